@@ -5,7 +5,9 @@
 //===========================================================================//
 
 #include "stdafx.h"
+#include "AutosaveJournal.h"
 #include "collisionutils.h"
+#include "EntityIndex.h"
 #include "fgdlib/gdclass.h"
 #include "IEditorTexture.h"
 #include "GlobalFunctions.h"
@@ -194,6 +196,7 @@ CMapEntity::CMapEntity(void) : flags(0)
 	m_pAnimatorChild = NULL;
 	m_vecLogicalPosition.Init( COORD_NOTINIT, COORD_NOTINIT );
 	m_bIsInstance = false;
+	m_pEntityIndex = NULL;
 	CalculateTypeFlags();
 }
 
@@ -204,6 +207,11 @@ CMapEntity::CMapEntity(void) : flags(0)
 CMapEntity::~CMapEntity(void)
 {
 	SignalChanged();
+
+	if (m_pEntityIndex != NULL)
+	{
+		m_pEntityIndex->RemoveEntity(this);
+	}
 }
 
 
@@ -549,6 +557,11 @@ CMapClass *CMapEntity::CopyFrom(CMapClass *pobj, bool bUpdateDependencies)
 	CEditGameClass::CopyFrom(pFrom);
 	const char *pszNewTargetName = CEditGameClass::GetKeyValue("targetname");
 
+	if (m_pEntityIndex != NULL)
+	{
+		m_pEntityIndex->UpdateEntity(this);
+	}
+
 	if ((bUpdateDependencies) && (pszNewTargetName != NULL))
 	{
 		if (stricmp(szOldTargetName, pszNewTargetName) != 0)
@@ -942,6 +955,11 @@ void CMapEntity::SetClass(LPCTSTR pszClass, bool bLoading)
 	CEditGameClass::SetClass(pszClass, bLoading);
 	UpdateObjectColor();
 
+	if (m_pEntityIndex != NULL)
+	{
+		m_pEntityIndex->UpdateEntity(this);
+	}
+
 	//
 	// If our new class is defined in the FGD, set our color and our default keys
 	// from the class.
@@ -1030,6 +1048,8 @@ void CMapEntity::CalculateTypeFlags( void )
 
 void CMapEntity::SignalChanged( void )
 {
+	CAutosaveJournal::ObjectChanged( this );
+
 	if ( m_EntityTypeFlags & ENTITY_FLAG_IS_LIGHT )
 		SignalUpdate( EVTYPE_LIGHTING_CHANGED );
 }
@@ -1428,6 +1448,12 @@ void CMapEntity::OnPaste(CMapClass *pCopy, CMapWorld *pSourceWorld, CMapWorld *p
 //-----------------------------------------------------------------------------
 void CMapEntity::OnKeyValueChanged(const char *pszKey, const char *pszOldValue, const char *pszValue)
 {
+	// Keep the world's key indices up to date before anything looks us up by the new value.
+	if ((m_pEntityIndex != NULL) && m_pEntityIndex->IsKeyIndexed(pszKey))
+	{
+		m_pEntityIndex->UpdateEntity(this);
+	}
+
 	// notify all our children that a key has changed
 
 	FOR_EACH_OBJ( m_Children, pos )
@@ -663,7 +663,7 @@ bool CMapInstance::LoadVMFInternal( const char* pVMFPath )
 	m_pTemplate->SetVMFPath( pVMFPath );
 
 	CChunkFile file;
-	ChunkFileResult_t eResult = file.Open( pVMFPath, ChunkFile_Read );
+	ChunkFileResult_t eResult = file.Open( pVMFPath, ChunkFile_ReadMapped );
 	if ( eResult == ChunkFile_Ok )
 	{
 		ChunkFileResult_t( *LoadWorldCallback )( CChunkFile*, CMapInstance* ) = []( CChunkFile* pFile, CMapInstance* pDoc )
@@ -786,7 +786,7 @@ bool CMapInstance::Collapse( bool bRecursive, InstanceCollapseData_t& collapseDa
 	const int visCount = collapseData.visGroups.Count();
 
 	CChunkFile file;
-	ChunkFileResult_t eResult = file.Open( instancePath, ChunkFile_Read );
+	ChunkFileResult_t eResult = file.Open( instancePath, ChunkFile_ReadMapped );
 	if ( eResult == ChunkFile_Ok )
 	{
 		ChunkFileResult_t( *LoadWorldCallback )( CChunkFile*, InstanceCollapseData_t* ) = []( CChunkFile* pFile, InstanceCollapseData_t* pDoc )->ChunkFileResult_t
@@ -21,6 +21,7 @@
 #include "camera.h"
 #include "ssolid.h"
 #include "TextureSystem.h"
+#include "tier0/threadtools.h"
 
 // memdbgon must be the last include file in a .cpp file!!!
 #include <tier0/memdbgon.h>
@@ -33,6 +34,10 @@ IMPLEMENT_MAPCLASS(CMapSolid)
 
 
 int CMapSolid::g_nBadSolidCount = 0;
+CMapSolidLoadQueue *CMapSolid::s_pLoadQueue = NULL;
+
+#define LOADQUEUE_MAX_THREADS	32
+#define LOADQUEUE_BATCH_SIZE	64		// Solids per job handed to the worker threads.
 
 
 //-----------------------------------------------------------------------------
@@ -55,6 +60,12 @@ CMapSolid::CMapSolid(CMapClass *Parent0)
 //-----------------------------------------------------------------------------
 CMapSolid::~CMapSolid(void)
 {
+	// Solids can be thrown away with their entity before the queue gets to them.
+	if (s_pLoadQueue != NULL)
+	{
+		s_pLoadQueue->RemoveSolid(this);
+	}
+
 	Faces.SetCount(0);
 }
 
@@ -1101,40 +1112,18 @@ ChunkFileResult_t CMapSolid::LoadVMF(CChunkFile *pFile, bool &bValid)
 	if (eResult == ChunkFile_Ok)
 	{
 		//
-		// Create the solid using the planes that were read from the MAP file.
+		// If the document is loading, let it build us along with everything else
+		// once the file has been read. Until then we are assumed to be valid.
 		//
-		if (CreateFromPlanes(m_bFacesHavePoints ? CREATE_ALREADY_HAS_POINTS : 0))
+		if ((s_pLoadQueue != NULL) && !HasDisp())
 		{
+			s_pLoadQueue->AddSolid(this);
 			bValid = true;
-			CalcBounds();
-
-			//
-			// Set solid type based on texture name.
-			//
-			m_eSolidType = HL1SolidTypeFromTextureName(Faces[0].texture.texture);
-
-			//
-			// create all of the displacement surfaces for faces with the displacement property
-			//
-			int faceCount = GetFaceCount();
-			for( int i = 0; i < faceCount; i++ )
-			{
-				CMapFace *pFace = GetFace( i );
-				if( !pFace->HasDisp() )
-					continue;
-
-				EditDispHandle_t handle = pFace->GetDisp();
-				CMapDisp *pMapDisp = EditDispMgr()->GetDisp( handle );
-				pMapDisp->InitDispSurfaceData( pFace, false );
-				pMapDisp->Create();
-				pMapDisp->PostLoad();
-			}
-
-			// There once was a bug that caused black solids. Fix it here.
-			if ((r == 0) && (g == 0) && (b == 0))
-			{
-				PickRandomColor();
-			}
+		}
+		else if (BuildLoadedSolid())
+		{
+			bValid = true;
+			FinishLoadedSolid();
 		}
 		else
 		{
@@ -1146,6 +1135,197 @@ ChunkFileResult_t CMapSolid::LoadVMF(CChunkFile *pFile, bool &bValid)
 }
 
 
+//-----------------------------------------------------------------------------
+// Purpose: Creates the solid using the planes that were read from the VMF file.
+//			Doesn't touch anything but this solid unless it has displacements,
+//			so CMapSolidLoadQueue can call it from its worker threads.
+// Output : Returns true if the solid is valid.
+//-----------------------------------------------------------------------------
+bool CMapSolid::BuildLoadedSolid(void)
+{
+	if (!CreateFromPlanes(m_bFacesHavePoints ? CREATE_ALREADY_HAS_POINTS : 0))
+	{
+		return(false);
+	}
+
+	CalcBounds();
+	return(true);
+}
+
+
+//-----------------------------------------------------------------------------
+// Purpose: The rest of loading a valid solid, done on the main thread after
+//			BuildLoadedSolid.
+//-----------------------------------------------------------------------------
+void CMapSolid::FinishLoadedSolid(void)
+{
+	//
+	// Set solid type based on texture name.
+	//
+	m_eSolidType = HL1SolidTypeFromTextureName(Faces[0].texture.texture);
+
+	//
+	// create all of the displacement surfaces for faces with the displacement property
+	//
+	int faceCount = GetFaceCount();
+	for( int i = 0; i < faceCount; i++ )
+	{
+		CMapFace *pFace = GetFace( i );
+		if( !pFace->HasDisp() )
+			continue;
+
+		EditDispHandle_t handle = pFace->GetDisp();
+		CMapDisp *pMapDisp = EditDispMgr()->GetDisp( handle );
+		pMapDisp->InitDispSurfaceData( pFace, false );
+		pMapDisp->Create();
+		pMapDisp->PostLoad();
+	}
+
+	// There once was a bug that caused black solids. Fix it here.
+	if ((r == 0) && (g == 0) && (b == 0))
+	{
+		PickRandomColor();
+	}
+}
+
+
+CMapSolidLoadQueue::CMapSolidLoadQueue(void)
+{
+	m_nNextBuildJob = -1;
+}
+
+
+//-----------------------------------------------------------------------------
+// Purpose: Queues a solid that has been read but not built yet.
+//-----------------------------------------------------------------------------
+void CMapSolidLoadQueue::AddSolid(CMapSolid *pSolid)
+{
+	//
+	// Materials load themselves the first time they are asked for their size,
+	// which isn't safe to do from the worker threads. Do it here.
+	//
+	int nFaces = pSolid->GetFaceCount();
+	for (int i = 0; i < nFaces; i++)
+	{
+		IEditorTexture *pTexture = pSolid->GetFace(i)->GetTexture();
+		if (pTexture != NULL)
+		{
+			pTexture->GetWidth();
+		}
+	}
+
+	m_Solids.AddToTail(pSolid);
+}
+
+
+//-----------------------------------------------------------------------------
+// Purpose: Forgets a queued solid that is being deleted. Searches from the end
+//			since it's almost always one of the last solids read.
+//-----------------------------------------------------------------------------
+void CMapSolidLoadQueue::RemoveSolid(CMapSolid *pSolid)
+{
+	for (int i = m_Solids.Count() - 1; i >= 0; i--)
+	{
+		if (m_Solids[i] == pSolid)
+		{
+			m_Solids.Remove(i);
+			return;
+		}
+	}
+}
+
+
+//-----------------------------------------------------------------------------
+// Purpose: Builds one batch of solids, called from the worker threads.
+//-----------------------------------------------------------------------------
+void CMapSolidLoadQueue::BuildJob(int nJob)
+{
+	int nFirst = nJob * LOADQUEUE_BATCH_SIZE;
+	int nLast = min(nFirst + LOADQUEUE_BATCH_SIZE, m_Solids.Count());
+	for (int i = nFirst; i < nLast; i++)
+	{
+		m_Valid[i] = m_Solids[i]->BuildLoadedSolid();
+	}
+}
+
+
+unsigned CMapSolidLoadQueue::BuildThreadFn(void *pParam)
+{
+	CMapSolidLoadQueue *pQueue = (CMapSolidLoadQueue *)pParam;
+	int nJobs = (pQueue->m_Solids.Count() + LOADQUEUE_BATCH_SIZE - 1) / LOADQUEUE_BATCH_SIZE;
+	for (;;)
+	{
+		int nJob = ThreadInterlockedIncrement(&pQueue->m_nNextBuildJob);
+		if (nJob >= nJobs)
+		{
+			break;
+		}
+		pQueue->BuildJob(nJob);
+	}
+	return 0;
+}
+
+
+//-----------------------------------------------------------------------------
+// Purpose: Builds every queued solid on all threads, then finishes them on this
+//			one in the order they were read. Bad solids are unlinked from their
+//			parents, deleted and counted in g_nBadSolidCount.
+//-----------------------------------------------------------------------------
+void CMapSolidLoadQueue::BuildSolids(void)
+{
+	int nSolids = m_Solids.Count();
+	if (nSolids == 0)
+	{
+		return;
+	}
+
+	double flStartTime = Plat_FloatTime();
+
+	m_Valid.SetCount(nSolids);
+
+	int nJobs = (nSolids + LOADQUEUE_BATCH_SIZE - 1) / LOADQUEUE_BATCH_SIZE;
+	int nThreads = min(min(GetCPUInformation()->m_nLogicalProcessors, LOADQUEUE_MAX_THREADS), nJobs);
+	m_nNextBuildJob = -1;
+	ThreadHandle_t hThreads[LOADQUEUE_MAX_THREADS];
+	for (int i = 0; i < nThreads - 1; i++)
+	{
+		hThreads[i] = CreateSimpleThread(BuildThreadFn, this);
+	}
+	BuildThreadFn(this);		// This thread works too.
+	for (int i = 0; i < nThreads - 1; i++)
+	{
+		ThreadJoin(hThreads[i]);
+		ReleaseThreadHandle(hThreads[i]);
+	}
+
+	int nBadSolids = 0;
+	for (int i = 0; i < nSolids; i++)
+	{
+		CMapSolid *pSolid = m_Solids[i];
+		if (m_Valid[i])
+		{
+			pSolid->FinishLoadedSolid();
+			continue;
+		}
+
+		CMapClass *pParent = pSolid->GetParent();
+		if (pParent != NULL)
+		{
+			pParent->RemoveChild(pSolid, false);
+		}
+		delete pSolid;
+		nBadSolids++;
+	}
+
+	CMapSolid::g_nBadSolidCount += nBadSolids;
+
+	Msg(mwStatus, "Built %d loaded solids in %.1f ms on %d threads.", nSolids, (Plat_FloatTime() - flStartTime) * 1000.0, nThreads);
+
+	m_Solids.RemoveAll();
+	m_Valid.RemoveAll();
+}
+
+
 //-----------------------------------------------------------------------------
 // Purpose: Picks a random shade of blue/green for this solid.
 //-----------------------------------------------------------------------------
@@ -26,6 +26,7 @@
 #include "MapSolid.h"
 #include "MapStudioModel.h"
 #include "MapWorld.h"
+#include "MapTraceTree.h"
 #include "MapView3D.h"
 #include "MapView2D.h"
 #include "ObjectBar.h"
@@ -1185,12 +1186,21 @@ void CMapView3D::UpdateView(int nFlags)
 //-----------------------------------------------------------------------------
 // Purpose: Determines the object at the point (point.x, point.y) in the 3D view.
 // Input  : point - Point to use for hit test.
-//			ulFace - Index of face in object that was hit.
+//			ulFace - Index of face in object that was hit, as the selection
+//				buffer reports it unless pFaceHit is given.
+//			pFaceHit - If the object is a solid, returns where the ray hits the
+//				face, with a NULL face if it misses. Only pass it when the hit
+//				is needed, it costs a trace.
 // Output : Returns a pointer to the CMapClass object at the coordinates, NULL if none.
 //-----------------------------------------------------------------------------
-CMapClass *CMapView3D::NearestObjectAt(const Vector2D &vPoint, ULONG &ulFace)
+CMapClass *CMapView3D::NearestObjectAt(const Vector2D &vPoint, ULONG &ulFace, MapTraceHit_t *pFaceHit)
 {
 	ulFace = 0;
+	if (pFaceHit != NULL)
+	{
+		pFaceHit->pFace = NULL;
+	}
+
 	if (m_pRender == NULL)
 	{
 		return(NULL);
@@ -1209,6 +1219,10 @@ CMapClass *CMapView3D::NearestObjectAt(const Vector2D &vPoint, ULONG &ulFace)
 		if (pSolid != NULL)
 		{
 			ulFace = Hits.uData;
+			if (pFaceHit != NULL)
+			{
+				TraceSolidFace(vPoint, pSolid, ulFace, *pFaceHit);
+			}
 			return(pSolid);
 		}
 
@@ -1219,6 +1233,62 @@ CMapClass *CMapView3D::NearestObjectAt(const Vector2D &vPoint, ULONG &ulFace)
 }
 
 
+//-----------------------------------------------------------------------------
+// Purpose: Only lets the trace tree test the faces of one solid, and only the
+//			displaced ones if it has any, since those are all that's drawn.
+//-----------------------------------------------------------------------------
+static bool MapView3D_SolidTraceFilter(CMapFace *pFace, void *pParam)
+{
+	CMapSolid *pSolid = (CMapSolid *)pParam;
+	return((pFace->GetParent() == pSolid) && (pFace->HasDisp() || !pSolid->HasDisp()));
+}
+
+
+//-----------------------------------------------------------------------------
+// Purpose: Finds where the ray under the point hits the solid that the
+//			selection buffer put in front, through the world's trace tree.
+//			Solids the tree doesn't have, such as those in instances, are
+//			traced against the face the selection buffer reported.
+// Input  : vPoint - Point in client coordinates.
+//			pSolid - Solid under the point.
+//			ulFace - Face the selection buffer reported, returns the face hit.
+//			FaceHit - Returns the hit, left alone if the ray misses.
+//-----------------------------------------------------------------------------
+void CMapView3D::TraceSolidFace(const Vector2D &vPoint, CMapSolid *pSolid, ULONG &ulFace, MapTraceHit_t &FaceHit)
+{
+	Vector vecStart;
+	Vector vecEnd;
+	BuildRay(vPoint, vecStart, vecEnd);
+
+	MapTraceHit_t Hit;
+	CMapWorld *pWorld = GetMapDoc() ? GetMapDoc()->GetMapWorld() : NULL;
+	if ((pWorld != NULL) && pWorld->TraceTree_Get()->TraceNearest(vecStart, vecEnd, Hit, MapView3D_SolidTraceFilter, pSolid))
+	{
+		ulFace = pSolid->GetFaceIndex(Hit.pFace);
+	}
+	else
+	{
+		Hit.pSolid = pSolid;
+		Hit.pFace = pSolid->GetFace(ulFace);
+		Hit.nTri = -1;
+		if (!Hit.pFace->TraceLine(Hit.vecPos, Hit.vecNormal, vecStart, vecEnd))
+		{
+			Hit.pFace = NULL;
+		}
+		else
+		{
+			Vector vecDelta = vecEnd - vecStart;
+			Hit.flFraction = (Hit.vecPos - vecStart).Dot(vecDelta) / vecDelta.LengthSqr();
+		}
+	}
+
+	if (Hit.pFace != NULL)
+	{
+		FaceHit = Hit;
+	}
+}
+
+
 //-----------------------------------------------------------------------------
 // Purpose: Casts a ray from the viewpoint through the given plane and determines
 //			the point of intersection of the ray on the plane.
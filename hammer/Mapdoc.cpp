@@ -10,6 +10,7 @@
 #include <io.h>
 #include <direct.h>
 #include <mmsystem.h>
+#include "AutosaveJournal.h"
 #include "BuildNum.h"
 #include "CustomMessages.h"
 #include "EntityReportDlg.h"
@@ -26,10 +27,12 @@
 #include "MapEntity.h"
 #include "MapGroup.h"
 #include "MapInfoDlg.h"
+#include "MapOverlay.h"
 #include "MapSolid.h"
 #include "MapView2D.h"
 #include "MapViewLogical.h"
 #include "MapView3D.h"
+#include "MapTraceTree.h"
 #include "MapWorld.h"
 #include "NewVisGroupDlg.h"
 #include "ObjectProperties.h"
@@ -415,6 +418,7 @@ CMapDoc::CMapDoc(void)
 	m_bNeedsAutosave = false;
 	m_bIsAutosave = false;
 	m_strAutosavedFrom = "";
+	m_pAutosaveJournal = new CAutosaveJournal(this);
 
 	m_bIsCordoning = false;
 	m_vCordonMins = Vector(-1024,-1024,-1024);
@@ -448,6 +452,7 @@ CMapDoc::~CMapDoc(void)
 
 	delete m_pSelection;
 	delete m_pToolManager;
+	delete m_pAutosaveJournal;
 
 	OnDisableLightPreview();
 }
@@ -1401,12 +1406,35 @@ bool CMapDoc::LoadVMF(const char *pszFileName)
 	bool bLocked = VisGroups_LockUpdates( true );
 
 	//
-	// Open the file.
+	// Open the file. Autosaves may have a journal of later changes next to them,
+	// in which case we load the two merged.
 	//
 	CChunkFile File;
-	ChunkFileResult_t eResult = File.Open(pszFileName, ChunkFile_Read);
+	CUtlBuffer JournaledFile;
+	ChunkFileResult_t eResult = ChunkFile_Fail;
+	if (CAutosaveJournal::HasJournal(pszFileName))
+	{
+		eResult = CAutosaveJournal::Replay(pszFileName, JournaledFile);
+		if (eResult == ChunkFile_Ok)
+		{
+			eResult = File.Open(JournaledFile, ChunkFile_ReadMapped);
+		}
+
+		if (eResult != ChunkFile_Ok)
+		{
+			File.Close();
+			Msg(mwWarning, "Couldn't apply the autosave journal for %s (%s), loading the file without it.", pszFileName, File.GetErrorText(eResult));
+		}
+	}
+
+	if (eResult != ChunkFile_Ok)
+	{
+		eResult = File.Open(pszFileName, ChunkFile_ReadMapped);
+	}
 	pProgDlg->StepIt();
 
+	CMapSolidLoadQueue SolidLoadQueue;
+
 	//
 	// Read the file.
 	//
@@ -1442,9 +1470,13 @@ bool CMapDoc::LoadVMF(const char *pszFileName)
 		//
 
 		pProgDlg->SetWindowText( "Reading Chunks..." );
-		while (eResult == ChunkFile_Ok)
 		{
-			eResult = File.ReadChunk();
+			// Solids are only parsed here, SolidLoadQueue builds them all at once below.
+			CAutoPushPop<CMapSolidLoadQueue *> loadQueue( CMapSolid::s_pLoadQueue, &SolidLoadQueue );
+			while (eResult == ChunkFile_Ok)
+			{
+				eResult = File.ReadChunk();
+			}
 		}
 		pProgDlg->SetStep(5000);
 		pProgDlg->StepIt();
@@ -1460,6 +1492,9 @@ bool CMapDoc::LoadVMF(const char *pszFileName)
 
 	if (eResult == ChunkFile_Ok)
 	{
+		pProgDlg->SetWindowText( "Building Solids..." );
+		SolidLoadQueue.BuildSolids();
+
 		pProgDlg->SetWindowText( "Postload Processing..." );
 		Postload();
 		pProgDlg->StepIt();
@@ -1707,6 +1742,10 @@ void CMapDoc::Postload(void)
 	m_pWorld->CullTree_Build();
 	pProgDlg->StepIt();
 
+	const EntityIndexStats_t &IndexStats = m_pWorld->EntityIndex_GetStats();
+	Msg(mwStatus, "Indexed %d entities: %d values of %d keys, %d trie nodes.",
+		IndexStats.m_nEntities, IndexStats.m_nValues, IndexStats.m_nKeys, IndexStats.m_nTrieNodes);
+
 	// We disabled building detail objects above to prevent it from generating them extra times.
 	// Now generate the ones that need to be generated.
 	pProgDlg->SetWindowText( "Building Detail Objects..." );
@@ -2272,6 +2311,12 @@ BOOL CMapDoc::OnOpenDocument(LPCTSTR lpszPathName)
 		return(FALSE);
 	}
 
+	// Autosaves from here on are relative to this file.
+	if (!m_bPrefab)
+	{
+		m_pAutosaveJournal->SetBase(lpszPathName, false);
+	}
+
 	SetModifiedFlag(FALSE);
 	Msg(mwStatus, "Opened %s", lpszPathName);
 	SetActiveMapDoc(this);
@@ -3700,13 +3745,12 @@ void CMapDoc::GetBestPastePoint(Vector &vecPasteOrigin)
 
 			if ( p3DView )
 			{
-				HitInfo_t Hits;
+				ULONG ulFace;
+				MapTraceHit_t FaceHit;
+				CMapClass *pObject = p3DView->NearestObjectAt( vPoint, ulFace, &FaceHit );
 
-				if ( p3DView->ObjectsAt( vPoint, &Hits, 1 ) )
+				if ( pObject != NULL )
 				{
-					// If they clicked on a solid, the index of the face they clicked on is stored
-					// in array index [1].
-					CMapClass *pObject = Hits.pObject;
 					CMapSolid *pSolid = dynamic_cast<CMapSolid *>(pObject);
 
 					Vector HitPos,HitNormal;
@@ -3719,12 +3763,15 @@ void CMapDoc::GetBestPastePoint(Vector &vecPasteOrigin)
 
 					if (pSolid != NULL)
 					{
-						// Build a ray to trace against the face that they clicked on to
-						// find the point of intersection.
-						CMapFace *pFace = pSolid->GetFace(Hits.uData);
-						bOk = pFace->TraceLine(HitPos, HitNormal, start, end);
+						// Paste where the ray hit the face that they clicked on.
+						if ( FaceHit.pFace != NULL )
+						{
+							HitPos = FaceHit.vecPos;
+							HitNormal = FaceHit.vecNormal;
+							bOk = true;
+						}
 					}
-					else if ( pObject != NULL )
+					else
 					{
 						// we hit something, just trace against bound box
 						pObject->GetRender2DBox( mins, maxs );
@@ -4221,7 +4268,7 @@ void CMapDoc::OnFileSaveAs(void)
 			strcpy(szBaseDir, m_pGame->szMapDir);
 		}
 
-		char *pszFilter = "Valve Map Files (*.vmf)|*.vmf||";
+		char *pszFilter = "Valve Map Files (*.vmf)|*.vmf|Binary Valve Map Files (*.vmfb)|*.vmfb||";
 
 		CFileDialog dlg(FALSE, NULL, str, OFN_LONGNAMES | OFN_NOCHANGEDIR |	OFN_HIDEREADONLY, pszFilter);
 		dlg.m_ofn.lpstrInitialDir = szBaseDir;
@@ -4235,9 +4282,10 @@ void CMapDoc::OnFileSaveAs(void)
 		str = dlg.GetPathName();
 
 		// Make sure we've got a .vmt extension, or else compile tools won't work.
-		CString wantedExtension = ".vmf";
+		// Binary maps get a .vmf written next to them when they're compiled.
+		CString wantedExtension = ( dlg.m_ofn.nFilterIndex == 2 ) ? ".vmfb" : ".vmf";
 
-		CString extension = str.Right( 4 );
+		CString extension = str.Right( wantedExtension.GetLength() );
 		extension.MakeLower();
 		if ( extension != wantedExtension )
 			str += wantedExtension;
@@ -4508,6 +4556,12 @@ void CMapDoc::OnFileRunmap(void)
 	}
 	strFile.MakeLower();
 
+	// The compile tools only read text, so binary maps are compiled from a .VMF saved next to them.
+	if (strFile.Right(5) == ".vmfb")
+	{
+		strEditExtension = ".vmfb";
+	}
+
 	// Make sure it has the correct extension for compilation (.VMF or .MAP).
 	int iPos = strFile.Find(strEditExtension);
 	Assert(iPos != -1);
@@ -4517,7 +4571,7 @@ void CMapDoc::OnFileRunmap(void)
 		strFile.ReleaseBuffer();
 
 		// Make sure the .MAP version is up to date.
-		if (bWasModified)
+		if (bWasModified || (GetFileAttributes(strFile) == 0xFFFFFFFF))
 		{
 			OnSaveDocument(strFile);
 		}
@@ -5581,13 +5635,10 @@ BOOL CMapDoc::OnUndoRedo(UINT nID)
 	// Do the undo/redo.
 
 	CMapObjectList NewSelection;
-	if (nID == ID_EDIT_UNDO)
-	{
-		m_pUndo->Undo(&NewSelection);
-	}
-	else
+	CHistory *pHistory = (nID == ID_EDIT_UNDO) ? m_pUndo : m_pRedo;
+	if (!pHistory->Undo(&NewSelection))
 	{
-		m_pRedo->Undo(&NewSelection);
+		return(TRUE);
 	}
 
 	// Change the selection to the objects that the undo system says
@@ -8615,14 +8666,24 @@ ChunkFileResult_t CMapDoc::CordonSaveVMF(CChunkFile *pFile, CSaveInfo *pSaveInfo
 }
 
 //-----------------------------------------------------------------------------
-// Purpose:
+// Purpose: Saves the map. Autosaves and .vmfb files are written in the binary
+//			chunk file format, which saves much faster and loads the same way.
 // Input  : *pszFileName -
 //-----------------------------------------------------------------------------
 bool CMapDoc::SaveVMF(const char *pszFileName, int saveFlags )
 {
+	// Autosave jobs may be reading or writing this file.
+	m_pAutosaveJournal->Flush();
+
 	CChunkFile File;
 
-	ChunkFileResult_t eResult = File.Open(pszFileName, ChunkFile_Write);
+	ChunkFileOpenMode_t eMode = ChunkFile_Write;
+	if ((saveFlags & SAVEFLAGS_AUTOSAVE) || !Q_stricmp(V_GetFileExtension(pszFileName), "vmfb"))
+	{
+		eMode = ChunkFile_WriteBinary;
+	}
+
+	ChunkFileResult_t eResult = File.Open(pszFileName, eMode);
 	BeginWaitCursor();
 
 	// Change the main title bar.
@@ -8728,7 +8789,12 @@ bool CMapDoc::SaveVMF(const char *pszFileName, int saveFlags )
 			}
 		}
 
-		File.Close();
+		// Binary files are written out when they're closed.
+		ChunkFileResult_t eCloseResult = File.Close();
+		if (eResult == ChunkFile_Ok)
+		{
+			eResult = eCloseResult;
+		}
 	}
 
 	// Restore the main window's title.
@@ -8742,12 +8808,63 @@ bool CMapDoc::SaveVMF(const char *pszFileName, int saveFlags )
 	{
 		//save filename into registry for last known good file for crash recovery purposes.
 		AfxGetApp()->WriteProfileString("General", "Last Good Save", pszFileName);
+
+		// Any journal next to the file was for what used to be in it.
+		char szJournal[MAX_PATH];
+		Q_snprintf(szJournal, sizeof(szJournal), "%s%s", pszFileName, AUTOSAVE_JOURNAL_EXTENSION);
+		DeleteFile(szJournal);
+
+		//
+		// A file with everything in it is where the next autosave can start from.
+		//
+		if (!m_bPrefab && !m_bSaveVisiblesOnly && !(saveFlags & SAVEFLAGS_LIGHTSONLY))
+		{
+			m_pAutosaveJournal->SetBase(pszFileName, (saveFlags & SAVEFLAGS_AUTOSAVE) != 0);
+		}
 	}
 
 	EndWaitCursor();
 	return(true);
 }
 
+
+//-----------------------------------------------------------------------------
+// Purpose: Writes an autosave journal entry: what SaveVMF writes, except that
+//			only the solids, groups and entities picked by pSaveInfo are saved
+//			and cordon brushes are left out.
+//-----------------------------------------------------------------------------
+ChunkFileResult_t CMapDoc::SaveJournalEntryVMF(CChunkFile *pFile, CSaveInfo *pSaveInfo)
+{
+	ChunkFileResult_t eResult = SaveVersionInfoVMF(pFile, true);
+
+	if (eResult == ChunkFile_Ok)
+	{
+		eResult = VisGroups_SaveVMF(pFile, pSaveInfo);
+	}
+
+	if (eResult == ChunkFile_Ok)
+	{
+		eResult = SaveViewSettingsVMF(pFile, pSaveInfo);
+	}
+
+	if (eResult == ChunkFile_Ok)
+	{
+		eResult = m_pWorld->SaveVMF(pFile, pSaveInfo, 0);
+	}
+
+	if (eResult == ChunkFile_Ok)
+	{
+		eResult = m_pToolManager->SaveVMF(pFile, pSaveInfo);
+	}
+
+	if (eResult == ChunkFile_Ok)
+	{
+		eResult = CordonSaveVMF(pFile, pSaveInfo);
+	}
+
+	return(eResult);
+}
+
 //-----------------------------------------------------------------------------
 // Purpose: Saves the version information chunk.
 // Input  : *pFile -
@@ -8982,6 +9099,9 @@ void CMapDoc::Update(void)
 {
 	ProcessNotifyList();
 
+	// Overlays whose faces changed since the last update are clipped together.
+	CMapOverlay::UpdateDirtyOverlays();
+
 	if (m_UpdateList.Count()>0)
 	{
 		//
@@ -10209,7 +10329,7 @@ void CMapDoc::CollapseInstances( bool bSelected, bool bRecursive )
 			m_pWorld->AddChild( c.GetObject() );
 			c->PostloadWorld( m_pWorld );
 			m_pWorld->EntityList_Add( c.GetObject() );
-			m_pWorld->m_pCullTree->UpdateCullTreeObjectRecurse( c.GetObject() );
+			m_pWorld->m_pCullTree->UpdateObject( c.GetObject() );
 			// TODO: renumber faceids and nodeids
 		}
 	}
@@ -11,6 +11,7 @@
 #include "MapDoc.h"
 #include "MapDecal.h"
 #include "MapSolid.h"
+#include "MapTraceTree.h"
 #include "MapView3D.h"
 #include "resource.h"
 #include "ToolManager.h"
@@ -85,9 +86,10 @@ bool CToolDecal::OnLMouseDown3D(CMapView3D *pView, UINT nFlags, const Vector2D &
 	CMapDoc *pDoc = pView->GetMapDoc();
 
 	ULONG ulFace;
+	MapTraceHit_t Hit;
 	CMapClass *pObject;
 
-	if ((pObject = pView->NearestObjectAt( vPoint, ulFace)) != NULL)
+	if ((pObject = pView->NearestObjectAt( vPoint, ulFace, &Hit)) != NULL)
 	{
 		CMapSolid *pSolid = dynamic_cast <CMapSolid *> (pObject);
 		if (pSolid == NULL)
@@ -96,22 +98,16 @@ bool CToolDecal::OnLMouseDown3D(CMapView3D *pView, UINT nFlags, const Vector2D &
 		}
 
 		//
-		// Build a ray to trace against the face that they clicked on to
-		// find the point of intersection.
-		//			
-		Vector Start,End;
-		pView->GetCamera()->BuildRay( vPoint, Start, End);
-
-		Vector HitPos, HitNormal;
-		CMapFace *pFace = pSolid->GetFace(ulFace);
-		if (pFace->TraceLine(HitPos, HitNormal, Start, End))
+		// Place the decal where the ray hit the face that they clicked on.
+		//
+		if (Hit.pFace != NULL)
 		{
 			GetHistory()->MarkUndoPosition(NULL, "Create decal");
 
 			CMapEntity *pEntity = new CMapEntity;
 			pEntity->SetKeyValue("texture", GetDefaultTextureName());
 			pEntity->SetPlaceholder(TRUE);
-			pEntity->SetOrigin(HitPos);
+			pEntity->SetOrigin(Hit.vecPos);
 			pEntity->SetClass("infodecal");
 
 			CMapWorld *pWorld = pDoc->GetMapWorld();
@@ -10,6 +10,7 @@
 #include "MapDefs.h"
 #include "MapSolid.h"
 #include "MapDoc.h"
+#include "MapTraceTree.h"
 #include "MapView2D.h"
 #include "MapView3D.h"
 #include "Material.h"
@@ -500,7 +501,8 @@ void CToolEntity::OnEscape(void)
 bool CToolEntity::OnLMouseDown3D(CMapView3D *pView, UINT nFlags, const Vector2D &vPoint)
 {
 	ULONG ulFace;
-	CMapClass *pObject = pView->NearestObjectAt( vPoint, ulFace);
+	MapTraceHit_t Hit;
+	CMapClass *pObject = pView->NearestObjectAt( vPoint, ulFace, &Hit);
 
 	Tool3D::OnLMouseDown3D(pView, nFlags, vPoint);
 
@@ -513,16 +515,11 @@ bool CToolEntity::OnLMouseDown3D(CMapView3D *pView, UINT nFlags, const Vector2D
 			return true;
 		}
 
-		// Build a ray to trace against the face that they clicked on to
-		// find the point of intersection.
-		
-		Vector Start,End;
-		pView->GetCamera()->BuildRay( vPoint, Start, End);
-
-		Vector HitPos, HitNormal;
-		CMapFace *pFace = pSolid->GetFace(ulFace);
-		if (pFace->TraceLine(HitPos, HitNormal, Start, End))
+		// Place the new object where the ray hit the face that they clicked on.
+		if (Hit.pFace != NULL)
 		{
+			Vector HitPos = Hit.vecPos;
+
 			CMapClass *pNewObject = NULL;
 		
 			if (GetMainWnd()->m_ObjectBar.IsEntityToolCreatingPrefab())
@@ -559,7 +556,7 @@ bool CToolEntity::OnLMouseDown3D(CMapView3D *pView, UINT nFlags, const Vector2D
 				pEntity->SetClass(CObjectBar::GetDefaultEntityClass());
 				
 				// Align the entity on the plane properly
-				pEntity->AlignOnPlane(HitPos, &pFace->plane, (HitNormal.z > 0.0f) ? CMapEntity::ALIGN_BOTTOM : CMapEntity::ALIGN_TOP);
+				pEntity->AlignOnPlane(HitPos, &Hit.pFace->plane, (Hit.vecNormal.z > 0.0f) ? CMapEntity::ALIGN_BOTTOM : CMapEntity::ALIGN_TOP);
 
 				pNewObject = pEntity;
 			}
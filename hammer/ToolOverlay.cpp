@@ -17,6 +17,7 @@
 #include "MapView3D.h"
 #include "MapView2D.h"
 #include "MapSolid.h"
+#include "MapTraceTree.h"
 #include "Camera.h"
 #include "ObjectProperties.h"  // FIXME: For ObjectProperties::RefreshData
 #include "Selection.h"
@@ -85,13 +86,17 @@ bool CToolOverlay::OnLMouseDown3D( CMapView3D *pView, UINT nFlags, const Vector2
 
 	// Handle the overlay creation and placement (if we hit a solid).
 	ULONG ulFace;
+	MapTraceHit_t hit;
 	CMapClass *pObject = NULL;
-	if ( ( pObject = pView->NearestObjectAt( vPoint, ulFace ) ) != NULL )
+	if ( ( pObject = pView->NearestObjectAt( vPoint, ulFace, &hit ) ) != NULL )
 	{
 		CMapSolid *pSolid = dynamic_cast<CMapSolid*>( pObject );
 		if ( pSolid )
 		{
-			return CreateOverlay( pSolid, ulFace, pView, vPoint );
+			if ( !hit.pFace )
+				return false;
+
+			return CreateOverlay( hit.pFace, hit.vecPos );
 		}
 	}
 
@@ -121,49 +126,37 @@ bool CToolOverlay::OnMouseMove3D( CMapView3D *pView, UINT nFlags, const Vector2D
 
 //-----------------------------------------------------------------------------
 //-----------------------------------------------------------------------------
-bool CToolOverlay::CreateOverlay( CMapSolid *pSolid, ULONG iFace, CMapView3D *pView, Vector2D point )
+bool CToolOverlay::CreateOverlay( CMapFace *pFace, const Vector &vecHitPos )
 {
-	// Build a ray to trace against the face that they clicked on to
-	// find the point of intersection.
-	Vector vecStart, vecEnd;
-	pView->BuildRay( point, vecStart, vecEnd );
+	// Create and initialize the "entity" --> "overlay."
+	CMapEntity *pEntity = new CMapEntity;
+	pEntity->SetKeyValue( "material", GetDefaultTextureName() );
+	pEntity->SetPlaceholder( TRUE );
+	pEntity->SetOrigin( vecHitPos );
+	pEntity->SetClass( "info_overlay" );				
 	
-	Vector vecHitPos, vecHitNormal;
-	CMapFace *pFace = pSolid->GetFace( iFace );
-	if( pFace->TraceLine( vecHitPos, vecHitNormal, vecStart, vecEnd ) )
-	{
-		// Create and initialize the "entity" --> "overlay."
-		CMapEntity *pEntity = new CMapEntity;
-		pEntity->SetKeyValue( "material", GetDefaultTextureName() );
-		pEntity->SetPlaceholder( TRUE );
-		pEntity->SetOrigin( vecHitPos );
-		pEntity->SetClass( "info_overlay" );				
-		
-		// Add the entity to the world.
-		m_pDocument->AddObjectToWorld( pEntity );
-		
-		// Setup "history."
-		GetHistory()->MarkUndoPosition( NULL, "Create Overlay" );
-		GetHistory()->KeepNew( pEntity );
-				
-		// Initialize the overlay.
-		InitOverlay( pEntity, pFace );
-
-		pEntity->CalcBounds( TRUE );
-		
-		// Add to selection list.
-		m_pDocument->SelectObject( pEntity, scSelect );
-		m_bEmpty = false;
-		
-		// Set modified and update views.
-		m_pDocument->SetModifiedFlag();
-		
-		m_pShoreline = NULL;
-
-		return true;
-	}
+	// Add the entity to the world.
+	m_pDocument->AddObjectToWorld( pEntity );
 	
-	return false;
+	// Setup "history."
+	GetHistory()->MarkUndoPosition( NULL, "Create Overlay" );
+	GetHistory()->KeepNew( pEntity );
+			
+	// Initialize the overlay.
+	InitOverlay( pEntity, pFace );
+
+	pEntity->CalcBounds( TRUE );
+	
+	// Add to selection list.
+	m_pDocument->SelectObject( pEntity, scSelect );
+	m_bEmpty = false;
+	
+	// Set modified and update views.
+	m_pDocument->SetModifiedFlag();
+	
+	m_pShoreline = NULL;
+
+	return true;
 }
 
 //-----------------------------------------------------------------------------
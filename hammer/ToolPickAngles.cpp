@@ -9,6 +9,7 @@
 #include "ToolPickAngles.h"
 #include "MapView3D.h"
 #include "MapSolid.h"
+#include "MapTraceTree.h"
 #include "camera.h"
 
 // memdbgon must be the last include file in a .cpp file!!!
@@ -55,7 +56,8 @@ bool CToolPickAngles::OnLMouseUp3D(CMapView3D *pView, UINT nFlags, const Vector2
 bool CToolPickAngles::OnLMouseDown3D(CMapView3D *pView, UINT nFlags, const Vector2D &vPoint)
 {
 	unsigned long ulFace;
-	CMapClass *pObject = pView->NearestObjectAt( vPoint, ulFace);
+	MapTraceHit_t Hit;
+	CMapClass *pObject = pView->NearestObjectAt( vPoint, ulFace, &Hit);
 	if (pObject != NULL)
 	{
 		CMapClass *pSelObject = pObject->PrepareSelection(selectObjects);
@@ -81,20 +83,13 @@ bool CToolPickAngles::OnLMouseDown3D(CMapView3D *pView, UINT nFlags, const Vecto
 			}
 
 			//
-			// Build a ray to trace against the face that they clicked on to
-			// find the point of intersection.
-			//			
-			Vector Start,End;
-			pView->GetCamera()->BuildRay( vPoint, Start, End);
-
-			Vector HitPos;
-			Vector HitNormal;
-			CMapFace *pFace = pSolid->GetFace(ulFace);
-			if (pFace->TraceLine(HitPos, HitNormal, Start, End))
+			// Point at where the ray hit the face that they clicked on.
+			//
+			if (Hit.pFace != NULL)
 			{
 				if (m_pNotifyTarget)
 				{
-					m_pNotifyTarget->OnNotifyPickAngles(HitPos);
+					m_pNotifyTarget->OnNotifyPickAngles(Hit.vecPos);
 				}
 			}
 		}
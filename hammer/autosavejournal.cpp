@@ -0,0 +1,1037 @@
+//========= Copyright Valve Corporation, All rights reserved. ============//
+//
+// Purpose: Incremental autosaves. See AutosaveJournal.h.
+//
+//=============================================================================//
+
+#include "stdafx.h"
+#include "AutosaveJournal.h"
+#include "GlobalFunctions.h"
+#include "MapDoc.h"
+#include "MapEntity.h"
+#include "MapGroup.h"
+#include "MapSolid.h"
+#include "MapWorld.h"
+#include "SaveInfo.h"
+
+// memdbgon must be the last include file in a .cpp file!!!
+#include <tier0/memdbgon.h>
+
+
+enum AutosaveJobType_t
+{
+	AUTOSAVE_JOB_APPEND = 0,		// Append the entry to m_szFile, a journal.
+	AUTOSAVE_JOB_COMPACT,			// Merge m_szBase, its journal and the entry into m_szFile.
+	AUTOSAVE_JOB_EXIT,
+};
+
+
+struct AutosaveJob_t
+{
+	AutosaveJobType_t m_eType;
+	char m_szBase[MAX_PATH];
+	char m_szFile[MAX_PATH];
+	CUtlBuffer m_Entry;
+	int m_nChanged;					// Objects in the entry.
+	double m_flEntryTime;			// Seconds spent writing the entry on the main thread.
+	double m_flJobTime;				// Seconds spent in the job.
+	bool m_bOk;
+};
+
+
+//-----------------------------------------------------------------------------
+// Purpose: Constructor.
+//-----------------------------------------------------------------------------
+CAutosaveJournal::CAutosaveJournal(CMapDoc *pDoc)
+{
+	m_pDoc = pDoc;
+	m_ChangedIDs.SetLessFunc(DefLessFunc(int));
+
+	m_szBase[0] = '\0';
+	m_bOwned = false;
+	m_bFailed = false;
+	m_nEntries = 0;
+	m_nBaseSize = 0;
+	m_nJournalSize = 0;
+	m_nSequence = 0;
+
+	m_hThread = NULL;
+	m_nPendingJobs = 0;
+}
+
+
+//-----------------------------------------------------------------------------
+// Purpose: Destructor. Finishes the queued jobs and stops the job thread.
+//-----------------------------------------------------------------------------
+CAutosaveJournal::~CAutosaveJournal(void)
+{
+	Flush();
+
+	if (m_hThread != NULL)
+	{
+		AutosaveJob_t *pJob = new AutosaveJob_t;
+		pJob->m_eType = AUTOSAVE_JOB_EXIT;
+		m_Jobs.QueueMessage(pJob);
+
+		ThreadJoin(m_hThread);
+		ReleaseThreadHandle(m_hThread);
+		m_hThread = NULL;
+	}
+}
+
+
+//-----------------------------------------------------------------------------
+// Purpose: Finds the document that the object is in and remembers that the
+//			object has changed. Objects that aren't in a document's world, and
+//			objects of documents that are being loaded, are ignored.
+//-----------------------------------------------------------------------------
+void CAutosaveJournal::ObjectChanged(CMapClass *pObject, bool bChildren)
+{
+	CMapWorld *pWorld = CMapClass::GetWorldObject(pObject);
+	if (pWorld == NULL)
+	{
+		return;
+	}
+
+	int nDocs = CMapDoc::GetDocumentCount();
+	for (int i = 0; i < nDocs; i++)
+	{
+		CMapDoc *pDoc = CMapDoc::GetDocument(i);
+		if (pDoc->GetMapWorld() == pWorld)
+		{
+			if (!pDoc->IsLoading() && (pDoc->GetAutosaveJournal() != NULL))
+			{
+				pDoc->GetAutosaveJournal()->MarkObject(pObject, bChildren);
+			}
+			return;
+		}
+	}
+}
+
+
+//-----------------------------------------------------------------------------
+// Purpose: Marks the object in the world's save lists that holds the given
+//			object: the object itself or the ancestor whose parent is the world
+//			or a group.
+//-----------------------------------------------------------------------------
+void CAutosaveJournal::MarkObject(CMapClass *pObject, bool bChildren)
+{
+	CMapClass *pSaved = pObject;
+	while ((pSaved->GetParent() != NULL) && !pSaved->GetParent()->IsGroup() && !IsWorldObject(pSaved->GetParent()))
+	{
+		pSaved = pSaved->GetParent();
+	}
+
+	if (pSaved->GetParent() == NULL)
+	{
+		// The world itself. Its keys go into every entry anyway.
+		return;
+	}
+
+	m_ChangedIDs.InsertIfNotFound(pSaved->GetID());
+
+	if (bChildren && pSaved->IsGroup())
+	{
+		pSaved->EnumChildrenRecurseGroupsOnly(MarkSaveListObject, this);
+	}
+}
+
+
+BOOL CAutosaveJournal::MarkSaveListObject(CMapClass *pObject, CAutosaveJournal *pJournal)
+{
+	pJournal->m_ChangedIDs.InsertIfNotFound(pObject->GetID());
+	return(TRUE);
+}
+
+
+//-----------------------------------------------------------------------------
+// Purpose: Adds the ID of an object that CMapWorld::SaveVMF writes a chunk for.
+//-----------------------------------------------------------------------------
+BOOL CAutosaveJournal::AddSaveListID(CMapClass *pObject, CUtlVector<int> *pIDs)
+{
+	if (!pObject->IsTemporary() &&
+		((dynamic_cast<CMapEntity *>(pObject) != NULL) || (dynamic_cast<CMapSolid *>(pObject) != NULL) || (dynamic_cast<CMapGroup *>(pObject) != NULL)))
+	{
+		pIDs->AddToTail(pObject->GetID());
+	}
+
+	return(TRUE);
+}
+
+
+static int __cdecl CompareIDs(const int *pID1, const int *pID2)
+{
+	return(*pID1 - *pID2);
+}
+
+
+//-----------------------------------------------------------------------------
+// Purpose: Gets the sorted IDs of everything in the world's save lists.
+//-----------------------------------------------------------------------------
+void CAutosaveJournal::GetSaveListIDs(CUtlVector<int> &IDs)
+{
+	IDs.RemoveAll();
+
+	CMapWorld *pWorld = m_pDoc->GetMapWorld();
+	if (pWorld != NULL)
+	{
+		pWorld->EnumChildrenRecurseGroupsOnly(AddSaveListID, &IDs);
+	}
+
+	IDs.Sort(CompareIDs);
+}
+
+
+//-----------------------------------------------------------------------------
+// Purpose: Makes the given file the one that following autosaves are relative
+//			to. Called after the document is loaded from or saved to a file.
+// Input  : pszFileName - File holding everything in the document, NULL for none.
+//			bOwned - True if the file is an autosave, which can have a journal
+//				appended to it. Other files are only ever read.
+//-----------------------------------------------------------------------------
+void CAutosaveJournal::SetBase(const char *pszFileName, bool bOwned)
+{
+	m_szBase[0] = '\0';
+	m_nBaseSize = 0;
+
+	if (pszFileName != NULL)
+	{
+		Q_strncpy(m_szBase, pszFileName, sizeof(m_szBase));
+
+		FILE *fp = fopen(pszFileName, "rb");
+		if (fp != NULL)
+		{
+			fseek(fp, 0, SEEK_END);
+			m_nBaseSize = ftell(fp);
+			fclose(fp);
+		}
+	}
+
+	m_bOwned = bOwned;
+	m_bFailed = false;
+	m_nEntries = 0;
+	m_nJournalSize = 0;
+
+	m_ChangedIDs.RemoveAll();
+	GetSaveListIDs(m_SavedIDs);
+}
+
+
+//-----------------------------------------------------------------------------
+// Purpose: Returns true if the next autosave can be appended to the journal.
+//			Journals are only appended to autosaves, and only until they get
+//			long enough that loading them would be slow.
+//-----------------------------------------------------------------------------
+bool CAutosaveJournal::CanAppend(void)
+{
+	return(CanCompact() && m_bOwned && (m_nEntries < AUTOSAVE_JOURNAL_MAX_ENTRIES) && (m_nJournalSize < m_nBaseSize / 4));
+}
+
+
+//-----------------------------------------------------------------------------
+// Purpose: Returns true if the next autosave can be merged with the base. If
+//			not, the whole document has to be saved.
+//-----------------------------------------------------------------------------
+bool CAutosaveJournal::CanCompact(void)
+{
+	return((m_szBase[0] != '\0') && !m_bFailed);
+}
+
+
+//-----------------------------------------------------------------------------
+// Purpose: Writes the objects that changed since the last entry into a new one.
+//			Objects that were added or removed count as changed.
+//-----------------------------------------------------------------------------
+bool CAutosaveJournal::WriteEntry(CUtlBuffer &Buffer)
+{
+	CUtlVector<int> IDs;
+	GetSaveListIDs(IDs);
+
+	int i = 0;
+	int j = 0;
+	while ((i < IDs.Count()) || (j < m_SavedIDs.Count()))
+	{
+		if ((j == m_SavedIDs.Count()) || ((i < IDs.Count()) && (IDs[i] < m_SavedIDs[j])))
+		{
+			m_ChangedIDs.InsertIfNotFound(IDs[i++]);
+		}
+		else if ((i == IDs.Count()) || (m_SavedIDs[j] < IDs[i]))
+		{
+			m_ChangedIDs.InsertIfNotFound(m_SavedIDs[j++]);
+		}
+		else
+		{
+			i++;
+			j++;
+		}
+	}
+
+	CChunkFile File;
+	ChunkFileResult_t eResult = File.Open(Buffer, ChunkFile_WriteBinary);
+
+	//
+	// The journal chunk lists everything that this entry replaces. Objects
+	// that are listed but not in the entry were deleted.
+	//
+	if (eResult == ChunkFile_Ok)
+	{
+		eResult = File.BeginChunk("journal");
+	}
+
+	if (eResult == ChunkFile_Ok)
+	{
+		eResult = File.WriteKeyValueInt("sequence", ++m_nSequence);
+	}
+
+	for (int nIndex = m_ChangedIDs.FirstInorder(); (eResult == ChunkFile_Ok) && (nIndex != m_ChangedIDs.InvalidIndex()); nIndex = m_ChangedIDs.NextInorder(nIndex))
+	{
+		eResult = File.WriteKeyValueInt("changed", m_ChangedIDs[nIndex]);
+	}
+
+	if (eResult == ChunkFile_Ok)
+	{
+		eResult = File.EndChunk();
+	}
+
+	if (eResult == ChunkFile_Ok)
+	{
+		CSaveInfo SaveInfo;
+		SaveInfo.SetObjectIDs(&m_ChangedIDs);
+		eResult = m_pDoc->SaveJournalEntryVMF(&File, &SaveInfo);
+	}
+
+	ChunkFileResult_t eCloseResult = File.Close();
+	if (eResult == ChunkFile_Ok)
+	{
+		eResult = eCloseResult;
+	}
+
+	if (eResult != ChunkFile_Ok)
+	{
+		Msg(mwError, "Autosave failed: %s", File.GetErrorText(eResult));
+		return(false);
+	}
+
+	m_SavedIDs.Swap(IDs);
+	return(true);
+}
+
+
+//-----------------------------------------------------------------------------
+// Purpose: Writes the changes since the last autosave and appends them to the
+//			base's journal on the job thread.
+//-----------------------------------------------------------------------------
+bool CAutosaveJournal::Append(void)
+{
+	double flStartTime = Plat_FloatTime();
+
+	AutosaveJob_t *pJob = new AutosaveJob_t;
+	pJob->m_eType = AUTOSAVE_JOB_APPEND;
+	pJob->m_szBase[0] = '\0';
+	Q_snprintf(pJob->m_szFile, sizeof(pJob->m_szFile), "%s%s", m_szBase, AUTOSAVE_JOURNAL_EXTENSION);
+	pJob->m_nChanged = m_ChangedIDs.Count();
+
+	if (!WriteEntry(pJob->m_Entry))
+	{
+		delete pJob;
+		return(false);
+	}
+
+	m_ChangedIDs.RemoveAll();
+	m_nEntries++;
+	m_nJournalSize += pJob->m_Entry.TellPut();
+
+	pJob->m_flEntryTime = Plat_FloatTime() - flStartTime;
+	QueueJob(pJob);
+	return(true);
+}
+
+
+//-----------------------------------------------------------------------------
+// Purpose: Writes the changes since the last autosave and merges them with the
+//			base and its journal into a new autosave on the job thread. The new
+//			autosave becomes the base.
+//-----------------------------------------------------------------------------
+bool CAutosaveJournal::Compact(const char *pszFileName)
+{
+	double flStartTime = Plat_FloatTime();
+
+	AutosaveJob_t *pJob = new AutosaveJob_t;
+	pJob->m_eType = AUTOSAVE_JOB_COMPACT;
+	Q_strncpy(pJob->m_szBase, m_szBase, sizeof(pJob->m_szBase));
+	Q_strncpy(pJob->m_szFile, pszFileName, sizeof(pJob->m_szFile));
+	pJob->m_nChanged = m_ChangedIDs.Count();
+
+	if (!WriteEntry(pJob->m_Entry))
+	{
+		delete pJob;
+		return(false);
+	}
+
+	m_ChangedIDs.RemoveAll();
+
+	// Not known until the job is done, but this is close enough for CanAppend.
+	m_nBaseSize += m_nJournalSize + pJob->m_Entry.TellPut();
+	Q_strncpy(m_szBase, pszFileName, sizeof(m_szBase));
+	m_bOwned = true;
+	m_nEntries = 0;
+	m_nJournalSize = 0;
+
+	pJob->m_flEntryTime = Plat_FloatTime() - flStartTime;
+	QueueJob(pJob);
+	return(true);
+}
+
+
+//-----------------------------------------------------------------------------
+// Purpose: Hands a job to the job thread, starting it the first time.
+//-----------------------------------------------------------------------------
+void CAutosaveJournal::QueueJob(AutosaveJob_t *pJob)
+{
+	if (m_hThread == NULL)
+	{
+		m_hThread = CreateSimpleThread(JobThreadFn, this);
+	}
+
+	m_QueuedJobs.AddToTail(pJob);
+	++m_nPendingJobs;
+	m_Jobs.QueueMessage(pJob);
+}
+
+
+//-----------------------------------------------------------------------------
+// Purpose: Runs the jobs in the order they were queued until told to exit.
+//-----------------------------------------------------------------------------
+unsigned CAutosaveJournal::JobThreadFn(void *pParam)
+{
+	CAutosaveJournal *pJournal = (CAutosaveJournal *)pParam;
+
+	for (;;)
+	{
+		AutosaveJob_t *pJob;
+		pJournal->m_Jobs.WaitMessage(&pJob);
+
+		if (pJob->m_eType == AUTOSAVE_JOB_EXIT)
+		{
+			delete pJob;
+			break;
+		}
+
+		double flStartTime = Plat_FloatTime();
+		pJob->m_bOk = RunJob(pJob);
+		pJob->m_flJobTime = Plat_FloatTime() - flStartTime;
+
+		pJournal->m_FinishedJobs.QueueMessage(pJob);
+		--pJournal->m_nPendingJobs;
+	}
+
+	return(0);
+}
+
+
+//-----------------------------------------------------------------------------
+// Purpose: Does the file work for a job. Only uses the job, never the document.
+//-----------------------------------------------------------------------------
+bool CAutosaveJournal::RunJob(AutosaveJob_t *pJob)
+{
+	if (pJob->m_eType == AUTOSAVE_JOB_APPEND)
+	{
+		return(WriteWholeFile(pJob->m_szFile, pJob->m_Entry, true));
+	}
+
+	//
+	// Merge the base, its journal and the entry.
+	//
+	char szJournal[MAX_PATH];
+	Q_snprintf(szJournal, sizeof(szJournal), "%s%s", pJob->m_szBase, AUTOSAVE_JOURNAL_EXTENSION);
+
+	CUtlBuffer Journal;
+	CUtlVector<JournalEntry_t> Entries;
+	if (ReadWholeFile(szJournal, Journal))
+	{
+		SplitJournal(Journal, Entries);
+	}
+
+	int nEntry = Entries.AddToTail();
+	Entries[nEntry].m_pData = pJob->m_Entry.Base();
+	Entries[nEntry].m_nSize = pJob->m_Entry.TellPut();
+
+	CUtlBuffer Output;
+	if (Merge(pJob->m_szBase, Entries, Output) != ChunkFile_Ok)
+	{
+		return(false);
+	}
+
+	//
+	// Write it next to where it goes so a crash never leaves half a file behind,
+	// then drop the old journal of the file being replaced before replacing it.
+	//
+	char szTemp[MAX_PATH];
+	Q_snprintf(szTemp, sizeof(szTemp), "%s.tmp", pJob->m_szFile);
+	if (!WriteWholeFile(szTemp, Output, false))
+	{
+		return(false);
+	}
+
+	Q_snprintf(szJournal, sizeof(szJournal), "%s%s", pJob->m_szFile, AUTOSAVE_JOURNAL_EXTENSION);
+	DeleteFile(szJournal);
+
+	if (!MoveFileEx(szTemp, pJob->m_szFile, MOVEFILE_REPLACE_EXISTING))
+	{
+		DeleteFile(szTemp);
+		return(false);
+	}
+
+	return(true);
+}
+
+
+//-----------------------------------------------------------------------------
+// Purpose: Reports the jobs that have finished. A failed job means that the
+//			base and journal may no longer hold the document, so the next
+//			autosave writes everything.
+//-----------------------------------------------------------------------------
+void CAutosaveJournal::Update(void)
+{
+	while (m_FinishedJobs.MessageWaiting())
+	{
+		AutosaveJob_t *pJob;
+		m_FinishedJobs.WaitMessage(&pJob);
+		m_QueuedJobs.FindAndRemove(pJob);
+
+		if (!pJob->m_bOk)
+		{
+			m_bFailed = true;
+			Msg(mwError, "Autosave to %s failed.", pJob->m_szFile);
+		}
+		else
+		{
+			Msg(mwStatus, "Autosaved %d changed objects to %s (%.1f ms, %.1f ms in the background).", pJob->m_nChanged, pJob->m_szFile,
+				pJob->m_flEntryTime * 1000.0, pJob->m_flJobTime * 1000.0);
+		}
+
+		delete pJob;
+	}
+}
+
+
+//-----------------------------------------------------------------------------
+// Purpose: Waits for the queued jobs to finish. Call before writing or deleting
+//			files the jobs might be using.
+//-----------------------------------------------------------------------------
+void CAutosaveJournal::Flush(void)
+{
+	while (m_nPendingJobs > 0)
+	{
+		ThreadSleep(1);
+	}
+
+	Update();
+}
+
+
+//-----------------------------------------------------------------------------
+// Purpose: Returns true if the file is the base or is used by a queued job, so
+//			that old autosaves can be cleaned up without losing the document.
+//-----------------------------------------------------------------------------
+bool CAutosaveJournal::UsesFile(const char *pszFileName)
+{
+	if (!Q_stricmp(pszFileName, m_szBase))
+	{
+		return(true);
+	}
+
+	for (int i = 0; i < m_QueuedJobs.Count(); i++)
+	{
+		if (!Q_stricmp(pszFileName, m_QueuedJobs[i]->m_szBase) || !Q_stricmp(pszFileName, m_QueuedJobs[i]->m_szFile))
+		{
+			return(true);
+		}
+	}
+
+	return(false);
+}
+
+
+//-----------------------------------------------------------------------------
+// Purpose: Returns true if there is a journal next to the given file.
+//-----------------------------------------------------------------------------
+bool CAutosaveJournal::HasJournal(const char *pszFileName)
+{
+	char szJournal[MAX_PATH];
+	Q_snprintf(szJournal, sizeof(szJournal), "%s%s", pszFileName, AUTOSAVE_JOURNAL_EXTENSION);
+	return(GetFileAttributes(szJournal) != INVALID_FILE_ATTRIBUTES);
+}
+
+
+//-----------------------------------------------------------------------------
+// Purpose: Merges a file and the journal next to it for loading.
+// Output : Returns ChunkFile_Ok with the merged file in Buffer, an error code
+//			if there is no journal or it can't be read.
+//-----------------------------------------------------------------------------
+ChunkFileResult_t CAutosaveJournal::Replay(const char *pszFileName, CUtlBuffer &Buffer)
+{
+	char szJournal[MAX_PATH];
+	Q_snprintf(szJournal, sizeof(szJournal), "%s%s", pszFileName, AUTOSAVE_JOURNAL_EXTENSION);
+
+	CUtlBuffer Journal;
+	if (!ReadWholeFile(szJournal, Journal))
+	{
+		return(ChunkFile_OpenFail);
+	}
+
+	CUtlVector<JournalEntry_t> Entries;
+	SplitJournal(Journal, Entries);
+	if (Entries.Count() == 0)
+	{
+		return(ChunkFile_Fail);
+	}
+
+	return(Merge(pszFileName, Entries, Buffer));
+}
+
+
+//-----------------------------------------------------------------------------
+// Purpose: Reads a whole file into a buffer.
+//-----------------------------------------------------------------------------
+bool CAutosaveJournal::ReadWholeFile(const char *pszFileName, CUtlBuffer &Buffer)
+{
+	FILE *fp = fopen(pszFileName, "rb");
+	if (fp == NULL)
+	{
+		return(false);
+	}
+
+	fseek(fp, 0, SEEK_END);
+	int nSize = ftell(fp);
+	fseek(fp, 0, SEEK_SET);
+
+	Buffer.EnsureCapacity(nSize);
+	bool bOk = (nSize >= 0) && (fread(Buffer.Base(), 1, nSize, fp) == (size_t)nSize);
+	fclose(fp);
+
+	if (bOk)
+	{
+		Buffer.SeekPut(CUtlBuffer::SEEK_HEAD, nSize);
+	}
+
+	return(bOk);
+}
+
+
+//-----------------------------------------------------------------------------
+// Purpose: Writes or appends a buffer to a file.
+//-----------------------------------------------------------------------------
+bool CAutosaveJournal::WriteWholeFile(const char *pszFileName, const CUtlBuffer &Buffer, bool bAppend)
+{
+	FILE *fp = fopen(pszFileName, bAppend ? "ab" : "wb");
+	if (fp == NULL)
+	{
+		return(false);
+	}
+
+	bool bOk = (fwrite(Buffer.Base(), 1, Buffer.TellPut(), fp) == (size_t)Buffer.TellPut());
+	if (fclose(fp) != 0)
+	{
+		bOk = false;
+	}
+
+	return(bOk);
+}
+
+
+//-----------------------------------------------------------------------------
+// Purpose: Finds the entries in a journal. Each one is a whole binary chunk
+//			file. An entry that was cut short by a crash ends the journal.
+//-----------------------------------------------------------------------------
+void CAutosaveJournal::SplitJournal(const CUtlBuffer &Journal, CUtlVector<JournalEntry_t> &Entries)
+{
+	const char *pData = (const char *)Journal.Base();
+	int nOffset = 0;
+
+	while (nOffset < Journal.TellPut())
+	{
+		int nSize = CChunkFile::GetBinaryFileSize(pData + nOffset, Journal.TellPut() - nOffset);
+		if (nSize <= 0)
+		{
+			break;
+		}
+
+		int nEntry = Entries.AddToTail();
+		Entries[nEntry].m_pData = pData + nOffset;
+		Entries[nEntry].m_nSize = nSize;
+		nOffset += nSize;
+	}
+}
+
+
+//-----------------------------------------------------------------------------
+// Purpose: Opens a journal entry for reading.
+//-----------------------------------------------------------------------------
+static ChunkFileResult_t OpenEntry(CChunkFile &File, const void *pData, int nSize)
+{
+	CUtlBuffer Buffer(pData, nSize, CUtlBuffer::READ_ONLY);
+	return(File.Open(Buffer, ChunkFile_ReadMapped));
+}
+
+
+//-----------------------------------------------------------------------------
+// Purpose: Reads up to the start of the next top-level chunk with the given name.
+// Output : Returns ChunkFile_Ok if it was found, ChunkFile_EOF if not.
+//-----------------------------------------------------------------------------
+static ChunkFileResult_t FindChunk(CChunkFile *pFile, const char *pszChunkName)
+{
+	ChunkFileResult_t eResult = ChunkFile_Ok;
+
+	while (eResult == ChunkFile_Ok)
+	{
+		const char *pszName;
+		const char *pszValue;
+		ChunkType_t eChunkType;
+		eResult = pFile->ReadNextMapped(&pszName, &pszValue, eChunkType);
+
+		if ((eResult == ChunkFile_Ok) && (eChunkType == ChunkType_Chunk))
+		{
+			if (!stricmp(pszName, pszChunkName))
+			{
+				break;
+			}
+
+			eResult = pFile->SkipChunk();
+		}
+	}
+
+	return(eResult);
+}
+
+
+//-----------------------------------------------------------------------------
+// Purpose: Copies the chunks for saved objects from the chunk being read, or
+//			from the top level of the file, that come from the given source.
+//			Inside the world chunk every chunk is an object (solid, group or a
+//			hidden solid); at the top level only entities and hidden entities are.
+// Input  : bTopLevel - True to read the rest of the file, false for the rest
+//				of the chunk being read.
+//			nEntry - Journal entry being read, -1 for the base file. Objects are
+//				copied from the entry that changed them last, and from the base
+//				if they never changed.
+//-----------------------------------------------------------------------------
+ChunkFileResult_t CAutosaveJournal::CopyUnits(CChunkFile *pSrc, CChunkFile *pDest, bool bTopLevel, int nEntry, const CUtlHashtable<int, int> &LastChange)
+{
+	ChunkFileResult_t eResult = ChunkFile_Ok;
+
+	while (eResult == ChunkFile_Ok)
+	{
+		const char *pszName;
+		const char *pszValue;
+		ChunkType_t eChunkType;
+		eResult = pSrc->ReadNextMapped(&pszName, &pszValue, eChunkType);
+
+		if ((eResult == ChunkFile_EndOfChunk) || ((eResult == ChunkFile_EOF) && bTopLevel))
+		{
+			return(ChunkFile_Ok);
+		}
+
+		if ((eResult != ChunkFile_Ok) || (eChunkType != ChunkType_Chunk))
+		{
+			continue;
+		}
+
+		if (bTopLevel && stricmp(pszName, "entity") && stricmp(pszName, "hidden"))
+		{
+			eResult = pSrc->SkipChunk();
+			continue;
+		}
+
+		//
+		// Find the object's ID, which is the first key of the object's chunk.
+		// Hidden objects are wrapped in a chunk of their own.
+		//
+		char szOuter[MAX_KEYVALUE_LEN];
+		char szInner[MAX_KEYVALUE_LEN];
+		Q_strncpy(szOuter, pszName, sizeof(szOuter));
+		szInner[0] = '\0';
+
+		eResult = pSrc->ReadNextMapped(&pszName, &pszValue, eChunkType);
+		if ((eResult == ChunkFile_Ok) && (eChunkType == ChunkType_Chunk) && !stricmp(szOuter, "hidden"))
+		{
+			Q_strncpy(szInner, pszName, sizeof(szInner));
+			eResult = pSrc->ReadNextMapped(&pszName, &pszValue, eChunkType);
+		}
+
+		if (eResult != ChunkFile_Ok)
+		{
+			// An empty object. Only the base keeps those.
+			if ((eResult == ChunkFile_EndOfChunk) && (nEntry == -1))
+			{
+				eResult = pDest->BeginChunk(szOuter);
+				if ((eResult == ChunkFile_Ok) && (szInner[0] != '\0'))
+				{
+					eResult = pDest->BeginChunk(szInner);
+					if (eResult == ChunkFile_Ok)
+					{
+						eResult = pDest->EndChunk();
+					}
+				}
+				if (eResult == ChunkFile_Ok)
+				{
+					eResult = pDest->EndChunk();
+				}
+				if ((eResult == ChunkFile_Ok) && (szInner[0] != '\0'))
+				{
+					eResult = pSrc->SkipChunk();
+				}
+			}
+			else if (eResult == ChunkFile_EndOfChunk)
+			{
+				eResult = (szInner[0] != '\0') ? pSrc->SkipChunk() : ChunkFile_Ok;
+			}
+			continue;
+		}
+
+		bool bCopy;
+		int nID;
+		if ((eChunkType == ChunkType_Key) && !stricmp(pszName, "id") && CChunkFile::ReadKeyValueInt(pszValue, nID))
+		{
+			UtlHashHandle_t hChange = LastChange.Find(nID);
+			bCopy = (hChange == LastChange.InvalidHandle()) ? (nEntry == -1) : (LastChange.Element(hChange) == nEntry);
+		}
+		else
+		{
+			bCopy = (nEntry == -1);
+		}
+
+		if (!bCopy)
+		{
+			if (eChunkType == ChunkType_Chunk)
+			{
+				eResult = pSrc->SkipChunk();
+			}
+			if ((eResult == ChunkFile_Ok) && (szInner[0] != '\0'))
+			{
+				eResult = pSrc->SkipChunk();
+			}
+			if (eResult == ChunkFile_Ok)
+			{
+				eResult = pSrc->SkipChunk();
+			}
+			continue;
+		}
+
+		eResult = pDest->BeginChunk(szOuter);
+		if ((eResult == ChunkFile_Ok) && (szInner[0] != '\0'))
+		{
+			eResult = pDest->BeginChunk(szInner);
+		}
+
+		if (eResult == ChunkFile_Ok)
+		{
+			eResult = pSrc->CopyRecord(pDest, pszName, pszValue, eChunkType);
+		}
+
+		if ((eResult == ChunkFile_Ok) && (eChunkType == ChunkType_Chunk))
+		{
+			eResult = pSrc->CopyChunk(pDest);
+		}
+
+		if ((eResult == ChunkFile_Ok) && (szInner[0] != '\0'))
+		{
+			eResult = pSrc->CopyChunk(pDest);
+		}
+
+		if (eResult == ChunkFile_Ok)
+		{
+			eResult = pSrc->CopyChunk(pDest);
+		}
+	}
+
+	return(eResult);
+}
+
+
+//-----------------------------------------------------------------------------
+// Purpose: Merges a file with journal entries into a new binary file. The
+//			document-wide chunks and world keys come from the last entry, and
+//			each object comes from the last entry that changed it, or from the
+//			base if none did.
+// Input  : pszBase - Text or binary chunk file that the entries follow.
+//			Entries - The entries, oldest first.
+//			Output - Receives the new file.
+//-----------------------------------------------------------------------------
+ChunkFileResult_t CAutosaveJournal::Merge(const char *pszBase, const CUtlVector<JournalEntry_t> &Entries, CUtlBuffer &Output)
+{
+	int nLast = Entries.Count() - 1;
+	if (nLast < 0)
+	{
+		return(ChunkFile_Fail);
+	}
+
+	//
+	// Find out which entry changed each object last.
+	//
+	CUtlHashtable<int, int> LastChange;
+	for (int nEntry = 0; nEntry <= nLast; nEntry++)
+	{
+		CChunkFile Entry;
+		ChunkFileResult_t eResult = OpenEntry(Entry, Entries[nEntry].m_pData, Entries[nEntry].m_nSize);
+		if (eResult == ChunkFile_Ok)
+		{
+			eResult = FindChunk(&Entry, "journal");
+		}
+
+		while (eResult == ChunkFile_Ok)
+		{
+			const char *pszName;
+			const char *pszValue;
+			ChunkType_t eChunkType;
+			eResult = Entry.ReadNextMapped(&pszName, &pszValue, eChunkType);
+
+			int nID;
+			if ((eResult == ChunkFile_Ok) && (eChunkType == ChunkType_Key) && !stricmp(pszName, "changed") && CChunkFile::ReadKeyValueInt(pszValue, nID))
+			{
+				LastChange.Element(LastChange.Insert(nID, nEntry)) = nEntry;
+			}
+		}
+
+		Entry.Close();
+
+		if (eResult != ChunkFile_EndOfChunk)
+		{
+			return((eResult == ChunkFile_Ok) || (eResult == ChunkFile_EOF) ? ChunkFile_Fail : eResult);
+		}
+	}
+
+	//
+	// Copy the last entry, putting the older objects into the world chunk and
+	// after the world chunk.
+	//
+	CChunkFile Last;
+	ChunkFileResult_t eResult = OpenEntry(Last, Entries[nLast].m_pData, Entries[nLast].m_nSize);
+	if (eResult != ChunkFile_Ok)
+	{
+		return(eResult);
+	}
+
+	CChunkFile Dest;
+	eResult = Dest.Open(Output, ChunkFile_WriteBinary);
+	bool bFoundWorld = false;
+
+	while (eResult == ChunkFile_Ok)
+	{
+		const char *pszName;
+		const char *pszValue;
+		ChunkType_t eChunkType;
+		eResult = Last.ReadNextMapped(&pszName, &pszValue, eChunkType);
+
+		if (eResult == ChunkFile_EOF)
+		{
+			eResult = ChunkFile_Ok;
+			break;
+		}
+
+		if (eResult != ChunkFile_Ok)
+		{
+			break;
+		}
+
+		if ((eChunkType == ChunkType_Chunk) && !stricmp(pszName, "journal"))
+		{
+			eResult = Last.SkipChunk();
+			continue;
+		}
+
+		eResult = Last.CopyRecord(&Dest, pszName, pszValue, eChunkType);
+		if ((eResult != ChunkFile_Ok) || (eChunkType != ChunkType_Chunk))
+		{
+			continue;
+		}
+
+		if (stricmp(pszName, "world"))
+		{
+			eResult = Last.CopyChunk(&Dest);
+			continue;
+		}
+
+		//
+		// The world: its keys and changed objects from the last entry, then the
+		// objects from the base and the older entries.
+		//
+		while (eResult == ChunkFile_Ok)
+		{
+			eResult = Last.ReadNextMapped(&pszName, &pszValue, eChunkType);
+			if (eResult == ChunkFile_Ok)
+			{
+				eResult = Last.CopyRecord(&Dest, pszName, pszValue, eChunkType);
+				if ((eResult == ChunkFile_Ok) && (eChunkType == ChunkType_Chunk))
+				{
+					eResult = Last.CopyChunk(&Dest);
+				}
+			}
+		}
+
+		if (eResult != ChunkFile_EndOfChunk)
+		{
+			break;
+		}
+
+		bFoundWorld = true;
+		eResult = ChunkFile_Ok;
+
+		for (int nPass = 0; (nPass < 2) && (eResult == ChunkFile_Ok); nPass++)
+		{
+			bool bWorld = (nPass == 0);
+
+			for (int nEntry = -1; (nEntry < nLast) && (eResult == ChunkFile_Ok); nEntry++)
+			{
+				CChunkFile Src;
+				if (nEntry == -1)
+				{
+					eResult = Src.Open(pszBase, ChunkFile_ReadMapped);
+				}
+				else
+				{
+					eResult = OpenEntry(Src, Entries[nEntry].m_pData, Entries[nEntry].m_nSize);
+				}
+
+				if ((eResult == ChunkFile_Ok) && bWorld)
+				{
+					eResult = FindChunk(&Src, "world");
+					if (eResult == ChunkFile_EOF)
+					{
+						Src.Close();
+						eResult = ChunkFile_Ok;
+						continue;
+					}
+				}
+
+				if (eResult == ChunkFile_Ok)
+				{
+					eResult = CopyUnits(&Src, &Dest, !bWorld, nEntry, LastChange);
+				}
+
+				Src.Close();
+			}
+
+			if ((eResult == ChunkFile_Ok) && bWorld)
+			{
+				eResult = Dest.EndChunk();
+			}
+		}
+	}
+
+	Last.Close();
+
+	if ((eResult == ChunkFile_Ok) && !bFoundWorld)
+	{
+		// Everything that didn't change would be lost.
+		eResult = ChunkFile_Fail;
+	}
+
+	ChunkFileResult_t eCloseResult = Dest.Close();
+	if (eResult == ChunkFile_Ok)
+	{
+		eResult = eCloseResult;
+	}
+
+	return(eResult);
+}
@@ -0,0 +1,115 @@
+//========= Copyright Valve Corporation, All rights reserved. ============//
+//
+// Purpose: Incremental autosaves. Only the objects that changed since the last
+//			autosave are written, into a journal that sits next to the last full
+//			save, and the journal is folded into a new full file now and then.
+//			All of the file work is done on a background thread.
+//
+//=============================================================================//
+
+#ifndef AUTOSAVEJOURNAL_H
+#define AUTOSAVEJOURNAL_H
+#pragma once
+
+#include "ChunkFile.h"
+#include "tier0/threadtools.h"
+#include "tier1/utlbuffer.h"
+#include "tier1/utlhashtable.h"
+#include "tier1/utlrbtree.h"
+#include "tier1/utlvector.h"
+
+
+class CMapClass;
+class CMapDoc;
+
+struct AutosaveJob_t;
+
+
+#define AUTOSAVE_JOURNAL_EXTENSION		".journal"
+#define AUTOSAVE_JOURNAL_MAX_ENTRIES	8		// Entries appended before the journal is compacted.
+
+
+//-----------------------------------------------------------------------------
+// Each document has one of these. Changed objects are remembered by the ID of
+// the object that holds them in the world's save lists (solids, groups and
+// entities), and every autosave writes just those objects, plus the small
+// document-wide chunks, into memory. A background thread either appends that
+// to <base>.journal or merges the base, its journal and the new entry into a
+// new full autosave. LoadVMF replays a journal it finds next to the file.
+//-----------------------------------------------------------------------------
+class CAutosaveJournal
+{
+	public:
+
+		CAutosaveJournal(CMapDoc *pDoc);
+		~CAutosaveJournal(void);
+
+		// Call when an object is about to change or has changed. bChildren also marks
+		// the save list objects below it, for objects that are being deleted.
+		static void ObjectChanged(CMapClass *pObject, bool bChildren = false);
+
+		// Makes the given file, which holds everything in the document, the one that
+		// following autosaves are relative to. bOwned allows appending a journal to it.
+		void SetBase(const char *pszFileName, bool bOwned);
+
+		bool CanAppend(void);
+		bool CanCompact(void);
+		bool Append(void);
+		bool Compact(const char *pszFileName);
+
+		void Update(void);				// Reports finished jobs. Call from the main thread.
+		void Flush(void);				// Waits for all jobs to finish.
+		bool UsesFile(const char *pszFileName);
+
+		// Merges the file with the journal next to it, if there is one, into Buffer.
+		static ChunkFileResult_t Replay(const char *pszFileName, CUtlBuffer &Buffer);
+		static bool HasJournal(const char *pszFileName);
+
+	protected:
+
+		struct JournalEntry_t
+		{
+			const void *m_pData;
+			int m_nSize;
+		};
+
+		void MarkObject(CMapClass *pObject, bool bChildren);
+		void GetSaveListIDs(CUtlVector<int> &IDs);
+		bool WriteEntry(CUtlBuffer &Buffer);
+		void QueueJob(AutosaveJob_t *pJob);
+
+		static BOOL AddSaveListID(CMapClass *pObject, CUtlVector<int> *pIDs);
+		static BOOL MarkSaveListObject(CMapClass *pObject, CAutosaveJournal *pJournal);
+
+		static bool ReadWholeFile(const char *pszFileName, CUtlBuffer &Buffer);
+		static bool WriteWholeFile(const char *pszFileName, const CUtlBuffer &Buffer, bool bAppend);
+		static void SplitJournal(const CUtlBuffer &Journal, CUtlVector<JournalEntry_t> &Entries);
+		static ChunkFileResult_t Merge(const char *pszBase, const CUtlVector<JournalEntry_t> &Entries, CUtlBuffer &Output);
+		static ChunkFileResult_t CopyUnits(CChunkFile *pSrc, CChunkFile *pDest, bool bTopLevel, int nEntry, const CUtlHashtable<int, int> &LastChange);
+
+		static bool RunJob(AutosaveJob_t *pJob);
+		static unsigned JobThreadFn(void *pParam);
+
+		CMapDoc *m_pDoc;
+
+		CUtlRBTree<int, int> m_ChangedIDs;		// Save list objects changed since the last entry.
+		CUtlVector<int> m_SavedIDs;			// Sorted IDs of the save list objects as of the last entry.
+
+		char m_szBase[MAX_PATH];			// File the journal is relative to, empty if none.
+		bool m_bOwned;						// We wrote the base, so a journal can be appended to it.
+		bool m_bFailed;						// A job failed, the next autosave has to write everything.
+		int m_nEntries;						// Entries in the base's journal.
+		int m_nBaseSize;
+		int m_nJournalSize;
+		int m_nSequence;
+
+		// Jobs run one at a time, in order, on one thread.
+		ThreadHandle_t m_hThread;
+		CMessageQueue<AutosaveJob_t *> m_Jobs;
+		CMessageQueue<AutosaveJob_t *> m_FinishedJobs;
+		CInterlockedInt m_nPendingJobs;
+		CUtlVector<AutosaveJob_t *> m_QueuedJobs;		// Owned by the main thread, for UsesFile.
+};
+
+
+#endif // AUTOSAVEJOURNAL_H
@@ -0,0 +1,423 @@
+//========= Copyright Valve Corporation, All rights reserved. ============//
+//
+// Purpose: Throughput benchmark for CChunkFile. Writes a large synthetic VMF as
+//			text and as binary, reads the text back with the stream tokenizer and
+//			the mapped one, reads the binary back, and checks that the binary
+//			file converts back into the text one byte for byte.
+//
+// $NoKeywords: $
+//=============================================================================//
+
+#include "stdafx.h"
+#include <stdio.h>
+#include "ChunkFile.h"
+#include "ChunkFileBench.h"
+#include "GlobalFunctions.h"
+#include "tier0/platform.h"
+#include "tier0/dbg.h"
+#include "tier1/strtools.h"
+#include "tier1/checksum_crc.h"
+#include "mathlib/vector.h"
+#include "mathlib/vector4d.h"
+
+// memdbgon must be the last include file in a .cpp file!!!
+#include "tier0/memdbgon.h"
+
+
+#define BENCH_PASSES			3
+#define BENCH_SOLIDS_PER_ENTITY	16		// every this many world solids, also write a brush entity
+
+
+static const char *s_pszBenchMaterials[] =
+{
+	"TOOLS/TOOLSNODRAW",
+	"BRICK/BRICKWALL001A",
+	"CONCRETE/CONCRETEFLOOR001A",
+	"METAL/METALWALL014A",
+	"DEV/DEV_MEASUREGENERIC01B",
+};
+
+
+struct ChunkFileBenchStats_t
+{
+	int m_nChunks;
+	int m_nKeys;
+	CRC32_t m_Crc;						// Over every chunk name, key and value, in order.
+	ChunkFileResult_t m_eResult;		// First error from a nested chunk.
+};
+
+
+static ChunkFileResult_t BenchKeyCallback(const char *szKey, const char *szValue, ChunkFileBenchStats_t *pStats)
+{
+	pStats->m_nKeys++;
+	CRC32_ProcessBuffer(&pStats->m_Crc, szKey, Q_strlen(szKey) + 1);
+	CRC32_ProcessBuffer(&pStats->m_Crc, szValue, Q_strlen(szValue) + 1);
+	return(ChunkFile_Ok);
+}
+
+
+static ChunkFileResult_t BenchChunkCallback(CChunkFile *pFile, ChunkFileBenchStats_t *pStats, const char *pszChunkName)
+{
+	pStats->m_nChunks++;
+	CRC32_ProcessBuffer(&pStats->m_Crc, pszChunkName, Q_strlen(pszChunkName) + 1);
+
+	ChunkFileResult_t eResult = pFile->ReadChunk(BenchKeyCallback, pStats);
+	if ((eResult != ChunkFile_Ok) && (pStats->m_eResult == ChunkFile_Ok))
+	{
+		pStats->m_eResult = eResult;
+	}
+
+	return(eResult);
+}
+
+
+//-----------------------------------------------------------------------------
+// Purpose: Writes one six sided brush the way Hammer saves them.
+//-----------------------------------------------------------------------------
+static void WriteBenchSolid(CChunkFile &File, int &nNextID, uint32 &nRandom)
+{
+	File.BeginChunk("solid");
+	File.WriteKeyValueInt("id", nNextID++);
+
+	nRandom = nRandom * 1664525 + 1013904223;
+	int x = (int)(nRandom >> 18) - 8192;
+	nRandom = nRandom * 1664525 + 1013904223;
+	int y = (int)(nRandom >> 18) - 8192;
+	nRandom = nRandom * 1664525 + 1013904223;
+	int z = (int)(nRandom >> 20) - 2048;
+	int nSize = 16 << (nRandom & 3);
+
+	for (int nSide = 0; nSide < 6; nSide++)
+	{
+		int nAxis = nSide >> 1;
+		int nSign = (nSide & 1) ? -1 : 1;
+		Vector vecOrigin(x, y, z);
+		if (nSign > 0)
+		{
+			vecOrigin[nAxis] += nSize;
+		}
+
+		File.BeginChunk("side");
+		File.WriteKeyValueInt("id", nNextID++);
+		File.WriteKeyValuePlane("plane", vecOrigin, vecOrigin + Vector(nSize, 0, nSign * nSize), vecOrigin + Vector(0, nSize, 0));
+
+		// Hammer writes the face points out for faces that are being kept as they are.
+		if (nSide == 0)
+		{
+			File.BeginChunk("point_data");
+			File.WriteKeyValueInt("numpts", 4);
+			for (int i = 0; i < 4; i++)
+			{
+				File.WriteKeyValueIndexedPoint("point", i, vecOrigin + Vector((i & 1) * nSize, (i >> 1) * nSize, 0.5f));
+			}
+			File.EndChunk();
+		}
+
+		File.WriteKeyValue("material", s_pszBenchMaterials[(nRandom >> 8) % ARRAYSIZE(s_pszBenchMaterials)]);
+		File.WriteKeyValueTextureAxis("uaxis", Vector4D(1, 0, 0, 0), 0.25f);
+		File.WriteKeyValueTextureAxis("vaxis", Vector4D(0, -1, 0, 0), 0.25f);
+		File.WriteKeyValueFloat("rotation", 0);
+		File.WriteKeyValueFloat("lightmapscale", 16);
+		File.WriteKeyValueInt("smoothing_groups", 0);
+		File.EndChunk();
+	}
+
+	File.BeginChunk("editor");
+	File.WriteKeyValueColor("color", 0, 146, 187);
+	File.WriteKeyValueBool("visgroupshown", true);
+	File.WriteKeyValueBool("visgroupautoshown", true);
+	File.EndChunk();
+
+	File.EndChunk();
+}
+
+
+//-----------------------------------------------------------------------------
+// Purpose: Writes a world with the given number of solids, plus a brush entity
+//			with outputs for every BENCH_SOLIDS_PER_ENTITY of them.
+// Output : Returns the time taken in seconds, or -1 if the file couldn't be written.
+//-----------------------------------------------------------------------------
+static double WriteBenchVMF(const char *pszFileName, int nSolids, ChunkFileOpenMode_t eMode)
+{
+	double flStart = Plat_FloatTime();
+
+	CChunkFile File;
+	if (File.Open(pszFileName, eMode) != ChunkFile_Ok)
+	{
+		return(-1);
+	}
+
+	int nNextID = 1;
+	uint32 nRandom = 0x5eed;
+
+	File.WriteLine("// Synthetic map written by RunChunkFileBenchmark");
+	File.BeginChunk("versioninfo");
+	File.WriteKeyValueInt("editorversion", 400);
+	File.WriteKeyValueInt("mapversion", 1);
+	File.WriteKeyValueInt("formatversion", 100);
+	File.WriteKeyValueBool("prefab", false);
+	File.EndChunk();
+
+	File.BeginChunk("world");
+	File.WriteKeyValueInt("id", nNextID++);
+	File.WriteKeyValue("classname", "worldspawn");
+	File.WriteKeyValue("skyname", "sky_day01_01");
+	for (int i = 0; i < nSolids; i++)
+	{
+		WriteBenchSolid(File, nNextID, nRandom);
+	}
+	File.EndChunk();
+
+	for (int i = 0; i < nSolids / BENCH_SOLIDS_PER_ENTITY; i++)
+	{
+		char szName[MAX_KEYVALUE_LEN];
+		Q_snprintf(szName, sizeof(szName), "door_%d", i);
+
+		File.BeginChunk("entity");
+		File.WriteKeyValueInt("id", nNextID++);
+		File.WriteKeyValue("classname", "func_door");
+		File.WriteKeyValue("targetname", szName);
+		File.WriteKeyValue("message", "Line one\\nLine two");
+		File.WriteKeyValuePoint("origin", Vector(i * 0.5f, -i * 0.25f, 64.125f));
+		File.WriteKeyValueColor("rendercolor", 255, i & 0xff, 0);
+		File.WriteKeyValueBool("locked", (i & 1) != 0);
+		File.BeginChunk("connections");
+		File.WriteKeyValue("OnOpen", "!self,Close,,5,-1");
+		File.WriteKeyValue("OnClose", "!activator,Kill,,0,1");
+		File.EndChunk();
+
+		// A row of displacement alphas, the way CMapDisp writes them.
+		float flAlphas[17];
+		for (int j = 0; j < ARRAYSIZE(flAlphas); j++)
+		{
+			flAlphas[j] = (j * 255.0f) / 16.0f + i * 0.001f;
+		}
+		File.BeginChunk("alphas");
+		File.WriteKeyValueFloats("row0", flAlphas, ARRAYSIZE(flAlphas));
+		File.EndChunk();
+
+		WriteBenchSolid(File, nNextID, nRandom);
+		File.EndChunk();
+	}
+
+	if (File.Close() != ChunkFile_Ok)
+	{
+		return(-1);
+	}
+
+	return(Plat_FloatTime() - flStart);
+}
+
+
+static long GetBenchFileSize(const char *pszFileName)
+{
+	FILE *fp = fopen(pszFileName, "rb");
+	long nFileSize = 0;
+	if (fp != NULL)
+	{
+		fseek(fp, 0, SEEK_END);
+		nFileSize = ftell(fp);
+		fclose(fp);
+	}
+
+	return(nFileSize);
+}
+
+
+//-----------------------------------------------------------------------------
+// Purpose: Returns true if the two files have the same contents.
+//-----------------------------------------------------------------------------
+static bool CompareBenchFiles(const char *pszFileName1, const char *pszFileName2)
+{
+	FILE *fp1 = fopen(pszFileName1, "rb");
+	FILE *fp2 = fopen(pszFileName2, "rb");
+	bool bSame = (fp1 != NULL) && (fp2 != NULL);
+
+	char Buf1[4096];
+	char Buf2[4096];
+	while (bSame)
+	{
+		size_t nRead1 = fread(Buf1, 1, sizeof(Buf1), fp1);
+		size_t nRead2 = fread(Buf2, 1, sizeof(Buf2), fp2);
+		if ((nRead1 != nRead2) || (memcmp(Buf1, Buf2, nRead1) != 0))
+		{
+			bSame = false;
+		}
+		else if (nRead1 == 0)
+		{
+			break;
+		}
+	}
+
+	if (fp1 != NULL)
+	{
+		fclose(fp1);
+	}
+
+	if (fp2 != NULL)
+	{
+		fclose(fp2);
+	}
+
+	return(bSame);
+}
+
+
+//-----------------------------------------------------------------------------
+// Purpose: Reads the whole file once in the given mode.
+// Output : Returns the time taken in seconds, or -1 on a parse error.
+//-----------------------------------------------------------------------------
+static double ParseBenchVMF(const char *pszFileName, ChunkFileOpenMode_t eMode, ChunkFileBenchStats_t &Stats)
+{
+	memset(&Stats, 0, sizeof(Stats));
+	CRC32_Init(&Stats.m_Crc);
+	Stats.m_eResult = ChunkFile_Ok;
+
+	double flStart = Plat_FloatTime();
+
+	CChunkFile File;
+	ChunkFileResult_t eResult = File.Open(pszFileName, eMode);
+	if (eResult == ChunkFile_Ok)
+	{
+		File.SetDefaultChunkHandler(BenchChunkCallback, &Stats);
+		eResult = File.ReadChunk(BenchKeyCallback, &Stats);
+	}
+
+	if ((eResult == ChunkFile_EOF) && (Stats.m_eResult != ChunkFile_Ok))
+	{
+		eResult = Stats.m_eResult;
+	}
+
+	if (eResult != ChunkFile_EOF)
+	{
+		Msg(mwError, "  %s", File.GetErrorText(eResult));
+		return(-1);
+	}
+
+	File.Close();
+	CRC32_Final(&Stats.m_Crc);
+
+	return(Plat_FloatTime() - flStart);
+}
+
+
+void RunChunkFileBenchmark(int nSolids)
+{
+	char szTempPath[MAX_PATH];
+	char szFileName[MAX_PATH];
+	if (!GetTempPath(sizeof(szTempPath), szTempPath))
+	{
+		Msg(mwError, "VMF benchmark: couldn't find the temp directory.");
+		return;
+	}
+	Q_snprintf(szFileName, sizeof(szFileName), "%shammer_bench.vmf", szTempPath);
+	const char *pszFileName = szFileName;
+
+	Msg(mwStatus, "VMF benchmark: %d solids.", nSolids);
+
+	char szBinaryFileName[MAX_PATH];
+	char szRoundTripFileName[MAX_PATH];
+	Q_snprintf(szBinaryFileName, sizeof(szBinaryFileName), "%sb", pszFileName);
+	Q_snprintf(szRoundTripFileName, sizeof(szRoundTripFileName), "%s.roundtrip", pszFileName);
+
+	static const char *s_pszFormatNames[2] = { "text", "binary" };
+	const char *pszFileNames[2] = { pszFileName, szBinaryFileName };
+	static const ChunkFileOpenMode_t s_eWriteModes[2] = { ChunkFile_Write, ChunkFile_WriteBinary };
+	long nFileSize[2];
+
+	for (int nFormat = 0; nFormat < 2; nFormat++)
+	{
+		double flTime = WriteBenchVMF(pszFileNames[nFormat], nSolids, s_eWriteModes[nFormat]);
+		if (flTime < 0)
+		{
+			Msg(mwError, "  couldn't write %s.", pszFileNames[nFormat]);
+			remove(pszFileName);
+			return;
+		}
+
+		if (flTime < 1.0e-6)
+		{
+			flTime = 1.0e-6;
+		}
+
+		nFileSize[nFormat] = GetBenchFileSize(pszFileNames[nFormat]);
+		Msg(mwStatus, "  %s writer: %.1f MB in %.3f s (%.1f MB/sec).",
+			s_pszFormatNames[nFormat], nFileSize[nFormat] / (1024.0 * 1024.0), flTime, nFileSize[nFormat] / (1024.0 * 1024.0 * flTime));
+	}
+
+	static const ChunkFileOpenMode_t s_eModes[3] = { ChunkFile_Read, ChunkFile_ReadMapped, ChunkFile_ReadMapped };
+	static const char *s_pszModeNames[3] = { "stream", "mapped", "binary" };
+	ChunkFileBenchStats_t Stats[3];
+	bool bOk = true;
+
+	for (int nMode = 0; (nMode < 3) && bOk; nMode++)
+	{
+		const char *pszModeFileName = pszFileNames[nMode == 2];
+
+		// Best of a few passes, so all modes are measured out of a warm file cache.
+		double flBest = -1;
+		for (int nPass = 0; nPass < BENCH_PASSES; nPass++)
+		{
+			double flTime = ParseBenchVMF(pszModeFileName, s_eModes[nMode], Stats[nMode]);
+			if (flTime < 0)
+			{
+				flBest = -1;
+				break;
+			}
+
+			if ((flBest < 0) || (flTime < flBest))
+			{
+				flBest = flTime;
+			}
+		}
+
+		if (flBest < 0)
+		{
+			Msg(mwError, "  %s tokenizer failed to parse %s.", s_pszModeNames[nMode], pszModeFileName);
+			bOk = false;
+			break;
+		}
+
+		if (flBest < 1.0e-6)
+		{
+			flBest = 1.0e-6;
+		}
+
+		long nModeFileSize = nFileSize[nMode == 2];
+		Msg(mwStatus, "  %s tokenizer: %.1f MB, %d chunks, %d keys in %.3f s (%.1f MB/sec, %.0f keys/sec).",
+			s_pszModeNames[nMode], nModeFileSize / (1024.0 * 1024.0), Stats[nMode].m_nChunks, Stats[nMode].m_nKeys,
+			flBest, nModeFileSize / (1024.0 * 1024.0 * flBest), Stats[nMode].m_nKeys / flBest);
+	}
+
+	if (bOk)
+	{
+		for (int nMode = 1; nMode < 3; nMode++)
+		{
+			if ((Stats[0].m_nChunks != Stats[nMode].m_nChunks) || (Stats[0].m_nKeys != Stats[nMode].m_nKeys) || (Stats[0].m_Crc != Stats[nMode].m_Crc))
+			{
+				Msg(mwError, "  the stream and %s tokenizers disagree on %s!", s_pszModeNames[nMode], pszFileName);
+			}
+		}
+
+		//
+		// Converting the binary file back to text must give the text file we wrote.
+		//
+		ChunkFileResult_t eResult = CChunkFile::Convert(szBinaryFileName, szRoundTripFileName, ChunkFile_Write);
+		if (eResult != ChunkFile_Ok)
+		{
+			Msg(mwError, "  couldn't convert %s back to text.", szBinaryFileName);
+		}
+		else if (!CompareBenchFiles(pszFileName, szRoundTripFileName))
+		{
+			Msg(mwError, "  %s doesn't convert back to %s!", szBinaryFileName, pszFileName);
+		}
+		else
+		{
+			Msg(mwStatus, "  binary round trip matches the text file.");
+		}
+	}
+
+	remove(pszFileName);
+	remove(szBinaryFileName);
+	remove(szRoundTripFileName);
+}
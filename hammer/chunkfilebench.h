@@ -0,0 +1,19 @@
+//========= Copyright Valve Corporation, All rights reserved. ============//
+//
+// Purpose: Throughput benchmark for CChunkFile, run with -benchvmf.
+//
+//=============================================================================//
+
+#ifndef CHUNKFILEBENCH_H
+#define CHUNKFILEBENCH_H
+#pragma once
+
+
+// Writes a synthetic VMF with the given number of solids to the temp directory,
+// as text and as binary, then times parsing it with ChunkFile_Read and
+// ChunkFile_ReadMapped and checks that every mode hands the callbacks the same
+// keys and values.
+void RunChunkFileBenchmark( int nSolids );
+
+
+#endif // CHUNKFILEBENCH_H
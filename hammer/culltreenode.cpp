@@ -1,12 +1,13 @@
 //========= Copyright  1996-2005, Valve Corporation, All rights reserved. ============//
 //
-// Purpose: 
+// Purpose:
 //
 // $NoKeywords: $
 //=============================================================================//
 
 #include "stdafx.h"
 #include "CullTreeNode.h"
+#include "tier0/threadtools.h"
 
 // memdbgon must be the last include file in a .cpp file!!!
 #include <tier0/memdbgon.h>
@@ -16,244 +17,493 @@
 bool BoxesIntersect(Vector const &mins1, Vector const &maxs1, Vector const &mins2, Vector const &maxs2);
 
 
+#define MIN_NODE_DIM			1024		// Minimum node size of 170 x 170 x 170 feet
+#define MIN_NODE_OBJECT_SPLIT	2			// Don't split nodes with fewer than two objects.
+
+#define CULLTREE_TASK_DEPTH		2			// Subtrees below this depth are built in parallel.
+#define CULLTREE_MAX_THREADS	32
+
+
 //-----------------------------------------------------------------------------
-// Purpose: 
+// Purpose: Returns the bounds of one of the eight children of a node. A set bit in
+//			nChild puts the child in the lower half of that axis.
 //-----------------------------------------------------------------------------
-CCullTreeNode::CCullTreeNode(void)
+static void GetChildBounds(const Vector &Mins, const Vector &Maxs, int nChild, Vector &ChildMins, Vector &ChildMaxs)
 {
+	for (int nAxis = 0; nAxis < 3; nAxis++)
+	{
+		float flMid = (Mins[nAxis] + Maxs[nAxis]) / 2.0;
+		if (nChild & (1 << nAxis))
+		{
+			ChildMins[nAxis] = Mins[nAxis];
+			ChildMaxs[nAxis] = flMid;
+		}
+		else
+		{
+			ChildMins[nAxis] = flMid;
+			ChildMaxs[nAxis] = Maxs[nAxis];
+		}
+	}
 }
 
 
 //-----------------------------------------------------------------------------
-// Purpose: 
+// Purpose: Returns whether a node of the given size is big enough to be split.
 //-----------------------------------------------------------------------------
-CCullTreeNode::~CCullTreeNode(void)
+static bool CanSplitNode(const Vector &Mins, const Vector &Maxs)
 {
+	Vector Size;
+	VectorSubtract(Maxs, Mins, Size);
+	return((Size[0] > MIN_NODE_DIM) && (Size[1] > MIN_NODE_DIM) && (Size[2] > MIN_NODE_DIM));
 }
 
 
 //-----------------------------------------------------------------------------
-// Purpose: 
-// Input  : pChild - 
+// Purpose:
 //-----------------------------------------------------------------------------
-void CCullTreeNode::AddCullTreeChild(CCullTreeNode *pChild)
+CCullTreeNode::CCullTreeNode(void)
 {
-	m_Children.AddToTail(pChild);
+	m_pTree = NULL;
+	m_nFirstChild = -1;
 }
 
 
 //-----------------------------------------------------------------------------
-// Purpose: 
-// Input  : pObject - 
+// Purpose:
 //-----------------------------------------------------------------------------
-void CCullTreeNode::AddCullTreeObject(CMapClass *pObject)
+CCullTreeNode::~CCullTreeNode(void)
 {
-	// First make sure the object isn't already in this node.
-
-	// If it's already here, bail out.
-	if ( m_Objects.Find( pObject ) != -1 )
-		return;
-	
-	// Add the object.
-	m_Objects.AddToTail(pObject);
 }
 
 
 //-----------------------------------------------------------------------------
-// Purpose: 
-// Input  : pObject - 
+// Node of a tree under construction. Objects are indices into the build's object list.
 //-----------------------------------------------------------------------------
-void CCullTreeNode::AddCullTreeObjectRecurse(CMapClass *pObject)
+struct BuildNode_t
 {
-	//
-	// If the object intersects this node, add it to this node and recurse,
-	// testing each of our children in the same fashion.
-	//
-	Vector ObjMins;
-	Vector ObjMaxs;
-	pObject->GetCullBox(ObjMins, ObjMaxs);
-	if (BoxesIntersect(ObjMins, ObjMaxs, bmins, bmaxs))
+	Vector m_vecMins;
+	Vector m_vecMaxs;
+	int m_nFirstChild;
+	CUtlVector<int> m_Objects;
+};
+
+
+//-----------------------------------------------------------------------------
+// A subtree built by one of the worker threads, to be spliced in at m_nNode.
+//-----------------------------------------------------------------------------
+struct CCullTree::BuildTask_t
+{
+	int m_nNode;
+	const CullBox_t *m_pBoxes;
+	CUtlVector<BuildNode_t> m_Nodes;
+};
+
+
+//-----------------------------------------------------------------------------
+// Purpose: Splits a node into eight children and hands its objects down to the
+//			children their boxes intersect, then splits the children that have at
+//			least two objects. The root is always split. At CULLTREE_TASK_DEPTH the
+//			nodes that still need splitting are left for the worker threads.
+//-----------------------------------------------------------------------------
+void CCullTree::BuildNodeRecurse(CUtlVector<BuildNode_t> &Nodes, int nNode, const CullBox_t *pBoxes,
+								 int nDepth, CUtlVector<int> *pTaskNodes)
+{
+	if ((pTaskNodes != NULL) && (nDepth == CULLTREE_TASK_DEPTH))
 	{
-		int nChildCount = GetChildCount();
-		if (nChildCount != 0)
+		pTaskNodes->AddToTail(nNode);
+		return;
+	}
+
+	Vector Mins = Nodes[nNode].m_vecMins;
+	Vector Maxs = Nodes[nNode].m_vecMaxs;
+	if (!CanSplitNode(Mins, Maxs))
+	{
+		return;
+	}
+
+	int nFirstChild = Nodes.AddMultipleToTail(8);
+	BuildNode_t &Node = Nodes[nNode];
+	Node.m_nFirstChild = nFirstChild;
+
+	for (int nChild = 0; nChild < 8; nChild++)
+	{
+		BuildNode_t &Child = Nodes[nFirstChild + nChild];
+		GetChildBounds(Mins, Maxs, nChild, Child.m_vecMins, Child.m_vecMaxs);
+		Child.m_nFirstChild = -1;
+
+		for (int i = 0; i < Node.m_Objects.Count(); i++)
 		{
-			// dvs: we should split when appropriate!
-			// otherwise the tree becomes less optimal over time.
-			for (int nChild = 0; nChild < nChildCount; nChild++)
+			const CullBox_t &Box = pBoxes[Node.m_Objects[i]];
+			if (BoxesIntersect(Child.m_vecMins, Child.m_vecMaxs, Box.m_vecMins, Box.m_vecMaxs))
 			{
-				CCullTreeNode *pChild = GetCullTreeChild(nChild);
-				pChild->AddCullTreeObjectRecurse(pObject);
+				Child.m_Objects.AddToTail(Node.m_Objects[i]);
 			}
 		}
-		else
+	}
+
+	Node.m_Objects.Purge();
+
+	for (int nChild = 0; nChild < 8; nChild++)
+	{
+		if (Nodes[nFirstChild + nChild].m_Objects.Count() >= MIN_NODE_OBJECT_SPLIT)
 		{
-			AddCullTreeObject(pObject);
+			BuildNodeRecurse(Nodes, nFirstChild + nChild, pBoxes, nDepth + 1, pTaskNodes);
 		}
 	}
 }
 
 
 //-----------------------------------------------------------------------------
-// Purpose: Removes all objects from this node.
+// Purpose: Largest subtree first, so the big ones don't straggle at the end.
 //-----------------------------------------------------------------------------
-void CCullTreeNode::RemoveAllCullTreeObjects(void)
+int __cdecl CCullTree::CompareBuildTasks(BuildTask_t * const *ppTask1, BuildTask_t * const *ppTask2)
 {
-	m_Objects.RemoveAll();
+	int nCount1 = (*ppTask1)->m_Nodes[0].m_Objects.Count();
+	int nCount2 = (*ppTask2)->m_Nodes[0].m_Objects.Count();
+	if (nCount1 != nCount2)
+	{
+		return((nCount1 > nCount2) ? -1 : 1);
+	}
+	return((*ppTask1)->m_nNode - (*ppTask2)->m_nNode);
 }
 
 
 //-----------------------------------------------------------------------------
-// Purpose: Removes all objects from this branch of the tree recursively.
+// Purpose:
 //-----------------------------------------------------------------------------
-void CCullTreeNode::RemoveAllCullTreeObjectsRecurse(void)
+CCullTree::CCullTree(void)
 {
-	RemoveAllCullTreeObjects();
-
-	int nChildCount = GetChildCount();
-	for (int nChild = 0; nChild < nChildCount; nChild++)
-	{
-		CCullTreeNode *pChild = GetCullTreeChild(nChild);
-		pChild->RemoveAllCullTreeObjectsRecurse();
-	}
+	memset(&m_Stats, 0, sizeof(m_Stats));
+	m_nNextBuildTask = 0;
 }
 
 
 //-----------------------------------------------------------------------------
-// Purpose: Removes all instances of a given object from this node.
-// Input  : pObject - 
+// Purpose:
 //-----------------------------------------------------------------------------
-void CCullTreeNode::RemoveCullTreeObject(CMapClass *pObject)
+CCullTree::~CCullTree(void)
 {
-	// Remove occurrence of pObject from the array
-	
-	m_Objects.FindAndRemove( pObject );
-
-	// make sure it's not in there twice
-	Assert( m_Objects.Find( pObject) == -1 );
 }
 
 
 //-----------------------------------------------------------------------------
-// Purpose: Removes all instances of a given object from this node.
-// Input  : pObject - 
+// Purpose: Builds one subtree, called from the worker threads.
 //-----------------------------------------------------------------------------
-void CCullTreeNode::RemoveCullTreeObjectRecurse(CMapClass *pObject)
+void CCullTree::BuildTaskJob(int nJob)
 {
-	RemoveCullTreeObject(pObject);
+	BuildTask_t *pTask = m_BuildTasks[nJob];
+	BuildNodeRecurse(pTask->m_Nodes, 0, pTask->m_pBoxes, CULLTREE_TASK_DEPTH, NULL);
+}
+
 
-	for (int nChild = 0; nChild < m_Children.Count(); nChild++)
+unsigned CCullTree::BuildThreadFn(void *pParam)
+{
+	CCullTree *pTree = (CCullTree *)pParam;
+	for (;;)
 	{
-		CCullTreeNode *pChild = m_Children[nChild];
-		pChild->RemoveCullTreeObjectRecurse(pObject);
-	}	
+		int nJob = ThreadInterlockedIncrement(&pTree->m_nNextBuildTask);
+		if (nJob >= pTree->m_BuildTasks.Count())
+		{
+			break;
+		}
+		pTree->BuildTaskJob(nJob);
+	}
+	return 0;
 }
 
 
 //-----------------------------------------------------------------------------
-// Purpose: Removes all instances of a given object from this node.
-// Input  : pObject - 
+// Purpose: Builds the tree from scratch. The top of the tree is split on this
+//			thread, the subtrees below CULLTREE_TASK_DEPTH on all of them, and
+//			the results are copied into the flat node array.
+// Input  : Objects - The world's root-level objects.
+//			vecMins, vecMaxs - Bounds of the root node.
 //-----------------------------------------------------------------------------
-CCullTreeNode *CCullTreeNode::FindCullTreeObjectRecurse(CMapClass *pObject)
+void CCullTree::Build(const CMapObjectList &Objects, const Vector &vecMins, const Vector &vecMaxs)
 {
-	for (int i = 0; i < m_Objects.Count(); i++)
+	double flStartTime = Plat_FloatTime();
+
+	m_Nodes.RemoveAll();
+	m_ObjectBoxes.RemoveAll();
+	memset(&m_Stats, 0, sizeof(m_Stats));
+
+	int nObjects = Objects.Count();
+	CUtlVector<CullBox_t> Boxes;
+	Boxes.SetCount(nObjects);
+	m_ObjectBoxes.Reserve(nObjects);
+	for (int i = 0; i < nObjects; i++)
+	{
+		Objects[i]->GetCullBox(Boxes[i].m_vecMins, Boxes[i].m_vecMaxs);
+		m_ObjectBoxes.Insert(Objects[i], Boxes[i]);
+	}
+
+	CUtlVector<BuildNode_t> TopNodes;
+	BuildNode_t &Root = TopNodes[TopNodes.AddToTail()];
+	Root.m_vecMins = vecMins;
+	Root.m_vecMaxs = vecMaxs;
+	Root.m_nFirstChild = -1;
+	Root.m_Objects.SetCount(nObjects);
+	for (int i = 0; i < nObjects; i++)
+	{
+		Root.m_Objects[i] = i;
+	}
+
+	CUtlVector<int> TaskNodes;
+	BuildNodeRecurse(TopNodes, 0, Boxes.Base(), 0, &TaskNodes);
+
+	//
+	// Hand the subtrees out to the worker threads.
+	//
+	for (int i = 0; i < TaskNodes.Count(); i++)
+	{
+		BuildTask_t *pTask = new BuildTask_t;
+		pTask->m_nNode = TaskNodes[i];
+		pTask->m_pBoxes = Boxes.Base();
+		BuildNode_t &TaskRoot = pTask->m_Nodes[pTask->m_Nodes.AddToTail()];
+		BuildNode_t &TopNode = TopNodes[TaskNodes[i]];
+		TaskRoot.m_vecMins = TopNode.m_vecMins;
+		TaskRoot.m_vecMaxs = TopNode.m_vecMaxs;
+		TaskRoot.m_nFirstChild = -1;
+		TaskRoot.m_Objects.Swap(TopNode.m_Objects);
+		m_BuildTasks.AddToTail(pTask);
+	}
+	m_BuildTasks.Sort(CompareBuildTasks);
+
+	int nThreads = min(min(GetCPUInformation()->m_nLogicalProcessors, CULLTREE_MAX_THREADS), m_BuildTasks.Count());
+	m_nNextBuildTask = -1;
+	ThreadHandle_t hThreads[CULLTREE_MAX_THREADS];
+	for (int i = 0; i < nThreads - 1; i++)
+	{
+		hThreads[i] = CreateSimpleThread(BuildThreadFn, this);
+	}
+	BuildThreadFn(this);		// This thread works too.
+	for (int i = 0; i < nThreads - 1; i++)
+	{
+		ThreadJoin(hThreads[i]);
+		ReleaseThreadHandle(hThreads[i]);
+	}
+
+	//
+	// Copy the top of the tree into the node array, then splice each subtree in
+	// where its root was left.
+	//
+	m_Nodes.AddMultipleToTail(TopNodes.Count());
+	for (int i = 0; i < TopNodes.Count(); i++)
 	{
-		CMapClass *pCurrent = m_Objects[i];
-		if (pCurrent == pObject)
+		CCullTreeNode &Node = m_Nodes[i];
+		Node.SetBounds(TopNodes[i].m_vecMins, TopNodes[i].m_vecMaxs);
+		Node.m_pTree = this;
+		Node.m_nFirstChild = TopNodes[i].m_nFirstChild;
+		for (int j = 0; j < TopNodes[i].m_Objects.Count(); j++)
 		{
-			return(this);
+			Node.m_Objects.AddToTail(Objects[TopNodes[i].m_Objects[j]]);
 		}
 	}
 
-	int nChildCount = GetChildCount();
-	for (int nChild = 0; nChild < nChildCount; nChild++)
+	for (int nTask = 0; nTask < m_BuildTasks.Count(); nTask++)
 	{
-		CCullTreeNode *pChild = GetCullTreeChild(nChild);
-		CCullTreeNode *pFound = pChild->FindCullTreeObjectRecurse(pObject);
-		if (pFound != NULL)
+		BuildTask_t *pTask = m_BuildTasks[nTask];
+
+		// Local node 0 goes where the task root was, the rest are appended.
+		int nBase = m_Nodes.Count() - 1;
+		if (pTask->m_Nodes.Count() > 1)
 		{
-			return(pFound);
+			m_Nodes.AddMultipleToTail(pTask->m_Nodes.Count() - 1);
+		}
+
+		for (int i = 0; i < pTask->m_Nodes.Count(); i++)
+		{
+			BuildNode_t &BuildNode = pTask->m_Nodes[i];
+			CCullTreeNode &Node = m_Nodes[(i == 0) ? pTask->m_nNode : nBase + i];
+			Node.SetBounds(BuildNode.m_vecMins, BuildNode.m_vecMaxs);
+			Node.m_pTree = this;
+			Node.m_nFirstChild = (BuildNode.m_nFirstChild != -1) ? nBase + BuildNode.m_nFirstChild : -1;
+			for (int j = 0; j < BuildNode.m_Objects.Count(); j++)
+			{
+				Node.m_Objects.AddToTail(Objects[BuildNode.m_Objects[j]]);
+			}
 		}
 	}
+	m_BuildTasks.PurgeAndDeleteElements();
 
-	return(NULL);
+	m_Stats.m_nObjects = m_ObjectBoxes.Count();
+	m_Stats.m_nNodes = m_Nodes.Count();
+	m_Stats.m_nBuildThreads = max(nThreads, 1);
+	m_Stats.m_flBuildTime = Plat_FloatTime() - flStartTime;
 }
 
 
 //-----------------------------------------------------------------------------
-// Purpose: 
-// Input  : pObject - 
+// Purpose: Splits a leaf that has gained enough objects, the same way Build
+//			would have split it.
 //-----------------------------------------------------------------------------
-void CCullTreeNode::UpdateCullTreeObject(CMapClass *pObject)
+void CCullTree::SplitLeaf(int nNode)
 {
-	Vector mins;
-	Vector maxs;
-	pObject->GetCullBox(mins, maxs);
+	Vector Mins = m_Nodes[nNode].bmins;
+	Vector Maxs = m_Nodes[nNode].bmaxs;
+	if (!CanSplitNode(Mins, Maxs))
+	{
+		return;
+	}
+
+	int nFirstChild = m_Nodes.AddMultipleToTail(8);
+	CCullTreeNode &Node = m_Nodes[nNode];
+	Node.m_nFirstChild = nFirstChild;
 
-	if (!BoxesIntersect(mins, maxs, bmins, bmaxs))
+	for (int nChild = 0; nChild < 8; nChild++)
 	{
-		RemoveCullTreeObject(pObject);
+		CCullTreeNode &Child = m_Nodes[nFirstChild + nChild];
+		Vector ChildMins, ChildMaxs;
+		GetChildBounds(Mins, Maxs, nChild, ChildMins, ChildMaxs);
+		Child.SetBounds(ChildMins, ChildMaxs);
+		Child.m_pTree = this;
+
+		for (int i = 0; i < Node.m_Objects.Count(); i++)
+		{
+			const CullBox_t &Box = m_ObjectBoxes[m_ObjectBoxes.Find(Node.m_Objects[i])];
+			if (BoxesIntersect(ChildMins, ChildMaxs, Box.m_vecMins, Box.m_vecMaxs))
+			{
+				Child.m_Objects.AddToTail(Node.m_Objects[i]);
+			}
+		}
 	}
-	else
+
+	Node.m_Objects.RemoveAll();
+
+	for (int nChild = 0; nChild < 8; nChild++)
 	{
-		AddCullTreeObject(pObject);
+		if (m_Nodes[nFirstChild + nChild].m_Objects.Count() >= MIN_NODE_OBJECT_SPLIT)
+		{
+			SplitLeaf(nFirstChild + nChild);
+		}
 	}
 }
 
 
 //-----------------------------------------------------------------------------
-// Purpose: Updates the culling tree due to a change in the bounding box of a
-//			given object within the tree. The object is added to any leaf nodes
-//			that it now intersects, and is removed from any leaf nodes that it
-//			no longer intersects.
-// Input  : pObject - The object whose bounding box has changed.
+// Purpose: Moves an object from the leaves its old box intersects to the leaves
+//			its new box intersects, only visiting nodes that either box touches.
+// Input  : pOldBox - Box the object was linked with, NULL if it is being added.
+//			pNewBox - Box to link the object with, NULL if it is being removed.
 //-----------------------------------------------------------------------------
-void CCullTreeNode::UpdateCullTreeObjectRecurse(CMapClass *pObject)
+void CCullTree::RelinkObject(int nNode, CMapClass *pObject, const CullBox_t *pOldBox, const CullBox_t *pNewBox)
 {
-	int nChildCount = GetChildCount();
-	if (nChildCount != 0)
+	CCullTreeNode *pNode = &m_Nodes[nNode];
+	bool bInOld = (pOldBox != NULL) && BoxesIntersect(pNode->bmins, pNode->bmaxs, pOldBox->m_vecMins, pOldBox->m_vecMaxs);
+	bool bInNew = (pNewBox != NULL) && BoxesIntersect(pNode->bmins, pNode->bmaxs, pNewBox->m_vecMins, pNewBox->m_vecMaxs);
+	if (!bInOld && !bInNew)
 	{
-		for (int nChild = 0; nChild < nChildCount; nChild++)
+		return;
+	}
+
+	if (pNode->m_nFirstChild != -1)
+	{
+		// Splitting a leaf grows the node array, so don't hang on to pNode.
+		int nFirstChild = pNode->m_nFirstChild;
+		for (int nChild = 0; nChild < 8; nChild++)
 		{
-			CCullTreeNode *pChild = GetCullTreeChild(nChild);
-			pChild->UpdateCullTreeObjectRecurse(pObject);
+			RelinkObject(nFirstChild + nChild, pObject, pOldBox, pNewBox);
 		}
+		return;
 	}
-	else
+
+	m_Stats.m_nLeavesTouched++;
+
+	if (bInOld && !bInNew)
 	{
-		UpdateCullTreeObject(pObject);
+		pNode->m_Objects.FindAndRemove(pObject);
+	}
+	else if (bInNew && !bInOld)
+	{
+		pNode->m_Objects.AddToTail(pObject);
+		if (pNode->m_Objects.Count() >= MIN_NODE_OBJECT_SPLIT)
+		{
+			SplitLeaf(nNode);
+		}
 	}
 }
 
 
 //-----------------------------------------------------------------------------
-// Purpose: 
-// Input  : pObject - The object whose bounding box has changed.
+// Purpose: Links an object into the leaves its cull box intersects.
 //-----------------------------------------------------------------------------
-void CCullTreeNode::UpdateAllCullTreeObjectsRecurse(void)
+void CCullTree::AddObject(CMapClass *pObject)
 {
-	int nChildCount = GetChildCount();
-	if (nChildCount != 0)
+	if (m_Nodes.Count() == 0)
 	{
-		for (int nChild = 0; nChild < nChildCount; nChild++)
-		{
-			CCullTreeNode *pChild = GetCullTreeChild(nChild);
-			pChild->UpdateAllCullTreeObjectsRecurse();
-		}
+		return;
 	}
-	else
+
+	// An entry left behind by a deleted object at the same address would keep the
+	// new one out of the leaves both boxes touch, so start over from a clean slate.
+	RemoveObject(pObject);
+
+	double flStartTime = Plat_FloatTime();
+
+	CullBox_t Box;
+	pObject->GetCullBox(Box.m_vecMins, Box.m_vecMaxs);
+	m_ObjectBoxes.Insert(pObject, Box);
+	RelinkObject(0, pObject, NULL, &Box);
+
+	m_Stats.m_nObjects = m_ObjectBoxes.Count();
+	m_Stats.m_nNodes = m_Nodes.Count();
+	m_Stats.m_nUpdates++;
+	m_Stats.m_flUpdateTime += Plat_FloatTime() - flStartTime;
+}
+
+
+//-----------------------------------------------------------------------------
+// Purpose: Unlinks an object from every leaf it is in.
+//-----------------------------------------------------------------------------
+void CCullTree::RemoveObject(CMapClass *pObject)
+{
+	UtlHashHandle_t hBox = m_ObjectBoxes.Find(pObject);
+	if (hBox == m_ObjectBoxes.InvalidHandle())
 	{
-		int nObjectCount = GetObjectCount();
-		for (int nObject = 0; nObject < nObjectCount; nObject++)
-		{
-			CMapClass *pObject = GetCullTreeObject(nObject);
+		return;
+	}
 
-			Vector mins;
-			Vector maxs;
-			pObject->GetCullBox(mins, maxs);
-			if (!BoxesIntersect(mins, maxs, bmins, bmaxs))
-			{
-				RemoveCullTreeObject(pObject);
-			}
-		}
+	double flStartTime = Plat_FloatTime();
+
+	CullBox_t OldBox = m_ObjectBoxes[hBox];
+	m_ObjectBoxes.Remove(pObject);
+	RelinkObject(0, pObject, &OldBox, NULL);
+
+	m_Stats.m_nObjects = m_ObjectBoxes.Count();
+	m_Stats.m_nUpdates++;
+	m_Stats.m_flUpdateTime += Plat_FloatTime() - flStartTime;
+}
+
+
+//-----------------------------------------------------------------------------
+// Purpose: Updates the culling tree due to a change in the bounding box of a
+//			given object within the tree. The object is added to any leaf nodes
+//			that it now intersects, and is removed from any leaf nodes that it
+//			no longer intersects.
+// Input  : pObject - The object whose bounding box has changed.
+//-----------------------------------------------------------------------------
+void CCullTree::UpdateObject(CMapClass *pObject)
+{
+	UtlHashHandle_t hBox = m_ObjectBoxes.Find(pObject);
+	if (hBox == m_ObjectBoxes.InvalidHandle())
+	{
+		AddObject(pObject);
+		return;
 	}
+
+	double flStartTime = Plat_FloatTime();
+
+	CullBox_t OldBox = m_ObjectBoxes[hBox];
+	CullBox_t &NewBox = m_ObjectBoxes[hBox];
+	pObject->GetCullBox(NewBox.m_vecMins, NewBox.m_vecMaxs);
+	if ((NewBox.m_vecMins != OldBox.m_vecMins) || (NewBox.m_vecMaxs != OldBox.m_vecMaxs))
+	{
+		// Splitting reads the boxes from the table, so the new box has to be in there first.
+		CullBox_t Box = NewBox;
+		RelinkObject(0, pObject, &OldBox, &Box);
+	}
+
+	m_Stats.m_nNodes = m_Nodes.Count();
+	m_Stats.m_nUpdates++;
+	m_Stats.m_flUpdateTime += Plat_FloatTime() - flStartTime;
 }
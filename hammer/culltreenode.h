@@ -1,6 +1,6 @@
 //========= Copyright  1996-2005, Valve Corporation, All rights reserved. ============//
 //
-// Purpose: 
+// Purpose:
 //
 // $Workfile:     $
 // $Date:         $
@@ -15,8 +15,11 @@
 
 #include "BoundBox.h"
 #include "MapClass.h"
+#include "tier1/utlhashtable.h"
 
+class CCullTree;
 class CCullTreeNode;
+struct BuildNode_t;
 
 class CCullTreeNode : public BoundBox
 {
@@ -28,37 +31,97 @@ class CCullTreeNode : public BoundBox
 		//
 		// Children.
 		//
-		inline int GetChildCount(void) { return(m_Children.Count()); }
-		inline CCullTreeNode *GetCullTreeChild(int nChild) { return(m_Children[nChild]); }
+		inline int GetChildCount(void) { return((m_nFirstChild != -1) ? 8 : 0); }
+		inline CCullTreeNode *GetCullTreeChild(int nChild);
 
-		void AddCullTreeChild(CCullTreeNode *pChild);
-		
 		//
 		// Objects.
 		//
 		inline int GetObjectCount(void) { return(m_Objects.Count()); }
 		inline CMapClass *GetCullTreeObject(int nObject) { return(m_Objects[nObject]); }
 
-		void AddCullTreeObject(CMapClass *pObject);
-		void AddCullTreeObjectRecurse(CMapClass *pObject);
+	protected:
+
+		friend class CCullTree;
+
+		CCullTree *m_pTree;				// The tree whose node array this node lives in.
+		int m_nFirstChild;				// Index of the first of our eight children in that array, -1 for leaves.
+		CMapObjectList m_Objects;		// The objects contained in this node. Only leaves have objects.
+};
+
+
+//-----------------------------------------------------------------------------
+// Build and update timings, for judging how the tree holds up on big maps.
+//-----------------------------------------------------------------------------
+struct CullTreeStats_t
+{
+	int m_nObjects;
+	int m_nNodes;
+	int m_nBuildThreads;
+	double m_flBuildTime;		// Seconds spent in the last Build.
+
+	int m_nUpdates;				// Inserts, removes and moves since the last Build.
+	int m_nLeavesTouched;		// Leaves visited by those updates.
+	double m_flUpdateTime;		// Seconds spent in those updates.
+};
+
+
+//-----------------------------------------------------------------------------
+// An octree over the world's root-level objects, used to cull them when rendering
+// the 3D view. The nodes live in one flat array, the eight children of a node next
+// to each other. Every object's cull box is remembered as of the last time it was
+// linked, so an object can be moved or removed by visiting only the leaves its old
+// and new boxes touch.
+//-----------------------------------------------------------------------------
+class CCullTree
+{
+	public:
 
-		CCullTreeNode *FindCullTreeObjectRecurse(CMapClass *pObject);
+		CCullTree(void);
+		~CCullTree(void);
 
-		void RemoveAllCullTreeObjects(void);
-		void RemoveAllCullTreeObjectsRecurse(void);
+		// Throws the old tree away and splits the given box around the objects.
+		void Build(const CMapObjectList &Objects, const Vector &vecMins, const Vector &vecMaxs);
 
-		void RemoveCullTreeObject(CMapClass *pObject);
-		void RemoveCullTreeObjectRecurse(CMapClass *pObject);
+		inline CCullTreeNode *GetRootNode(void) { return(&m_Nodes[0]); }
+		inline CCullTreeNode *GetNode(int nNode) { return(&m_Nodes[nNode]); }
 
-		void UpdateAllCullTreeObjects(void);
-		void UpdateAllCullTreeObjectsRecurse(void);
+		void AddObject(CMapClass *pObject);
+		void RemoveObject(CMapClass *pObject);
+		void UpdateObject(CMapClass *pObject);		// Call when the object's cull box changes.
 
-		void UpdateCullTreeObject(CMapClass *pObject);
-		void UpdateCullTreeObjectRecurse(CMapClass *pObject);
+		inline const CullTreeStats_t &GetStats(void) const { return(m_Stats); }
 
 	protected:
 
-		CUtlVector<CCullTreeNode*> m_Children;	// The child nodes. This is an octree.
-		CMapObjectList m_Objects;		// The objects contained in this node.
+		struct CullBox_t
+		{
+			Vector m_vecMins;
+			Vector m_vecMaxs;
+		};
+
+		struct BuildTask_t;
+
+		static void BuildNodeRecurse(CUtlVector<BuildNode_t> &Nodes, int nNode, const CullBox_t *pBoxes, int nDepth, CUtlVector<int> *pTaskNodes);
+		static int __cdecl CompareBuildTasks(BuildTask_t * const *ppTask1, BuildTask_t * const *ppTask2);
+
+		void SplitLeaf(int nNode);
+		void RelinkObject(int nNode, CMapClass *pObject, const CullBox_t *pOldBox, const CullBox_t *pNewBox);
+
+		void BuildTaskJob(int nJob);
+		static unsigned BuildThreadFn(void *pParam);
+
+		CUtlVector<CCullTreeNode> m_Nodes;
+		CUtlHashtable<CMapClass *, CullBox_t, PointerHashFunctor, DefaultEqualFunctor<CMapClass *> > m_ObjectBoxes;
+		CullTreeStats_t m_Stats;
+
+		// Build state shared with the worker threads.
+		CUtlVector<BuildTask_t *> m_BuildTasks;
+		int volatile m_nNextBuildTask;
 };
 
+
+CCullTreeNode *CCullTreeNode::GetCullTreeChild(int nChild)
+{
+	return(m_pTree->GetNode(m_nFirstChild + nChild));
+}
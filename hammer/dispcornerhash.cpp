@@ -0,0 +1,403 @@
+//========= Copyright Valve Corporation, All rights reserved. ============//
+//
+// Purpose: Spatial hash from displacement corners to displacements. See
+//			DispCornerHash.h.
+//
+//=============================================================================//
+
+#include "stdafx.h"
+#include "DispCornerHash.h"
+#include "GlobalFunctions.h"
+#include "tier0/platform.h"
+
+// memdbgon must be the last include file in a .cpp file!!!
+#include <tier0/memdbgon.h>
+
+
+#define DISPCORNERHASH_COORD_BITS	20
+#define DISPCORNERHASH_COORD_MASK	( ( 1 << DISPCORNERHASH_COORD_BITS ) - 1 )
+
+
+//-----------------------------------------------------------------------------
+// Purpose:
+//-----------------------------------------------------------------------------
+CDispCornerHash::CDispCornerHash()
+{
+	m_nFreeNode = -1;
+}
+
+
+//-----------------------------------------------------------------------------
+// Purpose:
+//-----------------------------------------------------------------------------
+void CDispCornerHash::Purge( void )
+{
+	m_Cells.Purge();
+	m_Nodes.Purge();
+	m_nFreeNode = -1;
+	m_Entries.Purge();
+}
+
+
+//-----------------------------------------------------------------------------
+// Purpose: Packs a cell and a power into a key. Each coordinate keeps its low
+//          DISPCORNERHASH_COORD_BITS bits and the power goes in the top bits.
+//-----------------------------------------------------------------------------
+uint64 CDispCornerHash::MakeKey( int x, int y, int z, int nPower )
+{
+	return ( uint64 )( x & DISPCORNERHASH_COORD_MASK ) |
+		   ( ( uint64 )( y & DISPCORNERHASH_COORD_MASK ) << DISPCORNERHASH_COORD_BITS ) |
+		   ( ( uint64 )( z & DISPCORNERHASH_COORD_MASK ) << ( DISPCORNERHASH_COORD_BITS * 2 ) ) |
+		   ( ( uint64 )nPower << ( DISPCORNERHASH_COORD_BITS * 3 ) );
+}
+
+
+//-----------------------------------------------------------------------------
+// Purpose:
+//-----------------------------------------------------------------------------
+void CDispCornerHash::AddNode( uint64 key, EditDispHandle_t handle )
+{
+	int nNode = m_nFreeNode;
+	if( nNode != -1 )
+	{
+		m_nFreeNode = m_Nodes[nNode].m_nNext;
+	}
+	else
+	{
+		nNode = m_Nodes.AddToTail();
+	}
+
+	m_Nodes[nNode].m_Handle = handle;
+
+	UtlHashHandle_t hCell = m_Cells.Find( key );
+	if( hCell == m_Cells.InvalidHandle() )
+	{
+		m_Nodes[nNode].m_nNext = -1;
+		m_Cells.Insert( key, nNode );
+	}
+	else
+	{
+		m_Nodes[nNode].m_nNext = m_Cells[hCell];
+		m_Cells[hCell] = nNode;
+	}
+}
+
+
+//-----------------------------------------------------------------------------
+// Purpose: Takes one of the displacement's nodes out of the cell.
+//-----------------------------------------------------------------------------
+void CDispCornerHash::RemoveNode( uint64 key, EditDispHandle_t handle )
+{
+	UtlHashHandle_t hCell = m_Cells.Find( key );
+	if( hCell == m_Cells.InvalidHandle() )
+		return;
+
+	int nPrev = -1;
+	for( int nNode = m_Cells[hCell]; nNode != -1; nPrev = nNode, nNode = m_Nodes[nNode].m_nNext )
+	{
+		if( m_Nodes[nNode].m_Handle != handle )
+			continue;
+
+		if( nPrev != -1 )
+		{
+			m_Nodes[nPrev].m_nNext = m_Nodes[nNode].m_nNext;
+		}
+		else if( m_Nodes[nNode].m_nNext != -1 )
+		{
+			m_Cells[hCell] = m_Nodes[nNode].m_nNext;
+		}
+		else
+		{
+			m_Cells.Remove( key );
+		}
+
+		m_Nodes[nNode].m_nNext = m_nFreeNode;
+		m_nFreeNode = nNode;
+		return;
+	}
+}
+
+
+//-----------------------------------------------------------------------------
+// Purpose:
+//-----------------------------------------------------------------------------
+void CDispCornerHash::Insert( EditDispHandle_t handle, const Vector *pCorners, int nPower )
+{
+	Remove( handle );
+
+	if( handle >= m_Entries.Count() )
+	{
+		int nFirst = m_Entries.AddMultipleToTail( handle + 1 - m_Entries.Count() );
+		for( int i = nFirst; i < m_Entries.Count(); i++ )
+		{
+			m_Entries[i].m_bFiled = false;
+		}
+	}
+
+	Entry_t &entry = m_Entries[handle];
+	for( int i = 0; i < 4; i++ )
+	{
+		entry.m_Corners[i] = pCorners[i];
+		AddNode( MakeKey( CellCoord( pCorners[i].x ), CellCoord( pCorners[i].y ), CellCoord( pCorners[i].z ), nPower ), handle );
+	}
+	entry.m_nPower = nPower;
+	entry.m_bFiled = true;
+}
+
+
+//-----------------------------------------------------------------------------
+// Purpose:
+//-----------------------------------------------------------------------------
+void CDispCornerHash::Remove( EditDispHandle_t handle )
+{
+	if( handle >= m_Entries.Count() || !m_Entries[handle].m_bFiled )
+		return;
+
+	Entry_t &entry = m_Entries[handle];
+	for( int i = 0; i < 4; i++ )
+	{
+		const Vector &vecCorner = entry.m_Corners[i];
+		RemoveNode( MakeKey( CellCoord( vecCorner.x ), CellCoord( vecCorner.y ), CellCoord( vecCorner.z ), entry.m_nPower ), handle );
+	}
+	entry.m_bFiled = false;
+}
+
+
+//-----------------------------------------------------------------------------
+// Purpose:
+//-----------------------------------------------------------------------------
+bool CDispCornerHash::IsCurrent( EditDispHandle_t handle, const Vector *pCorners, int nPower ) const
+{
+	if( handle >= m_Entries.Count() || !m_Entries[handle].m_bFiled )
+		return false;
+
+	const Entry_t &entry = m_Entries[handle];
+	if( entry.m_nPower != nPower )
+		return false;
+
+	for( int i = 0; i < 4; i++ )
+	{
+		if( entry.m_Corners[i] != pCorners[i] )
+			return false;
+	}
+
+	return true;
+}
+
+
+//-----------------------------------------------------------------------------
+// Purpose:
+//-----------------------------------------------------------------------------
+void CDispCornerHash::FindCandidates( EditDispHandle_t handle, const Vector *pCorners, int nPower,
+									  CUtlVector<EditDispHandle_t> &candidates ) const
+{
+	if( !m_Cells.Count() )
+		return;
+
+	// Search twice the tolerance so rounding at a cell boundary can't hide a
+	// corner. Extra candidates are weeded out by the shared point test anyway.
+	const float flSearch = DISP_SHARED_POINT_TOLERANCE * 2.0f;
+
+	for( int i = 0; i < 4; i++ )
+	{
+		const Vector &vecCorner = pCorners[i];
+		int nMinX = CellCoord( vecCorner.x - flSearch ), nMaxX = CellCoord( vecCorner.x + flSearch );
+		int nMinY = CellCoord( vecCorner.y - flSearch ), nMaxY = CellCoord( vecCorner.y + flSearch );
+		int nMinZ = CellCoord( vecCorner.z - flSearch ), nMaxZ = CellCoord( vecCorner.z + flSearch );
+
+		for( int z = nMinZ; z <= nMaxZ; z++ )
+		for( int y = nMinY; y <= nMaxY; y++ )
+		for( int x = nMinX; x <= nMaxX; x++ )
+		{
+			UtlHashHandle_t hCell = m_Cells.Find( MakeKey( x, y, z, nPower ) );
+			if( hCell == m_Cells.InvalidHandle() )
+				continue;
+
+			for( int nNode = m_Cells[hCell]; nNode != -1; nNode = m_Nodes[nNode].m_nNext )
+			{
+				EditDispHandle_t hCandidate = m_Nodes[nNode].m_Handle;
+				if( ( hCandidate != handle ) && ( candidates.Find( hCandidate ) == -1 ) )
+				{
+					candidates.AddToTail( hCandidate );
+				}
+			}
+		}
+	}
+}
+
+
+//=============================================================================
+//
+// Benchmark
+//
+
+#define DISPBENCH_QUAD_SIZE		256.0f
+#define DISPBENCH_BLOCK_SIZE	8			// quads per side in each block of the same power
+#define DISPBENCH_JITTER		0.004f		// corners of neighboring quads are off by up to twice this
+
+
+//-----------------------------------------------------------------------------
+// Purpose: Moves a corner by a repeatable amount under the tolerance, so the
+//          neighbors' copies of a grid point land on both sides of a cell
+//          boundary.
+//-----------------------------------------------------------------------------
+static float DispBench_Jitter( unsigned int nSeed )
+{
+	nSeed ^= nSeed >> 16;
+	nSeed *= 0x7feb352d;
+	nSeed ^= nSeed >> 15;
+	nSeed *= 0x846ca68b;
+	nSeed ^= nSeed >> 16;
+
+	return ( ( float )( nSeed & 0xffff ) / 65535.0f * 2.0f - 1.0f ) * DISPBENCH_JITTER;
+}
+
+
+//-----------------------------------------------------------------------------
+// Purpose: Same test as CWorldEditDispMgr::NumSharedPoints.
+//-----------------------------------------------------------------------------
+static int DispBench_NumSharedPoints( const Vector *pCorners, const Vector *pNeighborCorners )
+{
+	int ptCount = 0;
+	for( int i = 0; i < 4; i++ )
+	{
+		for( int j = 0; j < 4; j++ )
+		{
+			if( ComparePoints( pCorners[i], pNeighborCorners[j], DISP_SHARED_POINT_TOLERANCE ) )
+			{
+				ptCount++;
+				break;
+			}
+		}
+	}
+
+	return ptCount;
+}
+
+
+//-----------------------------------------------------------------------------
+// Purpose:
+//-----------------------------------------------------------------------------
+static int DispBench_CompareHandles( const EditDispHandle_t *pLeft, const EditDispHandle_t *pRight )
+{
+	return ( int )*pLeft - ( int )*pRight;
+}
+
+
+//-----------------------------------------------------------------------------
+// Purpose:
+//-----------------------------------------------------------------------------
+void RunDispNeighborBenchmark( int nGridSize )
+{
+	nGridSize = clamp( nGridSize, 2, 255 );
+	int nDisps = nGridSize * nGridSize;
+
+	//
+	// lay out a rolling grid of quads, in blocks of alternating power
+	//
+	CUtlVector<Vector> corners;
+	CUtlVector<int> powers;
+	corners.SetCount( nDisps * 4 );
+	powers.SetCount( nDisps );
+
+	static const int s_CornerOffsets[4][2] = { { 0, 0 }, { 0, 1 }, { 1, 1 }, { 1, 0 } };
+	for( int y = 0; y < nGridSize; y++ )
+	{
+		for( int x = 0; x < nGridSize; x++ )
+		{
+			int ndxDisp = y * nGridSize + x;
+			for( int i = 0; i < 4; i++ )
+			{
+				int nPointX = x + s_CornerOffsets[i][0];
+				int nPointY = y + s_CornerOffsets[i][1];
+				unsigned int nSeed = ( unsigned int )( ndxDisp * 4 + i );
+
+				Vector &vecCorner = corners[ndxDisp * 4 + i];
+				vecCorner.x = nPointX * DISPBENCH_QUAD_SIZE + DispBench_Jitter( nSeed * 3 );
+				vecCorner.y = nPointY * DISPBENCH_QUAD_SIZE + DispBench_Jitter( nSeed * 3 + 1 );
+				vecCorner.z = floor( 64.0f * sin( nPointX * 0.3f ) * cos( nPointY * 0.2f ) ) + DispBench_Jitter( nSeed * 3 + 2 );
+			}
+
+			powers[ndxDisp] = 2 + ( ( x / DISPBENCH_BLOCK_SIZE + y / DISPBENCH_BLOCK_SIZE ) & 1 );
+		}
+	}
+
+	//
+	// every pair, the way FindWorldNeighbors used to
+	//
+	double flStart = Plat_FloatTime();
+	int nPairTests = 0, nBruteShared = 0;
+	unsigned int nBruteSum = 0;
+	for( int i = 0; i < nDisps; i++ )
+	{
+		for( int j = 0; j < nDisps; j++ )
+		{
+			if( ( i == j ) || ( powers[i] != powers[j] ) )
+				continue;
+
+			nPairTests++;
+			int nShared = DispBench_NumSharedPoints( &corners[i * 4], &corners[j * 4] );
+			if( nShared )
+			{
+				nBruteShared++;
+				nBruteSum += ( ( unsigned int )i * 65599 + j ) * nShared;
+			}
+		}
+	}
+	double flBrute = Plat_FloatTime() - flStart;
+
+	//
+	// through the corner hash
+	//
+	CDispCornerHash hash;
+	flStart = Plat_FloatTime();
+	for( int i = 0; i < nDisps; i++ )
+	{
+		hash.Insert( ( EditDispHandle_t )i, &corners[i * 4], powers[i] );
+	}
+	double flBuild = Plat_FloatTime() - flStart;
+
+	flStart = Plat_FloatTime();
+	int nCandidateTests = 0, nHashShared = 0;
+	unsigned int nHashSum = 0;
+	CUtlVector<EditDispHandle_t> candidates;
+	for( int i = 0; i < nDisps; i++ )
+	{
+		candidates.RemoveAll();
+		hash.FindCandidates( ( EditDispHandle_t )i, &corners[i * 4], powers[i], candidates );
+		candidates.Sort( DispBench_CompareHandles );
+
+		for( int k = 0; k < candidates.Count(); k++ )
+		{
+			int j = candidates[k];
+			if( powers[i] != powers[j] )
+				continue;
+
+			nCandidateTests++;
+			int nShared = DispBench_NumSharedPoints( &corners[i * 4], &corners[j * 4] );
+			if( nShared )
+			{
+				nHashShared++;
+				nHashSum += ( ( unsigned int )i * 65599 + j ) * nShared;
+			}
+		}
+	}
+	double flHash = Plat_FloatTime() - flStart;
+
+	flBrute = MAX( flBrute, 1.0e-6 );
+	flHash = MAX( flHash, 1.0e-6 );
+
+	Msg( mwStatus, "Displacement neighbor benchmark: %d displacements in a %dx%d grid.", nDisps, nGridSize, nGridSize );
+	Msg( mwStatus, "  every pair: %d tests, %.3f ms.", nPairTests, flBrute * 1000.0 );
+	Msg( mwStatus, "  corner hash: %d cells built in %.3f ms, %d tests, %.3f ms (%.1fx).",
+		hash.CellCount(), flBuild * 1000.0, nCandidateTests, flHash * 1000.0, flBrute / flHash );
+
+	if( ( nBruteShared == nHashShared ) && ( nBruteSum == nHashSum ) )
+	{
+		Msg( mwStatus, "  both found the same %d neighbors.", nHashShared );
+	}
+	else
+	{
+		Msg( mwError, "  the corner hash found %d neighbors, testing every pair found %d!", nHashShared, nBruteShared );
+	}
+}
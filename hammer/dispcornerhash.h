@@ -0,0 +1,97 @@
+//========= Copyright Valve Corporation, All rights reserved. ============//
+//
+// Purpose: Spatial hash from displacement corner positions to the
+//			displacements that have a corner there, for finding neighbors
+//			without testing every displacement in the world.
+//
+//=============================================================================//
+
+#ifndef DISPCORNERHASH_H
+#define DISPCORNERHASH_H
+#pragma once
+
+#include "DispManager.h"
+#include "mathlib/vector.h"
+#include "tier1/utlhashtable.h"
+#include "tier1/utlvector.h"
+
+
+#define DISP_SHARED_POINT_TOLERANCE		0.01f		// corners closer than this on every axis are shared
+#define DISPCORNERHASH_CELL_SIZE		1.0f
+
+
+//-----------------------------------------------------------------------------
+// Corners are filed in DISPCORNERHASH_CELL_SIZE cells, keyed on the cell and
+// the displacement's power, since displacements of different powers are never
+// neighbors. A lookup visits the cells within DISP_SHARED_POINT_TOLERANCE of
+// each corner, so corners that straddle a cell boundary are still found.
+//
+// The hash only narrows down the candidates: they still have to be tested
+// with CWorldEditDispMgr::NumSharedPoints. Keys wrap far outside the map, which
+// can only add candidates, never lose them.
+//-----------------------------------------------------------------------------
+class CDispCornerHash
+{
+public:
+
+	CDispCornerHash();
+
+	void Purge( void );
+
+	// Files the displacement's four corners under its power, taking it out of
+	// wherever it was filed before.
+	void Insert( EditDispHandle_t handle, const Vector *pCorners, int nPower );
+	void Remove( EditDispHandle_t handle );
+
+	// Returns true if the displacement is filed with exactly these corners and power.
+	bool IsCurrent( EditDispHandle_t handle, const Vector *pCorners, int nPower ) const;
+
+	// Adds every other displacement of the given power that has a corner near
+	// one of these corners to the list, once each.
+	void FindCandidates( EditDispHandle_t handle, const Vector *pCorners, int nPower, CUtlVector<EditDispHandle_t> &candidates ) const;
+
+	int CellCount( void ) const		{ return m_Cells.Count(); }
+
+private:
+
+	struct KeyHashFunctor_t
+	{
+		unsigned int operator()( uint64 key ) const		{ return ( unsigned int )( ( key * 0x9E3779B97F4A7C15ULL ) >> 32 ); }
+	};
+
+	struct Entry_t
+	{
+		Vector	m_Corners[4];			// where the corners were filed
+		int		m_nPower;
+		bool	m_bFiled;
+	};
+
+	struct Node_t
+	{
+		EditDispHandle_t	m_Handle;
+		int					m_nNext;	// next node in the cell, or -1
+	};
+
+	static int CellCoord( float flCoord )		{ return ( int )floor( flCoord * ( 1.0f / DISPCORNERHASH_CELL_SIZE ) ); }
+	static uint64 MakeKey( int x, int y, int z, int nPower );
+
+	void AddNode( uint64 key, EditDispHandle_t handle );
+	void RemoveNode( uint64 key, EditDispHandle_t handle );
+
+	CUtlHashtable<uint64, int, KeyHashFunctor_t>	m_Cells;		// cell key -> first node
+	CUtlVector<Node_t>								m_Nodes;
+	int												m_nFreeNode;	// free nodes are chained through m_nNext
+	CUtlVector<Entry_t>								m_Entries;		// indexed by handle
+};
+
+
+// Returns true if the points are within the tolerance of each other on every axis.
+bool ComparePoints( const Vector& v1, const Vector& v2, float tolerance );
+
+// Times neighbor discovery on a synthetic grid of nGridSize x nGridSize
+// displacements, testing every pair against looking candidates up in the
+// corner hash, and checks that both find the same neighbors.
+void RunDispNeighborBenchmark( int nGridSize );
+
+
+#endif // DISPCORNERHASH_H
@@ -14,6 +14,7 @@
 #include "MapDisp.h"
 #include "DispSubdiv.h"
 #include "History.h"
+#include "DispCornerHash.h"
 #include "tier0/minidump.h"
 
 // memdbgon must be the last include file in a .cpp file!!!
@@ -173,6 +174,8 @@ public: // functions
 
 private: // functions
 
+	int GetWorldIndex( EditDispHandle_t handle );
+	void UpdateCornerHash( EditDispHandle_t handle, CMapDisp *pDisp );
 	void TestNeighbors( CMapDisp *pDisp, CMapDisp *pNeighborDisp );
 	int GetCornerIndex( int index );
 	int GetEdgeIndex( int *edge );
@@ -182,8 +185,11 @@ private: // functions
 private: // variables
 
 	CUtlVector<EditDispHandle_t>	m_WorldList;
+	CUtlVector<int>					m_WorldIndices;			// m_WorldList index of each handle, -1 if it isn't in the world
 	CUtlVector<EditDispHandle_t>	m_SelectList;
 
+	CDispCornerHash					m_CornerHash;			// corners of the displacements in the world, for finding neighbors
+
 	IEditDispSubdivMesh				*m_pSubdivMesh;			// pointer to the subdivision mesh
 
 	CUtlVector<CMapClass*>			m_aKeptList;
@@ -229,7 +235,9 @@ CWorldEditDispMgr::~CWorldEditDispMgr()
 {
 	// clear the displacement manager lists
 	m_WorldList.Purge();
+	m_WorldIndices.Purge();
 	m_SelectList.Purge();
+	m_CornerHash.Purge();
 
 	// de-allocate the subdivision mesh
 	DestroyEditDispSubdivMesh( &m_pSubdivMesh );
@@ -263,7 +271,7 @@ CMapDisp *CWorldEditDispMgr::GetFromWorld( int iWorldList )
 //-----------------------------------------------------------------------------
 CMapDisp *CWorldEditDispMgr::GetFromWorld( EditDispHandle_t handle )
 {
-	int ndx = m_WorldList.Find( handle );
+	int ndx = GetWorldIndex( handle );
 	if( ndx != -1 )
 	{
 		return EditDispMgr()->GetDisp( handle );
@@ -278,17 +286,28 @@ CMapDisp *CWorldEditDispMgr::GetFromWorld( EditDispHandle_t handle )
 //-----------------------------------------------------------------------------
 void CWorldEditDispMgr::AddToWorld( EditDispHandle_t handle )
 {
-	int ndx = m_WorldList.Find( handle );
+	int ndx = GetWorldIndex( handle );
 	if( ndx == -1 )
 	{
 		ndx = m_WorldList.AddToTail();
 		m_WorldList[ndx] = handle;
+
+		if( handle >= m_WorldIndices.Count() )
+		{
+			int nFirst = m_WorldIndices.AddMultipleToTail( handle + 1 - m_WorldIndices.Count() );
+			for( int i = nFirst; i < m_WorldIndices.Count(); i++ )
+			{
+				m_WorldIndices[i] = -1;
+			}
+		}
+		m_WorldIndices[handle] = ndx;
 	}
 
 	// Update itself when it gets added to the world.
 	CMapDisp *pDisp = EditDispMgr()->GetDisp( handle );
 	if ( pDisp )
 	{
+		UpdateCornerHash( handle, pDisp );
 		pDisp->UpdateData();
 	}
 }
@@ -299,14 +318,64 @@ void CWorldEditDispMgr::AddToWorld( EditDispHandle_t handle )
 //-----------------------------------------------------------------------------
 void CWorldEditDispMgr::RemoveFromWorld( EditDispHandle_t handle )
 {
-	int ndx = m_WorldList.Find( handle );
+	int ndx = GetWorldIndex( handle );
 	if( ndx != -1 )
 	{
 		m_WorldList.Remove( ndx );
+		m_WorldIndices[handle] = -1;
+
+		// the displacements after it moved down one
+		for( int i = ndx; i < m_WorldList.Count(); i++ )
+		{
+			m_WorldIndices[m_WorldList[i]] = i;
+		}
+
+		m_CornerHash.Remove( handle );
 	}
 }
 
 
+//-----------------------------------------------------------------------------
+// Purpose: Returns the displacement's index in the world list, or -1 if it
+//          isn't in the world.
+//-----------------------------------------------------------------------------
+int CWorldEditDispMgr::GetWorldIndex( EditDispHandle_t handle )
+{
+	if( handle >= m_WorldIndices.Count() )
+		return -1;
+
+	return m_WorldIndices[handle];
+}
+
+
+//-----------------------------------------------------------------------------
+// Purpose: Re-files the displacement in the corner hash if its corners or
+//          power changed since it was last filed.
+//-----------------------------------------------------------------------------
+void CWorldEditDispMgr::UpdateCornerHash( EditDispHandle_t handle, CMapDisp *pDisp )
+{
+	Vector corners[4];
+	for( int i = 0; i < 4; i++ )
+	{
+		pDisp->GetSurfPoint( i, corners[i] );
+	}
+
+	if( !m_CornerHash.IsCurrent( handle, corners, pDisp->GetPower() ) )
+	{
+		m_CornerHash.Insert( handle, corners, pDisp->GetPower() );
+	}
+}
+
+
+//-----------------------------------------------------------------------------
+// Purpose:
+//-----------------------------------------------------------------------------
+static int CompareWorldIndices( const int *pLeft, const int *pRight )
+{
+	return *pLeft - *pRight;
+}
+
+
 //-----------------------------------------------------------------------------
 // Purpose:
 // NOTE: this will be in the common code soon!!!!!!!!!
@@ -319,13 +388,40 @@ void CWorldEditDispMgr::FindWorldNeighbors( EditDispHandle_t handle )
 		return;
 
 	//
-	// compare against all of the displacements in the world
+	// CMapDisp looks for its neighbors whenever its surface is rebuilt, so
+	// this is where a moved or resampled displacement gets re-filed
+	//
+	UpdateCornerHash( handle, pDisp );
+
+	//
+	// only compare against the displacements with a corner near one of ours,
+	// in world list order so neighbors are added in the same order as before
 	//
-	int count = WorldCount();
-	for( int ndx = 0; ndx < count; ndx++ )
+	Vector corners[4];
+	for( int i = 0; i < 4; i++ )
+	{
+		pDisp->GetSurfPoint( i, corners[i] );
+	}
+
+	CUtlVector<EditDispHandle_t> candidates;
+	m_CornerHash.FindCandidates( handle, corners, pDisp->GetPower(), candidates );
+
+	CUtlVector<int> worldIndices;
+	for( int i = 0; i < candidates.Count(); i++ )
+	{
+		int ndx = GetWorldIndex( candidates[i] );
+		if( ndx != -1 )
+		{
+			worldIndices.AddToTail( ndx );
+		}
+	}
+	worldIndices.Sort( CompareWorldIndices );
+
+	int count = worldIndices.Count();
+	for( int i = 0; i < count; i++ )
 	{
 		// get the potential neighbor surface
-		CMapDisp *pNeighborDisp = GetFromWorld( ndx );
+		CMapDisp *pNeighborDisp = GetFromWorld( worldIndices[i] );
 
 		// check for valid neighbor and don't compare against self
 		if( !pNeighborDisp || ( pNeighborDisp == pDisp ) )
@@ -413,7 +509,7 @@ int CWorldEditDispMgr::NumSharedPoints( CMapDisp *pDisp, CMapDisp *pNeighborDisp
 			Vector pt1, pt2;
 			pDisp->GetSurfPoint( i, pt1 );
 			pNeighborDisp->GetSurfPoint( j, pt2 );
-			if( ComparePoints( pt1, pt2, 0.01f ) )
+			if( ComparePoints( pt1, pt2, DISP_SHARED_POINT_TOLERANCE ) )
 				break;
 		}
 
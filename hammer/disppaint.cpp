@@ -12,6 +12,7 @@
 #include "DispManager.h"
 #include "MapDoc.h"
 #include "MapDisp.h"
+#include "MapFace.h"
 #include "GlobalFunctions.h"
 #include "History.h"
 #include "DispSew.h"
@@ -85,21 +86,28 @@ bool CDispPaintMgr::PostPaint( bool bAutoSew )
 	if( !pDispMgr )
 		return false;
 
-	// Update the modified displacements.
+	// Update the displacements painted since the last update.
+	CUtlVector<CMapFace*> aPaintedFaces;
 	int nDispCount = pDispMgr->SelectCount();
 	for ( int iDisp = 0; iDisp < nDispCount; iDisp++ )
 	{
 		CMapDisp *pDisp = pDispMgr->GetFromSelect( iDisp );
-		if ( pDisp )
+		if ( pDisp && pDisp->Paint_IsUpdatePending() )
 		{
 			pDisp->Paint_Update( false );
+
+			CMapFace *pFace = static_cast<CMapFace*>( pDisp->GetParent() );
+			if ( pFace )
+			{
+				aPaintedFaces.AddToTail( pFace );
+			}
 		}
 	}
 
-	// Auto "sew" if necessary.
-	if ( bAutoSew )
+	// Auto "sew" the edges of the painted displacements if necessary.
+	if ( bAutoSew && ( aPaintedFaces.Count() > 0 ) )
 	{
-		FaceListSewEdges();
+		FaceListSewChangedEdges( aPaintedFaces );
 	}
 
 	return true;
@@ -74,6 +74,26 @@ static CUtlVector<SewCornerData_t*> s_CornerData;
 static CUtlVector<SewTJuncData_t*> s_TJData;
 static CUtlVector<CCoreDispInfo*> m_aCoreDispInfos;
 
+//
+// The edge/midpoint/corner info is kept between incremental sews, along with
+// what it was built from, so it is only rebuilt when the selection set changes.
+//
+struct SewFaceKey_t
+{
+	CMapFace			*pFace;
+	EditDispHandle_t	dispHandle;
+	int					power;
+	int					ptCount;
+};
+
+static CUtlVector<SewFaceKey_t> s_SewKeys;
+static CUtlVector<Vector> s_SewKeyPoints;
+static CUtlVector<unsigned long> s_SewKeyAllowedVerts;
+static bool s_bSewDataKept = false;
+
+static CUtlVector<CMapFace*> *s_pChangedFaces = NULL;	// only resolve sews with these faces (NULL = all)
+static CUtlVector<CMapFace*> s_SewnFaces;				// faces touched by the resolved sews
+
 // local functions
 void SewCorner_Build( void );
 void SewCorner_Resolve( void );
@@ -86,6 +106,7 @@ void SewEdge_Resolve( void );
 void SewEdge_Destroy( SewEdgeData_t *pEdgeData );
 
 void PlanarizeDependentVerts( void );
+void SnapDependentVertsToSurface( CCoreDispInfo *pCoreDisp );
 
 //-----------------------------------------------------------------------------
 // Purpose: compare two point positions to see if they are equivolent given a
@@ -479,21 +500,10 @@ void Faces_Update( void )
 }
 
 //-----------------------------------------------------------------------------
-// Purpose: Build temporary edge/midpoint/corner info for sewing.
+// Purpose: Destroy the edge/midpoint/corner info, including any kept from
+//          the last incremental sew.
 //-----------------------------------------------------------------------------
-void PreFaceListSew( void )
-{
-	// Build edge/midpoint/corner data.
-	SewCorner_Build();
-	SewTJunc_Build();
-	SewEdge_Build();
-}
-
-//-----------------------------------------------------------------------------
-// Purpose: Destroy temporary edge/midpoint/corner info for sewing and
-//          update the effected displacements.
-//-----------------------------------------------------------------------------
-void PostFaceListSew( void )
+void FaceListSew_Destroy( void )
 {
 	// Destroy all corners, midpoint, edges.
 	int count = s_CornerData.Size();
@@ -519,10 +529,156 @@ void PostFaceListSew( void )
 	s_TJData.Purge();
 	s_EdgeData.Purge();
 
+	s_SewKeys.Purge();
+	s_SewKeyPoints.Purge();
+	s_SewKeyAllowedVerts.Purge();
+	s_bSewDataKept = false;
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Build temporary edge/midpoint/corner info for sewing.
+//-----------------------------------------------------------------------------
+void PreFaceListSew( void )
+{
+	// Clear out anything kept from an incremental sew.
+	FaceListSew_Destroy();
+
+	// Build edge/midpoint/corner data.
+	SewCorner_Build();
+	SewTJunc_Build();
+	SewEdge_Build();
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Destroy temporary edge/midpoint/corner info for sewing and
+//          update the effected displacements.
+//-----------------------------------------------------------------------------
+void PostFaceListSew( void )
+{
+	FaceListSew_Destroy();
+
 	// Update the faces.
 	Faces_Update();
 }
 
+//-----------------------------------------------------------------------------
+// Purpose: Save (or compare against the saved) faces in the selection set,
+//          their surface points, displacement powers and allowed verts.
+//-----------------------------------------------------------------------------
+bool FaceListSew_Key( CFaceEditSheet *pSheet, bool bSave )
+{
+	if( bSave )
+	{
+		s_SewKeys.RemoveAll();
+		s_SewKeyPoints.RemoveAll();
+		s_SewKeyAllowedVerts.RemoveAll();
+	}
+
+	int faceCount = pSheet->GetFaceListCount();
+	if( !bSave && ( faceCount != s_SewKeys.Count() ) )
+		return false;
+
+	int ndxPoint = 0;
+	int ndxAllowed = 0;
+	for( int ndxFace = 0; ndxFace < faceCount; ndxFace++ )
+	{
+		SewFaceKey_t key;
+		key.pFace = pSheet->GetFaceListDataFace( ndxFace );
+		key.dispHandle = EDITDISPHANDLE_INVALID;
+		key.power = 0;
+		key.ptCount = 0;
+
+		CCoreDispInfo *pCoreDisp = NULL;
+		if( key.pFace )
+		{
+			key.dispHandle = key.pFace->GetDisp();
+			key.ptCount = key.pFace->GetPointCount();
+			if( key.dispHandle != EDITDISPHANDLE_INVALID )
+			{
+				CMapDisp *pDisp = EditDispMgr()->GetDisp( key.dispHandle );
+				key.power = pDisp->GetPower();
+				pCoreDisp = pDisp->GetCoreDispInfo();
+			}
+		}
+
+		if( bSave )
+		{
+			s_SewKeys.AddToTail( key );
+		}
+		else
+		{
+			const SewFaceKey_t &savedKey = s_SewKeys[ndxFace];
+			if( ( key.pFace != savedKey.pFace ) || ( key.dispHandle != savedKey.dispHandle ) ||
+				( key.power != savedKey.power ) || ( key.ptCount != savedKey.ptCount ) )
+				return false;
+		}
+
+		for( int ndxPt = 0; ndxPt < key.ptCount; ndxPt++, ndxPoint++ )
+		{
+			Vector pt;
+			GetPointFromSurface( key.pFace, ndxPt, pt );
+			if( bSave )
+			{
+				s_SewKeyPoints.AddToTail( pt );
+			}
+			else if( pt != s_SewKeyPoints[ndxPoint] )
+			{
+				return false;
+			}
+		}
+
+		if( pCoreDisp )
+		{
+			int dwordCount = pCoreDisp->AllowedVerts_GetNumDWords();
+			for( int ndxDWord = 0; ndxDWord < dwordCount; ndxDWord++, ndxAllowed++ )
+			{
+				unsigned long dword = pCoreDisp->AllowedVerts_GetDWord( ndxDWord );
+				if( bSave )
+				{
+					s_SewKeyAllowedVerts.AddToTail( dword );
+				}
+				else if( ( ndxAllowed >= s_SewKeyAllowedVerts.Count() ) || ( dword != s_SewKeyAllowedVerts[ndxAllowed] ) )
+				{
+					return false;
+				}
+			}
+		}
+	}
+
+	return true;
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Returns true if a sew between the given faces should be resolved,
+//          and remembers the faces so they are updated afterwards.
+//-----------------------------------------------------------------------------
+bool FaceListSew_ShouldResolve( CMapFace **ppFaces, int faceCount )
+{
+	// resolving everything
+	if( !s_pChangedFaces )
+		return true;
+
+	int ndxFace;
+	for( ndxFace = 0; ndxFace < faceCount; ndxFace++ )
+	{
+		if( s_pChangedFaces->Find( ppFaces[ndxFace] ) != -1 )
+			break;
+	}
+
+	if( ndxFace == faceCount )
+		return false;
+
+	for( ndxFace = 0; ndxFace < faceCount; ndxFace++ )
+	{
+		if( s_SewnFaces.Find( ppFaces[ndxFace] ) == -1 )
+		{
+			s_SewnFaces.AddToTail( ppFaces[ndxFace] );
+		}
+	}
+
+	return true;
+}
+
 //-----------------------------------------------------------------------------
 // Purpose: given a face with a displacement surface, "sew" all edges to all
 //          neighboring displacement and non-displacement surfaces 
@@ -545,6 +701,76 @@ void FaceListSewEdges( void )
 	PostFaceListSew();
 }
 
+//-----------------------------------------------------------------------------
+// Purpose: "sew" only the edges the given faces share with the rest of the
+//          selection set, after only those faces' displacements changed. The
+//          edge/midpoint/corner info is kept for the next call, and only
+//          rebuilt when the selection set or its surfaces have changed.
+//-----------------------------------------------------------------------------
+void FaceListSewChangedEdges( CUtlVector<CMapFace*> &aChangedFaces )
+{
+	CFaceEditSheet *pSheet = GetMainWnd()->GetFaceEditSheet();
+	if( !pSheet )
+		return;
+
+	bool bRebuilt = false;
+	if( !s_bSewDataKept || !FaceListSew_Key( pSheet, false ) )
+	{
+		// Setup.
+		PreFaceListSew();
+
+		// Resolve/Planarize unusable verts.
+		PlanarizeDependentVerts();
+
+		FaceListSew_Key( pSheet, true );
+		s_bSewDataKept = true;
+		bRebuilt = true;
+	}
+	else
+	{
+		// The allowed verts are the same as when they were planarized, so only
+		// the changed displacements can have unusable verts off the surface.
+		for( int ndxFace = 0; ndxFace < aChangedFaces.Count(); ndxFace++ )
+		{
+			EditDispHandle_t dispHandle = aChangedFaces[ndxFace]->GetDisp();
+			if( dispHandle == EDITDISPHANDLE_INVALID )
+				continue;
+
+			CMapDisp *pDisp = EditDispMgr()->GetDisp( dispHandle );
+			SnapDependentVertsToSurface( pDisp->GetCoreDispInfo() );
+		}
+	}
+
+	// Resolve the sewing with the changed faces.
+	s_SewnFaces.RemoveAll();
+	s_SewnFaces.AddVectorToTail( aChangedFaces );
+	s_pChangedFaces = &aChangedFaces;
+
+	SewCorner_Resolve();
+	SewTJunc_Resolve();
+	SewEdge_Resolve();
+
+	s_pChangedFaces = NULL;
+
+	// Update the faces - all of them if the planarize touched them all.
+	if( bRebuilt )
+	{
+		Faces_Update();
+	}
+	else
+	{
+		for( int ndxFace = 0; ndxFace < s_SewnFaces.Count(); ndxFace++ )
+		{
+			EditDispHandle_t dispHandle = s_SewnFaces[ndxFace]->GetDisp();
+			if( dispHandle == EDITDISPHANDLE_INVALID )
+				continue;
+
+			CMapDisp *pDisp = EditDispMgr()->GetDisp( dispHandle );
+			pDisp->UpdateDataRegion( 0, 0, pDisp->GetWidth() - 1, pDisp->GetHeight() - 1 );
+		}
+	}
+}
+
 //-----------------------------------------------------------------------------
 //-----------------------------------------------------------------------------
 SewCornerData_t *SewCorner_Create( void )
@@ -913,7 +1139,7 @@ void SewCorner_Resolve( void )
 	{
 		// get the current corner data struct
 		SewCornerData_t *pCornerData = s_CornerData.Element( i );
-		if( !pCornerData )
+		if( !pCornerData || !FaceListSew_ShouldResolve( pCornerData->pFaces, pCornerData->faceCount ) )
 			continue;
 
 		// determine if any of the faces is solid
@@ -1284,7 +1510,7 @@ void SewTJunc_Resolve( void )
 	{
 		// get the current t-junction data struct
 		SewTJuncData_t *pTJData = s_TJData.Element( i );
-		if( !pTJData )
+		if( !pTJData || !FaceListSew_ShouldResolve( pTJData->pFaces, pTJData->faceCount ) )
 			continue;
 
 		// determine if any of the faces is solid
@@ -2042,7 +2268,7 @@ void SewEdge_Resolve( void )
 	{
 		// get the current edge data struct
 		SewEdgeData_t *pEdgeData = s_EdgeData.Element( i );
-		if( !pEdgeData )
+		if( !pEdgeData || !FaceListSew_ShouldResolve( pEdgeData->pFaces, pEdgeData->faceCount ) )
 			continue;
 
 		// handle "normal" edge
@@ -10,6 +10,11 @@
 #define DISPSEW_H
 #pragma once
 
+#include "UtlVector.h"
+
+class CMapFace;
+
 void FaceListSewEdges( void );
+void FaceListSewChangedEdges( CUtlVector<CMapFace*> &aChangedFaces );
 
 #endif // DISPSEW_H
\ No newline at end of file
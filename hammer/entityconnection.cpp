@@ -280,6 +280,23 @@ bool CEntityConnection::ValidateTarget( const CMapEntityList* pEntityList, bool
 }
 
 
+//------------------------------------------------------------------------------
+// Purpose: Returns true if the given target name matches an entity in the
+//			world. Uses the world's name index instead of scanning its entities.
+//------------------------------------------------------------------------------
+bool CEntityConnection::ValidateTarget( CMapWorld *pWorld, bool bVisibilityCheck, const char *pszTarget)
+{
+	if (!pWorld || !pszTarget)
+		return false;
+
+	// These procedural names are always assumed to exist.
+	if (!stricmp(pszTarget, "!activator") || !stricmp(pszTarget, "!caller") || !stricmp(pszTarget, "!player") || !stricmp(pszTarget, "!self"))
+		return true;
+
+	return (pWorld->FindEntityByName(pszTarget, bVisibilityCheck) != NULL);
+}
+
+
 //------------------------------------------------------------------------------
 // Purpose: Returns true if all entities with the given target name
 //			have an input of the given input name
@@ -330,16 +347,12 @@ void CEntityConnection::FindBadConnections(CMapEntity *pEntity, bool bVisibility
 		return;
 	}
 
-	// Get a list of all the entities in the world
-	const CMapEntityList *pAllWorldEntities = NULL;
+	// Get the world to look the targets up in
+	CMapWorld *pWorld = NULL;
 	CMapDoc *pDoc = CMapDoc::GetActiveMapDoc();
 	if (pDoc)
 	{
-		CMapWorld *pWorld = pDoc->GetMapWorld();
-		if (pWorld)
-		{
-			pAllWorldEntities = pWorld->EntityList_GetList();
-		}
+		pWorld = pDoc->GetMapWorld();
 	}
 
 	// For each connection
@@ -361,7 +374,7 @@ void CEntityConnection::FindBadConnections(CMapEntity *pEntity, bool bVisibility
 				BadConnectionList.AddToTail(pConnection);
 			}
 			// Check validity of target entity (is it in the map?)
-			else if (!CEntityConnection::ValidateTarget(pAllWorldEntities, bVisibilityCheck, pConnection->GetTargetName()))
+			else if (!CEntityConnection::ValidateTarget(pWorld, bVisibilityCheck, pConnection->GetTargetName()))
 			{
 				BadConnectionList.AddToTail(pConnection);
 			}
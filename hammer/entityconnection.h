@@ -41,6 +41,7 @@ enum
 };
 
 class CMapEntity;
+class CMapWorld;
 typedef CUtlReferenceVector<CMapEntity> CMapEntityList;
 
 class CEntityConnection
@@ -95,6 +96,7 @@ public:
 	static bool ValidateOutput(CMapEntity *pEntity, const char* pszOutput);
 	static bool ValidateOutput(const CMapEntityList *pEntityList, const char* pszOutput);
 	static bool ValidateTarget(const CMapEntityList *pEntityList, bool bVisibilityCheck, const char* pszTarget);
+	static bool ValidateTarget(CMapWorld *pWorld, bool bVisibilityCheck, const char* pszTarget);
 	static bool ValidateInput(const char* pszTarget, const char* pszInput, bool bVisiblesOnly);
 
 	static int  ValidateOutputConnections(CMapEntity *pEntity, bool bVisibilityCheck, bool bIgnoreHiddenTargets=false );
@@ -0,0 +1,730 @@
+//========= Copyright Valve Corporation, All rights reserved. ============//
+//
+// Purpose: Hash indices over the entities in a world. See EntityIndex.h.
+//
+//=============================================================================//
+
+#include "stdafx.h"
+#include "EntityIndex.h"
+
+// memdbgon must be the last include file in a .cpp file!!!
+#include <tier0/memdbgon.h>
+
+
+#define ENTITY_INDEX_MIN_TRIE_REBUILD	256		// Dead trie nodes tolerated before the trie is rebuilt.
+
+
+//-----------------------------------------------------------------------------
+// Purpose: Constructor.
+//-----------------------------------------------------------------------------
+CEntityIndex::CEntityIndex(void)
+{
+	memset(&m_Stats, 0, sizeof(m_Stats));
+}
+
+
+//-----------------------------------------------------------------------------
+// Purpose: Destructor.
+//-----------------------------------------------------------------------------
+CEntityIndex::~CEntityIndex(void)
+{
+	RemoveAll();
+
+	for (int i = 0; i < m_Keys.Count(); i++)
+	{
+		IndexedKey_t *pKey = m_Keys[i];
+		delete pKey->m_Values[pKey->m_nMissing];
+		delete pKey;
+	}
+}
+
+
+//-----------------------------------------------------------------------------
+// Purpose: Returns the index of the given key in m_Keys, -1 if the key isn't
+//			indexed.
+//-----------------------------------------------------------------------------
+int CEntityIndex::FindKey(const char *pszKey)
+{
+	for (int i = 0; i < m_Keys.Count(); i++)
+	{
+		if (!stricmp(m_Keys[i]->m_szKey, pszKey))
+		{
+			return(i);
+		}
+	}
+
+	return(-1);
+}
+
+
+bool CEntityIndex::IsKeyIndexed(const char *pszKey)
+{
+	return(FindKey(pszKey) != -1);
+}
+
+
+//-----------------------------------------------------------------------------
+// Purpose: Returns the value the entity is indexed under for the given key,
+//			NULL if the entity doesn't have the key.
+//-----------------------------------------------------------------------------
+const char *CEntityIndex::GetIndexedValue(const IndexedKey_t *pKey, CMapEntity *pEntity)
+{
+	if (pKey->m_bClassName)
+	{
+		return(pEntity->GetClassName());
+	}
+
+	return(pEntity->GetKeyValue(pKey->m_szKey));
+}
+
+
+//-----------------------------------------------------------------------------
+// Purpose: Starts indexing the given key, for the entities already in the
+//			index as well as the ones that are added later.
+//-----------------------------------------------------------------------------
+bool CEntityIndex::AddKey(const char *pszKey)
+{
+	if (IsKeyIndexed(pszKey))
+	{
+		return(true);
+	}
+
+	if (m_Keys.Count() == ENTITY_INDEX_MAX_KEYS)
+	{
+		return(false);
+	}
+
+	IndexedKey_t *pKey = new IndexedKey_t;
+	Q_strncpy(pKey->m_szKey, pszKey, sizeof(pKey->m_szKey));
+	pKey->m_bClassName = !stricmp(pszKey, ENTITY_INDEX_CLASSNAME);
+
+	IndexedValue_t *pMissing = new IndexedValue_t;
+	pMissing->m_pszValue = NULL;
+	pMissing->m_nTrieNode = -1;
+	pKey->m_nMissing = pKey->m_Values.AddToTail(pMissing);
+
+	RebuildTrie(pKey);
+
+	int nKey = m_Keys.AddToTail(pKey);
+
+	FOR_EACH_HASHTABLE(m_Entities, i)
+	{
+		LinkEntity(nKey, m_Entities.Key(i), m_Entities.Element(i));
+	}
+
+	return(true);
+}
+
+
+//-----------------------------------------------------------------------------
+// Purpose: Returns the slot holding the entities with the given value,
+//			creating it if there isn't one yet.
+//-----------------------------------------------------------------------------
+int CEntityIndex::AddValue(IndexedKey_t *pKey, const char *pszValue)
+{
+	if (pszValue == NULL)
+	{
+		return(pKey->m_nMissing);
+	}
+
+	UtlHashHandle_t hValue = pKey->m_ValueTable.Find(pszValue);
+	if (hValue != pKey->m_ValueTable.InvalidHandle())
+	{
+		return(pKey->m_ValueTable.Element(hValue));
+	}
+
+	IndexedValue_t *pValue = new IndexedValue_t;
+	int nLen = strlen(pszValue);
+	pValue->m_pszValue = new char[nLen + 1];
+	memcpy(pValue->m_pszValue, pszValue, nLen + 1);
+	pValue->m_nTrieNode = -1;
+
+	int nValue;
+	if (pKey->m_FreeValues.Count() != 0)
+	{
+		nValue = pKey->m_FreeValues.Tail();
+		pKey->m_FreeValues.RemoveMultipleFromTail(1);
+		pKey->m_Values[nValue] = pValue;
+	}
+	else
+	{
+		nValue = pKey->m_Values.AddToTail(pValue);
+	}
+
+	pKey->m_ValueTable.Insert(pValue->m_pszValue, nValue);
+
+	if (strchr(pszValue, '*') != NULL)
+	{
+		pKey->m_WildcardValues.AddToTail(nValue);
+	}
+	else
+	{
+		InsertTrieValue(pKey, nValue);
+	}
+
+	return(nValue);
+}
+
+
+//-----------------------------------------------------------------------------
+// Purpose: Frees a value slot that no entity has anymore.
+//-----------------------------------------------------------------------------
+void CEntityIndex::RemoveValue(IndexedKey_t *pKey, int nValue)
+{
+	IndexedValue_t *pValue = pKey->m_Values[nValue];
+	Assert((nValue != pKey->m_nMissing) && (pValue->m_Entities.Count() == 0));
+
+	pKey->m_ValueTable.Remove(pValue->m_pszValue);
+
+	if (pValue->m_nTrieNode != -1)
+	{
+		pKey->m_Trie[pValue->m_nTrieNode].m_nValue = -1;
+		pKey->m_nTrieChars -= strlen(pValue->m_pszValue);
+	}
+	else
+	{
+		pKey->m_WildcardValues.FindAndFastRemove(nValue);
+	}
+
+	delete [] pValue->m_pszValue;
+	delete pValue;
+
+	pKey->m_Values[nValue] = NULL;
+	pKey->m_FreeValues.AddToTail(nValue);
+
+	//
+	// Renamed and deleted entities leave dead branches behind. Throw them away
+	// once there are more of them than live ones.
+	//
+	if (pKey->m_Trie.Count() > (pKey->m_nTrieChars * 2) + ENTITY_INDEX_MIN_TRIE_REBUILD)
+	{
+		RebuildTrie(pKey);
+	}
+}
+
+
+//-----------------------------------------------------------------------------
+// Purpose: Adds the entity to the slot of its value for the given key.
+//-----------------------------------------------------------------------------
+void CEntityIndex::LinkEntity(int nKey, CMapEntity *pEntity, IndexedEntity_t &Entity)
+{
+	IndexedKey_t *pKey = m_Keys[nKey];
+
+	int nValue = AddValue(pKey, GetIndexedValue(pKey, pEntity));
+	Entity.m_nValue[nKey] = nValue;
+	Entity.m_nPosition[nKey] = pKey->m_Values[nValue]->m_Entities.AddToTail(pEntity);
+}
+
+
+//-----------------------------------------------------------------------------
+// Purpose: Removes the entity from the slot of its value for the given key.
+//			The last entity in the slot takes its place.
+//-----------------------------------------------------------------------------
+void CEntityIndex::UnlinkEntity(int nKey, IndexedEntity_t &Entity)
+{
+	IndexedKey_t *pKey = m_Keys[nKey];
+	int nValue = Entity.m_nValue[nKey];
+	IndexedValue_t *pValue = pKey->m_Values[nValue];
+
+	int nPosition = Entity.m_nPosition[nKey];
+	int nLast = pValue->m_Entities.Count() - 1;
+	if (nPosition != nLast)
+	{
+		CMapEntity *pMoved = pValue->m_Entities[nLast];
+		pValue->m_Entities[nPosition] = pMoved;
+		m_Entities.GetPtr(pMoved)->m_nPosition[nKey] = nPosition;
+	}
+	pValue->m_Entities.RemoveMultipleFromTail(1);
+
+	if ((pValue->m_Entities.Count() == 0) && (nValue != pKey->m_nMissing))
+	{
+		RemoveValue(pKey, nValue);
+	}
+
+	Entity.m_nValue[nKey] = -1;
+	Entity.m_nPosition[nKey] = -1;
+}
+
+
+//-----------------------------------------------------------------------------
+// Purpose: Adds an entity to the flat list and to every key's index.
+// Output : Returns false if the entity was in the index already.
+//-----------------------------------------------------------------------------
+bool CEntityIndex::AddEntity(CMapEntity *pEntity)
+{
+	if (HasEntity(pEntity))
+	{
+		return(false);
+	}
+
+	Assert(pEntity->m_pEntityIndex == NULL);
+
+	IndexedEntity_t Entity;
+	Entity.m_nListIndex = m_EntityList.Count();
+	m_EntityList.AddToTail(pEntity);
+
+	for (int i = 0; i < m_Keys.Count(); i++)
+	{
+		LinkEntity(i, pEntity, Entity);
+	}
+
+	m_Entities.Insert(pEntity, Entity);
+	pEntity->m_pEntityIndex = this;
+
+	return(true);
+}
+
+
+//-----------------------------------------------------------------------------
+// Purpose: Removes an entity from the flat list and from every key's index.
+// Output : Returns false if the entity wasn't in the index.
+//-----------------------------------------------------------------------------
+bool CEntityIndex::RemoveEntity(CMapEntity *pEntity)
+{
+	IndexedEntity_t *pEntry = m_Entities.GetPtr(pEntity);
+	if (pEntry == NULL)
+	{
+		return(false);
+	}
+
+	for (int i = 0; i < m_Keys.Count(); i++)
+	{
+		UnlinkEntity(i, *pEntry);
+	}
+
+	//
+	// The last entity in the flat list takes this one's place.
+	//
+	int nListIndex = pEntry->m_nListIndex;
+	int nLast = m_EntityList.Count() - 1;
+	if (nListIndex != nLast)
+	{
+		CMapEntity *pMoved = m_EntityList.Element(nLast);
+		if (pMoved != NULL)
+		{
+			m_Entities.GetPtr(pMoved)->m_nListIndex = nListIndex;
+		}
+	}
+	m_EntityList.FastRemove(nListIndex);
+
+	m_Entities.Remove(pEntity);
+	pEntity->m_pEntityIndex = NULL;
+
+	return(true);
+}
+
+
+//-----------------------------------------------------------------------------
+// Purpose: Empties the index, keeping the set of indexed keys.
+//-----------------------------------------------------------------------------
+void CEntityIndex::RemoveAll(void)
+{
+	FOR_EACH_HASHTABLE(m_Entities, i)
+	{
+		m_Entities.Key(i)->m_pEntityIndex = NULL;
+	}
+
+	m_Entities.RemoveAll();
+	m_EntityList.RemoveAll();
+
+	for (int i = 0; i < m_Keys.Count(); i++)
+	{
+		IndexedKey_t *pKey = m_Keys[i];
+		for (int nValue = 0; nValue < pKey->m_Values.Count(); nValue++)
+		{
+			IndexedValue_t *pValue = pKey->m_Values[nValue];
+			if ((pValue != NULL) && (nValue != pKey->m_nMissing))
+			{
+				delete [] pValue->m_pszValue;
+				delete pValue;
+				pKey->m_Values[nValue] = NULL;
+				pKey->m_FreeValues.AddToTail(nValue);
+			}
+		}
+
+		pKey->m_Values[pKey->m_nMissing]->m_Entities.RemoveAll();
+		pKey->m_ValueTable.RemoveAll();
+		pKey->m_WildcardValues.RemoveAll();
+		RebuildTrie(pKey);
+	}
+}
+
+
+//-----------------------------------------------------------------------------
+// Purpose: Moves the entity to the right slots after its keys or class have
+//			changed. Keys whose values didn't change are left alone.
+//-----------------------------------------------------------------------------
+void CEntityIndex::UpdateEntity(CMapEntity *pEntity)
+{
+	IndexedEntity_t *pEntry = m_Entities.GetPtr(pEntity);
+	if (pEntry == NULL)
+	{
+		return;
+	}
+
+	for (int i = 0; i < m_Keys.Count(); i++)
+	{
+		IndexedKey_t *pKey = m_Keys[i];
+		const char *pszOldValue = pKey->m_Values[pEntry->m_nValue[i]]->m_pszValue;
+		const char *pszNewValue = GetIndexedValue(pKey, pEntity);
+
+		if ((pszOldValue == NULL) && (pszNewValue == NULL))
+		{
+			continue;
+		}
+
+		if ((pszOldValue != NULL) && (pszNewValue != NULL) && !stricmp(pszOldValue, pszNewValue))
+		{
+			continue;
+		}
+
+		UnlinkEntity(i, *pEntry);
+		LinkEntity(i, pEntity, *pEntry);
+		m_Stats.m_nUpdates++;
+	}
+}
+
+
+//-----------------------------------------------------------------------------
+// Purpose: Adds a value to the trie, creating the nodes for the characters
+//			that no other value shares with it.
+//-----------------------------------------------------------------------------
+void CEntityIndex::InsertTrieValue(IndexedKey_t *pKey, int nValue)
+{
+	IndexedValue_t *pValue = pKey->m_Values[nValue];
+
+	int nNode = 0;
+	const char *pch;
+	for (pch = pValue->m_pszValue; *pch != '\0'; pch++)
+	{
+		char chLower = tolower(*pch);
+
+		int nChild = pKey->m_Trie[nNode].m_nFirstChild;
+		while ((nChild != -1) && (pKey->m_Trie[nChild].m_chLower != chLower))
+		{
+			nChild = pKey->m_Trie[nChild].m_nNextSibling;
+		}
+
+		if (nChild == -1)
+		{
+			TrieNode_t Child;
+			Child.m_nFirstChild = -1;
+			Child.m_nNextSibling = pKey->m_Trie[nNode].m_nFirstChild;
+			Child.m_nValue = -1;
+			Child.m_chLower = chLower;
+
+			nChild = pKey->m_Trie.AddToTail(Child);
+			pKey->m_Trie[nNode].m_nFirstChild = nChild;
+		}
+
+		nNode = nChild;
+	}
+
+	Assert(pKey->m_Trie[nNode].m_nValue == -1);
+	pKey->m_Trie[nNode].m_nValue = nValue;
+	pKey->m_nTrieChars += pch - pValue->m_pszValue;
+	pValue->m_nTrieNode = nNode;
+}
+
+
+//-----------------------------------------------------------------------------
+// Purpose: Builds the trie from scratch out of the key's live values.
+//-----------------------------------------------------------------------------
+void CEntityIndex::RebuildTrie(IndexedKey_t *pKey)
+{
+	pKey->m_Trie.RemoveAll();
+	pKey->m_nTrieChars = 0;
+
+	TrieNode_t Root;
+	Root.m_nFirstChild = -1;
+	Root.m_nNextSibling = -1;
+	Root.m_nValue = -1;
+	Root.m_chLower = '\0';
+	pKey->m_Trie.AddToTail(Root);
+
+	for (int nValue = 0; nValue < pKey->m_Values.Count(); nValue++)
+	{
+		IndexedValue_t *pValue = pKey->m_Values[nValue];
+		if ((pValue != NULL) && (pValue->m_nTrieNode != -1))
+		{
+			InsertTrieValue(pKey, nValue);
+		}
+	}
+}
+
+
+//-----------------------------------------------------------------------------
+// Purpose: Finds the values that start with the given prefix, ignoring case.
+// Output : Returns the number of values added to Values.
+//-----------------------------------------------------------------------------
+int CEntityIndex::FindTrieValues(IndexedKey_t *pKey, const char *pszPrefix, int nPrefixLen, CUtlVector<int> &Values)
+{
+	int nNode = 0;
+	for (int i = 0; (i < nPrefixLen) && (nNode != -1); i++)
+	{
+		char chLower = tolower(pszPrefix[i]);
+
+		nNode = pKey->m_Trie[nNode].m_nFirstChild;
+		while ((nNode != -1) && (pKey->m_Trie[nNode].m_chLower != chLower))
+		{
+			nNode = pKey->m_Trie[nNode].m_nNextSibling;
+		}
+	}
+
+	if (nNode == -1)
+	{
+		return(0);
+	}
+
+	//
+	// Everything below the prefix's node starts with the prefix.
+	//
+	int nFound = 0;
+	CUtlVector<int> Stack;
+	Stack.AddToTail(nNode);
+	while (Stack.Count() != 0)
+	{
+		const TrieNode_t &Node = pKey->m_Trie[Stack.Tail()];
+		Stack.RemoveMultipleFromTail(1);
+
+		if (Node.m_nValue != -1)
+		{
+			Values.AddToTail(Node.m_nValue);
+			nFound++;
+		}
+
+		for (int nChild = Node.m_nFirstChild; nChild != -1; nChild = pKey->m_Trie[nChild].m_nNextSibling)
+		{
+			Stack.AddToTail(nChild);
+		}
+	}
+
+	return(nFound);
+}
+
+
+//-----------------------------------------------------------------------------
+// Purpose: Adds the entities in a value slot to Found.
+// Output : Returns true if bFirstOnly is set and an entity was found.
+//-----------------------------------------------------------------------------
+bool CEntityIndex::AddMatches(CMapEntityList &Found, const IndexedValue_t *pValue, bool bVisiblesOnly, bool bFirstOnly)
+{
+	int nCount = pValue->m_Entities.Count();
+	for (int i = 0; i < nCount; i++)
+	{
+		CMapEntity *pEntity = pValue->m_Entities[i];
+		m_Stats.m_nEntitiesVisited++;
+
+		if (pEntity->IsVisible() || !bVisiblesOnly)
+		{
+			Found.AddToTail(pEntity);
+			if (bFirstOnly)
+			{
+				return(true);
+			}
+		}
+	}
+
+	return(false);
+}
+
+
+//-----------------------------------------------------------------------------
+// Purpose: Finds the entities whose value for the key equals the given value,
+//			ignoring case. Wildcards are not expanded.
+// Output : Returns true if any entities were found.
+//-----------------------------------------------------------------------------
+bool CEntityIndex::FindExact(CMapEntityList &Found, const char *pszKey, const char *pszValue, bool bVisiblesOnly)
+{
+	if (pszValue == NULL)
+	{
+		return(FindMissing(Found, pszKey, bVisiblesOnly));
+	}
+
+	int nStartCount = Found.Count();
+
+	int nKey = FindKey(pszKey);
+	if (nKey == -1)
+	{
+		m_Stats.m_nScans++;
+
+		int nCount = m_EntityList.Count();
+		for (int i = 0; i < nCount; i++)
+		{
+			CMapEntity *pEntity = m_EntityList.Element(i);
+			m_Stats.m_nEntitiesVisited++;
+
+			if (pEntity->IsVisible() || !bVisiblesOnly)
+			{
+				const char *pszThisValue = pEntity->GetKeyValue(pszKey);
+				if ((pszThisValue != NULL) && !stricmp(pszValue, pszThisValue))
+				{
+					Found.AddToTail(pEntity);
+				}
+			}
+		}
+
+		return(Found.Count() != nStartCount);
+	}
+
+	m_Stats.m_nExactLookups++;
+
+	IndexedKey_t *pKey = m_Keys[nKey];
+	UtlHashHandle_t hValue = pKey->m_ValueTable.Find(pszValue);
+	if (hValue != pKey->m_ValueTable.InvalidHandle())
+	{
+		AddMatches(Found, pKey->m_Values[pKey->m_ValueTable.Element(hValue)], bVisiblesOnly, false);
+	}
+
+	return(Found.Count() != nStartCount);
+}
+
+
+//-----------------------------------------------------------------------------
+// Purpose: Finds the entities that don't have the given key.
+// Output : Returns true if any entities were found.
+//-----------------------------------------------------------------------------
+bool CEntityIndex::FindMissing(CMapEntityList &Found, const char *pszKey, bool bVisiblesOnly)
+{
+	int nStartCount = Found.Count();
+
+	int nKey = FindKey(pszKey);
+	if (nKey == -1)
+	{
+		m_Stats.m_nScans++;
+
+		int nCount = m_EntityList.Count();
+		for (int i = 0; i < nCount; i++)
+		{
+			CMapEntity *pEntity = m_EntityList.Element(i);
+			m_Stats.m_nEntitiesVisited++;
+
+			if ((pEntity->IsVisible() || !bVisiblesOnly) && (pEntity->GetKeyValue(pszKey) == NULL))
+			{
+				Found.AddToTail(pEntity);
+			}
+		}
+
+		return(Found.Count() != nStartCount);
+	}
+
+	m_Stats.m_nExactLookups++;
+
+	IndexedKey_t *pKey = m_Keys[nKey];
+	AddMatches(Found, pKey->m_Values[pKey->m_nMissing], bVisiblesOnly, false);
+
+	return(Found.Count() != nStartCount);
+}
+
+
+//-----------------------------------------------------------------------------
+// Purpose: Finds the entities whose value for the key matches the pattern the
+//			way CompareEntityNames compares them, so a '*' in either the pattern
+//			or the value ends the comparison.
+// Output : Returns true if any entities were found.
+//-----------------------------------------------------------------------------
+bool CEntityIndex::FindMatches(CMapEntityList &Found, const char *pszKey, const char *pszPattern, bool bVisiblesOnly, bool bFirstOnly)
+{
+	int nStartCount = Found.Count();
+
+	int nKey = FindKey(pszKey);
+	if (nKey == -1)
+	{
+		m_Stats.m_nScans++;
+
+		int nCount = m_EntityList.Count();
+		for (int i = 0; i < nCount; i++)
+		{
+			CMapEntity *pEntity = m_EntityList.Element(i);
+			m_Stats.m_nEntitiesVisited++;
+
+			if (pEntity->IsVisible() || !bVisiblesOnly)
+			{
+				const char *pszThisValue = pEntity->GetKeyValue(pszKey);
+				if ((pszThisValue != NULL) && !CompareEntityNames(pszThisValue, pszPattern))
+				{
+					Found.AddToTail(pEntity);
+					if (bFirstOnly)
+					{
+						break;
+					}
+				}
+			}
+		}
+
+		return(Found.Count() != nStartCount);
+	}
+
+	IndexedKey_t *pKey = m_Keys[nKey];
+
+	//
+	// Values without wildcards: one bucket, or every value that starts with
+	// the text before the pattern's wildcard.
+	//
+	const char *pszWildcard = strchr(pszPattern, '*');
+	if (pszWildcard == NULL)
+	{
+		m_Stats.m_nExactLookups++;
+
+		UtlHashHandle_t hValue = pKey->m_ValueTable.Find(pszPattern);
+		if (hValue != pKey->m_ValueTable.InvalidHandle())
+		{
+			if (AddMatches(Found, pKey->m_Values[pKey->m_ValueTable.Element(hValue)], bVisiblesOnly, bFirstOnly))
+			{
+				return(true);
+			}
+		}
+	}
+	else
+	{
+		m_Stats.m_nPrefixLookups++;
+
+		CUtlVector<int> Values;
+		FindTrieValues(pKey, pszPattern, pszWildcard - pszPattern, Values);
+		for (int i = 0; i < Values.Count(); i++)
+		{
+			if (AddMatches(Found, pKey->m_Values[Values[i]], bVisiblesOnly, bFirstOnly))
+			{
+				return(true);
+			}
+		}
+	}
+
+	//
+	// Values with wildcards of their own can match either way, so test them all.
+	//
+	for (int i = 0; i < pKey->m_WildcardValues.Count(); i++)
+	{
+		IndexedValue_t *pValue = pKey->m_Values[pKey->m_WildcardValues[i]];
+		if (!CompareEntityNames(pValue->m_pszValue, pszPattern))
+		{
+			if (AddMatches(Found, pValue, bVisiblesOnly, bFirstOnly))
+			{
+				return(true);
+			}
+		}
+	}
+
+	return(Found.Count() != nStartCount);
+}
+
+
+//-----------------------------------------------------------------------------
+// Purpose: Returns the index's counts, with the sizes brought up to date.
+//-----------------------------------------------------------------------------
+const EntityIndexStats_t &CEntityIndex::GetStats(void)
+{
+	m_Stats.m_nEntities = m_Entities.Count();
+	m_Stats.m_nKeys = m_Keys.Count();
+	m_Stats.m_nValues = 0;
+	m_Stats.m_nTrieNodes = 0;
+
+	for (int i = 0; i < m_Keys.Count(); i++)
+	{
+		IndexedKey_t *pKey = m_Keys[i];
+		m_Stats.m_nValues += pKey->m_ValueTable.Count();
+		m_Stats.m_nTrieNodes += pKey->m_Trie.Count();
+	}
+
+	return(m_Stats);
+}
@@ -0,0 +1,141 @@
+//========= Copyright Valve Corporation, All rights reserved. ============//
+//
+// Purpose: Hash indices over the entities in a world, for finding entities
+//			by name, class name and other keys without scanning all of them.
+//
+//=============================================================================//
+
+#ifndef ENTITYINDEX_H
+#define ENTITYINDEX_H
+#pragma once
+
+#include "MapEntity.h"
+#include "tier1/utlhashtable.h"
+#include "tier1/utlvector.h"
+
+
+#define ENTITY_INDEX_MAX_KEYS		8			// Keys that can be indexed at once.
+#define ENTITY_INDEX_CLASSNAME		"classname"	// Indexes the entity's class rather than a key value.
+
+
+//-----------------------------------------------------------------------------
+// Counts kept by the index, for judging how lookups hold up on big maps.
+//-----------------------------------------------------------------------------
+struct EntityIndexStats_t
+{
+	int m_nEntities;
+	int m_nKeys;				// Keys being indexed.
+	int m_nValues;				// Distinct values of those keys.
+	int m_nTrieNodes;
+
+	int m_nExactLookups;		// Lookups answered by one hash bucket.
+	int m_nPrefixLookups;		// Wildcard lookups answered by the prefix trie.
+	int m_nScans;				// Lookups of keys that aren't indexed, which visit every entity.
+	int m_nEntitiesVisited;		// Entities tested by all of the above.
+	int m_nUpdates;				// Indexed values changed since the index was built.
+};
+
+
+//-----------------------------------------------------------------------------
+// Every indexed key maps each of its values, ignoring case, to the entities
+// that have that value; entities without the key share one more list. Values
+// are also kept in a prefix trie, so wildcard lookups visit only the values
+// that start with the text before the '*'. Values that hold a wildcard
+// themselves match in both directions (see CompareEntityNames) and are kept
+// on the side. The index also keeps the world's flat entity list, so adding
+// and removing entities doesn't have to search it.
+//-----------------------------------------------------------------------------
+class CEntityIndex
+{
+	public:
+
+		CEntityIndex(void);
+		~CEntityIndex(void);
+
+		// Starts indexing the given key for all entities. Returns false if too
+		// many keys are indexed already.
+		bool AddKey(const char *pszKey);
+		bool IsKeyIndexed(const char *pszKey);
+
+		bool AddEntity(CMapEntity *pEntity);
+		bool RemoveEntity(CMapEntity *pEntity);
+		void RemoveAll(void);
+		void UpdateEntity(CMapEntity *pEntity);		// Call after the entity's indexed keys or class change.
+
+		inline bool HasEntity(CMapEntity *pEntity) { return(m_Entities.Find(pEntity) != m_Entities.InvalidHandle()); }
+		inline const CMapEntityList *GetEntityList(void) { return(&m_EntityList); }
+
+		//
+		// Lookups. All of them add what they find to the end of Found and return
+		// false if the key isn't indexed, leaving the caller to scan.
+		//
+		bool FindExact(CMapEntityList &Found, const char *pszKey, const char *pszValue, bool bVisiblesOnly);
+		bool FindMissing(CMapEntityList &Found, const char *pszKey, bool bVisiblesOnly);
+		bool FindMatches(CMapEntityList &Found, const char *pszKey, const char *pszPattern, bool bVisiblesOnly, bool bFirstOnly = false);
+
+		const EntityIndexStats_t &GetStats(void);
+
+	protected:
+
+		struct IndexedValue_t
+		{
+			char *m_pszValue;					// NULL for the list of entities without the key.
+			CUtlVector<CMapEntity *> m_Entities;
+			int m_nTrieNode;					// Node the value ends at, -1 for values with a wildcard.
+		};
+
+		struct TrieNode_t
+		{
+			int m_nFirstChild;
+			int m_nNextSibling;
+			int m_nValue;						// Value that ends at this node, -1 if none.
+			char m_chLower;
+		};
+
+		typedef CUtlHashtable<const char *, int, CaselessStringHashFunctor, CaselessStringEqualFunctor> ValueTable_t;
+
+		struct IndexedKey_t
+		{
+			char m_szKey[KEYVALUE_MAX_KEY_LENGTH];
+			bool m_bClassName;
+
+			CUtlVector<IndexedValue_t *> m_Values;	// NULL for free slots.
+			CUtlVector<int> m_FreeValues;
+			ValueTable_t m_ValueTable;				// Value text to slot.
+			int m_nMissing;							// Slot of the entities without the key.
+
+			CUtlVector<int> m_WildcardValues;
+			CUtlVector<TrieNode_t> m_Trie;			// Node 0 is the root, for the empty prefix.
+			int m_nTrieChars;						// Characters in the values in the trie.
+		};
+
+		struct IndexedEntity_t
+		{
+			int m_nListIndex;						// Where the entity is in m_EntityList.
+			int m_nValue[ENTITY_INDEX_MAX_KEYS];	// Slot of the entity's value for each key.
+			int m_nPosition[ENTITY_INDEX_MAX_KEYS];	// Where the entity is in that slot's list.
+		};
+
+		int FindKey(const char *pszKey);
+		static const char *GetIndexedValue(const IndexedKey_t *pKey, CMapEntity *pEntity);
+
+		int AddValue(IndexedKey_t *pKey, const char *pszValue);
+		void RemoveValue(IndexedKey_t *pKey, int nValue);
+		void LinkEntity(int nKey, CMapEntity *pEntity, IndexedEntity_t &Entity);
+		void UnlinkEntity(int nKey, IndexedEntity_t &Entity);
+
+		static void InsertTrieValue(IndexedKey_t *pKey, int nValue);
+		static void RebuildTrie(IndexedKey_t *pKey);
+		int FindTrieValues(IndexedKey_t *pKey, const char *pszPrefix, int nPrefixLen, CUtlVector<int> &Values);
+
+		bool AddMatches(CMapEntityList &Found, const IndexedValue_t *pValue, bool bVisiblesOnly, bool bFirstOnly);
+
+		CUtlVector<IndexedKey_t *> m_Keys;
+		CUtlHashtable<CMapEntity *, IndexedEntity_t, PointerHashFunctor, DefaultEqualFunctor<CMapEntity *> > m_Entities;
+		CMapEntityList m_EntityList;
+
+		EntityIndexStats_t m_Stats;
+};
+
+
+#endif // ENTITYINDEX_H
@@ -8,7 +8,10 @@
 #include <io.h>
 #include <stdlib.h>
 #include <direct.h>
+#include "AutosaveJournal.h"
 #include "BuildNum.h"
+#include "ChunkFileBench.h"
+#include "DispCornerHash.h"
 #include "EditGameConfigs.h"
 #include "Splash.h"
 #include "Options.h"
@@ -19,6 +22,7 @@
 #include "MapDoc.h"
 #include "MapView3D.h"
 #include "MapView2D.h"
+#include "MapTraceTree.h"
 #include "PakDoc.h"
 #include "PakViewDirec.h"
 #include "PakFrame.h"
@@ -1001,6 +1005,27 @@ InitReturnVal_t CHammer::HammerInternalInit()
 
 	UpdatePrefabs_Init();
 
+	// -benchdispneighbors [grid size] times displacement neighbor discovery on
+	// a synthetic grid and prints the results to the message window.
+	if ( CommandLine()->FindParm( "-benchdispneighbors" ) )
+	{
+		RunDispNeighborBenchmark( CommandLine()->ParmValue( "-benchdispneighbors", 64 ) );
+	}
+
+	// -benchpicking [grid size] times picking rays against a synthetic field
+	// of displacements, with and without the trace tree.
+	if ( CommandLine()->FindParm( "-benchpicking" ) )
+	{
+		RunTraceTreeBenchmark( CommandLine()->ParmValue( "-benchpicking", 32 ) );
+	}
+
+	// -benchvmf [solids] times writing and parsing a synthetic VMF with the
+	// stream, mapped and binary chunk file readers.
+	if ( CommandLine()->FindParm( "-benchvmf" ) )
+	{
+		RunChunkFileBenchmark( CommandLine()->ParmValue( "-benchvmf", 100000 ) );
+	}
+
 	// Indicate that we are ready to use.
 	m_pMainWnd->FlashWindow(TRUE);
 
@@ -1353,7 +1378,7 @@ void CHammer::OnFileOpen(void)
 		strcpy(szInitialDir, g_pGameConfig->szMapDir);
 	}
 
-	CFileDialog dlg(TRUE, NULL, NULL, OFN_LONGNAMES | OFN_HIDEREADONLY | OFN_NOCHANGEDIR, "Valve Map Files (*.vmf)|*.vmf|Valve Map Files Autosave (*.vmf_autosave)|*.vmf_autosave||");
+	CFileDialog dlg(TRUE, NULL, NULL, OFN_LONGNAMES | OFN_HIDEREADONLY | OFN_NOCHANGEDIR, "Valve Map Files (*.vmf)|*.vmf|Valve Map Files Autosave (*.vmf_autosave)|*.vmf_autosave|Binary Valve Map Files (*.vmfb)|*.vmfb||");
 	dlg.m_ofn.lpstrInitialDir = szInitialDir;
 	int iRvl = dlg.DoModal();
 
@@ -1387,6 +1412,12 @@ void CHammer::OnFileOpen(void)
 				str += ".vmf_autosave";
 				break;
 			}
+
+			case 3:
+			{
+				str += ".vmfb";
+				break;
+			}
 		}
 	}
 
@@ -1592,6 +1623,7 @@ BOOL CHammer::OnIdle(LONG lCount)
 	if (pDoc)
 	{
 		UpdateLighting(pDoc);
+		pDoc->GetAutosaveJournal()->Update();
 	}
 
 	g_Textures.UpdateFileChangeWatchers();
@@ -1838,7 +1870,9 @@ static bool LessFunc( const FILETIME &lhs, const FILETIME &rhs )
 //-----------------------------------------------------------------------------
 // Purpose: This is called when the autosave timer goes off.  It checks to
 //			make sure the document has changed and handles deletion of old
-//			files when the total directory size is too big
+//			files when the total directory size is too big. Only the changes
+//			since the last autosave are written when the document's journal
+//			allows it; the full document is written on a background thread.
 //-----------------------------------------------------------------------------
 void CHammer::Autosave( void )
 {
@@ -1864,6 +1898,18 @@ void CHammer::Autosave( void )
 
 	if ( pDoc && pDoc->NeedsAutosave() )
 	{
+		CAutosaveJournal *pJournal = pDoc->GetAutosaveJournal();
+		pJournal->Update();
+
+		//
+		// Append the changes to the journal of the last autosave if it isn't too long yet.
+		//
+		if ( pJournal->CanAppend() && pJournal->Append() )
+		{
+			pDoc->SetAutosaveFlag( FALSE );
+			return;
+		}
+
 		char szRootDir[MAX_PATH];
 		APP()->GetDirectory(DIR_AUTOSAVE, szRootDir);
 		CString strAutosaveDirectory( szRootDir );
@@ -1903,17 +1949,25 @@ void CHammer::Autosave( void )
 
 		CString strSaveName = strAutosaveDirectory + strMapTitle + strAutosaveNumber + strExtension + "_autosave";
 
-		pDoc->SaveVMF( (char *)strSaveName.GetBuffer(), SAVEFLAGS_AUTOSAVE );
+		//
+		// Merge the changes with the last full save into a new autosave in the background,
+		// or write the whole document if there isn't a full save to start from.
+		//
+		if ( !pJournal->CanCompact() || !pJournal->Compact( strSaveName ) )
+		{
+			pDoc->SaveVMF( (char *)strSaveName.GetBuffer(), SAVEFLAGS_AUTOSAVE );
+		}
 		//don't autosave again unless they make changes
 		pDoc->SetAutosaveFlag( FALSE );
 
 		//if there is too much space used for autosaves, delete the oldest file until the size is acceptable
+		bool bSkippedFiles = false;
 		while( dwTotalAutosaveDirectorySize > dwMaxAutosaveSpace )
 		{
 			int nFirstElementIndex = autosaveFiles.FirstInorder();
 			if ( !autosaveFiles.IsValidIndex( nFirstElementIndex ) )
 			{
-				Assert( false );
+				Assert( bSkippedFiles );
 				break;
 			}
 
@@ -1921,9 +1975,18 @@ void CHammer::Autosave( void )
 			DWORD dwOldestFileSize =  fileData.nFileSizeLow;
 			char filename[MAX_PATH];
 			strcpy( filename, fileData.cFileName );
+			autosaveFiles.RemoveAt( nFirstElementIndex );
+
+			// the journal still needs the files it is relative to or is writing
+			if ( pJournal->UsesFile( strAutosaveDirectory + filename ) )
+			{
+				bSkippedFiles = true;
+				continue;
+			}
+
 			DeleteFile( strAutosaveDirectory + filename );
+			DeleteFile( strAutosaveDirectory + filename + AUTOSAVE_JOURNAL_EXTENSION );
 			dwTotalAutosaveDirectorySize -= dwOldestFileSize;
-			autosaveFiles.RemoveAt( nFirstElementIndex );
 		}
 
 		autosaveFiles.RemoveAll();
@@ -6,12 +6,15 @@
 //=============================================================================//
 
 #include "stdafx.h"
+#include "AutosaveJournal.h"
 #include "History.h"
 #include "hammer.h"
 #include "Options.h"
 #include "MainFrm.h"
 #include "MapDoc.h"
 #include "GlobalFunctions.h"
+#include "StatusBarIDs.h"
+#include "UndoDelta.h"
 #include "UndoWarningDlg.h"
 
 // memdbgon must be the last include file in a .cpp file!!!
@@ -82,6 +85,49 @@ BOOL CHistory::IsUndoable()
 }
 
 
+//-----------------------------------------------------------------------------
+// Purpose: Returns roughly how many bytes this history is holding on to.
+//-----------------------------------------------------------------------------
+size_t CHistory::GetMemoryUsage()
+{
+	size_t uSize = 0;
+	for (int i = 0; i < Tracks.Count(); i++)
+	{
+		uSize += Tracks[i]->uDataSize;
+	}
+
+	return uSize;
+}
+
+
+//-----------------------------------------------------------------------------
+// Purpose: Shows the memory used by the active document's Undo and Redo
+//			histories in the status bar.
+//-----------------------------------------------------------------------------
+void CHistory::UpdateStatusText()
+{
+	CMainFrame *pMainWnd = GetMainWnd();
+	if ((pMainWnd == NULL) || (pMainWnd->GetStatusBar()->GetSafeHwnd() == NULL))
+	{
+		return;
+	}
+
+	size_t uSize = 0;
+	if (pCurHistory)
+	{
+		uSize = pCurHistory->GetMemoryUsage();
+		if (pCurHistory->Opposite)
+		{
+			uSize += pCurHistory->Opposite->GetMemoryUsage();
+		}
+	}
+
+	char szText[64];
+	sprintf(szText, "Undo: %.1f MB", uSize / (1024.0 * 1024.0));
+	SetStatusText(SBI_UNDO, szText);
+}
+
+
 //-----------------------------------------------------------------------------
 // Purpose: 
 // Input  : bActive - 
@@ -101,6 +147,8 @@ void CHistory::SetActive(BOOL bActive)
 		Tracks.RemoveAll();
 		MarkUndoPosition();
 	}
+
+	UpdateStatusText();
 }
 
 
@@ -108,9 +156,20 @@ void CHistory::SetActive(BOOL bActive)
 // Purpose: Actually, this implements both Undo and Redo, because a Redo is just
 //			an Undo in the opposite history track. 
 // Input  : pNewSelection - List to populate with the new selection set after the Undo.
+// Output : Returns false if the track couldn't be undone, in which case nothing
+//			was changed.
 //-----------------------------------------------------------------------------
-void CHistory::Undo(CMapObjectList *pNewSelection)
+bool CHistory::Undo(CMapObjectList *pNewSelection)
 {
+	//
+	// Bring back the full copies first, so that a copy that can't be rebuilt
+	// leaves the world alone rather than half undoing the track.
+	//
+	if (!CurTrack->RebuildKeptObjects())
+	{
+		return(false);
+	}
+
 	Opposite->MarkUndoPosition(&CurTrack->Selected, GetCurTrackName(), TRUE);
 
 	//
@@ -136,7 +195,6 @@ void CHistory::Undo(CMapObjectList *pNewSelection)
 	// Done with this track entry. This track entry will be recreated by the
 	// opposite history track if necessary.
 	//
-	uDataSize -= CurTrack->uDataSize;
 	delete CurTrack;
 
 	//
@@ -150,6 +208,9 @@ void CHistory::Undo(CMapObjectList *pNewSelection)
 	{
 		CurTrack = NULL;
 	}
+
+	UpdateStatusText();
+	return(true);
 }
 
 
@@ -179,9 +240,11 @@ void CHistory::MarkUndoPosition( const CMapObjectList *pSelection, LPCTSTR pszNa
 
 	if(CurTrack)
 	{
+		// the track is closed, swap its copies for deltas
+		CurTrack->Compact();
+
 		MEMORYSTATUS ms;
 		GlobalMemoryStatus(&ms);
-		uDataSize += CurTrack->uDataSize;
 		BOOL bWarnMemory = AfxGetApp()->GetProfileInt("General", 
 			"Undo Memory Warning", TRUE);
 		if(ms.dwMemoryLoad > 80 && bWarnMemory)
@@ -227,6 +290,8 @@ void CHistory::MarkUndoPosition( const CMapObjectList *pSelection, LPCTSTR pszNa
 			Tracks.Remove(0);
 		}
 	}
+
+	UpdateStatusText();
 }
 
 
@@ -242,6 +307,7 @@ void CHistory::Keep(CMapClass *pObject)
 	}
 
 	CurTrack->Keep(pObject, true);
+	CAutosaveJournal::ObjectChanged(pObject, true);
 	
 	//
 	// Keep this object's children.
@@ -268,6 +334,7 @@ void CHistory::KeepNoChildren(CMapClass *pObject)
 	}
 
 	CurTrack->Keep(pObject, false);
+	CAutosaveJournal::ObjectChanged(pObject);
 }
 
 
@@ -297,6 +364,7 @@ void CHistory::KeepForDestruction(CMapClass *pObject)
 	}
 
 	CurTrack->KeepForDestruction(pObject);
+	CAutosaveJournal::ObjectChanged(pObject, true);
 }
 
 
@@ -326,6 +394,7 @@ void CHistory::KeepNew(CMapClass *pObject, bool bKeepChildren)
 	}
 
 	CurTrack->KeepNew(pObject);
+	CAutosaveJournal::ObjectChanged(pObject, bKeepChildren);
 }
 
 
@@ -349,6 +418,7 @@ void CHistory::KeepNew( const CMapObjectList *pList, bool bKeepChildren)
 void CHistory::SetHistory(class CHistory *pHistory)
 {
 	pCurHistory = pHistory;
+	UpdateStatusText();
 }
 
 
@@ -406,6 +476,7 @@ CTrackEntry::CTrackEntry(TrackType_t eType, ...)
 		{
 			m_Copy.pCurrent = va_arg(vl, CMapClass *);
 			m_Copy.pKeptObject = m_Copy.pCurrent->Copy(false);
+			m_Copy.pDelta = NULL;
 			m_nDataSize = sizeof(*this) + m_Copy.pKeptObject->GetSize();
 			break;
 		}
@@ -465,6 +536,7 @@ CTrackEntry::~CTrackEntry()
 			if (!m_bUndone)
 			{
 				delete m_Copy.pKeptObject;
+				delete m_Copy.pDelta;
 			}
 
 			break;
@@ -535,6 +607,11 @@ void CTrackEntry::Undo(CHistory *Opposite)
 				Opposite->KeepNoChildren(m_Copy.pCurrent);
 			}
 
+			//
+			// The track rebuilt any compacted copy before undoing anything.
+			//
+			Assert(m_Copy.pDelta == NULL);
+
 			//
 			// Copying back into the world, so update object dependencies.
 			//
@@ -625,7 +702,13 @@ void CTrackEntry::OnRemoveVisGroup(CVisGroup *pVisGroup)
 	{
 		case ttCopy:
 		{
-			m_Copy.pKeptObject->RemoveVisGroup(pVisGroup);
+			//
+			// A delta gets its visgroups from the object it is rebuilt from.
+			//
+			if (m_Copy.pKeptObject != NULL)
+			{
+				m_Copy.pKeptObject->RemoveVisGroup(pVisGroup);
+			}
 			break;
 		}
 		
@@ -643,6 +726,60 @@ void CTrackEntry::OnRemoveVisGroup(CVisGroup *pVisGroup)
 }
 
 
+//-----------------------------------------------------------------------------
+// Purpose: Replaces the full copy of a kept object with a delta from the
+//			object as it is now, if there is one that covers the change. Only
+//			valid once the track is closed, since the delta is rebuilt from the
+//			object as it is when this is called.
+//-----------------------------------------------------------------------------
+void CTrackEntry::Compact(void)
+{
+	if ((m_eType != ttCopy) || m_bUndone || (m_Copy.pKeptObject == NULL))
+	{
+		return;
+	}
+
+	CUndoDelta *pDelta = CreateUndoDelta(m_Copy.pCurrent, m_Copy.pKeptObject);
+	if (pDelta == NULL)
+	{
+		return;
+	}
+
+	delete m_Copy.pKeptObject;
+	m_Copy.pKeptObject = NULL;
+	m_Copy.pDelta = pDelta;
+	m_nDataSize = sizeof(*this) + pDelta->GetSize();
+}
+
+
+//-----------------------------------------------------------------------------
+// Purpose: Swaps a compacted copy back for a full copy of the kept object,
+//			rebuilt from the object as it is now.
+// Output : Returns false if the object no longer matches the delta, in which
+//			case the delta is left as it was.
+//-----------------------------------------------------------------------------
+bool CTrackEntry::RebuildKeptObject(void)
+{
+	if ((m_eType != ttCopy) || (m_Copy.pDelta == NULL))
+	{
+		return(true);
+	}
+
+	CMapClass *pKeptObject = m_Copy.pDelta->Rebuild(m_Copy.pCurrent);
+	if (pKeptObject == NULL)
+	{
+		Msg(mwError, "Undo: %s changed outside of the undo history and can't be restored.", m_Copy.pCurrent->GetDescription());
+		return(false);
+	}
+
+	delete m_Copy.pDelta;
+	m_Copy.pDelta = NULL;
+	m_Copy.pKeptObject = pKeptObject;
+	m_nDataSize = sizeof(*this) + pKeptObject->GetSize();
+	return(true);
+}
+
+
 //-----------------------------------------------------------------------------
 // Purpose: 
 // Input  : *pParent - 
@@ -667,6 +804,7 @@ CHistoryTrack::CHistoryTrack(CHistory *pParent, const CMapObjectList *pSelected)
 	}
 
 	m_bAutoDestruct = true;
+	m_bCompacted = false;
 	szName[0] = 0;
 }
 
@@ -739,6 +877,50 @@ void CHistoryTrack::OnRemoveVisGroup(CVisGroup *pVisGroup)
 }
 
 
+//-----------------------------------------------------------------------------
+// Purpose: Called when the track is closed. Swaps the copies of the objects
+//			that were changed for deltas from their current state. Tracks are
+//			undone last to first, so the objects will be in this state again
+//			when this track is undone.
+//-----------------------------------------------------------------------------
+void CHistoryTrack::Compact()
+{
+	if (m_bCompacted)
+		return;
+
+	m_bCompacted = true;
+
+	uDataSize = 0;
+	for (int i = 0; i < Data.Count(); i++)
+	{
+		Data[i].Compact();
+		uDataSize += Data[i].GetSize();
+	}
+}
+
+
+//-----------------------------------------------------------------------------
+// Purpose: Called before the track is undone. Swaps the deltas back for full
+//			copies while the objects are still in the state they were compacted
+//			from.
+// Output : Returns false if any of them can't be rebuilt, in which case the
+//			track can't be undone.
+//-----------------------------------------------------------------------------
+bool CHistoryTrack::RebuildKeptObjects()
+{
+	bool bOk = true;
+
+	uDataSize = 0;
+	for (int i = 0; i < Data.Count(); i++)
+	{
+		bOk = Data[i].RebuildKeptObject() && bOk;
+		uDataSize += Data[i].GetSize();
+	}
+
+	return(bOk);
+}
+
+
 //-----------------------------------------------------------------------------
 // Purpose: 
 // Input  : *pObject - 
@@ -15,6 +15,7 @@
 class CMapClass;
 class CMapDoc;
 class CHistory;
+class CUndoDelta;
 
 //
 // Holds undo information for a single object, due to a single operation. Held by a CHistoryTrack.
@@ -44,6 +45,9 @@ class CTrackEntry
 
 		void OnRemoveVisGroup(CVisGroup *pGroup);
 
+		void Compact(void);
+		bool RebuildKeptObject(void);
+
 		bool m_bAutoDestruct;
 	
 	protected:
@@ -60,7 +64,8 @@ class CTrackEntry
 			struct
 			{
 				CMapClass *pCurrent;		// Pointer to the object as it currently exists in the world.
-				CMapClass *pKeptObject;		// Pointer to a copy of the object at the time it was kept.
+				CMapClass *pKeptObject;		// Pointer to a copy of the object at the time it was kept, NULL once compacted.
+				CUndoDelta *pDelta;			// What changed since the object was kept, replaces the copy once the track is closed.
 			} m_Copy;
 
 			struct
@@ -100,6 +105,9 @@ public:
 
 	void OnRemoveVisGroup(CVisGroup *pGroup);
 
+	void Compact();
+	bool RebuildKeptObjects();
+
 private:
 
 	BOOL CheckObjectFlag(CMapClass *pObject, int iFlag);
@@ -111,6 +119,7 @@ private:
 	char szName[128];
 	CMapObjectList Selected;
 	bool m_bAutoDestruct;
+	bool m_bCompacted;
 	size_t uDataSize;	// approx
 
 friend class CHistory;
@@ -150,10 +159,12 @@ public:
 	void KeepNew(CMapClass *pObject, bool bKeepChildren = true);
 	void KeepNew(const CMapObjectList *pList, bool bKeepChildren = true);
 	
-	void Undo(CMapObjectList *pNewSelection);
+	bool Undo(CMapObjectList *pNewSelection);
 
 	BOOL IsUndoable();	// anything to undo?
 
+	size_t GetMemoryUsage();	// approx
+
 	void OnRemoveVisGroup(CVisGroup *pVisGroup);
 
 	// returns current name
@@ -180,9 +191,10 @@ private:
 	BOOL bUndo;	// is this the undo tracker?
 
 	BOOL bPaused;
-	size_t uDataSize;
 	BOOL m_bActive;	// veto control
 
+	static void UpdateStatusText();
+
 friend class CHistoryTrack;
 };
 
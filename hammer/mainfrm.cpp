@@ -153,7 +153,7 @@ static UINT indicators[] =
 };
 
 
-const int NUMSTATUSPANES = 7;
+const int NUMSTATUSPANES = 8;
 
 
 enum WinStateViewTypes_t
@@ -178,7 +178,8 @@ struct
 	{ SBI_SIZE,			ID_INDICATOR_SIZE,			SBPS_NORMAL, 180 },
 	{ SBI_GRIDZOOM,		ID_INDICATOR_GRIDZOOM,		SBPS_NORMAL, 80 },
 	{ SBI_SNAP,			ID_INDICATOR_SNAP,			SBPS_NORMAL, 135 },
-	{ SBI_LIGHTPROGRESS,ID_INDICATOR_LIGHTPROGRESS,	SBPS_NORMAL, 50 }
+	{ SBI_LIGHTPROGRESS,ID_INDICATOR_LIGHTPROGRESS,	SBPS_NORMAL, 50 },
+	{ SBI_UNDO,			ID_INDICATOR_UNDO,			SBPS_NORMAL, 100 }
 };
 
 
@@ -5,6 +5,7 @@
 //=============================================================================//
 
 #include "stdafx.h"
+#include "AutosaveJournal.h"
 #include "ChunkFile.h"
 #include "SaveInfo.h"
 #include "MapClass.h"
@@ -586,6 +587,7 @@ void CMapClass::AddVisGroup(CVisGroup *pVisGroup)
 	if (m_VisGroups.Find(pVisGroup) == -1)
 	{
 		m_VisGroups.AddToTail(pVisGroup);
+		CAutosaveJournal::ObjectChanged(this);
 	}
 }
 
@@ -602,6 +604,7 @@ void CMapClass::RemoveVisGroup(CVisGroup *pVisGroup)
 	{
 		m_VisGroups.FastRemove(nIndex);
 		CheckVisibility();
+		CAutosaveJournal::ObjectChanged(this);
 	}
 }
 
@@ -630,6 +633,7 @@ CVisGroup *CMapClass::GetVisGroup(int nIndex)
 void CMapClass::RemoveAllVisGroups(void)
 {
 	m_VisGroups.RemoveAll();
+	CAutosaveJournal::ObjectChanged(this);
 
 	// Remove all visgroups from children as well.
 	FOR_EACH_OBJ( m_Children, pos )
@@ -674,6 +678,8 @@ void CMapClass::AddChild(CMapClass *pChild)
 	{
 		GetParent()->UpdateChild(this);
 	}
+
+	CAutosaveJournal::ObjectChanged(pChild, true);
 }
 
 
@@ -714,6 +720,7 @@ void CMapClass::RemoveChild(CMapClass *pChild, bool bUpdateBounds)
 
 	m_Children.Remove(index);
 	pChild->m_pParent = NULL;
+	CAutosaveJournal::ObjectChanged(this);
 
 	if (bUpdateBounds)
 	{
@@ -773,6 +780,11 @@ void CMapClass::CalcBounds(BOOL bFullUpdate)
 //-----------------------------------------------------------------------------
 void CMapClass::SetRenderColor(color32 rgbColor)
 {
+	if ((r != rgbColor.r) || (g != rgbColor.g) || (b != rgbColor.b))
+	{
+		CAutosaveJournal::ObjectChanged(this);
+	}
+
 	CMapAtom::SetRenderColor(rgbColor);
 
 	//
@@ -795,6 +807,11 @@ void CMapClass::SetRenderColor(color32 rgbColor)
 //-----------------------------------------------------------------------------
 void CMapClass::SetRenderColor(unsigned char uchRed, unsigned char uchGreen, unsigned char uchBlue)
 {
+	if ((r != uchRed) || (g != uchGreen) || (b != uchBlue))
+	{
+		CAutosaveJournal::ObjectChanged(this);
+	}
+
 	CMapAtom::SetRenderColor(uchRed, uchGreen, uchBlue);
 
 	//
@@ -1341,6 +1358,8 @@ ChunkFileResult_t CMapClass::LoadEditorKeyCallback(const char *szKey, const char
 //-----------------------------------------------------------------------------
 void CMapClass::PostUpdate(Notify_Dependent_t eNotifyType)
 {
+	CAutosaveJournal::ObjectChanged(this);
+
 	if (m_pParent != NULL)
 	{
 		GetParent()->UpdateChild(this);
@@ -1638,7 +1657,11 @@ void CMapClass::SetVisible(bool bVisible)
 		pChild->SetVisible(bVisible);
 	}
 
-	m_bVisible = bVisible;
+	if (m_bVisible != bVisible)
+	{
+		m_bVisible = bVisible;
+		CAutosaveJournal::ObjectChanged(this);
+	}
 }
 
 
@@ -1654,6 +1677,11 @@ void CMapClass::VisGroupShow(bool bShow, VisGroupSelection eVisGroup)
 		pChild->VisGroupShow(bShow, eVisGroup);
 	}
 
+	if ( ( m_bVisGroupShown != bShow ) || ( m_bVisGroupAutoShown != bShow ) )
+	{
+		CAutosaveJournal::ObjectChanged(this);
+	}
+
 	if ( eVisGroup == AUTO )
 	{
 		m_bVisGroupAutoShown = bShow;
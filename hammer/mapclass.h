@@ -468,6 +468,7 @@ protected:
 	WCKeyValuesT<WCKVBase_Vector> *m_pEditorKeys;		// Temporary storage for keys loaded from the "editor" chunk of the VMF file, freed after loading.
 
 	friend class CTrackEntry;						// Friends with Undo/Redo system so that parentage can be changed.
+	friend class CUndoDelta;						// So that undo deltas can save and restore bounds.
 	friend void FixHiddenObject(MapError *pError);	// So that the Check for Problems dialog can fix visgroups problems.
 	friend class CMapInstance;
 };
@@ -62,6 +62,8 @@ CMapDisp::CMapDisp()
 	m_bSubdiv = false;
 	m_bReSubdiv = false;
 
+	m_nSurfaceVersion = 0;
+
 	m_CoreDispInfo.InitDispInfo( 4, 0, 0, NULL, NULL, NULL );
 	Paint_Init( DISPPAINT_CHANNEL_POSITION );
 
@@ -204,6 +206,8 @@ bool CMapDisp::Create( void )
 //-----------------------------------------------------------------------------
 void CMapDisp::PostCreate( void )
 {
+	m_nSurfaceVersion++;
+
 	UpdateBoundingBox();
 	UpdateNeighborDependencies( false );
 	UpdateLightmapExtents();
@@ -362,6 +366,97 @@ void CMapDisp::UpdateData( void )
 	Create();
 }
 
+//-----------------------------------------------------------------------------
+// Purpose: Updates the surface after only the verts in the given rectangle
+//          (inclusive, in vert columns and rows) moved. Nothing that depends
+//          only on the surface points - texture coordinates, neighbors,
+//          lightmap extents - is rebuilt.
+//-----------------------------------------------------------------------------
+void CMapDisp::UpdateDataRegion( int nMinU, int nMinV, int nMaxU, int nMaxV )
+{
+	int nWidth = GetWidth();
+	int nHeight = GetHeight();
+
+	nMinU = max( nMinU, 0 );
+	nMinV = max( nMinV, 0 );
+	nMaxU = min( nMaxU, nWidth - 1 );
+	nMaxV = min( nMaxV, nHeight - 1 );
+	if ( ( nMinU > nMaxU ) || ( nMinV > nMaxV ) )
+		return;
+
+	m_nSurfaceVersion++;
+
+	// A vert that sits on the bounding box may take the box in with it when it
+	// moves, so the box has to be rebuilt. Otherwise it only ever grows.
+	bool bRebuildBox = false;
+	Vector v;
+	for ( int iV = nMinV; ( iV <= nMaxV ) && !bRebuildBox; iV++ )
+	{
+		for ( int iU = nMinU; iU <= nMaxU; iU++ )
+		{
+			m_CoreDispInfo.GetVert( ( iV * nWidth ) + iU, v );
+			if ( ( v[0] <= m_BBox[0][0] ) || ( v[1] <= m_BBox[0][1] ) || ( v[2] <= m_BBox[0][2] ) ||
+				 ( v[0] >= m_BBox[1][0] ) || ( v[1] >= m_BBox[1][1] ) || ( v[2] >= m_BBox[1][2] ) )
+			{
+				bRebuildBox = true;
+				break;
+			}
+		}
+	}
+
+	if ( !m_CoreDispInfo.UpdateRegionWithoutLOD( nMinU, nMinV, nMaxU, nMaxV ) )
+		return;
+
+	if ( bRebuildBox )
+	{
+		UpdateBoundingBox();
+	}
+	else
+	{
+		for ( int iV = nMinV; iV <= nMaxV; iV++ )
+		{
+			for ( int iU = nMinU; iU <= nMaxU; iU++ )
+			{
+				m_CoreDispInfo.GetVert( ( iV * nWidth ) + iU, v );
+				VectorMin( v, m_BBox[0], m_BBox[0] );
+				VectorMax( v, m_BBox[1], m_BBox[1] );
+			}
+		}
+	}
+
+	// Re-tag the triangles that use the moved verts. The walkable and buildable
+	// lists point at the verts, so they only need rebuilding if a tag changed.
+	bool bTagsChanged = false;
+	int nQuadMaxU = min( nMaxU, nWidth - 2 );
+	int nQuadMaxV = min( nMaxV, nHeight - 2 );
+	for ( int iV = max( nMinV - 1, 0 ); iV <= nQuadMaxV; iV++ )
+	{
+		for ( int iU = max( nMinU - 1, 0 ); iU <= nQuadMaxU; iU++ )
+		{
+			int iTri = ( ( iV * ( nWidth - 1 ) ) + iU ) * 2;
+			if ( UpdateTriTags( iTri ) )
+			{
+				bTagsChanged = true;
+			}
+			if ( UpdateTriTags( iTri + 1 ) )
+			{
+				bTagsChanged = true;
+			}
+		}
+	}
+
+	if ( bTagsChanged )
+	{
+		UpdateWalkable();
+		UpdateBuildable();
+	}
+
+	// Get the current face and create/update any detail objects
+	CMapFace *pFace = static_cast<CMapFace*>( GetParent() );
+	if ( pFace )
+		DetailObjects::BuildAnyDetailObjects(pFace);
+}
+
 //-----------------------------------------------------------------------------
 //-----------------------------------------------------------------------------
 void CMapDisp::UpdateDataAndNeighborData( void )
@@ -1458,6 +1553,41 @@ void CMapDisp::UpdateWalkable( void )
 	}
 }
 
+//-----------------------------------------------------------------------------
+// Purpose: Sets the walkable and buildable tags of the triangle from its
+//          current normal. Returns true if either tag changed.
+//-----------------------------------------------------------------------------
+bool CMapDisp::UpdateTriTags( int iTri )
+{
+	Vector v1, v2, v3;
+	GetTriPos( iTri, v1, v2, v3 );
+
+	Vector vecEdge1, vecEdge2;
+	vecEdge1 = v2 - v1;
+	vecEdge2 = v3 - v1;
+
+	Vector vecTriNormal;
+	CrossProduct( vecEdge2, vecEdge1, vecTriNormal );
+	VectorNormalize( vecTriNormal );
+
+	bool bWalkable = ( vecTriNormal.z >= WALKABLE_NORMAL_VALUE );
+	bool bBuildable = ( vecTriNormal.z >= BUILDABLE_NORMAL_VALUE );
+	bool bChanged = ( ( IsTriTag( iTri, COREDISPTRI_TAG_WALKABLE ) != bWalkable ) ||
+		              ( IsTriTag( iTri, COREDISPTRI_TAG_BUILDABLE ) != bBuildable ) );
+
+	ResetTriTag( iTri, COREDISPTRI_TAG_WALKABLE | COREDISPTRI_TAG_BUILDABLE );
+	if ( bWalkable )
+	{
+		SetTriTag( iTri, COREDISPTRI_TAG_WALKABLE );
+	}
+	if ( bBuildable )
+	{
+		SetTriTag( iTri, COREDISPTRI_TAG_BUILDABLE );
+	}
+
+	return bChanged;
+}
+
 //-----------------------------------------------------------------------------
 //-----------------------------------------------------------------------------
 void CMapDisp::UpdateBuildable( void )
@@ -3195,35 +3325,25 @@ ChunkFileResult_t CMapDisp::SaveVMF(CChunkFile *pFile, CSaveInfo *pSaveInfo)
 		eResult = pFile->BeginChunk("normals");
 		if (eResult == ChunkFile_Ok)
 		{
-			char szBuf[MAX_KEYVALUE_LEN];
-			char szTemp[80];
+			float flRow[3 * ((1 << MAX_MAP_DISP_POWER) + 1)];
 
-			int nRows = (1 << power) + 1;;
+			int nRows = (1 << power) + 1;
 			int nCols = nRows;
 
-			for (int nRow = 0; nRow < nRows; nRow++)
+			for (int nRow = 0; (nRow < nRows) && (eResult == ChunkFile_Ok); nRow++)
 			{
-				bool bFirst = true;
-				szBuf[0] = '\0';
-
 				for (int nCol = 0; nCol < nCols; nCol++)
 				{
 					int nIndex = nRow * nCols + nCol;
-
-					if (!bFirst)
-					{
-						strcat(szBuf, " ");
-					}
-
-					bFirst = false;
 					m_CoreDispInfo.GetFieldVector( nIndex, vectorFieldVector );
-					sprintf(szTemp, "%g %g %g", (double)vectorFieldVector[0], (double)vectorFieldVector[1], (double)vectorFieldVector[2]);
-					strcat(szBuf, szTemp);
+					flRow[nCol * 3] = vectorFieldVector[0];
+					flRow[nCol * 3 + 1] = vectorFieldVector[1];
+					flRow[nCol * 3 + 2] = vectorFieldVector[2];
 				}
 
 				char szKey[10];
 				sprintf(szKey, "row%d", nRow);
-				eResult = pFile->WriteKeyValue(szKey, szBuf);
+				eResult = pFile->WriteKeyValueFloats(szKey, flRow, nCols * 3);
 			}
 		}
 
@@ -3243,35 +3363,23 @@ ChunkFileResult_t CMapDisp::SaveVMF(CChunkFile *pFile, CSaveInfo *pSaveInfo)
 		eResult = pFile->BeginChunk("distances");
 		if (eResult == ChunkFile_Ok)
 		{
-			char szBuf[MAX_KEYVALUE_LEN];
-			char szTemp[80];
+			float flRow[(1 << MAX_MAP_DISP_POWER) + 1];
 
 			int nRows = (1 << power) + 1;
 			int nCols = nRows;
 
-			for (int nRow = 0; nRow < nRows; nRow++)
+			for (int nRow = 0; (nRow < nRows) && (eResult == ChunkFile_Ok); nRow++)
 			{
-				bool bFirst = true;
-				szBuf[0] = '\0';
-
 				for (int nCol = 0; nCol < nCols; nCol++)
 				{
 					int nIndex = nRow * nCols + nCol;
-
-					if (!bFirst)
-					{
-						strcat(szBuf, " ");
-					}
-
-					bFirst = false;
 					dispDistance = m_CoreDispInfo.GetFieldDistance( nIndex );
-					sprintf(szTemp, "%g", (double)dispDistance);
-					strcat(szBuf, szTemp);
+					flRow[nCol] = dispDistance;
 				}
 
 				char szKey[10];
 				sprintf(szKey, "row%d", nRow);
-				eResult = pFile->WriteKeyValue(szKey, szBuf);
+				eResult = pFile->WriteKeyValueFloats(szKey, flRow, nCols);
 			}
 		}
 
@@ -3291,35 +3399,25 @@ ChunkFileResult_t CMapDisp::SaveVMF(CChunkFile *pFile, CSaveInfo *pSaveInfo)
 		eResult = pFile->BeginChunk( "offsets" );
 		if( eResult == ChunkFile_Ok )
 		{
-			char szBuf[MAX_KEYVALUE_LEN];
-			char szTemp[80];
+			float flRow[3 * ((1 << MAX_MAP_DISP_POWER) + 1)];
 
 			int nRows = (1 << power) + 1;
 			int nCols = nRows;
 
-			for (int nRow = 0; nRow < nRows; nRow++)
+			for (int nRow = 0; (nRow < nRows) && (eResult == ChunkFile_Ok); nRow++)
 			{
-				bool bFirst = true;
-				szBuf[0] = '\0';
-
 				for (int nCol = 0; nCol < nCols; nCol++)
 				{
 					int nIndex = nRow * nCols + nCol;
-
-					if (!bFirst)
-					{
-						strcat(szBuf, " ");
-					}
-
-					bFirst = false;
 					m_CoreDispInfo.GetSubdivPosition( nIndex, subdivPos );
-					sprintf(szTemp, "%g %g %g", (double)subdivPos[0], (double)subdivPos[1], (double)subdivPos[2]);
-					strcat(szBuf, szTemp);
+					flRow[nCol * 3] = subdivPos[0];
+					flRow[nCol * 3 + 1] = subdivPos[1];
+					flRow[nCol * 3 + 2] = subdivPos[2];
 				}
 
 				char szKey[10];
 				sprintf(szKey, "row%d", nRow);
-				eResult = pFile->WriteKeyValue(szKey, szBuf);
+				eResult = pFile->WriteKeyValueFloats(szKey, flRow, nCols * 3);
 			}
 		}
 
@@ -3339,35 +3437,25 @@ ChunkFileResult_t CMapDisp::SaveVMF(CChunkFile *pFile, CSaveInfo *pSaveInfo)
 		eResult = pFile->BeginChunk( "offset_normals" );
 		if( eResult == ChunkFile_Ok )
 		{
-			char szBuf[MAX_KEYVALUE_LEN];
-			char szTemp[80];
+			float flRow[3 * ((1 << MAX_MAP_DISP_POWER) + 1)];
 
 			int nRows = (1 << power) + 1;
 			int nCols = nRows;
 
-			for (int nRow = 0; nRow < nRows; nRow++)
+			for (int nRow = 0; (nRow < nRows) && (eResult == ChunkFile_Ok); nRow++)
 			{
-				bool bFirst = true;
-				szBuf[0] = '\0';
-
 				for (int nCol = 0; nCol < nCols; nCol++)
 				{
 					int nIndex = nRow * nCols + nCol;
-
-					if (!bFirst)
-					{
-						strcat(szBuf, " ");
-					}
-
-					bFirst = false;
 					m_CoreDispInfo.GetSubdivNormal( nIndex, subdivNormal );
-					sprintf(szTemp, "%g %g %g", (double)subdivNormal[0], (double)subdivNormal[1], (double)subdivNormal[2]);
-					strcat(szBuf, szTemp);
+					flRow[nCol * 3] = subdivNormal[0];
+					flRow[nCol * 3 + 1] = subdivNormal[1];
+					flRow[nCol * 3 + 2] = subdivNormal[2];
 				}
 
 				char szKey[10];
 				sprintf(szKey, "row%d", nRow);
-				eResult = pFile->WriteKeyValue(szKey, szBuf);
+				eResult = pFile->WriteKeyValueFloats(szKey, flRow, nCols * 3);
 			}
 		}
 
@@ -3387,35 +3475,23 @@ ChunkFileResult_t CMapDisp::SaveVMF(CChunkFile *pFile, CSaveInfo *pSaveInfo)
 		eResult = pFile->BeginChunk( "alphas" );
 		if( eResult == ChunkFile_Ok )
 		{
-			char szBuf[MAX_KEYVALUE_LEN];
-			char szTemp[80];
+			float flRow[(1 << MAX_MAP_DISP_POWER) + 1];
 
 			int nRows = (1 << power) + 1;
 			int nCols = nRows;
 
-			for (int nRow = 0; nRow < nRows; nRow++)
+			for (int nRow = 0; (nRow < nRows) && (eResult == ChunkFile_Ok); nRow++)
 			{
-				bool bFirst = true;
-				szBuf[0] = '\0';
-
 				for (int nCol = 0; nCol < nCols; nCol++)
 				{
 					int nIndex = nRow * nCols + nCol;
-
-					if (!bFirst)
-					{
-						strcat(szBuf, " ");
-					}
-
-					bFirst = false;
 					alpha = m_CoreDispInfo.GetAlpha( nIndex );
-					sprintf(szTemp, "%g", (double)alpha);
-					strcat(szBuf, szTemp);
+					flRow[nCol] = alpha;
 				}
 
 				char szKey[10];
 				sprintf(szKey, "row%d", nRow);
-				eResult = pFile->WriteKeyValue(szKey, szBuf);
+				eResult = pFile->WriteKeyValueFloats(szKey, flRow, nCols);
 			}
 		}
 
@@ -3822,6 +3898,8 @@ void CMapDisp::Paint_Init( int nType )
 {
 	m_Canvas.m_nType = nType;
 	m_Canvas.m_bDirty = false;
+	m_Canvas.m_nDirtyMinU = m_Canvas.m_nDirtyMinV = MAPDISP_MAX_VERTS;
+	m_Canvas.m_nDirtyMaxU = m_Canvas.m_nDirtyMaxV = -1;
 
 	int nVertCount = GetSize();
 	for( int iVert = 0; iVert < nVertCount; iVert++ )
@@ -3874,6 +3952,15 @@ void CMapDisp::Paint_SetValue( int iVert, Vector const &vPaint )
 	VectorCopy( vPaint, m_Canvas.m_Values[iVert] );
 	m_Canvas.m_bValuesDirty[iVert] = true;
 	m_Canvas.m_bDirty = true;
+
+	// Grow the region to update.
+	int nWidth = GetWidth();
+	int iU = iVert % nWidth;
+	int iV = iVert / nWidth;
+	m_Canvas.m_nDirtyMinU = min( m_Canvas.m_nDirtyMinU, iU );
+	m_Canvas.m_nDirtyMinV = min( m_Canvas.m_nDirtyMinV, iV );
+	m_Canvas.m_nDirtyMaxU = max( m_Canvas.m_nDirtyMaxU, iU );
+	m_Canvas.m_nDirtyMaxV = max( m_Canvas.m_nDirtyMaxV, iV );
 }
 
 //-----------------------------------------------------------------------------
@@ -3952,29 +4039,38 @@ void CMapDisp::UpdateVertPositionForSubdiv( int iVert, const Vector &vecNewSubdi
 //-----------------------------------------------------------------------------
 void CMapDisp::Paint_Update( bool bSplit )
 {
-	// Check for changes to the canvas.
-	if ( !m_Canvas.m_bDirty )
+	// Check for changes to the canvas since the last update. The canvas stays
+	// dirty for the whole stroke, but only the verts set since the last update
+	// need to be applied again.
+	if ( !m_Canvas.m_bDirty || !Paint_IsUpdatePending() )
 		return;
 
-	int nVertCount = GetSize();
-	for ( int iVert = 0; iVert < nVertCount; iVert++ )
+	int nWidth = GetWidth();
+	for ( int iV = m_Canvas.m_nDirtyMinV; iV <= m_Canvas.m_nDirtyMaxV; iV++ )
 	{
-		// Check for changes at the vertex.
-		if ( m_Canvas.m_bValuesDirty[iVert] )
+		for ( int iU = m_Canvas.m_nDirtyMinU; iU <= m_Canvas.m_nDirtyMaxU; iU++ )
 		{
-			if ( m_Canvas.m_nType == DISPPAINT_CHANNEL_POSITION )
+			// Check for changes at the vertex.
+			int iVert = ( iV * nWidth ) + iU;
+			if ( m_Canvas.m_bValuesDirty[iVert] )
 			{
-				PaintPosition_Update( iVert );
-			}
-			else if ( m_Canvas.m_nType == DISPPAINT_CHANNEL_ALPHA )
-			{
-				PaintAlpha_Update( iVert );
+				if ( m_Canvas.m_nType == DISPPAINT_CHANNEL_POSITION )
+				{
+					PaintPosition_Update( iVert );
+				}
+				else if ( m_Canvas.m_nType == DISPPAINT_CHANNEL_ALPHA )
+				{
+					PaintAlpha_Update( iVert );
+				}
 			}
 		}
 	}
 
-	// Update the displacement surface.
-	UpdateData();
+	// Update the displacement surface around the painted verts.
+	UpdateDataRegion( m_Canvas.m_nDirtyMinU, m_Canvas.m_nDirtyMinV, m_Canvas.m_nDirtyMaxU, m_Canvas.m_nDirtyMaxV );
+
+	m_Canvas.m_nDirtyMinU = m_Canvas.m_nDirtyMinV = MAPDISP_MAX_VERTS;
+	m_Canvas.m_nDirtyMaxU = m_Canvas.m_nDirtyMaxV = -1;
 
 	if ( !bSplit )
 	{
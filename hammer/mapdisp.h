@@ -106,8 +106,12 @@ public:
 	void UpdateSurfData( CMapFace *pFace );
 	void UpdateSurfDataAndVectorField( CMapFace *pFace );
 	void UpdateData( void );
+	void UpdateDataRegion( int nMinU, int nMinV, int nMaxU, int nMaxV );
 	void UpdateDataAndNeighborData( void );
 
+	// Changes whenever the surface triangles may have moved.
+	inline int GetSurfaceVersion( void )			{ return m_nSurfaceVersion; }
+
 	void InvertAlpha( void );
 
 	void Resample( int power );
@@ -270,6 +274,7 @@ public:
 	void Paint_Update( bool bSplit );
 	void Paint_UpdateSelfAndNeighbors( bool bSplit );
 	inline bool Paint_IsDirty( void );
+	inline bool Paint_IsUpdatePending( void );
 
 	//=========================================================================
 	//
@@ -334,6 +339,8 @@ private:
 	bool			m_bSubdiv;
 	bool			m_bReSubdiv;
 
+	int				m_nSurfaceVersion;														// bumped whenever the surface moves
+
 	CUtlVector<CoreDispVert_t*>		m_aWalkableVerts;
 	CUtlVector<unsigned short>		m_aWalkableIndices;
 	CUtlVector<unsigned short>		m_aForcedWalkableIndices;
@@ -350,6 +357,8 @@ private:
 		Vector	m_Values[CANVAS_SIZE];
 		bool	m_bValuesDirty[CANVAS_SIZE];
 		bool	m_bDirty;
+		int		m_nDirtyMinU, m_nDirtyMinV;			// verts set since the last Paint_Update (empty when min > max)
+		int		m_nDirtyMaxU, m_nDirtyMaxV;
 	};
 
 	PaintCanvas_t	m_Canvas;
@@ -373,6 +382,7 @@ private:
 
 	void PostCreate( void );
 	void UpdateBoundingBox( void );
+	bool UpdateTriTags( int iTri );
 	void UpdateLightmapExtents( void );
 	bool ValidLightmapSize( void );
 	void CheckAndUpdateOverlays( bool bFull );
@@ -673,6 +683,7 @@ inline void CMapDisp::SetSurfTexCoord( int ndx, Vector2D const &texCoord )
 inline void CMapDisp::SetVert( int index, Vector const &v )
 {
 	m_CoreDispInfo.SetVert( index, v );
+	m_nSurfaceVersion++;
 }
 
 
@@ -929,5 +940,6 @@ inline void CMapDisp::SetDispMapHitIndex( int index ) { m_HitDispIndex = index;
 inline void CMapDisp::ResetDispMapHitIndex( void ) { m_HitDispIndex = -1; }
 
 inline bool CMapDisp::Paint_IsDirty( void ) { return m_Canvas.m_bDirty; }
+inline bool CMapDisp::Paint_IsUpdatePending( void ) { return ( m_Canvas.m_nDirtyMinU <= m_Canvas.m_nDirtyMaxU ); }
 
 #endif // MAPDISP_H
@@ -19,6 +19,7 @@
 #include "tier1/utlstack.h"
 
 class CToolManager;
+class CAutosaveJournal;
 class CMapDoc;
 class CGameConfig;
 class CHistory;
@@ -165,6 +166,7 @@ class CMapDoc : public CDocument
 
 		IBSPLighting	*GetBSPLighting()	{ return m_pBSPLighting; }
 		CToolManager	*GetTools()			{ return m_pToolManager; } // return tools working on this document
+		CAutosaveJournal *GetAutosaveJournal() { return m_pAutosaveJournal; }
 		CSelection		*GetSelection()		{ return m_pSelection;	} // return current selection
 
 		void BeginShellSession(void);
@@ -409,6 +411,7 @@ class CMapDoc : public CDocument
 
 		// Save a VMF file. saveFlags is a combination of SAVEFLAGS_ defines.
 		bool SaveVMF(const char *pszFileName, int saveFlags );
+		ChunkFileResult_t SaveJournalEntryVMF(CChunkFile *pFile, CSaveInfo *pSaveInfo);
 
 		bool LoadVMF(const char *pszFileName);
 		void Postload(void);
@@ -515,6 +518,7 @@ class CMapDoc : public CDocument
 		BOOL m_bNeedsAutosave;				// True if the document has been changed and needs autosaved.
 		BOOL m_bIsAutosave;
 		CString m_strAutosavedFrom;
+		CAutosaveJournal *m_pAutosaveJournal;	// Writes autosaves as changes to the last full save.
 
 		// Undo/Redo system.
 		CHistory *m_pUndo;
@@ -13,6 +13,7 @@
 #include "EditGameClass.h"
 #include "tier1/utlobjectreference.h"
 
+class CEntityIndex;
 class CMapAnimator;
 class CRender2D;
 
@@ -260,6 +261,10 @@ private:
 
 	bool m_bIsInstance;
 
+	CEntityIndex *m_pEntityIndex;		// Index of the world we're in, kept up to date as our keys change.
+	friend class CEntityIndex;
+	friend class CEntityUndoDelta;
+
 	DECLARE_REFERENCED_CLASS( CMapEntity );
 };
 
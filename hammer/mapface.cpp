@@ -2769,8 +2769,6 @@ ChunkFileResult_t CMapFace::SaveVMF(CChunkFile *pFile, CSaveInfo *pSaveInfo)
 
 	ChunkFileResult_t eResult = pFile->BeginChunk("side");
 
-	char szBuf[512];
-
 	//
 	// Write our unique face ID.
 	//
@@ -2784,12 +2782,7 @@ ChunkFileResult_t CMapFace::SaveVMF(CChunkFile *pFile, CSaveInfo *pSaveInfo)
 	//
 	if (eResult == ChunkFile_Ok)
 	{
-		sprintf(szBuf, "(%g %g %g) (%g %g %g) (%g %g %g)",
-				(double)plane.planepts[0][0], (double)plane.planepts[0][1], (double)plane.planepts[0][2],
-				(double)plane.planepts[1][0], (double)plane.planepts[1][1], (double)plane.planepts[1][2],
-				(double)plane.planepts[2][0], (double)plane.planepts[2][1], (double)plane.planepts[2][2]);
-
-		eResult = pFile->WriteKeyValue("plane", szBuf);
+		eResult = pFile->WriteKeyValuePlane("plane", plane.planepts[0], plane.planepts[1], plane.planepts[2]);
 	}
 
     if (eResult == ChunkFile_Ok)
@@ -2804,11 +2797,9 @@ ChunkFileResult_t CMapFace::SaveVMF(CChunkFile *pFile, CSaveInfo *pSaveInfo)
 
                 if (eResult == ChunkFile_Ok)
                 {
-                    char tempBuf[512];
                     for (int i = 0; i < nPoints && eResult == ChunkFile_Ok; i++)
                     {
-                        V_snprintf(tempBuf, 512, "\"point\" \"%i %g %g %g\"", i, (double) Points[i][0], (double) Points[i][1], (double) Points[i][2]);
-                        eResult = pFile->WriteLine(tempBuf);
+                        eResult = pFile->WriteKeyValueIndexedPoint("point", i, Points[i]);
                     }
 
                     if (eResult == ChunkFile_Ok)
@@ -2829,14 +2820,12 @@ ChunkFileResult_t CMapFace::SaveVMF(CChunkFile *pFile, CSaveInfo *pSaveInfo)
 
 	if (eResult == ChunkFile_Ok)
 	{
-		sprintf(szBuf, "[%g %g %g %g] %g", (double)texture.UAxis[0], (double)texture.UAxis[1], (double)texture.UAxis[2], (double)texture.UAxis[3], (double)texture.scale[0]);
-		eResult = pFile->WriteKeyValue("uaxis", szBuf);
+		eResult = pFile->WriteKeyValueTextureAxis("uaxis", texture.UAxis, texture.scale[0]);
 	}
 
 	if (eResult == ChunkFile_Ok)
 	{
-		sprintf(szBuf, "[%g %g %g %g] %g", (double)texture.VAxis[0], (double)texture.VAxis[1], (double)texture.VAxis[2], (double)texture.VAxis[3], (double)texture.scale[1]);
-		eResult = pFile->WriteKeyValue("vaxis", szBuf);
+		eResult = pFile->WriteKeyValueTextureAxis("vaxis", texture.VAxis, texture.scale[1]);
 	}
 
 	if (eResult == ChunkFile_Ok)
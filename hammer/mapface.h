@@ -356,6 +356,8 @@ protected:
 	unsigned int		m_fSmoothingGroups;		// 32-bits representing 32 smoothing groups
 
 	void UpdateFaceFlags( void );							// sniff face flags from texture
+
+	friend class CSolidUndoDelta;
 };
 
 
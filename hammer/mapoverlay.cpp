@@ -25,6 +25,7 @@
 #include "ChunkFile.h"
 #include "mapview.h"
 #include "options.h"
+#include "tier0/threadtools.h"
 
 // memdbgon must be the last include file in a .cpp file!!!
 #include <tier0/memdbgon.h>
@@ -53,6 +54,11 @@ IMPLEMENT_MAPCLASS( CMapOverlay )
 
 #define OVERLAY_INVALID_VALUE			-99999.9f
 
+#define OVERLAY_CLIP_MAX_THREADS		32
+
+CUtlVector<CMapOverlay*> CMapOverlay::s_DirtyOverlays;
+int volatile CMapOverlay::s_nNextDirtyOverlay = -1;
+
 //=============================================================================
 //
 // Basis Functions
@@ -1309,6 +1315,9 @@ CMapOverlay::CMapOverlay() : CMapSideList( "sides" )
 	m_bLoaded = false;
 	m_pOverlayFace = NULL;
 	m_uiFlags = 0;
+	m_nDirtyFlags = 0;
+	m_bClipped = false;
+	m_ClipShape.m_bValid = false;
 }
 
 //-----------------------------------------------------------------------------
@@ -1316,8 +1325,14 @@ CMapOverlay::CMapOverlay() : CMapSideList( "sides" )
 //-----------------------------------------------------------------------------
 CMapOverlay::~CMapOverlay()
 {
+	if ( m_nDirtyFlags )
+	{
+		s_DirtyOverlays.FindAndRemove( this );
+	}
+
 	ClipFace_Destroy( &m_pOverlayFace );
 	m_aRenderFaces.PurgeAndDeleteElements();
+	m_aClipFaces.PurgeAndDeleteElements();
 }
 
 //-----------------------------------------------------------------------------
@@ -1345,7 +1360,7 @@ void CMapOverlay::PostloadWorld( CMapWorld *pWorld )
 	}
 
 	Handles_Build3D();
-	DoClip();
+	MarkDirty( OVERLAY_DIRTY_CLIP );
 	CalcBounds();
 	m_bLoaded = true;
 }
@@ -1521,7 +1536,7 @@ void CMapOverlay::OnParentKeyChanged( const char* szKey, const char* szValue )
 	if ( m_bLoaded )
 	{
 		// Clip - this needs to be done for everything other than a material change, so go ahead.
-		DoClip();
+		MarkDirty( OVERLAY_DIRTY_CLIP );
 		
 		// Post updated.
 		PostUpdate( Notify_Changed );
@@ -1606,7 +1621,7 @@ void CMapOverlay::PostModified( void )
 	}
 
 	Handles_Build3D();
-	DoClip();
+	MarkDirty( OVERLAY_DIRTY_CLIP );
 }
 
 //-----------------------------------------------------------------------------
@@ -1754,18 +1769,22 @@ void CMapOverlay::OnNotifyDependent( CMapClass *pObject, Notify_Dependent_t eNot
 	case Notify_Removed:
 	case Notify_Clipped:
 		{
-			m_aRenderFaces.Purge();
+			// The render faces may point at faces that are gone.
+			m_aRenderFaces.PurgeAndDeleteElements();
+			m_ClipShape.m_bValid = false;
 			PostModified();
 			break;
 		}
 	case Notify_Rebuild:
 		{
-			UpdateDispBarycentric();
+			MarkDirty( OVERLAY_DIRTY_BLEND );
+			CenterEntity();
+			Handles_Build3D();
 			break;
 		}
 	case Notify_Rebuild_Full:
 		{
-			DoClip();
+			MarkDirty( OVERLAY_DIRTY_CLIP );
 			CenterEntity();
 			Handles_Build3D();
 			break;
@@ -1777,6 +1796,15 @@ void CMapOverlay::OnNotifyDependent( CMapClass *pObject, Notify_Dependent_t eNot
 //-----------------------------------------------------------------------------
 void CMapOverlay::Render3D( CRender3D *pRender )
 {
+	// Drawn before the once a frame update got to it.
+	if ( m_nDirtyFlags )
+	{
+		s_DirtyOverlays.FindAndRemove( this );
+		UpdateDirty();
+		FinishUpdate();
+		m_nDirtyFlags = 0;
+	}
+
 	int nFaceCount = m_aRenderFaces.Count();
 
 	if ( nFaceCount != 0 )
@@ -1880,14 +1908,24 @@ void CMapOverlay::Render3D( CRender3D *pRender )
 //          The sidelist defines all faces affected by the "overlay."
 //-----------------------------------------------------------------------------
 void CMapOverlay::DoClip( void )
+{
+	ClipToBuffer();
+	FinishUpdate();
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Clips the overlay into m_aClipFaces, leaving the render faces alone.
+//          Only touches this overlay and reads its faces, so overlays can be
+//          clipped on different threads at once.
+//-----------------------------------------------------------------------------
+void CMapOverlay::ClipToBuffer( void )
 {
 	// Check to see if we have any faces to clip against.
 	int nFaceCount = m_Faces.Count();
 	if( nFaceCount == 0 )
 		return;
 
-	// Destroy the render face cache.
-	m_aRenderFaces.Purge();
+	m_aClipFaces.PurgeAndDeleteElements();
 
 	// clip the overlay against all faces in the sidelist
 	for ( int iFace = 0; iFace < nFaceCount; iFace++ )
@@ -1900,6 +1938,200 @@ void CMapOverlay::DoClip( void )
 			PostClip();
 		}
 	}
+
+	ClipShape_Save( &m_ClipShape );
+	m_bClipped = true;
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Saves what a clip of the overlay would be built from right now.
+//-----------------------------------------------------------------------------
+void CMapOverlay::ClipShape_Save( ClipShape_t *pShape )
+{
+	pShape->m_vecOrigin = m_Basis.m_vecOrigin;
+	for ( int iAxis = 0; iAxis < 3; ++iAxis )
+	{
+		pShape->m_vecAxes[iAxis] = m_Basis.m_vecAxes[iAxis];
+	}
+
+	for ( int iHandle = 0; iHandle < OVERLAY_HANDLES_COUNT; ++iHandle )
+	{
+		pShape->m_vecBasisCoords[iHandle] = m_Handles.m_vecBasisCoords[iHandle];
+	}
+
+	pShape->m_vecTextureU = m_Material.m_vecTextureU;
+	pShape->m_vecTextureV = m_Material.m_vecTextureV;
+
+	pShape->m_Faces.RemoveAll();
+	pShape->m_Points.RemoveAll();
+	pShape->m_DispPowers.RemoveAll();
+
+	int nFaceCount = m_Faces.Count();
+	for ( int iFace = 0; iFace < nFaceCount; ++iFace )
+	{
+		CMapFace *pFace = m_Faces.Element( iFace );
+		pShape->m_Faces.AddToTail( pFace );
+		if ( !pFace )
+			continue;
+
+		pShape->m_Points.AddMultipleToTail( pFace->nPoints, pFace->Points );
+
+		if ( pFace->HasDisp() )
+		{
+			CMapDisp *pDisp = EditDispMgr()->GetDisp( pFace->GetDisp() );
+			for ( int iPoint = 0; iPoint < 4; ++iPoint )
+			{
+				Vector vecPoint;
+				pDisp->GetSurfPoint( iPoint, vecPoint );
+				pShape->m_Points.AddToTail( vecPoint );
+			}
+			pShape->m_DispPowers.AddToTail( pDisp->GetPower() );
+		}
+	}
+
+	pShape->m_bValid = true;
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Returns true if clipping the overlay again would give the faces it
+//          is already rendering, up to where the displacements move them.
+//-----------------------------------------------------------------------------
+bool CMapOverlay::ClipShape_IsCurrent( void )
+{
+	if ( !m_ClipShape.m_bValid )
+		return false;
+
+	ClipShape_t current;
+	ClipShape_Save( &current );
+
+	if ( current.m_vecOrigin != m_ClipShape.m_vecOrigin )
+		return false;
+
+	for ( int iAxis = 0; iAxis < 3; ++iAxis )
+	{
+		if ( current.m_vecAxes[iAxis] != m_ClipShape.m_vecAxes[iAxis] )
+			return false;
+	}
+
+	for ( int iHandle = 0; iHandle < OVERLAY_HANDLES_COUNT; ++iHandle )
+	{
+		if ( current.m_vecBasisCoords[iHandle] != m_ClipShape.m_vecBasisCoords[iHandle] )
+			return false;
+	}
+
+	if ( ( current.m_vecTextureU != m_ClipShape.m_vecTextureU ) ||
+		 ( current.m_vecTextureV != m_ClipShape.m_vecTextureV ) )
+		return false;
+
+	if ( ( current.m_Faces.Count() != m_ClipShape.m_Faces.Count() ) ||
+		 ( current.m_Points.Count() != m_ClipShape.m_Points.Count() ) ||
+		 ( current.m_DispPowers.Count() != m_ClipShape.m_DispPowers.Count() ) )
+		return false;
+
+	if ( memcmp( current.m_Faces.Base(), m_ClipShape.m_Faces.Base(), current.m_Faces.Count() * sizeof( CMapFace* ) ) ||
+		 memcmp( current.m_DispPowers.Base(), m_ClipShape.m_DispPowers.Base(), current.m_DispPowers.Count() * sizeof( int ) ) )
+		return false;
+
+	for ( int iPoint = 0; iPoint < current.m_Points.Count(); ++iPoint )
+	{
+		if ( current.m_Points[iPoint] != m_ClipShape.m_Points[iPoint] )
+			return false;
+	}
+
+	return true;
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Queues the overlay for the next UpdateDirtyOverlays.
+//-----------------------------------------------------------------------------
+void CMapOverlay::MarkDirty( int nFlags )
+{
+	if ( !m_nDirtyFlags )
+	{
+		s_DirtyOverlays.AddToTail( this );
+	}
+
+	m_nDirtyFlags |= nFlags;
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Brings a dirty overlay up to date, clipping it again only if the
+//          faces it was clipped against changed shape. Safe to run on any
+//          thread, like ClipToBuffer; FinishUpdate does the rest on the main one.
+//-----------------------------------------------------------------------------
+void CMapOverlay::UpdateDirty( void )
+{
+	if ( ( m_nDirtyFlags & OVERLAY_DIRTY_CLIP ) && !ClipShape_IsCurrent() )
+	{
+		// A new clip is built on the displacements as they are now.
+		ClipToBuffer();
+		return;
+	}
+
+	// Nothing the clip depends on changed, but the displacements may have moved.
+	UpdateDispBarycentric();
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Swaps in the faces from the last clip, if there was one.
+//-----------------------------------------------------------------------------
+void CMapOverlay::FinishUpdate( void )
+{
+	if ( m_bClipped )
+	{
+		m_aRenderFaces.PurgeAndDeleteElements();
+		m_aRenderFaces.Swap( m_aClipFaces );
+		m_bClipped = false;
+	}
+}
+
+//-----------------------------------------------------------------------------
+//-----------------------------------------------------------------------------
+unsigned CMapOverlay::UpdateThreadFn( void *pParam )
+{
+	int nOverlays = s_DirtyOverlays.Count();
+	for (;;)
+	{
+		int iOverlay = ThreadInterlockedIncrement( &s_nNextDirtyOverlay );
+		if ( iOverlay >= nOverlays )
+			break;
+
+		s_DirtyOverlays[iOverlay]->UpdateDirty();
+	}
+	return 0;
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Updates all of the dirty overlays together, so an overlay whose
+//          faces change many times in a frame (displacement painting) is only
+//          clipped once, and the clipping is spread over all cores.
+//-----------------------------------------------------------------------------
+void CMapOverlay::UpdateDirtyOverlays( void )
+{
+	int nOverlays = s_DirtyOverlays.Count();
+	if ( nOverlays == 0 )
+		return;
+
+	int nThreads = min( min( GetCPUInformation()->m_nLogicalProcessors, OVERLAY_CLIP_MAX_THREADS ), nOverlays );
+	s_nNextDirtyOverlay = -1;
+	ThreadHandle_t hThreads[OVERLAY_CLIP_MAX_THREADS];
+	for ( int i = 0; i < nThreads - 1; i++ )
+	{
+		hThreads[i] = CreateSimpleThread( UpdateThreadFn, NULL );
+	}
+	UpdateThreadFn( NULL );		// This thread works too.
+	for ( int i = 0; i < nThreads - 1; i++ )
+	{
+		ThreadJoin( hThreads[i] );
+		ReleaseThreadHandle( hThreads[i] );
+	}
+
+	for ( int iOverlay = 0; iOverlay < nOverlays; iOverlay++ )
+	{
+		s_DirtyOverlays[iOverlay]->FinishUpdate();
+		s_DirtyOverlays[iOverlay]->m_nDirtyFlags = 0;
+	}
+	s_DirtyOverlays.RemoveAll();
 }
 
 //-----------------------------------------------------------------------------
@@ -2070,7 +2302,7 @@ void CMapOverlay::DoClipFace( CMapFace *pFace )
 	else
 	{
 		pClippedFace->m_pBuildFace = pFace;
-		m_aRenderFaces.AddToTail( pClippedFace );
+		m_aClipFaces.AddToTail( pClippedFace );
 	}
 }
 
@@ -2206,7 +2438,7 @@ void CMapOverlay::DoClipDisp( CMapFace *pFace, ClipFace_t *pClippedFace )
 		{
 			// Save for re-building later!
 			pClipFace->m_pBuildFace = pFace;
-			m_aRenderFaces.AddToTail( aCurrentFaces[iFace] );
+			m_aClipFaces.AddToTail( aCurrentFaces[iFace] );
 			ClipFace_BuildFacesFromBlendedData( pClipFace );
 		}
 	}
@@ -2317,12 +2549,6 @@ void CMapOverlay::UpdateDispBarycentric( void )
 			}
 		}
 	}
-
-	// Update the entity position.
-	CenterEntity();
-
-	// Update the handles.
-	Handles_Build3D();
 }
 
 //-----------------------------------------------------------------------------
@@ -76,6 +76,10 @@ public:
 	void DoClip( void );
 	void CenterEntity( void );
 
+	// Re-clips every overlay marked dirty since the last call, on all cores.
+	// Called once a frame; overlays that are drawn before then update themselves.
+	static void UpdateDirtyOverlays( void );
+
 	void GetPlane( cplane_t &plane );
 
 	int	GetFaceCount( void ) { return m_Faces.Count(); }
@@ -265,6 +269,40 @@ private:
 	void PostModified( void );
 	void GetTriVerts( CMapDisp *pDisp, const Vector2D &vecSurfUV, int *pTris, Vector2D *pVertsUV );
 
+	//=========================================================================
+	//
+	// Deferred Clipping
+	//
+	enum
+	{
+		OVERLAY_DIRTY_CLIP	= 0x01,		// clip against the side list again
+		OVERLAY_DIRTY_BLEND	= 0x02,		// move the displacement points with the displacements
+	};
+
+	// Everything a clip is built from other than the displacement heights, which
+	// only move the points through their blends.
+	struct ClipShape_t
+	{
+		bool					m_bValid;
+		Vector					m_vecOrigin;
+		Vector					m_vecAxes[3];
+		Vector2D				m_vecBasisCoords[OVERLAY_HANDLES_COUNT];
+		Vector2D				m_vecTextureU;
+		Vector2D				m_vecTextureV;
+		CUtlVector<CMapFace*>	m_Faces;
+		CUtlVector<Vector>		m_Points;		// face points, then each displacement's four surface points
+		CUtlVector<int>			m_DispPowers;
+	};
+
+	void ClipShape_Save( ClipShape_t *pShape );
+	bool ClipShape_IsCurrent( void );
+
+	void MarkDirty( int nFlags );
+	void ClipToBuffer( void );
+	void UpdateDirty( void );
+	void FinishUpdate( void );
+	static unsigned UpdateThreadFn( void *pParam );
+
 private:
 
 	Basis_t			m_Basis;			// Overlay Basis Data
@@ -273,9 +311,16 @@ private:
 
 	ClipFace_t		*m_pOverlayFace;	// Primary Overlay
 	ClipFaces_t		m_aRenderFaces;		// Clipped Face Cache (Render Faces)
+	ClipFaces_t		m_aClipFaces;		// Faces built by a clip, moved into m_aRenderFaces on the main thread
+	ClipShape_t		m_ClipShape;		// What m_aRenderFaces were clipped from
 
 	unsigned short	m_uiFlags;			//
+	unsigned char	m_nDirtyFlags;		// OVERLAY_DIRTY_*, set while in s_DirtyOverlays
+	bool			m_bClipped;			// m_aClipFaces holds a clip waiting to be moved
 	bool			m_bLoaded;
+
+	static CUtlVector<CMapOverlay*>	s_DirtyOverlays;
+	static int volatile				s_nNextDirtyOverlay;	// shared with the update threads
 };
 
 
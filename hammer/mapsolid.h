@@ -17,6 +17,7 @@
 
 enum TextureAlignment_t;
 struct ExportDXFInfo_s;
+class CMapSolidLoadQueue;
 
 
 //
@@ -44,6 +45,7 @@ typedef BlockArray <CMapFace, 6, (MAPSOLID_MAX_FACES / 6) + 1> CSolidFaces;
 class CMapSolid : public CMapClass
 {
 	friend CSSolid;
+	friend class CMapSolidLoadQueue;
 
 public:
 
@@ -59,6 +61,7 @@ public:
 	//
 	static void PreloadWorld( void );
 	static int GetBadSolidCount( void );
+	static CMapSolidLoadQueue *s_pLoadQueue;	// When set, LoadVMF leaves building the solid to this queue.
 	virtual void PostloadWorld(CMapWorld *pWorld);
 	ChunkFileResult_t LoadVMF( CChunkFile *pFile, bool &bValid );
 	ChunkFileResult_t SaveVMF( CChunkFile *pFile, CSaveInfo *pSaveInfo );
@@ -170,6 +173,8 @@ protected:
 	//
 	static ChunkFileResult_t LoadSideCallback(CChunkFile *pFile, CMapSolid *pSolid);
 	ChunkFileResult_t SaveEditorData(CChunkFile *pFile);
+	bool BuildLoadedSolid(void);
+	void FinishLoadedSolid(void);
 	static int g_nBadSolidCount;
 
 	CSolidFaces Faces;					// The list of faces on this solid.
@@ -186,4 +191,40 @@ inline bool CMapSolid::IsCordonBrush() const
 	return m_bIsCordonBrush;
 }
 
+
+//-----------------------------------------------------------------------------
+// Builds the solids read from a VMF on all cores once the whole file has been
+// parsed. Parsing stays on the main thread; the queue only takes over the part
+// of CMapSolid::LoadVMF that turns the planes into faces: clipping the windings,
+// the face planes and the texture coordinates. Solids with displacements are
+// still built as they are read since they go through the displacement manager.
+//
+// Queued solids are linked to their parents as if they were valid, so the
+// document keeps its order. BuildSolids unlinks and deletes the ones that turn
+// out to be bad.
+//-----------------------------------------------------------------------------
+class CMapSolidLoadQueue
+{
+	public:
+
+		CMapSolidLoadQueue(void);
+
+		void AddSolid(CMapSolid *pSolid);
+		void RemoveSolid(CMapSolid *pSolid);
+		void BuildSolids(void);
+
+		inline int GetSolidCount(void) { return(m_Solids.Count()); }
+
+	protected:
+
+		void BuildJob(int nJob);
+		static unsigned BuildThreadFn(void *pParam);
+
+		CUtlVector<CMapSolid *> m_Solids;
+		CUtlVector<bool> m_Valid;			// Parallel to m_Solids, filled in by the build.
+
+		// Build state shared with the worker threads.
+		int volatile m_nNextBuildJob;
+};
+
 #endif // MAPSOLID_H
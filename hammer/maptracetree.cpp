@@ -0,0 +1,1322 @@
+//========= Copyright Valve Corporation, All rights reserved. ============//
+//
+// Purpose: Bounding volume hierarchy over the world's face and displacement
+//			triangles. See MapTraceTree.h.
+//
+//=============================================================================//
+
+#include "stdafx.h"
+#include "MapTraceTree.h"
+#include "MapDisp.h"
+#include "MapFace.h"
+#include "MapSolid.h"
+#include "GlobalFunctions.h"
+#include "CollisionUtils.h"
+#include "cmodel.h"
+#include "mathlib/ssemath.h"
+#include "tier0/platform.h"
+
+// memdbgon must be the last include file in a .cpp file!!!
+#include <tier0/memdbgon.h>
+
+
+#define TRACETREE_MIN_LOOSE_PACKETS		64		// loose packets always allowed before a rebuild
+#define TRACETREE_MAX_DEPTH				64
+
+
+//-----------------------------------------------------------------------------
+// The ray, ready for both the box and the triangle tests. A component of the
+// delta that is zero gets a huge inverse rather than an infinite one, so the
+// box test never multiplies zero by infinity.
+//-----------------------------------------------------------------------------
+struct CMapTraceTree::TraceRay_t
+{
+	TraceRay_t( const Vector &vecStart, const Vector &vecEnd )
+	{
+		m_vecStart = vecStart;
+		m_vecDelta = vecEnd - vecStart;
+		for ( int i = 0; i < 3; i++ )
+		{
+			m_vecInvDelta[i] = ( m_vecDelta[i] != 0.0f ) ? ( 1.0f / m_vecDelta[i] ) : 1.0e30f;
+			m_Start[i] = ReplicateX4( m_vecStart[i] );
+			m_Delta[i] = ReplicateX4( m_vecDelta[i] );
+		}
+	}
+
+	fltx4	m_Start[3];
+	fltx4	m_Delta[3];
+	Vector	m_vecStart;
+	Vector	m_vecDelta;
+	Vector	m_vecInvDelta;
+};
+
+
+//-----------------------------------------------------------------------------
+// What a trace is looking for, and what it has found so far.
+//-----------------------------------------------------------------------------
+struct CMapTraceTree::TraceFilter_t
+{
+	TraceTreeFilterFunc_t		m_pfnFilter;
+	void						*m_pFilterParam;
+	CUtlVector<MapTraceHit_t>	*m_pHits;			// every hit is wanted if this is set
+	float						m_flMaxFraction;	// nothing further than this is wanted
+	int							m_nBestPacket;
+	int							m_nBestLane;
+};
+
+
+//-----------------------------------------------------------------------------
+// Purpose: Returns the fraction at which the ray enters the box, or -1 if it
+//			misses it or only gets there beyond flMaxFraction.
+//-----------------------------------------------------------------------------
+static inline float TraceTree_RayEntersBox( const Vector &vecStart, const Vector &vecInvDelta,
+	const Vector &vecMins, const Vector &vecMaxs, float flMaxFraction )
+{
+	if ( vecMins.x > vecMaxs.x )
+		return -1.0f;
+
+	float flEnter = 0.0f;
+	float flLeave = flMaxFraction;
+	for ( int i = 0; i < 3; i++ )
+	{
+		float flNear = ( vecMins[i] - vecStart[i] ) * vecInvDelta[i];
+		float flFar = ( vecMaxs[i] - vecStart[i] ) * vecInvDelta[i];
+		if ( flNear > flFar )
+		{
+			float flTemp = flNear;
+			flNear = flFar;
+			flFar = flTemp;
+		}
+
+		flEnter = max( flEnter, flNear );
+		flLeave = min( flLeave, flFar );
+		if ( flEnter > flLeave )
+			return -1.0f;
+	}
+
+	return flEnter;
+}
+
+
+//-----------------------------------------------------------------------------
+// Purpose: Collects the faces of every solid at or under the object, in the
+//			same order every time.
+//-----------------------------------------------------------------------------
+static void TraceTree_GetFaces( CMapClass *pObject, CUtlVector<CMapFace *> &faces )
+{
+	CMapSolid *pSolid = dynamic_cast<CMapSolid *>( pObject );
+	if ( pSolid != NULL )
+	{
+		int nFaces = pSolid->GetFaceCount();
+		for ( int i = 0; i < nFaces; i++ )
+		{
+			faces.AddToTail( pSolid->GetFace( i ) );
+		}
+		return;
+	}
+
+	const CMapObjectList *pChildren = pObject->GetChildren();
+	FOR_EACH_OBJ( *pChildren, pos )
+	{
+		TraceTree_GetFaces( pChildren->Element( pos ), faces );
+	}
+}
+
+
+//-----------------------------------------------------------------------------
+// Purpose: Moves the nth packet in order of center along the axis into the nth
+//			slot, with nothing after it in front and nothing before it behind.
+//-----------------------------------------------------------------------------
+static void TraceTree_Partition( int *pPackets, int nCount, int nNth, const Vector *pCenters, int nAxis )
+{
+	int nLeft = 0;
+	int nRight = nCount - 1;
+	while ( nLeft < nRight )
+	{
+		float flPivot = pCenters[pPackets[( nLeft + nRight ) / 2]][nAxis];
+		int i = nLeft;
+		int j = nRight;
+		while ( i <= j )
+		{
+			while ( pCenters[pPackets[i]][nAxis] < flPivot )
+				i++;
+			while ( pCenters[pPackets[j]][nAxis] > flPivot )
+				j--;
+
+			if ( i <= j )
+			{
+				int nTemp = pPackets[i];
+				pPackets[i] = pPackets[j];
+				pPackets[j] = nTemp;
+				i++;
+				j--;
+			}
+		}
+
+		if ( nNth <= j )
+		{
+			nRight = j;
+		}
+		else if ( nNth >= i )
+		{
+			nLeft = i;
+		}
+		else
+		{
+			break;
+		}
+	}
+}
+
+
+//-----------------------------------------------------------------------------
+// Purpose:
+//-----------------------------------------------------------------------------
+CMapTraceTree::CMapTraceTree()
+{
+	m_nLiveTris = 0;
+	m_nDeadFaces = 0;
+	m_nDeadPackets = 0;
+	memset( &m_Stats, 0, sizeof( m_Stats ) );
+}
+
+
+//-----------------------------------------------------------------------------
+// Purpose: Throws away whatever was in the tree and builds it over the faces
+//			of the objects.
+//-----------------------------------------------------------------------------
+void CMapTraceTree::Build( const CMapObjectList &Objects )
+{
+	double flStart = Plat_FloatTime();
+
+	m_Packets.RemoveAll();
+	m_Faces.RemoveAll();
+	m_Nodes.RemoveAll();
+	m_LeafPackets.RemoveAll();
+	m_LoosePackets.RemoveAll();
+	m_DispFaces.RemoveAll();
+	m_DirtyLeaves.RemoveAll();
+	m_Objects.RemoveAll();
+	m_nLiveTris = 0;
+	m_nDeadFaces = 0;
+	m_nDeadPackets = 0;
+
+	FOR_EACH_OBJ( Objects, pos )
+	{
+		AddObjectFaces( Objects.Element( pos ) );
+	}
+
+	BuildNodes();
+
+	m_Stats.m_flBuildTime = Plat_FloatTime() - flStart;
+}
+
+
+//-----------------------------------------------------------------------------
+// Purpose: Adds a root-level object. Its faces are kept outside the hierarchy
+//			until the next rebuild.
+//-----------------------------------------------------------------------------
+void CMapTraceTree::AddObject( CMapClass *pObject )
+{
+	if ( m_Objects.Find( pObject ) != m_Objects.InvalidHandle() )
+	{
+		UpdateObject( pObject );
+		return;
+	}
+
+	AddObjectFaces( pObject );
+}
+
+
+//-----------------------------------------------------------------------------
+// Purpose:
+//-----------------------------------------------------------------------------
+void CMapTraceTree::RemoveObject( CMapClass *pObject )
+{
+	UtlHashHandle_t h = m_Objects.Find( pObject );
+	if ( h == m_Objects.InvalidHandle() )
+		return;
+
+	ObjectFaces_t Faces = m_Objects.Element( h );
+	for ( int i = 0; i < Faces.m_nFaces; i++ )
+	{
+		KillFace( Faces.m_nFirstFace + i );
+	}
+
+	m_Objects.Remove( pObject );
+}
+
+
+//-----------------------------------------------------------------------------
+// Purpose: Rewrites the object's triangles in place if it still has the same
+//			faces with the same number of triangles, otherwise drops it and
+//			adds it again.
+//-----------------------------------------------------------------------------
+void CMapTraceTree::UpdateObject( CMapClass *pObject )
+{
+	UtlHashHandle_t h = m_Objects.Find( pObject );
+	if ( h == m_Objects.InvalidHandle() )
+	{
+		AddObjectFaces( pObject );
+		return;
+	}
+
+	ObjectFaces_t Faces = m_Objects.Element( h );
+
+	CUtlVector<CMapFace *> faces;
+	TraceTree_GetFaces( pObject, faces );
+
+	bool bSameLayout = ( faces.Count() == Faces.m_nFaces );
+	CUtlVector<Vector> triVerts;
+	for ( int i = 0; bSameLayout && ( i < faces.Count() ); i++ )
+	{
+		const Face_t &Face = m_Faces[Faces.m_nFirstFace + i];
+		EditDispHandle_t hDisp = faces[i]->HasDisp() ? faces[i]->GetDisp() : EDITDISPHANDLE_INVALID;
+		if ( ( Face.m_pFace != faces[i] ) || ( Face.m_hDisp != hDisp ) ||
+			 ( Face.m_nTris != GetFaceTris( faces[i], triVerts ) ) )
+		{
+			bSameLayout = false;
+		}
+	}
+
+	if ( !bSameLayout )
+	{
+		RemoveObject( pObject );
+		AddObjectFaces( pObject );
+		return;
+	}
+
+	for ( int i = 0; i < faces.Count(); i++ )
+	{
+		int nFace = Faces.m_nFirstFace + i;
+		GetFaceTris( faces[i], triVerts );
+		RefitFace( nFace, triVerts.Base() );
+
+		Face_t &Face = m_Faces[nFace];
+		if ( Face.m_hDisp != EDITDISPHANDLE_INVALID )
+		{
+			Face.m_nDispVersion = EditDispMgr()->GetDisp( Face.m_hDisp )->GetSurfaceVersion();
+		}
+	}
+}
+
+
+//-----------------------------------------------------------------------------
+// Purpose: Finds the nearest triangle hit between the two points.
+//-----------------------------------------------------------------------------
+bool CMapTraceTree::TraceNearest( const Vector &vecStart, const Vector &vecEnd, MapTraceHit_t &hit,
+	TraceTreeFilterFunc_t pfnFilter, void *pFilterParam )
+{
+	Refresh();
+
+	TraceRay_t ray( vecStart, vecEnd );
+
+	TraceFilter_t filter;
+	filter.m_pfnFilter = pfnFilter;
+	filter.m_pFilterParam = pFilterParam;
+	filter.m_pHits = NULL;
+	filter.m_flMaxFraction = 1.0f;
+	filter.m_nBestPacket = -1;
+	filter.m_nBestLane = -1;
+
+	TraceTree( ray, filter );
+
+	if ( filter.m_nBestPacket == -1 )
+		return false;
+
+	MakeHit( filter.m_nBestPacket, filter.m_nBestLane, filter.m_flMaxFraction, ray, hit );
+	return true;
+}
+
+
+//-----------------------------------------------------------------------------
+// Purpose:
+//-----------------------------------------------------------------------------
+static int TraceTree_CompareHits( const MapTraceHit_t *pLeft, const MapTraceHit_t *pRight )
+{
+	if ( pLeft->flFraction < pRight->flFraction )
+		return -1;
+
+	if ( pLeft->flFraction > pRight->flFraction )
+		return 1;
+
+	return 0;
+}
+
+
+//-----------------------------------------------------------------------------
+// Purpose: Finds every triangle hit between the two points, nearest first.
+//-----------------------------------------------------------------------------
+int CMapTraceTree::TraceAll( const Vector &vecStart, const Vector &vecEnd, CUtlVector<MapTraceHit_t> &hits,
+	TraceTreeFilterFunc_t pfnFilter, void *pFilterParam )
+{
+	Refresh();
+
+	TraceRay_t ray( vecStart, vecEnd );
+
+	TraceFilter_t filter;
+	filter.m_pfnFilter = pfnFilter;
+	filter.m_pFilterParam = pFilterParam;
+	filter.m_pHits = &hits;
+	filter.m_flMaxFraction = 1.0f;
+	filter.m_nBestPacket = -1;
+	filter.m_nBestLane = -1;
+
+	hits.RemoveAll();
+	TraceTree( ray, filter );
+	hits.Sort( TraceTree_CompareHits );
+
+	return hits.Count();
+}
+
+
+//-----------------------------------------------------------------------------
+// Purpose: Adds a face outside the hierarchy and returns its index.
+//-----------------------------------------------------------------------------
+int CMapTraceTree::AddFace( CMapFace *pFace, const Vector *pTriVerts, int nTris )
+{
+	int nFace = m_Faces.AddToTail();
+	Face_t &Face = m_Faces[nFace];
+	Face.m_pFace = pFace;
+	Face.m_pSolid = ( pFace != NULL ) ? ( CMapSolid * )pFace->GetParent() : NULL;
+	Face.m_pObject = NULL;
+	Face.m_hDisp = EDITDISPHANDLE_INVALID;
+	Face.m_nDispVersion = 0;
+	Face.m_nFirstPacket = m_Packets.Count();
+	Face.m_nTris = nTris;
+	Face.m_bLive = true;
+
+	if ( ( pFace != NULL ) && pFace->HasDisp() )
+	{
+		Face.m_hDisp = pFace->GetDisp();
+		Face.m_nDispVersion = EditDispMgr()->GetDisp( Face.m_hDisp )->GetSurfaceVersion();
+		m_DispFaces.AddToTail( nFace );
+	}
+
+	int nPackets = ( nTris + TRACETREE_PACKET_TRIS - 1 ) / TRACETREE_PACKET_TRIS;
+	m_Packets.AddMultipleToTail( nPackets );
+	for ( int i = 0; i < nPackets; i++ )
+	{
+		int nPacket = Face.m_nFirstPacket + i;
+		m_Packets[nPacket].m_nFace = nFace;
+		m_Packets[nPacket].m_nLeaf = -1;
+		SetPacket( nPacket, &pTriVerts[i * TRACETREE_PACKET_TRIS * 3], min( nTris - i * TRACETREE_PACKET_TRIS, TRACETREE_PACKET_TRIS ) );
+		m_LoosePackets.AddToTail( nPacket );
+	}
+
+	m_nLiveTris += nTris;
+	m_Stats.m_nRelinks++;
+
+	return nFace;
+}
+
+
+//-----------------------------------------------------------------------------
+// Purpose: Fills in a packet from up to TRACETREE_PACKET_TRIS triangles, three
+//			verts each. Unused lanes get a degenerate triangle that can never
+//			be hit.
+//-----------------------------------------------------------------------------
+void CMapTraceTree::SetPacket( int nPacket, const Vector *pTriVerts, int nTris )
+{
+	Packet_t &Packet = m_Packets[nPacket];
+	Packet.m_vecMins.Init( FLT_MAX, FLT_MAX, FLT_MAX );
+	Packet.m_vecMaxs.Init( -FLT_MAX, -FLT_MAX, -FLT_MAX );
+
+	for ( int nLane = 0; nLane < TRACETREE_PACKET_TRIS; nLane++ )
+	{
+		if ( nLane >= nTris )
+		{
+			for ( int nAxis = 0; nAxis < 3; nAxis++ )
+			{
+				Packet.m_flVert[nAxis][nLane] = 0.0f;
+				Packet.m_flEdge1[nAxis][nLane] = 0.0f;
+				Packet.m_flEdge2[nAxis][nLane] = 0.0f;
+			}
+			continue;
+		}
+
+		const Vector *pTri = &pTriVerts[nLane * 3];
+		for ( int nAxis = 0; nAxis < 3; nAxis++ )
+		{
+			Packet.m_flVert[nAxis][nLane] = pTri[0][nAxis];
+			Packet.m_flEdge1[nAxis][nLane] = pTri[1][nAxis] - pTri[0][nAxis];
+			Packet.m_flEdge2[nAxis][nLane] = pTri[2][nAxis] - pTri[0][nAxis];
+		}
+
+		for ( int i = 0; i < 3; i++ )
+		{
+			VectorMin( pTri[i], Packet.m_vecMins, Packet.m_vecMins );
+			VectorMax( pTri[i], Packet.m_vecMaxs, Packet.m_vecMaxs );
+		}
+	}
+}
+
+
+//-----------------------------------------------------------------------------
+// Purpose: Rewrites a face's packets with triangles that may have moved.
+//-----------------------------------------------------------------------------
+void CMapTraceTree::RefitFace( int nFace, const Vector *pTriVerts )
+{
+	const Face_t &Face = m_Faces[nFace];
+	int nPackets = ( Face.m_nTris + TRACETREE_PACKET_TRIS - 1 ) / TRACETREE_PACKET_TRIS;
+	for ( int i = 0; i < nPackets; i++ )
+	{
+		int nPacket = Face.m_nFirstPacket + i;
+		SetPacket( nPacket, &pTriVerts[i * TRACETREE_PACKET_TRIS * 3], min( Face.m_nTris - i * TRACETREE_PACKET_TRIS, TRACETREE_PACKET_TRIS ) );
+
+		int nLeaf = m_Packets[nPacket].m_nLeaf;
+		if ( ( nLeaf != -1 ) && ( ( m_DirtyLeaves.Count() == 0 ) || ( m_DirtyLeaves.Tail() != nLeaf ) ) )
+		{
+			m_DirtyLeaves.AddToTail( nLeaf );
+		}
+	}
+
+	m_Stats.m_nRefits++;
+}
+
+
+//-----------------------------------------------------------------------------
+// Purpose: Takes a face out of the traces. Its packets stay where they are,
+//			with empty bounds, until the next rebuild.
+//-----------------------------------------------------------------------------
+void CMapTraceTree::KillFace( int nFace )
+{
+	Face_t &Face = m_Faces[nFace];
+	if ( !Face.m_bLive )
+		return;
+
+	int nPackets = ( Face.m_nTris + TRACETREE_PACKET_TRIS - 1 ) / TRACETREE_PACKET_TRIS;
+	for ( int i = 0; i < nPackets; i++ )
+	{
+		Packet_t &Packet = m_Packets[Face.m_nFirstPacket + i];
+		Packet.m_vecMins.Init( FLT_MAX, FLT_MAX, FLT_MAX );
+		Packet.m_vecMaxs.Init( -FLT_MAX, -FLT_MAX, -FLT_MAX );
+
+		if ( ( Packet.m_nLeaf != -1 ) && ( ( m_DirtyLeaves.Count() == 0 ) || ( m_DirtyLeaves.Tail() != Packet.m_nLeaf ) ) )
+		{
+			m_DirtyLeaves.AddToTail( Packet.m_nLeaf );
+		}
+	}
+
+	m_nLiveTris -= Face.m_nTris;
+	m_nDeadFaces++;
+	m_nDeadPackets += nPackets;
+	Face.m_bLive = false;
+}
+
+
+//-----------------------------------------------------------------------------
+// Purpose: Adds the faces of every solid at or under a root-level object,
+//			next to each other, and files them under the object.
+//-----------------------------------------------------------------------------
+void CMapTraceTree::AddObjectFaces( CMapClass *pObject )
+{
+	CUtlVector<CMapFace *> faces;
+	TraceTree_GetFaces( pObject, faces );
+
+	ObjectFaces_t Faces;
+	Faces.m_nFirstFace = m_Faces.Count();
+	Faces.m_nFaces = faces.Count();
+
+	CUtlVector<Vector> triVerts;
+	for ( int i = 0; i < faces.Count(); i++ )
+	{
+		int nTris = GetFaceTris( faces[i], triVerts );
+		int nFace = AddFace( faces[i], triVerts.Base(), nTris );
+		m_Faces[nFace].m_pObject = pObject;
+	}
+
+	m_Objects.Insert( pObject, Faces );
+}
+
+
+//-----------------------------------------------------------------------------
+// Purpose: Gets the triangles of a face, three verts each, and returns how
+//			many there are. Displacements give their own triangles, in order;
+//			other faces are fanned from their first point.
+//-----------------------------------------------------------------------------
+int CMapTraceTree::GetFaceTris( CMapFace *pFace, CUtlVector<Vector> &triVerts )
+{
+	triVerts.RemoveAll();
+
+	if ( pFace->HasDisp() )
+	{
+		CMapDisp *pDisp = EditDispMgr()->GetDisp( pFace->GetDisp() );
+		int nTris = pDisp->GetTriCount();
+		triVerts.SetCount( nTris * 3 );
+		for ( int iTri = 0; iTri < nTris; iTri++ )
+		{
+			pDisp->GetTriPos( iTri, triVerts[iTri * 3], triVerts[iTri * 3 + 1], triVerts[iTri * 3 + 2] );
+		}
+
+		return nTris;
+	}
+
+	int nPoints = pFace->GetPointCount();
+	if ( nPoints < 3 )
+		return 0;
+
+	int nTris = nPoints - 2;
+	triVerts.SetCount( nTris * 3 );
+	for ( int iTri = 0; iTri < nTris; iTri++ )
+	{
+		pFace->GetPoint( triVerts[iTri * 3], 0 );
+		pFace->GetPoint( triVerts[iTri * 3 + 1], iTri + 1 );
+		pFace->GetPoint( triVerts[iTri * 3 + 2], iTri + 2 );
+	}
+
+	return nTris;
+}
+
+
+//-----------------------------------------------------------------------------
+// Purpose: Drops the dead faces and builds the hierarchy over every packet.
+//-----------------------------------------------------------------------------
+void CMapTraceTree::BuildNodes( void )
+{
+	//
+	// Squeeze out the dead faces. Faces only ever die a whole object at a
+	// time, so every object's faces are still next to each other after.
+	//
+	if ( m_nDeadFaces != 0 )
+	{
+		CUtlVector<int> newFaces;
+		newFaces.SetCount( m_Faces.Count() );
+
+		CUtlVector<Face_t> faces;
+		CUtlVector<Packet_t> packets;
+		packets.EnsureCapacity( m_Packets.Count() - m_nDeadPackets );
+		for ( int nFace = 0; nFace < m_Faces.Count(); nFace++ )
+		{
+			const Face_t &Face = m_Faces[nFace];
+			if ( !Face.m_bLive )
+			{
+				newFaces[nFace] = -1;
+				continue;
+			}
+
+			int nNewFace = faces.AddToTail( Face );
+			newFaces[nFace] = nNewFace;
+			faces[nNewFace].m_nFirstPacket = packets.Count();
+
+			int nPackets = ( Face.m_nTris + TRACETREE_PACKET_TRIS - 1 ) / TRACETREE_PACKET_TRIS;
+			for ( int i = 0; i < nPackets; i++ )
+			{
+				int nPacket = packets.AddToTail( m_Packets[Face.m_nFirstPacket + i] );
+				packets[nPacket].m_nFace = nNewFace;
+			}
+		}
+
+		FOR_EACH_HASHTABLE( m_Objects, h )
+		{
+			ObjectFaces_t &Faces = m_Objects.Element( h );
+			Faces.m_nFirstFace = ( Faces.m_nFaces != 0 ) ? newFaces[Faces.m_nFirstFace] : 0;
+		}
+
+		m_Faces.Swap( faces );
+		m_Packets.Swap( packets );
+		m_nDeadFaces = 0;
+		m_nDeadPackets = 0;
+
+		m_DispFaces.RemoveAll();
+		for ( int nFace = 0; nFace < m_Faces.Count(); nFace++ )
+		{
+			if ( m_Faces[nFace].m_hDisp != EDITDISPHANDLE_INVALID )
+			{
+				m_DispFaces.AddToTail( nFace );
+			}
+		}
+	}
+
+	m_Nodes.RemoveAll();
+	m_LoosePackets.RemoveAll();
+	m_DirtyLeaves.RemoveAll();
+
+	int nPackets = m_Packets.Count();
+	m_LeafPackets.SetCount( nPackets );
+
+	CUtlVector<Vector> centers;
+	centers.SetCount( nPackets );
+	for ( int i = 0; i < nPackets; i++ )
+	{
+		m_LeafPackets[i] = i;
+		centers[i] = ( m_Packets[i].m_vecMins + m_Packets[i].m_vecMaxs ) * 0.5f;
+	}
+
+	if ( nPackets != 0 )
+	{
+		m_Nodes.EnsureCapacity( 2 * ( nPackets / TRACETREE_LEAF_PACKETS + 1 ) );
+		m_Nodes.AddToTail();
+		BuildNode( 0, -1, 0, nPackets, centers );
+	}
+
+	m_Stats.m_nFaces = m_Faces.Count();
+	m_Stats.m_nTris = m_nLiveTris;
+	m_Stats.m_nNodes = m_Nodes.Count();
+	m_Stats.m_nRefits = 0;
+	m_Stats.m_nRelinks = 0;
+}
+
+
+//-----------------------------------------------------------------------------
+// Purpose: Fills in a node over a run of the leaf packet slots, splitting it
+//			at the median packet along the axis the packets are most spread
+//			out on.
+//-----------------------------------------------------------------------------
+void CMapTraceTree::BuildNode( int nNode, int nParent, int nFirst, int nCount, const CUtlVector<Vector> &centers )
+{
+	Vector vecMins( FLT_MAX, FLT_MAX, FLT_MAX ), vecMaxs( -FLT_MAX, -FLT_MAX, -FLT_MAX );
+	Vector vecCenterMins( FLT_MAX, FLT_MAX, FLT_MAX ), vecCenterMaxs( -FLT_MAX, -FLT_MAX, -FLT_MAX );
+	for ( int i = nFirst; i < nFirst + nCount; i++ )
+	{
+		const Packet_t &Packet = m_Packets[m_LeafPackets[i]];
+		VectorMin( Packet.m_vecMins, vecMins, vecMins );
+		VectorMax( Packet.m_vecMaxs, vecMaxs, vecMaxs );
+		VectorMin( centers[m_LeafPackets[i]], vecCenterMins, vecCenterMins );
+		VectorMax( centers[m_LeafPackets[i]], vecCenterMaxs, vecCenterMaxs );
+	}
+
+	m_Nodes[nNode].m_vecMins = vecMins;
+	m_Nodes[nNode].m_vecMaxs = vecMaxs;
+	m_Nodes[nNode].m_nParent = nParent;
+
+	if ( nCount <= TRACETREE_LEAF_PACKETS )
+	{
+		m_Nodes[nNode].m_nFirst = nFirst;
+		m_Nodes[nNode].m_nPackets = nCount;
+		for ( int i = nFirst; i < nFirst + nCount; i++ )
+		{
+			m_Packets[m_LeafPackets[i]].m_nLeaf = nNode;
+		}
+		return;
+	}
+
+	Vector vecExtents = vecCenterMaxs - vecCenterMins;
+	int nAxis = 0;
+	if ( vecExtents[1] > vecExtents[nAxis] )
+	{
+		nAxis = 1;
+	}
+	if ( vecExtents[2] > vecExtents[nAxis] )
+	{
+		nAxis = 2;
+	}
+
+	int nHalf = nCount / 2;
+	TraceTree_Partition( &m_LeafPackets[nFirst], nCount, nHalf, centers.Base(), nAxis );
+
+	// Both children go in together, after everything that is already there.
+	int nChild = m_Nodes.AddMultipleToTail( 2 );
+	m_Nodes[nNode].m_nFirst = nChild;
+	m_Nodes[nNode].m_nPackets = 0;
+
+	BuildNode( nChild, nNode, nFirst, nHalf, centers );
+	BuildNode( nChild + 1, nNode, nFirst + nHalf, nCount - nHalf, centers );
+}
+
+
+//-----------------------------------------------------------------------------
+// Purpose: Recomputes a leaf's box from its packets, and the boxes above it
+//			for as long as they change.
+//-----------------------------------------------------------------------------
+void CMapTraceTree::RefitLeaf( int nLeaf )
+{
+	Node_t &Leaf = m_Nodes[nLeaf];
+	Leaf.m_vecMins.Init( FLT_MAX, FLT_MAX, FLT_MAX );
+	Leaf.m_vecMaxs.Init( -FLT_MAX, -FLT_MAX, -FLT_MAX );
+	for ( int i = Leaf.m_nFirst; i < Leaf.m_nFirst + Leaf.m_nPackets; i++ )
+	{
+		const Packet_t &Packet = m_Packets[m_LeafPackets[i]];
+		VectorMin( Packet.m_vecMins, Leaf.m_vecMins, Leaf.m_vecMins );
+		VectorMax( Packet.m_vecMaxs, Leaf.m_vecMaxs, Leaf.m_vecMaxs );
+	}
+
+	for ( int nNode = Leaf.m_nParent; nNode != -1; nNode = m_Nodes[nNode].m_nParent )
+	{
+		Node_t &Node = m_Nodes[nNode];
+		const Node_t &Left = m_Nodes[Node.m_nFirst];
+		const Node_t &Right = m_Nodes[Node.m_nFirst + 1];
+
+		Vector vecMins, vecMaxs;
+		VectorMin( Left.m_vecMins, Right.m_vecMins, vecMins );
+		VectorMax( Left.m_vecMaxs, Right.m_vecMaxs, vecMaxs );
+		if ( ( vecMins == Node.m_vecMins ) && ( vecMaxs == Node.m_vecMaxs ) )
+			break;
+
+		Node.m_vecMins = vecMins;
+		Node.m_vecMaxs = vecMaxs;
+	}
+}
+
+
+//-----------------------------------------------------------------------------
+// Purpose: Brings the tree up to date before a trace: picks up displacements
+//			that were edited behind its back, then either refits the boxes
+//			that changed or rebuilds if too much has been added or removed.
+//-----------------------------------------------------------------------------
+void CMapTraceTree::Refresh( void )
+{
+	CUtlVector<Vector> triVerts;
+
+	// Faces can be added while going through the list, but they are current.
+	int nDispFaces = m_DispFaces.Count();
+	for ( int i = 0; i < nDispFaces; i++ )
+	{
+		int nFace = m_DispFaces[i];
+		if ( !m_Faces[nFace].m_bLive )
+			continue;
+
+		CMapDisp *pDisp = EditDispMgr()->GetDisp( m_Faces[nFace].m_hDisp );
+		if ( ( pDisp == NULL ) || ( pDisp->GetSurfaceVersion() == m_Faces[nFace].m_nDispVersion ) )
+			continue;
+
+		if ( GetFaceTris( m_Faces[nFace].m_pFace, triVerts ) == m_Faces[nFace].m_nTris )
+		{
+			RefitFace( nFace, triVerts.Base() );
+			m_Faces[nFace].m_nDispVersion = pDisp->GetSurfaceVersion();
+		}
+		else if ( m_Faces[nFace].m_pObject != NULL )
+		{
+			// The power changed, so the object's layout did too.
+			UpdateObject( m_Faces[nFace].m_pObject );
+		}
+	}
+
+	int nLivePackets = m_Packets.Count() - m_nDeadPackets;
+	if ( ( m_LoosePackets.Count() > max( TRACETREE_MIN_LOOSE_PACKETS, nLivePackets / 16 ) ) ||
+		 ( m_nDeadPackets > nLivePackets / 4 ) )
+	{
+		double flStart = Plat_FloatTime();
+		BuildNodes();
+		m_Stats.m_flBuildTime = Plat_FloatTime() - flStart;
+		return;
+	}
+
+	for ( int i = 0; i < m_DirtyLeaves.Count(); i++ )
+	{
+		RefitLeaf( m_DirtyLeaves[i] );
+	}
+	m_DirtyLeaves.RemoveAll();
+}
+
+
+//-----------------------------------------------------------------------------
+// Purpose: Tests the ray against the four triangles of a packet at once,
+//			from either side, and records what it hits.
+//-----------------------------------------------------------------------------
+void CMapTraceTree::TracePacket( int nPacket, const TraceRay_t &ray, TraceFilter_t &filter ) const
+{
+	const Packet_t &Packet = m_Packets[nPacket];
+	const Face_t &Face = m_Faces[Packet.m_nFace];
+	if ( !Face.m_bLive )
+		return;
+
+	if ( TraceTree_RayEntersBox( ray.m_vecStart, ray.m_vecInvDelta, Packet.m_vecMins, Packet.m_vecMaxs, filter.m_flMaxFraction ) < 0.0f )
+		return;
+
+	fltx4 e1[3], e2[3], org[3];
+	for ( int i = 0; i < 3; i++ )
+	{
+		e1[i] = LoadUnalignedSIMD( Packet.m_flEdge1[i] );
+		e2[i] = LoadUnalignedSIMD( Packet.m_flEdge2[i] );
+		org[i] = SubSIMD( ray.m_Start[i], LoadUnalignedSIMD( Packet.m_flVert[i] ) );
+	}
+
+	// delta x edge2
+	fltx4 p0 = SubSIMD( MulSIMD( ray.m_Delta[1], e2[2] ), MulSIMD( ray.m_Delta[2], e2[1] ) );
+	fltx4 p1 = SubSIMD( MulSIMD( ray.m_Delta[2], e2[0] ), MulSIMD( ray.m_Delta[0], e2[2] ) );
+	fltx4 p2 = SubSIMD( MulSIMD( ray.m_Delta[0], e2[1] ), MulSIMD( ray.m_Delta[1], e2[0] ) );
+
+	fltx4 det = MaddSIMD( p0, e1[0], MaddSIMD( p1, e1[1], MulSIMD( p2, e1[2] ) ) );
+
+	// Degenerate lanes divide by one instead of zero, and are masked out below.
+	fltx4 degenerate = CmpEqSIMD( det, Four_Zeros );
+	fltx4 invDet = DivSIMD( Four_Ones, OrSIMD( det, AndSIMD( degenerate, Four_Ones ) ) );
+
+	fltx4 u = MulSIMD( MaddSIMD( p0, org[0], MaddSIMD( p1, org[1], MulSIMD( p2, org[2] ) ) ), invDet );
+
+	// org x edge1
+	fltx4 q0 = SubSIMD( MulSIMD( org[1], e1[2] ), MulSIMD( org[2], e1[1] ) );
+	fltx4 q1 = SubSIMD( MulSIMD( org[2], e1[0] ), MulSIMD( org[0], e1[2] ) );
+	fltx4 q2 = SubSIMD( MulSIMD( org[0], e1[1] ), MulSIMD( org[1], e1[0] ) );
+
+	fltx4 v = MulSIMD( MaddSIMD( q0, ray.m_Delta[0], MaddSIMD( q1, ray.m_Delta[1], MulSIMD( q2, ray.m_Delta[2] ) ) ), invDet );
+	fltx4 t = MulSIMD( MaddSIMD( q0, e2[0], MaddSIMD( q1, e2[1], MulSIMD( q2, e2[2] ) ) ), invDet );
+
+	fltx4 hit = AndNotSIMD( degenerate, CmpGeSIMD( u, Four_Zeros ) );
+	hit = AndSIMD( hit, CmpGeSIMD( v, Four_Zeros ) );
+	hit = AndSIMD( hit, CmpLeSIMD( AddSIMD( u, v ), Four_Ones ) );
+	hit = AndSIMD( hit, CmpGeSIMD( t, Four_Zeros ) );
+	hit = AndSIMD( hit, CmpLeSIMD( t, ReplicateX4( filter.m_flMaxFraction ) ) );
+
+	int nHitMask = TestSignSIMD( hit );
+	if ( nHitMask == 0 )
+		return;
+
+	if ( ( Face.m_pSolid != NULL ) && !Face.m_pSolid->IsVisible() )
+		return;
+
+	if ( ( filter.m_pfnFilter != NULL ) && !filter.m_pfnFilter( Face.m_pFace, filter.m_pFilterParam ) )
+		return;
+
+	for ( int nLane = 0; nLane < TRACETREE_PACKET_TRIS; nLane++ )
+	{
+		if ( !( nHitMask & ( 1 << nLane ) ) )
+			continue;
+
+		float flFraction = SubFloat( t, nLane );
+		if ( filter.m_pHits != NULL )
+		{
+			MakeHit( nPacket, nLane, flFraction, ray, filter.m_pHits->Element( filter.m_pHits->AddToTail() ) );
+		}
+		else if ( ( filter.m_nBestPacket == -1 ) || ( flFraction < filter.m_flMaxFraction ) )
+		{
+			filter.m_flMaxFraction = flFraction;
+			filter.m_nBestPacket = nPacket;
+			filter.m_nBestLane = nLane;
+		}
+	}
+}
+
+
+//-----------------------------------------------------------------------------
+// Purpose: Walks the hierarchy nearest child first, skipping boxes the ray
+//			only reaches beyond the best hit so far, then tests the packets
+//			that are outside it.
+//-----------------------------------------------------------------------------
+void CMapTraceTree::TraceTree( const TraceRay_t &ray, TraceFilter_t &filter ) const
+{
+	if ( m_Nodes.Count() != 0 )
+	{
+		int nStack[TRACETREE_MAX_DEPTH * 2];
+		float flStackEnter[TRACETREE_MAX_DEPTH * 2];
+		int nDepth = 0;
+
+		float flEnter = TraceTree_RayEntersBox( ray.m_vecStart, ray.m_vecInvDelta, m_Nodes[0].m_vecMins, m_Nodes[0].m_vecMaxs, filter.m_flMaxFraction );
+		if ( flEnter >= 0.0f )
+		{
+			nStack[0] = 0;
+			flStackEnter[0] = flEnter;
+			nDepth = 1;
+		}
+
+		while ( nDepth > 0 )
+		{
+			nDepth--;
+			if ( flStackEnter[nDepth] > filter.m_flMaxFraction )
+				continue;
+
+			const Node_t &Node = m_Nodes[nStack[nDepth]];
+			if ( Node.m_nPackets != 0 )
+			{
+				for ( int i = Node.m_nFirst; i < Node.m_nFirst + Node.m_nPackets; i++ )
+				{
+					TracePacket( m_LeafPackets[i], ray, filter );
+				}
+				continue;
+			}
+
+			const Node_t &Left = m_Nodes[Node.m_nFirst];
+			const Node_t &Right = m_Nodes[Node.m_nFirst + 1];
+			float flLeft = TraceTree_RayEntersBox( ray.m_vecStart, ray.m_vecInvDelta, Left.m_vecMins, Left.m_vecMaxs, filter.m_flMaxFraction );
+			float flRight = TraceTree_RayEntersBox( ray.m_vecStart, ray.m_vecInvDelta, Right.m_vecMins, Right.m_vecMaxs, filter.m_flMaxFraction );
+
+			// Push the far child first so the near one comes off the stack first.
+			int nNear = Node.m_nFirst, nFar = Node.m_nFirst + 1;
+			float flNear = flLeft, flFar = flRight;
+			if ( ( flRight >= 0.0f ) && ( ( flLeft < 0.0f ) || ( flRight < flLeft ) ) )
+			{
+				nNear = Node.m_nFirst + 1;
+				nFar = Node.m_nFirst;
+				flNear = flRight;
+				flFar = flLeft;
+			}
+
+			Assert( nDepth + 2 <= TRACETREE_MAX_DEPTH * 2 );
+			if ( flFar >= 0.0f )
+			{
+				nStack[nDepth] = nFar;
+				flStackEnter[nDepth] = flFar;
+				nDepth++;
+			}
+			if ( flNear >= 0.0f )
+			{
+				nStack[nDepth] = nNear;
+				flStackEnter[nDepth] = flNear;
+				nDepth++;
+			}
+		}
+	}
+
+	for ( int i = 0; i < m_LoosePackets.Count(); i++ )
+	{
+		TracePacket( m_LoosePackets[i], ray, filter );
+	}
+}
+
+
+//-----------------------------------------------------------------------------
+// Purpose: Fills in a hit from a packet lane. The normal is the plane's for
+//			brush faces and the triangle's, as CMapDisp::TraceLine gives it,
+//			for displacements.
+//-----------------------------------------------------------------------------
+void CMapTraceTree::MakeHit( int nPacket, int nLane, float flFraction, const TraceRay_t &ray, MapTraceHit_t &hit ) const
+{
+	const Packet_t &Packet = m_Packets[nPacket];
+	const Face_t &Face = m_Faces[Packet.m_nFace];
+
+	hit.pSolid = Face.m_pSolid;
+	hit.pFace = Face.m_pFace;
+	hit.nTri = ( nPacket - Face.m_nFirstPacket ) * TRACETREE_PACKET_TRIS + nLane;
+	hit.flFraction = flFraction;
+	VectorMA( ray.m_vecStart, flFraction, ray.m_vecDelta, hit.vecPos );
+
+	if ( ( Face.m_pFace != NULL ) && ( Face.m_hDisp == EDITDISPHANDLE_INVALID ) )
+	{
+		hit.vecNormal = Face.m_pFace->plane.normal;
+	}
+	else
+	{
+		Vector vecEdge1( Packet.m_flEdge1[0][nLane], Packet.m_flEdge1[1][nLane], Packet.m_flEdge1[2][nLane] );
+		Vector vecEdge2( Packet.m_flEdge2[0][nLane], Packet.m_flEdge2[1][nLane], Packet.m_flEdge2[2][nLane] );
+		hit.vecNormal = CrossProduct( vecEdge2, vecEdge1 );
+		VectorNormalize( hit.vecNormal );
+	}
+}
+
+
+//=============================================================================
+//
+// Benchmark
+//
+
+#define TRACEBENCH_DISP_SIZE		512.0f
+#define TRACEBENCH_DISP_POWER		3
+#define TRACEBENCH_PILLAR_SIZE		32.0f
+#define TRACEBENCH_PILLAR_HEIGHT	256.0f
+#define TRACEBENCH_RAYS				4096
+#define TRACEBENCH_RAY_LENGTH		16384.0f
+
+
+//-----------------------------------------------------------------------------
+// Purpose: Repeatable number from 0 to 1 for a seed.
+//-----------------------------------------------------------------------------
+static float TraceBench_Random( unsigned int nSeed )
+{
+	nSeed ^= nSeed >> 16;
+	nSeed *= 0x7feb352d;
+	nSeed ^= nSeed >> 15;
+	nSeed *= 0x846ca68b;
+	nSeed ^= nSeed >> 16;
+
+	return ( float )( nSeed & 0xffff ) / 65535.0f;
+}
+
+
+//-----------------------------------------------------------------------------
+// Purpose:
+//-----------------------------------------------------------------------------
+static float TraceBench_Height( float x, float y )
+{
+	return 96.0f * sin( x * ( 1.0f / 700.0f ) ) * cos( y * ( 1.0f / 500.0f ) );
+}
+
+
+//-----------------------------------------------------------------------------
+// Purpose: Adds a quad as two triangles.
+//-----------------------------------------------------------------------------
+static void TraceBench_AddQuad( CUtlVector<Vector> &triVerts, const Vector &v0, const Vector &v1, const Vector &v2, const Vector &v3 )
+{
+	triVerts.AddToTail( v0 );
+	triVerts.AddToTail( v1 );
+	triVerts.AddToTail( v2 );
+	triVerts.AddToTail( v0 );
+	triVerts.AddToTail( v2 );
+	triVerts.AddToTail( v3 );
+}
+
+
+//-----------------------------------------------------------------------------
+// Purpose: Sorts the hit fractions along a ray and merges the ones closer
+//			together than the benchmark's tolerance, since triangles that share
+//			an edge can both claim a ray through it.
+//-----------------------------------------------------------------------------
+static int TraceBench_CompareFractions( const float *pLeft, const float *pRight )
+{
+	if ( *pLeft < *pRight )
+		return -1;
+
+	if ( *pLeft > *pRight )
+		return 1;
+
+	return 0;
+}
+
+static void TraceBench_MergeHits( CUtlVector<float> &fractions )
+{
+	fractions.Sort( TraceBench_CompareFractions );
+
+	int nKept = 0;
+	for ( int i = 0; i < fractions.Count(); i++ )
+	{
+		if ( ( nKept == 0 ) || ( ( fractions[i] - fractions[nKept - 1] ) * TRACEBENCH_RAY_LENGTH > 0.1f ) )
+		{
+			fractions[nKept++] = fractions[i];
+		}
+	}
+	fractions.SetCountNonDestructively( nKept );
+}
+
+
+//-----------------------------------------------------------------------------
+// Purpose:
+//-----------------------------------------------------------------------------
+void RunTraceTreeBenchmark( int nGridSize )
+{
+	nGridSize = clamp( nGridSize, 1, 128 );
+
+	//
+	// a rolling field of displacements with a box pillar standing on each
+	//
+	CUtlVector< CUtlVector<Vector> > faceTris;
+	int nWidth = ( 1 << TRACEBENCH_DISP_POWER ) + 1;
+	float flStep = TRACEBENCH_DISP_SIZE / ( nWidth - 1 );
+	for ( int y = 0; y < nGridSize; y++ )
+	{
+		for ( int x = 0; x < nGridSize; x++ )
+		{
+			CUtlVector<Vector> &triVerts = faceTris[faceTris.AddToTail()];
+			for ( int iV = 0; iV < nWidth - 1; iV++ )
+			{
+				for ( int iU = 0; iU < nWidth - 1; iU++ )
+				{
+					Vector vecCorners[4];
+					for ( int i = 0; i < 4; i++ )
+					{
+						float flX = x * TRACEBENCH_DISP_SIZE + ( iU + ( ( i == 1 || i == 2 ) ? 1 : 0 ) ) * flStep;
+						float flY = y * TRACEBENCH_DISP_SIZE + ( iV + ( ( i >= 2 ) ? 1 : 0 ) ) * flStep;
+						vecCorners[i].Init( flX, flY, TraceBench_Height( flX, flY ) );
+					}
+					TraceBench_AddQuad( triVerts, vecCorners[0], vecCorners[1], vecCorners[2], vecCorners[3] );
+				}
+			}
+
+			Vector vecMins( ( x + 0.5f ) * TRACEBENCH_DISP_SIZE - TRACEBENCH_PILLAR_SIZE, ( y + 0.5f ) * TRACEBENCH_DISP_SIZE - TRACEBENCH_PILLAR_SIZE, -128.0f );
+			Vector vecMaxs( vecMins.x + TRACEBENCH_PILLAR_SIZE * 2.0f, vecMins.y + TRACEBENCH_PILLAR_SIZE * 2.0f, TRACEBENCH_PILLAR_HEIGHT );
+			Vector vecBox[8];
+			for ( int i = 0; i < 8; i++ )
+			{
+				vecBox[i].Init( ( i & 1 ) ? vecMaxs.x : vecMins.x, ( i & 2 ) ? vecMaxs.y : vecMins.y, ( i & 4 ) ? vecMaxs.z : vecMins.z );
+			}
+
+			static const int s_BoxFaces[6][4] = { { 0, 2, 3, 1 }, { 4, 5, 7, 6 }, { 0, 1, 5, 4 }, { 2, 6, 7, 3 }, { 0, 4, 6, 2 }, { 1, 3, 7, 5 } };
+			for ( int i = 0; i < 6; i++ )
+			{
+				CUtlVector<Vector> &boxVerts = faceTris[faceTris.AddToTail()];
+				TraceBench_AddQuad( boxVerts, vecBox[s_BoxFaces[i][0]], vecBox[s_BoxFaces[i][1]], vecBox[s_BoxFaces[i][2]], vecBox[s_BoxFaces[i][3]] );
+			}
+		}
+	}
+
+	int nFaces = faceTris.Count();
+	CUtlVector<Vector> faceMins, faceMaxs;
+	faceMins.SetCount( nFaces );
+	faceMaxs.SetCount( nFaces );
+	int nTris = 0;
+	for ( int i = 0; i < nFaces; i++ )
+	{
+		faceMins[i].Init( FLT_MAX, FLT_MAX, FLT_MAX );
+		faceMaxs[i].Init( -FLT_MAX, -FLT_MAX, -FLT_MAX );
+		for ( int j = 0; j < faceTris[i].Count(); j++ )
+		{
+			VectorMin( faceTris[i][j], faceMins[i], faceMins[i] );
+			VectorMax( faceTris[i][j], faceMaxs[i], faceMaxs[i] );
+		}
+		nTris += faceTris[i].Count() / 3;
+	}
+
+	//
+	// picking rays from above the field, looking down at it from all sides
+	//
+	float flMapSize = nGridSize * TRACEBENCH_DISP_SIZE;
+	CUtlVector<Vector> rayStarts, rayEnds;
+	rayStarts.SetCount( TRACEBENCH_RAYS );
+	rayEnds.SetCount( TRACEBENCH_RAYS );
+	for ( int i = 0; i < TRACEBENCH_RAYS; i++ )
+	{
+		unsigned int nSeed = ( unsigned int )i * 6;
+		Vector vecEye( TraceBench_Random( nSeed ) * flMapSize, TraceBench_Random( nSeed + 1 ) * flMapSize, 256.0f + TraceBench_Random( nSeed + 2 ) * 1024.0f );
+		Vector vecTarget( TraceBench_Random( nSeed + 3 ) * flMapSize, TraceBench_Random( nSeed + 4 ) * flMapSize, TraceBench_Random( nSeed + 5 ) * 128.0f - 64.0f );
+		Vector vecDir = vecTarget - vecEye;
+		VectorNormalize( vecDir );
+
+		rayStarts[i] = vecEye;
+		VectorMA( vecEye, TRACEBENCH_RAY_LENGTH, vecDir, rayEnds[i] );
+	}
+
+	//
+	// every triangle of every face whose box the ray crosses, the way a pick
+	// used to end up in each object's TraceLine
+	//
+	CUtlVector<float> bruteFractions;
+	bruteFractions.SetCount( TRACEBENCH_RAYS );
+	double flStart = Plat_FloatTime();
+	for ( int i = 0; i < TRACEBENCH_RAYS; i++ )
+	{
+		Ray_t ray;
+		ray.Init( rayStarts[i], rayEnds[i] );
+
+		float flBest = -1.0f;
+		for ( int nFace = 0; nFace < nFaces; nFace++ )
+		{
+			if ( !IsBoxIntersectingRay( faceMins[nFace], faceMaxs[nFace], ray ) )
+				continue;
+
+			const CUtlVector<Vector> &triVerts = faceTris[nFace];
+			for ( int j = 0; j < triVerts.Count(); j += 3 )
+			{
+				float flFraction = IntersectRayWithTriangle( ray, triVerts[j], triVerts[j + 1], triVerts[j + 2], false );
+				if ( ( flFraction >= 0.0f ) && ( ( flBest < 0.0f ) || ( flFraction < flBest ) ) )
+				{
+					flBest = flFraction;
+				}
+			}
+		}
+		bruteFractions[i] = flBest;
+	}
+	double flBrute = Plat_FloatTime() - flStart;
+
+	//
+	// through the tree
+	//
+	CMapTraceTree tree;
+	flStart = Plat_FloatTime();
+	for ( int i = 0; i < nFaces; i++ )
+	{
+		tree.AddFace( NULL, faceTris[i].Base(), faceTris[i].Count() / 3 );
+	}
+	tree.BuildNodes();
+	double flBuild = Plat_FloatTime() - flStart;
+
+	CUtlVector<float> treeFractions;
+	treeFractions.SetCount( TRACEBENCH_RAYS );
+	flStart = Plat_FloatTime();
+	for ( int i = 0; i < TRACEBENCH_RAYS; i++ )
+	{
+		MapTraceHit_t hit;
+		treeFractions[i] = tree.TraceNearest( rayStarts[i], rayEnds[i], hit ) ? hit.flFraction : -1.0f;
+	}
+	double flTree = Plat_FloatTime() - flStart;
+
+	//
+	// every hit along each ray, testing every triangle and through the tree
+	//
+	CUtlVector< CUtlVector<float> > bruteAllFractions;
+	bruteAllFractions.SetCount( TRACEBENCH_RAYS );
+	flStart = Plat_FloatTime();
+	for ( int i = 0; i < TRACEBENCH_RAYS; i++ )
+	{
+		Ray_t ray;
+		ray.Init( rayStarts[i], rayEnds[i] );
+
+		for ( int nFace = 0; nFace < nFaces; nFace++ )
+		{
+			if ( !IsBoxIntersectingRay( faceMins[nFace], faceMaxs[nFace], ray ) )
+				continue;
+
+			const CUtlVector<Vector> &triVerts = faceTris[nFace];
+			for ( int j = 0; j < triVerts.Count(); j += 3 )
+			{
+				float flFraction = IntersectRayWithTriangle( ray, triVerts[j], triVerts[j + 1], triVerts[j + 2], false );
+				if ( flFraction >= 0.0f )
+				{
+					bruteAllFractions[i].AddToTail( flFraction );
+				}
+			}
+		}
+	}
+	double flBruteAll = Plat_FloatTime() - flStart;
+
+	CUtlVector< CUtlVector<float> > treeAllFractions;
+	treeAllFractions.SetCount( TRACEBENCH_RAYS );
+	CUtlVector<MapTraceHit_t> hits;
+	flStart = Plat_FloatTime();
+	for ( int i = 0; i < TRACEBENCH_RAYS; i++ )
+	{
+		tree.TraceAll( rayStarts[i], rayEnds[i], hits );
+		for ( int j = 0; j < hits.Count(); j++ )
+		{
+			treeAllFractions[i].AddToTail( hits[j].flFraction );
+		}
+	}
+	double flTreeAll = Plat_FloatTime() - flStart;
+
+	int nAllHits = 0, nAllMismatches = 0;
+	for ( int i = 0; i < TRACEBENCH_RAYS; i++ )
+	{
+		TraceBench_MergeHits( bruteAllFractions[i] );
+		TraceBench_MergeHits( treeAllFractions[i] );
+		nAllHits += bruteAllFractions[i].Count();
+
+		bool bSame = ( bruteAllFractions[i].Count() == treeAllFractions[i].Count() );
+		for ( int j = 0; bSame && ( j < bruteAllFractions[i].Count() ); j++ )
+		{
+			bSame = ( fabs( bruteAllFractions[i][j] - treeAllFractions[i][j] ) * TRACEBENCH_RAY_LENGTH <= 0.1f );
+		}
+
+		if ( !bSame )
+		{
+			nAllMismatches++;
+		}
+	}
+
+	int nHits = 0, nMismatches = 0;
+	for ( int i = 0; i < TRACEBENCH_RAYS; i++ )
+	{
+		if ( bruteFractions[i] >= 0.0f )
+		{
+			nHits++;
+		}
+
+		// Triangles that share an edge can both claim a ray through it, so
+		// only the distance has to agree.
+		bool bBruteHit = ( bruteFractions[i] >= 0.0f );
+		bool bTreeHit = ( treeFractions[i] >= 0.0f );
+		if ( ( bBruteHit != bTreeHit ) || ( bBruteHit && ( fabs( bruteFractions[i] - treeFractions[i] ) * TRACEBENCH_RAY_LENGTH > 0.1f ) ) )
+		{
+			nMismatches++;
+		}
+	}
+
+	flBrute = MAX( flBrute, 1.0e-6 );
+	flTree = MAX( flTree, 1.0e-6 );
+	flBruteAll = MAX( flBruteAll, 1.0e-6 );
+	flTreeAll = MAX( flTreeAll, 1.0e-6 );
+
+	Msg( mwStatus, "Trace tree benchmark: %d faces, %d triangles in a %dx%d displacement field.", nFaces, nTris, nGridSize, nGridSize );
+	Msg( mwStatus, "  box and triangle per face: %d rays in %.3f ms, %.0f picks/sec.",
+		TRACEBENCH_RAYS, flBrute * 1000.0, TRACEBENCH_RAYS / flBrute );
+	Msg( mwStatus, "  trace tree: %d nodes built in %.3f ms, %d rays in %.3f ms, %.0f picks/sec (%.1fx).",
+		tree.GetStats().m_nNodes, flBuild * 1000.0, TRACEBENCH_RAYS, flTree * 1000.0, TRACEBENCH_RAYS / flTree, flBrute / flTree );
+
+	if ( nMismatches == 0 )
+	{
+		Msg( mwStatus, "  both found the same %d hits.", nHits );
+	}
+	else
+	{
+		Msg( mwError, "  the trace tree disagreed with testing every triangle on %d of %d rays!", nMismatches, TRACEBENCH_RAYS );
+	}
+
+	Msg( mwStatus, "  all hits: every triangle in %.3f ms, trace tree in %.3f ms (%.1fx).",
+		flBruteAll * 1000.0, flTreeAll * 1000.0, flBruteAll / flTreeAll );
+
+	if ( nAllMismatches == 0 )
+	{
+		Msg( mwStatus, "  both found the same %d hits along every ray.", nAllHits );
+	}
+	else
+	{
+		Msg( mwError, "  the trace tree found different hits along %d of %d rays!", nAllMismatches, TRACEBENCH_RAYS );
+	}
+}
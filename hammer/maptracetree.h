@@ -0,0 +1,178 @@
+//========= Copyright Valve Corporation, All rights reserved. ============//
+//
+// Purpose: Bounding volume hierarchy over the triangles of every face and
+//			displacement in the world, for tracing rays against the map
+//			without testing every object and triangle.
+//
+//=============================================================================//
+
+#ifndef MAPTRACETREE_H
+#define MAPTRACETREE_H
+#pragma once
+
+#include "MapClass.h"
+#include "DispManager.h"
+#include "mathlib/vector.h"
+#include "tier1/utlhashtable.h"
+#include "tier1/utlvector.h"
+
+
+class CMapFace;
+class CMapSolid;
+
+
+#define TRACETREE_PACKET_TRIS		4		// triangles tested together
+#define TRACETREE_LEAF_PACKETS		4		// most packets in a leaf
+
+
+struct MapTraceHit_t
+{
+	CMapSolid	*pSolid;
+	CMapFace	*pFace;
+	int			nTri;			// the displacement's triangle for displacements, else the triangle in the face's fan
+	float		flFraction;		// 0 at the start of the ray, 1 at the end
+	Vector		vecPos;
+	Vector		vecNormal;
+};
+
+
+struct TraceTreeStats_t
+{
+	int m_nFaces;				// faces in the tree when it was built
+	int m_nTris;
+	int m_nNodes;
+	double m_flBuildTime;		// seconds
+	int m_nRefits;				// faces refit in place since the last build
+	int m_nRelinks;				// faces added outside the tree since the last build
+};
+
+
+// Return false to skip the face.
+typedef bool (*TraceTreeFilterFunc_t)( CMapFace *pFace, void *pParam );
+
+
+//-----------------------------------------------------------------------------
+// The triangles of each face are kept in packets of TRACETREE_PACKET_TRIS,
+// laid out so the packet can be tested against a ray in one go, and the
+// packets are the leaves of the hierarchy. Root-level objects of the world are
+// added, removed and updated the same way as in the culling tree.
+//
+// An update that keeps the face and triangle counts rewrites the packets in
+// place and refits the boxes above them. Anything else drops the object's old
+// faces and adds the new ones outside the hierarchy, where they are tested one
+// by one until there are enough of them to be worth rebuilding over.
+// Displacements are edited far more often than the world is told about it, so
+// their surface versions are checked before each trace as well.
+//-----------------------------------------------------------------------------
+class CMapTraceTree
+{
+public:
+
+	CMapTraceTree();
+
+	// Throws away whatever was in the tree and builds it over the objects.
+	void Build( const CMapObjectList &Objects );
+
+	void AddObject( CMapClass *pObject );
+	void RemoveObject( CMapClass *pObject );
+	void UpdateObject( CMapClass *pObject );
+
+	// Finds the nearest triangle hit between the two points, on faces of
+	// visible solids that pass the filter, if there is one.
+	bool TraceNearest( const Vector &vecStart, const Vector &vecEnd, MapTraceHit_t &hit,
+		TraceTreeFilterFunc_t pfnFilter = NULL, void *pFilterParam = NULL );
+
+	// Finds every triangle hit between the two points, nearest first, and
+	// returns how many there are.
+	int TraceAll( const Vector &vecStart, const Vector &vecEnd, CUtlVector<MapTraceHit_t> &hits,
+		TraceTreeFilterFunc_t pfnFilter = NULL, void *pFilterParam = NULL );
+
+	inline const TraceTreeStats_t &GetStats( void ) const	{ return m_Stats; }
+
+private:
+
+	friend void RunTraceTreeBenchmark( int nGridSize );
+
+	struct Packet_t
+	{
+		float	m_flVert[3][TRACETREE_PACKET_TRIS];		// first vert of each triangle, by axis
+		float	m_flEdge1[3][TRACETREE_PACKET_TRIS];	// from it to the second vert
+		float	m_flEdge2[3][TRACETREE_PACKET_TRIS];	// from it to the third vert
+		Vector	m_vecMins;
+		Vector	m_vecMaxs;
+		int		m_nFace;
+		int		m_nLeaf;								// -1 while outside the hierarchy
+	};
+
+	struct Face_t
+	{
+		CMapFace			*m_pFace;
+		CMapSolid			*m_pSolid;
+		CMapClass			*m_pObject;					// root-level object the face belongs to
+		EditDispHandle_t	m_hDisp;
+		int					m_nDispVersion;
+		int					m_nFirstPacket;
+		int					m_nTris;
+		bool				m_bLive;					// false once the object is removed
+	};
+
+	struct Node_t
+	{
+		Vector	m_vecMins;
+		Vector	m_vecMaxs;
+		int		m_nFirst;			// first of the two children, or the first packet slot in a leaf
+		int		m_nPackets;			// 0 for an inner node
+		int		m_nParent;
+	};
+
+	struct ObjectFaces_t
+	{
+		int		m_nFirstFace;		// faces of an object are added together
+		int		m_nFaces;
+	};
+
+	struct TraceRay_t;
+	struct TraceFilter_t;
+
+	int AddFace( CMapFace *pFace, const Vector *pTriVerts, int nTris );
+	void SetPacket( int nPacket, const Vector *pTriVerts, int nTris );
+	void RefitFace( int nFace, const Vector *pTriVerts );
+	void KillFace( int nFace );
+
+	void AddObjectFaces( CMapClass *pObject );
+	static int GetFaceTris( CMapFace *pFace, CUtlVector<Vector> &triVerts );
+
+	void BuildNodes( void );
+	void BuildNode( int nNode, int nParent, int nFirst, int nCount, const CUtlVector<Vector> &centers );
+	void RefitLeaf( int nLeaf );
+	void Refresh( void );
+
+	void TracePacket( int nPacket, const TraceRay_t &ray, TraceFilter_t &filter ) const;
+	void TraceTree( const TraceRay_t &ray, TraceFilter_t &filter ) const;
+	void MakeHit( int nPacket, int nLane, float flFraction, const TraceRay_t &ray, MapTraceHit_t &hit ) const;
+
+	CUtlVector<Packet_t>	m_Packets;
+	CUtlVector<Face_t>		m_Faces;
+	CUtlVector<Node_t>		m_Nodes;					// children always come after their parent
+	CUtlVector<int>			m_LeafPackets;				// packets of each leaf, in leaf order
+	CUtlVector<int>			m_LoosePackets;				// packets added since the last build
+	CUtlVector<int>			m_DispFaces;				// faces whose surface version has to be checked
+	CUtlVector<int>			m_DirtyLeaves;
+
+	CUtlHashtable<CMapClass *, ObjectFaces_t, PointerHashFunctor>	m_Objects;
+
+	int						m_nLiveTris;
+	int						m_nDeadFaces;
+	int						m_nDeadPackets;				// packets of removed faces still in the tree
+	TraceTreeStats_t		m_Stats;
+};
+
+
+// Times picking rays against a synthetic map of nGridSize x nGridSize
+// displacements with pillars standing on them, testing every triangle of
+// every face whose box the ray crosses against tracing the tree, and checks
+// that both find the same hits.
+void RunTraceTreeBenchmark( int nGridSize );
+
+
+#endif // MAPTRACETREE_H
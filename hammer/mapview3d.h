@@ -26,7 +26,9 @@ class CRender3D;
 class CCamera;
 class CTitleWnd;
 class CMapDecal;
+class CMapSolid;
 struct PLANE;
+struct MapTraceHit_t;
 
 //
 // Defines the logical keys.
@@ -108,7 +110,7 @@ public:
 
 	int			ObjectsAt(const Vector2D &point, HitInfo_t *pObjects, int nMaxObjects);
 
-	CMapClass	*NearestObjectAt( const Vector2D &point, ULONG &ulFace);
+	CMapClass	*NearestObjectAt( const Vector2D &point, ULONG &ulFace, MapTraceHit_t *pFaceHit = NULL );
 		
 	void RenderPreloadObject(CMapAtom *pObject);
 
@@ -143,6 +145,8 @@ private:
 	
 	bool ControlCamera(const CPoint &point);
 
+	void TraceSolidFace(const Vector2D &vPoint, CMapSolid *pSolid, ULONG &ulFace, MapTraceHit_t &FaceHit);
+
 	//
 	// Keyboard processing.
 	//
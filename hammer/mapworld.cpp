@@ -5,7 +5,6 @@
 //=============================================================================//
 
 #include "stdafx.h"
-#include "generichash.h"
 #include "CullTreeNode.h"
 #include "GlobalFunctions.h"
 #include "MainFrm.h"
@@ -14,6 +13,7 @@
 #include "MapEntity.h"
 #include "MapGroup.h"
 #include "MapSolid.h"
+#include "MapTraceTree.h"
 #include "MapWorld.h"
 #include "SaveInfo.h"
 #include "StatusBarIDs.h"
@@ -145,6 +145,7 @@ CMapWorld::CMapWorld(void)
 
 	SetClass("worldspawn");
 	m_pCullTree = NULL;
+	m_pTraceTree = NULL;
 
 	m_nNextFaceID = 1;			// Face IDs start at 1. An ID of 0 means no ID.
 
@@ -152,11 +153,20 @@ CMapWorld::CMapWorld(void)
 	m_pWorldDispMgr = CreateWorldEditDispMgr();
 
 	m_pPreferredPickObject = NULL;
+
+	//
+	// Keys that entities are commonly looked up by. Anything else is found by
+	// scanning the entity list.
+	//
+	m_EntityIndex.AddKey("targetname");
+	m_EntityIndex.AddKey(ENTITY_INDEX_CLASSNAME);
+	m_EntityIndex.AddKey("nodeid");
 }
 
 
 //-----------------------------------------------------------------------------
-// Purpose: Destructor. Deletes all paths in the world and the culling tree.
+// Purpose: Destructor. Deletes all paths in the world and the culling and
+//			trace trees.
 //-----------------------------------------------------------------------------
 CMapWorld::~CMapWorld(void)
 {
@@ -164,12 +174,16 @@ CMapWorld::~CMapWorld(void)
 	m_Paths.PurgeAndDeleteElements();
 
 	//
-	// Delete the culling tree.
+	// Delete the culling and trace trees.
 	//
 	CullTree_Free();
+	TraceTree_Free();
 
 	// destroy the world displacement manager
 	DestroyWorldEditDispMgr( &m_pWorldDispMgr );
+
+	// Our children are deleted after the entity index is gone, so let go of them now.
+	m_EntityIndex.RemoveAll();
 }
 
 
@@ -187,7 +201,12 @@ void CMapWorld::AddChild(CMapClass *pChild)
 	//
 	if (m_pCullTree != NULL)
 	{
-		m_pCullTree->AddCullTreeObjectRecurse(pChild);
+		m_pCullTree->AddObject(pChild);
+	}
+
+	if (m_pTraceTree != NULL)
+	{
+		m_pTraceTree->AddObject(pChild);
 	}
 }
 
@@ -314,41 +333,6 @@ CMapClass *CMapWorld::CopyFrom(CMapClass *pobj, bool bUpdateDependencies)
 }
 
 
-//-----------------------------------------------------------------------------
-// Hash the string to the bucket index where it belongs.
-//-----------------------------------------------------------------------------
-static inline int EntityBucketForName( const char *pszName )
-{
-	if ( !pszName )
-		return 0;
-
-	unsigned int nHash = HashStringCaseless( pszName );
-
-	return nHash % NUM_HASHED_ENTITY_BUCKETS;
-}
-
-
-//-----------------------------------------------------------------------------
-//-----------------------------------------------------------------------------
-int CMapWorld::FindEntityBucket( CMapEntity *pEntity, int *pnIndex )
-{
-	for ( int i = 0; i < NUM_HASHED_ENTITY_BUCKETS; i++ )
-	{
-		int nIndex = m_EntityListByName[ i ].Find( pEntity );
-		if ( nIndex != -1 )
-		{
-			if ( pnIndex )
-			{
-				*pnIndex = nIndex;
-			}
-
-			return i;
-		}
-	}
-
-	return -1;
-}
-
 void CMapWorld::SetVMFPath( const char* pVMFPath )
 {
 	m_strVMFPath = pVMFPath;
@@ -363,19 +347,8 @@ const char* CMapWorld::GetVMFPath() const
 //-----------------------------------------------------------------------------
 void CMapWorld::AddEntity( CMapEntity *pEntity )
 {
-	if ( m_EntityList.Find( pEntity ) != -1 )
-		return;
-
-	// Add it to the flat list.
-	m_EntityList.AddToTail( pEntity );
-
-	// If it has a name, add it to the list of entities hashed by name checksum.
-	const char *pszName = pEntity->GetKeyValue( "targetname" );
-	if ( pszName )
-	{
-		int nBucket = EntityBucketForName( pszName );
-		m_EntityListByName[ nBucket ].AddToTail( pEntity );
-	}
+	// Adds it to the flat list and the key indices, unless it's there already.
+	m_EntityIndex.AddEntity( pEntity );
 }
 
 
@@ -398,7 +371,7 @@ void CMapWorld::EntityList_Add(CMapClass *pObject)
 	while (pChild != NULL)
 	{
 		CMapEntity *pEntity = dynamic_cast<CMapEntity *>(pChild);
-		if ((pEntity != NULL) && (m_EntityList.Find(pEntity) == -1))
+		if (pEntity != NULL)
 		{
 			AddEntity(pEntity);
 		}
@@ -421,21 +394,9 @@ void CMapWorld::EntityList_Remove(CMapClass *pObject, bool bRemoveChildren)
 	CMapEntity *pEntity = dynamic_cast<CMapEntity *>(pObject);
 	if (pEntity != NULL)
 	{
-		// Remove the entity from the flat list.
-		int nIndex = m_EntityList.Find( pEntity );
-		if ( nIndex != -1 )
-		{
-			m_EntityList.FastRemove( nIndex );
-		}
-
-		// Remove the entity from the hashed list.
-		int nOldBucket = FindEntityBucket( pEntity, &nIndex );
-		if ( nOldBucket != -1 )
-		{
-			m_EntityListByName[ nOldBucket ].FastRemove( nIndex );
-		}
-
-		Assert( m_EntityList.Find( pEntity ) == -1 );
+		// Remove the entity from the flat list and the key indices.
+		m_EntityIndex.RemoveEntity( pEntity );
+		Assert( !m_EntityIndex.HasEntity( pEntity ) );
 	}
 
 	//
@@ -450,7 +411,7 @@ void CMapWorld::EntityList_Remove(CMapClass *pObject, bool bRemoveChildren)
 			CMapEntity *pEntity = dynamic_cast<CMapEntity *>(pChild);
 			if (pEntity != NULL)
 			{
-				m_EntityList.FindAndRemove(pEntity);
+				m_EntityIndex.RemoveEntity(pEntity);
 			}
 			pChild = pObject->GetNextDescendent(pos);
 		}
@@ -472,7 +433,12 @@ void CMapWorld::RemoveChild(CMapClass *pChild, bool bUpdateBounds)
 	//
 	if (m_pCullTree != NULL)
 	{
-		m_pCullTree->RemoveCullTreeObjectRecurse(pChild);
+		m_pCullTree->RemoveObject(pChild);
+	}
+
+	if (m_pTraceTree != NULL)
+	{
+		m_pTraceTree->RemoveObject(pChild);
 	}
 }
 
@@ -537,7 +503,12 @@ void CMapWorld::UpdateChild(CMapClass *pChild)
 	//
 	if (m_pCullTree != NULL)
 	{
-		m_pCullTree->UpdateCullTreeObjectRecurse(pChild);
+		m_pCullTree->UpdateObject(pChild);
+	}
+
+	if (m_pTraceTree != NULL)
+	{
+		m_pTraceTree->UpdateObject(pChild);
 	}
 
 	//
@@ -567,159 +538,62 @@ void CMapWorld::GetUsedTextures(CUsedTextureList &List)
 
 
 //-----------------------------------------------------------------------------
-// Purpose:
-// Input  : pNode -
+// Purpose: Deletes the entire culling tree if is it not NULL. This does not
+//			delete the map objects that the culling tree contains, only the
+//			leaves and nodes themselves.
 //-----------------------------------------------------------------------------
-void CMapWorld::CullTree_FreeNode(CCullTreeNode *pNode)
+void CMapWorld::CullTree_Free(void)
 {
-	Assert(pNode != NULL);
-
-	int nChildCount = pNode->GetChildCount();
-	if (nChildCount != 0)
+	if (m_pCullTree != NULL)
 	{
-		for (int nChild = 0; nChild < nChildCount; nChild++)
-		{
-			CCullTreeNode *pChild = pNode->GetCullTreeChild(nChild);
-			CullTree_FreeNode(pChild);
-		}
+		delete m_pCullTree;
+		m_pCullTree = NULL;
 	}
-
-	delete pNode;
 }
 
 
 //-----------------------------------------------------------------------------
-// Purpose: Recursively deletes the entire culling tree if is it not NULL.
-//			This does not delete the map objects that the culling tree contains,
-//			only the leaves and nodes themselves.
+// Purpose: Deletes the trace tree if there is one. It is built again the next
+//			time something traces against the world.
 //-----------------------------------------------------------------------------
-void CMapWorld::CullTree_Free(void)
+void CMapWorld::TraceTree_Free(void)
 {
-	if (m_pCullTree != NULL)
+	if (m_pTraceTree != NULL)
 	{
-		CullTree_FreeNode(m_pCullTree);
-		m_pCullTree = NULL;
+		delete m_pTraceTree;
+		m_pTraceTree = NULL;
 	}
 }
 
 
 //-----------------------------------------------------------------------------
-// Purpose: Determines if this node is a node or a leaf. If it is a node, it will
-//			be split into eight children and each child will be populated with
-//			objects whose bounding boxes intersect them, then split recursively.
-//			If this node is a leaf, no action is taken and recursion terminates.
-// Input  : pNode -
+// Purpose: Returns the trace tree, building it over the contents of the world
+//			if there isn't one yet. After that, objects are relinked as they
+//			are added, removed and changed, like in the culling tree.
 //-----------------------------------------------------------------------------
-#define MIN_NODE_DIM			1024		// Minimum node size of 170 x 170 x 170 feet
-#define MIN_NODE_OBJECT_SPLIT	2			// Don't split nodes with fewer than two objects.
-
-void CMapWorld::CullTree_SplitNode(CCullTreeNode *pNode)
+CMapTraceTree *CMapWorld::TraceTree_Get(void)
 {
-	Vector Mins;
-	Vector Maxs;
-	Vector Size;
-
-	pNode->GetBounds(Mins, Maxs);
-	VectorSubtract(Maxs, Mins, Size);
-
-	if ((Size[0] > MIN_NODE_DIM) && (Size[1] > MIN_NODE_DIM) && (Size[2] > MIN_NODE_DIM))
+	if (m_pTraceTree == NULL)
 	{
-		Vector Mids;
-		int nChild;
-
-		Mids[0] = (Mins[0] + Maxs[0]) / 2.0;
-		Mids[1] = (Mins[1] + Maxs[1]) / 2.0;
-		Mids[2] = (Mins[2] + Maxs[2]) / 2.0;
-
-		for (nChild = 0; nChild < 8; nChild++)
-		{
-			Vector ChildMins;
-			Vector ChildMaxs;
-
-			//
-			// Create a child and set its bounding box.
-			//
-			CCullTreeNode *pChild = new CCullTreeNode;
-
-			if (nChild & 1)
-			{
-				ChildMins[0] = Mins[0];
-				ChildMaxs[0] = Mids[0];
-			}
-			else
-			{
-				ChildMins[0] = Mids[0];
-				ChildMaxs[0] = Maxs[0];
-			}
-
-			if (nChild & 2)
-			{
-				ChildMins[1] = Mins[1];
-				ChildMaxs[1] = Mids[1];
-			}
-			else
-			{
-				ChildMins[1] = Mids[1];
-				ChildMaxs[1] = Maxs[1];
-			}
-
-			if (nChild & 4)
-			{
-				ChildMins[2] = Mins[2];
-				ChildMaxs[2] = Mids[2];
-			}
-			else
-			{
-				ChildMins[2] = Mids[2];
-				ChildMaxs[2] = Maxs[2];
-			}
-
-			pChild->UpdateBounds(ChildMins, ChildMaxs);
-
-			pNode->AddCullTreeChild(pChild);
-
-			Vector mins1;
-			Vector maxs1;
-			pChild->GetBounds(mins1, maxs1);
-
-			//
-			// Check all objects in this node against the child's bounding box, adding the
-			// objects that intersect to the child's object list.
-			//
-			int nObjectCount = pNode->GetObjectCount();
-			for (int nObject = 0; nObject < nObjectCount; nObject++)
-			{
-				CMapClass *pObject = pNode->GetCullTreeObject(nObject);
-				Assert(pObject != NULL);
+		m_pTraceTree = new CMapTraceTree;
+		m_pTraceTree->Build(m_Children);
+	}
 
-				Vector mins2;
-				Vector maxs2;
-				pObject->GetCullBox(mins2, maxs2);
-				if (BoxesIntersect(mins1, maxs1, mins2, maxs2))
-				{
-					pChild->AddCullTreeObject(pObject);
-				}
-			}
-		}
+	return(m_pTraceTree);
+}
 
-		//
-		// Remove all objects from this node's object list (since we are not a leaf).
-		//
-		pNode->RemoveAllCullTreeObjects();
 
-		//
-		// Recurse into all children with at least two objects, splitting them.
-		//
-		int nChildCount = pNode->GetChildCount();
-		for (nChild = 0; nChild < nChildCount; nChild++)
-		{
-			CCullTreeNode *pChild = pNode->GetCullTreeChild(nChild);
-			if (pChild->GetObjectCount() >= MIN_NODE_OBJECT_SPLIT)
-			{
-				CullTree_SplitNode(pChild);
-			}
-		}
+//-----------------------------------------------------------------------------
+// Purpose: Returns the root of the culling tree, or NULL if there isn't one.
+//-----------------------------------------------------------------------------
+CCullTreeNode *CMapWorld::CullTree_GetCullTree(void)
+{
+	if (m_pCullTree == NULL)
+	{
+		return(NULL);
 	}
+
+	return(m_pCullTree->GetRootNode());
 }
 
 
@@ -762,35 +636,43 @@ void CMapWorld::CullTree_DumpNode(CCullTreeNode *pNode, int nDepth)
 
 
 //-----------------------------------------------------------------------------
-// Purpose:
+// Purpose: Builds the culling tree from scratch. After this, objects are linked
+//			and unlinked incrementally as they are added, removed and moved.
 //-----------------------------------------------------------------------------
 void CMapWorld::CullTree_Build(void)
 {
+	if (m_pCullTree != NULL)
+	{
+		const CullTreeStats_t &Stats = m_pCullTree->GetStats();
+		if (Stats.m_nUpdates != 0)
+		{
+			Msg(mwStatus, "Culling tree: %d updates touched %d leaves in %.1f ms since the last build.",
+				Stats.m_nUpdates, Stats.m_nLeavesTouched, Stats.m_flUpdateTime * 1000.0);
+		}
+	}
+
 	CullTree_Free();
-	m_pCullTree = new CCullTreeNode;
+	m_pCullTree = new CCullTree;
 
 	//
 	// The top level node in the tree uses the largest possible bounding box.
 	//
 	Vector BoxMins( g_MIN_MAP_COORD, g_MIN_MAP_COORD, g_MIN_MAP_COORD );
 	Vector BoxMaxs( g_MAX_MAP_COORD, g_MAX_MAP_COORD, g_MAX_MAP_COORD );
-	m_pCullTree->UpdateBounds(BoxMins, BoxMaxs);
 
 	//
-	// Populate the top level node with the contents of the world.
+	// Split it around the contents of the world.
 	//
-	FOR_EACH_OBJ( m_Children, pos )
+	m_pCullTree->Build(m_Children, BoxMins, BoxMaxs);
+
+	const CullTreeStats_t &Stats = m_pCullTree->GetStats();
+	if (Stats.m_nObjects != 0)
 	{
-		CMapClass *pObject = m_Children.Element(pos);
-		m_pCullTree->AddCullTreeObject(pObject);
+		Msg(mwStatus, "Built culling tree: %d objects, %d nodes in %.1f ms on %d threads.",
+			Stats.m_nObjects, Stats.m_nNodes, Stats.m_flBuildTime * 1000.0, Stats.m_nBuildThreads);
 	}
 
-	//
-	// Recursively split this node into children and populate them.
-	//
-	CullTree_SplitNode(m_pCullTree);
-
-	//DumpCullTreeNode(m_pCullTree, 1);
+	//CullTree_DumpNode(m_pCullTree->GetRootNode(), 1);
 	//OutputDebugString("\n");
 }
 
@@ -865,7 +747,12 @@ void CMapWorld::PostloadWorld(void)
 			//
 			if (m_pCullTree != NULL)
 			{
-				m_pCullTree->UpdateCullTreeObjectRecurse(pChild);
+				m_pCullTree->UpdateObject(pChild);
+			}
+
+			if (m_pTraceTree != NULL)
+			{
+				m_pTraceTree->UpdateObject(pChild);
 			}
 
 			pChild->PostUpdate(Notify_Changed);
@@ -947,6 +834,14 @@ ChunkFileResult_t CMapWorld::LoadKeyCallback(const char *szKey, const char *szVa
 //-----------------------------------------------------------------------------
 ChunkFileResult_t CMapWorld::LoadVMF(CChunkFile *pFile)
 {
+	//
+	// The doc builds the culling tree once everything is loaded, don't keep
+	// relinking the old one as each solid comes in. The trace tree is built
+	// on the first trace after that.
+	//
+	CullTree_Free();
+	TraceTree_Free();
+
 	//
 	// Set up handlers for the subchunks that we are interested in.
 	//
@@ -1009,6 +904,33 @@ void CMapWorld::PresaveWorld(void)
 }
 
 
+//-----------------------------------------------------------------------------
+// Purpose: Calls PresaveWorld in the objects from a save list that are going to
+//			be saved, and in their descendents.
+//-----------------------------------------------------------------------------
+void CMapWorld::PresaveObjectList(CSaveInfo *pSaveInfo, const CMapObjectList *pList)
+{
+	FOR_EACH_OBJ( *pList, pos )
+	{
+		CMapClass *pObject = pList->Element(pos);
+		if (!pSaveInfo->ShouldSaveListObject(pObject))
+		{
+			continue;
+		}
+
+		pObject->PresaveWorld();
+
+		EnumChildrenPos_t ChildPos;
+		CMapClass *pChild = pObject->GetFirstDescendent(ChildPos);
+		while (pChild != NULL)
+		{
+			pChild->PresaveWorld();
+			pChild = pObject->GetNextDescendent(ChildPos);
+		}
+	}
+}
+
+
 //-----------------------------------------------------------------------------
 // Purpose: Saves all solids, entities, and groups in the world to a VMF file.
 // Input  : pFile - File object to use for saving.
@@ -1017,14 +939,24 @@ void CMapWorld::PresaveWorld(void)
 //-----------------------------------------------------------------------------
 ChunkFileResult_t CMapWorld::SaveVMF(CChunkFile *pFile, CSaveInfo *pSaveInfo, int saveFlags)
 {
-	PresaveWorld();
-
 	//
 	// Sort the world objects into lists for saving into different chunks.
 	//
 	SaveLists_t SaveLists;
 	EnumChildrenRecurseGroupsOnly(BuildSaveListsCallback, &SaveLists);
 
+	if (pSaveInfo->HasObjectIDs())
+	{
+		// Only the objects being saved need to get ready for it.
+		PresaveObjectList(pSaveInfo, &SaveLists.Solids);
+		PresaveObjectList(pSaveInfo, &SaveLists.Groups);
+		PresaveObjectList(pSaveInfo, &SaveLists.Entities);
+	}
+	else
+	{
+		PresaveWorld();
+	}
+
 	//
 	// Begin the world chunk.
 	//
@@ -1107,6 +1039,11 @@ ChunkFileResult_t CMapWorld::SaveObjectListVMF(CChunkFile *pFile, CSaveInfo *pSa
 	{
 		CMapClass *pObject = pList->Element(pos);
 
+		if (!pSaveInfo->ShouldSaveListObject(pObject))
+		{
+			continue;
+		}
+
 		// Only save lights if that's what they want.
 		if( saveFlags & SAVEFLAGS_LIGHTSONLY )
 		{
@@ -1678,35 +1615,19 @@ void CMapWorld::PostloadVisGroups()
 
 
 //-----------------------------------------------------------------------------
+// Purpose: Finds the first entity whose name matches the given name, allowing
+//			wildcards in either name.
 //-----------------------------------------------------------------------------
 CMapEntity *CMapWorld::FindEntityByName( const char *pszName, bool bVisiblesOnly )
 {
 	if ( !pszName )
 		return NULL;
 
-	CMapEntityList *pList = &m_EntityList;
-
-	if ( !strchr( pszName, '*' ) )
-	{
-		int nBucket = EntityBucketForName( pszName );
-		pList = &m_EntityListByName[nBucket];
-	}
-
-	int nCount = pList->Count();
-	for ( int i = 0; i < nCount; i++ )
-	{
-		CMapEntity *pEntity = pList->Element( i );
-
-		if ( pEntity->IsVisible() || !bVisiblesOnly )
-		{
-			if ( pEntity->NameMatches( pszName ) )
-			{
-				return pEntity;
-			}
-		}
-	}
+	CMapEntityList Found;
+	if ( !m_EntityIndex.FindMatches( Found, "targetname", pszName, bVisiblesOnly, true ) )
+		return NULL;
 
-	return NULL;
+	return Found.Element( 0 );
 }
 
 
@@ -1720,64 +1641,27 @@ bool CMapWorld::FindEntitiesByClassName(CMapEntityList &Found, const char *pszCl
 {
 	Found.RemoveAll();
 
-	int nCount = EntityList_GetCount();
-	for ( int i = 0; i < nCount; i++ )
-	{
-		CMapEntity *pEntity = EntityList_GetEntity( i );
-
-		if ( pEntity->IsVisible() || !bVisiblesOnly )
-		{
-			if ( pEntity->ClassNameMatches( pszClassName ) )
-			{
-				Found.AddToTail( pEntity );
-			}
-		}
-	}
-
-	return( Found.Count() != 0 );
+	return m_EntityIndex.FindMatches( Found, ENTITY_INDEX_CLASSNAME, pszClassName, bVisiblesOnly );
 }
 
 
 //-----------------------------------------------------------------------------
-// Purpose:
-// Input  : pFound -
-//			pszTargetName -
-// Output : Returns true on success, false on failure.
+// Purpose: Finds all entities whose value for the given key equals the given
+//			value, or that don't have the key if the value is NULL.
+// Output : Returns true if any matches were found, false if not.
 //-----------------------------------------------------------------------------
 bool CMapWorld::FindEntitiesByKeyValue(CMapEntityList &Found, const char *pszKey, const char *pszValue, bool bVisiblesOnly)
 {
 	Found.RemoveAll();
 
-	int nCount = EntityList_GetCount();
-	for ( int i = 0; i < nCount; i++ )
-	{
-		CMapEntity *pEntity = EntityList_GetEntity( i );
-
-		if ( pEntity->IsVisible() || !bVisiblesOnly )
-		{
-			const char *pszThisValue = pEntity->GetKeyValue( pszKey );
-
-			if ( pszThisValue != NULL )
-			{
-				if (( pszValue != NULL ) && ( !stricmp( pszValue, pszThisValue )))
-				{
-					Found.AddToTail( pEntity );
-				}
-			}
-			else if (pszValue == NULL)
-			{
-				Found.AddToTail( pEntity );
-			}
-		}
-	}
-
-	return( Found.Count() != 0 );
+	return m_EntityIndex.FindExact( Found, pszKey, pszValue, bVisiblesOnly );
 }
 
 
 //-----------------------------------------------------------------------------
-// Purpose:
-// Output : Returns true on success, false on failure.
+// Purpose: Finds all entities whose name matches the given name, allowing
+//			wildcards in either name.
+// Output : Returns true if any matches were found, false if not.
 //-----------------------------------------------------------------------------
 bool CMapWorld::FindEntitiesByName( CMapEntityList &Found, const char *pszName, bool bVisiblesOnly )
 {
@@ -1786,51 +1670,33 @@ bool CMapWorld::FindEntitiesByName( CMapEntityList &Found, const char *pszName,
 	if ( !pszName )
 		return false;
 
-	CMapEntityList *pList = &m_EntityList;
-
-	if ( !strchr( pszName, '*' ) )
-	{
-		int nBucket = EntityBucketForName( pszName );
-		pList = &m_EntityListByName[nBucket];
-	}
-
-	int nCount = pList->Count();
-	for ( int i = 0; i < nCount; i++ )
-	{
-		CMapEntity *pEntity = pList->Element( i );
-
-		if ( pEntity->IsVisible() || !bVisiblesOnly )
-		{
-			if ( pEntity->NameMatches( pszName ) )
-			{
-				Found.AddToTail( pEntity );
-			}
-		}
-	}
-
-	return( Found.Count() != 0 );
+	return m_EntityIndex.FindMatches( Found, "targetname", pszName, bVisiblesOnly );
 }
 
 
 //-----------------------------------------------------------------------------
-// Purpose:
-// Output : Returns true on success, false on failure.
+// Purpose: Finds all entities whose name or class name matches the given name.
+// Output : Returns true if any matches were found, false if not.
 //-----------------------------------------------------------------------------
 bool CMapWorld::FindEntitiesByNameOrClassName(CMapEntityList &Found, const char *pszName, bool bVisiblesOnly)
 {
 	Found.RemoveAll();
 
-	int nCount = EntityList_GetCount();
+	m_EntityIndex.FindMatches( Found, "targetname", pszName, bVisiblesOnly );
+
+	//
+	// Add the class name matches that weren't found by name already.
+	//
+	CMapEntityList ClassMatches;
+	m_EntityIndex.FindMatches( ClassMatches, ENTITY_INDEX_CLASSNAME, pszName, bVisiblesOnly );
+
+	int nCount = ClassMatches.Count();
 	for ( int i = 0; i < nCount; i++ )
 	{
-		CMapEntity *pEntity = EntityList_GetEntity( i );
-
-		if ( pEntity->IsVisible() || !bVisiblesOnly )
+		CMapEntity *pEntity = ClassMatches.Element( i );
+		if ( !pEntity->NameMatches( pszName ) )
 		{
-			if ( pEntity->NameMatches( pszName ) || pEntity->ClassNameMatches( pszName ) )
-			{
-				Found.AddToTail( pEntity );
-			}
+			Found.AddToTail( pEntity );
 		}
 	}
 
@@ -1844,35 +1710,12 @@ bool CMapWorld::FindEntitiesByNameOrClassName(CMapEntityList &Found, const char
 void CMapWorld::UpdateAllDependencies( CMapClass *pObject )
 {
 	//
-	// Entities need to be put in their proper hash bucket if the name changed.
+	// Entities need to be moved in the key indices if their name changed.
 	//
 	CMapEntity *pEntity = dynamic_cast<CMapEntity *>(pObject);
 	if ( pEntity )
 	{
-		int nNewBucket = -1;
-		const char *pszName = pEntity->GetKeyValue( "targetname" );
-		if ( pszName )
-		{
-			nNewBucket = EntityBucketForName( pszName );
-		}
-
-		int nIndex;
-		int nOldBucket = FindEntityBucket( pEntity, &nIndex );
-
-		if ( nOldBucket != nNewBucket )
-		{
-			// Remove the entity from the hashed list.
-			if ( nOldBucket != -1 )
-			{
-				m_EntityListByName[ nOldBucket ].FastRemove( nIndex );
-			}
-
-			// Add the entity back to the hashed list in the proper bucket.
-			if ( nNewBucket != -1 )
-			{
-				m_EntityListByName[ nNewBucket ].AddToTail( pEntity );
-			}
-		}
+		m_EntityIndex.UpdateEntity( pEntity );
 	}
 }
 
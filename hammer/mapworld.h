@@ -12,6 +12,7 @@
 
 #include "MapEntity.h"
 #include "EditGameClass.h"
+#include "EntityIndex.h"
 #include "MapClass.h"
 #include "MapDoc.h"
 #include "MapPath.h"
@@ -23,13 +24,13 @@
 
 #define MAX_VISIBLE_OBJECTS		10000
 
-#define NUM_HASHED_ENTITY_BUCKETS	200
-
 
 class BoundBox;
 class CChunkFile;
 class CVisGroup;
+class CCullTree;
 class CCullTreeNode;
+class CMapTraceTree;
 class IEditorTexture;
 class CMapGroup;
 
@@ -75,7 +76,13 @@ class CMapWorld : public CMapClass, public CEditGameClass
 		// Public interface to the culling tree.
 		//
 		void CullTree_Build(void);
-		inline CCullTreeNode *CullTree_GetCullTree(void) { return(m_pCullTree); }
+		CCullTreeNode *CullTree_GetCullTree(void);
+
+		//
+		// Public interface to the trace tree.
+		//
+		CMapTraceTree *TraceTree_Get(void);
+		void TraceTree_Free(void);
 
 		//
 		// CMapClass virtual overrides.
@@ -124,10 +131,13 @@ class CMapWorld : public CMapClass, public CEditGameClass
 		CUtlVector<CMapPath*> m_Paths;
 
 		// Interface to list of all the entities in the world:
-		const CMapEntityList *EntityList_GetList(void) { return(&m_EntityList); }
+		const CMapEntityList *EntityList_GetList(void) { return(m_EntityIndex.GetEntityList()); }
 		inline int EntityList_GetCount();
 		inline CMapEntity *EntityList_GetEntity( int nIndex );
 
+		// Counts kept by the index that looks entities up without scanning the entity list.
+		inline const EntityIndexStats_t &EntityIndex_GetStats( void ) { return(m_EntityIndex.GetStats()); }
+
 		CMapEntity *FindEntityByName( const char *pszName, bool bVisiblesOnly = false );
 		bool FindEntitiesByKeyValue(CMapEntityList &Found, const char *szKey, const char *szValue, bool bVisiblesOnly);
 		bool FindEntitiesByName(CMapEntityList &Found, const char *szName, bool bVisiblesOnly);
@@ -159,8 +169,6 @@ class CMapWorld : public CMapClass, public CEditGameClass
 		void EntityList_Add(CMapClass *pObject);
 		void EntityList_Remove(CMapClass *pObject, bool bRemoveChildren);
 
-		int FindEntityBucket( CMapEntity *pEntity, int *pnIndex );
-
 		//
 		// Serialization.
 		//
@@ -174,19 +182,18 @@ class CMapWorld : public CMapClass, public CEditGameClass
 
 		static BOOL BuildSaveListsCallback(CMapClass *pObject, SaveLists_t *pSaveLists);
 		ChunkFileResult_t SaveObjectListVMF(CChunkFile *pFile, CSaveInfo *pSaveInfo, const CMapObjectList *pList, int saveFlags);
+		void PresaveObjectList(CSaveInfo *pSaveInfo, const CMapObjectList *pList);
 
 		//
 		// Culling tree operations.
 		//
-		void CullTree_SplitNode(CCullTreeNode *pNode);
 		void CullTree_DumpNode(CCullTreeNode *pNode, int nDepth);
-		void CullTree_FreeNode(CCullTreeNode *pNode);
 		void CullTree_Free(void);
 
-		CCullTreeNode *m_pCullTree;		// This world's objects stored in a spatial hierarchy for culling.
+		CCullTree *m_pCullTree;			// This world's objects stored in a spatial hierarchy for culling.
+		CMapTraceTree *m_pTraceTree;	// This world's face triangles stored in a hierarchy for tracing, built on first use.
 
-		CMapEntityList m_EntityList;									// A flat list of all the entities in this world.
-		CMapEntityList m_EntityListByName[NUM_HASHED_ENTITY_BUCKETS];	// A list of all the entities in the world, hashed by name checksum.
+		CEntityIndex m_EntityIndex;		// A flat list of all the entities in this world, indexed by name, class name and other keys.
 
 		int m_nNextFaceID;						// Used for assigning unique IDs to every solid face in this world.
 
@@ -221,13 +228,13 @@ inline void CMapWorld::FaceID_SetNext(int nNextFaceID)
 
 inline int CMapWorld::EntityList_GetCount()
 {
-	return m_EntityList.Count();
+	return m_EntityIndex.GetEntityList()->Count();
 }
 
 
 inline CMapEntity *CMapWorld::EntityList_GetEntity( int nIndex )
 {
-	return m_EntityList.Element( nIndex );
+	return m_EntityIndex.GetEntityList()->Element( nIndex );
 }
 
 
@@ -33,3 +33,18 @@ bool CSaveInfo::ShouldSaveObject(CMapClass *pObject)
 	return(true);
 }
 
+
+//-----------------------------------------------------------------------------
+// Purpose: Returns true if an object from the world's save lists should be
+//			saved. Its children are saved along with it.
+// Input  : pObject - Solid, group or entity to check.
+//-----------------------------------------------------------------------------
+bool CSaveInfo::ShouldSaveListObject(CMapClass *pObject)
+{
+	if ((m_pObjectIDs != NULL) && (m_pObjectIDs->Find(pObject->GetID()) == m_pObjectIDs->InvalidIndex()))
+	{
+		return(false);
+	}
+
+	return(true);
+}
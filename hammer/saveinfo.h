@@ -12,6 +12,7 @@
 
 
 #include "ChunkFile.h"
+#include "tier1/utlrbtree.h"
 
 
 class CMapClass;
@@ -23,12 +24,16 @@ class CSaveInfo
 
 		inline CSaveInfo(void);
 		inline void SetVisiblesOnly(bool bVisiblesOnly);
+		inline void SetObjectIDs(const CUtlRBTree<int, int> *pObjectIDs);
+		inline bool HasObjectIDs(void) const;
 
 		bool ShouldSaveObject(CMapClass *pObject);
+		bool ShouldSaveListObject(CMapClass *pObject);
 
 	protected:
 
 		bool m_bVisiblesOnly;
+		const CUtlRBTree<int, int> *m_pObjectIDs;	// If set, the only objects in the world's save lists to save.
 };
 
 
@@ -38,6 +43,7 @@ class CSaveInfo
 CSaveInfo::CSaveInfo(void)
 {
 	m_bVisiblesOnly = false;
+	m_pObjectIDs = NULL;
 }
 
 
@@ -51,4 +57,21 @@ void CSaveInfo::SetVisiblesOnly(bool bVisiblesOnly)
 }
 
 
+//-----------------------------------------------------------------------------
+// Purpose: Limits the solids, groups and entities that the world saves to the
+//			ones with the given IDs. Used for autosave journal entries.
+// Input  : pObjectIDs - IDs to save, NULL to save everything.
+//-----------------------------------------------------------------------------
+void CSaveInfo::SetObjectIDs(const CUtlRBTree<int, int> *pObjectIDs)
+{
+	m_pObjectIDs = pObjectIDs;
+}
+
+
+bool CSaveInfo::HasObjectIDs(void) const
+{
+	return(m_pObjectIDs != NULL);
+}
+
+
 #endif // SAVEINFO_H
@@ -32,9 +32,12 @@ BOOL CheckFace(Vector *Points, int nPoints, Vector* pNormal, float dist, CCheckF
 	float	d, edgedist;
 	Vector	dir, edgenormal;
 
+	// Locals rather than statics, faces are checked from the solid load threads.
+	CCheckFaceInfo dummyinfo;
+	Vector	_normal;
+
 	if(!pInfo)
 	{
-		static CCheckFaceInfo dummyinfo;
 		pInfo = &dummyinfo;
 		pInfo->iPoint = -1;	// make sure it's reset to default
 	}
@@ -45,7 +48,6 @@ BOOL CheckFace(Vector *Points, int nPoints, Vector* pNormal, float dist, CCheckF
 	// do we need to create a normal?
 	if(!pNormal)
 	{
-		static Vector _normal;
 		pNormal = &_normal;
 
 		// calc a plane from the points
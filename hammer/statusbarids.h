@@ -17,7 +17,8 @@ enum
 	ID_INDICATOR_SIZE,
 	ID_INDICATOR_GRIDZOOM,
 	ID_INDICATOR_SNAP,
-	ID_INDICATOR_LIGHTPROGRESS
+	ID_INDICATOR_LIGHTPROGRESS,
+	ID_INDICATOR_UNDO
 };
 
 enum
@@ -28,7 +29,8 @@ enum
 	SBI_SIZE,
 	SBI_GRIDZOOM,
 	SBI_SNAP,
-	SBI_LIGHTPROGRESS
+	SBI_LIGHTPROGRESS,
+	SBI_UNDO
 };
 
 // mainfrm.cpp:
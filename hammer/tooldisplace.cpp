@@ -13,7 +13,9 @@
 #include "GlobalFunctions.h"
 #include "MapAtom.h"
 #include "MapSolid.h"
+#include "MapTraceTree.h"
 #include "MapView3D.h"
+#include "MapWorld.h"
 #include "History.h"
 #include "Camera.h"
 #include "MapDoc.h"
@@ -942,10 +944,70 @@ EditDispHandle_t CToolDisplace::GetHitPos( CMapView3D *pView, const Vector2D &vP
 	if( dispCount == 0 )
 		return NULL;
 
-	// collide against all "active" displacements and set texel hit data
+	// trace the "active" displacements and set texel hit data
+	EditDispHandle_t handle = TraceSelectedDisps( rayStart, rayEnd );
+	if( handle != EDITDISPHANDLE_INVALID )
+		return handle;
+
+	// the ray missed them all, take the vert nearest to it
 	return CollideWithSelectedDisps( rayStart, rayEnd );
 }
 
+
+//-----------------------------------------------------------------------------
+//-----------------------------------------------------------------------------
+static bool DispTool_TraceFilter( CMapFace *pFace, void *pParam )
+{
+	IWorldEditDispMgr *pDispMgr = ( IWorldEditDispMgr* )pParam;
+	return ( pFace->HasDisp() && pDispMgr->IsInSelect( pFace->GetDisp() ) );
+}
+
+
+//-----------------------------------------------------------------------------
+// Purpose: Traces the ray against the selected displacements through the
+//          world's trace tree, and sets the texel hit index on the one it
+//          hits to the vert of the hit triangle nearest the hit.
+//-----------------------------------------------------------------------------
+EditDispHandle_t CToolDisplace::TraceSelectedDisps( const Vector &rayStart, const Vector &rayEnd )
+{
+	IWorldEditDispMgr *pDispMgr = GetActiveWorldEditDispManager();
+	if( !pDispMgr )
+		return EDITDISPHANDLE_INVALID;
+
+	CMapDoc *pDoc = CMapDoc::GetActiveMapDoc();
+	CMapWorld *pWorld = pDoc ? pDoc->GetMapWorld() : NULL;
+	if( !pWorld )
+		return EDITDISPHANDLE_INVALID;
+
+	MapTraceHit_t hit;
+	if( !pWorld->TraceTree_Get()->TraceNearest( rayStart, rayEnd, hit, DispTool_TraceFilter, pDispMgr ) )
+		return EDITDISPHANDLE_INVALID;
+
+	EditDispHandle_t handle = hit.pFace->GetDisp();
+	CMapDisp *pDisp = EditDispMgr()->GetDisp( handle );
+
+	unsigned short triVerts[3];
+	pDisp->GetTriIndices( hit.nTri, triVerts[0], triVerts[1], triVerts[2] );
+
+	int minIndex = triVerts[0];
+	float minDist = FLT_MAX;
+	for( int i = 0; i < 3; i++ )
+	{
+		Vector point;
+		pDisp->GetVert( triVerts[i], point );
+		float dist = point.DistToSqr( hit.vecPos );
+		if( dist < minDist )
+		{
+			minDist = dist;
+			minIndex = triVerts[i];
+		}
+	}
+
+	pDisp->SetTexelHitIndex( minIndex );
+
+	return handle;
+}
+
 //-----------------------------------------------------------------------------
 //-----------------------------------------------------------------------------
 int CToolDisplace::GetSelectedDisps( void )
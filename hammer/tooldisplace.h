@@ -148,6 +148,7 @@ private:
 	static ChunkFileResult_t LoadFiltersCallback( CChunkFile *pFile, CToolDisplace *pDisplaceTool );
 
 	int GetSelectedDisps( void );
+	EditDispHandle_t TraceSelectedDisps( const Vector &rayStart, const Vector &rayEnd );
 	EditDispHandle_t CollideWithSelectedDisps( const Vector &rayStart, const Vector &rayEnd );
 	bool RayAABBTest( CMapDisp *pDisp, const Vector &rayStart, const Vector &rayEnd );
 	void BuildParallelepiped( const Vector &boxMin, const Vector &boxMax, PLANE planes[6] );
@@ -0,0 +1,1021 @@
+//========= Copyright Valve Corporation, All rights reserved. ============//
+//
+// Purpose: Compact undo records for solids and entities. A nudged solid keeps
+//			its translation and the few values that don't follow from it, a
+//			painted displacement keeps the vertices that were painted, and an
+//			edited entity keeps the keys that were edited.
+//
+//=============================================================================//
+
+#include "stdafx.h"
+#include "UndoDelta.h"
+#include "GlobalFunctions.h"
+#include "MapDisp.h"
+#include "MapEntity.h"
+#include "MapFace.h"
+#include "MapSolid.h"
+#include "VisGroup.h"
+
+// memdbgon must be the last include file in a .cpp file!!!
+#include <tier0/memdbgon.h>
+
+
+//
+// Which parts of a face a face delta holds.
+//
+#define FACEDELTA_POINTS			0x0001		// Points that didn't just move with the solid.
+#define FACEDELTA_PLANE				0x0002
+#define FACEDELTA_PLANEDIST			0x0004		// Plane moved with the solid, only the distance is kept.
+#define FACEDELTA_TEXTURE			0x0008
+#define FACEDELTA_TEXTURESHIFT		0x0010		// Only the U and V shifts changed.
+#define FACEDELTA_TEXTURECOORDS		0x0020
+#define FACEDELTA_LIGHTMAPCOORDS	0x0040
+#define FACEDELTA_TANGENTAXES		0x0080
+#define FACEDELTA_MISC				0x0100
+#define FACEDELTA_DISP				0x0200
+
+
+//-----------------------------------------------------------------------------
+// Purpose: Returns true if the object's state outside of what a delta keeps
+//			is the same as the kept copy's.
+//-----------------------------------------------------------------------------
+bool CUndoDelta::CompareMapClass(CMapClass *pCurrent, CMapClass *pKept)
+{
+	if ((pCurrent->m_bTemporary != pKept->m_bTemporary) ||
+		(pCurrent->m_bVisible2D != pKept->m_bVisible2D) ||
+		(pCurrent->r != pKept->r) || (pCurrent->g != pKept->g) || (pCurrent->b != pKept->b) ||
+		(pCurrent->GetParent() != pKept->GetParent()))
+	{
+		return false;
+	}
+
+	if (pCurrent->m_Dependents.Count() != pKept->m_Dependents.Count())
+	{
+		return false;
+	}
+
+	for (int i = 0; i < pCurrent->m_Dependents.Count(); i++)
+	{
+		if (pCurrent->m_Dependents.Element(i) != pKept->m_Dependents.Element(i))
+		{
+			return false;
+		}
+	}
+
+	//
+	// Copies don't get the auto visgroups, so only the user visgroups have to match.
+	//
+	int nCurrentCount = pCurrent->GetVisGroupCount();
+	int nKeptCount = pKept->GetVisGroupCount();
+	int nCurrent = 0;
+	int nKept = 0;
+	while (true)
+	{
+		while ((nCurrent < nCurrentCount) && (pCurrent->GetVisGroup(nCurrent)->IsAutoVisGroup()))
+		{
+			nCurrent++;
+		}
+
+		while ((nKept < nKeptCount) && (pKept->GetVisGroup(nKept)->IsAutoVisGroup()))
+		{
+			nKept++;
+		}
+
+		if ((nCurrent == nCurrentCount) || (nKept == nKeptCount))
+		{
+			break;
+		}
+
+		if (pCurrent->GetVisGroup(nCurrent) != pKept->GetVisGroup(nKept))
+		{
+			return false;
+		}
+
+		nCurrent++;
+		nKept++;
+	}
+
+	return((nCurrent == nCurrentCount) && (nKept == nKeptCount));
+}
+
+
+//-----------------------------------------------------------------------------
+// Purpose: Saves the base state that a change is expected to move.
+//-----------------------------------------------------------------------------
+void CUndoDelta::SaveMapClass(CMapClass *pKept, MapClassState_t &State)
+{
+	State.Origin = pKept->m_Origin;
+	State.CullBox = pKept->m_CullBox;
+	State.Render2DBox = pKept->m_Render2DBox;
+}
+
+
+//-----------------------------------------------------------------------------
+// Purpose:
+//-----------------------------------------------------------------------------
+void CUndoDelta::RestoreMapClass(CMapClass *pRebuilt, const MapClassState_t &State)
+{
+	pRebuilt->m_Origin = State.Origin;
+	pRebuilt->m_CullBox = State.CullBox;
+	pRebuilt->m_Render2DBox = State.Render2DBox;
+}
+
+
+//-----------------------------------------------------------------------------
+// Displacement paint changes a handful of vertices out of hundreds, so only
+// those are kept, along with the four surface corners.
+//-----------------------------------------------------------------------------
+struct DispVertDelta_t
+{
+	int nIndex;
+	Vector vecFieldVector;
+	Vector vecSubdivPosition;
+	Vector vecSubdivNormal;
+	Vector vecVert;
+	Vector vecFlatVert;
+	float flFieldDistance;
+	float flAlpha;
+};
+
+
+struct DispTriTagDelta_t
+{
+	int nTri;
+	unsigned short nTag;
+};
+
+
+struct DispDelta_t
+{
+	Vector Points[4];
+	Vector Normals[4];
+	Vector2D TexCoords[4];
+	Vector2D LuxelCoords[4];
+	int nFlags;
+	int nContents;
+	int nPointStartIndex;
+
+	int nVertCount;
+	CUtlVector<DispVertDelta_t> Verts;
+	CUtlVector<DispTriTagDelta_t> TriTags;
+};
+
+
+//-----------------------------------------------------------------------------
+// Purpose: Returns true if the displacement has the same layout as the kept
+//			copy, so that a delta can be made between them.
+//-----------------------------------------------------------------------------
+static bool CanDeltaDisp(CMapDisp *pCurrent, CMapDisp *pKept)
+{
+	if ((pCurrent->GetPower() != pKept->GetPower()) ||
+		(pCurrent->GetScale() != pKept->GetScale()) ||
+		(pCurrent->GetElevation() != pKept->GetElevation()) ||
+		(pCurrent->IsSubdivided() != pKept->IsSubdivided()) ||
+		(pCurrent->NeedsReSubdivision() != pKept->NeedsReSubdivision()))
+	{
+		return false;
+	}
+
+	CCoreDispInfo *pCurrentInfo = pCurrent->GetCoreDispInfo();
+	CCoreDispInfo *pKeptInfo = pKept->GetCoreDispInfo();
+	if ((pCurrentInfo->GetSurface()->GetPointCount() != 4) || (pKeptInfo->GetSurface()->GetPointCount() != 4))
+	{
+		return false;
+	}
+
+	int nRenderCount = pCurrentInfo->GetRenderIndexCount();
+	if (nRenderCount != pKeptInfo->GetRenderIndexCount())
+	{
+		return false;
+	}
+
+	for (int i = 0; i < nRenderCount; i++)
+	{
+		if (pCurrentInfo->GetRenderIndex(i) != pKeptInfo->GetRenderIndex(i))
+		{
+			return false;
+		}
+	}
+
+	int nTriCount = pCurrent->GetTriCount();
+	for (int iTri = 0; iTri < nTriCount; iTri++)
+	{
+		unsigned short nCurrent[3], nKept[3];
+		pCurrent->GetTriIndices(iTri, nCurrent[0], nCurrent[1], nCurrent[2]);
+		pKept->GetTriIndices(iTri, nKept[0], nKept[1], nKept[2]);
+		if ((nCurrent[0] != nKept[0]) || (nCurrent[1] != nKept[1]) || (nCurrent[2] != nKept[2]))
+		{
+			return false;
+		}
+	}
+
+	return true;
+}
+
+
+//-----------------------------------------------------------------------------
+// Purpose: Makes the delta from a displacement to its kept copy. Vertices that
+//			only moved with the solid aren't kept.
+// Output : Returns NULL if nothing changed.
+//-----------------------------------------------------------------------------
+static DispDelta_t *CreateDispDelta(CMapDisp *pCurrent, CMapDisp *pKept, const Vector &vecTranslation)
+{
+	DispDelta_t *pDelta = new DispDelta_t;
+	bool bChanged = false;
+
+	CCoreDispSurface *pCurrentSurf = pCurrent->GetCoreDispInfo()->GetSurface();
+	CCoreDispSurface *pKeptSurf = pKept->GetCoreDispInfo()->GetSurface();
+	for (int i = 0; i < 4; i++)
+	{
+		Vector vecCurrent;
+		Vector2D vecCurrent2D;
+
+		pKeptSurf->GetPoint(i, pDelta->Points[i]);
+		pCurrentSurf->GetPoint(i, vecCurrent);
+		bChanged |= (vecCurrent != pDelta->Points[i]);
+
+		pKeptSurf->GetPointNormal(i, pDelta->Normals[i]);
+		pCurrentSurf->GetPointNormal(i, vecCurrent);
+		bChanged |= (vecCurrent != pDelta->Normals[i]);
+
+		pKeptSurf->GetTexCoord(i, pDelta->TexCoords[i]);
+		pCurrentSurf->GetTexCoord(i, vecCurrent2D);
+		bChanged |= (vecCurrent2D != pDelta->TexCoords[i]);
+
+		pKeptSurf->GetLuxelCoord(0, i, pDelta->LuxelCoords[i]);
+		pCurrentSurf->GetLuxelCoord(0, i, vecCurrent2D);
+		bChanged |= (vecCurrent2D != pDelta->LuxelCoords[i]);
+	}
+
+	pDelta->nFlags = pKeptSurf->GetFlags();
+	pDelta->nContents = pKeptSurf->GetContents();
+	pDelta->nPointStartIndex = pKeptSurf->GetPointStartIndex();
+	bChanged |= (pDelta->nFlags != pCurrentSurf->GetFlags()) ||
+				(pDelta->nContents != pCurrentSurf->GetContents()) ||
+				(pDelta->nPointStartIndex != pCurrentSurf->GetPointStartIndex());
+
+	pDelta->nVertCount = pCurrent->GetSize();
+	for (int i = 0; i < pDelta->nVertCount; i++)
+	{
+		DispVertDelta_t Vert;
+		Vector vecCurrent;
+		bool bVertChanged = false;
+
+		pKept->GetFieldVector(i, Vert.vecFieldVector);
+		pCurrent->GetFieldVector(i, vecCurrent);
+		bVertChanged |= (vecCurrent != Vert.vecFieldVector);
+
+		pKept->GetSubdivPosition(i, Vert.vecSubdivPosition);
+		pCurrent->GetSubdivPosition(i, vecCurrent);
+		bVertChanged |= (vecCurrent != Vert.vecSubdivPosition);
+
+		pKept->GetSubdivNormal(i, Vert.vecSubdivNormal);
+		pCurrent->GetSubdivNormal(i, vecCurrent);
+		bVertChanged |= (vecCurrent != Vert.vecSubdivNormal);
+
+		pKept->GetVert(i, Vert.vecVert);
+		pCurrent->GetVert(i, vecCurrent);
+		bVertChanged |= (vecCurrent - vecTranslation != Vert.vecVert);
+
+		pKept->GetFlatVert(i, Vert.vecFlatVert);
+		pCurrent->GetFlatVert(i, vecCurrent);
+		bVertChanged |= (vecCurrent - vecTranslation != Vert.vecFlatVert);
+
+		Vert.flFieldDistance = pKept->GetFieldDistance(i);
+		bVertChanged |= (pCurrent->GetFieldDistance(i) != Vert.flFieldDistance);
+
+		Vert.flAlpha = pKept->GetAlpha(i);
+		bVertChanged |= (pCurrent->GetAlpha(i) != Vert.flAlpha);
+
+		if (bVertChanged)
+		{
+			Vert.nIndex = i;
+			pDelta->Verts.AddToTail(Vert);
+		}
+	}
+
+	CCoreDispInfo *pCurrentInfo = pCurrent->GetCoreDispInfo();
+	CCoreDispInfo *pKeptInfo = pKept->GetCoreDispInfo();
+	int nTriCount = pCurrent->GetTriCount();
+	for (int iTri = 0; iTri < nTriCount; iTri++)
+	{
+		unsigned short nTag = pKeptInfo->GetTriTagValue(iTri);
+		if (pCurrentInfo->GetTriTagValue(iTri) != nTag)
+		{
+			int nIndex = pDelta->TriTags.AddToTail();
+			pDelta->TriTags[nIndex].nTri = iTri;
+			pDelta->TriTags[nIndex].nTag = nTag;
+		}
+	}
+
+	if (!bChanged && !pDelta->Verts.Count() && !pDelta->TriTags.Count() && (vecTranslation == vec3_origin))
+	{
+		delete pDelta;
+		return NULL;
+	}
+
+	pDelta->Verts.Compact();
+	pDelta->TriTags.Compact();
+	return pDelta;
+}
+
+
+//-----------------------------------------------------------------------------
+// Purpose: Turns a copy of the current displacement back into the kept one.
+//-----------------------------------------------------------------------------
+static bool RebuildDisp(CMapDisp *pDisp, const DispDelta_t *pDelta, const Vector &vecTranslation)
+{
+	if (pDisp->GetSize() != pDelta->nVertCount)
+	{
+		return false;
+	}
+
+	CCoreDispSurface *pSurf = pDisp->GetCoreDispInfo()->GetSurface();
+	for (int i = 0; i < 4; i++)
+	{
+		pSurf->SetPoint(i, pDelta->Points[i]);
+		pSurf->SetPointNormal(i, pDelta->Normals[i]);
+		pSurf->SetTexCoord(i, pDelta->TexCoords[i]);
+		pSurf->SetLuxelCoord(0, i, pDelta->LuxelCoords[i]);
+	}
+
+	pSurf->SetFlags(pDelta->nFlags);
+	pSurf->SetContents(pDelta->nContents);
+	pSurf->SetPointStartIndex(pDelta->nPointStartIndex);
+
+	if (vecTranslation != vec3_origin)
+	{
+		int nVertCount = pDisp->GetSize();
+		for (int i = 0; i < nVertCount; i++)
+		{
+			Vector vecVert;
+			pDisp->GetVert(i, vecVert);
+			pDisp->SetVert(i, vecVert - vecTranslation);
+
+			pDisp->GetFlatVert(i, vecVert);
+			pDisp->SetFlatVert(i, vecVert - vecTranslation);
+		}
+	}
+
+	for (int i = 0; i < pDelta->Verts.Count(); i++)
+	{
+		const DispVertDelta_t &Vert = pDelta->Verts[i];
+		pDisp->SetFieldVector(Vert.nIndex, Vert.vecFieldVector);
+		pDisp->SetSubdivPosition(Vert.nIndex, Vert.vecSubdivPosition);
+		pDisp->SetSubdivNormal(Vert.nIndex, Vert.vecSubdivNormal);
+		pDisp->SetVert(Vert.nIndex, Vert.vecVert);
+		pDisp->SetFlatVert(Vert.nIndex, Vert.vecFlatVert);
+		pDisp->SetFieldDistance(Vert.nIndex, Vert.flFieldDistance);
+		pDisp->SetAlpha(Vert.nIndex, Vert.flAlpha);
+	}
+
+	CCoreDispInfo *pInfo = pDisp->GetCoreDispInfo();
+	for (int i = 0; i < pDelta->TriTags.Count(); i++)
+	{
+		pInfo->SetTriTagValue(pDelta->TriTags[i].nTri, pDelta->TriTags[i].nTag);
+	}
+
+	return true;
+}
+
+
+//-----------------------------------------------------------------------------
+// A solid keeps how far it moved, which is usually all that changed, and only
+// the parts of each face that don't follow from that.
+//-----------------------------------------------------------------------------
+class CSolidUndoDelta : public CUndoDelta
+{
+public:
+
+	CSolidUndoDelta();
+	virtual ~CSolidUndoDelta();
+
+	static CSolidUndoDelta *Create(CMapSolid *pCurrent, CMapSolid *pKept);
+
+	virtual CMapClass *Rebuild(CMapClass *pCurrent);
+	virtual size_t GetSize(void);
+
+private:
+
+	struct FaceMisc_t
+	{
+		int nFaceID;
+		SelectionState_t eSelectionState;
+		IEditorTexture *pTexture;
+		unsigned char r, g, b;
+		unsigned char uchAlpha;
+		bool bIsCordonFace;
+		bool bIgnoreLighting;
+		unsigned int fSmoothingGroups;
+	};
+
+	struct FaceDelta_t
+	{
+		int nFace;
+		int nPoints;
+		int nFields;						// FACEDELTA_xxx
+		Vector *pPoints;
+		PLANE *pPlane;
+		float flPlaneDist;
+		TEXTURE *pTexture;
+		float flUShift;
+		float flVShift;
+		Vector2D *pTextureCoords;
+		Vector2D *pLightmapCoords;
+		CMapFace::TangentSpaceAxes_t *pTangentAxes;
+		FaceMisc_t *pMisc;
+		DispDelta_t *pDisp;
+	};
+
+	bool AddFace(int nFace, CMapFace *pCurrent, CMapFace *pKept);
+	static void FreeFace(FaceDelta_t &Face);
+
+	MapClassState_t m_State;
+	Vector m_vecTranslation;				// How far the solid moved, kept points are current points minus this.
+	int m_nFaceCount;
+	CUtlVector<FaceDelta_t> m_Faces;		// Only the faces that changed.
+	size_t m_nSize;
+};
+
+
+//-----------------------------------------------------------------------------
+// Purpose: Constructor.
+//-----------------------------------------------------------------------------
+CSolidUndoDelta::CSolidUndoDelta()
+{
+	m_vecTranslation.Init();
+	m_nFaceCount = 0;
+	m_nSize = sizeof(*this);
+}
+
+
+//-----------------------------------------------------------------------------
+// Purpose: Destructor.
+//-----------------------------------------------------------------------------
+CSolidUndoDelta::~CSolidUndoDelta()
+{
+	for (int i = 0; i < m_Faces.Count(); i++)
+	{
+		FreeFace(m_Faces[i]);
+	}
+}
+
+
+//-----------------------------------------------------------------------------
+// Purpose:
+//-----------------------------------------------------------------------------
+void CSolidUndoDelta::FreeFace(FaceDelta_t &Face)
+{
+	delete [] Face.pPoints;
+	delete Face.pPlane;
+	delete Face.pTexture;
+	delete [] Face.pTextureCoords;
+	delete [] Face.pLightmapCoords;
+	delete [] Face.pTangentAxes;
+	delete Face.pMisc;
+	delete Face.pDisp;
+}
+
+
+//-----------------------------------------------------------------------------
+// Purpose: Makes the delta from a solid to its kept copy.
+// Output : Returns NULL if the faces were rebuilt, or changed in a way that
+//			a delta doesn't cover.
+//-----------------------------------------------------------------------------
+CSolidUndoDelta *CSolidUndoDelta::Create(CMapSolid *pCurrent, CMapSolid *pKept)
+{
+	int nFaceCount = pCurrent->GetFaceCount();
+	if ((nFaceCount != pKept->GetFaceCount()) ||
+		(pCurrent->GetHL1SolidType() != pKept->GetHL1SolidType()) ||
+		(pCurrent->IsCordonBrush() != pKept->IsCordonBrush()) ||
+		!CompareMapClass(pCurrent, pKept))
+	{
+		return NULL;
+	}
+
+	CSolidUndoDelta *pDelta = new CSolidUndoDelta;
+	SaveMapClass(pKept, pDelta->m_State);
+	pDelta->m_nFaceCount = nFaceCount;
+
+	if ((nFaceCount > 0) && (pCurrent->GetFace(0)->nPoints > 0) && (pKept->GetFace(0)->nPoints > 0))
+	{
+		pDelta->m_vecTranslation = pCurrent->GetFace(0)->Points[0] - pKept->GetFace(0)->Points[0];
+	}
+
+	for (int nFace = 0; nFace < nFaceCount; nFace++)
+	{
+		if (!pDelta->AddFace(nFace, pCurrent->GetFace(nFace), pKept->GetFace(nFace)))
+		{
+			delete pDelta;
+			return NULL;
+		}
+	}
+
+	pDelta->m_Faces.Compact();
+	pDelta->m_nSize += pDelta->m_Faces.Count() * sizeof(FaceDelta_t);
+	return pDelta;
+}
+
+
+//-----------------------------------------------------------------------------
+// Purpose: Adds a face to the delta if it changed.
+// Output : Returns false if the face changed in a way that a delta doesn't cover.
+//-----------------------------------------------------------------------------
+bool CSolidUndoDelta::AddFace(int nFace, CMapFace *pCurrent, CMapFace *pKept)
+{
+	int nPoints = pCurrent->nPoints;
+	if ((nPoints != pKept->nPoints) || (pCurrent->HasDisp() != pKept->HasDisp()))
+	{
+		return false;
+	}
+
+	if ((nPoints > 0) &&
+		((pCurrent->Points == NULL) || (pCurrent->m_pTextureCoords == NULL) || (pCurrent->m_pLightmapCoords == NULL) || (pCurrent->m_pTangentAxes == NULL) ||
+		 (pKept->Points == NULL) || (pKept->m_pTextureCoords == NULL) || (pKept->m_pLightmapCoords == NULL) || (pKept->m_pTangentAxes == NULL)))
+	{
+		return false;
+	}
+
+	FaceDelta_t Face;
+	memset(&Face, 0, sizeof(Face));
+	Face.nFace = nFace;
+	Face.nPoints = nPoints;
+
+	//
+	// Points, if they didn't just move with the solid.
+	//
+	for (int i = 0; i < nPoints; i++)
+	{
+		if (pCurrent->Points[i] - m_vecTranslation != pKept->Points[i])
+		{
+			Face.nFields |= FACEDELTA_POINTS;
+			Face.pPoints = new Vector[nPoints];
+			memcpy(Face.pPoints, pKept->Points, nPoints * sizeof(Vector));
+			m_nSize += nPoints * sizeof(Vector);
+			break;
+		}
+	}
+
+	//
+	// Plane. If it moved with the solid only the distance changed.
+	//
+	bool bPlaneMoved = (pCurrent->plane.normal == pKept->plane.normal);
+	for (int i = 0; (i < 3) && bPlaneMoved; i++)
+	{
+		bPlaneMoved = (pCurrent->plane.planepts[i] - m_vecTranslation == pKept->plane.planepts[i]);
+	}
+
+	if (!bPlaneMoved)
+	{
+		Face.nFields |= FACEDELTA_PLANE;
+		Face.pPlane = new PLANE;
+		*Face.pPlane = pKept->plane;
+		m_nSize += sizeof(PLANE);
+	}
+	else if (pCurrent->plane.dist != pKept->plane.dist)
+	{
+		Face.nFields |= FACEDELTA_PLANEDIST;
+		Face.flPlaneDist = pKept->plane.dist;
+	}
+
+	//
+	// Texture. Moving with texture lock on only changes the shifts.
+	//
+	TEXTURE Texture;
+	Texture = pKept->texture;
+	Texture.UAxis.w = pCurrent->texture.UAxis.w;
+	Texture.VAxis.w = pCurrent->texture.VAxis.w;
+	if (memcmp(&Texture, &pCurrent->texture, sizeof(TEXTURE)) != 0)
+	{
+		Face.nFields |= FACEDELTA_TEXTURE;
+		Face.pTexture = new TEXTURE;
+		*Face.pTexture = pKept->texture;
+		m_nSize += sizeof(TEXTURE);
+	}
+	else if ((pCurrent->texture.UAxis.w != pKept->texture.UAxis.w) || (pCurrent->texture.VAxis.w != pKept->texture.VAxis.w))
+	{
+		Face.nFields |= FACEDELTA_TEXTURESHIFT;
+		Face.flUShift = pKept->texture.UAxis.w;
+		Face.flVShift = pKept->texture.VAxis.w;
+	}
+
+	//
+	// Per point texture data.
+	//
+	if ((nPoints > 0) && (memcmp(pCurrent->m_pTextureCoords, pKept->m_pTextureCoords, nPoints * sizeof(Vector2D)) != 0))
+	{
+		Face.nFields |= FACEDELTA_TEXTURECOORDS;
+		Face.pTextureCoords = new Vector2D[nPoints];
+		memcpy(Face.pTextureCoords, pKept->m_pTextureCoords, nPoints * sizeof(Vector2D));
+		m_nSize += nPoints * sizeof(Vector2D);
+	}
+
+	if ((nPoints > 0) && (memcmp(pCurrent->m_pLightmapCoords, pKept->m_pLightmapCoords, nPoints * sizeof(Vector2D)) != 0))
+	{
+		Face.nFields |= FACEDELTA_LIGHTMAPCOORDS;
+		Face.pLightmapCoords = new Vector2D[nPoints];
+		memcpy(Face.pLightmapCoords, pKept->m_pLightmapCoords, nPoints * sizeof(Vector2D));
+		m_nSize += nPoints * sizeof(Vector2D);
+	}
+
+	if ((nPoints > 0) && (memcmp(pCurrent->m_pTangentAxes, pKept->m_pTangentAxes, nPoints * sizeof(CMapFace::TangentSpaceAxes_t)) != 0))
+	{
+		Face.nFields |= FACEDELTA_TANGENTAXES;
+		Face.pTangentAxes = new CMapFace::TangentSpaceAxes_t[nPoints];
+		memcpy(Face.pTangentAxes, pKept->m_pTangentAxes, nPoints * sizeof(CMapFace::TangentSpaceAxes_t));
+		m_nSize += nPoints * sizeof(CMapFace::TangentSpaceAxes_t);
+	}
+
+	//
+	// Everything else CMapFace::CopyFrom copies.
+	//
+	if ((pCurrent->m_nFaceID != pKept->m_nFaceID) ||
+		(pCurrent->m_eSelectionState != pKept->m_eSelectionState) ||
+		(pCurrent->m_pTexture != pKept->m_pTexture) ||
+		(pCurrent->r != pKept->r) || (pCurrent->g != pKept->g) || (pCurrent->b != pKept->b) ||
+		(pCurrent->m_uchAlpha != pKept->m_uchAlpha) ||
+		(pCurrent->m_bIsCordonFace != pKept->m_bIsCordonFace) ||
+		(pCurrent->m_bIgnoreLighting != pKept->m_bIgnoreLighting) ||
+		(pCurrent->m_fSmoothingGroups != pKept->m_fSmoothingGroups))
+	{
+		Face.nFields |= FACEDELTA_MISC;
+		Face.pMisc = new FaceMisc_t;
+		Face.pMisc->nFaceID = pKept->m_nFaceID;
+		Face.pMisc->eSelectionState = pKept->m_eSelectionState;
+		Face.pMisc->pTexture = pKept->m_pTexture;
+		Face.pMisc->r = pKept->r;
+		Face.pMisc->g = pKept->g;
+		Face.pMisc->b = pKept->b;
+		Face.pMisc->uchAlpha = pKept->m_uchAlpha;
+		Face.pMisc->bIsCordonFace = pKept->m_bIsCordonFace;
+		Face.pMisc->bIgnoreLighting = pKept->m_bIgnoreLighting;
+		Face.pMisc->fSmoothingGroups = pKept->m_fSmoothingGroups;
+		m_nSize += sizeof(FaceMisc_t);
+	}
+
+	//
+	// Displacement.
+	//
+	if (pCurrent->HasDisp())
+	{
+		CMapDisp *pCurrentDisp = EditDispMgr()->GetDisp(pCurrent->GetDisp());
+		CMapDisp *pKeptDisp = EditDispMgr()->GetDisp(pKept->GetDisp());
+		if (!CanDeltaDisp(pCurrentDisp, pKeptDisp))
+		{
+			FreeFace(Face);
+			return false;
+		}
+
+		Face.pDisp = CreateDispDelta(pCurrentDisp, pKeptDisp, m_vecTranslation);
+		if (Face.pDisp != NULL)
+		{
+			Face.nFields |= FACEDELTA_DISP;
+			m_nSize += sizeof(DispDelta_t) + Face.pDisp->Verts.Count() * sizeof(DispVertDelta_t) + Face.pDisp->TriTags.Count() * sizeof(DispTriTagDelta_t);
+		}
+	}
+
+	if (Face.nFields != 0)
+	{
+		m_Faces.AddToTail(Face);
+	}
+
+	return true;
+}
+
+
+//-----------------------------------------------------------------------------
+// Purpose: Rebuilds the kept copy of the solid from the current solid.
+//-----------------------------------------------------------------------------
+CMapClass *CSolidUndoDelta::Rebuild(CMapClass *pCurrent)
+{
+	Assert(pCurrent->IsMapClass(MAPCLASS_TYPE(CMapSolid)));
+	CMapSolid *pSolid = (CMapSolid *)pCurrent->Copy(false);
+	if (pSolid->GetFaceCount() != m_nFaceCount)
+	{
+		delete pSolid;
+		return NULL;
+	}
+
+	RestoreMapClass(pSolid, m_State);
+
+	//
+	// Move every face back first, then put back what didn't move with the solid.
+	//
+	bool bMoved = (m_vecTranslation != vec3_origin);
+	int nChanged = 0;
+	for (int nFace = 0; nFace < m_nFaceCount; nFace++)
+	{
+		CMapFace *pFace = pSolid->GetFace(nFace);
+		const FaceDelta_t *pDelta = NULL;
+		if ((nChanged < m_Faces.Count()) && (m_Faces[nChanged].nFace == nFace))
+		{
+			pDelta = &m_Faces[nChanged++];
+		}
+
+		if (bMoved)
+		{
+			for (int i = 0; i < pFace->nPoints; i++)
+			{
+				pFace->Points[i] -= m_vecTranslation;
+			}
+
+			for (int i = 0; i < 3; i++)
+			{
+				pFace->plane.planepts[i] -= m_vecTranslation;
+			}
+		}
+
+		if (pDelta == NULL)
+		{
+			if (pFace->HasDisp() && bMoved)
+			{
+				// Every displacement in a moved solid has a delta, since its surface moved.
+				delete pSolid;
+				return NULL;
+			}
+
+			continue;
+		}
+
+		if (pFace->nPoints != pDelta->nPoints)
+		{
+			delete pSolid;
+			return NULL;
+		}
+
+		int nFields = pDelta->nFields;
+		if (nFields & FACEDELTA_POINTS)
+		{
+			memcpy(pFace->Points, pDelta->pPoints, pFace->nPoints * sizeof(Vector));
+		}
+
+		if (nFields & FACEDELTA_PLANE)
+		{
+			pFace->plane = *pDelta->pPlane;
+		}
+		else if (nFields & FACEDELTA_PLANEDIST)
+		{
+			pFace->plane.dist = pDelta->flPlaneDist;
+		}
+
+		if (nFields & FACEDELTA_TEXTURE)
+		{
+			pFace->texture = *pDelta->pTexture;
+		}
+		else if (nFields & FACEDELTA_TEXTURESHIFT)
+		{
+			pFace->texture.UAxis.w = pDelta->flUShift;
+			pFace->texture.VAxis.w = pDelta->flVShift;
+		}
+
+		if (nFields & FACEDELTA_TEXTURECOORDS)
+		{
+			memcpy(pFace->m_pTextureCoords, pDelta->pTextureCoords, pFace->nPoints * sizeof(Vector2D));
+		}
+
+		if (nFields & FACEDELTA_LIGHTMAPCOORDS)
+		{
+			memcpy(pFace->m_pLightmapCoords, pDelta->pLightmapCoords, pFace->nPoints * sizeof(Vector2D));
+		}
+
+		if (nFields & FACEDELTA_TANGENTAXES)
+		{
+			memcpy(pFace->m_pTangentAxes, pDelta->pTangentAxes, pFace->nPoints * sizeof(CMapFace::TangentSpaceAxes_t));
+		}
+
+		if (nFields & FACEDELTA_MISC)
+		{
+			pFace->m_nFaceID = pDelta->pMisc->nFaceID;
+			pFace->m_eSelectionState = pDelta->pMisc->eSelectionState;
+			pFace->m_pTexture = pDelta->pMisc->pTexture;
+			pFace->r = pDelta->pMisc->r;
+			pFace->g = pDelta->pMisc->g;
+			pFace->b = pDelta->pMisc->b;
+			pFace->m_uchAlpha = pDelta->pMisc->uchAlpha;
+			pFace->m_bIsCordonFace = pDelta->pMisc->bIsCordonFace;
+			pFace->m_bIgnoreLighting = pDelta->pMisc->bIgnoreLighting;
+			pFace->m_fSmoothingGroups = pDelta->pMisc->fSmoothingGroups;
+		}
+
+		if (nFields & FACEDELTA_DISP)
+		{
+			if (!pFace->HasDisp() || !RebuildDisp(EditDispMgr()->GetDisp(pFace->GetDisp()), pDelta->pDisp, m_vecTranslation))
+			{
+				delete pSolid;
+				return NULL;
+			}
+		}
+	}
+
+	return pSolid;
+}
+
+
+//-----------------------------------------------------------------------------
+// Purpose:
+//-----------------------------------------------------------------------------
+size_t CSolidUndoDelta::GetSize(void)
+{
+	return m_nSize;
+}
+
+
+//-----------------------------------------------------------------------------
+// An entity keeps the keys that changed. Moving it changes its origin key,
+// which is kept like any other.
+//-----------------------------------------------------------------------------
+class CEntityUndoDelta : public CUndoDelta
+{
+public:
+
+	virtual ~CEntityUndoDelta();
+
+	static CEntityUndoDelta *Create(CMapEntity *pCurrent, CMapEntity *pKept);
+
+	virtual CMapClass *Rebuild(CMapClass *pCurrent);
+	virtual size_t GetSize(void);
+
+private:
+
+	struct KeyDelta_t
+	{
+		int nKey;				// Position of the key in the entity's keys.
+		char *pszValue;			// The kept value.
+	};
+
+	static bool CompareConnections(CMapEntity *pCurrent, CMapEntity *pKept);
+
+	MapClassState_t m_State;
+	Vector2D m_vecLogicalPosition;
+	CUtlVector<KeyDelta_t> m_Keys;
+	size_t m_nSize;
+};
+
+
+//-----------------------------------------------------------------------------
+// Purpose: Destructor.
+//-----------------------------------------------------------------------------
+CEntityUndoDelta::~CEntityUndoDelta()
+{
+	for (int i = 0; i < m_Keys.Count(); i++)
+	{
+		delete [] m_Keys[i].pszValue;
+	}
+}
+
+
+//-----------------------------------------------------------------------------
+// Purpose: Returns true if the entity has the same connections as the kept copy.
+//-----------------------------------------------------------------------------
+bool CEntityUndoDelta::CompareConnections(CMapEntity *pCurrent, CMapEntity *pKept)
+{
+	int nCount = pCurrent->Connections_GetCount();
+	if (nCount != pKept->Connections_GetCount())
+	{
+		return false;
+	}
+
+	for (int i = 0; i < nCount; i++)
+	{
+		CEntityConnection *pCurrentConn = pCurrent->Connections_Get(i);
+		CEntityConnection *pKeptConn = pKept->Connections_Get(i);
+		if ((strcmp(pCurrentConn->GetSourceName(), pKeptConn->GetSourceName()) != 0) ||
+			(strcmp(pCurrentConn->GetOutputName(), pKeptConn->GetOutputName()) != 0) ||
+			(strcmp(pCurrentConn->GetTargetName(), pKeptConn->GetTargetName()) != 0) ||
+			(strcmp(pCurrentConn->GetInputName(), pKeptConn->GetInputName()) != 0) ||
+			(strcmp(pCurrentConn->GetParam(), pKeptConn->GetParam()) != 0) ||
+			(pCurrentConn->GetDelay() != pKeptConn->GetDelay()) ||
+			(pCurrentConn->GetTimesToFire() != pKeptConn->GetTimesToFire()))
+		{
+			return false;
+		}
+	}
+
+	return true;
+}
+
+
+//-----------------------------------------------------------------------------
+// Purpose: Makes the delta from an entity to its kept copy.
+// Output : Returns NULL if the class, the set of keys, the connections or the
+//			comments changed.
+//-----------------------------------------------------------------------------
+CEntityUndoDelta *CEntityUndoDelta::Create(CMapEntity *pCurrent, CMapEntity *pKept)
+{
+	if ((pCurrent->flags != pKept->flags) ||
+		(pCurrent->GetClass() != pKept->GetClass()) ||
+		(strcmp(pCurrent->GetClassName(), pKept->GetClassName()) != 0) ||
+		(strcmp(pCurrent->GetComments(), pKept->GetComments()) != 0) ||
+		!CompareMapClass(pCurrent, pKept) ||
+		!CompareConnections(pCurrent, pKept))
+	{
+		return NULL;
+	}
+
+	CEntityUndoDelta *pDelta = new CEntityUndoDelta;
+	SaveMapClass(pKept, pDelta->m_State);
+	pDelta->m_vecLogicalPosition = pKept->m_vecLogicalPosition;
+	pDelta->m_nSize = sizeof(*pDelta);
+
+	int nCurrent = pCurrent->GetFirstKeyValue();
+	int nKept = pKept->GetFirstKeyValue();
+	int nKey = 0;
+	while ((nCurrent != pCurrent->GetInvalidKeyValue()) && (nKept != pKept->GetInvalidKeyValue()))
+	{
+		if (stricmp(pCurrent->GetKey(nCurrent), pKept->GetKey(nKept)) != 0)
+		{
+			delete pDelta;
+			return NULL;
+		}
+
+		const char *pszValue = pKept->GetKeyValue(nKept);
+		if (strcmp(pCurrent->GetKeyValue(nCurrent), pszValue) != 0)
+		{
+			int nLen = strlen(pszValue) + 1;
+			int nIndex = pDelta->m_Keys.AddToTail();
+			pDelta->m_Keys[nIndex].nKey = nKey;
+			pDelta->m_Keys[nIndex].pszValue = new char[nLen];
+			memcpy(pDelta->m_Keys[nIndex].pszValue, pszValue, nLen);
+			pDelta->m_nSize += sizeof(KeyDelta_t) + nLen;
+		}
+
+		nCurrent = pCurrent->GetNextKeyValue(nCurrent);
+		nKept = pKept->GetNextKeyValue(nKept);
+		nKey++;
+	}
+
+	if ((nCurrent != pCurrent->GetInvalidKeyValue()) || (nKept != pKept->GetInvalidKeyValue()))
+	{
+		delete pDelta;
+		return NULL;
+	}
+
+	pDelta->m_Keys.Compact();
+	return pDelta;
+}
+
+
+//-----------------------------------------------------------------------------
+// Purpose: Rebuilds the kept copy of the entity from the current entity.
+//-----------------------------------------------------------------------------
+CMapClass *CEntityUndoDelta::Rebuild(CMapClass *pCurrent)
+{
+	Assert(pCurrent->IsMapClass(MAPCLASS_TYPE(CMapEntity)));
+	CMapEntity *pEntity = (CMapEntity *)pCurrent->Copy(false);
+
+	RestoreMapClass(pEntity, m_State);
+	pEntity->m_vecLogicalPosition = m_vecLogicalPosition;
+
+	int nChanged = 0;
+	int nKey = 0;
+	for (int i = pEntity->GetFirstKeyValue(); (i != pEntity->GetInvalidKeyValue()) && (nChanged < m_Keys.Count()); i = pEntity->GetNextKeyValue(i))
+	{
+		if (m_Keys[nChanged].nKey == nKey)
+		{
+			// Straight into the keys, the copy isn't in the world and the
+			// entity's own SetKeyValue would act on the change.
+			pEntity->CEditGameClass::SetKeyValue(pEntity->GetKey(i), m_Keys[nChanged].pszValue);
+			nChanged++;
+		}
+
+		nKey++;
+	}
+
+	if (nChanged != m_Keys.Count())
+	{
+		delete pEntity;
+		return NULL;
+	}
+
+	return pEntity;
+}
+
+
+//-----------------------------------------------------------------------------
+// Purpose:
+//-----------------------------------------------------------------------------
+size_t CEntityUndoDelta::GetSize(void)
+{
+	return m_nSize;
+}
+
+
+//-----------------------------------------------------------------------------
+// Purpose: Makes a delta from the object to the copy of it that was kept
+//			before it changed.
+// Output : Returns NULL if the full copy should be kept instead.
+//-----------------------------------------------------------------------------
+CUndoDelta *CreateUndoDelta(CMapClass *pCurrent, CMapClass *pKept)
+{
+	if (pCurrent->IsMapClass(MAPCLASS_TYPE(CMapSolid)) && pKept->IsMapClass(MAPCLASS_TYPE(CMapSolid)))
+	{
+		return CSolidUndoDelta::Create((CMapSolid *)pCurrent, (CMapSolid *)pKept);
+	}
+
+	if (pCurrent->IsMapClass(MAPCLASS_TYPE(CMapEntity)) && pKept->IsMapClass(MAPCLASS_TYPE(CMapEntity)))
+	{
+		return CEntityUndoDelta::Create((CMapEntity *)pCurrent, (CMapEntity *)pKept);
+	}
+
+	return NULL;
+}
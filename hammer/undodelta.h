@@ -0,0 +1,68 @@
+//========= Copyright Valve Corporation, All rights reserved. ============//
+//
+// Purpose: Compact records of how an object changed during one undo step,
+//			kept by the Undo system instead of a full copy of the object.
+//
+//=============================================================================//
+
+#ifndef UNDODELTA_H
+#define UNDODELTA_H
+#ifdef _WIN32
+#pragma once
+#endif
+
+#include "BoundBox.h"
+
+
+class CMapClass;
+
+
+//-----------------------------------------------------------------------------
+// A delta is made when an undo step is closed, from the object as it is now
+// and the full copy that was kept before the step changed it. It only holds
+// what the step changed, and can rebuild the kept copy from the object as long
+// as the object is back in the state it was in when the delta was made. Undo
+// steps are undone last to first, so that is always the case when a step is
+// undone.
+//-----------------------------------------------------------------------------
+class CUndoDelta
+{
+public:
+
+	virtual ~CUndoDelta() {}
+
+	// Returns a new copy of the object as it was before the change, for the
+	// caller to copy back into the world and delete. Returns NULL if the object
+	// no longer matches the delta.
+	virtual CMapClass *Rebuild(CMapClass *pCurrent) = 0;
+
+	// Returns the approximate size of the delta in bytes.
+	virtual size_t GetSize(void) = 0;
+
+protected:
+
+	//
+	// Base CMapClass state, which CUndoDelta is friends with.
+	//
+	struct MapClassState_t
+	{
+		Vector Origin;
+		BoundBox CullBox;
+		BoundBox Render2DBox;
+	};
+
+	static bool CompareMapClass(CMapClass *pCurrent, CMapClass *pKept);
+	static void SaveMapClass(CMapClass *pKept, MapClassState_t &State);
+	static void RestoreMapClass(CMapClass *pRebuilt, const MapClassState_t &State);
+};
+
+
+//
+// Returns a delta that rebuilds pKept from pCurrent, or NULL if the object
+// type isn't handled or the change is too big for a delta, in which case the
+// full copy should be kept.
+//
+CUndoDelta *CreateUndoDelta(CMapClass *pCurrent, CMapClass *pKept);
+
+
+#endif // UNDODELTA_H
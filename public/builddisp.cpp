@@ -1690,6 +1690,17 @@ void CCoreDispInfo::CalcDispSurfAlphas( void )
 //-----------------------------------------------------------------------------
 //-----------------------------------------------------------------------------
 void CCoreDispInfo::GenerateDispSurfTangentSpaces( void )
+{
+	int postSpacing = GetPostSpacing();
+	GenerateDispSurfTangentSpaces( 0, 0, postSpacing - 1, postSpacing - 1 );
+}
+
+
+//-----------------------------------------------------------------------------
+// Purpose: Calculates the tangent spaces of the verts in the given rectangle
+//          (inclusive) from their normals.
+//-----------------------------------------------------------------------------
+void CCoreDispInfo::GenerateDispSurfTangentSpaces( int nMinU, int nMinV, int nMaxU, int nMaxV )
 {
 	//
 	// get texture axes from base surface
@@ -1702,26 +1713,31 @@ void CCoreDispInfo::GenerateDispSurfTangentSpaces( void )
 	//
 	// calculate the tangent spaces
 	//
-	int size = GetSize();
-	for( int i = 0; i < size; i++ )
+	int postSpacing = GetPostSpacing();
+	for( int iV = nMinV; iV <= nMaxV; iV++ )
 	{
-		//
-		// create the axes - normals, tangents, and binormals
-		//
-		VectorCopy( tAxis, m_pVerts[i].m_TangentT );
-		VectorNormalize( m_pVerts[i].m_TangentT );
-		CrossProduct( m_pVerts[i].m_Normal, m_pVerts[i].m_TangentT, m_pVerts[i].m_TangentS );
-		VectorNormalize( m_pVerts[i].m_TangentS );
-		CrossProduct( m_pVerts[i].m_TangentS, m_pVerts[i].m_Normal, m_pVerts[i].m_TangentT );
-		VectorNormalize( m_pVerts[i].m_TangentT );
-
-		Vector tmpVect;
-		Vector planeNormal;
-		pSurf->GetNormal( planeNormal );
-		CrossProduct( sAxis, tAxis, tmpVect );
-		if( DotProduct( planeNormal, tmpVect ) > 0.0f )
-		{
-			VectorScale( m_pVerts[i].m_TangentS, -1.0f, m_pVerts[i].m_TangentS );
+		for( int iU = nMinU; iU <= nMaxU; iU++ )
+		{
+			int i = iV * postSpacing + iU;
+
+			//
+			// create the axes - normals, tangents, and binormals
+			//
+			VectorCopy( tAxis, m_pVerts[i].m_TangentT );
+			VectorNormalize( m_pVerts[i].m_TangentT );
+			CrossProduct( m_pVerts[i].m_Normal, m_pVerts[i].m_TangentT, m_pVerts[i].m_TangentS );
+			VectorNormalize( m_pVerts[i].m_TangentS );
+			CrossProduct( m_pVerts[i].m_TangentS, m_pVerts[i].m_Normal, m_pVerts[i].m_TangentT );
+			VectorNormalize( m_pVerts[i].m_TangentT );
+
+			Vector tmpVect;
+			Vector planeNormal;
+			pSurf->GetNormal( planeNormal );
+			CrossProduct( sAxis, tAxis, tmpVect );
+			if( DotProduct( planeNormal, tmpVect ) > 0.0f )
+			{
+				VectorScale( m_pVerts[i].m_TangentS, -1.0f, m_pVerts[i].m_TangentS );
+			}
 		}
 	}
 }
@@ -1884,6 +1900,17 @@ bool CCoreDispInfo::DoesEdgeExist( int indexRow, int indexCol, int direction, in
 //-----------------------------------------------------------------------------
 //-----------------------------------------------------------------------------
 void CCoreDispInfo::GenerateDispSurfNormals( void )
+{
+	int postSpacing = GetPostSpacing();
+	GenerateDispSurfNormals( 0, 0, postSpacing - 1, postSpacing - 1 );
+}
+
+
+//-----------------------------------------------------------------------------
+// Purpose: Generates the normals of the verts in the given rectangle (inclusive)
+//          from the positions of the verts around them.
+//-----------------------------------------------------------------------------
+void CCoreDispInfo::GenerateDispSurfNormals( int nMinU, int nMinV, int nMaxU, int nMaxV )
 {
 	// get the post spacing (size/interval of displacement surface)
 	int postSpacing = GetPostSpacing();
@@ -1891,9 +1918,9 @@ void CCoreDispInfo::GenerateDispSurfNormals( void )
 	//
 	// generate the normals at each displacement surface vertex
 	//
-	for( int i = 0; i < postSpacing; i++ )
+	for( int i = nMinV; i <= nMaxV; i++ )
 	{
-		for( int j = 0; j < postSpacing; j++ )
+		for( int j = nMinU; j <= nMaxU; j++ )
 		{
 			bool bIsEdge[4];
 
@@ -1916,6 +1943,17 @@ void CCoreDispInfo::GenerateDispSurfNormals( void )
 //-----------------------------------------------------------------------------
 //-----------------------------------------------------------------------------
 void CCoreDispInfo::GenerateDispSurf( void )
+{
+	int postSpacing = GetPostSpacing();
+	GenerateDispSurf( 0, 0, postSpacing - 1, postSpacing - 1 );
+}
+
+
+//-----------------------------------------------------------------------------
+// Purpose: Calculates the flat and displaced positions of the verts in the
+//          given rectangle (inclusive).
+//-----------------------------------------------------------------------------
+void CCoreDispInfo::GenerateDispSurf( int nMinU, int nMinV, int nMaxU, int nMaxV )
 {
 	int i;
 	CCoreDispSurface *pSurf = GetSurface();
@@ -1951,7 +1989,7 @@ void CCoreDispInfo::GenerateDispSurf( void )
 	//
 	// calculate the displaced vertices
 	//
-	for( i = 0; i < postSpacing; i++ )
+	for( i = nMinV; i <= nMaxV; i++ )
 	{
 		//
 		// calculate segment interval between opposite edges
@@ -1969,7 +2007,7 @@ void CCoreDispInfo::GenerateDispSurf( void )
 		//
 		// calculate the surface vertices
 		//
-		for( int j = 0; j < postSpacing; j++ )
+		for( int j = nMinU; j <= nMaxU; j++ )
 		{	
 			int ndx = i * postSpacing + j;
 
@@ -2060,6 +2098,44 @@ bool CCoreDispInfo::CreateWithoutLOD( void )
 }
 
 
+//-----------------------------------------------------------------------------
+// Purpose: Rebuilds the surface after only the field data of the verts in the
+//          given rectangle (inclusive, in vert columns and rows) changed.
+//          Normals and tangent spaces are rebuilt one vert further out, since
+//          a vert's normal depends on the positions around it. The texture and
+//          lightmap coordinates and the triangles don't depend on the vert
+//          positions, so they are left as they are.
+//-----------------------------------------------------------------------------
+bool CCoreDispInfo::UpdateRegionWithoutLOD( int nMinU, int nMinV, int nMaxU, int nMaxV )
+{
+	// sanity check
+	CCoreDispSurface *pSurf = GetSurface();
+	if( pSurf->GetPointCount() != 4 )
+		return false;
+
+	int postSpacing = GetPostSpacing();
+	if( nMinU < 0 ) { nMinU = 0; }
+	if( nMinV < 0 ) { nMinV = 0; }
+	if( nMaxU > ( postSpacing - 1 ) ) { nMaxU = postSpacing - 1; }
+	if( nMaxV > ( postSpacing - 1 ) ) { nMaxV = postSpacing - 1; }
+	if( ( nMinU > nMaxU ) || ( nMinV > nMaxV ) )
+		return true;
+
+	GenerateDispSurf( nMinU, nMinV, nMaxU, nMaxV );
+
+	if( nMinU > 0 ) { nMinU--; }
+	if( nMinV > 0 ) { nMinV--; }
+	if( nMaxU < ( postSpacing - 1 ) ) { nMaxU++; }
+	if( nMaxV < ( postSpacing - 1 ) ) { nMaxV++; }
+
+	GenerateDispSurfNormals( nMinU, nMinV, nMaxU, nMaxV );
+
+	GenerateDispSurfTangentSpaces( nMinU, nMinV, nMaxU, nMaxV );
+
+	return true;
+}
+
+
 
 //-----------------------------------------------------------------------------
 // Purpose: This function calculates the neighbor node index given the base
@@ -781,6 +781,7 @@ public:
 //	bool Create( int creationFlags );
 	bool Create( void );
 	bool CreateWithoutLOD( void );
+	bool UpdateRegionWithoutLOD( int nMinU, int nMinV, int nMaxU, int nMaxV );
 
 	//=========================================================================
 	//
@@ -954,8 +955,11 @@ private:
 	//
 
 	void GenerateDispSurf( void );
+	void GenerateDispSurf( int nMinU, int nMinV, int nMaxU, int nMaxV );
 	void GenerateDispSurfNormals( void );
+	void GenerateDispSurfNormals( int nMinU, int nMinV, int nMaxU, int nMaxV );
 	void GenerateDispSurfTangentSpaces( void );
+	void GenerateDispSurfTangentSpaces( int nMinU, int nMinV, int nMaxU, int nMaxV );
 	bool DoesEdgeExist( int indexRow, int indexCol, int direction, int postSpacing );
 	void CalcNormalFromEdges( int indexRow, int indexCol, bool bIsEdge[4], Vector& normal );
 	void CalcDispSurfAlphas( void );
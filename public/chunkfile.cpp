@@ -34,8 +34,14 @@
 
 #include <fcntl.h>
 #ifdef _WIN32
+#include <windows.h>
 #include <io.h>
+#else
+#include <sys/mman.h>
+#include <unistd.h>
 #endif
+#include <ctype.h>
+#include <limits.h>
 #include <math.h>
 #include <sys/stat.h>
 #include <stdlib.h>
@@ -155,16 +161,475 @@ ChunkHandler_t CChunkHandlerMap::GetHandler(const char *pszChunkName, void **ppD
 }
 
 
+//-----------------------------------------------------------------------------
+// Purpose: Constructor.
+//-----------------------------------------------------------------------------
+CMappedTokenReader::CMappedTokenReader(void)
+{
+	m_pView = NULL;
+	m_nViewSize = 0;
+	m_pCur = NULL;
+	m_pEnd = NULL;
+	m_bOpen = false;
+	m_nLine = 1;
+	m_szFileName[0] = '\0';
+	m_nNextCopy = 0;
+#ifdef _WIN32
+	m_hFile = INVALID_HANDLE_VALUE;
+	m_hMapping = NULL;
+#endif
+}
+
+
+//-----------------------------------------------------------------------------
+// Purpose: Destructor. Unmaps the file if it is currently open.
+//-----------------------------------------------------------------------------
+CMappedTokenReader::~CMappedTokenReader(void)
+{
+	Close();
+}
+
+
+//-----------------------------------------------------------------------------
+// Purpose: Maps the file for reading.
+// Input  : pszFileName - Path of file to open.
+// Output : Returns true on success, false on failure.
+//-----------------------------------------------------------------------------
+bool CMappedTokenReader::Open(const char *pszFileName)
+{
+	Close();
+
+	Q_strncpy(m_szFileName, pszFileName, sizeof( m_szFileName ) );
+	m_nLine = 1;
+
+#ifdef _WIN32
+	m_hFile = ::CreateFile(pszFileName, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+	if (m_hFile == INVALID_HANDLE_VALUE)
+	{
+		return(false);
+	}
+
+	DWORD dwSizeHigh = 0;
+	DWORD dwSize = ::GetFileSize(m_hFile, &dwSizeHigh);
+	if ((dwSizeHigh != 0) || (dwSize > INT_MAX))
+	{
+		Close();
+		return(false);
+	}
+
+	m_nViewSize = (int)dwSize;
+
+	//
+	// An empty file can't be mapped, but it is still a valid chunk file. The view is
+	// copy-on-write so that terminating tokens in place never touches the file itself.
+	//
+	if (m_nViewSize > 0)
+	{
+		m_hMapping = ::CreateFileMapping((HANDLE)m_hFile, NULL, PAGE_WRITECOPY, 0, 0, NULL);
+		if (m_hMapping != NULL)
+		{
+			m_pView = (char *)::MapViewOfFile((HANDLE)m_hMapping, FILE_MAP_COPY, 0, 0, 0);
+		}
+
+		if (m_pView == NULL)
+		{
+			Close();
+			return(false);
+		}
+	}
+#else
+	int hFile = ::open(pszFileName, O_RDONLY);
+	if (hFile == -1)
+	{
+		return(false);
+	}
+
+	struct stat FileStat;
+	if ((fstat(hFile, &FileStat) != 0) || (FileStat.st_size > INT_MAX))
+	{
+		::close(hFile);
+		return(false);
+	}
+
+	m_nViewSize = (int)FileStat.st_size;
+	if (m_nViewSize > 0)
+	{
+		void *pView = mmap(NULL, m_nViewSize, PROT_READ | PROT_WRITE, MAP_PRIVATE, hFile, 0);
+		m_pView = (pView != MAP_FAILED) ? (char *)pView : NULL;
+	}
+
+	// The mapping holds its own reference to the file.
+	::close(hFile);
+
+	if ((m_nViewSize > 0) && (m_pView == NULL))
+	{
+		m_nViewSize = 0;
+		return(false);
+	}
+#endif
+
+	m_pCur = m_pView;
+	m_pEnd = m_pView + m_nViewSize;
+	m_nNextCopy = 0;
+	m_bOpen = true;
+
+	return(true);
+}
+
+
+//-----------------------------------------------------------------------------
+// Purpose: Unmaps the file. Any tokens handed out are no longer valid.
+//-----------------------------------------------------------------------------
+void CMappedTokenReader::Close(void)
+{
+#ifdef _WIN32
+	if (m_pView != NULL)
+	{
+		::UnmapViewOfFile(m_pView);
+	}
+
+	if (m_hMapping != NULL)
+	{
+		::CloseHandle((HANDLE)m_hMapping);
+		m_hMapping = NULL;
+	}
+
+	if (m_hFile != INVALID_HANDLE_VALUE)
+	{
+		::CloseHandle((HANDLE)m_hFile);
+		m_hFile = INVALID_HANDLE_VALUE;
+	}
+#else
+	if (m_pView != NULL)
+	{
+		munmap(m_pView, m_nViewSize);
+	}
+#endif
+
+	m_pView = NULL;
+	m_nViewSize = 0;
+	m_pCur = NULL;
+	m_pEnd = NULL;
+	m_bOpen = false;
+}
+
+
+//-----------------------------------------------------------------------------
+// Purpose: Prefixes an error message with the file name and current line.
+//-----------------------------------------------------------------------------
+const char *CMappedTokenReader::Error(const char *pszError)
+{
+	static char szErrorBuf[256];
+	Q_snprintf(szErrorBuf, sizeof( szErrorBuf ), "File %s, line %d: %s", m_szFileName, m_nLine, pszError);
+	return(szErrorBuf);
+}
+
+
+//-----------------------------------------------------------------------------
+// Purpose: Copies a token that can't be terminated in place.
+//-----------------------------------------------------------------------------
+const char *CMappedTokenReader::CopyToken(const char *pchStart, int nLen)
+{
+	char *pszCopy = m_szCopy[m_nNextCopy];
+	m_nNextCopy ^= 1;
+
+	nLen = min(nLen, MAX_KEYVALUE_LEN - 1);
+	memcpy(pszCopy, pchStart, nLen);
+	pszCopy[nLen] = '\0';
+
+	return(pszCopy);
+}
+
+
+//-----------------------------------------------------------------------------
+// Purpose: Skips whitespace and comments, counting lines as it goes.
+// Output : Returns true if the whitespace contained the combine strings
+//			character '+', which is used to merge consecutive quoted strings.
+//-----------------------------------------------------------------------------
+bool CMappedTokenReader::SkipWhiteSpace(void)
+{
+	bool bCombineStrings = false;
+
+	while (m_pCur < m_pEnd)
+	{
+		char ch = *m_pCur;
+
+		if ((ch == ' ') || (ch == '\t') || (ch == '\r') || (ch == '\0'))
+		{
+			m_pCur++;
+		}
+		else if (ch == '\n')
+		{
+			m_nLine++;
+			m_pCur++;
+		}
+		else if (ch == '+')
+		{
+			bCombineStrings = true;
+			m_pCur++;
+		}
+		else if (ch == '/')
+		{
+			//
+			// Comments run to the end of the line. Like TokenReader, a lone slash is skipped.
+			//
+			m_pCur++;
+			if ((m_pCur < m_pEnd) && (*m_pCur == '/'))
+			{
+				while ((m_pCur < m_pEnd) && (*m_pCur != '\n'))
+				{
+					m_pCur++;
+				}
+			}
+		}
+		else
+		{
+			break;
+		}
+	}
+
+	return(bCombineStrings);
+}
+
+
+//-----------------------------------------------------------------------------
+// Purpose: Reads a quoted string whose open quote has already been consumed.
+//			Escapes only ever shorten a string, so it is unescaped over itself.
+// Input  : ppszToken - Receives the string.
+//			nMaxLen - Longest string accepted, including the terminator.
+// Output : Returns STRING, TOKENSTRINGTOOLONG or TOKENEOF.
+//-----------------------------------------------------------------------------
+trtoken_t CMappedTokenReader::GetString(const char **ppszToken, int nMaxLen)
+{
+	char *pszStart = m_pCur;
+	char *pchOut = m_pCur;
+
+	while (true)
+	{
+		if (m_pCur >= m_pEnd)
+		{
+			return(TOKENEOF);
+		}
+
+		char ch = *m_pCur++;
+
+		if (ch == '\"')
+		{
+			//
+			// Combine consecutive quoted strings if the combine strings character was
+			// encountered between the two strings.
+			//
+			if (SkipWhiteSpace() && (m_pCur < m_pEnd) && (*m_pCur == '\"'))
+			{
+				m_pCur++;
+				continue;
+			}
+
+			*pchOut = '\0';
+			*ppszToken = pszStart;
+			return(STRING);
+		}
+
+		if (ch == '\r')
+		{
+			//
+			// Newline encountered before closing quote -- unterminated string.
+			//
+			return(TOKENSTRINGTOOLONG);
+		}
+
+		if (ch == '\\')
+		{
+			//
+			// Backslash sequence. \n is a newline, and the backslash is dropped from
+			// anything else. A backslash doesn't keep a quote from closing the string.
+			//
+			if ((m_pCur >= m_pEnd) || (*m_pCur == '\"'))
+			{
+				continue;
+			}
+
+			ch = *m_pCur++;
+			if (ch == 'n')
+			{
+				ch = '\n';
+			}
+			else if (ch == '\n')
+			{
+				m_nLine++;
+			}
+		}
+		else if (ch == '\n')
+		{
+			m_nLine++;
+		}
+
+		if (pchOut - pszStart >= nMaxLen - 1)
+		{
+			//
+			// Ran out of room. Skip to the close-quote and give up on this string.
+			//
+			while ((m_pCur < m_pEnd) && (*m_pCur++ != '\"'))
+			{
+			}
+
+			return(TOKENSTRINGTOOLONG);
+		}
+
+		*pchOut++ = ch;
+	}
+}
+
+
+//-----------------------------------------------------------------------------
+// Purpose: Returns the next token.
+// Input  : ppszToken - Receives the token. It points into the view, or into a
+//				copy for tokens that can't be terminated in place.
+//			nMaxLen - Longest token accepted, including the terminator.
+// Output : Returns the type of token that was read, or TOKENERROR.
+//-----------------------------------------------------------------------------
+trtoken_t CMappedTokenReader::NextToken(const char **ppszToken, int nMaxLen)
+{
+	*ppszToken = "";
+
+	if (!m_bOpen)
+	{
+		return(TOKENEOF);
+	}
+
+	SkipWhiteSpace();
+
+	if (m_pCur >= m_pEnd)
+	{
+		return(TOKENEOF);
+	}
+
+	char *pchStart = m_pCur;
+	unsigned char ch = *m_pCur++;
+
+	//
+	// Look for all the valid operators.
+	//
+	switch (ch)
+	{
+		case '@':
+		case ',':
+		case '!':
+		case '+':
+		case '&':
+		case '*':
+		case '$':
+		case '.':
+		case '=':
+		case ':':
+		case '[':
+		case ']':
+		case '(':
+		case ')':
+		case '{':
+		case '}':
+		case '\\':
+		{
+			m_szOperator[0] = ch;
+			m_szOperator[1] = '\0';
+			*ppszToken = m_szOperator;
+			return(OPERATOR);
+		}
+	}
+
+	//
+	// Look for the start of a quoted string.
+	//
+	if (ch == '\"')
+	{
+		return(GetString(ppszToken, nMaxLen));
+	}
+
+	trtoken_t eTokenType;
+	if (isdigit(ch) || (ch == '-'))
+	{
+		//
+		// Integers consist of numbers with an optional leading minus sign. No identifier
+		// characters or further minus signs are allowed contiguous with them.
+		//
+		while ((m_pCur < m_pEnd) && isdigit((unsigned char)*m_pCur))
+		{
+			m_pCur++;
+		}
+
+		if ((m_pCur < m_pEnd) && ((*m_pCur == '-') || (*m_pCur == '_') || isalpha((unsigned char)*m_pCur)))
+		{
+			*ppszToken = CopyToken(pchStart, m_pCur - pchStart);
+			return(TOKENERROR);
+		}
+
+		eTokenType = INTEGER;
+	}
+	else if (isalpha(ch) || (ch == '_'))
+	{
+		//
+		// Identifiers consist of a consecutive string of alphanumeric
+		// characters and underscores.
+		//
+		while ((m_pCur < m_pEnd) && (isalnum((unsigned char)*m_pCur) || (*m_pCur == '_')))
+		{
+			m_pCur++;
+		}
+
+		eTokenType = IDENT;
+	}
+	else
+	{
+		// Not the start of any token. TokenReader returns an empty identifier here without consuming anything.
+		*ppszToken = CopyToken(pchStart, 1);
+		return(TOKENERROR);
+	}
+
+	//
+	// Terminate the token over the whitespace that follows it, or copy it out if it
+	// runs straight into the next token. Long tokens are truncated, as TokenReader does.
+	//
+	int nLen = min((int)(m_pCur - pchStart), nMaxLen - 1);
+	if ((m_pCur < m_pEnd) && ((*m_pCur == ' ') || (*m_pCur == '\t') || (*m_pCur == '\r') || (*m_pCur == '\n') || (*m_pCur == '\0')))
+	{
+		if (*m_pCur == '\n')
+		{
+			m_nLine++;
+		}
+
+		*m_pCur++ = '\0';
+		pchStart[nLen] = '\0';
+		*ppszToken = pchStart;
+	}
+	else
+	{
+		*ppszToken = CopyToken(pchStart, nLen);
+	}
+
+	return(eTokenType);
+}
+
+
 //-----------------------------------------------------------------------------
 // Purpose: Constructor. Initializes data members.
 //-----------------------------------------------------------------------------
-CChunkFile::CChunkFile(void)
+CChunkFile::CChunkFile(void) : m_BinaryStringIndex(false)
 {
 	m_hFile = NULL;
 	m_nCurrentDepth = 0;
 	m_szIndent[0] = '\0';
 	m_nHandlerStackDepth = 0;
 	m_DefaultChunkHandler = 0;
+	m_bMapped = false;
+	m_bBinary = false;
+	m_nBinaryStrings = 0;
+	m_pBinaryFile = NULL;
+	m_pBinaryBody = NULL;
+	m_nBinaryBodySize = 0;
+	m_nBinaryPos = 0;
+	m_nBinaryRecordPos = 0;
+	m_pBinaryOutput = NULL;
+	m_szBinaryFileName[0] = '\0';
 }
 
 
@@ -177,6 +642,8 @@ CChunkFile::~CChunkFile(void)
 	{
 		fclose(m_hFile);
 	}
+
+	delete [] m_pBinaryFile;
 }
 
 
@@ -187,6 +654,30 @@ CChunkFile::~CChunkFile(void)
 //-----------------------------------------------------------------------------
 ChunkFileResult_t CChunkFile::BeginChunk(const char *pszChunkName)
 {
+	if (m_bBinary)
+	{
+		if (m_nCurrentDepth >= MAX_INDENT_DEPTH)
+		{
+			return(ChunkFile_Fail);
+		}
+
+		int nName = AddBinaryString(pszChunkName);
+		if (m_nCurrentDepth == 0)
+		{
+			BinaryChunkIndex_t &Index = m_BinaryIndex[m_BinaryIndex.AddToTail()];
+			Index.m_nName = nName;
+			Index.m_nOffset = m_BinaryBody.TellPut();
+			Index.m_nSize = 0;
+		}
+
+		m_BinaryBody.PutUnsignedChar(BinaryChunk_Begin);
+		m_BinaryBody.PutInt(nName);
+		m_nBinaryChunkStart[m_nCurrentDepth] = m_BinaryBody.TellPut();
+		m_BinaryBody.PutInt(0);		// Filled in by EndChunk.
+		m_nCurrentDepth++;
+		return(ChunkFile_Ok);
+	}
+
 	//
 	// Write the chunk name and open curly.
 	//
@@ -230,13 +721,21 @@ void CChunkFile::BuildIndentString(char *pszDest, int nDepth)
 //-----------------------------------------------------------------------------
 ChunkFileResult_t CChunkFile::Close(void)
 {
+	ChunkFileResult_t eResult = ChunkFile_Ok;
+	if (m_bBinary)
+	{
+		eResult = CloseBinary();
+	}
+
 	if (m_hFile != NULL)
 	{
 		fclose(m_hFile);
 		m_hFile = NULL;
 	}
 
-	return(ChunkFile_Ok);
+	m_MappedReader.Close();
+
+	return(eResult);
 }
 
 
@@ -246,6 +745,26 @@ ChunkFileResult_t CChunkFile::Close(void)
 //-----------------------------------------------------------------------------
 ChunkFileResult_t CChunkFile::EndChunk(void)
 {
+	if (m_bBinary)
+	{
+		m_BinaryBody.PutUnsignedChar(BinaryChunk_End);
+		if (m_nCurrentDepth > 0)
+		{
+			m_nCurrentDepth--;
+			int nStart = m_nBinaryChunkStart[m_nCurrentDepth];
+			int nSize = m_BinaryBody.TellPut() - (nStart + sizeof(int));
+			memcpy((unsigned char *)m_BinaryBody.Base() + nStart, &nSize, sizeof(nSize));
+
+			if (m_nCurrentDepth == 0)
+			{
+				BinaryChunkIndex_t &Index = m_BinaryIndex.Tail();
+				Index.m_nSize = m_BinaryBody.TellPut() - Index.m_nOffset;
+			}
+		}
+
+		return(ChunkFile_Ok);
+	}
+
 	if (m_nCurrentDepth > 0)
 	{
 		m_nCurrentDepth--;
@@ -297,7 +816,23 @@ const char *CChunkFile::GetErrorText(ChunkFileResult_t eResult)
 		}
 	}
 
-	return(m_TokenReader.Error(szError));
+	if (m_bBinary)
+	{
+		static char szBinaryError[MAX_KEYVALUE_LEN];
+		if (eResult == ChunkFile_Fail)
+		{
+			Q_strncpy(szError, "not a valid binary chunk file", sizeof( szError ) );
+		}
+		Q_snprintf(szBinaryError, sizeof( szBinaryError ), "File %s, offset %d: %s", m_szBinaryFileName, m_nBinaryPos, szError);
+		return(szBinaryError);
+	}
+
+	if (m_bMapped)
+	{
+		return(m_MappedReader.Error(szError));
+	}
+
+	return(m_TokenReader.Error(szError));
 }
 
 
@@ -359,17 +894,39 @@ ChunkFileResult_t CChunkFile::HandleChunk(const char *szChunkName)
 			int nDepth = 1;
 			ChunkFileResult_t eResult;
 
+			if (m_bBinary)
+			{
+				// Chunks know their size, go straight to the end record.
+				m_nBinaryPos = m_nBinaryChunkEnd[m_nCurrentDepth - 1];
+			}
+
 			do
 			{
 				ChunkType_t eChunkType;
-				char szKey[MAX_KEYVALUE_LEN];
-				char szValue[MAX_KEYVALUE_LEN];
 
-				while ((eResult = ReadNext(szKey, szValue, sizeof(szValue), eChunkType)) == ChunkFile_Ok)
+				if (m_bMapped)
+				{
+					const char *pszKey;
+					const char *pszValue;
+					while ((eResult = ReadNextMapped(&pszKey, &pszValue, eChunkType)) == ChunkFile_Ok)
+					{
+						if (eChunkType == ChunkType_Chunk)
+						{
+							nDepth++;
+						}
+					}
+				}
+				else
 				{
-					if (eChunkType == ChunkType_Chunk)
+					char szKey[MAX_KEYVALUE_LEN];
+					char szValue[MAX_KEYVALUE_LEN];
+
+					while ((eResult = ReadNext(szKey, szValue, sizeof(szValue), eChunkType)) == ChunkFile_Ok)
 					{
-						nDepth++;
+						if (eChunkType == ChunkType_Chunk)
+						{
+							nDepth++;
+						}
 					}
 				}
 
@@ -394,17 +951,35 @@ ChunkFileResult_t CChunkFile::HandleChunk(const char *szChunkName)
 //-----------------------------------------------------------------------------
 // Purpose: Opens the chunk file for reading or writing.
 // Input  : pszFileName - Path of file to open.
-//			eMode - ChunkFile_Read or ChunkFile_Write.
+//			eMode - One of the ChunkFileOpenMode_t modes.
 // Output : Returns ChunkFile_Ok on success, ChunkFile_Fail on failure.
 // UNDONE: boolean return value?
 //-----------------------------------------------------------------------------
 ChunkFileResult_t CChunkFile::Open(const char *pszFileName, ChunkFileOpenMode_t eMode)
 {
-	if (eMode == ChunkFile_Read)
+	if ((eMode == ChunkFile_Read) || (eMode == ChunkFile_ReadMapped))
 	{
+		//
+		// Binary files are recognized by their header whichever read mode is asked for.
+		//
+		FILE *fp = fopen(pszFileName, "rb");
+		if (fp != NULL)
+		{
+			int nIdent = 0;
+			bool bBinary = (fread(&nIdent, sizeof(nIdent), 1, fp) == 1) && (nIdent == BINARYCHUNKFILE_ID);
+			fclose(fp);
+
+			if (bBinary)
+			{
+				return(OpenBinary(pszFileName));
+			}
+		}
+
 		// UNDONE: TokenReader encapsulates file - unify reading and writing to use the same file I/O.
 		// UNDONE: Support in-memory parsing.
-		if (m_TokenReader.Open(pszFileName))
+		m_bMapped = (eMode == ChunkFile_ReadMapped);
+		bool bOpen = m_bMapped ? m_MappedReader.Open(pszFileName) : m_TokenReader.Open(pszFileName);
+		if (bOpen)
 		{
 			m_nCurrentDepth = 0;
 		}
@@ -413,7 +988,7 @@ ChunkFileResult_t CChunkFile::Open(const char *pszFileName, ChunkFileOpenMode_t
 			return(ChunkFile_OpenFail);
 		}	
 	}
-	else if (eMode == ChunkFile_Write)
+	else if ((eMode == ChunkFile_Write) || (eMode == ChunkFile_WriteBinary))
 	{
 		m_hFile = fopen(pszFileName, "wb");
 
@@ -423,12 +998,81 @@ ChunkFileResult_t CChunkFile::Open(const char *pszFileName, ChunkFileOpenMode_t
 		}
 
 		m_nCurrentDepth = 0;
+		m_bBinary = (eMode == ChunkFile_WriteBinary);
+		Q_strncpy(m_szBinaryFileName, pszFileName, sizeof(m_szBinaryFileName));
 	}
 
 	return(ChunkFile_Ok);
 }
 
 
+//-----------------------------------------------------------------------------
+// Purpose: Opens a binary chunk file image held in memory for reading, or
+//			starts one that Close will put into the buffer.
+// Input  : Buffer - Holds the image to read, or receives the one written.
+//			eMode - ChunkFile_Read, ChunkFile_ReadMapped or ChunkFile_WriteBinary.
+// Output : Returns ChunkFile_Ok on success, ChunkFile_Fail if the buffer doesn't
+//			hold a binary chunk file or the mode is a text one.
+//-----------------------------------------------------------------------------
+ChunkFileResult_t CChunkFile::Open(CUtlBuffer &Buffer, ChunkFileOpenMode_t eMode)
+{
+	Q_strncpy(m_szBinaryFileName, "<memory>", sizeof(m_szBinaryFileName));
+
+	if ((eMode == ChunkFile_Read) || (eMode == ChunkFile_ReadMapped))
+	{
+		m_bBinary = true;
+		m_bMapped = true;
+		m_nCurrentDepth = 0;
+		m_nBinaryPos = 0;
+
+		int nFileSize = Buffer.TellPut() - Buffer.TellGet();
+		if (nFileSize < (int)sizeof(BinaryChunkFileHeader_t))
+		{
+			return(ChunkFile_Fail);
+		}
+
+		m_pBinaryFile = new char[nFileSize + 1];
+		m_pBinaryFile[nFileSize] = '\0';
+		memcpy(m_pBinaryFile, Buffer.PeekGet(), nFileSize);
+
+		return(ParseBinary(nFileSize));
+	}
+	else if (eMode == ChunkFile_WriteBinary)
+	{
+		m_nCurrentDepth = 0;
+		m_bBinary = true;
+		m_pBinaryOutput = &Buffer;
+		return(ChunkFile_Ok);
+	}
+
+	return(ChunkFile_Fail);
+}
+
+
+//-----------------------------------------------------------------------------
+// Purpose: Returns the size of the binary chunk file image at the start of the
+//			given data, or -1 if the data doesn't start with a whole image.
+//-----------------------------------------------------------------------------
+int CChunkFile::GetBinaryFileSize(const void *pData, int nDataSize)
+{
+	BinaryChunkFileHeader_t Header;
+	if (nDataSize < (int)sizeof(Header))
+	{
+		return(-1);
+	}
+
+	memcpy(&Header, pData, sizeof(Header));
+	if ((Header.m_nIdent != BINARYCHUNKFILE_ID) || (Header.m_nVersion != BINARYCHUNKFILE_VERSION) ||
+		(Header.m_nBodyOffset < (int)sizeof(Header)) || (Header.m_nBodySize < 0) ||
+		(Header.m_nBodySize > nDataSize - Header.m_nBodyOffset))
+	{
+		return(-1);
+	}
+
+	return(Header.m_nBodyOffset + Header.m_nBodySize);
+}
+
+
 //-----------------------------------------------------------------------------
 // Purpose: Removes the topmost set of chunk handlers.
 //-----------------------------------------------------------------------------
@@ -472,6 +1116,20 @@ void CChunkFile::PushHandlers(CChunkHandlerMap *pHandlerMap)
 //-----------------------------------------------------------------------------
 ChunkFileResult_t CChunkFile::ReadNext(char *szName, char *szValue, int nValueSize, ChunkType_t &eChunkType)
 {
+	if (m_bMapped)
+	{
+		const char *pszName;
+		const char *pszValue;
+		ChunkFileResult_t eResult = ReadNextMapped(&pszName, &pszValue, eChunkType);
+		if (eResult == ChunkFile_Ok)
+		{
+			Q_strncpy(szName, pszName, MAX_KEYVALUE_LEN);
+			Q_strncpy(szValue, pszValue, nValueSize);
+		}
+
+		return(eResult);
+	}
+
 	// HACK: pass in buffer sizes?
 	trtoken_t eTokenType = m_TokenReader.NextToken(szName, MAX_KEYVALUE_LEN);
 
@@ -566,6 +1224,111 @@ ChunkFileResult_t CChunkFile::ReadNext(char *szName, char *szValue, int nValueSi
 }
 
 
+//-----------------------------------------------------------------------------
+// Purpose: ReadNext for files opened with ChunkFile_ReadMapped, and binary files.
+//			Hands back pointers into the file instead of copying the terms out.
+// Input  : ppszName - Receives the name of the key or chunk.
+//			ppszValue - Receives the value of the key, or an empty string for chunks.
+//			eChunkType - ChunkType_Key or ChunkType_Chunk.
+// Output : Returns ChunkFile_Ok on success, an error code if a parsing error occurs.
+//-----------------------------------------------------------------------------
+ChunkFileResult_t CChunkFile::ReadNextMapped(const char **ppszName, const char **ppszValue, ChunkType_t &eChunkType)
+{
+	if (m_bBinary)
+	{
+		return(ReadNextBinary(ppszName, ppszValue, eChunkType));
+	}
+
+	const char *pszName;
+	trtoken_t eTokenType = m_MappedReader.NextToken(&pszName, MAX_KEYVALUE_LEN);
+
+	switch (eTokenType)
+	{
+		case IDENT:
+		case STRING:
+		{
+			//
+			// Read the next token to determine what we have.
+			//
+			const char *pszNext;
+			switch (m_MappedReader.NextToken(&pszNext, MAX_KEYVALUE_LEN))
+			{
+				case OPERATOR:
+				{
+					if (pszNext[0] == '{')
+					{
+						// Beginning of new chunk.
+						m_nCurrentDepth++;
+						eChunkType = ChunkType_Chunk;
+						*ppszName = pszName;
+						*ppszValue = "";
+						return(ChunkFile_Ok);
+					}
+
+					break;
+				}
+
+				case STRING:
+				case IDENT:
+				{
+					// Key value pair.
+					eChunkType = ChunkType_Key;
+					*ppszName = pszName;
+					*ppszValue = pszNext;
+					return(ChunkFile_Ok);
+				}
+
+				case TOKENEOF:
+				{
+					return(ChunkFile_UnexpectedEOF);
+				}
+
+				case TOKENSTRINGTOOLONG:
+				{
+					return(ChunkFile_StringTooLong);
+				}
+			}
+
+			// Unexpected symbol.
+			Q_strncpy(m_szErrorToken, pszNext, sizeof( m_szErrorToken ) );
+			return(ChunkFile_UnexpectedSymbol);
+		}
+
+		case OPERATOR:
+		{
+			if (pszName[0] == '}')
+			{
+				// End of current chunk.
+				m_nCurrentDepth--;
+				return(ChunkFile_EndOfChunk);
+			}
+
+			break;
+		}
+
+		case TOKENSTRINGTOOLONG:
+		{
+			return(ChunkFile_StringTooLong);
+		}
+
+		case TOKENEOF:
+		{
+			if (m_nCurrentDepth != 0)
+			{
+				// End of file while within the scope of a chunk.
+				return(ChunkFile_UnexpectedEOF);
+			}
+
+			return(ChunkFile_EOF);
+		}
+	}
+
+	// Unexpected symbol.
+	Q_strncpy(m_szErrorToken, pszName, sizeof( m_szErrorToken ) );
+	return(ChunkFile_UnexpectedSymbol);
+}
+
+
 //-----------------------------------------------------------------------------
 // Purpose: Reads the current chunk and dispatches keys and sub-chunks to the
 //			appropriate handler callbacks.
@@ -584,9 +1347,18 @@ ChunkFileResult_t CChunkFile::ReadChunk(KeyHandler_t pfnKeyHandler, void *pData)
 	{
 		char szName[MAX_KEYVALUE_LEN];
 		char szValue[MAX_KEYVALUE_LEN];
+		const char *pszName = szName;
+		const char *pszValue = szValue;
 		ChunkType_t eChunkType;
 
-		eResult = ReadNext(szName, szValue, sizeof(szValue), eChunkType);
+		if (m_bMapped)
+		{
+			eResult = ReadNextMapped(&pszName, &pszValue, eChunkType);
+		}
+		else
+		{
+			eResult = ReadNext(szName, szValue, sizeof(szValue), eChunkType);
+		}
 
 		if (eResult == ChunkFile_Ok)
 		{
@@ -595,14 +1367,14 @@ ChunkFileResult_t CChunkFile::ReadChunk(KeyHandler_t pfnKeyHandler, void *pData)
 				//
 				// Dispatch sub-chunks to the appropriate handler.
 				//
-				eResult = HandleChunk(szName);
+				eResult = HandleChunk(pszName);
 			}
 			else if ((eChunkType == ChunkType_Key) && (pfnKeyHandler != NULL))
 			{
 				//
 				// Dispatch keys to the key value handler.
 				//
-				eResult = pfnKeyHandler(szName, szValue, pData);
+				eResult = pfnKeyHandler(pszName, pszValue, pData);
 			}
 		}
 	} while (eResult == ChunkFile_Ok);
@@ -774,6 +1546,170 @@ bool CChunkFile::ReadKeyValueVector4(const char *pszValue, Vector4D &vec)
 }
 
 
+//-----------------------------------------------------------------------------
+// Purpose: Formats a typed value exactly as the text format writes it.
+// Input  : eType - One of the key value BinaryChunkRecord_t types, but not BinaryChunk_String.
+//			pData - The value as it is stored in a binary file.
+//			nDataSize - Bytes available at pData.
+//			pszValue - Receives the text.
+// Output : Returns the number of bytes the value takes up, or -1 if it runs past
+//			nDataSize or eType isn't a typed value.
+//-----------------------------------------------------------------------------
+static int FormatTypedValue(int eType, const unsigned char *pData, int nDataSize, char *pszValue, int nValueSize)
+{
+	float fl[9];
+	int nInt;
+
+	switch (eType)
+	{
+		case BinaryChunk_Int:
+		{
+			if (nDataSize < (int)sizeof(int))
+			{
+				return(-1);
+			}
+
+			memcpy(&nInt, pData, sizeof(int));
+			Q_snprintf(pszValue, nValueSize, "%d", nInt);
+			return(sizeof(int));
+		}
+
+		case BinaryChunk_Float:
+		{
+			if (nDataSize < (int)sizeof(float))
+			{
+				return(-1);
+			}
+
+			memcpy(fl, pData, sizeof(float));
+			Q_snprintf(pszValue, nValueSize, "%g", (double)fl[0]);
+			return(sizeof(float));
+		}
+
+		case BinaryChunk_Color:
+		{
+			if (nDataSize < 3)
+			{
+				return(-1);
+			}
+
+			Q_snprintf(pszValue, nValueSize, "%d %d %d", (int)pData[0], (int)pData[1], (int)pData[2]);
+			return(3);
+		}
+
+		case BinaryChunk_Point:
+		case BinaryChunk_Vector3:
+		{
+			if (nDataSize < 3 * (int)sizeof(float))
+			{
+				return(-1);
+			}
+
+			memcpy(fl, pData, 3 * sizeof(float));
+			Q_snprintf(pszValue, nValueSize, (eType == BinaryChunk_Point) ? "(%g %g %g)" : "[%g %g %g]", (double)fl[0], (double)fl[1], (double)fl[2]);
+			return(3 * sizeof(float));
+		}
+
+		case BinaryChunk_Vector2:
+		{
+			if (nDataSize < 2 * (int)sizeof(float))
+			{
+				return(-1);
+			}
+
+			memcpy(fl, pData, 2 * sizeof(float));
+			Q_snprintf(pszValue, nValueSize, "[%g %g]", (double)fl[0], (double)fl[1]);
+			return(2 * sizeof(float));
+		}
+
+		case BinaryChunk_Vector4:
+		{
+			if (nDataSize < 4 * (int)sizeof(float))
+			{
+				return(-1);
+			}
+
+			memcpy(fl, pData, 4 * sizeof(float));
+			Q_snprintf(pszValue, nValueSize, "[%g %g %g %g]", (double)fl[0], (double)fl[1], (double)fl[2], (double)fl[3]);
+			return(4 * sizeof(float));
+		}
+
+		case BinaryChunk_Plane:
+		{
+			if (nDataSize < 9 * (int)sizeof(float))
+			{
+				return(-1);
+			}
+
+			memcpy(fl, pData, 9 * sizeof(float));
+			Q_snprintf(pszValue, nValueSize, "(%g %g %g) (%g %g %g) (%g %g %g)",
+				(double)fl[0], (double)fl[1], (double)fl[2],
+				(double)fl[3], (double)fl[4], (double)fl[5],
+				(double)fl[6], (double)fl[7], (double)fl[8]);
+			return(9 * sizeof(float));
+		}
+
+		case BinaryChunk_TextureAxis:
+		{
+			if (nDataSize < 5 * (int)sizeof(float))
+			{
+				return(-1);
+			}
+
+			memcpy(fl, pData, 5 * sizeof(float));
+			Q_snprintf(pszValue, nValueSize, "[%g %g %g %g] %g", (double)fl[0], (double)fl[1], (double)fl[2], (double)fl[3], (double)fl[4]);
+			return(5 * sizeof(float));
+		}
+
+		case BinaryChunk_IndexedPoint:
+		{
+			if (nDataSize < (int)sizeof(int) + 3 * (int)sizeof(float))
+			{
+				return(-1);
+			}
+
+			memcpy(&nInt, pData, sizeof(int));
+			memcpy(fl, pData + sizeof(int), 3 * sizeof(float));
+			Q_snprintf(pszValue, nValueSize, "%i %g %g %g", nInt, (double)fl[0], (double)fl[1], (double)fl[2]);
+			return(sizeof(int) + 3 * sizeof(float));
+		}
+
+		case BinaryChunk_Floats:
+		{
+			unsigned short nCount;
+			if (nDataSize < (int)sizeof(nCount))
+			{
+				return(-1);
+			}
+
+			memcpy(&nCount, pData, sizeof(nCount));
+			int nSize = sizeof(nCount) + nCount * sizeof(float);
+			if (nDataSize < nSize)
+			{
+				return(-1);
+			}
+
+			int nLen = 0;
+			pszValue[0] = '\0';
+			for (int i = 0; (i < nCount) && (nLen < nValueSize - 1); i++)
+			{
+				memcpy(fl, pData + sizeof(nCount) + i * sizeof(float), sizeof(float));
+				int nWritten = Q_snprintf(pszValue + nLen, nValueSize - nLen, (i == 0) ? "%g" : " %g", (double)fl[0]);
+				if (nWritten < 0)
+				{
+					break;
+				}
+				nLen += nWritten;
+			}
+
+			return(nSize);
+		}
+	}
+
+	return(-1);
+}
+
+
 //-----------------------------------------------------------------------------
 // Purpose: 
 // Input  : pszLine - 
@@ -783,6 +1719,12 @@ ChunkFileResult_t CChunkFile::WriteKeyValue(const char *pszKey, const char *pszV
 {
 	if ((pszKey != NULL) && (pszValue != NULL))
 	{
+		if (m_bBinary)
+		{
+			int nValue = AddBinaryString(pszValue);
+			return(WriteBinaryKeyValue(pszKey, BinaryChunk_String, &nValue, sizeof(nValue)));
+		}
+
 		char szTemp[MAX_KEYVALUE_LEN];
 		Q_snprintf(szTemp, sizeof( szTemp ), "\"%s\" \"%s\"", pszKey, pszValue);
 		return(WriteLine(szTemp));
@@ -800,14 +1742,8 @@ ChunkFileResult_t CChunkFile::WriteKeyValue(const char *pszKey, const char *pszV
 //-----------------------------------------------------------------------------
 ChunkFileResult_t CChunkFile::WriteKeyValueBool(const char *pszKey, bool bValue)
 {
-	if (pszKey != NULL)
-	{
-		char szBuf[MAX_KEYVALUE_LEN];
-		Q_snprintf(szBuf, sizeof( szBuf ), "\"%s\" \"%d\"", pszKey, (int)bValue);
-		return(WriteLine(szBuf));
-	}
-
-	return(ChunkFile_Ok);
+	int nValue = bValue ? 1 : 0;
+	return(WriteTypedKeyValue(pszKey, BinaryChunk_Int, &nValue, sizeof(nValue)));
 }
 
 
@@ -819,14 +1755,7 @@ ChunkFileResult_t CChunkFile::WriteKeyValueBool(const char *pszKey, bool bValue)
 //-----------------------------------------------------------------------------
 ChunkFileResult_t CChunkFile::WriteKeyValueInt(const char *pszKey, int nValue)
 {
-	if (pszKey != NULL)
-	{
-		char szBuf[MAX_KEYVALUE_LEN];
-		Q_snprintf(szBuf, sizeof( szBuf ), "\"%s\" \"%d\"", pszKey, nValue);
-		return(WriteLine(szBuf));
-	}
-
-	return(ChunkFile_Ok);
+	return(WriteTypedKeyValue(pszKey, BinaryChunk_Int, &nValue, sizeof(nValue)));
 }
 
 
@@ -838,14 +1767,7 @@ ChunkFileResult_t CChunkFile::WriteKeyValueInt(const char *pszKey, int nValue)
 //-----------------------------------------------------------------------------
 ChunkFileResult_t CChunkFile::WriteKeyValueFloat(const char *pszKey, float fValue)
 {
-	if (pszKey != NULL)
-	{
-		char szBuf[MAX_KEYVALUE_LEN];
-		Q_snprintf(szBuf, sizeof( szBuf ), "\"%s\" \"%g\"", pszKey, (double)fValue);
-		return(WriteLine(szBuf));
-	}
-
-	return(ChunkFile_Ok);
+	return(WriteTypedKeyValue(pszKey, BinaryChunk_Float, &fValue, sizeof(fValue)));
 }
 
 
@@ -859,14 +1781,8 @@ ChunkFileResult_t CChunkFile::WriteKeyValueFloat(const char *pszKey, float fValu
 //-----------------------------------------------------------------------------
 ChunkFileResult_t CChunkFile::WriteKeyValueColor(const char *pszKey, unsigned char r, unsigned char g, unsigned char b)
 {
-	if (pszKey != NULL)
-	{
-		char szBuf[MAX_KEYVALUE_LEN];
-		Q_snprintf(szBuf, sizeof( szBuf ), "\"%s\" \"%d %d %d\"", pszKey, (int)r, (int)g, (int)b);
-		return(WriteLine(szBuf));
-	}
-
-	return(ChunkFile_Ok);
+	unsigned char Color[3] = { r, g, b };
+	return(WriteTypedKeyValue(pszKey, BinaryChunk_Color, Color, sizeof(Color)));
 }
 
 
@@ -878,14 +1794,8 @@ ChunkFileResult_t CChunkFile::WriteKeyValueColor(const char *pszKey, unsigned ch
 //-----------------------------------------------------------------------------
 ChunkFileResult_t CChunkFile::WriteKeyValuePoint(const char *pszKey, const Vector &Point)
 {
-	if (pszKey != NULL)
-	{
-		char szBuf[MAX_KEYVALUE_LEN];
-		Q_snprintf(szBuf, sizeof( szBuf ), "\"%s\" \"(%g %g %g)\"", pszKey, (double)Point[0], (double)Point[1], (double)Point[2]);
-		return(WriteLine(szBuf));
-	}
-
-	return(ChunkFile_Ok);
+	float fl[3] = { Point[0], Point[1], Point[2] };
+	return(WriteTypedKeyValue(pszKey, BinaryChunk_Point, fl, sizeof(fl)));
 }
 
 
@@ -894,14 +1804,8 @@ ChunkFileResult_t CChunkFile::WriteKeyValuePoint(const char *pszKey, const Vecto
 //-----------------------------------------------------------------------------
 ChunkFileResult_t CChunkFile::WriteKeyValueVector2(const char *pszKey, const Vector2D &vec)
 {
-	if (pszKey != NULL)
-	{
-		char szBuf[MAX_KEYVALUE_LEN];
-		Q_snprintf( szBuf, sizeof( szBuf ), "\"%s\" \"[%g %g]\"", pszKey, (double)vec.x, (double)vec.y );
-		return(WriteLine(szBuf));
-	}
-
-	return(ChunkFile_Ok);
+	float fl[2] = { vec.x, vec.y };
+	return(WriteTypedKeyValue(pszKey, BinaryChunk_Vector2, fl, sizeof(fl)));
 }
 
 
@@ -910,14 +1814,8 @@ ChunkFileResult_t CChunkFile::WriteKeyValueVector2(const char *pszKey, const Vec
 //-----------------------------------------------------------------------------
 ChunkFileResult_t CChunkFile::WriteKeyValueVector3(const char *pszKey, const Vector &vec)
 {
-	if (pszKey != NULL)
-	{
-		char szBuf[MAX_KEYVALUE_LEN];
-		Q_snprintf(szBuf, sizeof( szBuf ), "\"%s\" \"[%g %g %g]\"", pszKey, (double)vec.x, (double)vec.y, (double)vec.z);
-		return(WriteLine(szBuf));
-	}
-
-	return(ChunkFile_Ok);
+	float fl[3] = { vec.x, vec.y, vec.z };
+	return(WriteTypedKeyValue(pszKey, BinaryChunk_Vector3, fl, sizeof(fl)));
 }
 
 
@@ -929,37 +1827,145 @@ ChunkFileResult_t CChunkFile::WriteKeyValueVector3(const char *pszKey, const Vec
 //-----------------------------------------------------------------------------
 ChunkFileResult_t CChunkFile::WriteKeyValueVector4(const char *pszKey, const Vector4D &vec)
 {
-	if (pszKey != NULL)
-	{
-		char szBuf[MAX_KEYVALUE_LEN];
-		Q_snprintf(szBuf, sizeof( szBuf ), "\"%s\" \"[%g %g %g %g]\"", pszKey, (double)vec.x, (double)vec.y, (double)vec.z, (double)vec.w);
-		return( WriteLine( szBuf ) );
-	}
-
-	return( ChunkFile_Ok );
+	float fl[4] = { vec.x, vec.y, vec.z, vec.w };
+	return(WriteTypedKeyValue(pszKey, BinaryChunk_Vector4, fl, sizeof(fl)));
 }
 
 
 //-----------------------------------------------------------------------------
-// Purpose: 
-// Input  : *pszLine - 
-// Output : 
+// Purpose: Writes the three points that define a plane.
 //-----------------------------------------------------------------------------
-ChunkFileResult_t CChunkFile::WriteLine(const char *pszLine)
+ChunkFileResult_t CChunkFile::WriteKeyValuePlane(const char *pszKey, const Vector &Point0, const Vector &Point1, const Vector &Point2)
 {
-	if (pszLine != NULL)
+	float fl[9] =
 	{
-		//
-		// Write the indentation string.
-		//
-		if (m_nCurrentDepth > 0)
-		{
-			int nWritten = fwrite(m_szIndent, 1, m_nCurrentDepth, m_hFile);
-			if (nWritten != m_nCurrentDepth)
-			{
-				return(ChunkFile_Fail);
-			}
-		}
+		Point0[0], Point0[1], Point0[2],
+		Point1[0], Point1[1], Point1[2],
+		Point2[0], Point2[1], Point2[2]
+	};
+	return(WriteTypedKeyValue(pszKey, BinaryChunk_Plane, fl, sizeof(fl)));
+}
+
+
+//-----------------------------------------------------------------------------
+// Purpose: Writes a texture axis and its scale.
+//-----------------------------------------------------------------------------
+ChunkFileResult_t CChunkFile::WriteKeyValueTextureAxis(const char *pszKey, const Vector4D &vecAxis, float flScale)
+{
+	float fl[5] = { vecAxis.x, vecAxis.y, vecAxis.z, vecAxis.w, flScale };
+	return(WriteTypedKeyValue(pszKey, BinaryChunk_TextureAxis, fl, sizeof(fl)));
+}
+
+
+//-----------------------------------------------------------------------------
+// Purpose: Writes a point preceded by its index, as face point data is saved.
+//-----------------------------------------------------------------------------
+ChunkFileResult_t CChunkFile::WriteKeyValueIndexedPoint(const char *pszKey, int nIndex, const Vector &Point)
+{
+	unsigned char Data[sizeof(int) + 3 * sizeof(float)];
+	float fl[3] = { Point[0], Point[1], Point[2] };
+	memcpy(Data, &nIndex, sizeof(int));
+	memcpy(Data + sizeof(int), fl, sizeof(fl));
+	return(WriteTypedKeyValue(pszKey, BinaryChunk_IndexedPoint, Data, sizeof(Data)));
+}
+
+
+//-----------------------------------------------------------------------------
+// Purpose: Writes a list of floats separated by spaces, such as a row of
+//			displacement data.
+//-----------------------------------------------------------------------------
+ChunkFileResult_t CChunkFile::WriteKeyValueFloats(const char *pszKey, const float *pflValues, int nCount)
+{
+	unsigned char Data[sizeof(unsigned short) + MAX_KEYVALUE_LEN * sizeof(float)];
+	if ((nCount < 0) || (nCount > MAX_KEYVALUE_LEN))
+	{
+		return(ChunkFile_StringTooLong);
+	}
+
+	unsigned short nShortCount = nCount;
+	memcpy(Data, &nShortCount, sizeof(nShortCount));
+	memcpy(Data + sizeof(nShortCount), pflValues, nCount * sizeof(float));
+	return(WriteTypedKeyValue(pszKey, BinaryChunk_Floats, Data, sizeof(nShortCount) + nCount * sizeof(float)));
+}
+
+
+//-----------------------------------------------------------------------------
+// Purpose: Writes a typed value. Binary files store the value as is, text files
+//			get it formatted by FormatTypedValue.
+//-----------------------------------------------------------------------------
+ChunkFileResult_t CChunkFile::WriteTypedKeyValue(const char *pszKey, BinaryChunkRecord_t eType, const void *pData, int nSize)
+{
+	if (pszKey == NULL)
+	{
+		return(ChunkFile_Ok);
+	}
+
+	if (m_bBinary)
+	{
+		return(WriteBinaryKeyValue(pszKey, eType, pData, nSize));
+	}
+
+	char szValue[MAX_KEYVALUE_LEN];
+	FormatTypedValue(eType, (const unsigned char *)pData, nSize, szValue, sizeof(szValue));
+	return(WriteKeyValue(pszKey, szValue));
+}
+
+
+ChunkFileResult_t CChunkFile::WriteBinaryKeyValue(const char *pszKey, BinaryChunkRecord_t eType, const void *pData, int nSize)
+{
+	m_BinaryBody.PutUnsignedChar(eType);
+	m_BinaryBody.PutInt(AddBinaryString(pszKey));
+	m_BinaryBody.Put(pData, nSize);
+	return(m_BinaryBody.IsValid() ? ChunkFile_Ok : ChunkFile_OutOfMemory);
+}
+
+
+//-----------------------------------------------------------------------------
+// Purpose: Returns the index of the string in the string table, adding it if
+//			this is the first time it has been written.
+//-----------------------------------------------------------------------------
+int CChunkFile::AddBinaryString(const char *pszString)
+{
+	UtlSymId_t nSymbol = m_BinaryStringIndex.Find(pszString);
+	if (nSymbol != CUtlStringMap<int>::InvalidIndex())
+	{
+		return(m_BinaryStringIndex[nSymbol]);
+	}
+
+	int nIndex = m_nBinaryStrings++;
+	m_BinaryStringIndex[pszString] = nIndex;
+	m_BinaryStrings.Put(pszString, strlen(pszString) + 1);
+	return(nIndex);
+}
+
+
+//-----------------------------------------------------------------------------
+// Purpose: 
+// Input  : *pszLine - 
+// Output : 
+//-----------------------------------------------------------------------------
+ChunkFileResult_t CChunkFile::WriteLine(const char *pszLine)
+{
+	if (pszLine != NULL)
+	{
+		if (m_bBinary)
+		{
+			m_BinaryBody.PutUnsignedChar(BinaryChunk_Line);
+			m_BinaryBody.PutInt(AddBinaryString(pszLine));
+			return(ChunkFile_Ok);
+		}
+
+		//
+		// Write the indentation string.
+		//
+		if (m_nCurrentDepth > 0)
+		{
+			int nWritten = fwrite(m_szIndent, 1, m_nCurrentDepth, m_hFile);
+			if (nWritten != m_nCurrentDepth)
+			{
+				return(ChunkFile_Fail);
+			}
+		}
 
 		//
 		// Write the string.
@@ -983,3 +1989,552 @@ ChunkFileResult_t CChunkFile::WriteLine(const char *pszLine)
 	return(ChunkFile_Ok);
 }
 
+
+//-----------------------------------------------------------------------------
+// Purpose: Reads a binary chunk file into memory and checks its header.
+//-----------------------------------------------------------------------------
+ChunkFileResult_t CChunkFile::OpenBinary(const char *pszFileName)
+{
+	m_bBinary = true;
+	m_bMapped = true;
+	m_nCurrentDepth = 0;
+	m_nBinaryPos = 0;
+	Q_strncpy(m_szBinaryFileName, pszFileName, sizeof(m_szBinaryFileName));
+
+	FILE *fp = fopen(pszFileName, "rb");
+	if (fp == NULL)
+	{
+		return(ChunkFile_OpenFail);
+	}
+
+	fseek(fp, 0, SEEK_END);
+	long nFileSize = ftell(fp);
+	fseek(fp, 0, SEEK_SET);
+
+	if ((nFileSize < (long)sizeof(BinaryChunkFileHeader_t)) || (nFileSize >= INT_MAX))
+	{
+		fclose(fp);
+		return(ChunkFile_Fail);
+	}
+
+	// One extra byte so that the last string is always terminated.
+	m_pBinaryFile = new char[nFileSize + 1];
+	m_pBinaryFile[nFileSize] = '\0';
+	bool bRead = (fread(m_pBinaryFile, 1, nFileSize, fp) == (size_t)nFileSize);
+	fclose(fp);
+
+	if (!bRead)
+	{
+		return(ChunkFile_OpenFail);
+	}
+
+	return(ParseBinary(nFileSize));
+}
+
+
+//-----------------------------------------------------------------------------
+// Purpose: Checks the header of the image in m_pBinaryFile and sets up the
+//			string table and chunk index.
+//-----------------------------------------------------------------------------
+ChunkFileResult_t CChunkFile::ParseBinary(int nFileSize)
+{
+	BinaryChunkFileHeader_t Header;
+	memcpy(&Header, m_pBinaryFile, sizeof(Header));
+
+	if ((Header.m_nIdent != BINARYCHUNKFILE_ID) || (Header.m_nVersion != BINARYCHUNKFILE_VERSION) ||
+		(Header.m_nStringCount < 0) || (Header.m_nStringOffset < 0) || (Header.m_nStringOffset > nFileSize) ||
+		(Header.m_nIndexCount < 0) || (Header.m_nIndexOffset < 0) || (Header.m_nIndexCount > (nFileSize - Header.m_nIndexOffset) / (int)sizeof(BinaryChunkIndex_t)) ||
+		(Header.m_nBodyOffset < 0) || (Header.m_nBodySize < 0) || (Header.m_nBodySize > nFileSize - Header.m_nBodyOffset))
+	{
+		return(ChunkFile_Fail);
+	}
+
+	//
+	// Point the string table into the file.
+	//
+	m_BinaryStringTable.EnsureCapacity(Header.m_nStringCount);
+	const char *pszString = m_pBinaryFile + Header.m_nStringOffset;
+	const char *pszFileEnd = m_pBinaryFile + nFileSize;
+	for (int i = 0; i < Header.m_nStringCount; i++)
+	{
+		if (pszString >= pszFileEnd)
+		{
+			return(ChunkFile_Fail);
+		}
+
+		m_BinaryStringTable.AddToTail(pszString);
+		pszString += strlen(pszString) + 1;
+	}
+
+	m_BinaryIndex.SetCount(Header.m_nIndexCount);
+	if (Header.m_nIndexCount > 0)
+	{
+		memcpy(m_BinaryIndex.Base(), m_pBinaryFile + Header.m_nIndexOffset, Header.m_nIndexCount * sizeof(BinaryChunkIndex_t));
+	}
+
+	m_pBinaryBody = (const unsigned char *)m_pBinaryFile + Header.m_nBodyOffset;
+	m_nBinaryBodySize = Header.m_nBodySize;
+
+	return(ChunkFile_Ok);
+}
+
+
+//-----------------------------------------------------------------------------
+// Purpose: Copies a string value, turning \n into a newline and dropping the
+//			backslash from any other escape, as the text readers do.
+//-----------------------------------------------------------------------------
+static void UnescapeBinaryString(const char *pszString, char *pszOut, int nOutSize)
+{
+	char *pchOut = pszOut;
+	char *pchEnd = pszOut + nOutSize - 1;
+
+	while ((*pszString != '\0') && (pchOut < pchEnd))
+	{
+		char ch = *pszString++;
+		if (ch == '\\')
+		{
+			ch = *pszString;
+			if (ch == '\0')
+			{
+				break;
+			}
+
+			pszString++;
+			if (ch == 'n')
+			{
+				ch = '\n';
+			}
+		}
+
+		*pchOut++ = ch;
+	}
+
+	*pchOut = '\0';
+}
+
+
+//-----------------------------------------------------------------------------
+// Purpose: ReadNextMapped for binary files. Names and string values point into
+//			the string table, typed values are formatted into m_szBinaryValue.
+//-----------------------------------------------------------------------------
+ChunkFileResult_t CChunkFile::ReadNextBinary(const char **ppszName, const char **ppszValue, ChunkType_t &eChunkType)
+{
+	for (;;)
+	{
+		if (m_nBinaryPos >= m_nBinaryBodySize)
+		{
+			if (m_nCurrentDepth != 0)
+			{
+				// End of file while within the scope of a chunk.
+				return(ChunkFile_UnexpectedEOF);
+			}
+
+			return(ChunkFile_EOF);
+		}
+
+		m_nBinaryRecordPos = m_nBinaryPos;
+		const unsigned char *pRecord = m_pBinaryBody + m_nBinaryPos;
+		int nLeft = m_nBinaryBodySize - m_nBinaryPos - 1;
+		int eType = *pRecord++;
+
+		if (eType == BinaryChunk_End)
+		{
+			m_nBinaryPos++;
+			if (m_nCurrentDepth == 0)
+			{
+				Q_strncpy(m_szErrorToken, "}", sizeof( m_szErrorToken ) );
+				return(ChunkFile_UnexpectedSymbol);
+			}
+
+			// End of current chunk.
+			m_nCurrentDepth--;
+			return(ChunkFile_EndOfChunk);
+		}
+
+		//
+		// Everything else starts with a string.
+		//
+		int nString;
+		if (nLeft < (int)sizeof(nString))
+		{
+			return(ChunkFile_UnexpectedEOF);
+		}
+
+		memcpy(&nString, pRecord, sizeof(nString));
+		pRecord += sizeof(nString);
+		nLeft -= sizeof(nString);
+
+		if ((nString < 0) || (nString >= m_BinaryStringTable.Count()))
+		{
+			Q_snprintf(m_szErrorToken, sizeof( m_szErrorToken ), "string %d", nString);
+			return(ChunkFile_UnexpectedSymbol);
+		}
+
+		const char *pszString = m_BinaryStringTable[nString];
+
+		switch (eType)
+		{
+			case BinaryChunk_Line:
+			{
+				// Only there for the text form.
+				m_nBinaryPos = pRecord - m_pBinaryBody;
+				continue;
+			}
+
+			case BinaryChunk_Begin:
+			{
+				int nSize;
+				if (nLeft < (int)sizeof(nSize))
+				{
+					return(ChunkFile_UnexpectedEOF);
+				}
+
+				memcpy(&nSize, pRecord, sizeof(nSize));
+				pRecord += sizeof(nSize);
+				nLeft -= sizeof(nSize);
+
+				if ((nSize < 1) || (nSize > nLeft) || (pRecord[nSize - 1] != BinaryChunk_End))
+				{
+					return(ChunkFile_UnexpectedEOF);
+				}
+
+				if (m_nCurrentDepth >= MAX_INDENT_DEPTH)
+				{
+					Q_strncpy(m_szErrorToken, pszString, sizeof( m_szErrorToken ) );
+					return(ChunkFile_UnexpectedSymbol);
+				}
+
+				m_nBinaryPos = pRecord - m_pBinaryBody;
+				m_nBinaryChunkEnd[m_nCurrentDepth] = m_nBinaryPos + nSize - 1;
+
+				// Beginning of new chunk.
+				m_nCurrentDepth++;
+				eChunkType = ChunkType_Chunk;
+				*ppszName = pszString;
+				*ppszValue = "";
+				return(ChunkFile_Ok);
+			}
+
+			case BinaryChunk_String:
+			{
+				int nValue;
+				if (nLeft < (int)sizeof(nValue))
+				{
+					return(ChunkFile_UnexpectedEOF);
+				}
+
+				memcpy(&nValue, pRecord, sizeof(nValue));
+				if ((nValue < 0) || (nValue >= m_BinaryStringTable.Count()))
+				{
+					Q_snprintf(m_szErrorToken, sizeof( m_szErrorToken ), "string %d", nValue);
+					return(ChunkFile_UnexpectedSymbol);
+				}
+
+				m_nBinaryPos = (pRecord + sizeof(nValue)) - m_pBinaryBody;
+				*ppszValue = m_BinaryStringTable[nValue];
+
+				// Strings are kept as written, so unescape them the way the text readers would.
+				if (strchr(*ppszValue, '\\') != NULL)
+				{
+					UnescapeBinaryString(*ppszValue, m_szBinaryValue, sizeof(m_szBinaryValue));
+					*ppszValue = m_szBinaryValue;
+				}
+				break;
+			}
+
+			default:
+			{
+				int nValueSize = FormatTypedValue(eType, pRecord, nLeft, m_szBinaryValue, sizeof(m_szBinaryValue));
+				if (nValueSize < 0)
+				{
+					if (eType > BinaryChunk_Floats)
+					{
+						Q_snprintf(m_szErrorToken, sizeof( m_szErrorToken ), "record type %d", eType);
+						return(ChunkFile_UnexpectedSymbol);
+					}
+
+					return(ChunkFile_UnexpectedEOF);
+				}
+
+				m_nBinaryPos = (pRecord + nValueSize) - m_pBinaryBody;
+				*ppszValue = m_szBinaryValue;
+				break;
+			}
+		}
+
+		// Key value pair.
+		eChunkType = ChunkType_Key;
+		*ppszName = pszString;
+		return(ChunkFile_Ok);
+	}
+}
+
+
+//-----------------------------------------------------------------------------
+// Purpose: Writes out everything written to a binary file, or frees a binary
+//			file that was read.
+//-----------------------------------------------------------------------------
+ChunkFileResult_t CChunkFile::CloseBinary(void)
+{
+	ChunkFileResult_t eResult = ChunkFile_Ok;
+
+	if ((m_hFile != NULL) || (m_pBinaryOutput != NULL))
+	{
+		if (!m_BinaryBody.IsValid() || !m_BinaryStrings.IsValid())
+		{
+			eResult = ChunkFile_OutOfMemory;
+		}
+		else
+		{
+			BinaryChunkFileHeader_t Header;
+			Header.m_nIdent = BINARYCHUNKFILE_ID;
+			Header.m_nVersion = BINARYCHUNKFILE_VERSION;
+			Header.m_nStringCount = m_nBinaryStrings;
+			Header.m_nStringOffset = sizeof(Header);
+			Header.m_nIndexCount = m_BinaryIndex.Count();
+			Header.m_nIndexOffset = Header.m_nStringOffset + m_BinaryStrings.TellPut();
+			Header.m_nBodyOffset = Header.m_nIndexOffset + m_BinaryIndex.Count() * sizeof(BinaryChunkIndex_t);
+			Header.m_nBodySize = m_BinaryBody.TellPut();
+
+			if (m_pBinaryOutput != NULL)
+			{
+				m_pBinaryOutput->Put(&Header, sizeof(Header));
+				m_pBinaryOutput->Put(m_BinaryStrings.Base(), m_BinaryStrings.TellPut());
+				m_pBinaryOutput->Put(m_BinaryIndex.Base(), m_BinaryIndex.Count() * sizeof(BinaryChunkIndex_t));
+				m_pBinaryOutput->Put(m_BinaryBody.Base(), m_BinaryBody.TellPut());
+
+				if (!m_pBinaryOutput->IsValid())
+				{
+					eResult = ChunkFile_OutOfMemory;
+				}
+			}
+			else if ((fwrite(&Header, sizeof(Header), 1, m_hFile) != 1) ||
+				(fwrite(m_BinaryStrings.Base(), 1, m_BinaryStrings.TellPut(), m_hFile) != (size_t)m_BinaryStrings.TellPut()) ||
+				(fwrite(m_BinaryIndex.Base(), sizeof(BinaryChunkIndex_t), m_BinaryIndex.Count(), m_hFile) != (size_t)m_BinaryIndex.Count()) ||
+				(fwrite(m_BinaryBody.Base(), 1, m_BinaryBody.TellPut(), m_hFile) != (size_t)m_BinaryBody.TellPut()))
+			{
+				eResult = ChunkFile_Fail;
+			}
+		}
+	}
+
+	m_BinaryBody.Purge();
+	m_BinaryStrings.Purge();
+	m_BinaryStringIndex.Purge();
+	m_nBinaryStrings = 0;
+	m_BinaryIndex.Purge();
+
+	delete [] m_pBinaryFile;
+	m_pBinaryFile = NULL;
+	m_pBinaryBody = NULL;
+	m_nBinaryBodySize = 0;
+	m_BinaryStringTable.Purge();
+	m_pBinaryOutput = NULL;
+
+	m_bBinary = false;
+	m_bMapped = false;
+	return(eResult);
+}
+
+
+//-----------------------------------------------------------------------------
+// Purpose: Returns the name of a top-level chunk of a binary file, in the order
+//			they were written, along with where its records are in the body.
+//			Names are only known for files being read.
+//-----------------------------------------------------------------------------
+const char *CChunkFile::GetChunkIndex(int nIndex, int &nOffset, int &nSize)
+{
+	const BinaryChunkIndex_t &Index = m_BinaryIndex[nIndex];
+	nOffset = Index.m_nOffset;
+	nSize = Index.m_nSize;
+
+	if ((m_pBinaryFile == NULL) || (Index.m_nName < 0) || (Index.m_nName >= m_BinaryStringTable.Count()))
+	{
+		return("");
+	}
+
+	return(m_BinaryStringTable[Index.m_nName]);
+}
+
+
+//-----------------------------------------------------------------------------
+// Purpose: Copies the line records ahead of the read position, which readers
+//			never return, to the destination.
+//-----------------------------------------------------------------------------
+ChunkFileResult_t CChunkFile::CopyLines(CChunkFile *pDest)
+{
+	ChunkFileResult_t eResult = ChunkFile_Ok;
+
+	while (m_bBinary && (eResult == ChunkFile_Ok) && (m_nBinaryPos + 1 + (int)sizeof(int) <= m_nBinaryBodySize) &&
+		   (m_pBinaryBody[m_nBinaryPos] == BinaryChunk_Line))
+	{
+		int nString;
+		memcpy(&nString, m_pBinaryBody + m_nBinaryPos + 1, sizeof(nString));
+		if ((nString < 0) || (nString >= m_BinaryStringTable.Count()))
+		{
+			break;
+		}
+
+		eResult = pDest->WriteLine(m_BinaryStringTable[nString]);
+		m_nBinaryPos += 1 + sizeof(int);
+	}
+
+	return(eResult);
+}
+
+
+//-----------------------------------------------------------------------------
+// Purpose: Writes the record that ReadNextMapped just returned to another file.
+//			Binary files keep their typed values when copied to binary, and
+//			strings are copied as they were written rather than as they read back.
+// Input  : pDest - File being written.
+//			pszName, pszValue, eChunkType - What ReadNextMapped returned.
+//-----------------------------------------------------------------------------
+ChunkFileResult_t CChunkFile::CopyRecord(CChunkFile *pDest, const char *pszName, const char *pszValue, ChunkType_t eChunkType)
+{
+	if (eChunkType == ChunkType_Chunk)
+	{
+		return(pDest->BeginChunk(pszName));
+	}
+
+	if (m_bBinary)
+	{
+		int nRecord = m_nBinaryRecordPos;
+		int nDataStart = nRecord + 1 + sizeof(int);
+
+		if (m_pBinaryBody[nRecord] == BinaryChunk_String)
+		{
+			int nValue;
+			memcpy(&nValue, m_pBinaryBody + nDataStart, sizeof(nValue));
+			return(pDest->WriteKeyValue(pszName, m_BinaryStringTable[nValue]));
+		}
+
+		if (pDest->m_bBinary)
+		{
+			return(pDest->WriteBinaryKeyValue(pszName, (BinaryChunkRecord_t)m_pBinaryBody[nRecord], m_pBinaryBody + nDataStart, m_nBinaryPos - nDataStart));
+		}
+	}
+
+	return(pDest->WriteKeyValue(pszName, pszValue));
+}
+
+
+//-----------------------------------------------------------------------------
+// Purpose: Copies the rest of the chunk being read, including its end, to
+//			another file. At the top level this copies the rest of the file.
+//-----------------------------------------------------------------------------
+ChunkFileResult_t CChunkFile::CopyChunk(CChunkFile *pDest)
+{
+	int nDepth = m_nCurrentDepth;
+	ChunkFileResult_t eResult = ChunkFile_Ok;
+
+	while (eResult == ChunkFile_Ok)
+	{
+		eResult = CopyLines(pDest);
+		if (eResult != ChunkFile_Ok)
+		{
+			break;
+		}
+
+		const char *pszName;
+		const char *pszValue;
+		ChunkType_t eChunkType;
+		eResult = ReadNextMapped(&pszName, &pszValue, eChunkType);
+
+		if (eResult == ChunkFile_EndOfChunk)
+		{
+			eResult = pDest->EndChunk();
+			if ((eResult == ChunkFile_Ok) && (m_nCurrentDepth < nDepth))
+			{
+				break;
+			}
+		}
+		else if ((eResult == ChunkFile_EOF) && (nDepth == 0))
+		{
+			eResult = ChunkFile_Ok;
+			break;
+		}
+		else if (eResult == ChunkFile_Ok)
+		{
+			eResult = CopyRecord(pDest, pszName, pszValue, eChunkType);
+		}
+	}
+
+	return(eResult);
+}
+
+
+//-----------------------------------------------------------------------------
+// Purpose: Reads past the rest of the chunk being read, including its end.
+//			Binary files jump straight to the end.
+//-----------------------------------------------------------------------------
+ChunkFileResult_t CChunkFile::SkipChunk(void)
+{
+	if (m_nCurrentDepth == 0)
+	{
+		return(ChunkFile_Fail);
+	}
+
+	if (m_bBinary)
+	{
+		m_nBinaryPos = m_nBinaryChunkEnd[m_nCurrentDepth - 1];
+	}
+
+	int nDepth = m_nCurrentDepth;
+	ChunkFileResult_t eResult = ChunkFile_Ok;
+
+	while (eResult == ChunkFile_Ok)
+	{
+		const char *pszName;
+		const char *pszValue;
+		ChunkType_t eChunkType;
+		eResult = ReadNextMapped(&pszName, &pszValue, eChunkType);
+
+		if (eResult == ChunkFile_EndOfChunk)
+		{
+			eResult = ChunkFile_Ok;
+			if (m_nCurrentDepth < nDepth)
+			{
+				break;
+			}
+		}
+	}
+
+	return(eResult);
+}
+
+
+//-----------------------------------------------------------------------------
+// Purpose: Copies a chunk file into a new one, text to binary or back. Binary
+//			files keep their typed values and lines when copied to binary, and
+//			come out as the text they were written as when copied to text. Text
+//			files are copied key by key as strings, since that is all they hold.
+// Input  : pszSrcFileName - Text or binary chunk file to read.
+//			pszDestFileName - File to write.
+//			eMode - ChunkFile_Write or ChunkFile_WriteBinary.
+//-----------------------------------------------------------------------------
+ChunkFileResult_t CChunkFile::Convert(const char *pszSrcFileName, const char *pszDestFileName, ChunkFileOpenMode_t eMode)
+{
+	CChunkFile Src;
+	ChunkFileResult_t eResult = Src.Open(pszSrcFileName, ChunkFile_ReadMapped);
+	if (eResult != ChunkFile_Ok)
+	{
+		return(eResult);
+	}
+
+	CChunkFile Dest;
+	eResult = Dest.Open(pszDestFileName, eMode);
+	if (eResult == ChunkFile_Ok)
+	{
+		eResult = Src.CopyChunk(&Dest);
+	}
+
+	ChunkFileResult_t eCloseResult = Dest.Close();
+	if (eResult == ChunkFile_Ok)
+	{
+		eResult = eCloseResult;
+	}
+
+	Src.Close();
+	return(eResult);
+}
@@ -14,6 +14,9 @@
 
 #include <stdio.h>
 #include "tokenreader.h"
+#include "tier1/utlbuffer.h"
+#include "tier1/utlvector.h"
+#include "tier1/UtlStringMap.h"
 
 #define MAX_INDENT_DEPTH		80
 #define MAX_KEYVALUE_LEN		1024
@@ -32,6 +35,8 @@ enum ChunkFileOpenMode_t
 {
 	ChunkFile_Read = 0,
 	ChunkFile_Write,
+	ChunkFile_ReadMapped,		// Read through CMappedTokenReader instead of TokenReader.
+	ChunkFile_WriteBinary,		// Write the binary format below. Both read modes recognize it.
 };
 
 
@@ -60,6 +65,60 @@ enum ChunkType_t
 };
 
 
+//-----------------------------------------------------------------------------
+// Binary chunk file layout. The same chunks and keys as the text format, but
+// values written with the typed WriteKeyValue functions are stored as numbers
+// and every name and string value is stored once in a string table. Reading a
+// binary file hands the callbacks exactly the text the text format would have,
+// so the two convert into each other losslessly (see CChunkFile::Convert).
+// Everything is little endian.
+//-----------------------------------------------------------------------------
+#define BINARYCHUNKFILE_ID			(('B'<<24)+('F'<<16)+('M'<<8)+'V')
+#define BINARYCHUNKFILE_VERSION		1
+
+//
+// The body is a stream of records, each starting with one of these as a byte.
+// Key value records are followed by the key's string index, then the value.
+//
+enum BinaryChunkRecord_t
+{
+	BinaryChunk_Begin = 0,		// int name, int size of the chunk's records including its end record
+	BinaryChunk_End,
+	BinaryChunk_Line,			// int string; WriteLine text, only kept for the text form
+	BinaryChunk_String,			// int string
+	BinaryChunk_Int,			// int
+	BinaryChunk_Float,			// float
+	BinaryChunk_Color,			// 3 bytes
+	BinaryChunk_Point,			// 3 floats, written as "(x y z)"
+	BinaryChunk_Vector2,		// 2 floats, "[x y]"
+	BinaryChunk_Vector3,		// 3 floats, "[x y z]"
+	BinaryChunk_Vector4,		// 4 floats, "[x y z w]"
+	BinaryChunk_Plane,			// 9 floats, "(x y z) (x y z) (x y z)"
+	BinaryChunk_TextureAxis,	// 5 floats, "[x y z w] scale"
+	BinaryChunk_IndexedPoint,	// int, 3 floats, "i x y z"
+	BinaryChunk_Floats,			// unsigned short count, that many floats separated by spaces
+};
+
+struct BinaryChunkFileHeader_t
+{
+	int m_nIdent;				// BINARYCHUNKFILE_ID
+	int m_nVersion;				// BINARYCHUNKFILE_VERSION
+	int m_nStringCount;
+	int m_nStringOffset;		// Null terminated strings, in index order.
+	int m_nIndexCount;
+	int m_nIndexOffset;			// A BinaryChunkIndex_t for every top-level chunk.
+	int m_nBodyOffset;
+	int m_nBodySize;
+};
+
+struct BinaryChunkIndex_t
+{
+	int m_nName;				// String index.
+	int m_nOffset;				// Of the chunk's begin record, from the start of the body.
+	int m_nSize;				// Up to and including its end record.
+};
+
+
 typedef ChunkFileResult_t (*DefaultChunkHandler_t)(CChunkFile *pFile, void *pData, char const *pChunkName);
 
 typedef ChunkFileResult_t (*ChunkHandler_t)(CChunkFile *pFile, void *pData);
@@ -126,6 +185,57 @@ class CChunkHandlerMap
 };
 
 
+//-----------------------------------------------------------------------------
+// Tokenizer for ChunkFile_ReadMapped. The file is mapped copy-on-write and each
+// token is terminated (and unescaped) in place, so NextToken hands back pointers
+// into the view rather than copying every character out of a stream. Tokens stay
+// valid until Close. Accepts the same syntax as TokenReader and keeps the line
+// count for error reporting.
+//-----------------------------------------------------------------------------
+class CMappedTokenReader
+{
+	public:
+
+		CMappedTokenReader(void);
+		~CMappedTokenReader(void);
+
+		bool Open(const char *pszFileName);
+		void Close(void);
+
+		trtoken_t NextToken(const char **ppszToken, int nMaxLen);
+		const char *Error(const char *pszError);
+
+		inline int GetLine(void) const { return(m_nLine); }
+
+	protected:
+
+		bool SkipWhiteSpace(void);
+		trtoken_t GetString(const char **ppszToken, int nMaxLen);
+		const char *CopyToken(const char *pchStart, int nLen);
+
+		char *m_pView;
+		int m_nViewSize;
+		char *m_pCur;					// Next unread character.
+		char *m_pEnd;
+
+		bool m_bOpen;
+		int m_nLine;
+		char m_szFileName[128];
+
+		// Tokens that can't be terminated in place, such as an identifier that runs
+		// straight into a brace, are copied here. Two of them so that a key and its
+		// value can both be live.
+		char m_szCopy[2][MAX_KEYVALUE_LEN];
+		int m_nNextCopy;
+		char m_szOperator[2];
+
+#ifdef _WIN32
+		void *m_hFile;
+		void *m_hMapping;
+#endif
+};
+
+
 class CChunkFile
 {
 	public:
@@ -135,6 +245,14 @@ class CChunkFile
 
 		ChunkFileResult_t Open(const char *pszFileName, ChunkFileOpenMode_t eMode);
 		ChunkFileResult_t Close(void);
+
+		// Binary files only. Reads a file image from the buffer, or with ChunkFile_WriteBinary
+		// puts one into it on Close.
+		ChunkFileResult_t Open(CUtlBuffer &Buffer, ChunkFileOpenMode_t eMode);
+
+		// Returns the size of the binary file image at the start of pData, or -1 if there
+		// isn't a whole one there. For splitting up images that were written back to back.
+		static int GetBinaryFileSize(const void *pData, int nDataSize);
 		const char *GetErrorText(ChunkFileResult_t eResult);
 
 		//
@@ -152,11 +270,34 @@ class CChunkFile
 		ChunkFileResult_t WriteKeyValueVector2(const char *pszKey, const Vector2D &vec);
 		ChunkFileResult_t WriteKeyValueVector3(const char *pszKey, const Vector &vec);
 		ChunkFileResult_t WriteKeyValueVector4( const char *pszKey, const Vector4D &vec);
+		ChunkFileResult_t WriteKeyValuePlane(const char *pszKey, const Vector &Point0, const Vector &Point1, const Vector &Point2);
+		ChunkFileResult_t WriteKeyValueTextureAxis(const char *pszKey, const Vector4D &vecAxis, float flScale);
+		ChunkFileResult_t WriteKeyValueIndexedPoint(const char *pszKey, int nIndex, const Vector &Point);
+		ChunkFileResult_t WriteKeyValueFloats(const char *pszKey, const float *pflValues, int nCount);
 
+		// In binary files lines are only kept for the text form, readers never see them.
 		ChunkFileResult_t WriteLine(const char *pszLine);
 
+		// Copies a text or binary chunk file into a new file written with eMode.
+		static ChunkFileResult_t Convert(const char *pszSrcFileName, const char *pszDestFileName, ChunkFileOpenMode_t eMode);
+
 		//
-		// Functions for reading chunk files.
+		// Functions for rewriting chunk files without loading them. The source must be opened
+		// with ChunkFile_ReadMapped. CopyRecord copies the record ReadNextMapped just returned,
+		// CopyChunk and SkipChunk take care of the rest of the chunk that is being read.
+		//
+		ChunkFileResult_t CopyRecord(CChunkFile *pDest, const char *pszName, const char *pszValue, ChunkType_t eChunkType);
+		ChunkFileResult_t CopyChunk(CChunkFile *pDest);
+		ChunkFileResult_t SkipChunk(void);
+
+		inline bool IsBinary(void) const { return(m_bBinary); }
+		inline int GetChunkIndexCount(void) const { return(m_BinaryIndex.Count()); }
+		const char *GetChunkIndex(int nIndex, int &nOffset, int &nSize);
+
+		//
+		// Functions for reading chunk files. With ChunkFile_ReadMapped the key and value
+		// strings handed to callbacks point into the file mapping and are only valid
+		// until Close. Binary files are always read that way.
 		//
 		template <typename T1, typename T2>
 		FORCEINLINE auto ReadChunk( ChunkFileResult_t (*pfnKeyHandler)( const char*, const char*, T1* ), T2* pData ) -> std::enable_if_t<__is_base_of( T1, T2 ), ChunkFileResult_t>
@@ -166,6 +307,7 @@ class CChunkFile
 
 		ChunkFileResult_t ReadChunk(KeyHandler_t pfnKeyHandler = NULL, void *pData = NULL);
 		ChunkFileResult_t ReadNext(char *szKey, char *szValue, int nValueSize, ChunkType_t &eChunkType);
+		ChunkFileResult_t ReadNextMapped(const char **ppszKey, const char **ppszValue, ChunkType_t &eChunkType);
 		ChunkFileResult_t HandleChunk(const char *szChunkName);
 		void HandleError(const char *szChunkName, ChunkFileResult_t eError);
 
@@ -201,7 +343,44 @@ class CChunkFile
 
 		void BuildIndentString(char *pszDest, int nDepth);
 
+		ChunkFileResult_t OpenBinary(const char *pszFileName);
+		ChunkFileResult_t ParseBinary(int nFileSize);
+		ChunkFileResult_t CopyLines(CChunkFile *pDest);
+		ChunkFileResult_t ReadNextBinary(const char **ppszName, const char **ppszValue, ChunkType_t &eChunkType);
+		ChunkFileResult_t CloseBinary(void);
+		ChunkFileResult_t WriteBinaryKeyValue(const char *pszKey, BinaryChunkRecord_t eType, const void *pData, int nSize);
+		ChunkFileResult_t WriteTypedKeyValue(const char *pszKey, BinaryChunkRecord_t eType, const void *pData, int nSize);
+		int AddBinaryString(const char *pszString);
+
 		TokenReader m_TokenReader;
+		CMappedTokenReader m_MappedReader;
+		bool m_bMapped;					// Opened with ChunkFile_ReadMapped, or binary.
+		bool m_bBinary;					// Opened with ChunkFile_WriteBinary, or read a binary file.
+
+		//
+		// Binary writing. Everything is kept in memory and written out by Close.
+		//
+		CUtlBuffer *m_pBinaryOutput;	// Image goes here instead of to m_hFile.
+		CUtlBuffer m_BinaryBody;
+		CUtlBuffer m_BinaryStrings;
+		CUtlStringMap<int> m_BinaryStringIndex;
+		int m_nBinaryStrings;
+		int m_nBinaryChunkStart[MAX_INDENT_DEPTH];	// Offset of each open chunk's size.
+
+		//
+		// Binary reading. The whole file is read into memory.
+		//
+		char *m_pBinaryFile;
+		const unsigned char *m_pBinaryBody;
+		int m_nBinaryBodySize;
+		int m_nBinaryPos;
+		int m_nBinaryRecordPos;			// Start of the record most recently read.
+		int m_nBinaryChunkEnd[MAX_INDENT_DEPTH];	// End record of each chunk being read.
+		CUtlVector<const char *> m_BinaryStringTable;
+		char m_szBinaryValue[MAX_KEYVALUE_LEN];
+		char m_szBinaryFileName[128];
+
+		CUtlVector<BinaryChunkIndex_t> m_BinaryIndex;	// Both ways.
 
 		FILE *m_hFile;
 		char m_szErrorToken[80];
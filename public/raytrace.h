@@ -16,6 +16,11 @@
 // fast SSE-ONLY ray tracing module. Based upon various "real time ray tracing" research.
 //#define DEBUG_RAYTRACE 1
 
+// the wide packet kernel in trace_avx.cpp is only built for win32
+#if defined( _WIN32 ) && !defined( _X360 ) && !defined( _WIN64 )
+#define RAYTRACE_HAS_AVX 1
+#endif
+
 class FourRays
 {
 public:
@@ -133,6 +138,10 @@ struct CacheOptimizedTriangle
 #define KDNODE_STATE_ZSPLIT 2								// this node is a zsplit
 #define KDNODE_STATE_LEAF 3									// this node is a leaf
 
+#define MAILBOX_HASH_SIZE 256
+#define MAX_TREE_DEPTH 21
+#define MAX_NODE_STACK_LEN (40*MAX_TREE_DEPTH)
+
 struct CacheOptimizedKDNode
 {
 	// this is the cache intensive data structure. "Tricks" are used to fit it into 8 bytes:
@@ -220,6 +229,9 @@ public:
 #define RTE_FLAGS_FAST_TREE_GENERATION 1
 #define RTE_FLAGS_DONT_STORE_TRIANGLE_COLORS 2				// saves memory if not needed
 #define RTE_FLAGS_DONT_STORE_TRIANGLE_MATERIALS 4
+#define RTE_FLAGS_REFERENCE_TREE_GENERATION 8				// use the exhaustive single-threaded
+															// kd-tree builder instead of the
+															// binned one
 
 enum RayTraceLightingMode_t {
 	DIRECT_LIGHTING,										// just dot product lighting
@@ -257,6 +269,8 @@ class RayTracingEnvironment
 {
 public:
 	uint32 Flags;											// RTE_FLAGS_xxx above
+	int m_nBuildThreads;									// threads used to build the kd-tree.
+															// 0 = one per logical processor
 	Vector m_MinBound;
 	Vector m_MaxBound;
 
@@ -273,6 +287,7 @@ public:
 	{
 		BackgroundColor.DuplicateVector(Vector(1,0,0));		// red
 		Flags=0;
+		m_nBuildThreads=0;
 	}
 
 
@@ -297,6 +312,18 @@ public:
 	// SetupAccelerationStructure to prepare for tracing
 	void SetupAccelerationStructure(void);
 
+	// same, but reuses the tree saved in pCacheFilename when it was built from the same
+	// triangles, and saves the tree there when it wasn't.
+	void SetupAccelerationStructure(const char *pCacheFilename);
+
+	// hash of the triangles as added, before SetupAccelerationStructure changes their format.
+	uint32 CalculateGeometryHash(void);
+
+	// save a built acceleration structure / load one into an environment holding the same
+	// triangles it was built from. Load fails if the hash or the triangle count don't match.
+	bool SaveAccelerationStructure(const char *pFilename, uint32 nGeometryHash);
+	bool LoadAccelerationStructure(const char *pFilename, uint32 nGeometryHash);
+
 
 	// lowest level intersection routine - fire 4 rays through the scene. all 4 rays must pass the
 	// Check() function, and t extents must be initialized. skipid can be set to exclude a
@@ -310,6 +337,21 @@ public:
 					RayTracingResult *rslt_out,
 					int32 skip_id=-1, ITransparentTriangleCallback *pCallback = NULL);
 
+	// trace 2 or 4 groups of FourRays (8 or 16 rays) at once. Groups whose direction signs
+	// match are traversed together by the AVX kernel when the cpu has one, the rest go through
+	// Trace4Rays. Results match Trace4Rays ray for ray, apart from which of two equidistant
+	// triangles gets reported.
+	void TraceRayPacket(int nGroups, const FourRays *pRays, fltx4 TMin, const fltx4 *pTMax,
+						RayTracingResult *pResults, int32 skip_id=-1);
+
+	// true when TraceRayPacket has a kernel wider than Trace4Rays built in and this cpu can run it
+	static bool HasWideRayPackets(void);
+
+	// AVX kernel behind TraceRayPacket. all groups must have the same DirectionSignMask.
+	void TraceRayPacketAVX(int nGroups, const FourRays *pRays, const FourVectors *pOneOverRayDir,
+						   fltx4 TMin, const fltx4 *pTMax, int DirectionSignMask,
+						   RayTracingResult *pResults, int32 skip_id);
+
 	// compute virtual light sources to model inter-reflection
 	void ComputeVirtualLightSources(void);
 
@@ -356,6 +398,10 @@ public:
 	void CalculateTriangleListBounds(int32 const *tris,int ntris,
 									 Vector &minout, Vector &maxout);
 
+	// binned surface area heuristic builder used by SetupAccelerationStructure unless
+	// RTE_FLAGS_REFERENCE_TREE_GENERATION is set. Builds the same node layout as RefineNode.
+	void BuildBinnedKDTree(int32 const *tri_list,int ntris);
+
 	void AddInfinitePointLight(Vector position,				// light center
 							   Vector intensity);			// rgb amount
 
@@ -386,5 +432,10 @@ public:
 };
 
 
+// builds the same synthetic triangle soup with the reference and the binned kd-tree builders,
+// then reports build time, trace rate and how many of the traced rays disagree between the two,
+// and the trace rate of 4, 8 and 16 ray packets.
+void RunRayTraceBenchmark( int nTriangles, int nRays, int nBuildThreads = 0 );
+
 
 #endif
@@ -5,6 +5,8 @@
 #include <filesystem_tools.h>
 #include <cmdlib.h>
 #include <stdio.h>
+#include <tier0/threadtools.h>
+#include <tier1/processor_detect.h>
 
 static bool SameSign(float a, float b)
 {
@@ -253,10 +255,6 @@ int CacheOptimizedTriangle::ClassifyAgainstAxisSplit(int split_plane, float spli
 	return PLANECHECK_STRADDLING;
 }
 
-#define MAILBOX_HASH_SIZE 256
-#define MAX_TREE_DEPTH 21
-#define MAX_NODE_STACK_LEN (40*MAX_TREE_DEPTH)
-
 struct NodeToVisit {
 	CacheOptimizedKDNode const *node;
 	fltx4 TMin;
@@ -342,6 +340,96 @@ void RayTracingEnvironment::Trace4Rays(const FourRays &rays, fltx4 TMin, fltx4 T
 }
 
 
+#ifdef RAYTRACE_HAS_AVX
+static int s_nWideRayPackets = -1;							// -1 = haven't asked the cpu yet
+#endif
+
+bool RayTracingEnvironment::HasWideRayPackets(void)
+{
+#ifdef RAYTRACE_HAS_AVX
+	if (s_nWideRayPackets == -1)
+		s_nWideRayPackets = CheckAVXTechnology() ? 1 : 0;
+	return (s_nWideRayPackets != 0);
+#else
+	// the cpu may well have AVX (processor_detect_linux.cpp asks it), but the kernel isn't built
+	return false;
+#endif
+}
+
+
+void RayTracingEnvironment::TraceRayPacket(int nGroups, const FourRays *pRays, fltx4 TMin,
+										   const fltx4 *pTMax, RayTracingResult *pResults,
+										   int32 skip_id)
+{
+	Assert((nGroups == 2) || (nGroups == 4));
+	if (! HasWideRayPackets())
+	{
+		for(int g=0;g<nGroups;g++)
+			Trace4Rays(pRays[g],TMin,pTMax[g],pResults+g,skip_id);
+		return;
+	}
+
+	FourVectors OneOverRayDir[4];
+	int msk[4];
+	bool all_same=true;
+	for(int g=0;g<nGroups;g++)
+	{
+		msk[g]=pRays[g].CalculateDirectionSignMask();
+		all_same = all_same && (msk[g]!=-1) && (msk[g]==msk[0]);
+	}
+	if (all_same)
+	{
+		for(int g=0;g<nGroups;g++)
+		{
+			OneOverRayDir[g]=pRays[g].direction;
+			OneOverRayDir[g].MakeReciprocalSaturate();
+		}
+		TraceRayPacketAVX(nGroups,pRays,OneOverRayDir,TMin,pTMax,msk[0],pResults,skip_id);
+		return;
+	}
+
+	// pair up groups heading into the same octant, and send whatever is left 4 at a time
+	bool done[4]={false,false,false,false};
+	for(int g=0;g<nGroups;g++)
+	{
+		if (done[g])
+			continue;
+		done[g]=true;
+		int partner=-1;
+		if (msk[g]!=-1)
+		{
+			for(int h=g+1;h<nGroups;h++)
+				if ((! done[h]) && (msk[h]==msk[g]))
+				{
+					partner=h;
+					break;
+				}
+		}
+		if (partner==-1)
+		{
+			Trace4Rays(pRays[g],TMin,pTMax[g],pResults+g,skip_id);
+			continue;
+		}
+		done[partner]=true;
+		FourRays pair[2];
+		fltx4 pair_tmax[2];
+		RayTracingResult pair_results[2];
+		pair[0]=pRays[g];
+		pair[1]=pRays[partner];
+		pair_tmax[0]=pTMax[g];
+		pair_tmax[1]=pTMax[partner];
+		for(int i=0;i<2;i++)
+		{
+			OneOverRayDir[i]=pair[i].direction;
+			OneOverRayDir[i].MakeReciprocalSaturate();
+		}
+		TraceRayPacketAVX(2,pair,OneOverRayDir,TMin,pair_tmax,msk[g],pair_results,skip_id);
+		pResults[g]=pair_results[0];
+		pResults[partner]=pair_results[1];
+	}
+}
+
+
 void RayTracingEnvironment::Trace4Rays(const FourRays &rays, fltx4 TMin, fltx4 TMax,
 									   int DirectionSignMask, RayTracingResult *rslt_out,
 									   int32 skip_id, ITransparentTriangleCallback *pCallback)
@@ -869,6 +957,535 @@ void RayTracingEnvironment::RefineNode(int node_number,int32 const *tri_list,int
 }
 
 
+//-----------------------------------------------------------------------------
+// Binned SAH kd-tree builder.
+//
+// RefineNode evaluates CalculateCostsOfSplit at every tenth triangle vertex on each axis, which
+// is quadratic in the number of triangles in a node. The binned builder instead drops each
+// triangle's extents into KDBUILD_NUM_BINS buckets per axis and evaluates the same cost formula
+// at every bucket boundary, plus the two planes at the extents of the triangle list (which
+// takes care of "growing" empty space the way the regular builder does).
+//
+// The top of the tree is built on the calling thread, with the binning pass of very large nodes
+// spread over all threads. Once a node gets small enough it is deferred as a task. Tasks build
+// their subtree into private lists, largest first, and are spliced into OptimizedKDTree at the
+// end. Children are still stored in adjacent pairs and leaves still index TriangleIndexList, so
+// Trace4Rays doesn't know which builder made the tree.
+//-----------------------------------------------------------------------------
+
+#define KDBUILD_NUM_BINS 32
+#define KDBUILD_PARALLEL_BIN_TRIS 65536						// nodes bigger than this bin in parallel
+#define KDBUILD_MIN_TASK_TRIS 1024							// smallest subtree worth its own task
+#define KDBUILD_TASKS_PER_THREAD 8
+#define KDBUILD_MAX_THREADS 64
+
+struct KDBuildBins_t
+{
+	int m_nEntering[3][KDBUILD_NUM_BINS];					// # of triangles whose low extent is in
+															// this bin
+	int m_nLeaving[3][KDBUILD_NUM_BINS];					// # of triangles whose high extent is in
+															// this bin
+	Vector m_ListMins;										// extents of the triangles, clipped to
+	Vector m_ListMaxs;										// the node
+};
+
+struct KDBuildTask_t
+{
+	int m_nNode;											// node in OptimizedKDTree the subtree
+															// replaces
+	int32 *m_pTriangles;
+	int m_nTriangles;
+	Vector m_MinBound;
+	Vector m_MaxBound;
+	int m_nDepth;
+
+	CUtlVector<CacheOptimizedKDNode> m_Nodes;				// m_Nodes[0] is the subtree root
+	CUtlVector<int32> m_TriangleIndices;
+};
+
+static int __cdecl CompareKDBuildTasks( KDBuildTask_t * const *ppLeft, KDBuildTask_t * const *ppRight )
+{
+	return (*ppRight)->m_nTriangles - (*ppLeft)->m_nTriangles;
+}
+
+class CKDTreeBuilder
+{
+public:
+	CKDTreeBuilder( RayTracingEnvironment *pEnv, int nThreads );
+	~CKDTreeBuilder();
+
+	void Build( int32 const *pTriangles, int nTriangles );
+
+private:
+	typedef void (CKDTreeBuilder::*JobFn_t)( int iJob );
+
+	void RefineNode( CUtlVector<CacheOptimizedKDNode> &nodes, CUtlVector<int32> &triangleIndices,
+					 int nNode, int32 const *pTriangles, int nTriangles,
+					 Vector const &MinBound, Vector const &MaxBound, int nDepth, bool bTopLevel );
+	void MakeLeaf( CUtlVector<CacheOptimizedKDNode> &nodes, CUtlVector<int32> &triangleIndices,
+				   int nNode, int32 const *pTriangles, int nTriangles,
+				   Vector const &MinBound, Vector const &MaxBound );
+
+	void BinTriangles( int32 const *pTriangles, int nTriangles, Vector const &MinBound,
+					   Vector const &MaxBound, KDBuildBins_t &bins ) const;
+	void BinTrianglesParallel( int32 const *pTriangles, int nTriangles, Vector const &MinBound,
+							   Vector const &MaxBound, KDBuildBins_t &bins );
+	float FindBestSplit( KDBuildBins_t const &bins, int nTriangles, Vector const &MinBound,
+						 Vector const &MaxBound, int &nSplitPlane, float &flSplitValue ) const;
+
+	void BinSliceJob( int iJob );
+	void BuildTaskJob( int iJob );
+	void SpliceTask( KDBuildTask_t *pTask );
+
+	void RunJobs( JobFn_t pfnJob, int nJobs );
+	void DoJobs();
+	static unsigned JobThreadFn( void *pParam );
+
+	RayTracingEnvironment *m_pEnv;
+	int m_nThreads;
+	int m_nTaskTriangles;									// top level nodes at or below this size
+															// become tasks
+	Vector *m_pTriMins;										// bounds of each triangle
+	Vector *m_pTriMaxs;
+	CUtlVector<KDBuildTask_t *> m_Tasks;
+
+	// state for the job currently being run by RunJobs
+	JobFn_t m_pfnJob;
+	int m_nJobs;
+	int volatile m_iNextJob;
+
+	// state for BinSliceJob
+	int32 const *m_pBinTriangles;
+	int m_nBinTriangles;
+	Vector m_BinMins;
+	Vector m_BinMaxs;
+	KDBuildBins_t *m_pSliceBins;
+};
+
+
+CKDTreeBuilder::CKDTreeBuilder( RayTracingEnvironment *pEnv, int nThreads )
+{
+	m_pEnv = pEnv;
+	if ( nThreads <= 0 )
+		nThreads = GetCPUInformation()->m_nLogicalProcessors;
+	m_nThreads = clamp( nThreads, 1, KDBUILD_MAX_THREADS );
+	m_nTaskTriangles = 0;
+	m_pfnJob = NULL;
+	m_nJobs = 0;
+	m_iNextJob = 0;
+	m_pBinTriangles = NULL;
+	m_nBinTriangles = 0;
+	m_pSliceBins = NULL;
+
+	int nTotal = pEnv->OptimizedTriangleList.Count();
+	m_pTriMins = new Vector[ max( nTotal, 1 ) ];
+	m_pTriMaxs = new Vector[ max( nTotal, 1 ) ];
+	for ( int i = 0; i < nTotal; i++ )
+	{
+		CacheOptimizedTriangle const &tri = pEnv->OptimizedTriangleList[i];
+		Vector &mins = m_pTriMins[i];
+		Vector &maxs = m_pTriMaxs[i];
+		mins = maxs = tri.Vertex( 0 );
+		for ( int v = 1; v < 3; v++ )
+		{
+			VectorMin( mins, tri.Vertex( v ), mins );
+			VectorMax( maxs, tri.Vertex( v ), maxs );
+		}
+	}
+}
+
+
+CKDTreeBuilder::~CKDTreeBuilder()
+{
+	delete[] m_pTriMins;
+	delete[] m_pTriMaxs;
+	m_Tasks.PurgeAndDeleteElements();
+}
+
+
+void CKDTreeBuilder::Build( int32 const *pTriangles, int nTriangles )
+{
+	// only hand out tasks when there is somebody to run them
+	if ( m_nThreads > 1 )
+		m_nTaskTriangles = max( KDBUILD_MIN_TASK_TRIS, nTriangles / ( m_nThreads * KDBUILD_TASKS_PER_THREAD ) );
+
+	CUtlVector<CacheOptimizedKDNode> &tree = m_pEnv->OptimizedKDTree;
+	RefineNode( tree, m_pEnv->TriangleIndexList, tree.Count() - 1, pTriangles, nTriangles,
+				m_pEnv->m_MinBound, m_pEnv->m_MaxBound, 0, true );
+
+	if ( !m_Tasks.Count() )
+		return;
+
+	m_Tasks.Sort( CompareKDBuildTasks );
+	RunJobs( &CKDTreeBuilder::BuildTaskJob, m_Tasks.Count() );
+
+	// splice in task order so the result doesn't depend on which thread finished first
+	for ( int i = 0; i < m_Tasks.Count(); i++ )
+		SpliceTask( m_Tasks[i] );
+}
+
+
+void CKDTreeBuilder::MakeLeaf( CUtlVector<CacheOptimizedKDNode> &nodes, CUtlVector<int32> &triangleIndices,
+							   int nNode, int32 const *pTriangles, int nTriangles,
+							   Vector const &MinBound, Vector const &MaxBound )
+{
+	nodes[nNode].Children = KDNODE_STATE_LEAF + ( triangleIndices.Count() << 2 );
+	nodes[nNode].SetNumberOfTrianglesInLeafNode( nTriangles );
+#ifdef DEBUG_RAYTRACE
+	nodes[nNode].vecMins = MinBound;
+	nodes[nNode].vecMaxs = MaxBound;
+#endif
+	triangleIndices.AddMultipleToTail( nTriangles, pTriangles );
+}
+
+
+void CKDTreeBuilder::RefineNode( CUtlVector<CacheOptimizedKDNode> &nodes, CUtlVector<int32> &triangleIndices,
+								 int nNode, int32 const *pTriangles, int nTriangles,
+								 Vector const &MinBound, Vector const &MaxBound, int nDepth, bool bTopLevel )
+{
+	if ( nTriangles < 3 )									// never split empty lists
+	{
+		MakeLeaf( nodes, triangleIndices, nNode, pTriangles, nTriangles, MinBound, MaxBound );
+		return;
+	}
+
+	if ( bTopLevel && ( nTriangles <= m_nTaskTriangles ) )
+	{
+		// leave the node as a placeholder and build the rest of this subtree later
+		KDBuildTask_t *pTask = new KDBuildTask_t;
+		pTask->m_nNode = nNode;
+		pTask->m_pTriangles = new int32[nTriangles];
+		memcpy( pTask->m_pTriangles, pTriangles, nTriangles * sizeof( int32 ) );
+		pTask->m_nTriangles = nTriangles;
+		pTask->m_MinBound = MinBound;
+		pTask->m_MaxBound = MaxBound;
+		pTask->m_nDepth = nDepth;
+		m_Tasks.AddToTail( pTask );
+		return;
+	}
+
+	KDBuildBins_t bins;
+	if ( bTopLevel && ( m_nThreads > 1 ) && ( nTriangles > KDBUILD_PARALLEL_BIN_TRIS ) )
+		BinTrianglesParallel( pTriangles, nTriangles, MinBound, MaxBound, bins );
+	else
+		BinTriangles( pTriangles, nTriangles, MinBound, MaxBound, bins );
+
+	int nSplitPlane = 0;
+	float flSplitValue = 0;
+	float flBestCost = FindBestSplit( bins, nTriangles, MinBound, MaxBound, nSplitPlane, flSplitValue );
+	float flCostOfNoSplit = COST_OF_INTERSECTION * nTriangles;
+	if ( ( flCostOfNoSplit <= flBestCost ) || NEVER_SPLIT || ( nDepth > MAX_TREE_DEPTH ) )
+	{
+		// no benefit to splitting. just make this a leaf node
+		MakeLeaf( nodes, triangleIndices, nNode, pTriangles, nTriangles, MinBound, MaxBound );
+		return;
+	}
+
+	// classify exactly the way CacheOptimizedTriangle::ClassifyAgainstAxisSplit does; the bins
+	// only estimated the counts.
+	signed char *pSide = new signed char[nTriangles];
+	int nLeft = 0, nRight = 0, nBoth = 0;
+	for ( int t = 0; t < nTriangles; t++ )
+	{
+		float flMin = m_pTriMins[pTriangles[t]][nSplitPlane];
+		float flMax = m_pTriMaxs[pTriangles[t]][nSplitPlane];
+		if ( flMin >= flSplitValue )
+		{
+			pSide[t] = PLANECHECK_POSITIVE;
+			nRight++;
+		}
+		else if ( flMax <= flSplitValue )
+		{
+			pSide[t] = PLANECHECK_NEGATIVE;
+			nLeft++;
+		}
+		else
+		{
+			pSide[t] = PLANECHECK_STRADDLING;
+			nBoth++;
+		}
+	}
+
+	// lay the list out as left, both, right so each child's list is contiguous
+	int32 *pNewTriangles = new int32[nTriangles];
+	int nLeftOut = 0, nBothOut = 0, nRightOut = 0;
+	for ( int t = 0; t < nTriangles; t++ )
+	{
+		switch ( pSide[t] )
+		{
+			case PLANECHECK_NEGATIVE:
+				pNewTriangles[nLeftOut++] = pTriangles[t];
+				break;
+			case PLANECHECK_POSITIVE:
+				pNewTriangles[nTriangles - ( ++nRightOut )] = pTriangles[t];
+				break;
+			case PLANECHECK_STRADDLING:
+				pNewTriangles[nLeft + ( nBothOut++ )] = pTriangles[t];
+				break;
+		}
+	}
+	delete[] pSide;
+
+	Vector LeftMins = MinBound;
+	Vector LeftMaxes = MaxBound;
+	Vector RightMins = MinBound;
+	Vector RightMaxes = MaxBound;
+	LeftMaxes[nSplitPlane] = flSplitValue;
+	RightMins[nSplitPlane] = flSplitValue;
+
+	int nLeftChild = nodes.Count();
+	nodes[nNode].Children = nSplitPlane + ( nLeftChild << 2 );
+	nodes[nNode].SplittingPlaneValue = flSplitValue;
+#ifdef DEBUG_RAYTRACE
+	nodes[nNode].vecMins = MinBound;
+	nodes[nNode].vecMaxs = MaxBound;
+#endif
+	CacheOptimizedKDNode newnode;
+	nodes.AddToTail( newnode );
+	nodes.AddToTail( newnode );
+
+	if ( ( nTriangles < 20 ) && ( ( nLeft == 0 ) || ( nRight == 0 ) ) )
+		nDepth += 100;
+	RefineNode( nodes, triangleIndices, nLeftChild, pNewTriangles, nLeft + nBoth,
+				LeftMins, LeftMaxes, nDepth + 1, bTopLevel );
+	RefineNode( nodes, triangleIndices, nLeftChild + 1, pNewTriangles + nLeft, nRight + nBoth,
+				RightMins, RightMaxes, nDepth + 1, bTopLevel );
+	delete[] pNewTriangles;
+}
+
+
+void CKDTreeBuilder::BinTriangles( int32 const *pTriangles, int nTriangles, Vector const &MinBound,
+								   Vector const &MaxBound, KDBuildBins_t &bins ) const
+{
+	memset( bins.m_nEntering, 0, sizeof( bins.m_nEntering ) );
+	memset( bins.m_nLeaving, 0, sizeof( bins.m_nLeaving ) );
+	bins.m_ListMins = MaxBound;
+	bins.m_ListMaxs = MinBound;
+
+	Vector vecBinScale;
+	for ( int c = 0; c < 3; c++ )
+	{
+		float flWidth = MaxBound[c] - MinBound[c];
+		vecBinScale[c] = ( flWidth > 0 ) ? ( KDBUILD_NUM_BINS / flWidth ) : 0;
+	}
+
+	for ( int t = 0; t < nTriangles; t++ )
+	{
+		Vector const &triMins = m_pTriMins[pTriangles[t]];
+		Vector const &triMaxs = m_pTriMaxs[pTriangles[t]];
+		for ( int c = 0; c < 3; c++ )
+		{
+			// triangles that straddled a parent's plane hang out of the node
+			float flMin = max( triMins[c], MinBound[c] );
+			float flMax = min( triMaxs[c], MaxBound[c] );
+			bins.m_ListMins[c] = min( bins.m_ListMins[c], flMin );
+			bins.m_ListMaxs[c] = max( bins.m_ListMaxs[c], flMax );
+
+			int nEnter = clamp( (int)( ( flMin - MinBound[c] ) * vecBinScale[c] ), 0, KDBUILD_NUM_BINS - 1 );
+			int nLeave = clamp( (int)( ( flMax - MinBound[c] ) * vecBinScale[c] ), 0, KDBUILD_NUM_BINS - 1 );
+			bins.m_nEntering[c][nEnter]++;
+			bins.m_nLeaving[c][nLeave]++;
+		}
+	}
+}
+
+
+void CKDTreeBuilder::BinSliceJob( int iJob )
+{
+	int nFirst = ( m_nBinTriangles * iJob ) / m_nJobs;
+	int nEnd = ( m_nBinTriangles * ( iJob + 1 ) ) / m_nJobs;
+	BinTriangles( m_pBinTriangles + nFirst, nEnd - nFirst, m_BinMins, m_BinMaxs, m_pSliceBins[iJob] );
+}
+
+
+void CKDTreeBuilder::BinTrianglesParallel( int32 const *pTriangles, int nTriangles, Vector const &MinBound,
+										   Vector const &MaxBound, KDBuildBins_t &bins )
+{
+	KDBuildBins_t sliceBins[KDBUILD_MAX_THREADS];
+	m_pBinTriangles = pTriangles;
+	m_nBinTriangles = nTriangles;
+	m_BinMins = MinBound;
+	m_BinMaxs = MaxBound;
+	m_pSliceBins = sliceBins;
+	RunJobs( &CKDTreeBuilder::BinSliceJob, m_nThreads );
+	m_pSliceBins = NULL;
+
+	bins = sliceBins[0];
+	for ( int i = 1; i < m_nThreads; i++ )
+	{
+		for ( int c = 0; c < 3; c++ )
+		{
+			for ( int b = 0; b < KDBUILD_NUM_BINS; b++ )
+			{
+				bins.m_nEntering[c][b] += sliceBins[i].m_nEntering[c][b];
+				bins.m_nLeaving[c][b] += sliceBins[i].m_nLeaving[c][b];
+			}
+		}
+		VectorMin( bins.m_ListMins, sliceBins[i].m_ListMins, bins.m_ListMins );
+		VectorMax( bins.m_ListMaxs, sliceBins[i].m_ListMaxs, bins.m_ListMaxs );
+	}
+}
+
+
+float CKDTreeBuilder::FindBestSplit( KDBuildBins_t const &bins, int nTriangles, Vector const &MinBound,
+									 Vector const &MaxBound, int &nSplitPlane, float &flSplitValue ) const
+{
+	float flBestCost = 1.0e23;
+	float flSA = BoxSurfaceArea( MinBound, MaxBound );
+	if ( flSA <= 0 )
+		return flBestCost;
+	float ISA = 1.0 / flSA;
+
+	for ( int axis = 0; axis < 3; axis++ )
+	{
+		float flWidth = MaxBound[axis] - MinBound[axis];
+		if ( flWidth <= 0 )
+			continue;
+
+		// same cost formula as CalculateCostsOfSplit
+		Vector LeftMaxes = MaxBound;
+		Vector RightMins = MinBound;
+		float flBinWidth = flWidth / KDBUILD_NUM_BINS;
+		int nLeft = 0;
+		int nEntered = 0;
+		for ( int b = 1; b < KDBUILD_NUM_BINS; b++ )
+		{
+			float flValue = MinBound[axis] + b * flBinWidth;
+			nLeft += bins.m_nLeaving[axis][b - 1];
+			nEntered += bins.m_nEntering[axis][b - 1];
+			int nRight = nTriangles - nEntered;
+			int nBoth = nTriangles - nLeft - nRight;
+
+			LeftMaxes[axis] = flValue;
+			RightMins[axis] = flValue;
+			float flCost = COST_OF_TRAVERSAL + COST_OF_INTERSECTION * ( nBoth +
+				( BoxSurfaceArea( MinBound, LeftMaxes ) * ISA * nLeft ) +
+				( BoxSurfaceArea( RightMins, MaxBound ) * ISA * nRight ) );
+			if ( flCost < flBestCost )
+			{
+				flBestCost = flCost;
+				nSplitPlane = axis;
+				flSplitValue = flValue;
+			}
+		}
+
+		// cutting off the empty space around the triangles
+		if ( bins.m_ListMins[axis] > MinBound[axis] )
+		{
+			RightMins[axis] = bins.m_ListMins[axis];
+			float flCost = COST_OF_TRAVERSAL +
+				COST_OF_INTERSECTION * BoxSurfaceArea( RightMins, MaxBound ) * ISA * nTriangles;
+			if ( flCost < flBestCost )
+			{
+				flBestCost = flCost;
+				nSplitPlane = axis;
+				flSplitValue = bins.m_ListMins[axis];
+			}
+		}
+		if ( bins.m_ListMaxs[axis] < MaxBound[axis] )
+		{
+			LeftMaxes[axis] = bins.m_ListMaxs[axis];
+			float flCost = COST_OF_TRAVERSAL +
+				COST_OF_INTERSECTION * BoxSurfaceArea( MinBound, LeftMaxes ) * ISA * nTriangles;
+			if ( flCost < flBestCost )
+			{
+				flBestCost = flCost;
+				nSplitPlane = axis;
+				flSplitValue = bins.m_ListMaxs[axis];
+			}
+		}
+	}
+	return flBestCost;
+}
+
+
+void CKDTreeBuilder::BuildTaskJob( int iJob )
+{
+	KDBuildTask_t *pTask = m_Tasks[iJob];
+	CacheOptimizedKDNode root;
+	pTask->m_Nodes.AddToTail( root );
+	RefineNode( pTask->m_Nodes, pTask->m_TriangleIndices, 0, pTask->m_pTriangles, pTask->m_nTriangles,
+				pTask->m_MinBound, pTask->m_MaxBound, pTask->m_nDepth, false );
+	delete[] pTask->m_pTriangles;
+	pTask->m_pTriangles = NULL;
+}
+
+
+void CKDTreeBuilder::SpliceTask( KDBuildTask_t *pTask )
+{
+	CUtlVector<CacheOptimizedKDNode> &tree = m_pEnv->OptimizedKDTree;
+	CUtlVector<int32> &triangleIndices = m_pEnv->TriangleIndexList;
+
+	// the subtree root replaces the placeholder, everything below it goes on the end. local node
+	// n>0 lands at nNodeBase+n, which keeps sibling pairs adjacent.
+	int nNodeBase = tree.Count() - 1;
+	int nTriangleBase = triangleIndices.Count();
+	tree.EnsureCapacity( tree.Count() + pTask->m_Nodes.Count() - 1 );
+	for ( int i = 0; i < pTask->m_Nodes.Count(); i++ )
+	{
+		CacheOptimizedKDNode node = pTask->m_Nodes[i];
+		if ( node.NodeType() == KDNODE_STATE_LEAF )
+			node.Children = KDNODE_STATE_LEAF + ( ( node.TriangleIndexStart() + nTriangleBase ) << 2 );
+		else
+			node.Children = node.NodeType() + ( ( node.LeftChild() + nNodeBase ) << 2 );
+
+		if ( i == 0 )
+			tree[pTask->m_nNode] = node;
+		else
+			tree.AddToTail( node );
+	}
+	triangleIndices.AddMultipleToTail( pTask->m_TriangleIndices.Count(), pTask->m_TriangleIndices.Base() );
+	pTask->m_Nodes.Purge();
+	pTask->m_TriangleIndices.Purge();
+}
+
+
+void CKDTreeBuilder::RunJobs( JobFn_t pfnJob, int nJobs )
+{
+	m_pfnJob = pfnJob;
+	m_nJobs = nJobs;
+	m_iNextJob = -1;
+
+	// the calling thread works too
+	int nWorkers = min( m_nThreads, nJobs ) - 1;
+	ThreadHandle_t hThreads[KDBUILD_MAX_THREADS];
+	for ( int i = 0; i < nWorkers; i++ )
+		hThreads[i] = CreateSimpleThread( JobThreadFn, this );
+	DoJobs();
+	for ( int i = 0; i < nWorkers; i++ )
+	{
+		ThreadJoin( hThreads[i] );
+		ReleaseThreadHandle( hThreads[i] );
+	}
+}
+
+
+void CKDTreeBuilder::DoJobs()
+{
+	for (;;)
+	{
+		int iJob = ThreadInterlockedIncrement( &m_iNextJob );
+		if ( iJob >= m_nJobs )
+			break;
+		( this->*m_pfnJob )( iJob );
+	}
+}
+
+
+unsigned CKDTreeBuilder::JobThreadFn( void *pParam )
+{
+	( (CKDTreeBuilder *)pParam )->DoJobs();
+	return 0;
+}
+
+
+void RayTracingEnvironment::BuildBinnedKDTree(int32 const *tri_list,int ntris)
+{
+	CKDTreeBuilder builder( this, m_nBuildThreads );
+	builder.Build( tri_list, ntris );
+}
+
+
 void RayTracingEnvironment::SetupAccelerationStructure(void)
 {
 	CacheOptimizedKDNode root;
@@ -878,7 +1495,10 @@ void RayTracingEnvironment::SetupAccelerationStructure(void)
 		root_triangle_list[t]=t;
 	CalculateTriangleListBounds(root_triangle_list,OptimizedTriangleList.Count(),m_MinBound,
 								m_MaxBound);
-	RefineNode(0,root_triangle_list,OptimizedTriangleList.Count(),m_MinBound,m_MaxBound,0);
+	if (Flags & RTE_FLAGS_REFERENCE_TREE_GENERATION)
+		RefineNode(0,root_triangle_list,OptimizedTriangleList.Count(),m_MinBound,m_MaxBound,0);
+	else
+		BuildBinnedKDTree(root_triangle_list,OptimizedTriangleList.Count());
 	delete[] root_triangle_list;
 
 	// now, convert all triangles to "intersection format"
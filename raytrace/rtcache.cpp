@@ -0,0 +1,187 @@
+//========= Copyright Valve Corporation, All rights reserved. ============//
+// $Id$
+
+// Saving and loading of a built acceleration structure.
+//
+// The blob holds the kd-tree, the triangle index list and the triangles in intersection format,
+// keyed by a hash of the triangles as they were added. Whoever filled the environment (vrad's
+// brushes, displacements and static props, InitializeFromLoadedBSP)
+// adds the same triangles again, computes the hash, and if it matches the blob is mapped in
+// instead of building the tree.
+
+#include <windows.h>
+#include "raytrace.h"
+#include <tier0/dbg.h>
+#include <tier1/checksum_crc.h>
+
+#define RTCACHE_ID		(('K'<<24)+('T'<<16)+('R'<<8)+'V')	// little-endian "VRTK"
+#define RTCACHE_VERSION	2
+
+// Flags that change the tree the build makes, so a tree built with other flags can't be reused
+#define RTCACHE_BUILD_FLAGS	( RTE_FLAGS_FAST_TREE_GENERATION | RTE_FLAGS_REFERENCE_TREE_GENERATION )
+
+struct RayTraceCacheHeader_t
+{
+	int32 m_nId;
+	int32 m_nVersion;
+	uint32 m_nGeometryHash;									// CalculateGeometryHash() before the build
+	int32 m_nTriangleSize;									// sizeof(CacheOptimizedTriangle)
+	int32 m_nNodeSize;										// sizeof(CacheOptimizedKDNode)
+	int32 m_nTriangles;
+	int32 m_nNodes;
+	int32 m_nTriangleIndices;
+	Vector m_MinBound;
+	Vector m_MaxBound;
+
+	// followed by CacheOptimizedTriangle[m_nTriangles], CacheOptimizedKDNode[m_nNodes] and
+	// int32[m_nTriangleIndices]
+};
+
+
+uint32 RayTracingEnvironment::CalculateGeometryHash(void)
+{
+	CRC32_t crc;
+	CRC32_Init( &crc );
+
+	// the builders make different (equally valid) trees
+	uint32 nBuildFlags = Flags & RTCACHE_BUILD_FLAGS;
+	CRC32_ProcessBuffer( &crc, &nBuildFlags, sizeof( nBuildFlags ) );
+
+	int32 nTriangles = OptimizedTriangleList.Count();
+	CRC32_ProcessBuffer( &crc, &nTriangles, sizeof( nTriangles ) );
+	for ( int i = 0; i < nTriangles; i++ )
+	{
+		// only the fields AddTriangle fills in; the tmp data is scratch for the builder
+		TriGeometryData_t const &tri = OptimizedTriangleList[i].m_Data.m_GeometryData;
+		CRC32_ProcessBuffer( &crc, &tri.m_nTriangleID, sizeof( tri.m_nTriangleID ) );
+		CRC32_ProcessBuffer( &crc, tri.m_VertexCoordData, sizeof( tri.m_VertexCoordData ) );
+		CRC32_ProcessBuffer( &crc, &tri.m_nFlags, sizeof( tri.m_nFlags ) );
+	}
+
+	CRC32_Final( &crc );
+	return crc;
+}
+
+
+bool RayTracingEnvironment::LoadAccelerationStructure( const char *pFilename, uint32 nGeometryHash )
+{
+	Assert( OptimizedKDTree.Count() == 0 );
+
+	HANDLE hFile = ::CreateFile( pFilename, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL );
+	if ( hFile == INVALID_HANDLE_VALUE )
+		return false;
+
+	DWORD dwSizeHigh = 0;
+	DWORD dwSize = ::GetFileSize( hFile, &dwSizeHigh );
+	if ( dwSizeHigh != 0 || dwSize < sizeof( RayTraceCacheHeader_t ) )
+	{
+		::CloseHandle( hFile );
+		return false;
+	}
+
+	HANDLE hMapping = ::CreateFileMapping( hFile, NULL, PAGE_READONLY, 0, 0, NULL );
+	void const *pData = hMapping ? ::MapViewOfFile( hMapping, FILE_MAP_READ, 0, 0, 0 ) : NULL;
+	if ( !pData )
+	{
+		if ( hMapping )
+			::CloseHandle( hMapping );
+		::CloseHandle( hFile );
+		return false;
+	}
+
+	RayTraceCacheHeader_t const *pHeader = (RayTraceCacheHeader_t const *)pData;
+	bool bValid = ( pHeader->m_nId == RTCACHE_ID ) &&
+		( pHeader->m_nVersion == RTCACHE_VERSION ) &&
+		( pHeader->m_nGeometryHash == nGeometryHash ) &&
+		( pHeader->m_nTriangleSize == sizeof( CacheOptimizedTriangle ) ) &&
+		( pHeader->m_nNodeSize == sizeof( CacheOptimizedKDNode ) ) &&
+		( pHeader->m_nTriangles == OptimizedTriangleList.Count() ) &&
+		( dwSize == sizeof( RayTraceCacheHeader_t ) +
+		  pHeader->m_nTriangles * sizeof( CacheOptimizedTriangle ) +
+		  pHeader->m_nNodes * sizeof( CacheOptimizedKDNode ) +
+		  pHeader->m_nTriangleIndices * sizeof( int32 ) );
+
+	if ( bValid )
+	{
+		// the triangles live in a block vector and the tree in utlvectors, neither of which can
+		// point at the view, so this is one straight copy out of the page cache
+		CacheOptimizedTriangle const *pTriangles = (CacheOptimizedTriangle const *)( pHeader + 1 );
+		CacheOptimizedKDNode const *pNodes = (CacheOptimizedKDNode const *)( pTriangles + pHeader->m_nTriangles );
+		int32 const *pTriangleIndices = (int32 const *)( pNodes + pHeader->m_nNodes );
+
+		for ( int i = 0; i < pHeader->m_nTriangles; i++ )
+			OptimizedTriangleList[i] = pTriangles[i];
+		OptimizedKDTree.CopyArray( pNodes, pHeader->m_nNodes );
+		TriangleIndexList.CopyArray( pTriangleIndices, pHeader->m_nTriangleIndices );
+		m_MinBound = pHeader->m_MinBound;
+		m_MaxBound = pHeader->m_MaxBound;
+	}
+
+	::UnmapViewOfFile( pData );
+	::CloseHandle( hMapping );
+	::CloseHandle( hFile );
+	return bValid;
+}
+
+
+bool RayTracingEnvironment::SaveAccelerationStructure( const char *pFilename, uint32 nGeometryHash )
+{
+	FILE *fp = fopen( pFilename, "wb" );
+	if ( !fp )
+		return false;
+
+	RayTraceCacheHeader_t header;
+	header.m_nId = RTCACHE_ID;
+	header.m_nVersion = RTCACHE_VERSION;
+	header.m_nGeometryHash = nGeometryHash;
+	header.m_nTriangleSize = sizeof( CacheOptimizedTriangle );
+	header.m_nNodeSize = sizeof( CacheOptimizedKDNode );
+	header.m_nTriangles = OptimizedTriangleList.Count();
+	header.m_nNodes = OptimizedKDTree.Count();
+	header.m_nTriangleIndices = TriangleIndexList.Count();
+	header.m_MinBound = m_MinBound;
+	header.m_MaxBound = m_MaxBound;
+
+	// write a zeroed header first so an interrupted save is never picked up as valid
+	RayTraceCacheHeader_t blank;
+	memset( &blank, 0, sizeof( blank ) );
+	bool bOk = ( fwrite( &blank, sizeof( blank ), 1, fp ) == 1 );
+	for ( int i = 0; bOk && i < header.m_nTriangles; i++ )
+		bOk = ( fwrite( &OptimizedTriangleList[i], sizeof( CacheOptimizedTriangle ), 1, fp ) == 1 );
+	if ( bOk && header.m_nNodes )
+		bOk = ( fwrite( OptimizedKDTree.Base(), sizeof( CacheOptimizedKDNode ), header.m_nNodes, fp ) == (size_t)header.m_nNodes );
+	if ( bOk && header.m_nTriangleIndices )
+		bOk = ( fwrite( TriangleIndexList.Base(), sizeof( int32 ), header.m_nTriangleIndices, fp ) == (size_t)header.m_nTriangleIndices );
+	if ( bOk )
+	{
+		fseek( fp, 0, SEEK_SET );
+		bOk = ( fwrite( &header, sizeof( header ), 1, fp ) == 1 );
+	}
+	fclose( fp );
+
+	if ( !bOk )
+		remove( pFilename );
+	return bOk;
+}
+
+
+void RayTracingEnvironment::SetupAccelerationStructure( const char *pCacheFilename )
+{
+	if ( !pCacheFilename )
+	{
+		SetupAccelerationStructure();
+		return;
+	}
+
+	// has to be computed before the build turns the triangles into intersection format
+	uint32 nGeometryHash = CalculateGeometryHash();
+	if ( LoadAccelerationStructure( pCacheFilename, nGeometryHash ) )
+	{
+		Msg( "(loaded from %s) ", pCacheFilename );
+		return;
+	}
+
+	SetupAccelerationStructure();
+	if ( !SaveAccelerationStructure( pCacheFilename, nGeometryHash ) )
+		Warning( "Can't write ray trace cache %s\n", pCacheFilename );
+}
@@ -0,0 +1,327 @@
+//========= Copyright Valve Corporation, All rights reserved. ============//
+// $Id$
+
+// 8 and 16 ray packet traversal. This is Trace4Rays with every fltx4 widened to one or two
+// __m256s, doing the same operations in the same order so that each ray gets the same
+// answer it would from Trace4Rays.
+//
+// This file is built with /arch:AVX and is only entered after CheckAVXTechnology() said yes,
+// so it must not call any inline function from a shared header that does floating point math
+// (FourVectors, mathlib, ...): the linker is free to keep this file's AVX copy of it for the
+// whole program. It sticks to intrinsics and plain data.
+
+#include "raytrace.h"
+
+#ifdef RAYTRACE_HAS_AVX
+#include <immintrin.h>
+#endif
+
+#ifdef RAYTRACE_HAS_AVX
+
+template<int NVEC> struct WideNodeToVisit
+{
+	CacheOptimizedKDNode const *node;
+	__m256 TMin[NVEC];
+	__m256 TMax[NVEC];
+};
+
+template<int NVEC> struct WideRayState
+{
+	__m256 Origin[3][NVEC];
+	__m256 Direction[3][NVEC];
+	__m256 OneOverRayDir[3][NVEC];
+	__m256 HitIds[NVEC];									// triangle index bits, -1=no hit
+	__m256 HitDistance[NVEC];
+	__m256 Normal[3][NVEC];
+};
+
+
+// lanes 0-3 from a, 4-7 from b
+static FORCEINLINE __m256 Combine( fltx4 const &a, fltx4 const &b )
+{
+	return _mm256_insertf128_ps( _mm256_castps128_ps256( a ), b, 1 );
+}
+
+template<int NVEC> static FORCEINLINE bool AnyNegative( __m256 const *pMasks )
+{
+	int nMask = _mm256_movemask_ps( pMasks[0] );
+	for ( int v = 1; v < NVEC; v++ )
+		nMask |= _mm256_movemask_ps( pMasks[v] );
+	return ( nMask != 0 );
+}
+
+// (a & mask) | (b & ~mask), same as the OrSIMD/AndSIMD/AndNotSIMD select in Trace4Rays
+static FORCEINLINE __m256 Select( __m256 a, __m256 b, __m256 mask )
+{
+	return _mm256_or_ps( _mm256_and_ps( a, mask ), _mm256_andnot_ps( mask, b ) );
+}
+
+
+template<int NVEC> static void TraceWidePacket( RayTracingEnvironment const &env, WideRayState<NVEC> &rs,
+											  __m256 *TMin, __m256 *TMax, int DirectionSignMask, int32 skip_id )
+{
+	const __m256 Epsilons = _mm256_set1_ps( 1.0e-10f );
+	const __m256 NegativeEpsilons = _mm256_set1_ps( -1.0e-10f );
+	const __m256 Zeros = _mm256_set1_ps( 1.0e-10f );		// Trace4Rays' FourZeros isn't zero either
+	const __m256 Ones = _mm256_set1_ps( 1.0f );
+
+	// now, clip rays against bounding box
+	for ( int c = 0; c < 3; c++ )
+	{
+		__m256 MinBound = _mm256_set1_ps( env.m_MinBound[c] );
+		__m256 MaxBound = _mm256_set1_ps( env.m_MaxBound[c] );
+		for ( int v = 0; v < NVEC; v++ )
+		{
+			__m256 isect_min_t = _mm256_mul_ps( _mm256_sub_ps( MinBound, rs.Origin[c][v] ), rs.OneOverRayDir[c][v] );
+			__m256 isect_max_t = _mm256_mul_ps( _mm256_sub_ps( MaxBound, rs.Origin[c][v] ), rs.OneOverRayDir[c][v] );
+			TMin[v] = _mm256_max_ps( TMin[v], _mm256_min_ps( isect_min_t, isect_max_t ) );
+			TMax[v] = _mm256_min_ps( TMax[v], _mm256_max_ps( isect_min_t, isect_max_t ) );
+		}
+	}
+	__m256 active[NVEC];
+	for ( int v = 0; v < NVEC; v++ )
+		active[v] = _mm256_cmp_ps( TMin[v], TMax[v], _CMP_LE_OS );
+	if ( !AnyNegative<NVEC>( active ) )
+		return;												// missed bounding box
+
+	int32 mailboxids[MAILBOX_HASH_SIZE];					// used to avoid redundant triangle tests
+	memset( mailboxids, 0xff, sizeof( mailboxids ) );
+
+	// based on ray direction, whether to visit left or right node first
+	int front_idx[3], back_idx[3];
+	for ( int c = 0; c < 3; c++ )
+	{
+		back_idx[c] = ( DirectionSignMask & ( 1 << c ) ) ? 0 : 1;
+		front_idx[c] = 1 - back_idx[c];
+	}
+
+	CacheOptimizedKDNode const *pNodes = env.OptimizedKDTree.Base();
+	int32 const *pTriangleIndices = env.TriangleIndexList.Base();
+
+	WideNodeToVisit<NVEC> NodeQueue[MAX_NODE_STACK_LEN];
+	CacheOptimizedKDNode const *CurNode = pNodes;
+	WideNodeToVisit<NVEC> *stack_ptr = &NodeQueue[MAX_NODE_STACK_LEN];
+	for (;;)
+	{
+		while ( ( CurNode->Children & 3 ) != KDNODE_STATE_LEAF )	// traverse until next leaf
+		{
+			int split_plane_number = CurNode->Children & 3;
+			CacheOptimizedKDNode const *FrontChild = pNodes + ( CurNode->Children >> 2 );
+			__m256 SplitValue = _mm256_set1_ps( CurNode->SplittingPlaneValue );
+
+			__m256 dist_to_sep_plane[NVEC];					// dist=(split-org)/dir
+			__m256 hits_front[NVEC];
+			for ( int v = 0; v < NVEC; v++ )
+			{
+				dist_to_sep_plane[v] = _mm256_mul_ps( _mm256_sub_ps( SplitValue, rs.Origin[split_plane_number][v] ),
+													  rs.OneOverRayDir[split_plane_number][v] );
+				active[v] = _mm256_cmp_ps( TMin[v], TMax[v], _CMP_LE_OS );
+				hits_front[v] = _mm256_and_ps( active[v], _mm256_cmp_ps( dist_to_sep_plane[v], TMin[v], _CMP_GE_OS ) );
+			}
+
+			// now, decide how to traverse children. can either do front,back, or do front and push
+			// back.
+			if ( !AnyNegative<NVEC>( hits_front ) )
+			{
+				// missed the front. only traverse back
+				CurNode = FrontChild + back_idx[split_plane_number];
+				for ( int v = 0; v < NVEC; v++ )
+					TMin[v] = _mm256_max_ps( TMin[v], dist_to_sep_plane[v] );
+				continue;
+			}
+
+			__m256 hits_back[NVEC];
+			for ( int v = 0; v < NVEC; v++ )
+				hits_back[v] = _mm256_and_ps( active[v], _mm256_cmp_ps( dist_to_sep_plane[v], TMax[v], _CMP_LE_OS ) );
+			if ( !AnyNegative<NVEC>( hits_back ) )
+			{
+				// missed the back - only need to traverse front node
+				CurNode = FrontChild + front_idx[split_plane_number];
+				for ( int v = 0; v < NVEC; v++ )
+					TMax[v] = _mm256_min_ps( TMax[v], dist_to_sep_plane[v] );
+				continue;
+			}
+
+			// at least some rays hit both nodes. must push far, traverse near
+			Assert( stack_ptr > NodeQueue );
+			--stack_ptr;
+			stack_ptr->node = FrontChild + back_idx[split_plane_number];
+			for ( int v = 0; v < NVEC; v++ )
+			{
+				stack_ptr->TMin[v] = _mm256_max_ps( TMin[v], dist_to_sep_plane[v] );
+				stack_ptr->TMax[v] = TMax[v];
+				TMax[v] = _mm256_min_ps( TMax[v], dist_to_sep_plane[v] );
+			}
+			CurNode = FrontChild + front_idx[split_plane_number];
+		}
+
+		// hit a leaf! must do intersection check
+		int ntris = *( (int32 const *)&CurNode->SplittingPlaneValue );
+		if ( ntris )
+		{
+			int32 const *tlist = pTriangleIndices + ( CurNode->Children >> 2 );
+			do
+			{
+				int tnum = *( tlist++ );
+				int mbox_slot = tnum & ( MAILBOX_HASH_SIZE - 1 );
+				TriIntersectData_t const *tri = &( env.OptimizedTriangleList[tnum].m_Data.m_IntersectData );
+				if ( ( mailboxids[mbox_slot] == tnum ) || ( tri->m_nTriangleID == skip_id ) )
+					continue;
+				mailboxids[mbox_slot] = tnum;
+
+				__m256 Nx = _mm256_set1_ps( tri->m_flNx );
+				__m256 Ny = _mm256_set1_ps( tri->m_flNy );
+				__m256 Nz = _mm256_set1_ps( tri->m_flNz );
+				__m256 D = _mm256_set1_ps( tri->m_flD );
+				__m256 E[6];
+				for ( int e = 0; e < 6; e++ )
+					E[e] = _mm256_set1_ps( tri->m_ProjectedEdgeEquations[e] );
+				int c0 = tri->m_nCoordSelect0;
+				int c1 = tri->m_nCoordSelect1;
+				__m256 TriangleID = _mm256_castsi256_ps( _mm256_set1_epi32( tnum ) );
+
+				for ( int v = 0; v < NVEC; v++ )
+				{
+					// compute plane intersection
+					__m256 DDotN = _mm256_mul_ps( rs.Direction[0][v], Nx );
+					DDotN = _mm256_add_ps( _mm256_mul_ps( rs.Direction[1][v], Ny ), DDotN );
+					DDotN = _mm256_add_ps( _mm256_mul_ps( rs.Direction[2][v], Nz ), DDotN );
+
+					// mask off zero or near zero (ray parallel to surface)
+					__m256 did_hit = _mm256_or_ps( _mm256_cmp_ps( DDotN, Epsilons, _CMP_GT_OS ),
+												   _mm256_cmp_ps( DDotN, NegativeEpsilons, _CMP_LT_OS ) );
+
+					__m256 ODotN = _mm256_mul_ps( rs.Origin[0][v], Nx );
+					ODotN = _mm256_add_ps( _mm256_mul_ps( rs.Origin[1][v], Ny ), ODotN );
+					ODotN = _mm256_add_ps( _mm256_mul_ps( rs.Origin[2][v], Nz ), ODotN );
+					__m256 numerator = _mm256_sub_ps( D, ODotN );
+
+					__m256 isect_t = _mm256_div_ps( numerator, DDotN );
+					// now, we have the distance to the plane. lets update our mask
+					did_hit = _mm256_and_ps( did_hit, _mm256_cmp_ps( isect_t, Zeros, _CMP_GT_OS ) );
+					did_hit = _mm256_and_ps( did_hit, _mm256_cmp_ps( isect_t, rs.HitDistance[v], _CMP_LT_OS ) );
+					if ( !_mm256_movemask_ps( did_hit ) )
+						continue;
+
+					// now, check 3 edges
+					__m256 hitc1 = _mm256_add_ps( rs.Origin[c0][v], _mm256_mul_ps( isect_t, rs.Direction[c0][v] ) );
+					__m256 hitc2 = _mm256_add_ps( rs.Origin[c1][v], _mm256_mul_ps( isect_t, rs.Direction[c1][v] ) );
+
+					// do barycentric coordinate check
+					__m256 B0 = _mm256_mul_ps( E[0], hitc1 );
+					B0 = _mm256_add_ps( B0, _mm256_mul_ps( E[1], hitc2 ) );
+					B0 = _mm256_add_ps( B0, E[2] );
+					did_hit = _mm256_and_ps( did_hit, _mm256_cmp_ps( B0, Zeros, _CMP_GE_OS ) );
+
+					__m256 B1 = _mm256_mul_ps( E[3], hitc1 );
+					B1 = _mm256_add_ps( B1, _mm256_mul_ps( E[4], hitc2 ) );
+					B1 = _mm256_add_ps( B1, E[5] );
+					did_hit = _mm256_and_ps( did_hit, _mm256_cmp_ps( B1, Zeros, _CMP_GE_OS ) );
+
+					__m256 B2 = _mm256_add_ps( B1, B0 );
+					did_hit = _mm256_and_ps( did_hit, _mm256_cmp_ps( B2, Ones, _CMP_LE_OS ) );
+
+					if ( !_mm256_movemask_ps( did_hit ) )
+						continue;
+
+					// now, set the hit_id and closest_hit fields for any enabled rays
+					rs.HitIds[v] = Select( TriangleID, rs.HitIds[v], did_hit );
+					rs.HitDistance[v] = Select( isect_t, rs.HitDistance[v], did_hit );
+					rs.Normal[0][v] = Select( Nx, rs.Normal[0][v], did_hit );
+					rs.Normal[1][v] = Select( Ny, rs.Normal[1][v], did_hit );
+					rs.Normal[2][v] = Select( Nz, rs.Normal[2][v], did_hit );
+				}
+			} while ( --ntris );
+
+			// now, check if all rays have terminated
+			__m256 raydone[NVEC];
+			for ( int v = 0; v < NVEC; v++ )
+				raydone[v] = _mm256_cmp_ps( TMax[v], rs.HitDistance[v], _CMP_LE_OS );
+			if ( !AnyNegative<NVEC>( raydone ) )
+				return;
+		}
+
+		if ( stack_ptr == &NodeQueue[MAX_NODE_STACK_LEN] )
+			return;
+
+		// pop stack!
+		CurNode = stack_ptr->node;
+		for ( int v = 0; v < NVEC; v++ )
+		{
+			TMin[v] = stack_ptr->TMin[v];
+			TMax[v] = stack_ptr->TMax[v];
+		}
+		stack_ptr++;
+	}
+}
+
+
+template<int NVEC> static void TraceWidePacket( RayTracingEnvironment const &env, FourRays const *pRays,
+											  FourVectors const *pOneOverRayDir, fltx4 TMin4, fltx4 const *pTMax,
+											  int DirectionSignMask, RayTracingResult *pResults, int32 skip_id )
+{
+	WideRayState<NVEC> rs;
+	__m256 TMin[NVEC], TMax[NVEC];
+	for ( int v = 0; v < NVEC; v++ )
+	{
+		FourRays const &lo = pRays[2 * v];
+		FourRays const &hi = pRays[2 * v + 1];
+		rs.Origin[0][v] = Combine( lo.origin.x, hi.origin.x );
+		rs.Origin[1][v] = Combine( lo.origin.y, hi.origin.y );
+		rs.Origin[2][v] = Combine( lo.origin.z, hi.origin.z );
+		rs.Direction[0][v] = Combine( lo.direction.x, hi.direction.x );
+		rs.Direction[1][v] = Combine( lo.direction.y, hi.direction.y );
+		rs.Direction[2][v] = Combine( lo.direction.z, hi.direction.z );
+		rs.OneOverRayDir[0][v] = Combine( pOneOverRayDir[2 * v].x, pOneOverRayDir[2 * v + 1].x );
+		rs.OneOverRayDir[1][v] = Combine( pOneOverRayDir[2 * v].y, pOneOverRayDir[2 * v + 1].y );
+		rs.OneOverRayDir[2][v] = Combine( pOneOverRayDir[2 * v].z, pOneOverRayDir[2 * v + 1].z );
+
+		rs.HitIds[v] = _mm256_castsi256_ps( _mm256_set1_epi32( -1 ) );
+		rs.HitDistance[v] = _mm256_set1_ps( 1.0e23f );
+		rs.Normal[0][v] = rs.Normal[1][v] = rs.Normal[2][v] = _mm256_setzero_ps();
+
+		TMin[v] = Combine( TMin4, TMin4 );
+		TMax[v] = Combine( pTMax[2 * v], pTMax[2 * v + 1] );
+	}
+
+	TraceWidePacket<NVEC>( env, rs, TMin, TMax, DirectionSignMask, skip_id );
+
+	for ( int v = 0; v < NVEC; v++ )
+	{
+		RayTracingResult &lo = pResults[2 * v];
+		RayTracingResult &hi = pResults[2 * v + 1];
+		_mm_store_ps( (float *)lo.HitIds, _mm256_castps256_ps128( rs.HitIds[v] ) );
+		_mm_store_ps( (float *)hi.HitIds, _mm256_extractf128_ps( rs.HitIds[v], 1 ) );
+		lo.HitDistance = _mm256_castps256_ps128( rs.HitDistance[v] );
+		hi.HitDistance = _mm256_extractf128_ps( rs.HitDistance[v], 1 );
+		lo.surface_normal.x = _mm256_castps256_ps128( rs.Normal[0][v] );
+		lo.surface_normal.y = _mm256_castps256_ps128( rs.Normal[1][v] );
+		lo.surface_normal.z = _mm256_castps256_ps128( rs.Normal[2][v] );
+		hi.surface_normal.x = _mm256_extractf128_ps( rs.Normal[0][v], 1 );
+		hi.surface_normal.y = _mm256_extractf128_ps( rs.Normal[1][v], 1 );
+		hi.surface_normal.z = _mm256_extractf128_ps( rs.Normal[2][v], 1 );
+	}
+
+	// back to SSE code without paying for the dirty upper halves
+	_mm256_zeroupper();
+}
+
+#endif // RAYTRACE_HAS_AVX
+
+
+void RayTracingEnvironment::TraceRayPacketAVX(int nGroups, const FourRays *pRays, const FourVectors *pOneOverRayDir,
+											  fltx4 TMin, const fltx4 *pTMax, int DirectionSignMask,
+											  RayTracingResult *pResults, int32 skip_id)
+{
+#ifdef RAYTRACE_HAS_AVX
+	if ( nGroups == 4 )
+		TraceWidePacket<2>( *this, pRays, pOneOverRayDir, TMin, pTMax, DirectionSignMask, pResults, skip_id );
+	else
+		TraceWidePacket<1>( *this, pRays, pOneOverRayDir, TMin, pTMax, DirectionSignMask, pResults, skip_id );
+#else
+	// HasWideRayPackets() is false without the kernel, so TraceRayPacket never gets here
+	Assert( 0 );
+	for ( int g = 0; g < nGroups; g++ )
+		Trace4Rays( pRays[g], TMin, pTMax[g], DirectionSignMask, pResults + g, skip_id );
+#endif
+}
@@ -0,0 +1,235 @@
+//========= Copyright Valve Corporation, All rights reserved. ============//
+// $Id$
+
+// Synthetic kd-tree build/trace benchmark. Builds the same triangle soup with the reference
+// (exhaustive) and binned builders, traces the same rays through both, and reports the timings
+// along with how many rays came back with a different hit. Then compares packet widths on the
+// binned tree.
+
+#include "raytrace.h"
+#include <tier0/platform.h>
+#include <tier0/dbg.h>
+#include <tier0/memalloc.h>
+
+#define BENCH_WORLD_SIZE 8192.0f
+#define BENCH_CLUSTER_SIZE 256								// triangles per "prop"
+
+// deterministic so both environments see exactly the same scene and rays
+class CBenchRandom
+{
+public:
+	CBenchRandom( uint32 nSeed ) : m_nState( nSeed ) {}
+
+	float RandomFloat( float flMin, float flMax )
+	{
+		m_nState = m_nState * 1664525 + 1013904223;
+		return flMin + ( flMax - flMin ) * ( ( m_nState >> 8 ) * ( 1.0f / 16777216.0f ) );
+	}
+
+	Vector RandomVector( float flMin, float flMax )
+	{
+		float x = RandomFloat( flMin, flMax );
+		float y = RandomFloat( flMin, flMax );
+		float z = RandomFloat( flMin, flMax );
+		return Vector( x, y, z );
+	}
+
+private:
+	uint32 m_nState;
+};
+
+
+//-----------------------------------------------------------------------------
+// Most of the triangles are small and clumped together like static props, the rest are big
+// and scattered like world brushes.
+//-----------------------------------------------------------------------------
+static void BuildTriangleSoup( RayTracingEnvironment &env, int nTriangles )
+{
+	CBenchRandom random( 0x5eed );
+	Vector vecColor( 1, 1, 1 );
+	Vector vecCenter( 0, 0, 0 );
+	env.MakeRoomForTriangles( nTriangles );
+	for ( int i = 0; i < nTriangles; i++ )
+	{
+		Vector v0;
+		float flSize;
+		if ( ( i & 3 ) == 3 )
+		{
+			v0 = random.RandomVector( -0.5f * BENCH_WORLD_SIZE, 0.5f * BENCH_WORLD_SIZE );
+			flSize = 512.0f;
+		}
+		else
+		{
+			if ( ( i % BENCH_CLUSTER_SIZE ) == 0 )
+				vecCenter = random.RandomVector( -0.45f * BENCH_WORLD_SIZE, 0.45f * BENCH_WORLD_SIZE );
+			v0 = vecCenter + random.RandomVector( -128.0f, 128.0f );
+			flSize = 16.0f;
+		}
+		Vector v1 = v0 + random.RandomVector( -flSize, flSize );
+		Vector v2 = v0 + random.RandomVector( -flSize, flSize );
+		env.AddTriangle( i, v0, v1, v2, vecColor );
+	}
+}
+
+
+static void TraceBenchRays( RayTracingEnvironment &env, Vector const *pStarts, Vector const *pDirs,
+							int nRays, int32 *pHitIDs, float *pHitDistances )
+{
+	fltx4 TMax = ReplicateX4( 2.0f * BENCH_WORLD_SIZE );
+	for ( int i = 0; i < nRays; i += 4 )
+	{
+		FourRays rays;
+		rays.origin.LoadAndSwizzle( pStarts[i], pStarts[i + 1], pStarts[i + 2], pStarts[i + 3] );
+		rays.direction.LoadAndSwizzle( pDirs[i], pDirs[i + 1], pDirs[i + 2], pDirs[i + 3] );
+		RayTracingResult rslt;
+		env.Trace4Rays( rays, Four_Zeros, TMax, &rslt );
+		for ( int r = 0; r < 4; r++ )
+		{
+			pHitIDs[i + r] = rslt.HitIds[r];
+			pHitDistances[i + r] = SubFloat( rslt.HitDistance, r );
+		}
+	}
+}
+
+
+//-----------------------------------------------------------------------------
+// Traces the same rays 4, 8 and 16 at a time. Every 16 rays share an octant and start near
+// each other, like the ambient occlusion rays from one group of luxels.
+//-----------------------------------------------------------------------------
+static void BenchmarkPacketWidths( RayTracingEnvironment &env, int nRays )
+{
+	nRays = ( nRays + 15 ) & ~15;
+	int nGroups = nRays / 4;
+	FourRays *pRays = (FourRays *)MemAlloc_AllocAligned( nGroups * sizeof( FourRays ), 16 );
+	fltx4 *pTMax = (fltx4 *)MemAlloc_AllocAligned( nGroups * sizeof( fltx4 ), 16 );
+	CBenchRandom random( 0xfeed );
+	Vector vecCenter( 0, 0, 0 );
+	Vector vecSigns( 1, 1, 1 );
+	for ( int g = 0; g < nGroups; g++ )
+	{
+		if ( ( g & 3 ) == 0 )
+		{
+			vecCenter = random.RandomVector( -0.45f * BENCH_WORLD_SIZE, 0.45f * BENCH_WORLD_SIZE );
+			for ( int c = 0; c < 3; c++ )
+				vecSigns[c] = ( random.RandomFloat( 0, 1 ) < 0.5f ) ? -1.0f : 1.0f;
+		}
+		Vector vecStarts[4], vecDirs[4];
+		for ( int r = 0; r < 4; r++ )
+		{
+			vecStarts[r] = vecCenter + random.RandomVector( -64.0f, 64.0f );
+			vecDirs[r] = random.RandomVector( 0.1f, 1.0f ) * vecSigns;
+			VectorNormalize( vecDirs[r] );
+		}
+		pRays[g].origin.LoadAndSwizzle( vecStarts[0], vecStarts[1], vecStarts[2], vecStarts[3] );
+		pRays[g].direction.LoadAndSwizzle( vecDirs[0], vecDirs[1], vecDirs[2], vecDirs[3] );
+		pTMax[g] = ReplicateX4( 1024.0f );
+	}
+
+	RayTracingResult *pResults[3];
+	static const int s_nWidths[3] = { 4, 8, 16 };
+	for ( int w = 0; w < 3; w++ )
+	{
+		pResults[w] = (RayTracingResult *)MemAlloc_AllocAligned( nGroups * sizeof( RayTracingResult ), 16 );
+		int nGroupsPerPacket = s_nWidths[w] / 4;
+		double flStart = Plat_FloatTime();
+		for ( int g = 0; g < nGroups; g += nGroupsPerPacket )
+		{
+			if ( nGroupsPerPacket == 1 )
+				env.Trace4Rays( pRays[g], Four_Zeros, pTMax[g], pResults[w] + g );
+			else
+				env.TraceRayPacket( nGroupsPerPacket, pRays + g, Four_Zeros, pTMax + g, pResults[w] + g );
+		}
+		double flTime = Plat_FloatTime() - flStart;
+
+		int nMismatches = 0;
+		for ( int g = 0; w && g < nGroups; g++ )
+		{
+			for ( int r = 0; r < 4; r++ )
+			{
+				if ( ( pResults[w][g].HitIds[r] != pResults[0][g].HitIds[r] ) ||
+					 ( SubFloat( pResults[w][g].HitDistance, r ) != SubFloat( pResults[0][g].HitDistance, r ) ) )
+					nMismatches++;
+			}
+		}
+		Msg( "%2d ray packets: %d rays in %.3f s (%.0f rays/sec), %d differ from 4 wide%s\n",
+			 s_nWidths[w], nRays, flTime, nRays / max( flTime, 1.0e-6 ), nMismatches,
+			 ( w && !RayTracingEnvironment::HasWideRayPackets() ) ? " (no AVX kernel, traced 4 wide)" : "" );
+	}
+
+	for ( int w = 0; w < 3; w++ )
+		MemAlloc_FreeAligned( pResults[w] );
+	MemAlloc_FreeAligned( pRays );
+	MemAlloc_FreeAligned( pTMax );
+}
+
+
+void RunRayTraceBenchmark( int nTriangles, int nRays, int nBuildThreads )
+{
+	nRays = ( nRays + 3 ) & ~3;
+
+	Vector *pStarts = new Vector[nRays];
+	Vector *pDirs = new Vector[nRays];
+	CBenchRandom random( 0xbeef );
+	for ( int i = 0; i < nRays; i++ )
+	{
+		pStarts[i] = random.RandomVector( -0.5f * BENCH_WORLD_SIZE, 0.5f * BENCH_WORLD_SIZE );
+		do
+		{
+			pDirs[i] = random.RandomVector( -1.0f, 1.0f );
+		}
+		while ( pDirs[i].LengthSqr() < 0.01f );
+		VectorNormalize( pDirs[i] );
+	}
+
+	int32 *pHitIDs[2];
+	float *pHitDistances[2];
+	static const char *s_pBuilderNames[2] = { "reference", "binned" };
+	for ( int nBuilder = 0; nBuilder < 2; nBuilder++ )
+	{
+		RayTracingEnvironment *pEnv = new RayTracingEnvironment;
+		pEnv->Flags = RTE_FLAGS_DONT_STORE_TRIANGLE_COLORS | RTE_FLAGS_DONT_STORE_TRIANGLE_MATERIALS;
+		if ( nBuilder == 0 )
+			pEnv->Flags |= RTE_FLAGS_REFERENCE_TREE_GENERATION;
+		pEnv->m_nBuildThreads = nBuildThreads;
+		BuildTriangleSoup( *pEnv, nTriangles );
+
+		double flStart = Plat_FloatTime();
+		pEnv->SetupAccelerationStructure();
+		double flBuildTime = Plat_FloatTime() - flStart;
+
+		pHitIDs[nBuilder] = new int32[nRays];
+		pHitDistances[nBuilder] = new float[nRays];
+		flStart = Plat_FloatTime();
+		TraceBenchRays( *pEnv, pStarts, pDirs, nRays, pHitIDs[nBuilder], pHitDistances[nBuilder] );
+		double flTraceTime = Plat_FloatTime() - flStart;
+
+		Msg( "%9s kd-tree: %d tris, %d nodes, built in %.3f s, %d rays in %.3f s (%.0f rays/sec)\n",
+			 s_pBuilderNames[nBuilder], nTriangles, pEnv->OptimizedKDTree.Count(), flBuildTime,
+			 nRays, flTraceTime, nRays / max( flTraceTime, 1.0e-6 ) );
+		if ( nBuilder == 1 )
+			BenchmarkPacketWidths( *pEnv, nRays );
+		delete pEnv;
+	}
+
+	// coplanar and shared-edge ties can legitimately resolve to a different triangle at the same
+	// distance, so only count rays whose hit distance changed
+	int nMismatches = 0;
+	for ( int i = 0; i < nRays; i++ )
+	{
+		bool bHit0 = ( pHitIDs[0][i] != -1 );
+		bool bHit1 = ( pHitIDs[1][i] != -1 );
+		if ( bHit0 != bHit1 )
+			nMismatches++;
+		else if ( bHit0 && ( fabs( pHitDistances[0][i] - pHitDistances[1][i] ) > 1.0e-3 * max( pHitDistances[0][i], 1.0f ) ) )
+			nMismatches++;
+	}
+	Msg( "%d of %d rays differ between the reference and binned trees\n", nMismatches, nRays );
+
+	for ( int nBuilder = 0; nBuilder < 2; nBuilder++ )
+	{
+		delete[] pHitIDs[nBuilder];
+		delete[] pHitDistances[nBuilder];
+	}
+	delete[] pStarts;
+	delete[] pDirs;
+}
@@ -12,6 +12,7 @@ bool CheckMMXTechnology(void) { return false; }
 bool CheckSSETechnology(void) { return false; }
 bool CheckSSE2Technology(void) { return false; }
 bool Check3DNowTechnology(void) { return false; }
+bool CheckAVXTechnology(void) { return false; }
 
 #elif defined( _WIN32 ) && !defined( _X360 )
 
@@ -269,6 +270,63 @@ bool Check3DNowTechnology(void)
     return retval;
 }
 
+bool CheckAVXTechnology(void)
+{
+    int retval = true;
+    unsigned int RegECX = 0;
+
+#ifdef CPUID
+	_asm pushad;
+#endif
+
+	// Do we have support for the CPUID function?
+    __try
+	{
+        _asm
+		{
+#ifdef CPUID
+			xor edx, edx			// Clue the compiler that EDX is about to be used.
+#endif
+            mov eax, 1				// set up CPUID to return processor version and features
+            CPUID					// code bytes = 0fh,  0a2h
+            mov RegECX, ecx			// features returned in ecx
+		}
+    } 
+	__except(EXCEPTION_EXECUTE_HANDLER) 
+	{ 
+		retval = false; 
+	}
+
+	// If CPUID not supported, then certainly no AVX.
+    if (retval)
+	{
+		// bit 28 is set for AVX, bit 27 if the OS saves state with XSAVE
+		if ( ( RegECX & 0x18000000 ) == 0x18000000 )
+		{
+			unsigned int RegXCR0 = 0;
+			_asm
+			{
+				xor ecx, ecx			// XCR0
+				_emit 0x0f				// xgetbv, spelled out for compilers that don't know it
+				_emit 0x01
+				_emit 0xd0
+				mov RegXCR0, eax
+			}
+
+			// the OS has to save both the xmm and the upper ymm state on a context switch
+			retval = ( ( RegXCR0 & 6 ) == 6 );
+		}
+		else
+			retval = false;
+	}
+
+#ifdef CPUID
+	_asm popad;
+#endif
+
+    return retval;
+}
+
 #pragma optimize( "", on )
 
 #endif // _WIN32
@@ -45,3 +45,18 @@ bool Check3DNowTechnology(void)
     }
     return false;
 }
+
+bool CheckAVXTechnology(void)
+{
+    unsigned long eax,ebx,ecx,edx;
+    cpuid(1,eax,ebx,ecx,edx);
+
+    // bit 28 is set for AVX, bit 27 if the OS saves state with XSAVE
+    if ( ( ecx & 0x18000000 ) != 0x18000000 )
+		return false;
+
+	// the OS has to save both the xmm and the upper ymm state on a context switch
+	unsigned int xcr0, unused;
+	asm( ".byte 0x0f, 0x01, 0xd0" : "=a" (xcr0), "=d" (unused) : "c" (0) );	// xgetbv
+	return ( xcr0 & 6 ) == 6;
+}
@@ -6,6 +6,14 @@
 // $NoKeywords: $
 //=============================================================================//
 
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
 #include "cmdlib.h"
 #include "mathlib/mathlib.h"
 #include "bsplib.h"
@@ -28,6 +36,8 @@
 #include "vtf/vtf.h"
 #include "lzma/lzma.h"
 #include "tier1/lzmaDecoder.h"
+#include "threads.h"
+#include "bitvec.h"
 
 //=============================================================================
 
@@ -705,6 +715,9 @@ template< class T > static void AddLump( int lumpnum, CUtlVector<T> &data, int v
 dheader_t		*g_pBSPHeader;
 FileHandle_t	g_hBSPFile;
 
+// The file OpenBSPFile has open; g_pBSPHeader points to the start of it
+static CMappedBSPFile	g_MappedBSPFile;
+
 struct Lump_t
 {
 	void	*pLumps[HEADER_LUMPS];
@@ -716,13 +729,60 @@ CGameLump	g_GameLumps;
 
 static IZip *s_pakFile = 0;
 
+//-----------------------------------------------------------------------------
+// While WriteBSPFile runs, lumps at least this big are written straight from
+// their arrays, and everything smaller (small lumps, padding, game lump and
+// occluder headers) is collected into one buffer and written in one go.
+//-----------------------------------------------------------------------------
+#define BSP_WRITE_COMBINE_SIZE	( 64 * 1024 )
+
+static bool			g_bCombineBSPWrites = false;
+static CUtlBuffer	g_BSPWriteBuffer;
+
+static void FlushBSPWrites( void )
+{
+	if ( g_BSPWriteBuffer.TellPut() )
+	{
+		SafeWrite( g_hBSPFile, g_BSPWriteBuffer.Base(), g_BSPWriteBuffer.TellPut() );
+		g_BSPWriteBuffer.SeekPut( CUtlBuffer::SEEK_HEAD, 0 );
+	}
+}
+
+static void WriteBSPData( void *pData, int len )
+{
+	if ( !g_bCombineBSPWrites )
+	{
+		SafeWrite( g_hBSPFile, pData, len );
+		return;
+	}
+
+	if ( len >= BSP_WRITE_COMBINE_SIZE )
+	{
+		// keep the file in order, then write the lump from where it is
+		FlushBSPWrites();
+		SafeWrite( g_hBSPFile, pData, len );
+		return;
+	}
+
+	g_BSPWriteBuffer.Put( pData, len );
+	if ( g_BSPWriteBuffer.TellPut() >= BSP_WRITE_COMBINE_SIZE )
+	{
+		FlushBSPWrites();
+	}
+}
+
+static unsigned int TellBSPFile( void )
+{
+	return g_pFileSystem->Tell( g_hBSPFile ) + g_BSPWriteBuffer.TellPut();
+}
+
 //-----------------------------------------------------------------------------
 // Keep the file position aligned to an arbitrary boundary.
 // Returns updated file position.
 //-----------------------------------------------------------------------------
 static unsigned int AlignFilePosition( FileHandle_t hFile, int alignment )
 {
-	unsigned int currPosition = g_pFileSystem->Tell( hFile );
+	unsigned int currPosition = ( hFile == g_hBSPFile ) ? TellBSPFile() : g_pFileSystem->Tell( hFile );
 
 	if ( alignment >= 2 )
 	{
@@ -742,7 +802,14 @@ static unsigned int AlignFilePosition( FileHandle_t hFile, int alignment )
 			}
 
 			memset( pBuffer, 0, count );
-			SafeWrite( hFile, pBuffer, count );
+			if ( hFile == g_hBSPFile )
+			{
+				WriteBSPData( pBuffer, count );
+			}
+			else
+			{
+				SafeWrite( hFile, pBuffer, count );
+			}
 
 			if ( pBuffer != smallBuffer )
 			{
@@ -1292,7 +1359,7 @@ static void AddGameLumps( )
 
 	lump_t* lump = &g_pBSPHeader->lumps[LUMP_GAME_LUMP];
 	
-	lump->fileofs = g_pFileSystem->Tell( g_hBSPFile );
+	lump->fileofs = TellBSPFile();
 	lump->filelen = size;
 
 	// write header
@@ -1324,7 +1391,7 @@ static void AddGameLumps( )
 		{
 			g_GameLumps.SwapGameLump( g_GameLumps.GetGameLumpId(h), g_GameLumps.GetGameLumpVersion(h), (byte*)g_GameLumps.GetGameLump(h), (byte*)g_GameLumps.GetGameLump(h), lumpsize );
 		}
-		SafeWrite( g_hBSPFile, g_GameLumps.GetGameLump(h), lumpsize );
+		WriteBSPData( g_GameLumps.GetGameLump(h), lumpsize );
 	}
 
 	// align to doubleword
@@ -1350,7 +1417,7 @@ static void AddOcclusionLump( )
 
 	lump_t *lump = &g_pBSPHeader->lumps[LUMP_OCCLUSION];
 
-	lump->fileofs = g_pFileSystem->Tell( g_hBSPFile );
+	lump->fileofs = TellBSPFile();
 	lump->filelen = nLumpLength;
 	lump->version = LUMP_OCCLUSION_VERSION;
 	lump->uncompressedSize = 0;
@@ -1465,9 +1532,16 @@ int CompressVis (byte *vis, byte *dest)
 }
 
 
+// Nonzero if any of the eight bytes in v is zero
+#define VIS_HAS_ZERO_BYTE( v )	( ( (v) - 0x0101010101010101ULL ) & ~(v) & 0x8080808080808080ULL )
+
 /*
 ===================
 DecompressVis
+
+Reads a word at a time: the literal bytes ahead of the first zero in the word
+are copied at once, and the zero starts a run. Rows in dvisdata are read that
+way while a whole word is left in the lump; anything else a byte at a time.
 ===================
 */
 void DecompressVis (byte *in, byte *decompressed)
@@ -1475,14 +1549,35 @@ void DecompressVis (byte *in, byte *decompressed)
 	int		c;
 	byte	*out;
 	int		row;
+	uint64	word;
 
 //	row = (r_numvisleafs+7)>>3;	
 	row = (dvis->numclusters+7)>>3;	
 	out = decompressed;
 
+	byte *inEnd = ( in >= dvisdata && in < dvisdata + visdatasize ) ? dvisdata + visdatasize : in;
+
 	do
 	{
-		if (*in)
+		if ( ( row - ( out - decompressed ) ) >= (int)sizeof( word ) && inEnd - in >= (int)sizeof( word ) )
+		{
+			memcpy( &word, in, sizeof( word ) );
+			uint64 zeros = VIS_HAS_ZERO_BYTE( word );
+
+			// the whole word fits, so write it and keep the bytes before the first zero
+			memcpy( out, &word, sizeof( word ) );
+			if ( !zeros )
+			{
+				in += sizeof( word );
+				out += sizeof( word );
+				continue;
+			}
+
+			int nLiterals = ( (unsigned int)zeros ? FirstBitInWord( (unsigned int)zeros, 0 ) : FirstBitInWord( (unsigned int)( zeros >> 32 ), 32 ) ) >> 3;
+			in += nLiterals;
+			out += nLiterals;
+		}
+		else if (*in)
 		{
 			*out++ = *in++;
 			continue;
@@ -1497,11 +1592,8 @@ void DecompressVis (byte *in, byte *decompressed)
 			c = row - (out - decompressed);
 			Warning( "warning: Vis decompression overrun\n" );
 		}
-		while (c)
-		{
-			*out++ = 0;
-			c--;
-		}
+		memset( out, 0, c );
+		out += c;
 	} while (out - decompressed < row);
 }
 
@@ -1985,6 +2077,368 @@ int CopyVariableLump( int lump, void **dest, int forceVersion = -1 )
 	return CopyLumpInternal<T>( lump, (T*)*dest, forceVersion );
 }
 
+//-----------------------------------------------------------------------------
+//	Mapped BSP files
+//-----------------------------------------------------------------------------
+
+// The lump swappers work off the global swap state. This sets it up the way
+// LoadBSPFile would for a file of the other byte order, while it's in scope.
+class CSwapOnLoadScope
+{
+public:
+	CSwapOnLoadScope()
+	{
+		m_bSwapOnLoad = g_bSwapOnLoad;
+		m_bSwapBytes = g_Swap.IsSwappingBytes();
+		g_bSwapOnLoad = true;
+		g_Swap.ActivateByteSwapping( true );
+	}
+
+	~CSwapOnLoadScope()
+	{
+		g_bSwapOnLoad = m_bSwapOnLoad;
+		g_Swap.ActivateByteSwapping( m_bSwapBytes );
+	}
+
+private:
+	bool m_bSwapOnLoad;
+	bool m_bSwapBytes;
+};
+
+CMappedBSPFile::CMappedBSPFile()
+{
+	m_pFileData = NULL;
+	m_nFileSize = 0;
+	m_bMapped = false;
+#ifdef _WIN32
+	m_hFile = INVALID_HANDLE_VALUE;
+	m_hMapping = NULL;
+#endif
+	memset( &m_Header, 0, sizeof( m_Header ) );
+	m_bSwap = false;
+	memset( m_pLumpCopy, 0, sizeof( m_pLumpCopy ) );
+	m_bGameLumpsParsed = false;
+}
+
+CMappedBSPFile::~CMappedBSPFile()
+{
+	Close();
+}
+
+bool CMappedBSPFile::MapFile( const char *pFilename )
+{
+#ifdef _WIN32
+	m_hFile = ::CreateFile( pFilename, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_FLAG_RANDOM_ACCESS, NULL );
+	if ( m_hFile == INVALID_HANDLE_VALUE )
+		return false;
+
+	DWORD dwSizeHigh = 0;
+	DWORD dwSize = ::GetFileSize( (HANDLE)m_hFile, &dwSizeHigh );
+	if ( dwSizeHigh != 0 || dwSize > INT_MAX || dwSize < sizeof( dheader_t ) )
+	{
+		::CloseHandle( (HANDLE)m_hFile );
+		m_hFile = INVALID_HANDLE_VALUE;
+		return false;
+	}
+
+	m_hMapping = ::CreateFileMapping( (HANDLE)m_hFile, NULL, PAGE_WRITECOPY, 0, 0, NULL );
+	if ( m_hMapping )
+	{
+		m_pFileData = (byte *)::MapViewOfFile( (HANDLE)m_hMapping, FILE_MAP_COPY, 0, 0, 0 );
+	}
+
+	if ( !m_pFileData )
+	{
+		if ( m_hMapping )
+		{
+			::CloseHandle( (HANDLE)m_hMapping );
+			m_hMapping = NULL;
+		}
+		::CloseHandle( (HANDLE)m_hFile );
+		m_hFile = INVALID_HANDLE_VALUE;
+		return false;
+	}
+
+	m_nFileSize = (int)dwSize;
+#else
+	int hFile = ::open( pFilename, O_RDONLY );
+	if ( hFile == -1 )
+		return false;
+
+	struct stat fileStat;
+	if ( fstat( hFile, &fileStat ) != 0 || fileStat.st_size > INT_MAX || fileStat.st_size < (off_t)sizeof( dheader_t ) )
+	{
+		::close( hFile );
+		return false;
+	}
+
+	void *pView = mmap( NULL, fileStat.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, hFile, 0 );
+
+	// the mapping holds its own reference to the file
+	::close( hFile );
+
+	if ( pView == MAP_FAILED )
+		return false;
+
+	m_pFileData = (byte *)pView;
+	m_nFileSize = (int)fileStat.st_size;
+#endif
+
+	m_bMapped = true;
+	return true;
+}
+
+bool CMappedBSPFile::Open( const char *pFilename, bool bMapFile )
+{
+	Close();
+
+	// Map the file if it's on disk, under its own name or wherever the filesystem finds it
+	char szFullPath[MAX_PATH];
+	if ( !bMapFile ||
+		 ( !MapFile( pFilename ) &&
+		   !( g_pFullFileSystem->RelativePathToFullPath( pFilename, NULL, szFullPath, sizeof( szFullPath ) ) && MapFile( szFullPath ) ) ) )
+	{
+		// Otherwise read it, the same as LoadFile would for LoadBSPFile
+		int nPathLength;
+		if ( !g_pFileSystem->FileExists( pFilename ) && !CmdLib_HasBasePath( pFilename, nPathLength ) )
+			return false;
+
+		m_nFileSize = LoadFile( pFilename, (void **)&m_pFileData );
+		if ( !m_pFileData || m_nFileSize < (int)sizeof( dheader_t ) )
+		{
+			Close();
+			return false;
+		}
+	}
+
+	// The ident tells which byte order the file is in
+	m_Header = *(dheader_t *)m_pFileData;
+	m_bSwap = ( m_Header.ident != IDBSPHEADER && DWordSwap( m_Header.ident ) == IDBSPHEADER );
+	if ( m_bSwap )
+	{
+		CByteswap swap;
+		swap.ActivateByteSwapping( true );
+		swap.SwapFieldsToTargetEndian( &m_Header );
+	}
+
+	return true;
+}
+
+void CMappedBSPFile::Close()
+{
+	for ( int i = 0; i < HEADER_LUMPS; i++ )
+	{
+		free( m_pLumpCopy[i] );
+		m_pLumpCopy[i] = NULL;
+	}
+
+	for ( int i = 0; i < m_GameLumpCopies.Count(); i++ )
+	{
+		free( m_GameLumpCopies[i] );
+	}
+	m_GameLumpCopies.Purge();
+	m_GameLumps.Purge();
+	m_bGameLumpsParsed = false;
+
+	if ( m_bMapped )
+	{
+#ifdef _WIN32
+		::UnmapViewOfFile( m_pFileData );
+		::CloseHandle( (HANDLE)m_hMapping );
+		::CloseHandle( (HANDLE)m_hFile );
+		m_hMapping = NULL;
+		m_hFile = INVALID_HANDLE_VALUE;
+#else
+		munmap( m_pFileData, m_nFileSize );
+#endif
+	}
+	else
+	{
+		free( m_pFileData );
+	}
+
+	m_pFileData = NULL;
+	m_nFileSize = 0;
+	m_bMapped = false;
+	memset( &m_Header, 0, sizeof( m_Header ) );
+	m_bSwap = false;
+}
+
+//-----------------------------------------------------------------------------
+// Swaps a lump of a file of the other byte order into pDest
+//-----------------------------------------------------------------------------
+void CMappedBSPFile::SwapLump( int lump, int elementSize, datamap_t *pDataMap, void *pDest, const void *pSrc, int length )
+{
+	CSwapOnLoadScope swapOnLoad;
+
+	byte *pDestBytes = (byte *)pDest;
+	byte *pSrcBytes = (byte *)pSrc;
+	if ( pDataMap )
+	{
+		for ( int i = 0; i < length / elementSize; i++ )
+		{
+			g_Swap.SwapFieldsToTargetEndian( pDestBytes + i * elementSize, pSrcBytes + i * elementSize, pDataMap );
+		}
+	}
+	else
+	{
+		switch ( lump )
+		{
+		case LUMP_VISIBILITY:
+			SwapVisibilityLump( pDestBytes, pSrcBytes, length / elementSize );
+			break;
+
+		case LUMP_PHYSCOLLIDE:
+			{
+				unsigned int count = length / elementSize;
+				SwapPhyscollideLump( pDestBytes, pSrcBytes, count );
+			}
+			break;
+
+		case LUMP_PHYSDISP:
+			SwapPhysdispLump( pDestBytes, pSrcBytes, length / elementSize );
+			break;
+
+		default:
+			if ( elementSize == sizeof( short ) )
+			{
+				g_Swap.SwapBufferToTargetEndian( (short *)pDestBytes, (short *)pSrcBytes, length / elementSize );
+			}
+			else if ( elementSize == sizeof( int ) )
+			{
+				g_Swap.SwapBufferToTargetEndian( (int *)pDestBytes, (int *)pSrcBytes, length / elementSize );
+			}
+			else
+			{
+				memcpy( pDestBytes, pSrcBytes, length );
+			}
+			break;
+		}
+	}
+}
+
+void *CMappedBSPFile::GetLumpData( int lump, int elementSize, datamap_t *pDataMap, int fieldType, bool bMutable, int forceVersion, int *pCount )
+{
+	Assert( IsOpen() );
+
+	unsigned int length = m_Header.lumps[lump].filelen;
+	unsigned int ofs = m_Header.lumps[lump].fileofs;
+	if ( ofs > (unsigned int)m_nFileSize || length > (unsigned int)m_nFileSize - ofs )
+	{
+		Error( "CMappedBSPFile: lump %d is past the end of the file!", lump );
+	}
+
+	// Vectors are asked for as floats
+	int fieldSize = ( fieldType == FIELD_VECTOR ) ? sizeof( Vector ) : elementSize;
+	if ( length % fieldSize )
+	{
+		Error( "ValidateLump: odd size for lump %d", lump );
+	}
+
+	if ( forceVersion >= 0 && forceVersion != m_Header.lumps[lump].version )
+	{
+		Error( "ValidateLump: old version for lump %d in map!", lump );
+	}
+
+	if ( pCount )
+	{
+		*pCount = length / fieldSize;
+	}
+
+	if ( !length )
+		return NULL;
+
+	if ( m_pLumpCopy[lump] )
+		return m_pLumpCopy[lump];
+
+	// Views of lumps in machine order point into the file
+	if ( !m_bSwap && !bMutable )
+		return m_pFileData + ofs;
+
+	m_pLumpCopy[lump] = malloc( length );
+	if ( m_bSwap )
+	{
+		SwapLump( lump, elementSize, pDataMap, m_pLumpCopy[lump], m_pFileData + ofs, length );
+	}
+	else
+	{
+		memcpy( m_pLumpCopy[lump], m_pFileData + ofs, length );
+	}
+
+	return m_pLumpCopy[lump];
+}
+
+//-----------------------------------------------------------------------------
+// Reads the game lump directory, swapping it if need be
+//-----------------------------------------------------------------------------
+void CMappedBSPFile::ParseGameLumpDirectory()
+{
+	m_bGameLumpsParsed = true;
+
+	unsigned int length = m_Header.lumps[LUMP_GAME_LUMP].filelen;
+	unsigned int ofs = m_Header.lumps[LUMP_GAME_LUMP].fileofs;
+	if ( length < sizeof( dgamelumpheader_t ) || ofs > (unsigned int)m_nFileSize || length > (unsigned int)m_nFileSize - ofs )
+		return;
+
+	CByteswap swap;
+	swap.ActivateByteSwapping( m_bSwap );
+
+	dgamelumpheader_t gameLumpHeader = *(dgamelumpheader_t *)( m_pFileData + ofs );
+	swap.SwapFieldsToTargetEndian( &gameLumpHeader );
+
+	int lumpCount = gameLumpHeader.lumpCount;
+	if ( lumpCount <= 0 || (unsigned int)lumpCount > ( length - sizeof( dgamelumpheader_t ) ) / sizeof( dgamelump_t ) )
+		return;
+
+	m_GameLumps.CopyArray( (dgamelump_t *)( m_pFileData + ofs + sizeof( dgamelumpheader_t ) ), lumpCount );
+	swap.SwapFieldsToTargetEndian( m_GameLumps.Base(), lumpCount );
+
+	m_GameLumpCopies.SetCount( lumpCount );
+	memset( m_GameLumpCopies.Base(), 0, lumpCount * sizeof( void * ) );
+}
+
+const void *CMappedBSPFile::GetGameLump( GameLumpId_t id, int *pSize, int *pVersion )
+{
+	Assert( IsOpen() );
+
+	if ( !m_bGameLumpsParsed )
+	{
+		ParseGameLumpDirectory();
+	}
+
+	for ( int i = 0; i < m_GameLumps.Count(); i++ )
+	{
+		const dgamelump_t &gameLump = m_GameLumps[i];
+		if ( gameLump.id != id )
+			continue;
+
+		if ( gameLump.fileofs < 0 || gameLump.filelen <= 0 || gameLump.fileofs > m_nFileSize - gameLump.filelen )
+			return NULL;
+
+		if ( pSize )
+		{
+			*pSize = gameLump.filelen;
+		}
+		if ( pVersion )
+		{
+			*pVersion = gameLump.version;
+		}
+
+		if ( !m_bSwap )
+			return m_pFileData + gameLump.fileofs;
+
+		if ( !m_GameLumpCopies[i] )
+		{
+			CSwapOnLoadScope swapOnLoad;
+			m_GameLumpCopies[i] = malloc( gameLump.filelen );
+			g_GameLumps.SwapGameLump( gameLump.id, gameLump.version, (byte *)m_GameLumpCopies[i], m_pFileData + gameLump.fileofs, gameLump.filelen );
+		}
+		return m_GameLumpCopies[i];
+	}
+
+	return NULL;
+}
+
 //-----------------------------------------------------------------------------
 //	Add/Write unknown lumps
 //-----------------------------------------------------------------------------
@@ -2177,12 +2631,19 @@ void ValidateHeader( const char *filename, const dheader_t *pHeader )
 //	Low level BSP opener for external parsing. Parses headers, but nothing else.
 //	You must close the BSP, via CloseBSPFile().
 //-----------------------------------------------------------------------------
-void OpenBSPFile( const char *filename )
+void OpenBSPFile( const char *filename, bool bMapFile )
 {
 	Lumps_Init();
 
-	// load the file header
-	LoadFile( filename, (void **)&g_pBSPHeader );
+	// map the file rather than reading it all in, the lumps get copied out anyway.
+	// Callers that write a file while this one is open read it in instead: the
+	// output may be the same file, and truncating it under a live mapping
+	// faults on POSIX and fails on Windows.
+	if ( !g_MappedBSPFile.Open( filename, bMapFile ) )
+	{
+		Error( "Error opening %s", filename );
+	}
+	g_pBSPHeader = (dheader_t *)g_MappedBSPFile.GetFileData();
 
 	if ( g_bSwapOnLoad )
 	{
@@ -2200,7 +2661,7 @@ void OpenBSPFile( const char *filename )
 //-----------------------------------------------------------------------------
 void CloseBSPFile( void )
 {
-	free( g_pBSPHeader );
+	g_MappedBSPFile.Close();
 	g_pBSPHeader = NULL;
 }
 
@@ -2439,45 +2900,43 @@ void LoadBSPFile_FileSystemOnly( const char *filename )
 {
 	Lumps_Init();
 
-	//
-	// load the file header
-	//
-	LoadFile( filename, (void **)&g_pBSPHeader );
+	// only the pak file lump is needed, so view it in place
+	CMappedBSPFile bsp;
+	if ( !bsp.Open( filename ) )
+	{
+		Error( "Error opening %s", filename );
+	}
 
-	ValidateHeader( filename, g_pBSPHeader );
+	ValidateHeader( filename, bsp.GetHeader() );
 
 	// Load PAK file lump into appropriate data structure
-	byte *pakbuffer = NULL;
-	int paksize = CopyVariableLump<byte>( FIELD_CHARACTER, LUMP_PAKFILE, ( void ** )&pakbuffer, 1 );
+	int paksize;
+	const byte *pakbuffer = bsp.GetLump<byte>( FIELD_CHARACTER, LUMP_PAKFILE, &paksize, 1 );
 	if ( paksize > 0 )
 	{
-		GetPakFile()->ParseFromBuffer( pakbuffer, paksize );
+		GetPakFile()->ParseFromBuffer( (void *)pakbuffer, paksize );
 	}
 	else
 	{
 		GetPakFile()->Reset();
 	}
-
-	free( pakbuffer );
-
-	// everything has been copied out
-	free( g_pBSPHeader );
-	g_pBSPHeader = NULL;
 }
 
 void ExtractZipFileFromBSP( char *pBSPFileName, char *pZipFileName )
 {
 	Lumps_Init();
 
-	//
-	// load the file header
-	//
-	LoadFile( pBSPFileName, (void **)&g_pBSPHeader);
+	CMappedBSPFile bsp;
+	if ( !bsp.Open( pBSPFileName ) )
+	{
+		Error( "Error opening %s", pBSPFileName );
+	}
 
-	ValidateHeader( pBSPFileName, g_pBSPHeader );
+	ValidateHeader( pBSPFileName, bsp.GetHeader() );
 
-	byte *pakbuffer = NULL;
-	int paksize = CopyVariableLump<byte>( FIELD_CHARACTER, LUMP_PAKFILE, ( void ** )&pakbuffer );
+	// written straight out of the file
+	int paksize;
+	const byte *pakbuffer = bsp.GetLump<byte>( FIELD_CHARACTER, LUMP_PAKFILE, &paksize );
 	if ( paksize > 0 )
 	{
 		FILE *fp;
@@ -2541,12 +3000,12 @@ static void AddLumpInternal( int lumpnum, void *data, int len, int version )
 
 	lump = &g_pBSPHeader->lumps[lumpnum];
 
-	lump->fileofs = g_pFileSystem->Tell( g_hBSPFile );
+	lump->fileofs = TellBSPFile();
 	lump->filelen = len;
 	lump->version = version;
 	lump->uncompressedSize = 0;
 
-	SafeWrite( g_hBSPFile, data, len );
+	WriteBSPData( data, len );
 
 	// pad out to the next dword
 	AlignFilePosition( g_hBSPFile, 4 );
@@ -2582,7 +3041,7 @@ static void WriteData( int fieldType, T *pData, int count )
 	{
 		SwapInPlace( fieldType, pData, count );
 	}
-	SafeWrite( g_hBSPFile, pData, count * sizeof(T) );
+	WriteBSPData( pData, count * sizeof(T) );
 }
 
 template< class T >
@@ -2592,7 +3051,7 @@ static void WriteData( T *pData, int count )
 	{
 		SwapInPlace( pData, count );
 	}
-	SafeWrite( g_hBSPFile, pData, count * sizeof(T) );
+	WriteBSPData( pData, count * sizeof(T) );
 }
 
 //-----------------------------------------------------------------------------
@@ -2636,6 +3095,8 @@ void WriteBSPFile( const char *filename, char *pUnused )
 	g_hBSPFile = SafeOpenWrite( filename );
 	WriteData( g_pBSPHeader );	// overwritten later
 
+	g_bCombineBSPWrites = true;
+
 	AddLump( LUMP_PLANES, dplanes, numplanes );
 	AddLump( LUMP_LEAFS, dleafs, numleafs, LUMP_LEAFS_VERSION );
 	AddLump( LUMP_LEAF_AMBIENT_LIGHTING, g_LeafAmbientLightingLDR, LUMP_LEAF_AMBIENT_LIGHTING_VERSION );
@@ -2728,6 +3189,10 @@ void WriteBSPFile( const char *filename, char *pUnused )
 	// write any additional lumps
 	Lumps_Write();
 
+	FlushBSPWrites();
+	g_bCombineBSPWrites = false;
+	g_BSPWriteBuffer.Purge();
+
 	g_pFileSystem->Seek( g_hBSPFile, 0, FILESYSTEM_SEEK_HEAD );
 	WriteData( g_pBSPHeader );
 	g_pFileSystem->Close( g_hBSPFile );
@@ -4388,17 +4853,6 @@ void BuildStaticPropNameTable()
 	g_GameLumps.DestroyAllGameLumps();
 }
 
-int AlignBuffer( CUtlBuffer &buffer, int alignment )
-{
-	unsigned int newPosition = AlignValue( buffer.TellPut(), alignment );
-	int padLength = newPosition - buffer.TellPut();
-	for ( int i = 0; i<padLength; i++ )
-	{
-		buffer.PutChar( '\0' );
-	}
-	return buffer.TellPut();
-}
-
 struct SortedLump_t
 {
 	int		lumpNum;
@@ -4436,115 +4890,175 @@ int SortLumpsByOffset( const SortedLump_t *pSortedLumpA, const SortedLump_t *pSo
 	return 0;
 }
 
-bool CompressGameLump( dheader_t *pInBSPHeader, dheader_t *pOutBSPHeader, CUtlBuffer &outputBuffer, CompressFunc_t pCompressFunc )
-{
-	CByteswap	byteSwap;
+//-----------------------------------------------------------------------------
+// RepackBSP compresses each lump, each game lump and the pak file as its own
+// job on the thread pool, then lays the results out in the input's offset
+// order. Compression is deterministic, so the output is the same however
+// many threads run the jobs.
+//-----------------------------------------------------------------------------
+struct RepackJob_t
+{
+	int				order;				// index into g_RepackJobs
+	int				lumpNum;
+	int				gameLump;			// index into the game lump directory, -1 for whole lumps
+	byte			*pInput;			// the lump as it is in the input
+	unsigned int	inputSize;
+	bool			bInputCompressed;	// LZMA compressed in the input
+	unsigned int	uncompressedSize;	// size the input header expects it to uncompress to, 0 for any
+
+	CUtlBuffer		input;				// the lump uncompressed, or a view of the input
+	CUtlBuffer		output;				// the compressed lump, or the new pak file
+	bool			bCompressed;
+	unsigned int	outputOffset;		// where it goes in the output
+};
 
-	dgamelumpheader_t* pInGameLumpHeader = (dgamelumpheader_t*)(((byte *)pInBSPHeader) + pInBSPHeader->lumps[LUMP_GAME_LUMP].fileofs);
-	dgamelump_t* pInGameLump = (dgamelump_t*)(pInGameLumpHeader + 1);
+static CUtlVector< RepackJob_t * >	g_RepackJobs;			// in output order
+static CUtlVector< RepackJob_t * >	g_RepackJobsBySize;		// biggest first, so they don't end up last
+static CompressFunc_t				g_pRepackCompressFunc;
+static IZip::eCompressionType		g_RepackPackfileCompression;
 
-	if ( IsX360() )
+static RepackJob_t *AddRepackJob( int lumpNum, int gameLump, byte *pInput, unsigned int inputSize, bool bInputCompressed, unsigned int uncompressedSize )
+{
+	RepackJob_t *pJob = new RepackJob_t;
+	pJob->order = g_RepackJobs.Count();
+	pJob->lumpNum = lumpNum;
+	pJob->gameLump = gameLump;
+	pJob->pInput = pInput;
+	pJob->inputSize = inputSize;
+	pJob->bInputCompressed = bInputCompressed;
+	pJob->uncompressedSize = uncompressedSize;
+	pJob->bCompressed = false;
+	pJob->outputOffset = 0;
+	g_RepackJobs.AddToTail( pJob );
+	return pJob;
+}
+
+static int RepackJobSizeCompare( RepackJob_t * const *ppJobA, RepackJob_t * const *ppJobB )
+{
+	// want descending, keep output order for ties so the dispatch order is stable
+	if ( (*ppJobA)->inputSize != (*ppJobB)->inputSize )
 	{
-		byteSwap.ActivateByteSwapping( true );
-		byteSwap.SwapFieldsToTargetEndian( pInGameLumpHeader );
-		byteSwap.SwapFieldsToTargetEndian( pInGameLump, pInGameLumpHeader->lumpCount );
+		return ( (*ppJobA)->inputSize > (*ppJobB)->inputSize ) ? -1 : 1;
 	}
+	return (*ppJobA)->order - (*ppJobB)->order;
+}
 
-	unsigned int newOffset = outputBuffer.TellPut();
-	// Make room for gamelump header and gamelump structs, which we'll write at the end
-	outputBuffer.SeekPut( CUtlBuffer::SEEK_CURRENT, sizeof( dgamelumpheader_t ) );
-	outputBuffer.SeekPut( CUtlBuffer::SEEK_CURRENT, pInGameLumpHeader->lumpCount * sizeof( dgamelump_t ) );
+static void UncompressRepackInput( RepackJob_t *pJob )
+{
+	if ( !pJob->bInputCompressed )
+	{
+		// Just use input
+		pJob->input.SetExternalBuffer( pJob->pInput, pJob->inputSize, pJob->inputSize );
+		return;
+	}
 
-	// Start with input lumps, and fixup
-	dgamelumpheader_t sOutGameLumpHeader = *pInGameLumpHeader;
-	CUtlBuffer sOutGameLumpBuf;
-	sOutGameLumpBuf.Put( pInGameLump, pInGameLumpHeader->lumpCount * sizeof( dgamelump_t ) );
-	dgamelump_t *sOutGameLump = (dgamelump_t *)sOutGameLumpBuf.Base();
+	if ( CLZMA::IsCompressed( pJob->pInput ) && ( !pJob->uncompressedSize || pJob->uncompressedSize == CLZMA::GetActualSize( pJob->pInput ) ) )
+	{
+		unsigned int actualSize = CLZMA::GetActualSize( pJob->pInput );
+		pJob->input.EnsureCapacity( actualSize );
+		unsigned int outSize = CLZMA::Uncompress( pJob->pInput, (unsigned char *)pJob->input.Base() );
+		pJob->input.SeekPut( CUtlBuffer::SEEK_CURRENT, outSize );
+		if ( outSize != actualSize )
+		{
+			Warning( "Decompressed size differs from header, BSP may be corrupt\n" );
+		}
+	}
+	else if ( pJob->gameLump >= 0 )
+	{
+		Warning( "Unsupported BSP: Unrecognized compressed game lump\n" );
+	}
+	else
+	{
+		Warning( "Unsupported BSP: Unrecognized compressed lump\n" );
+	}
+}
 
-	// add a dummy terminal gamelump
-	// purposely NOT updating the .filelen to reflect the compressed size, but leaving as original size
-	// callers use the next entry offset to determine compressed size
-	sOutGameLumpHeader.lumpCount++;
-	dgamelump_t dummyLump = { 0 };
-	outputBuffer.Put( &dummyLump, sizeof( dgamelump_t ) );
+static void RepackPakFile( RepackJob_t *pJob )
+{
+	IZip *newPakFile = IZip::CreateZip( NULL );
+	IZip *oldPakFile = IZip::CreateZip( NULL );
+	oldPakFile->ParseFromBuffer( pJob->input.Base(), pJob->input.Size() );
 
-	for ( int i = 0; i < pInGameLumpHeader->lumpCount; i++ )
+	int id = -1;
+	int fileSize;
+	while ( 1 )
 	{
-		CUtlBuffer inputBuffer;
-		CUtlBuffer compressedBuffer;
+		char relativeName[MAX_PATH];
+		id = GetNextFilename( oldPakFile, id, relativeName, sizeof( relativeName ), fileSize );
+		if ( id == -1 )
+			break;
 
-		sOutGameLump[i].fileofs = AlignBuffer( outputBuffer, 4 );
+		CUtlBuffer sourceBuf;
 
-		if ( pInGameLump[i].filelen )
+		bool bOK = ReadFileFromPak( oldPakFile, relativeName, false, sourceBuf );
+		if ( !bOK )
 		{
-			if ( pInGameLump[i].flags & GAMELUMPFLAG_COMPRESSED )
-			{
-				byte *pCompressedLump = ((byte *)pInBSPHeader) + pInGameLump[i].fileofs;
-				if ( CLZMA::IsCompressed( pCompressedLump ) )
-				{
-					inputBuffer.EnsureCapacity( CLZMA::GetActualSize( pCompressedLump ) );
-					unsigned int outSize = CLZMA::Uncompress( pCompressedLump, (unsigned char *)inputBuffer.Base() );
-					inputBuffer.SeekPut( CUtlBuffer::SEEK_CURRENT, outSize );
-					if ( outSize != CLZMA::GetActualSize( pCompressedLump ) )
-					{
-						Warning( "Decompressed size differs from header, BSP may be corrupt\n" );
-					}
-				}
-				else
-				{
-					Assert( CLZMA::IsCompressed( pCompressedLump ) );
-					Warning( "Unsupported BSP: Unrecognized compressed game lump\n" );
-				}
+			Error( "Failed to load '%s' from lump pak for repacking.\n", relativeName );
+			continue;
+		}
 
-			}
-			else
-			{
-				inputBuffer.SetExternalBuffer( ((byte *)pInBSPHeader) + pInGameLump[i].fileofs,
-				                               pInGameLump[i].filelen, pInGameLump[i].filelen );
-			}
+		AddBufferToPak( newPakFile, relativeName, sourceBuf.Base(), sourceBuf.TellMaxPut(), false, g_RepackPackfileCompression );
 
-			bool bCompressed = pCompressFunc ? pCompressFunc( inputBuffer, compressedBuffer ) : false;
-			if ( bCompressed )
-			{
-				sOutGameLump[i].flags |= GAMELUMPFLAG_COMPRESSED;
+		DevMsg( "Repacking BSP: Created '%s' in lump pak\n", relativeName );
+	}
 
-				outputBuffer.Put( compressedBuffer.Base(), compressedBuffer.TellPut() );
-				compressedBuffer.Purge();
-			}
-			else
-			{
-				// as is, clear compression flag from input lump
-				sOutGameLump[i].flags &= ~GAMELUMPFLAG_COMPRESSED;
-				outputBuffer.Put( inputBuffer.Base(), inputBuffer.TellPut() );
-			}
-		}
+	// the pak's offsets are relative to its start, so it can be saved on its own
+	newPakFile->SaveToBuffer( pJob->output );
+
+	IZip::ReleaseZip( oldPakFile );
+	IZip::ReleaseZip( newPakFile );
+}
+
+static void RepackLumpJob( int iThread, int iJob )
+{
+	RepackJob_t *pJob = g_RepackJobsBySize[iJob];
+	if ( !pJob->inputSize )
+	{
+		// empty game lumps are left as they are
+		return;
 	}
 
-	// fix the dummy terminal lump
-	int lastLump = sOutGameLumpHeader.lumpCount-1;
-	sOutGameLump[lastLump].fileofs = outputBuffer.TellPut();
+	UncompressRepackInput( pJob );
 
-	if ( IsX360() )
+	if ( pJob->lumpNum == LUMP_PAKFILE )
 	{
-		// fix the output for 360, swapping it back
-		byteSwap.SwapFieldsToTargetEndian( sOutGameLump, sOutGameLumpHeader.lumpCount );
-		byteSwap.SwapFieldsToTargetEndian( &sOutGameLumpHeader );
+		RepackPakFile( pJob );
 	}
+	else
+	{
+		pJob->bCompressed = g_pRepackCompressFunc ? g_pRepackCompressFunc( pJob->input, pJob->output ) : false;
+	}
+}
 
-	pOutBSPHeader->lumps[LUMP_GAME_LUMP].fileofs = newOffset;
-	pOutBSPHeader->lumps[LUMP_GAME_LUMP].filelen = outputBuffer.TellPut() - newOffset;
-	// We set GAMELUMPFLAG_COMPRESSED and handle compression at the sub-lump level, this whole lump is not
-	// decompressable as a block.
-	pOutBSPHeader->lumps[LUMP_GAME_LUMP].uncompressedSize = 0;
+static void PadBuffer( CUtlBuffer &buffer, unsigned int offset )
+{
+	Assert( (unsigned int)buffer.TellPut() <= offset );
+	while ( (unsigned int)buffer.TellPut() < offset )
+	{
+		buffer.PutChar( '\0' );
+	}
+}
 
-	// Rewind to start and write lump headers
-	unsigned int endOffset = outputBuffer.TellPut();
-	outputBuffer.SeekPut( CUtlBuffer::SEEK_HEAD, newOffset );
-	outputBuffer.Put( &sOutGameLumpHeader, sizeof( dgamelumpheader_t ) );
-	outputBuffer.Put( sOutGameLumpBuf.Base(), sOutGameLumpBuf.TellPut() );
-	outputBuffer.SeekPut( CUtlBuffer::SEEK_HEAD, endOffset );
+static void PutRepackJob( CUtlBuffer &outputBuffer, RepackJob_t *pJob )
+{
+	PadBuffer( outputBuffer, pJob->outputOffset );
+	if ( pJob->bCompressed || pJob->lumpNum == LUMP_PAKFILE )
+	{
+		outputBuffer.Put( pJob->output.Base(), pJob->output.TellPut() );
+	}
+	else
+	{
+		// as is
+		outputBuffer.Put( pJob->input.Base(), pJob->input.TellPut() );
+	}
+}
 
-	return true;
+static unsigned int RepackJobSize( RepackJob_t *pJob )
+{
+	if ( pJob->bCompressed || pJob->lumpNum == LUMP_PAKFILE )
+		return pJob->output.TellPut();
+
+	return pJob->input.TellPut();
 }
 
 //-----------------------------------------------------------------------------
@@ -4593,9 +5107,7 @@ bool RepackBSP( CUtlBuffer &inputBuffer, CUtlBuffer &outputBuffer, CompressFunc_
 	}
 
 	unsigned int headerOffset = outputBuffer.TellPut();
-	outputBuffer.Put( pInBSPHeader, sizeof( dheader_t ) );
 
-	// This buffer grows dynamically, don't keep pointers to it around. Write out header at end.
 	dheader_t sOutBSPHeader = *pInBSPHeader;
 
 	// must adhere to input lump's offset order and process according to that, NOT lump num
@@ -4609,120 +5121,129 @@ bool RepackBSP( CUtlBuffer &inputBuffer, CUtlBuffer &outputBuffer, CompressFunc_
 	}
 	sortedLumps.Sort( SortLumpsByOffset );
 
-	// iterate in sorted order
+	// the game lump directory, which gets fixed up for the output
+	dgamelumpheader_t sOutGameLumpHeader = { 0 };
+	CUtlVector< dgamelump_t > sOutGameLumps;
+
+	// queue a job for each lump, and for each game lump, in output order
 	for ( int i = 0; i < HEADER_LUMPS; ++i )
 	{
 		SortedLump_t *pSortedLump = &sortedLumps[i];
 		int lumpNum = pSortedLump->lumpNum;
 
-		// Should be set below, don't copy over old data
-		sOutBSPHeader.lumps[lumpNum].fileofs = 0;
-		sOutBSPHeader.lumps[lumpNum].filelen = 0;
-		// Only set by compressed lumps
-		sOutBSPHeader.lumps[lumpNum].uncompressedSize = 0;
+		if ( !pSortedLump->pLump->filelen ) // Otherwise its degenerate
+			continue;
 
-		if ( pSortedLump->pLump->filelen ) // Otherwise its degenerate
+		if ( lumpNum == LUMP_GAME_LUMP )
 		{
-			int alignment = 4;
-			if ( lumpNum == LUMP_PAKFILE )
-			{
-				alignment = 2048;
-			}
-			unsigned int newOffset = AlignBuffer( outputBuffer, alignment );
+			// the game lump has to have each of its components individually compressed
+			dgamelumpheader_t* pInGameLumpHeader = (dgamelumpheader_t*)(((byte *)pInBSPHeader) + pSortedLump->pLump->fileofs);
+			dgamelump_t* pInGameLump = (dgamelump_t*)(pInGameLumpHeader + 1);
 
-			CUtlBuffer inputBuffer;
-			if ( pSortedLump->pLump->uncompressedSize )
-			{
-				byte *pCompressedLump = ((byte *)pInBSPHeader) + pSortedLump->pLump->fileofs;
-				if ( CLZMA::IsCompressed( pCompressedLump ) && pSortedLump->pLump->uncompressedSize == CLZMA::GetActualSize( pCompressedLump ) )
-				{
-					inputBuffer.EnsureCapacity( CLZMA::GetActualSize( pCompressedLump ) );
-					unsigned int outSize = CLZMA::Uncompress( pCompressedLump, (unsigned char *)inputBuffer.Base() );
-					inputBuffer.SeekPut( CUtlBuffer::SEEK_CURRENT, outSize );
-					if ( outSize != pSortedLump->pLump->uncompressedSize )
-					{
-						Warning( "Decompressed size differs from header, BSP may be corrupt\n" );
-					}
-				}
-				else
-				{
-					Assert( CLZMA::IsCompressed( pCompressedLump ) &&
-					        pSortedLump->pLump->uncompressedSize == CLZMA::GetActualSize( pCompressedLump ) );
-					Warning( "Unsupported BSP: Unrecognized compressed lump\n" );
-				}
-			}
-			else
+			if ( IsX360() )
 			{
-				// Just use input
-				inputBuffer.SetExternalBuffer( ((byte *)pInBSPHeader) + pSortedLump->pLump->fileofs,
-				                               pSortedLump->pLump->filelen, pSortedLump->pLump->filelen );
+				byteSwap.SwapFieldsToTargetEndian( pInGameLumpHeader );
+				byteSwap.SwapFieldsToTargetEndian( pInGameLump, pInGameLumpHeader->lumpCount );
 			}
 
-			if ( lumpNum == LUMP_GAME_LUMP )
+			sOutGameLumpHeader = *pInGameLumpHeader;
+			sOutGameLumps.CopyArray( pInGameLump, pInGameLumpHeader->lumpCount );
+
+			for ( int j = 0; j < pInGameLumpHeader->lumpCount; j++ )
 			{
-				// the game lump has to have each of its components individually compressed
-				CompressGameLump( pInBSPHeader, &sOutBSPHeader, outputBuffer, pCompressFunc );
+				AddRepackJob( lumpNum, j, ((byte *)pInBSPHeader) + pInGameLump[j].fileofs, pInGameLump[j].filelen,
+							  ( pInGameLump[j].flags & GAMELUMPFLAG_COMPRESSED ) != 0, 0 );
 			}
-			else if ( lumpNum == LUMP_PAKFILE )
-			{
-				IZip *newPakFile = IZip::CreateZip( NULL );
-				IZip *oldPakFile = IZip::CreateZip( NULL );
-				oldPakFile->ParseFromBuffer( inputBuffer.Base(), inputBuffer.Size() );
+		}
+		else
+		{
+			AddRepackJob( lumpNum, -1, ((byte *)pInBSPHeader) + pSortedLump->pLump->fileofs, pSortedLump->pLump->filelen,
+						  pSortedLump->pLump->uncompressedSize != 0, pSortedLump->pLump->uncompressedSize );
+		}
+	}
 
-				int id = -1;
-				int fileSize;
-				while ( 1 )
-				{
-					char relativeName[MAX_PATH];
-					id = GetNextFilename( oldPakFile, id, relativeName, sizeof( relativeName ), fileSize );
-					if ( id == -1 )
-						break;
+	// compress everything at once, biggest first
+	g_RepackJobsBySize.CopyArray( g_RepackJobs.Base(), g_RepackJobs.Count() );
+	g_RepackJobsBySize.Sort( RepackJobSizeCompare );
+	g_pRepackCompressFunc = pCompressFunc;
+	g_RepackPackfileCompression = packfileCompression;
+	RunThreadsOnIndividual( g_RepackJobsBySize.Count(), false, RepackLumpJob );
 
-					CUtlBuffer sourceBuf;
-					CUtlBuffer targetBuf;
+	// now that all the sizes are known, work out where everything goes
+	unsigned int offset = headerOffset + sizeof( dheader_t );
+	unsigned int gameLumpOffset = 0;
+	int iJob = 0;
+	for ( int i = 0; i < HEADER_LUMPS; ++i )
+	{
+		SortedLump_t *pSortedLump = &sortedLumps[i];
+		int lumpNum = pSortedLump->lumpNum;
 
-					bool bOK = ReadFileFromPak( oldPakFile, relativeName, false, sourceBuf );
-					if ( !bOK )
-					{
-						Error( "Failed to load '%s' from lump pak for repacking.\n", relativeName );
-						continue;
-					}
+		// Should be set below, don't copy over old data
+		sOutBSPHeader.lumps[lumpNum].fileofs = 0;
+		sOutBSPHeader.lumps[lumpNum].filelen = 0;
+		// Only set by compressed lumps
+		sOutBSPHeader.lumps[lumpNum].uncompressedSize = 0;
 
-					AddBufferToPak( newPakFile, relativeName, sourceBuf.Base(), sourceBuf.TellMaxPut(), false, packfileCompression );
+		if ( !pSortedLump->pLump->filelen )
+			continue;
 
-					DevMsg( "Repacking BSP: Created '%s' in lump pak\n", relativeName );
-				}
+		int alignment = 4;
+		if ( lumpNum == LUMP_PAKFILE )
+		{
+			alignment = 2048;
+		}
+		unsigned int newOffset = AlignValue( offset, alignment );
 
-				// save new pack to buffer
-				newPakFile->SaveToBuffer( outputBuffer );
-				sOutBSPHeader.lumps[lumpNum].fileofs = newOffset;
-				sOutBSPHeader.lumps[lumpNum].filelen = outputBuffer.TellPut() - newOffset;
-				// Note that this *lump* is uncompressed, it just contains a packfile that uses compression, so we're
-				// not setting lumps[lumpNum].uncompressedSize
+		if ( lumpNum == LUMP_GAME_LUMP )
+		{
+			// room for the gamelump header and gamelump structs, plus a dummy terminal gamelump
+			// purposely NOT updating the .filelen to reflect the compressed size, but leaving as original size
+			// callers use the next entry offset to determine compressed size
+			gameLumpOffset = newOffset;
+			offset = newOffset + sizeof( dgamelumpheader_t ) + ( sOutGameLumps.Count() + 1 ) * sizeof( dgamelump_t );
 
-				IZip::ReleaseZip( oldPakFile );
-				IZip::ReleaseZip( newPakFile );
-			}
-			else
+			for ( int j = 0; j < sOutGameLumps.Count(); j++ )
 			{
-				CUtlBuffer compressedBuffer;
-				bool bCompressed = pCompressFunc ? pCompressFunc( inputBuffer, compressedBuffer ) : false;
-				if ( bCompressed )
-				{
-					sOutBSPHeader.lumps[lumpNum].uncompressedSize = inputBuffer.TellPut();
-					sOutBSPHeader.lumps[lumpNum].filelen = compressedBuffer.TellPut();
-					sOutBSPHeader.lumps[lumpNum].fileofs = newOffset;
-					outputBuffer.Put( compressedBuffer.Base(), compressedBuffer.TellPut() );
-					compressedBuffer.Purge();
-				}
-				else
+				RepackJob_t *pJob = g_RepackJobs[iJob++];
+				offset = AlignValue( offset, 4 );
+				pJob->outputOffset = offset;
+				sOutGameLumps[j].fileofs = offset;
+
+				if ( sOutGameLumps[j].filelen )
 				{
-					// add as is
-					sOutBSPHeader.lumps[lumpNum].fileofs = newOffset;
-					sOutBSPHeader.lumps[lumpNum].filelen = inputBuffer.TellPut();
-					outputBuffer.Put( inputBuffer.Base(), inputBuffer.TellPut() );
+					if ( pJob->bCompressed )
+					{
+						sOutGameLumps[j].flags |= GAMELUMPFLAG_COMPRESSED;
+					}
+					else
+					{
+						// as is, clear compression flag from input lump
+						sOutGameLumps[j].flags &= ~GAMELUMPFLAG_COMPRESSED;
+					}
+					offset += RepackJobSize( pJob );
 				}
 			}
+
+			sOutBSPHeader.lumps[lumpNum].fileofs = newOffset;
+			sOutBSPHeader.lumps[lumpNum].filelen = offset - newOffset;
+			// We set GAMELUMPFLAG_COMPRESSED and handle compression at the sub-lump level, this whole lump is not
+			// decompressable as a block.
+		}
+		else
+		{
+			RepackJob_t *pJob = g_RepackJobs[iJob++];
+			pJob->outputOffset = newOffset;
+
+			sOutBSPHeader.lumps[lumpNum].fileofs = newOffset;
+			sOutBSPHeader.lumps[lumpNum].filelen = RepackJobSize( pJob );
+			if ( pJob->bCompressed )
+			{
+				sOutBSPHeader.lumps[lumpNum].uncompressedSize = pJob->input.TellPut();
+			}
+			// Note that the pak *lump* is uncompressed, it just contains a packfile that uses compression, so we're
+			// not setting lumps[lumpNum].uncompressedSize
+
+			offset = newOffset + sOutBSPHeader.lumps[lumpNum].filelen;
 		}
 	}
 
@@ -4733,11 +5254,49 @@ bool RepackBSP( CUtlBuffer &inputBuffer, CUtlBuffer &outputBuffer, CompressFunc_
 		byteSwap.SwapFieldsToTargetEndian( &sOutBSPHeader );
 	}
 
-	// Write out header
-	unsigned int endOffset = outputBuffer.TellPut();
-	outputBuffer.SeekPut( CUtlBuffer::SEEK_HEAD, headerOffset );
+	// and write it all out in one pass
+	outputBuffer.EnsureCapacity( offset );
 	outputBuffer.Put( &sOutBSPHeader, sizeof( sOutBSPHeader ) );
-	outputBuffer.SeekPut( CUtlBuffer::SEEK_HEAD, endOffset );
+
+	iJob = 0;
+	for ( int i = 0; i < HEADER_LUMPS; ++i )
+	{
+		SortedLump_t *pSortedLump = &sortedLumps[i];
+		if ( !pSortedLump->pLump->filelen )
+			continue;
+
+		if ( pSortedLump->lumpNum != LUMP_GAME_LUMP )
+		{
+			PutRepackJob( outputBuffer, g_RepackJobs[iJob++] );
+			continue;
+		}
+
+		int lumpCount = sOutGameLumps.Count();
+		sOutGameLumpHeader.lumpCount = lumpCount + 1;
+		if ( IsX360() )
+		{
+			// fix the output for 360, swapping it back
+			CByteswap gameLumpSwap;
+			gameLumpSwap.ActivateByteSwapping( true );
+			gameLumpSwap.SwapFieldsToTargetEndian( sOutGameLumps.Base(), lumpCount );
+			gameLumpSwap.SwapFieldsToTargetEndian( &sOutGameLumpHeader );
+		}
+
+		// The terminal gamelump has always been written out as zeros; keep it that way
+		dgamelump_t dummyLump = { 0 };
+		PadBuffer( outputBuffer, gameLumpOffset );
+		outputBuffer.Put( &sOutGameLumpHeader, sizeof( dgamelumpheader_t ) );
+		outputBuffer.Put( sOutGameLumps.Base(), lumpCount * sizeof( dgamelump_t ) );
+		outputBuffer.Put( &dummyLump, sizeof( dgamelump_t ) );
+
+		for ( int j = 0; j < lumpCount; j++ )
+		{
+			PutRepackJob( outputBuffer, g_RepackJobs[iJob++] );
+		}
+	}
+
+	g_RepackJobs.PurgeAndDeleteElements();
+	g_RepackJobsBySize.Purge();
 
 	return true;
 }
@@ -4785,7 +5344,7 @@ bool SwapBSPFile( const char *pInFilename, const char *pOutFilename, bool bSwapO
 
 	g_Swap.ActivateByteSwapping( true );
 
-	OpenBSPFile( pInFilename );
+	OpenBSPFile( pInFilename, false );
 
 	// CRC the bsp first
 	CRC32_t mapCRC;
@@ -4973,29 +5532,33 @@ bool GetPakFileLump( const char *pBSPFilename, void **pPakData, int *pPakSize )
 	*pPakData = NULL;
 	*pPakSize = 0;
 
-	if ( !g_pFileSystem->FileExists( pBSPFilename ) )
+	CMappedBSPFile bsp;
+	if ( !bsp.Open( pBSPFilename ) )
 	{
 		Warning( "Error! Couldn't open file %s!\n", pBSPFilename ); 
 		return false;
 	}
 
-	// determine endian nature
-	dheader_t *pHeader;
-	LoadFile( pBSPFilename, (void **)&pHeader );
-	bool bSwap = ( pHeader->ident == BigLong( IDBSPHEADER ) );
-	free( pHeader );
+	ValidateHeader( pBSPFilename, bsp.GetHeader() );
 
+	// determine endian nature
+	bool bSwap = bsp.NeedsSwap();
 	g_bSwapOnLoad = bSwap;
 	g_bSwapOnWrite = !bSwap;
-
-	OpenBSPFile( pBSPFilename );
-	
-	if ( g_pBSPHeader->lumps[LUMP_PAKFILE].filelen )
+	if ( bSwap )
 	{
-		*pPakSize = CopyVariableLump<byte>( FIELD_CHARACTER, LUMP_PAKFILE, pPakData );
+		g_Swap.ActivateByteSwapping( true );
 	}
 
-	CloseBSPFile();
+	// the caller owns the pak data, so copy it out of the file
+	int paksize;
+	const byte *pPak = bsp.GetLump<byte>( FIELD_CHARACTER, LUMP_PAKFILE, &paksize );
+	if ( paksize > 0 )
+	{
+		*pPakData = malloc( paksize );
+		memcpy( *pPakData, pPak, paksize );
+		*pPakSize = paksize;
+	}
 
 	return true;
 }
@@ -5075,7 +5638,7 @@ bool SetPakFileLump( const char *pBSPFilename, const char *pNewFilename, void *p
 	g_bSwapOnLoad = bSwap;
 	g_bSwapOnWrite = bSwap;
 
-	OpenBSPFile( pBSPFilename );
+	OpenBSPFile( pBSPFilename, false );
 
 	// save a copy of the old header
 	// generating a new bsp is a destructive operation
@@ -5148,16 +5711,15 @@ bool SetPakFileLump( const char *pBSPFilename, const char *pNewFilename, void *p
 //-----------------------------------------------------------------------------
 bool GetBSPDependants( const char *pBSPFilename, CUtlVector< CUtlString > *pList )
 {
-	if ( !g_pFileSystem->FileExists( pBSPFilename ) )
+	// only a handful of lumps are needed, so view them in place rather than loading the map
+	CMappedBSPFile bsp;
+	if ( !bsp.Open( pBSPFilename ) )
 	{
 		Warning( "Error! Couldn't open file %s!\n", pBSPFilename ); 
 		return false;
 	}
 
-	// must be set, but exact hdr not critical for dependant traversal	
-	SetHDRMode( false );
-
-	LoadBSPFile( pBSPFilename );
+	ValidateHeader( pBSPFilename, bsp.GetHeader() );
 
 	char szBspName[MAX_PATH];
 	V_FileBase( pBSPFilename, szBspName, sizeof( szBspName ) );
@@ -5165,77 +5727,88 @@ bool GetBSPDependants( const char *pBSPFilename, CUtlVector< CUtlString > *pList
 
 	// get embedded pak files, and internals
 	char szFilename[MAX_PATH];
-	int fileSize;
-	int fileId = -1;
-	for ( ;; )
+	int paksize;
+	const byte *pakbuffer = bsp.GetLump<byte>( FIELD_CHARACTER, LUMP_PAKFILE, &paksize );
+	if ( paksize > 0 )
 	{
-		fileId = GetPakFile()->GetNextFilename( fileId, szFilename, sizeof( szFilename ), fileSize );
-		if ( fileId == -1 )
+		IZip *pPakFile = IZip::CreateZip( NULL );
+		pPakFile->ParseFromBuffer( (void *)pakbuffer, paksize );
+
+		int fileSize;
+		int fileId = -1;
+		for ( ;; )
 		{
-			break;
+			fileId = pPakFile->GetNextFilename( fileId, szFilename, sizeof( szFilename ), fileSize );
+			if ( fileId == -1 )
+			{
+				break;
+			}
+			pList->AddToTail( szFilename );
 		}
-		pList->AddToTail( szFilename );
+
+		IZip::ReleaseZip( pPakFile );
 	}
 
 	// get all the world materials
-	for ( int i=0; i<numtexdata; i++ )
-	{
-		const char *pName = TexDataStringTable_GetString( dtexdata[i].nameStringTableID );
+	int nTexData, nStringTable, nStringData;
+	const dtexdata_t *pTexData = bsp.GetLump<dtexdata_t>( LUMP_TEXDATA, &nTexData );
+	const int *pStringTable = bsp.GetLump<int>( FIELD_INTEGER, LUMP_TEXDATA_STRING_TABLE, &nStringTable );
+	const char *pStringData = bsp.GetLump<char>( FIELD_CHARACTER, LUMP_TEXDATA_STRING_DATA, &nStringData );
+	for ( int i=0; i<nTexData; i++ )
+	{
+		int nStringID = pTexData[i].nameStringTableID;
+		if ( nStringID < 0 || nStringID >= nStringTable || pStringTable[nStringID] < 0 || pStringTable[nStringID] >= nStringData )
+		{
+			continue;
+		}
+
+		const char *pName = &pStringData[pStringTable[nStringID]];
 		V_ComposeFileName( "materials", pName, szFilename, sizeof( szFilename ) );
 		V_SetExtension( szFilename, ".vmt", sizeof( szFilename ) );
 		pList->AddToTail( szFilename );
 	}
 
 	// get all the static props
-	GameLumpHandle_t hGameLump = g_GameLumps.GetGameLumpHandle( GAMELUMP_STATIC_PROPS );
-	if ( hGameLump != g_GameLumps.InvalidGameLump() )
+	int nGameLumpSize, nGameLumpVersion;
+	const byte *pGameLumpData = (const byte *)bsp.GetGameLump( GAMELUMP_STATIC_PROPS, &nGameLumpSize, &nGameLumpVersion );
+	if ( pGameLumpData )
 	{
-		byte *pGameLumpData = (byte *)g_GameLumps.GetGameLump( hGameLump );
-		if ( pGameLumpData && g_GameLumps.GameLumpSize( hGameLump ) )
-		{
-			int count = ((int *)pGameLumpData)[0];
-			pGameLumpData += sizeof( int );
+		int count = ((int *)pGameLumpData)[0];
+		pGameLumpData += sizeof( int );
 
-			StaticPropDictLump_t *pStaticPropDictLump = (StaticPropDictLump_t *)pGameLumpData;
-			for ( int i=0; i<count; i++ )
-			{
-				pList->AddToTail( pStaticPropDictLump[i].m_Name );
-			}
+		const StaticPropDictLump_t *pStaticPropDictLump = (const StaticPropDictLump_t *)pGameLumpData;
+		for ( int i=0; i<count; i++ )
+		{
+			pList->AddToTail( pStaticPropDictLump[i].m_Name );
 		}
 	}
 
 	// get all the detail props
-	hGameLump = g_GameLumps.GetGameLumpHandle( GAMELUMP_DETAIL_PROPS );
-	if ( hGameLump != g_GameLumps.InvalidGameLump() )
+	pGameLumpData = (const byte *)bsp.GetGameLump( GAMELUMP_DETAIL_PROPS, &nGameLumpSize, &nGameLumpVersion );
+	if ( pGameLumpData )
 	{
-		byte *pGameLumpData = (byte *)g_GameLumps.GetGameLump( hGameLump );
-		if ( pGameLumpData && g_GameLumps.GameLumpSize( hGameLump ) )
-		{
-			int count = ((int *)pGameLumpData)[0];
-			pGameLumpData += sizeof( int );
+		int count = ((int *)pGameLumpData)[0];
+		pGameLumpData += sizeof( int );
 
-			DetailObjectDictLump_t *pDetailObjectDictLump = (DetailObjectDictLump_t *)pGameLumpData;
-			for ( int i=0; i<count; i++ )
-			{
-				pList->AddToTail( pDetailObjectDictLump[i].m_Name );
-			}
-			pGameLumpData += count * sizeof( DetailObjectDictLump_t );
+		const DetailObjectDictLump_t *pDetailObjectDictLump = (const DetailObjectDictLump_t *)pGameLumpData;
+		for ( int i=0; i<count; i++ )
+		{
+			pList->AddToTail( pDetailObjectDictLump[i].m_Name );
+		}
+		pGameLumpData += count * sizeof( DetailObjectDictLump_t );
 
-			if ( g_GameLumps.GetGameLumpVersion( hGameLump ) == 4 )
+		if ( nGameLumpVersion == 4 )
+		{
+			count = ((int *)pGameLumpData)[0];
+			pGameLumpData += sizeof( int );
+			if ( count )
 			{
-				count = ((int *)pGameLumpData)[0];
-				pGameLumpData += sizeof( int );
-				if ( count )
-				{
-					// All detail prop sprites must lie in the material detail/detailsprites
-					pList->AddToTail( "materials/detail/detailsprites.vmt" );
-				}
+				// All detail prop sprites must lie in the material detail/detailsprites
+				pList->AddToTail( "materials/detail/detailsprites.vmt" );
 			}
 		}
 	}
 
-	UnloadBSPFile();
-
 	return true;
 }
 
@@ -272,6 +272,93 @@ private:
 extern CGameLump	g_GameLumps;
 extern CByteswap	g_Swap;
 
+//-----------------------------------------------------------------------------
+// Read-only access to the lumps of a BSP on disk, for tools that only need a
+// few of them. The file is mapped rather than read, and a lump isn't touched
+// until it's asked for. Views point straight into the file, except for files
+// of the other byte order, whose lumps are swapped into a copy the first time
+// they're viewed. GetMutableLump gives a private copy of a lump to tools that
+// change it; later views of that lump see the copy.
+//-----------------------------------------------------------------------------
+class CMappedBSPFile
+{
+public:
+	CMappedBSPFile();
+	~CMappedBSPFile();
+
+	// Returns false if the file can't be read or is too small to be a BSP.
+	// The ident and version are left to the caller to check. Pass false for
+	// bMapFile to read the file into memory instead, for callers that write
+	// a file that may be the one they read.
+	bool				Open( const char *pFilename, bool bMapFile = true );
+	void				Close();
+	bool				IsOpen() const			{ return m_pFileData != NULL; }
+	bool				NeedsSwap() const		{ return m_bSwap; }
+
+	// The header, in machine byte order.
+	const dheader_t		*GetHeader() const		{ return &m_Header; }
+	bool				HasLump( int lump ) const	{ return m_Header.lumps[lump].filelen > 0; }
+	int					LumpVersion( int lump ) const	{ return m_Header.lumps[lump].version; }
+	int					LumpSize( int lump ) const	{ return m_Header.lumps[lump].filelen; }
+
+	// The whole file as it is on disk. The view is copy-on-write, so it can be
+	// changed in memory without touching the file.
+	byte				*GetFileData()			{ return m_pFileData; }
+	int					GetFileSize() const		{ return m_nFileSize; }
+
+	//-----------------------------------------------------------------------------
+	// Lumps of object types with datadescs
+	//-----------------------------------------------------------------------------
+	template< class T > const T *GetLump( int lump, int *pCount = NULL, int forceVersion = -1 )
+	{
+		return (const T *)GetLumpData( lump, sizeof(T), &T::m_DataMap, FIELD_VOID, false, forceVersion, pCount );
+	}
+
+	template< class T > T *GetMutableLump( int lump, int *pCount = NULL, int forceVersion = -1 )
+	{
+		return (T *)GetLumpData( lump, sizeof(T), &T::m_DataMap, FIELD_VOID, true, forceVersion, pCount );
+	}
+
+	//-----------------------------------------------------------------------------
+	// Lumps of integral types without datadescs. Vectors are asked for as floats.
+	//-----------------------------------------------------------------------------
+	template< class T > const T *GetLump( int fieldType, int lump, int *pCount = NULL, int forceVersion = -1 )
+	{
+		return (const T *)GetLumpData( lump, sizeof(T), NULL, fieldType, false, forceVersion, pCount );
+	}
+
+	template< class T > T *GetMutableLump( int fieldType, int lump, int *pCount = NULL, int forceVersion = -1 )
+	{
+		return (T *)GetLumpData( lump, sizeof(T), NULL, fieldType, true, forceVersion, pCount );
+	}
+
+	// Game lumps, in machine byte order. Returns NULL if the map doesn't have it.
+	const void			*GetGameLump( GameLumpId_t id, int *pSize = NULL, int *pVersion = NULL );
+
+private:
+	bool				MapFile( const char *pFilename );
+	void				*GetLumpData( int lump, int elementSize, datamap_t *pDataMap, int fieldType, bool bMutable, int forceVersion, int *pCount );
+	void				SwapLump( int lump, int elementSize, datamap_t *pDataMap, void *pDest, const void *pSrc, int length );
+	void				ParseGameLumpDirectory();
+
+	byte				*m_pFileData;
+	int					m_nFileSize;
+	bool				m_bMapped;				// Otherwise m_pFileData was read into memory.
+#ifdef _WIN32
+	void				*m_hFile;
+	void				*m_hMapping;
+#endif
+
+	dheader_t			m_Header;
+	bool				m_bSwap;
+
+	void				*m_pLumpCopy[HEADER_LUMPS];		// Swapped or mutable copies, NULL if none.
+
+	bool				m_bGameLumpsParsed;
+	CUtlVector<dgamelump_t>	m_GameLumps;
+	CUtlVector<void *>	m_GameLumpCopies;
+};
+
 //-----------------------------------------------------------------------------
 // Helper for the bspzip tool
 //-----------------------------------------------------------------------------
@@ -287,7 +374,7 @@ int					TexDataStringTable_AddOrFindString( const char *pString );
 void	DecompressVis (byte *in, byte *decompressed);
 int		CompressVis (byte *vis, byte *dest);
 
-void	OpenBSPFile( const char *filename );
+void	OpenBSPFile( const char *filename, bool bMapFile = true );
 void	CloseBSPFile(void);
 void	LoadBSPFile( const char *filename );
 void	LoadBSPFile_FileSystemOnly( const char *filename );
@@ -306,6 +393,7 @@ bool	SetPakFileLump( const char *pBSPFilename, const char *pNewFilename, void *p
 void	WriteLumpToFile( char *filename, int lump );
 void	WriteLumpToFile( char *filename, int lump, int nLumpVersion, void *pBuffer, size_t nBufLen );
 bool	GetBSPDependants( const char *pBSPFilename, CUtlVector< CUtlString > *pList );
+void	RunMappedBSPBenchmark( const char *pszFileName );
 void	UnloadBSPFile();
 
 void	ParseEntities (void);
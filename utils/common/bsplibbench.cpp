@@ -0,0 +1,190 @@
+//========= Copyright Valve Corporation, All rights reserved. ============//
+//
+// Purpose: Compares loading a BSP with LoadBSPFile against viewing its lumps
+//			through CMappedBSPFile, for a full pass over the file and for a
+//			tool that only needs a few lumps, and checks that the views hold
+//			the same data as the loaded arrays.
+//
+// $NoKeywords: $
+//=============================================================================//
+
+#include "cmdlib.h"
+#include "bsplib.h"
+#include "gamebspfile.h"
+#include "checksum_crc.h"
+#include "tier0/platform.h"
+#include "tier0/dbg.h"
+
+// memdbgon must be the last include file in a .cpp file!!!
+#include "tier0/memdbgon.h"
+
+
+#define BENCH_PASSES	3
+
+
+static double BestTime( double flBest, double flTime )
+{
+	return ( flBest < 0 || flTime < flBest ) ? flTime : flBest;
+}
+
+//-----------------------------------------------------------------------------
+// Compares a view with the array LoadBSPFile copied the lump into
+//-----------------------------------------------------------------------------
+static bool CompareLump( const char *pLumpName, const void *pView, int nViewCount, const void *pLoaded, int nLoadedCount, int nElementSize )
+{
+	if ( nViewCount != nLoadedCount || ( nViewCount && memcmp( pView, pLoaded, nViewCount * nElementSize ) ) )
+	{
+		Warning( "%s: mapped view doesn't match LoadBSPFile (%d vs %d elements)\n", pLumpName, nViewCount, nLoadedCount );
+		return false;
+	}
+	return true;
+}
+
+static bool CompareWithLoadedBSP( CMappedBSPFile &bsp )
+{
+	bool bOk = true;
+	int nCount;
+
+	const dplane_t *pPlanes = bsp.GetLump<dplane_t>( LUMP_PLANES, &nCount );
+	bOk &= CompareLump( "planes", pPlanes, nCount, dplanes, numplanes, sizeof( dplane_t ) );
+
+	const dvertex_t *pVertexes = bsp.GetLump<dvertex_t>( LUMP_VERTEXES, &nCount );
+	bOk &= CompareLump( "vertexes", pVertexes, nCount, dvertexes, numvertexes, sizeof( dvertex_t ) );
+
+	const dface_t *pFaces = bsp.GetLump<dface_t>( LUMP_FACES, &nCount );
+	bOk &= CompareLump( "faces", pFaces, nCount, dfaces, numfaces, sizeof( dface_t ) );
+
+	const texinfo_t *pTexInfo = bsp.GetLump<texinfo_t>( LUMP_TEXINFO, &nCount );
+	bOk &= CompareLump( "texinfo", pTexInfo, nCount, texinfo.Base(), texinfo.Count(), sizeof( texinfo_t ) );
+
+	const dtexdata_t *pTexData = bsp.GetLump<dtexdata_t>( LUMP_TEXDATA, &nCount );
+	bOk &= CompareLump( "texdata", pTexData, nCount, dtexdata, numtexdata, sizeof( dtexdata_t ) );
+
+	const int *pStringTable = bsp.GetLump<int>( FIELD_INTEGER, LUMP_TEXDATA_STRING_TABLE, &nCount );
+	bOk &= CompareLump( "texdata string table", pStringTable, nCount, g_TexDataStringTable.Base(), g_TexDataStringTable.Count(), sizeof( int ) );
+
+	const char *pStringData = bsp.GetLump<char>( FIELD_CHARACTER, LUMP_TEXDATA_STRING_DATA, &nCount );
+	bOk &= CompareLump( "texdata string data", pStringData, nCount, g_TexDataStringData.Base(), g_TexDataStringData.Count(), sizeof( char ) );
+
+	GameLumpHandle_t hGameLump = g_GameLumps.GetGameLumpHandle( GAMELUMP_STATIC_PROPS );
+	int nGameLumpSize = 0;
+	const void *pGameLump = bsp.GetGameLump( GAMELUMP_STATIC_PROPS, &nGameLumpSize );
+	if ( hGameLump != g_GameLumps.InvalidGameLump() )
+	{
+		bOk &= CompareLump( "static props", pGameLump, nGameLumpSize, g_GameLumps.GetGameLump( hGameLump ), g_GameLumps.GameLumpSize( hGameLump ), 1 );
+	}
+	else if ( pGameLump )
+	{
+		Warning( "static props: mapped view found a game lump LoadBSPFile didn't\n" );
+		bOk = false;
+	}
+
+	// A private copy starts out the same as the view, and changing it leaves the file alone
+	dplane_t *pMutablePlanes = bsp.GetMutableLump<dplane_t>( LUMP_PLANES, &nCount );
+	if ( nCount )
+	{
+		bOk &= CompareLump( "mutable planes", pMutablePlanes, nCount, dplanes, numplanes, sizeof( dplane_t ) );
+		pMutablePlanes[0].dist += 1.0f;
+
+		const dheader_t *pFileHeader = (const dheader_t *)bsp.GetFileData();
+		if ( !bsp.NeedsSwap() && !memcmp( pMutablePlanes, bsp.GetFileData() + pFileHeader->lumps[LUMP_PLANES].fileofs, sizeof( dplane_t ) ) )
+		{
+			Warning( "mutable planes: changing the copy changed the file view\n" );
+			bOk = false;
+		}
+
+		if ( bsp.GetLump<dplane_t>( LUMP_PLANES ) != pMutablePlanes )
+		{
+			Warning( "mutable planes: later views don't see the copy\n" );
+			bOk = false;
+		}
+	}
+
+	return bOk;
+}
+
+//-----------------------------------------------------------------------------
+// Touches every byte of every lump where it sits in the file
+//-----------------------------------------------------------------------------
+static double MappedFullPass( const char *pszFileName, CRC32_t &crc )
+{
+	double flStart = Plat_FloatTime();
+
+	CMappedBSPFile bsp;
+	if ( !bsp.Open( pszFileName ) )
+		return -1;
+
+	CRC32_Init( &crc );
+	const dheader_t *pFileHeader = (const dheader_t *)bsp.GetFileData();
+	for ( int i = 0; i < HEADER_LUMPS; i++ )
+	{
+		int nSize = bsp.LumpSize( i );
+		if ( nSize > 0 )
+		{
+			CRC32_ProcessBuffer( &crc, bsp.GetFileData() + pFileHeader->lumps[i].fileofs, nSize );
+		}
+	}
+	CRC32_Final( &crc );
+
+	bsp.Close();
+	return Plat_FloatTime() - flStart;
+}
+
+void RunMappedBSPBenchmark( const char *pszFileName )
+{
+	CMappedBSPFile bsp;
+	if ( !bsp.Open( pszFileName ) )
+	{
+		Warning( "Couldn't open %s for the BSP benchmark\n", pszFileName );
+		return;
+	}
+
+	int nFileSize = bsp.GetFileSize();
+	int nFewLumpsSize = bsp.LumpSize( LUMP_PAKFILE ) + bsp.LumpSize( LUMP_TEXDATA ) + bsp.LumpSize( LUMP_TEXDATA_STRING_TABLE ) +
+		bsp.LumpSize( LUMP_TEXDATA_STRING_DATA ) + bsp.LumpSize( LUMP_GAME_LUMP );
+	Msg( "BSP benchmark: %s, %.1f MB%s\n", pszFileName, nFileSize / ( 1024.0 * 1024.0 ), bsp.NeedsSwap() ? " (byte swapped)" : "" );
+
+	// Best of a few passes, so both paths are measured out of a warm file cache
+	double flLoad = -1, flMapped = -1, flDependants = -1;
+	CRC32_t crc = 0;
+	int nDependants = 0;
+	for ( int nPass = 0; nPass < BENCH_PASSES; nPass++ )
+	{
+		double flStart = Plat_FloatTime();
+		LoadBSPFile( pszFileName );
+		UnloadBSPFile();
+		flLoad = BestTime( flLoad, Plat_FloatTime() - flStart );
+
+		double flTime = MappedFullPass( pszFileName, crc );
+		if ( flTime < 0 )
+		{
+			Warning( "Couldn't map %s\n", pszFileName );
+			return;
+		}
+		flMapped = BestTime( flMapped, flTime );
+
+		CUtlVector< CUtlString > dependants;
+		flStart = Plat_FloatTime();
+		GetBSPDependants( pszFileName, &dependants );
+		flDependants = BestTime( flDependants, Plat_FloatTime() - flStart );
+		nDependants = dependants.Count();
+	}
+
+	flLoad = MAX( flLoad, 1.0e-6 );
+	flMapped = MAX( flMapped, 1.0e-6 );
+	flDependants = MAX( flDependants, 1.0e-6 );
+
+	// GetBSPDependants used to run all of LoadBSPFile to get at a few lumps
+	Msg( "LoadBSPFile:        %.3f s (%.1f MB/sec), %.1f MB copied\n", flLoad, nFileSize / ( 1024.0 * 1024.0 * flLoad ), nFileSize / ( 1024.0 * 1024.0 ) );
+	Msg( "mapped, every lump: %.3f s (%.1f MB/sec), nothing copied, crc %08x\n", flMapped, nFileSize / ( 1024.0 * 1024.0 * flMapped ), crc );
+	Msg( "GetBSPDependants:   %.3f s (%.1fx faster than LoadBSPFile), %d files from %.1f MB of lumps\n", flDependants, flLoad / flDependants,
+		nDependants, nFewLumpsSize / ( 1024.0 * 1024.0 ) );
+
+	// The views have to hold what LoadBSPFile would have copied out
+	LoadBSPFile( pszFileName );
+	if ( CompareWithLoadedBSP( bsp ) )
+	{
+		Msg( "mapped views match LoadBSPFile\n" );
+	}
+	UnloadBSPFile();
+}
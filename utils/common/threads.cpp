@@ -20,6 +20,7 @@
 #define NO_THREAD_NAMES
 #include "threads.h"
 #include "pacifier.h"
+#include "tier0/threadtools.h"
 
 #define	MAX_THREADS	MAX_TOOL_THREADS
 
@@ -35,8 +36,6 @@ public:
 CRunThreadsData g_RunThreadsData[MAX_THREADS];
 
 
-int		dispatch;
-int		workcount;
 qboolean		pacifier;
 
 qboolean	threaded;
@@ -45,6 +44,151 @@ bool g_bLowPriorityThreads = false;
 HANDLE g_ThreadHandles[MAX_THREADS];
 
 
+/*
+===================================================================
+
+WORK DISPATCH
+
+Work items are split into one contiguous index range per thread. Each
+thread pulls adaptively sized chunks off the front of its own range with
+a compare-exchange on a packed (first, end) pair, so the common case never
+touches a lock or a cache line shared with another thread. When a thread
+runs dry it steals the back half of the largest remaining range.
+
+Work that is sorted by cost goes through RunThreadsOnIndividualOrdered
+instead, which hands items out one at a time from a single shared cursor.
+The per-thread ranges would give thread 0 all of the most expensive items
+as one block.
+
+Pacifier progress is sampled by the main thread while it waits for the
+workers rather than on every work item.
+
+===================================================================
+*/
+
+// Largest chunk a thread will claim from its own range at once. Chunks shrink
+// towards 1 as the range empties so that the tail stays stealable.
+#define MAX_WORK_CHUNK	32
+
+class ALIGN128 CThreadWorkRange
+{
+public:
+	volatile int64	m_Range;		// Packed first (low 32 bits) and end (high 32 bits) of the unclaimed range.
+	volatile long	m_nDispatched;	// Items handed out by this thread, sampled for the pacifier.
+} ALIGN128_POST;
+
+CThreadWorkRange g_ThreadWorkRanges[MAX_THREADS];
+
+int		workcount;
+
+// Shared cursor for RunThreadsOnIndividualOrdered.
+static bool s_bOrderedWork = false;
+static volatile long s_nNextOrderedWork = 0;
+
+// The chunk the current thread is working through, so GetThreadWork() can stay argument-free.
+static THREAD_LOCAL int s_iWorkThread = -1;
+static THREAD_LOCAL int s_iWorkChunkNext = 0;
+static THREAD_LOCAL int s_iWorkChunkEnd = 0;
+
+
+static inline int64 PackWorkRange( int iFirst, int iEnd )
+{
+	return ( (int64)iEnd << 32 ) | (uint32)iFirst;
+}
+
+static inline int WorkRangeFirst( int64 range )
+{
+	return (int)( range & 0xFFFFFFFF );
+}
+
+static inline int WorkRangeEnd( int64 range )
+{
+	return (int)( range >> 32 );
+}
+
+// 64-bit loads aren't atomic on 32-bit targets, so read through a no-op compare-exchange.
+static inline int64 ReadWorkRange( const CThreadWorkRange &range )
+{
+	return ThreadInterlockedCompareExchange64( const_cast<int64 volatile *>( &range.m_Range ), 0, 0 );
+}
+
+
+static void InitWorkRanges( int nThreads, int nWorkItems )
+{
+	for ( int i=0; i < nThreads; i++ )
+	{
+		int iFirst = (int)( ( (int64)nWorkItems * i ) / nThreads );
+		int iEnd = (int)( ( (int64)nWorkItems * ( i+1 ) ) / nThreads );
+		g_ThreadWorkRanges[i].m_Range = PackWorkRange( iFirst, iEnd );
+		g_ThreadWorkRanges[i].m_nDispatched = 0;
+	}
+}
+
+
+// Claim a chunk off the front of our own range. Returns false if it's empty.
+static bool ClaimOwnWork( int iThread, int &iFirst, int &iEnd )
+{
+	CThreadWorkRange &range = g_ThreadWorkRanges[iThread];
+	while ( 1 )
+	{
+		int64 cur = ReadWorkRange( range );
+		int iRangeFirst = WorkRangeFirst( cur );
+		int iRangeEnd = WorkRangeEnd( cur );
+		if ( iRangeFirst >= iRangeEnd )
+			return false;
+
+		int nChunk = clamp( ( iRangeEnd - iRangeFirst ) / 4, 1, MAX_WORK_CHUNK );
+		if ( ThreadInterlockedAssignIf64( &range.m_Range, PackWorkRange( iRangeFirst + nChunk, iRangeEnd ), cur ) )
+		{
+			iFirst = iRangeFirst;
+			iEnd = iRangeFirst + nChunk;
+			return true;
+		}
+	}
+}
+
+
+// Take the back half of the fullest range belonging to another thread and make it our own.
+static bool StealWork( int iThread )
+{
+	while ( 1 )
+	{
+		int iVictim = -1;
+		int nMostRemaining = 0;
+		int64 victimRange = 0;
+		for ( int i=0; i < numthreads; i++ )
+		{
+			if ( i == iThread )
+				continue;
+
+			int64 cur = ReadWorkRange( g_ThreadWorkRanges[i] );
+			int nRemaining = WorkRangeEnd( cur ) - WorkRangeFirst( cur );
+			if ( nRemaining > nMostRemaining )
+			{
+				iVictim = i;
+				nMostRemaining = nRemaining;
+				victimRange = cur;
+			}
+		}
+
+		if ( iVictim == -1 )
+			return false;
+
+		int iFirst = WorkRangeFirst( victimRange );
+		int iEnd = WorkRangeEnd( victimRange );
+		int iSplit = iEnd - ( nMostRemaining + 1 ) / 2;
+		if ( ThreadInterlockedAssignIf64( &g_ThreadWorkRanges[iVictim].m_Range, PackWorkRange( iFirst, iSplit ), victimRange ) )
+		{
+			// Our own range is empty, so nobody else will try to take from it until this lands.
+			ThreadInterlockedExchange64( &g_ThreadWorkRanges[iThread].m_Range, PackWorkRange( iSplit, iEnd ) );
+			return true;
+		}
+
+		// Lost the race with the owner or another thief, rescan.
+		ThreadPause();
+	}
+}
+
 
 /*
 =============
@@ -54,23 +198,49 @@ GetThreadWork
 */
 int	GetThreadWork (void)
 {
-	int	r;
+	if ( s_bOrderedWork )
+	{
+		int iWork = ThreadInterlockedIncrement( &s_nNextOrderedWork ) - 1;
+		return ( iWork < workcount ) ? iWork : -1;
+	}
 
-	ThreadLock ();
+	if ( s_iWorkChunkNext < s_iWorkChunkEnd )
+		return s_iWorkChunkNext++;
 
-	if (dispatch == workcount)
+	int iThread = s_iWorkThread;
+	if ( iThread < 0 )
 	{
-		ThreadUnlock ();
-		return -1;
+		// Called outside of RunThreadsOn (e.g. _PROFILE builds), just walk the one range.
+		iThread = 0;
 	}
 
-	UpdatePacifier( (float)dispatch / workcount );
+	int iFirst, iEnd;
+	while ( !ClaimOwnWork( iThread, iFirst, iEnd ) )
+	{
+		if ( !StealWork( iThread ) )
+			return -1;
+	}
+
+	ThreadInterlockedExchangeAdd( &g_ThreadWorkRanges[iThread].m_nDispatched, iEnd - iFirst );
+
+	s_iWorkChunkNext = iFirst + 1;
+	s_iWorkChunkEnd = iEnd;
+	return iFirst;
+}
 
-	r = dispatch;
-	dispatch++;
-	ThreadUnlock ();
 
-	return r;
+static int GetDispatchedWorkCount()
+{
+	if ( s_bOrderedWork )
+	{
+		int nDispatched = s_nNextOrderedWork;
+		return ( nDispatched < workcount ) ? nDispatched : workcount;
+	}
+
+	int nDispatched = 0;
+	for ( int i=0; i < numthreads; i++ )
+		nDispatched += g_ThreadWorkRanges[i].m_nDispatched;
+	return nDispatched;
 }
 
 
@@ -99,6 +269,14 @@ void RunThreadsOnIndividual (int workcnt, qboolean showpacifier, ThreadWorkerFn
 	RunThreadsOn (workcnt, showpacifier, ThreadWorkerFunction);
 }
 
+void RunThreadsOnIndividualOrdered (int workcnt, qboolean showpacifier, ThreadWorkerFn func)
+{
+	s_bOrderedWork = true;
+	s_nNextOrderedWork = 0;
+	RunThreadsOnIndividual (workcnt, showpacifier, func);
+	s_bOrderedWork = false;
+}
+
 
 /*
 ===================================================================
@@ -168,7 +346,10 @@ void ThreadUnlock (void)
 DWORD WINAPI InternalRunThreadsFn( LPVOID pParameter )
 {
 	CRunThreadsData *pData = (CRunThreadsData*)pParameter;
+	s_iWorkThread = pData->m_iThread;
+	s_iWorkChunkNext = s_iWorkChunkEnd = 0;
 	pData->m_Fn( pData->m_iThread, pData->m_pUserData );
+	s_iWorkThread = -1;
 	return 0;
 }
 
@@ -228,9 +409,12 @@ void RunThreadsOn( int workcnt, qboolean showpacifier, RunThreadsFn fn, void *pU
 {
 	int		start, end;
 
+	if ( numthreads > MAX_TOOL_THREADS )
+		numthreads = MAX_TOOL_THREADS;
+
 	start = Plat_FloatTime();
-	dispatch = 0;
 	workcount = workcnt;
+	InitWorkRanges( numthreads, workcnt );
 	StartPacifier("");
 	pacifier = showpacifier;
 
@@ -242,6 +426,14 @@ void RunThreadsOn( int workcnt, qboolean showpacifier, RunThreadsFn fn, void *pU
 
 	
 	RunThreads_Start( fn, pUserData );
+
+	// Sample progress from here so the workers never touch the pacifier.
+	while ( WaitForMultipleObjects( numthreads, g_ThreadHandles, TRUE, 50 ) == WAIT_TIMEOUT )
+	{
+		if ( workcount > 0 )
+			UpdatePacifier( (float)GetDispatchedWorkCount() / workcount );
+	}
+
 	RunThreads_End();
 
 
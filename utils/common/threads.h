@@ -43,10 +43,17 @@ enum ERunThreadsPriority
 void SetLowPriority();
 
 void ThreadSetDefault (void);
+
+// Returns the next work item for the calling thread, or -1 when everything has been handed out.
+// Items come from per-thread chunks, so they aren't returned in global index order.
 int	GetThreadWork (void);
 
 void RunThreadsOnIndividual ( int workcnt, qboolean showpacifier, ThreadWorkerFn fn );
 
+// Like RunThreadsOnIndividual, but items are handed out one at a time, in index order, from
+// a cursor shared by all threads. Use it when the items are sorted most expensive first.
+void RunThreadsOnIndividualOrdered ( int workcnt, qboolean showpacifier, ThreadWorkerFn fn );
+
 void RunThreadsOn ( int workcnt, qboolean showpacifier, RunThreadsFn fn, void *pUserData=NULL );
 
 // This version doesn't track work items - it just runs your function and waits for it to finish.
@@ -60,6 +67,7 @@ void ThreadUnlock (void);
 #ifndef NO_THREAD_NAMES
 #define RunThreadsOn(n,p,f) { if (p) printf("%-20s ", #f ":"); RunThreadsOn(n,p,f); }
 #define RunThreadsOnIndividual(n,p,f) { if (p) printf("%-20s ", #f ":"); RunThreadsOnIndividual(n,p,f); }
+#define RunThreadsOnIndividualOrdered(n,p,f) { if (p) printf("%-20s ", #f ":"); RunThreadsOnIndividualOrdered(n,p,f); }
 #endif
 
 #endif // THREADS_H
@@ -942,25 +942,19 @@ void CVRadDispMgr::RadialLuxelAddSamples( int ndxFace, Vector const &luxelPt, Ve
 		voxelMax[axis] = ( int )( ( luxelPt[axis] + radius ) * ooVoxelSize ) + 1;
 	}
 
-	SampleData_t sampleData;
 	for( int ndxZ = voxelMin[2]; ndxZ < voxelMax[2] + 1; ndxZ++ )
 	{
 		for( int ndxY = voxelMin[1]; ndxY < voxelMax[1] + 1; ndxY++ )
 		{
 			for( int ndxX = voxelMin[0]; ndxX < voxelMax[0] + 1; ndxX++ )
 			{
-				sampleData.x = ndxX * 100;
-				sampleData.y = ndxY * 10;
-				sampleData.z = ndxZ;
-
-				UtlHashHandle_t handle = g_SampleHashTable.Find( sampleData );
-				if( handle != g_SampleHashTable.InvalidHandle() )
+				const SampleHandle_t *pSamples;
+				int count = g_SampleHashTable.Find( ndxX, ndxY, ndxZ, &pSamples );
+				if( count )
 				{
-					SampleData_t *pSampleData = &g_SampleHashTable.Element( handle );
-					int count = pSampleData->m_Samples.Count();
 					for( int ndx = 0; ndx < count; ndx++ )
 					{
-						SampleHandle_t sampleHandle = pSampleData->m_Samples.Element( ndx );
+						SampleHandle_t sampleHandle = pSamples[ndx];
 						int ndxSample = ( sampleHandle & 0x0000ffff );
 						int ndxFaceLight = ( ( sampleHandle >> 16 ) & 0x0000ffff );
 
@@ -1205,25 +1199,19 @@ void CVRadDispMgr::RadialLuxelAddPatch( int ndxFace, Vector const &luxelPt,
 	}
 
 	unsigned short curIterationKey = IncrementPatchIterationKey();
-	PatchSampleData_t patchData;
 	for ( int ndxZ = voxelMin[2]; ndxZ < voxelMax[2] + 1; ndxZ++ )
 	{
 		for ( int ndxY = voxelMin[1]; ndxY < voxelMax[1] + 1; ndxY++ )
 		{
 			for ( int ndxX = voxelMin[0]; ndxX < voxelMax[0] + 1; ndxX++ )
 			{
-				patchData.x = ndxX * 100;
-				patchData.y = ndxY * 10;
-				patchData.z = ndxZ;
-
-				UtlHashHandle_t handle = g_PatchSampleHashTable.Find( patchData );
-				if ( handle != g_PatchSampleHashTable.InvalidHandle() )
+				const int *pPatches;
+				int count = g_PatchSampleHashTable.Find( ndxX, ndxY, ndxZ, &pPatches );
+				if ( count )
 				{
-					PatchSampleData_t *pPatchData = &g_PatchSampleHashTable.Element( handle );
-					int count = pPatchData->m_ndxPatches.Count();
 					for ( int ndx = 0; ndx < count; ndx++ )
 					{
-						int ndxPatch = pPatchData->m_ndxPatches.Element( ndx );
+						int ndxPatch = pPatches[ndx];
 						CPatch *pPatch = &g_Patches.Element( ndxPatch );
 						if ( pPatch && pPatch->m_IterationKey != curIterationKey )
 						{
@@ -1318,20 +1306,14 @@ void CVRadDispMgr::GetInterestingPatchesForLuxels(
 				if ( !val )
 					continue;
 
-				PatchSampleData_t patchData;
-				patchData.x = (x + allVoxelMin[0]) * 100;
-				patchData.y = (y + allVoxelMin[1]) * 10;
-				patchData.z = (z + allVoxelMin[2]);
-
-				UtlHashHandle_t handle = g_PatchSampleHashTable.Find( patchData );
-				if ( handle != g_PatchSampleHashTable.InvalidHandle() )
+				const int *pPatches;
+				int count = g_PatchSampleHashTable.Find( x + allVoxelMin[0], y + allVoxelMin[1], z + allVoxelMin[2], &pPatches );
+				if ( count )
 				{
-					PatchSampleData_t *pPatchData = &g_PatchSampleHashTable.Element( handle );
-
 					// For all patches that touch this hash table element..
-					for ( int ndx = 0; ndx < pPatchData->m_ndxPatches.Count(); ndx++ )
+					for ( int ndx = 0; ndx < count; ndx++ )
 					{
-						int ndxPatch = pPatchData->m_ndxPatches.Element( ndx );
+						int ndxPatch = pPatches[ndx];
 						CPatch *pPatch = &g_Patches.Element( ndxPatch );
 
 						// If we haven't touched the patch already and it's a valid neighbor, then we want to use it.
@@ -1421,64 +1403,61 @@ bool SampleInSolid( sample_t *pSample )
 }
 
 
+//-----------------------------------------------------------------------------
+// Where each face's samples start in the sample hash's pairs, -1 for faces
+// that don't light anything.
+//-----------------------------------------------------------------------------
+static CUtlVector<int> s_FirstSamplePair;
+
+static void AddFaceSamplesToHash( int iThread, int ndxFace )
+{
+	int iPair = s_FirstSamplePair[ndxFace];
+	if( iPair < 0 )
+		return;
+
+	facelight_t *pFaceLight = &facelight[ndxFace];
+	for( int ndxSample = 0; ndxSample < pFaceLight->numsamples; ndxSample++ )
+	{
+		int x, y, z;
+		GetSampleHashVoxel( pFaceLight->sample[ndxSample].pos, x, y, z );
+
+		// create the sample handle
+		SampleHandle_t sampleHandle = ndxSample;
+		sampleHandle |= ( ndxFace << 16 );
+
+		g_SampleHashTable.SetPair( iPair + ndxSample, x, y, z, sampleHandle );
+	}
+}
+
+
 //-----------------------------------------------------------------------------
 //-----------------------------------------------------------------------------
 void CVRadDispMgr::InsertSamplesDataIntoHashTable( void )
 {
+	// Lay the faces' samples out one after another, so every thread can fill
+	// in its own faces without locking, then build the hash from all of them.
 	int totalSamples = 0;
-#if 0
-	int totalSamplesInSolid = 0;
-#endif
-
+	s_FirstSamplePair.SetCount( numfaces );
 	for( int ndxFace = 0; ndxFace < numfaces; ndxFace++ )
 	{
 		dface_t *pFace = &g_pFaces[ndxFace];
 		facelight_t *pFaceLight = &facelight[ndxFace];
-		if( !pFace || !pFaceLight )
-			continue;
 
+		s_FirstSamplePair[ndxFace] = -1;
 		if( texinfo[pFace->texinfo].flags & TEX_SPECIAL )
 			continue;
 
-#if 0
-		bool bDisp = ( pFace->dispinfo != -1 );
-#endif
-		//
-		// for each sample
-		//
-		for( int ndxSample = 0; ndxSample < pFaceLight->numsamples; ndxSample++ )
-		{
-			sample_t *pSample = &pFaceLight->sample[ndxSample];
-			if( pSample )
-			{
-#if 0
-				if( bDisp )
-				{
-					// test sample to see if the displacement samples resides in solid
-					if( SampleInSolid( pSample ) )
-					{
-						totalSamplesInSolid++;
-						continue;
-					}
-				}
-#endif
-
-				// create the sample handle
-				SampleHandle_t sampleHandle = ndxSample;
-				sampleHandle |= ( ndxFace << 16 );
-
-				SampleData_AddSample( pSample, sampleHandle );
-			}
-
-		}
-
+		s_FirstSamplePair[ndxFace] = totalSamples;
 		totalSamples += pFaceLight->numsamples;
 	}
 
-#if 0
-	// not implemented yet!!!
-	Msg( "%d samples in solid\n", totalSamplesInSolid );
-#endif
+	g_SampleHashTable.Purge();
+	g_SampleHashTable.SetPairCount( totalSamples );
+	RunThreadsOnIndividual( numfaces, false, AddFaceSamplesToHash );
+	g_SampleHashTable.Build();
+	s_FirstSamplePair.Purge();
+
+	samplesAdded = totalSamples;
 
 	// log the distribution
 	SampleData_Log();
@@ -1494,6 +1473,7 @@ void CVRadDispMgr::InsertPatchSampleDataIntoHashTable( void )
 		return;
 
 	int totalPatchSamples = 0;
+	g_PatchSampleHashTable.Purge();
 
 	for( int ndxFace = 0; ndxFace < numfaces; ndxFace++ )
 	{
@@ -1531,6 +1511,8 @@ void CVRadDispMgr::InsertPatchSampleDataIntoHashTable( void )
 			}
 		}
 	}
+
+	g_PatchSampleHashTable.Build();
 }
 
 
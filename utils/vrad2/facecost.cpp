@@ -0,0 +1,236 @@
+//========= Copyright Valve Corporation, All rights reserved. ============//
+//
+// Purpose: Cost-model-driven ordering of faces for BuildFacelights.
+//
+//=============================================================================//
+
+#include "vrad.h"
+#include "facecost.h"
+
+
+// Tuning weights for the cost model. The units are arbitrary; only the relative
+// cost between faces matters for scheduling. Use -logfacecost to refit them.
+#define FACECOST_PER_FACE				64.0f	// Fixed setup cost (lightinfo, CalcPoints, sample windings).
+#define FACECOST_LIGHT_BASE				1.0f	// Per-luxel cost that doesn't depend on the number of lights.
+#define FACECOST_BUMP_SCALE				2.0f	// Bumped faces light 4 normals but share the shadow rays.
+#define FACECOST_SUPERSAMPLE_SCALE		2.5f	// Average multiplier for the -extra supersampling passes.
+#define FACECOST_DISP_POWER_SCALE		0.5f	// Per displacement power step (collision tests get more expensive).
+
+
+bool g_bLogFaceCost = false;
+
+struct FaceCost_t
+{
+	int		m_iFace;
+	int		m_nLuxels;
+	int		m_nLights;
+	float	m_flPredicted;
+	float	m_flActual;		// Seconds spent in BuildFacelights.
+	double	m_flEnd;		// When BuildFacelights finished with the face.
+	int		m_iThread;
+};
+
+// Most expensive first. Ties keep face order so the schedule is deterministic.
+static int __cdecl CompareFaceCost( const FaceCost_t *pCost1, const FaceCost_t *pCost2 )
+{
+	if ( pCost1->m_flPredicted != pCost2->m_flPredicted )
+		return ( pCost1->m_flPredicted > pCost2->m_flPredicted ) ? -1 : 1;
+	return pCost1->m_iFace - pCost2->m_iFace;
+}
+
+static CUtlVector<FaceCost_t> g_FaceSchedule;
+
+
+//-----------------------------------------------------------------------------
+// Purpose: Counts, for each cluster, how many direct lights have it in their PVS.
+//-----------------------------------------------------------------------------
+static void CountLightsPerCluster( CUtlVector<int> &lightCounts )
+{
+	lightCounts.SetCount( dvis->numclusters );
+	for ( int iCluster=0; iCluster < dvis->numclusters; iCluster++ )
+	{
+		int nLights = 0;
+		for ( directlight_t *dl = activelights; dl != NULL; dl = dl->next )
+		{
+			if ( !dl->pvs || PVSCheck( dl->pvs, iCluster ) )
+				++nLights;
+		}
+		lightCounts[iCluster] = nLights;
+	}
+}
+
+
+static int CountLights()
+{
+	int nLights = 0;
+	for ( directlight_t *dl = activelights; dl != NULL; dl = dl->next )
+		++nLights;
+	return nLights;
+}
+
+
+//-----------------------------------------------------------------------------
+// Purpose: Predicts the relative BuildFacelights cost of a face. Faces that
+//			BuildFacelights rejects up front cost only the fixed overhead.
+//-----------------------------------------------------------------------------
+static void EstimateFaceCost( FaceCost_t &cost, const CUtlVector<int> &lightCounts, int nTotalLights )
+{
+	dface_t *f = &g_pFaces[cost.m_iFace];
+
+	cost.m_nLuxels = 0;
+	cost.m_nLights = 0;
+	cost.m_flPredicted = FACECOST_PER_FACE;
+	cost.m_flActual = 0.0f;
+	cost.m_flEnd = 0.0;
+	cost.m_iThread = -1;
+
+	if ( texinfo[f->texinfo].flags & TEX_SPECIAL )
+		return;
+
+	if ( g_FacePatches.Element( cost.m_iFace ) == g_FacePatches.InvalidIndex() )
+		return;
+
+	cost.m_nLuxels = ( f->m_LightmapTextureSizeInLuxels[0] + 1 ) * ( f->m_LightmapTextureSizeInLuxels[1] + 1 );
+
+	// Lights that can see the cluster the face sits in.
+	cost.m_nLights = nTotalLights;
+	winding_t *w = WindingFromFace( f, face_offset[cost.m_iFace] );
+	if ( w )
+	{
+		Vector vCenter;
+		WindingCenter( w, vCenter );
+		FreeWinding( w );
+
+		int iCluster = ClusterFromPoint( vCenter );
+		if ( iCluster >= 0 && iCluster < lightCounts.Count() )
+			cost.m_nLights = lightCounts[iCluster];
+	}
+
+	float flCost = cost.m_nLuxels * ( FACECOST_LIGHT_BASE + cost.m_nLights );
+
+	if ( texinfo[f->texinfo].flags & SURF_BUMPLIGHT )
+		flCost *= FACECOST_BUMP_SCALE;
+
+	if ( ValidDispFace( f ) )
+	{
+		// Displacements never get supersampled, but their samples are more expensive.
+		flCost *= 1.0f + FACECOST_DISP_POWER_SCALE * g_dispinfo[f->dispinfo].power;
+	}
+	else if ( do_extra )
+	{
+		flCost *= FACECOST_SUPERSAMPLE_SCALE;
+	}
+
+	cost.m_flPredicted += flCost;
+}
+
+
+void BuildFacelightSchedule()
+{
+	double flStart = Plat_FloatTime();
+
+	CUtlVector<int> lightCounts;
+	CountLightsPerCluster( lightCounts );
+	int nTotalLights = CountLights();
+
+	g_FaceSchedule.SetCount( numfaces );
+	for ( int iFace=0; iFace < numfaces; iFace++ )
+	{
+		g_FaceSchedule[iFace].m_iFace = iFace;
+		EstimateFaceCost( g_FaceSchedule[iFace], lightCounts, nTotalLights );
+	}
+	g_FaceSchedule.Sort( CompareFaceCost );
+
+	if ( verbose )
+	{
+		Msg( "Face cost schedule built in %.2f seconds\n", Plat_FloatTime() - flStart );
+	}
+}
+
+
+void BuildScheduledFacelights( int iThread, int iScheduleSlot )
+{
+	FaceCost_t &cost = g_FaceSchedule[iScheduleSlot];
+
+	double flStart = Plat_FloatTime();
+	BuildFacelights( iThread, cost.m_iFace );
+	cost.m_flEnd = Plat_FloatTime();
+	cost.m_flActual = (float)( cost.m_flEnd - flStart );
+	cost.m_iThread = iThread;
+}
+
+
+void ReportFacelightSchedule()
+{
+	int nFaces = g_FaceSchedule.Count();
+	if ( !nFaces )
+		return;
+
+	// Least-squares fit of seconds = scale * predicted, plus the correlation between them.
+	double sumP = 0, sumA = 0, sumPP = 0, sumAA = 0, sumPA = 0;
+	for ( int i=0; i < nFaces; i++ )
+	{
+		double p = g_FaceSchedule[i].m_flPredicted;
+		double a = g_FaceSchedule[i].m_flActual;
+		sumP += p;
+		sumA += a;
+		sumPP += p * p;
+		sumAA += a * a;
+		sumPA += p * a;
+	}
+
+	double flScale = ( sumPP > 0 ) ? sumPA / sumPP : 0;
+	double flCovar = nFaces * sumPA - sumP * sumA;
+	double flVarP = nFaces * sumPP - sumP * sumP;
+	double flVarA = nFaces * sumAA - sumA * sumA;
+	double flCorrelation = ( flVarP > 0 && flVarA > 0 ) ? flCovar / sqrt( flVarP * flVarA ) : 0;
+
+	Msg( "Face cost model: %d faces, %.2f thread-seconds, correlation %.3f, %.3g seconds per unit\n",
+		nFaces, sumA, flCorrelation, flScale );
+
+	// How long the last thread kept going after the first one ran out of faces.
+	double flThreadEnd[MAX_TOOL_THREADS];
+	for ( int i=0; i < MAX_TOOL_THREADS; i++ )
+		flThreadEnd[i] = 0;
+	for ( int i=0; i < nFaces; i++ )
+	{
+		const FaceCost_t &cost = g_FaceSchedule[i];
+		if ( cost.m_iThread >= 0 && cost.m_iThread < MAX_TOOL_THREADS )
+			flThreadEnd[cost.m_iThread] = max( flThreadEnd[cost.m_iThread], cost.m_flEnd );
+	}
+
+	double flFirstDone = 0, flLastDone = 0;
+	for ( int i=0; i < MAX_TOOL_THREADS; i++ )
+	{
+		if ( flThreadEnd[i] == 0 )
+			continue;
+		if ( flFirstDone == 0 || flThreadEnd[i] < flFirstDone )
+			flFirstDone = flThreadEnd[i];
+		flLastDone = max( flLastDone, flThreadEnd[i] );
+	}
+
+	Msg( "Face schedule tail: threads finished over %.2f seconds\n", flLastDone - flFirstDone );
+
+	if ( !g_bLogFaceCost )
+		return;
+
+	FILE *fp = fopen( "facecost.txt", "w" );
+	if ( !fp )
+	{
+		Warning( "Can't open facecost.txt for writing\n" );
+		return;
+	}
+
+	fprintf( fp, "face\tluxels\tlights\tbump\tdisppower\tpredicted\tactual\n" );
+	for ( int i=0; i < nFaces; i++ )
+	{
+		const FaceCost_t &cost = g_FaceSchedule[i];
+		dface_t *f = &g_pFaces[cost.m_iFace];
+		int nPower = ValidDispFace( f ) ? g_dispinfo[f->dispinfo].power : 0;
+		int bBump = ( texinfo[f->texinfo].flags & SURF_BUMPLIGHT ) ? 1 : 0;
+		fprintf( fp, "%d\t%d\t%d\t%d\t%d\t%.1f\t%.6f\n",
+			cost.m_iFace, cost.m_nLuxels, cost.m_nLights, bBump, nPower, cost.m_flPredicted, cost.m_flActual );
+	}
+
+	fclose( fp );
+}
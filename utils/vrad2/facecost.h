@@ -0,0 +1,30 @@
+//========= Copyright Valve Corporation, All rights reserved. ============//
+//
+// Purpose: 
+//
+//=============================================================================//
+
+#ifndef FACECOST_H
+#define FACECOST_H
+#ifdef _WIN32
+#pragma once
+#endif
+
+
+// If set, ReportFacelightSchedule writes per-face predicted and measured cost to facecost.txt.
+extern bool g_bLogFaceCost;
+
+// Estimates the direct lighting cost of every face and sorts them most expensive first,
+// so the huge faces get started early instead of leaving one thread running at the end.
+void BuildFacelightSchedule();
+
+// Drop-in for BuildFacelights that takes a slot in the schedule instead of a face index.
+// Run it with RunThreadsOnIndividualOrdered so the slots are handed out in order.
+void BuildScheduledFacelights( int iThread, int iScheduleSlot );
+
+// Prints how well the cost model predicted the measured per-face times, and how far
+// apart the threads finished.
+void ReportFacelightSchedule();
+
+
+#endif // FACECOST_H
@@ -0,0 +1,817 @@
+//========= Copyright Valve Corporation, All rights reserved. ============//
+//
+// Purpose: On-disk cache of each face's direct lighting.
+//
+// Tracing the direct lights is most of a compile, and tweaking lights on a
+// finished map changes the direct lighting of only a few faces. After the
+// facelights are built, every face's direct lighting is written to
+// <mapname>.vlc along with an MD5 of the face's samples, the sample positions
+// and the keys of the lights that reached it. The next compile relights a face
+// only if
+//
+//  - its samples changed (or it is new),
+//  - a light that reached it last time was removed or edited, or
+//  - a light that is new, was removed, or can see geometry that changed, can
+//    reach one of its samples through the PVS,
+//
+// and copies the rest out of the cache. Faces are found by their hash, not
+// their index, so renumbering by vbsp doesn't throw the cache away; the face
+// number only picks between cached faces with the same hash. Bounced
+// light, detail props and static props are always computed in full.
+//
+//=============================================================================//
+
+#include "vrad.h"
+#include "lightmap.h"
+#include "lightcache.h"
+#include "tier1/checksum_crc.h"
+#include "tier1/checksum_md5.h"
+#include "tier1/utlhashtable.h"
+
+
+#define LIGHTCACHE_ID		(('H'<<24)+('C'<<16)+('L'<<8)+'V')	// little-endian "VLCH"
+#define LIGHTCACHE_VERSION	3
+
+struct LightCacheHeader_t
+{
+	int		m_nId;
+	int		m_nVersion;
+	CRC32_t	m_SettingsCRC;		// Command line options that change the direct lighting.
+	int		m_nLights;
+	int		m_nTriangles;
+	int		m_nFaces;
+
+	// Followed by LightCacheLight_t lights[m_nLights], LightCacheTriangle_t triangles[m_nTriangles],
+	// then m_nFaces LightCacheFace_t, each followed by its data.
+};
+
+struct LightCacheLight_t
+{
+	MD5Value_t	m_Key;
+	Vector		m_vecOrigin;	// Where its PVS came from, for when it's removed
+	int			m_nType;
+};
+
+struct LightCacheTriangle_t
+{
+	MD5Value_t	m_Key;
+	Vector	m_vecMins;
+	Vector	m_vecMaxs;
+};
+
+struct LightCacheFace_t
+{
+	MD5Value_t	m_Key;
+	int		m_nFace;			// Only a tie breaker, vbsp renumbers faces.
+	byte	m_Styles[MAXLIGHTMAPS];
+	int		m_nSamples;
+	int		m_nNormals;
+	int		m_nLights;
+
+	// Followed by MD5Value_t lights[m_nLights], Vector positions[m_nSamples],
+	// Vector normals[m_nSamples], then LightingValue_t light[m_nSamples] for
+	// each normal of each style in use.
+};
+
+// The keys are MD5s, so any 32 bits of them hash as well as the whole thing
+struct LightCacheKeyHashFunctor_t
+{
+	unsigned int operator()( const MD5Value_t &key ) const
+	{
+		unsigned int nHash;
+		memcpy( &nHash, key.bits, sizeof( nHash ) );
+		return nHash;
+	}
+};
+
+typedef CUtlHashtable<MD5Value_t, empty_t, LightCacheKeyHashFunctor_t> LightCacheKeySet_t;
+
+
+bool g_bUseLightCache = false;
+
+static CUtlVector<LightCacheTriangle_t> s_Triangles;		// This compile's ray tracing triangles.
+static CUtlVector<MD5Value_t> s_LightKeys;					// This compile's lights, by directlight_t::index.
+
+static CUtlVector<byte> s_CacheData;						// The last compile's cache file.
+static CUtlVector<const LightCacheFace_t *> s_CachedFaces;	// Its faces, in file order.
+static CUtlVector<int> s_CachedFaceNext;					// Next cached face with the same key, or -1.
+static CUtlHashtable<MD5Value_t, int, LightCacheKeyHashFunctor_t> s_CachedFaceKeys;	// First cached face with each key.
+static LightCacheKeySet_t s_KeptLights;						// Lights that are the same as last time.
+static CUtlVector<uint64> s_DirtyPVS;						// Merged PVS of the lights whose lighting may have changed.
+static bool s_bDirtyLights;
+
+static CUtlVector<MD5Value_t> s_FaceKeys;
+static CUtlVector<const LightCacheFace_t *> s_Faces;		// What SaveLightCache writes, by face.
+static CUtlVector<LightCacheFace_t *> s_NewFaces;			// The entries relit this time, which we own.
+
+static CUtlVector<int> s_FaceLights[MAX_TOOL_THREADS+1];	// Lights reaching the face being lit on each thread.
+static CUtlVector<byte> s_FaceLightMarks[MAX_TOOL_THREADS+1];
+
+
+static void GetLightCacheFilename( char *pOut, int nOutLen )
+{
+	Q_snprintf( pOut, nOutLen, "%s%s.vlc", source, g_bHDR ? ".hdr" : "" );
+}
+
+
+static int FaceStyleCount( const LightCacheFace_t *pFace )
+{
+	int nStyles = 0;
+	while ( nStyles < MAXLIGHTMAPS && pFace->m_Styles[nStyles] != 255 )
+	{
+		nStyles++;
+	}
+	return nStyles;
+}
+
+static int FaceDataSize( const LightCacheFace_t *pFace )
+{
+	return sizeof( LightCacheFace_t ) + pFace->m_nLights * sizeof( MD5Value_t ) + 2 * pFace->m_nSamples * sizeof( Vector ) +
+		FaceStyleCount( pFace ) * pFace->m_nNormals * pFace->m_nSamples * sizeof( LightingValue_t );
+}
+
+static inline MD5Value_t *FaceLights( const LightCacheFace_t *pFace )
+{
+	return (MD5Value_t *)( pFace + 1 );
+}
+
+static inline Vector *FacePositions( const LightCacheFace_t *pFace )
+{
+	return (Vector *)( FaceLights( pFace ) + pFace->m_nLights );
+}
+
+static inline Vector *FaceNormals( const LightCacheFace_t *pFace )
+{
+	return FacePositions( pFace ) + pFace->m_nSamples;
+}
+
+static inline LightingValue_t *FaceLight( const LightCacheFace_t *pFace )
+{
+	return (LightingValue_t *)( FaceNormals( pFace ) + pFace->m_nSamples );
+}
+
+
+//-----------------------------------------------------------------------------
+// Hashes
+//-----------------------------------------------------------------------------
+static CRC32_t ComputeSettingsCRC()
+{
+	CRC32_t crc;
+	CRC32_Init( &crc );
+
+	int nInts[] = { do_extra, extrapasses, do_fast, do_centersamples, g_bLargeDispSampleRadius, g_bStaticPropPolys,
+		g_bTextureShadows, g_bDisablePropSelfShadowing, g_bHDR };
+	float flFloats[] = { smoothing_threshold, g_flMaxDispSampleSize, g_SunAngularExtent, g_flSkySampleScale, lightscale, dlight_threshold };
+	CRC32_ProcessBuffer( &crc, nInts, sizeof( nInts ) );
+	CRC32_ProcessBuffer( &crc, flFloats, sizeof( flFloats ) );
+
+	CRC32_Final( &crc );
+	return crc;
+}
+
+static inline void HashBuffer( MD5Context_t *pCtx, const void *pData, int nLen )
+{
+	MD5Update( pCtx, (unsigned char const *)pData, nLen );
+}
+
+static MD5Value_t ComputeLightKey( directlight_t *dl, int nDuplicate )
+{
+	// The cluster, texinfo and owner are indices that unrelated edits renumber.
+	// The PVS only culls what the shadow rays would have blocked anyway.
+	dworldlight_t light = dl->light;
+	light.cluster = 0;
+	light.texinfo = 0;
+	light.owner = 0;
+
+	MD5Context_t ctx;
+	MD5Init( &ctx );
+	HashBuffer( &ctx, &light, sizeof( light ) );
+	HashBuffer( &ctx, &dl->snormal, sizeof( dl->snormal ) );
+	HashBuffer( &ctx, &dl->tnormal, sizeof( dl->tnormal ) );
+	float flValues[] = { dl->sscale, dl->tscale, dl->soffset, dl->toffset, dl->m_flStartFadeDistance, dl->m_flEndFadeDistance, dl->m_flCapDist };
+	HashBuffer( &ctx, flValues, sizeof( flValues ) );
+
+	// Identical lights in the same spot are still different lights
+	HashBuffer( &ctx, &nDuplicate, sizeof( nDuplicate ) );
+	MD5Value_t key;
+	MD5Final( key.bits, &ctx );
+	return key;
+}
+
+static MD5Value_t ComputeFaceKey( int facenum, lightinfo_t const &l, facelight_t *fl, int nNormals )
+{
+	dface_t *f = &g_pFaces[facenum];
+	texinfo_t *pTexInfo = &texinfo[f->texinfo];
+	faceneighbor_t *fn = &faceneighbor[facenum];
+
+	MD5Context_t ctx;
+	MD5Init( &ctx );
+
+	HashBuffer( &ctx, &l.facenormal, sizeof( l.facenormal ) );
+	HashBuffer( &ctx, &l.modelorg, sizeof( l.modelorg ) );
+	HashBuffer( &ctx, &l.isflat, sizeof( l.isflat ) );
+	HashBuffer( &ctx, &nNormals, sizeof( nNormals ) );
+	HashBuffer( &ctx, &pTexInfo->flags, sizeof( pTexInfo->flags ) );
+	HashBuffer( &ctx, pTexInfo->textureVecsTexelsPerWorldUnits, sizeof( pTexInfo->textureVecsTexelsPerWorldUnits ) );
+
+	// Smooth faces take their sample normals from the corners
+	for ( int i = 0; i < f->numedges; i++ )
+	{
+		int iEdge = dsurfedges[f->firstedge + i];
+		int iVert = ( iEdge >= 0 ) ? dedges[iEdge].v[0] : dedges[-iEdge].v[1];
+		HashBuffer( &ctx, &dvertexes[iVert].point, sizeof( Vector ) );
+		if ( fn->normal )
+		{
+			HashBuffer( &ctx, &fn->normal[i], sizeof( Vector ) );
+		}
+	}
+
+	HashBuffer( &ctx, &fl->numsamples, sizeof( fl->numsamples ) );
+	for ( int i = 0; i < fl->numsamples; i++ )
+	{
+		sample_t *pSample = &fl->sample[i];
+		HashBuffer( &ctx, &pSample->s, sizeof( pSample->s ) );
+		HashBuffer( &ctx, &pSample->t, sizeof( pSample->t ) );
+		HashBuffer( &ctx, &pSample->coord, sizeof( pSample->coord ) );
+		HashBuffer( &ctx, &pSample->mins, sizeof( pSample->mins ) );
+		HashBuffer( &ctx, &pSample->maxs, sizeof( pSample->maxs ) );
+		HashBuffer( &ctx, &pSample->pos, sizeof( pSample->pos ) );
+		HashBuffer( &ctx, &pSample->normal, sizeof( pSample->normal ) );
+		HashBuffer( &ctx, &pSample->area, sizeof( pSample->area ) );
+	}
+
+	MD5Value_t key;
+	MD5Final( key.bits, &ctx );
+	return key;
+}
+
+
+//-----------------------------------------------------------------------------
+// Geometry
+//-----------------------------------------------------------------------------
+void HashLightCacheGeometry()
+{
+	int nTriangles = g_RtEnv.OptimizedTriangleList.Count();
+	s_Triangles.SetCount( nTriangles );
+	for ( int i = 0; i < nTriangles; i++ )
+	{
+		const TriGeometryData_t &tri = g_RtEnv.OptimizedTriangleList[i].m_Data.m_GeometryData;
+		LightCacheTriangle_t &out = s_Triangles[i];
+
+		// Only the kind of blocker, the rest of the ID is a face or prop index
+		int nKind = tri.m_nTriangleID & 0xFF000000;
+		int nMaterial = g_RtEnv.TriangleMaterials.Count() ? g_RtEnv.TriangleMaterials[i] : -1;
+
+		MD5Context_t ctx;
+		MD5Init( &ctx );
+		HashBuffer( &ctx, tri.m_VertexCoordData, sizeof( tri.m_VertexCoordData ) );
+		HashBuffer( &ctx, &tri.m_nFlags, sizeof( tri.m_nFlags ) );
+		HashBuffer( &ctx, &nKind, sizeof( nKind ) );
+		HashBuffer( &ctx, &nMaterial, sizeof( nMaterial ) );
+		MD5Final( out.m_Key.bits, &ctx );
+
+		ClearBounds( out.m_vecMins, out.m_vecMaxs );
+		for ( int j = 0; j < 3; j++ )
+		{
+			AddPointToBounds( Vector( tri.m_VertexCoordData[j*3], tri.m_VertexCoordData[j*3+1], tri.m_VertexCoordData[j*3+2] ), out.m_vecMins, out.m_vecMaxs );
+		}
+	}
+}
+
+static void MarkClustersInBox( int node, Vector const &vecMins, Vector const &vecMaxs, uint64 *pClusters )
+{
+	Vector vecCenter = ( vecMins + vecMaxs ) * 0.5f;
+	Vector vecExtents = ( vecMaxs - vecMins ) * 0.5f;
+
+	while ( node >= 0 )
+	{
+		dnode_t *pNode = &dnodes[node];
+		dplane_t *pPlane = &dplanes[pNode->planenum];
+
+		float flDist = DotProduct( vecCenter, pPlane->normal ) - pPlane->dist;
+		float flRadius = fabs( pPlane->normal.x * vecExtents.x ) + fabs( pPlane->normal.y * vecExtents.y ) + fabs( pPlane->normal.z * vecExtents.z );
+		if ( flDist > flRadius )
+		{
+			node = pNode->children[0];
+		}
+		else if ( flDist < -flRadius )
+		{
+			node = pNode->children[1];
+		}
+		else
+		{
+			MarkClustersInBox( pNode->children[1], vecMins, vecMaxs, pClusters );
+			node = pNode->children[0];
+		}
+	}
+
+	int cluster = dleafs[-1 - node].cluster;
+	if ( cluster >= 0 )
+	{
+		pClusters[cluster >> 6] |= (uint64)1 << ( cluster & 63 );
+	}
+}
+
+static void MarkChangedTriangle( LightCacheTriangle_t const &tri, uint64 *pClusters )
+{
+	Vector vecBloat( 1, 1, 1 );
+	MarkClustersInBox( dmodels[0].headnode, tri.m_vecMins - vecBloat, tri.m_vecMaxs + vecBloat, pClusters );
+}
+
+
+//-----------------------------------------------------------------------------
+// Loading
+//-----------------------------------------------------------------------------
+static bool ReadLightCacheFile( const char *pFilename )
+{
+	FILE *fp = fopen( pFilename, "rb" );
+	if ( !fp )
+		return false;
+
+	fseek( fp, 0, SEEK_END );
+	long nSize = ftell( fp );
+	fseek( fp, 0, SEEK_SET );
+
+	bool bOk = ( nSize >= (long)sizeof( LightCacheHeader_t ) );
+	if ( bOk )
+	{
+		s_CacheData.SetCount( nSize );
+		bOk = ( fread( s_CacheData.Base(), nSize, 1, fp ) == 1 );
+	}
+	fclose( fp );
+
+	if ( !bOk )
+	{
+		Warning( "Ignoring light cache %s: can't read it\n", pFilename );
+		return false;
+	}
+
+	const LightCacheHeader_t *pHeader = (const LightCacheHeader_t *)s_CacheData.Base();
+	if ( pHeader->m_nId != LIGHTCACHE_ID || pHeader->m_nVersion != LIGHTCACHE_VERSION )
+	{
+		Msg( "Light cache %s is out of date, relighting everything\n", pFilename );
+		return false;
+	}
+
+	if ( pHeader->m_SettingsCRC != ComputeSettingsCRC() )
+	{
+		Msg( "Light cache %s was built with different settings, relighting everything\n", pFilename );
+		return false;
+	}
+
+	// Check that everything fits before anything points into the data
+	const byte *pEnd = s_CacheData.Base() + s_CacheData.Count();
+	const byte *pFace = (const byte *)( pHeader + 1 ) + pHeader->m_nLights * sizeof( LightCacheLight_t ) + pHeader->m_nTriangles * sizeof( LightCacheTriangle_t );
+	for ( int i = 0; i < pHeader->m_nFaces && pFace <= pEnd; i++ )
+	{
+		if ( pFace + sizeof( LightCacheFace_t ) > pEnd )
+		{
+			pFace = pEnd + 1;
+			break;
+		}
+		pFace += FaceDataSize( (const LightCacheFace_t *)pFace );
+	}
+
+	if ( pHeader->m_nLights < 0 || pHeader->m_nTriangles < 0 || pFace != pEnd )
+	{
+		Warning( "Ignoring light cache %s: truncated\n", pFilename );
+		return false;
+	}
+
+	return true;
+}
+
+void LoadLightCache()
+{
+	double flStart = Plat_FloatTime();
+
+	// Key this compile's lights
+	s_LightKeys.SetCount( numdlights );
+	LightCacheKeySet_t currentLights;
+	for ( directlight_t *dl = activelights; dl != NULL; dl = dl->next )
+	{
+		int nDuplicate = 0;
+		MD5Value_t key;
+		do
+		{
+			key = ComputeLightKey( dl, nDuplicate++ );
+		} while ( currentLights.Find( key ) != currentLights.InvalidHandle() );
+
+		currentLights.Insert( key );
+		s_LightKeys[dl->index] = key;
+	}
+
+	for ( int i = 0; i <= MAX_TOOL_THREADS; i++ )
+	{
+		s_FaceLightMarks[i].SetCount( numdlights );
+		memset( s_FaceLightMarks[i].Base(), 0, numdlights );
+	}
+
+	s_FaceKeys.SetCount( numfaces );
+	s_Faces.SetCount( numfaces );
+	s_NewFaces.SetCount( numfaces );
+	memset( s_Faces.Base(), 0, numfaces * sizeof( s_Faces[0] ) );
+	memset( s_NewFaces.Base(), 0, numfaces * sizeof( s_NewFaces[0] ) );
+
+	char szFilename[MAX_PATH];
+	GetLightCacheFilename( szFilename, sizeof( szFilename ) );
+	if ( !ReadLightCacheFile( szFilename ) )
+	{
+		s_CacheData.Purge();
+		return;
+	}
+
+	const LightCacheHeader_t *pHeader = (const LightCacheHeader_t *)s_CacheData.Base();
+	const LightCacheLight_t *pOldLights = (const LightCacheLight_t *)( pHeader + 1 );
+	const LightCacheTriangle_t *pOldTriangles = (const LightCacheTriangle_t *)( pOldLights + pHeader->m_nLights );
+
+	// Lights that are in both compiles keep their lighting
+	LightCacheKeySet_t oldLights;
+	for ( int i = 0; i < pHeader->m_nLights; i++ )
+	{
+		oldLights.Insert( pOldLights[i].m_Key );
+		if ( currentLights.Find( pOldLights[i].m_Key ) != currentLights.InvalidHandle() )
+		{
+			s_KeptLights.Insert( pOldLights[i].m_Key );
+		}
+	}
+
+	// Find where triangles were added or removed
+	CUtlVector<uint64> changedClusters;
+	changedClusters.SetCount( PVSRowWords() );
+	memset( changedClusters.Base(), 0, changedClusters.Count() * sizeof( uint64 ) );
+
+	LightCacheKeySet_t currentTriangles;
+	for ( int i = 0; i < s_Triangles.Count(); i++ )
+	{
+		currentTriangles.Insert( s_Triangles[i].m_Key );
+	}
+
+	int nChangedTriangles = 0;
+	LightCacheKeySet_t oldTriangles;
+	for ( int i = 0; i < pHeader->m_nTriangles; i++ )
+	{
+		oldTriangles.Insert( pOldTriangles[i].m_Key );
+		if ( currentTriangles.Find( pOldTriangles[i].m_Key ) == currentTriangles.InvalidHandle() )
+		{
+			MarkChangedTriangle( pOldTriangles[i], changedClusters.Base() );
+			nChangedTriangles++;
+		}
+	}
+	for ( int i = 0; i < s_Triangles.Count(); i++ )
+	{
+		if ( oldTriangles.Find( s_Triangles[i].m_Key ) == oldTriangles.InvalidHandle() )
+		{
+			MarkChangedTriangle( s_Triangles[i], changedClusters.Base() );
+			nChangedTriangles++;
+		}
+	}
+
+	// New lights, and lights that can see the changes, may reach any face in their PVS
+	s_DirtyPVS.SetCount( PVSRowWords() );
+	memset( s_DirtyPVS.Base(), 0, s_DirtyPVS.Count() * sizeof( uint64 ) );
+
+	int nNewLights = 0, nShadowedLights = 0;
+	for ( directlight_t *dl = activelights; dl != NULL; dl = dl->next )
+	{
+		const uint64 *pPVS = (const uint64 *)dl->pvs;
+		bool bDirty = ( oldLights.Find( s_LightKeys[dl->index] ) == oldLights.InvalidHandle() );
+		if ( bDirty )
+		{
+			nNewLights++;
+		}
+		else if ( nChangedTriangles )
+		{
+			for ( int i = 0; i < changedClusters.Count() && !bDirty; i++ )
+			{
+				bDirty = ( pPVS[i] & changedClusters[i] ) != 0;
+			}
+			nShadowedLights += bDirty ? 1 : 0;
+		}
+
+		if ( bDirty )
+		{
+			MergePVS( s_DirtyPVS.Base(), pPVS );
+			s_bDirtyLights = true;
+		}
+	}
+
+	// Removed lights could have reached any face in their PVS too. Every light
+	// but the sky gets its PVS from the cluster it's in, the sky's covers every
+	// cluster that can see it, so just relight everything if it went away.
+	CUtlVector<uint64> removedPVS;
+	removedPVS.SetCount( PVSRowWords() );
+	for ( int i = 0; i < pHeader->m_nLights; i++ )
+	{
+		const LightCacheLight_t &light = pOldLights[i];
+		if ( currentLights.Find( light.m_Key ) != currentLights.InvalidHandle() )
+			continue;
+
+		if ( light.m_nType == emit_skylight || light.m_nType == emit_skyambient )
+		{
+			memset( removedPVS.Base(), 0xFF, removedPVS.Count() * sizeof( uint64 ) );
+		}
+		else
+		{
+			memset( removedPVS.Base(), 0, removedPVS.Count() * sizeof( uint64 ) );
+			GetVisCache( -1, ClusterFromPoint( light.m_vecOrigin ), (byte *)removedPVS.Base() );
+		}
+
+		MergePVS( s_DirtyPVS.Base(), removedPVS.Base() );
+		s_bDirtyLights = true;
+	}
+
+	// Index the faces, chaining the ones that share a key
+	s_CachedFaces.SetCount( pHeader->m_nFaces );
+	s_CachedFaceNext.SetCount( pHeader->m_nFaces );
+	const byte *pFace = (const byte *)( pOldTriangles + pHeader->m_nTriangles );
+	for ( int i = 0; i < pHeader->m_nFaces; i++ )
+	{
+		const LightCacheFace_t *pCached = (const LightCacheFace_t *)pFace;
+		s_CachedFaces[i] = pCached;
+		pFace += FaceDataSize( pCached );
+
+		UtlHashHandle_t h = s_CachedFaceKeys.Find( pCached->m_Key );
+		if ( h == s_CachedFaceKeys.InvalidHandle() )
+		{
+			s_CachedFaceNext[i] = -1;
+			s_CachedFaceKeys.Insert( pCached->m_Key, i );
+		}
+		else
+		{
+			s_CachedFaceNext[i] = s_CachedFaceKeys[h];
+			s_CachedFaceKeys[h] = i;
+		}
+	}
+
+	Msg( "Light cache: %d faces, %d of %d lights removed or edited, %d new, %d see %d changed triangles (%.2f seconds)\n",
+		pHeader->m_nFaces, pHeader->m_nLights - s_KeptLights.Count(), pHeader->m_nLights, nNewLights, nShadowedLights, nChangedTriangles,
+		Plat_FloatTime() - flStart );
+}
+
+
+//-----------------------------------------------------------------------------
+// Per face
+//-----------------------------------------------------------------------------
+static bool CanReuseFace( const LightCacheFace_t *pCached, facelight_t *fl, int nNormals )
+{
+	if ( pCached->m_nSamples != fl->numsamples || pCached->m_nNormals != nNormals )
+		return false;
+
+	// Don't trust the key alone, the samples have to be in the same places
+	const Vector *pPositions = FacePositions( pCached );
+	for ( int i = 0; i < fl->numsamples; i++ )
+	{
+		if ( pPositions[i] != fl->sample[i].pos )
+			return false;
+	}
+
+	// Any light that lit it last time has to be unchanged
+	const MD5Value_t *pLights = FaceLights( pCached );
+	for ( int i = 0; i < pCached->m_nLights; i++ )
+	{
+		if ( s_KeptLights.Find( pLights[i] ) == s_KeptLights.InvalidHandle() )
+			return false;
+	}
+
+	// and no light that changed can get to it
+	const byte *pDirtyPVS = (const byte *)s_DirtyPVS.Base();
+	for ( int i = 0; i < fl->numsamples && s_bDirtyLights; i++ )
+	{
+		if ( PVSCheck( pDirtyPVS, ClusterFromPoint( fl->sample[i].pos ) ) )
+			return false;
+	}
+
+	return true;
+}
+
+bool LightCache_ReuseFace( int iThread, int facenum, lightinfo_t const &l, facelight_t *fl, int nNormals )
+{
+	// Start over on the lights reaching this thread's face
+	CUtlVector<int> &faceLights = s_FaceLights[iThread];
+	for ( int i = 0; i < faceLights.Count(); i++ )
+	{
+		s_FaceLightMarks[iThread][faceLights[i]] = 0;
+	}
+	faceLights.RemoveAll();
+
+	MD5Value_t key = ComputeFaceKey( facenum, l, fl, nNormals );
+	s_FaceKeys[facenum] = key;
+
+	UtlHashHandle_t h = s_CachedFaceKeys.Find( key );
+	if ( h == s_CachedFaceKeys.InvalidHandle() )
+		return false;
+
+	// Faces that share a key are usually coplanar duplicates, prefer the one
+	// that had the same number last time
+	const LightCacheFace_t *pCached = NULL;
+	for ( int i = s_CachedFaceKeys[h]; i != -1; i = s_CachedFaceNext[i] )
+	{
+		const LightCacheFace_t *pCandidate = s_CachedFaces[i];
+		if ( !CanReuseFace( pCandidate, fl, nNormals ) )
+			continue;
+
+		pCached = pCandidate;
+		if ( pCandidate->m_nFace == facenum )
+			break;
+	}
+
+	if ( !pCached )
+		return false;
+
+	dface_t *f = &g_pFaces[facenum];
+	memcpy( f->styles, pCached->m_Styles, sizeof( f->styles ) );
+
+	// Smooth faces get their normals while they're lit
+	const Vector *pNormals = FaceNormals( pCached );
+	for ( int i = 0; i < fl->numsamples; i++ )
+	{
+		fl->sample[i].normal = pNormals[i];
+	}
+
+	const LightingValue_t *pLight = FaceLight( pCached );
+	for ( int iStyle = 0; iStyle < MAXLIGHTMAPS && f->styles[iStyle] != 255; iStyle++ )
+	{
+		for ( int n = 0; n < nNormals; n++ )
+		{
+			fl->light[iStyle][n] = ( LightingValue_t* )malloc( fl->numsamples * sizeof( LightingValue_t ) );
+			memcpy( fl->light[iStyle][n], pLight, fl->numsamples * sizeof( LightingValue_t ) );
+			pLight += fl->numsamples;
+		}
+	}
+
+	s_Faces[facenum] = pCached;
+	return true;
+}
+
+void LightCache_AddLightToFace( int iThread, directlight_t *dl )
+{
+	byte &mark = s_FaceLightMarks[iThread][dl->index];
+	if ( !mark )
+	{
+		mark = 1;
+		s_FaceLights[iThread].AddToTail( dl->index );
+	}
+}
+
+void LightCache_StoreFace( int iThread, int facenum, facelight_t *fl, int nNormals )
+{
+	dface_t *f = &g_pFaces[facenum];
+	CUtlVector<int> &faceLights = s_FaceLights[iThread];
+
+	LightCacheFace_t header;
+	header.m_Key = s_FaceKeys[facenum];
+	header.m_nFace = facenum;
+	memcpy( header.m_Styles, f->styles, sizeof( header.m_Styles ) );
+	header.m_nSamples = fl->numsamples;
+	header.m_nNormals = nNormals;
+	header.m_nLights = faceLights.Count();
+
+	LightCacheFace_t *pFace = (LightCacheFace_t *)malloc( FaceDataSize( &header ) );
+	*pFace = header;
+
+	MD5Value_t *pLights = FaceLights( pFace );
+	for ( int i = 0; i < faceLights.Count(); i++ )
+	{
+		pLights[i] = s_LightKeys[faceLights[i]];
+	}
+
+	Vector *pPositions = FacePositions( pFace );
+	Vector *pNormals = FaceNormals( pFace );
+	for ( int i = 0; i < fl->numsamples; i++ )
+	{
+		pPositions[i] = fl->sample[i].pos;
+		pNormals[i] = fl->sample[i].normal;
+	}
+
+	LightingValue_t *pLight = FaceLight( pFace );
+	for ( int iStyle = 0; iStyle < MAXLIGHTMAPS && f->styles[iStyle] != 255; iStyle++ )
+	{
+		for ( int n = 0; n < nNormals; n++ )
+		{
+			memcpy( pLight, fl->light[iStyle][n], fl->numsamples * sizeof( LightingValue_t ) );
+			pLight += fl->numsamples;
+		}
+	}
+
+	s_NewFaces[facenum] = pFace;
+	s_Faces[facenum] = pFace;
+}
+
+
+//-----------------------------------------------------------------------------
+// Saving
+//-----------------------------------------------------------------------------
+static void FreeLightCache()
+{
+	for ( int i = 0; i < s_NewFaces.Count(); i++ )
+	{
+		free( s_NewFaces[i] );
+	}
+
+	s_Triangles.Purge();
+	s_LightKeys.Purge();
+	s_CacheData.Purge();
+	s_CachedFaces.Purge();
+	s_CachedFaceNext.Purge();
+	s_CachedFaceKeys.Purge();
+	s_KeptLights.Purge();
+	s_DirtyPVS.Purge();
+	s_bDirtyLights = false;
+	s_FaceKeys.Purge();
+	s_Faces.Purge();
+	s_NewFaces.Purge();
+	for ( int i = 0; i <= MAX_TOOL_THREADS; i++ )
+	{
+		s_FaceLights[i].Purge();
+		s_FaceLightMarks[i].Purge();
+	}
+}
+
+void SaveLightCache()
+{
+	int nFaces = 0, nReused = 0;
+	for ( int i = 0; i < s_Faces.Count(); i++ )
+	{
+		if ( s_Faces[i] )
+		{
+			nFaces++;
+			nReused += s_NewFaces[i] ? 0 : 1;
+		}
+	}
+
+	if ( s_CachedFaces.Count() )
+	{
+		Msg( "Light cache: reused the direct lighting of %d of %d faces\n", nReused, nFaces );
+	}
+
+	char szFilename[MAX_PATH];
+	GetLightCacheFilename( szFilename, sizeof( szFilename ) );
+
+	FILE *fp = fopen( szFilename, "wb" );
+	if ( !fp )
+	{
+		Warning( "Can't write light cache %s\n", szFilename );
+		FreeLightCache();
+		return;
+	}
+
+	LightCacheHeader_t header;
+	header.m_nId = LIGHTCACHE_ID;
+	header.m_nVersion = LIGHTCACHE_VERSION;
+	header.m_SettingsCRC = ComputeSettingsCRC();
+	header.m_nLights = 0;
+	header.m_nTriangles = s_Triangles.Count();
+	header.m_nFaces = nFaces;
+
+	CUtlVector<LightCacheLight_t> lights;
+	for ( directlight_t *dl = activelights; dl != NULL; dl = dl->next )
+	{
+		LightCacheLight_t &light = lights[lights.AddToTail()];
+		light.m_Key = s_LightKeys[dl->index];
+		light.m_vecOrigin = dl->light.origin;
+		light.m_nType = dl->light.type;
+	}
+	header.m_nLights = lights.Count();
+
+	// Write a zeroed header first so an interrupted save is never picked up as valid.
+	LightCacheHeader_t blank;
+	memset( &blank, 0, sizeof( blank ) );
+	bool bOk = ( fwrite( &blank, sizeof( blank ), 1, fp ) == 1 );
+
+	if ( bOk && lights.Count() )
+	{
+		bOk = ( fwrite( lights.Base(), sizeof( LightCacheLight_t ), lights.Count(), fp ) == (size_t)lights.Count() );
+	}
+
+	if ( bOk && s_Triangles.Count() )
+	{
+		bOk = ( fwrite( s_Triangles.Base(), sizeof( LightCacheTriangle_t ), s_Triangles.Count(), fp ) == (size_t)s_Triangles.Count() );
+	}
+
+	for ( int i = 0; bOk && i < s_Faces.Count(); i++ )
+	{
+		if ( s_Faces[i] )
+		{
+			bOk = ( fwrite( s_Faces[i], FaceDataSize( s_Faces[i] ), 1, fp ) == 1 );
+		}
+	}
+
+	if ( bOk )
+	{
+		fseek( fp, 0, SEEK_SET );
+		bOk = ( fwrite( &header, sizeof( header ), 1, fp ) == 1 );
+	}
+
+	fclose( fp );
+	FreeLightCache();
+
+	if ( !bOk )
+	{
+		Warning( "Error writing light cache %s\n", szFilename );
+		remove( szFilename );
+		return;
+	}
+
+	Msg( "Wrote direct lighting to %s\n", szFilename );
+}
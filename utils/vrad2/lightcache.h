@@ -0,0 +1,50 @@
+//========= Copyright Valve Corporation, All rights reserved. ============//
+//
+// Purpose: On-disk cache of each face's direct lighting, for relighting only
+//			the faces that changed since the last compile.
+//
+//=============================================================================//
+
+#ifndef LIGHTCACHE_H
+#define LIGHTCACHE_H
+#ifdef _WIN32
+#pragma once
+#endif
+
+
+struct facelight_t;
+struct lightinfo_t;
+struct directlight_t;
+
+
+// Set with -lightcache. The cache lives next to the BSP as <mapname>.vlc
+// (<mapname>.hdr.vlc for HDR lighting).
+extern bool g_bUseLightCache;
+
+// Remembers the ray tracing triangles, so the next compile can tell where the
+// geometry changed. Must be called before the acceleration structure is built.
+void HashLightCacheGeometry();
+
+// Reads the last compile's cache and works out which lights were added,
+// removed or edited and which lights can see geometry that changed. Also sets
+// up recording this compile's lighting, so call it even without a cache file.
+// Must be called after the direct lights are created.
+void LoadLightCache();
+
+// Called by BuildFacelights once the face's samples are placed. If nothing
+// that lit the face last time has changed, copies the cached direct lighting
+// into the facelight and returns true. Otherwise starts recording which
+// lights reach the face.
+bool LightCache_ReuseFace( int iThread, int facenum, lightinfo_t const &l, facelight_t *fl, int nNormals );
+
+// Records that the light added something to the face being lit on this thread.
+void LightCache_AddLightToFace( int iThread, directlight_t *dl );
+
+// Keeps the face's direct lighting, before ambient and patch light are added.
+void LightCache_StoreFace( int iThread, int facenum, facelight_t *fl, int nNormals );
+
+// Writes every face's direct lighting out for the next compile and frees the cache.
+void SaveLightCache();
+
+
+#endif // LIGHTCACHE_H
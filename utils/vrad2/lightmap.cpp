@@ -22,6 +22,8 @@
 #include "mathlib/quantize.h"
 #include "bitmap/imageformat.h"
 #include "coordsize.h"
+#include "shadowqueue.h"
+#include "lightcache.h"
 
 enum
 {
@@ -94,30 +96,42 @@ fltx4 CalculateAmbientOcclusion4( const FourVectors &position4, const FourVector
 
 	fltx4 totalVisible = Four_Zeros;
 	fltx4 totalPossibleVisible = Four_Zeros;
-	for ( int i = 0; i < nSamples; i++ )
+
+	// trace 4 sample directions at a time so they can go out as one 16 ray packet
+	const int nGroups = 4;
+	for ( int i = 0; i < nSamples; i += nGroups )
 	{
-		FourVectors rayStart = position4;
-		rayStart += normal4;
+		FourVectors rayStart[nGroups];
+		FourVectors rayEnd[nGroups];
+		fltx4 absRayDotN[nGroups];
+		for ( int g = 0; g < nGroups; g++ )
+		{
+			rayStart[g] = position4;
+			rayStart[g] += normal4;
 
-		// Ray direction on the sphere
-		FourVectors rayDirection;
-		rayDirection.DuplicateVector( sampler.NextValue() );
+			// Ray direction on the sphere
+			FourVectors rayDirection;
+			rayDirection.DuplicateVector( sampler.NextValue() );
 
-		// Mirror ray along normal so all rays are on the hemisphere defined by the normal
-		fltx4 rayDotN = rayDirection * normal4; // dot product
-		fltx4 absRayDotN = AbsSIMD( rayDotN );
-		rayDirection = rayDirection - Mul( normal4, rayDotN ) + Mul( normal4, absRayDotN );
+			// Mirror ray along normal so all rays are on the hemisphere defined by the normal
+			fltx4 rayDotN = rayDirection * normal4; // dot product
+			absRayDotN[g] = AbsSIMD( rayDotN );
+			rayDirection = rayDirection - Mul( normal4, rayDotN ) + Mul( normal4, absRayDotN[g] );
 
-		// Set length of ray
-		FourVectors rayEnd = rayDirection;
-		rayEnd *= 36.0f;
-		rayEnd += rayStart;
+			// Set length of ray
+			rayEnd[g] = rayDirection;
+			rayEnd[g] *= 36.0f;
+			rayEnd[g] += rayStart[g];
+		}
 
 		// Raytrace for visibility function
-		fltx4 fractionVisible = Four_Ones;
-		TestLine_IgnoreSky( rayStart, rayEnd, &fractionVisible, static_prop_index_to_ignore );
-		totalVisible = AddSIMD( totalVisible, MulSIMD( fractionVisible, absRayDotN ) );
-		totalPossibleVisible = AddSIMD( totalPossibleVisible, absRayDotN );
+		fltx4 fractionVisible[nGroups];
+		TestLines_IgnoreSky( nGroups, rayStart, rayEnd, fractionVisible, static_prop_index_to_ignore );
+		for ( int g = 0; g < nGroups; g++ )
+		{
+			totalVisible = AddSIMD( totalVisible, MulSIMD( fractionVisible[g], absRayDotN[g] ) );
+			totalPossibleVisible = AddSIMD( totalPossibleVisible, absRayDotN[g] );
+		}
 	}
 
 	fltx4 ao = DivSIMD( totalVisible, totalPossibleVisible );
@@ -1128,7 +1142,8 @@ void SetDLightVis( directlight_t *dl, int cluster )
 {
 	if (dl->pvs == NULL)
 	{
-		dl->pvs = (byte *)calloc( 1, (dvis->numclusters / 8) + 1 );
+		// whole words, so MergePVS can work on it
+		dl->pvs = (byte *)calloc( PVSRowWords(), sizeof( uint64 ) );
 	}
 
 	GetVisCache( -1, cluster, dl->pvs );
@@ -1142,6 +1157,13 @@ void MergeDLightVis( directlight_t *dl, int cluster )
 	}
 	else
 	{
+		const uint64 *pCachedPVS = GetClusterPVS( cluster );
+		if ( pCachedPVS )
+		{
+			MergePVS( (uint64 *)dl->pvs, pCachedPVS );
+			return;
+		}
+
 		byte		pvs[MAX_MAP_CLUSTERS/8];
 		GetVisCache( -1, cluster, pvs );
 
@@ -1950,10 +1972,12 @@ void GatherSampleAmbientSkySSE( SSE_sampleLightOutput_t &out, directlight_t *dl,
 }
 
 // Helper function - gathers light from area lights, spot lights, and point lights
+// If pShadowRayEnd is set the visibility test is left to the caller: m_flDot[0] comes back
+// unshadowed and *pShadowRayEnd is where the shadow rays from pos should go.
 void GatherSampleStandardLightSSE( SSE_sampleLightOutput_t &out, directlight_t *dl, int facenum,
 								  FourVectors const& pos, FourVectors *pNormals, int normalCount, int iThread,
 								  int nLFlags, int static_prop_index_to_ignore,
-								  float flEpsilon )
+								  float flEpsilon, FourVectors *pShadowRayEnd = NULL )
 {
 	const bool bIgnoreNormals = ( nLFlags & GATHERLFLAGS_IGNORE_NORMALS ) != 0;
 
@@ -2089,9 +2113,26 @@ void GatherSampleStandardLightSSE( SSE_sampleLightOutput_t &out, directlight_t *
 	}
 
 	// Raytrace for visibility function
-	fltx4 fractionVisible = Four_Ones;
-	TestLine( pos, src, &fractionVisible, static_prop_index_to_ignore);
-	dot = MulSIMD( fractionVisible, dot );
+	if ( pShadowRayEnd )
+	{
+		*pShadowRayEnd = src;
+	}
+	else if ( g_bShadowRayStats )
+	{
+		CFastTimer timer;
+		timer.Start();
+		fltx4 fractionVisible = Four_Ones;
+		TestLine( pos, src, &fractionVisible, static_prop_index_to_ignore);
+		dot = MulSIMD( fractionVisible, dot );
+		timer.End();
+		AddShadowRayStats( iThread, false, 4, timer.GetDuration() );
+	}
+	else
+	{
+		fltx4 fractionVisible = Four_Ones;
+		TestLine( pos, src, &fractionVisible, static_prop_index_to_ignore);
+		dot = MulSIMD( fractionVisible, dot );
+	}
 	out.m_flDot[0] = dot;
 
 	for ( int i = 1; i < normalCount; i++ )
@@ -2107,6 +2148,8 @@ void GatherSampleStandardLightSSE( SSE_sampleLightOutput_t &out, directlight_t *
 	out.m_flSunAmount = Four_Zeros; //MulSIMD( out.m_flDot[0], out.m_flFalloff );
 }
 
+static void FinishSampleLightSSE( SSE_sampleLightOutput_t &out, fltx4 ao, int normalCount );
+
 // returns dot product with normal and delta
 // dl - light
 // pos - position of sample
@@ -2149,6 +2192,13 @@ void GatherSampleLightSSE( SSE_sampleLightOutput_t &out, directlight_t *dl, int
 	// Don't calculate ambient occlusion for objects that ignore normals for gathering light
 	fltx4 ao = ( nLFlags & GATHERLFLAGS_IGNORE_NORMALS ) == 0 ? CalculateAmbientOcclusion4( pos, *pNormals, static_prop_index_to_ignore ) : Four_Ones;
 
+	FinishSampleLightSSE( out, ao, normalCount );
+}
+
+// The part of GatherSampleLightSSE that comes after the light is shadowed: applies ambient
+// occlusion and keeps lights behind the face out of the bumped lightmaps.
+static void FinishSampleLightSSE( SSE_sampleLightOutput_t &out, fltx4 ao, int normalCount )
+{
 	out.m_flSunAmount = MulSIMD( out.m_flSunAmount, ao );
 
 	// NOTE: Notice here that if the light is on the back side of the face
@@ -2451,7 +2501,15 @@ int GetVisCache( int lastoffset, int cluster, byte *pvs )
 					Error ("visofs == -1");
 				}
 
-				DecompressVis (&dvisdata[thisoffset], pvs);
+				const uint64 *pCachedPVS = GetClusterPVS( cluster );
+				if ( pCachedPVS )
+				{
+					memcpy( pvs, pCachedPVS, (dvis->numclusters+7)/8 );
+				}
+				else
+				{
+					DecompressVis (&dvisdata[thisoffset], pvs);
+				}
 			}
 			lastoffset = thisoffset;
 		}
@@ -2602,9 +2660,96 @@ static void ComputeIlluminationPointAndNormalsSSE( lightinfo_t const& l, FourVec
 }
 
 //-----------------------------------------------------------------------------
-// Iterates over all lights and computes lighting at up to 4 sample points
+// Adds one light's (shadowed) contribution to up to 4 sample points
 //-----------------------------------------------------------------------------
-static void GatherSampleLightAt4Points( SSE_SampleInfo_t& info, int sampleIdx, int numSamples )
+static void AddSampleLightAt4Points( SSE_SampleInfo_t& info, directlight_t *dl, SSE_sampleLightOutput_t const &out,
+									 fltx4 dotMask, int sampleIdx, int numSamples, Vector const &vecWarnPos )
+{
+	// Apply the PVS check filter and compute falloff x dot
+	fltx4 fxdot[NUM_BUMP_VECTS + 1];
+	bool skipLight = true;
+	for ( int b = 0; b < info.m_NormalCount; b++ )
+	{
+		fxdot[b] = MulSIMD( out.m_flDot[b], dotMask );
+		fxdot[b] = MulSIMD( fxdot[b], out.m_flFalloff );
+		if ( !IsAllZeros( fxdot[b] ) )
+		{
+			skipLight = false;
+		}
+	}
+	if ( skipLight )
+		return;
+
+	// Figure out the lightstyle for this particular sample
+	int lightStyleIndex = FindOrAllocateLightstyleSamples( info.m_pFace, info.m_pFaceLight,
+		dl->light.style, info.m_NormalCount );
+	if (lightStyleIndex < 0)
+	{
+		if (info.m_WarnFace != info.m_FaceNum)
+		{
+			Warning ("\nWARNING: Too many light styles on a face at (%f, %f, %f)\n",
+				vecWarnPos.x, vecWarnPos.y, vecWarnPos.z );
+			info.m_WarnFace = info.m_FaceNum;
+		}
+		return;
+	}
+
+	// pLightmaps is an array of the lightmaps for each normal direction,
+	// here's where the result of the sample gathering goes
+	LightingValue_t** pLightmaps = info.m_pFaceLight->light[lightStyleIndex];
+
+	if ( g_bUseLightCache )
+	{
+		LightCache_AddLightToFace( info.m_iThread, dl );
+	}
+
+	// Incremental lighting only cares about lightstyle zero
+	if( g_pIncremental && (dl->light.style == 0) )
+	{
+		for ( int i = 0; i < numSamples; i++ )
+		{
+			g_pIncremental->AddLightToFace( dl->m_IncrementalID, info.m_FaceNum, sampleIdx + i,
+				info.m_LightmapSize, SubFloat( fxdot[0], i ), info.m_iThread );
+		}
+	}
+
+	for( int n = 0; n < info.m_NormalCount; ++n )
+	{
+		for ( int i = 0; i < numSamples; i++ )
+		{
+			pLightmaps[n][sampleIdx + i].AddLight( SubFloat( fxdot[n], i ), dl->light.intensity, SubFloat( out.m_flSunAmount, i ) );
+		}
+	}
+}
+
+
+//-----------------------------------------------------------------------------
+// A light's contribution to a group of samples, held back until the face's shadow rays
+// have been traced. Kept in light order so lightstyles get allocated and the lightmaps
+// summed exactly as if each light had been traced on the spot.
+//-----------------------------------------------------------------------------
+struct DeferredSampleLight_t
+{
+	SSE_sampleLightOutput_t m_Out;			// unshadowed, no ambient occlusion yet
+	fltx4			m_AO;
+	fltx4			m_DotMask;
+	directlight_t	*m_pLight;
+	int				m_nSampleIdx;
+	int				m_nNumSamples;
+	int				m_nShadowRays;			// CShadowRayQueue handle, -1 if m_Out is already final
+	Vector			m_vecWarnPos;
+};
+
+typedef CUtlVector< DeferredSampleLight_t, CUtlMemoryAligned< DeferredSampleLight_t, 16 > > DeferredSampleLightVector_t;
+static DeferredSampleLightVector_t s_DeferredSampleLights[MAX_TOOL_THREADS+1];
+
+
+//-----------------------------------------------------------------------------
+// Iterates over all lights and computes lighting at up to 4 sample points.
+// With a shadow ray queue, point, spot and surface lights only queue their rays
+// and everything is added by FlushDeferredSampleLights.
+//-----------------------------------------------------------------------------
+static void GatherSampleLightAt4Points( SSE_SampleInfo_t& info, int sampleIdx, int numSamples, CShadowRayQueue *pShadowRays = NULL )
 {
 	SSE_sampleLightOutput_t out;
 
@@ -2625,59 +2770,78 @@ static void GatherSampleLightAt4Points( SSE_SampleInfo_t& info, int sampleIdx, i
 		if ( skipLight )
 			continue;
 
-		GatherSampleLightSSE( out, dl, info.m_FaceNum, info.m_Points, info.m_PointNormals, info.m_NormalCount, info.m_iThread );
-
-		// Apply the PVS check filter and compute falloff x dot
-		fltx4 fxdot[NUM_BUMP_VECTS + 1];
-		skipLight = true;
-		for ( int b = 0; b < info.m_NormalCount; b++ )
+		if ( !pShadowRays )
 		{
-			fxdot[b] = MulSIMD( out.m_flDot[b], dotMask );
-			fxdot[b] = MulSIMD( fxdot[b], out.m_flFalloff );
-			if ( !IsAllZeros( fxdot[b] ) )
-			{
-				skipLight = false;
-			}
-		}
-		if ( skipLight )
+			GatherSampleLightSSE( out, dl, info.m_FaceNum, info.m_Points, info.m_PointNormals, info.m_NormalCount, info.m_iThread );
+			AddSampleLightAt4Points( info, dl, out, dotMask, sampleIdx, numSamples, info.m_Points.Vec( 0 ) );
 			continue;
+		}
 
-		// Figure out the lightstyle for this particular sample
-		int lightStyleIndex = FindOrAllocateLightstyleSamples( info.m_pFace, info.m_pFaceLight,
-			dl->light.style, info.m_NormalCount );
-		if (lightStyleIndex < 0)
+		DeferredSampleLightVector_t &deferred = s_DeferredSampleLights[info.m_iThread];
+		DeferredSampleLight_t &light = deferred[deferred.AddToTail()];
+		light.m_DotMask = dotMask;
+		light.m_pLight = dl;
+		light.m_nSampleIdx = sampleIdx;
+		light.m_nNumSamples = numSamples;
+		light.m_nShadowRays = -1;
+		light.m_vecWarnPos = info.m_Points.Vec( 0 );
+
+		if ( dl->light.type == emit_skylight || dl->light.type == emit_skyambient )
 		{
-			if (info.m_WarnFace != info.m_FaceNum)
-			{
-				Warning ("\nWARNING: Too many light styles on a face at (%f, %f, %f)\n",
-					info.m_Points.x.m128_f32[0], info.m_Points.y.m128_f32[0], info.m_Points.z.m128_f32[0] );
-				info.m_WarnFace = info.m_FaceNum;
-			}
+			GatherSampleLightSSE( light.m_Out, dl, info.m_FaceNum, info.m_Points, info.m_PointNormals, info.m_NormalCount, info.m_iThread );
 			continue;
 		}
 
-		// pLightmaps is an array of the lightmaps for each normal direction,
-		// here's where the result of the sample gathering goes
-		LightingValue_t** pLightmaps = info.m_pFaceLight->light[lightStyleIndex];
-
-		// Incremental lighting only cares about lightstyle zero
-		if( g_pIncremental && (dl->light.style == 0) )
-		{
-			for ( int i = 0; i < numSamples; i++ )
-			{
-				g_pIncremental->AddLightToFace( dl->m_IncrementalID, info.m_FaceNum, sampleIdx + i,
-					info.m_LightmapSize, SubFloat( fxdot[0], i ), info.m_iThread );
-			}
+		// same as GatherSampleLightSSE, minus the visibility test
+		for ( int b = 0; b < info.m_NormalCount; b++ )
+			light.m_Out.m_flDot[b] = Four_Zeros;
+		light.m_Out.m_flFalloff = Four_Zeros;
+		light.m_Out.m_flSunAmount = Four_Zeros;
+		FourVectors shadowRayEnd;
+		GatherSampleStandardLightSSE( light.m_Out, dl, info.m_FaceNum, info.m_Points, info.m_PointNormals, info.m_NormalCount,
+									  info.m_iThread, 0, -1, 0.0f, &shadowRayEnd );
+
+		// Samples facing away from the light or outside the PVS add nothing however the ray
+		// turns out, so they don't need one. If that's all of them the light is skipped just
+		// like it would have been after the trace.
+		fltx4 needsRay = AndSIMD( CmpGtSIMD( light.m_Out.m_flDot[0], Four_Zeros ), CmpGtSIMD( dotMask, Four_Zeros ) );
+		int nLaneMask = TestSignSIMD( needsRay );
+		if ( !nLaneMask )
+		{
+			deferred.RemoveMultipleFromTail( 1 );
+			continue;
 		}
 
-		for( int n = 0; n < info.m_NormalCount; ++n )
+		light.m_AO = CalculateAmbientOcclusion4( info.m_Points, info.m_PointNormals[0], -1 );
+		light.m_nShadowRays = pShadowRays->AddRays( info.m_Points, shadowRayEnd, nLaneMask );
+	}
+}
+
+
+//-----------------------------------------------------------------------------
+// Traces the shadow rays queued by GatherSampleLightAt4Points and adds every light
+// that was held back into the face's lightmaps.
+//-----------------------------------------------------------------------------
+static void FlushDeferredSampleLights( SSE_SampleInfo_t& info, CShadowRayQueue &shadowRays )
+{
+	shadowRays.TraceQueuedRays( info.m_iThread );
+
+	DeferredSampleLightVector_t &deferred = s_DeferredSampleLights[info.m_iThread];
+	for ( int i = 0; i < deferred.Count(); i++ )
+	{
+		DeferredSampleLight_t &light = deferred[i];
+		if ( light.m_nShadowRays >= 0 )
 		{
-			for ( int i = 0; i < numSamples; i++ )
-			{
-				pLightmaps[n][sampleIdx + i].AddLight( SubFloat( fxdot[n], i ), dl->light.intensity, SubFloat( out.m_flSunAmount, i ) );
-			}
+			fltx4 fractionVisible = shadowRays.GetFractionVisible( light.m_nShadowRays );
+			light.m_Out.m_flDot[0] = MulSIMD( fractionVisible, light.m_Out.m_flDot[0] );
+			FinishSampleLightSSE( light.m_Out, light.m_AO, info.m_NormalCount );
 		}
+		AddSampleLightAt4Points( info, light.m_pLight, light.m_Out, light.m_DotMask,
+			light.m_nSampleIdx, light.m_nNumSamples, light.m_vecWarnPos );
 	}
+
+	deferred.RemoveAll();
+	shadowRays.Reset();
 }
 
 
@@ -2727,6 +2891,11 @@ static void ResampleLightAt4Points( SSE_SampleInfo_t& info, int lightStyleIndex,
 		if ( skipLight )
 			continue;
 
+		if ( g_bUseLightCache )
+		{
+			LightCache_AddLightToFace( info.m_iThread, dl );
+		}
+
 		// NOTE: Notice here that if the light is on the back side of the face
 		// (tested by checking the dot product of the face normal and the light position)
 		// we don't want it to contribute to *any* of the bumped lightmaps. It glows
@@ -3172,6 +3341,30 @@ static void InitSampleInfo( lightinfo_t const& l, int iThread, SSE_SampleInfo_t&
 	}
 }
 
+//-----------------------------------------------------------------------------
+// Once a face's direct lighting is done, whether it was traced or came out of
+// the light cache
+//-----------------------------------------------------------------------------
+static void FinishFacelights( int facenum, facelight_t *fl )
+{
+	if (!g_bUseMPI)
+	{
+		//
+		// This is done on the master node when MPI is used
+		//
+		BuildPatchLights( facenum );
+	}
+
+	if( g_bDumpPatches )
+	{
+		DumpSamples( facenum, fl );
+	}
+	else
+	{
+		FreeSampleWindings( fl );
+	}
+}
+
 void BuildFacelights (int iThread, int facenum)
 {
 	lightinfo_t	l;
@@ -3219,6 +3412,13 @@ void BuildFacelights (int iThread, int facenum)
 	CalcPoints( &l, fl, facenum );
 	InitSampleInfo( l, iThread, sampleInfo );
 
+	// Nothing that lit this face last time changed?
+	if ( g_bUseLightCache && LightCache_ReuseFace( iThread, facenum, l, fl, sampleInfo.m_NormalCount ) )
+	{
+		FinishFacelights( facenum, fl );
+		return;
+	}
+
 	// Allocate sample positions/normals to SSE
 	int numGroups = ( fl->numsamples & 0x3) ? ( fl->numsamples / 4 ) + 1 : ( fl->numsamples / 4 );
 
@@ -3226,6 +3426,8 @@ void BuildFacelights (int iThread, int facenum)
 	f->styles[0] = 0;
 	AllocateLightstyleSamples( fl, 0, sampleInfo.m_NormalCount );
 
+	CShadowRayQueue *pShadowRays = g_bShadowRayQueue ? &GetShadowRayQueue( iThread ) : NULL;
+
 	// sample the lights at each sample location
 	for ( int grp = 0; grp < numGroups; ++grp )
 	{
@@ -3255,9 +3457,12 @@ void BuildFacelights (int iThread, int facenum)
 		}
 
 		// Iterate over all the lights and add their contribution to this group of spots
-		GatherSampleLightAt4Points( sampleInfo, nSample, numSamples );
+		GatherSampleLightAt4Points( sampleInfo, nSample, numSamples, pShadowRays );
 	}
 
+	if ( pShadowRays )
+		FlushDeferredSampleLights( sampleInfo, *pShadowRays );
+
 	// Tell the incremental light manager that we're done with this face.
 	if( g_pIncremental )
 	{
@@ -3287,23 +3492,12 @@ void BuildFacelights (int iThread, int facenum)
 		}
 	}
 
-	if (!g_bUseMPI)
+	if ( g_bUseLightCache )
 	{
-		//
-		// This is done on the master node when MPI is used
-		//
-		BuildPatchLights( facenum );
-	}
-
-	if( g_bDumpPatches )
-	{
-		DumpSamples( facenum, fl );
-	}
-	else
-	{
-		FreeSampleWindings( fl );
+		LightCache_StoreFace( iThread, facenum, fl, sampleInfo.m_NormalCount );
 	}
 
+	FinishFacelights( facenum, fl );
 }
 
 void BuildPatchLights( int facenum )
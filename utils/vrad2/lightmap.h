@@ -135,6 +135,9 @@ extern void InitLightinfo( lightinfo_t *l, int facenum );
 
 void FreeDLights();
 
+// Decompresses the cluster's PVS into pvs, unless lastoffset says it's already there
+int GetVisCache( int lastoffset, int cluster, byte *pvs );
+
 void ExportDirectLightsToWorldLights();
 
 
@@ -28,6 +28,7 @@
 #include "vmpi.h"
 #include "mpi_stats.h"
 #include "vmpi_distribute_work.h"
+#include "packedtransfers.h"
 #include "vmpi_tools_shared.h"
 
 
@@ -292,10 +293,18 @@ void MPI_ReceiveVisLeafsResults( uint64 iWorkUnit, MessageBuffer *pBuf, int iWor
 		int numtransfers;
 		pBuf->read( &numtransfers, sizeof(numtransfers) );
 		patch->numtransfers = numtransfers;
-		if (numtransfers) 
+		if ( numtransfers && g_bCompressTransfers )
+		{
+			CUtlVector<transfer_t> received;
+			received.SetCount( numtransfers );
+			pBuf->read( received.Base(), numtransfers * sizeof(transfer_t) );
+			PackPatchTransfers( patch, received.Base(), numtransfers );
+		}
+		else if (numtransfers) 
 		{
 			patch->transfers = new transfer_t[numtransfers];
 			pBuf->read(patch->transfers, numtransfers * sizeof(transfer_t));
+			SortTransfers( patch->transfers, numtransfers );
 		}
 		
 		total_transfer += numtransfers;
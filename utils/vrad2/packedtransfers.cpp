@@ -0,0 +1,352 @@
+//========= Copyright Valve Corporation, All rights reserved. ============//
+//
+// Purpose: Compact storage for the patch transfer lists used by the bounce.
+//
+//=============================================================================//
+
+#include "vrad.h"
+#include "packedtransfers.h"
+
+
+// Size of the view each thread maps over the transfer file when streaming.
+// Blocks are written in patch order and threads work through contiguous
+// patch ranges, so a window is normally reused for many patches.
+#define TRANSFER_STREAM_WINDOW_SIZE		( 32 * 1024 * 1024 )
+
+bool g_bCompressTransfers = false;
+bool g_bStreamTransfers = false;
+
+double g_flBounceTime = 0;
+unsigned g_nBounces = 0;
+
+extern int total_transfer;
+
+// Bytes held by packed blocks, whether on the heap or in the transfer file.
+static int64 g_nPackedTransferBytes = 0;
+
+// Streaming state. g_PackedTransferOffsets holds each patch's block offset in the file.
+static HANDLE g_hTransferFile = INVALID_HANDLE_VALUE;
+static HANDLE g_hTransferMapping = NULL;
+static int64 g_nTransferFileSize = 0;
+static CUtlVector<int64> g_PackedTransferOffsets;
+static DWORD g_nAllocationGranularity = 0;
+
+struct TransferStreamWindow_t
+{
+	byte	*m_pView;
+	int64	m_nStart;
+	int64	m_nEnd;
+	int		m_nRemaps;
+};
+
+static TransferStreamWindow_t g_TransferStreamWindows[MAX_TOOL_THREADS+1];
+
+
+static int __cdecl CompareTransferPatch( const void *p1, const void *p2 )
+{
+	return ( (const transfer_t *)p1 )->patch - ( (const transfer_t *)p2 )->patch;
+}
+
+
+void SortTransfers( transfer_t *pTransfers, int nTransfers )
+{
+	qsort( pTransfers, nTransfers, sizeof( transfer_t ), CompareTransferPatch );
+}
+
+
+static inline int VarIntSize( unsigned int nValue )
+{
+	int nSize = 1;
+	while ( nValue >= 0x80 )
+	{
+		nValue >>= 7;
+		++nSize;
+	}
+	return nSize;
+}
+
+
+static inline byte *WriteVarInt( byte *pOut, unsigned int nValue )
+{
+	while ( nValue >= 0x80 )
+	{
+		*pOut++ = (byte)( nValue | 0x80 );
+		nValue >>= 7;
+	}
+	*pOut++ = (byte)nValue;
+	return pOut;
+}
+
+
+static inline const byte *ReadVarInt( const byte *pIn, unsigned int &nValue )
+{
+	nValue = 0;
+	int nShift = 0;
+	byte b;
+	do
+	{
+		b = *pIn++;
+		nValue |= (unsigned int)( b & 0x7F ) << nShift;
+		nShift += 7;
+	} while ( b & 0x80 );
+	return pIn;
+}
+
+
+//-----------------------------------------------------------------------------
+// Block layout: unsigned short quantized[n], then n varints holding the
+// difference from the previous patch index (the first one is absolute).
+//-----------------------------------------------------------------------------
+void PackPatchTransfers( CPatch *pPatch, transfer_t *pTransfers, int nTransfers )
+{
+	pPatch->numtransfers = nTransfers;
+	pPatch->transfers = NULL;
+	pPatch->packedtransfers = NULL;
+	pPatch->packedsize = 0;
+	pPatch->packedscale = 0;
+
+	if ( !nTransfers )
+		return;
+
+	SortTransfers( pTransfers, nTransfers );
+
+	float flMax = 0;
+	int nSize = nTransfers * sizeof( unsigned short );
+	int iPrevPatch = 0;
+	for ( int i = 0; i < nTransfers; i++ )
+	{
+		flMax = max( flMax, pTransfers[i].transfer );
+		nSize += VarIntSize( pTransfers[i].patch - iPrevPatch );
+		iPrevPatch = pTransfers[i].patch;
+	}
+
+	byte *pBlock = (byte *)malloc( nSize );
+	if ( !pBlock )
+		Error( "Memory allocation failure" );
+
+	float flScale = flMax / 65535.0f;
+	float flInvScale = ( flMax > 0 ) ? 65535.0f / flMax : 0;
+
+	unsigned short *pQuantized = (unsigned short *)pBlock;
+	byte *pIndices = pBlock + nTransfers * sizeof( unsigned short );
+	iPrevPatch = 0;
+	for ( int i = 0; i < nTransfers; i++ )
+	{
+		pQuantized[i] = (unsigned short)min( 65535.0f, pTransfers[i].transfer * flInvScale + 0.5f );
+		pIndices = WriteVarInt( pIndices, pTransfers[i].patch - iPrevPatch );
+		iPrevPatch = pTransfers[i].patch;
+	}
+	Assert( pIndices == pBlock + nSize );
+
+	pPatch->packedtransfers = pBlock;
+	pPatch->packedsize = nSize;
+	pPatch->packedscale = flScale;
+
+	ThreadInterlockedExchangeAdd64( &g_nPackedTransferBytes, nSize );
+}
+
+
+void PackAllTransfers( bool bFreeLists )
+{
+	int nPatches = g_Patches.Count();
+	for ( int i = 0; i < nPatches; i++ )
+	{
+		CPatch *pPatch = &g_Patches[i];
+		if ( pPatch->packedtransfers || !pPatch->transfers )
+			continue;
+
+		// Packing sorts the list in place, so work on a copy in case it's read-only.
+		transfer_t *pTransfers = pPatch->transfers;
+		CUtlVector<transfer_t> sorted;
+		sorted.CopyArray( pTransfers, pPatch->numtransfers );
+		PackPatchTransfers( pPatch, sorted.Base(), sorted.Count() );
+
+		if ( bFreeLists )
+			free( pTransfers );
+	}
+}
+
+
+static void DecodePackedTransfers( const byte *pBlock, int nTransfers, float flScale, transfer_t *pOut )
+{
+	const unsigned short *pQuantized = (const unsigned short *)pBlock;
+	const byte *pIndices = pBlock + nTransfers * sizeof( unsigned short );
+
+	int iPatch = 0;
+	for ( int i = 0; i < nTransfers; i++ )
+	{
+		unsigned int nDelta;
+		pIndices = ReadVarInt( pIndices, nDelta );
+		iPatch += nDelta;
+		pOut[i].patch = iPatch;
+		pOut[i].transfer = pQuantized[i] * flScale;
+	}
+}
+
+
+void StreamPackedTransfers()
+{
+	if ( g_hTransferFile != INVALID_HANDLE_VALUE )
+		return;
+
+	SYSTEM_INFO info;
+	GetSystemInfo( &info );
+	g_nAllocationGranularity = info.dwAllocationGranularity;
+
+	char szFilename[MAX_PATH];
+	Q_snprintf( szFilename, sizeof( szFilename ), "%s.vtp", source );
+
+	g_hTransferFile = ::CreateFile( szFilename, GENERIC_READ | GENERIC_WRITE, 0, NULL, CREATE_ALWAYS,
+		FILE_ATTRIBUTE_TEMPORARY | FILE_FLAG_DELETE_ON_CLOSE, NULL );
+	if ( g_hTransferFile == INVALID_HANDLE_VALUE )
+	{
+		Warning( "Can't create transfer file %s, keeping transfers in memory\n", szFilename );
+		return;
+	}
+
+	// Write the blocks in patch order, 2-byte aligned for the quantized values.
+	int nPatches = g_Patches.Count();
+	g_PackedTransferOffsets.SetCount( nPatches );
+	int64 nOffset = 0;
+	for ( int i = 0; i < nPatches; i++ )
+	{
+		CPatch *pPatch = &g_Patches[i];
+		g_PackedTransferOffsets[i] = nOffset;
+		if ( !pPatch->packedtransfers )
+			continue;
+
+		int nPadded = ( pPatch->packedsize + 1 ) & ~1;
+		DWORD dwWritten = 0;
+		if ( !::WriteFile( g_hTransferFile, pPatch->packedtransfers, nPadded, &dwWritten, NULL ) || (int)dwWritten != nPadded )
+			Error( "Error writing transfer file %s\n", szFilename );
+
+		free( pPatch->packedtransfers );
+		pPatch->packedtransfers = NULL;
+		nOffset += nPadded;
+	}
+	g_nTransferFileSize = nOffset;
+
+	if ( nOffset )
+	{
+		g_hTransferMapping = ::CreateFileMapping( g_hTransferFile, NULL, PAGE_READONLY, 0, 0, NULL );
+		if ( !g_hTransferMapping )
+			Error( "Can't map transfer file %s\n", szFilename );
+	}
+
+	memset( g_TransferStreamWindows, 0, sizeof( g_TransferStreamWindows ) );
+
+	Msg( "Streaming %.1f megs of transfers from %s\n", (float)nOffset / ( 1024*1024 ), szFilename );
+}
+
+
+// Returns the packed block of a streamed patch, remapping this thread's window if needed.
+static const byte *GetStreamedBlock( const CPatch *pPatch, int iThread )
+{
+	int64 nStart = g_PackedTransferOffsets[pPatch - g_Patches.Base()];
+	int64 nEnd = nStart + pPatch->packedsize;
+
+	TransferStreamWindow_t &window = g_TransferStreamWindows[iThread];
+	if ( !window.m_pView || nStart < window.m_nStart || nEnd > window.m_nEnd )
+	{
+		if ( window.m_pView )
+			::UnmapViewOfFile( window.m_pView );
+
+		int64 nViewStart = nStart - ( nStart % g_nAllocationGranularity );
+		int64 nViewEnd = min( g_nTransferFileSize, max( nEnd, nViewStart + TRANSFER_STREAM_WINDOW_SIZE ) );
+		window.m_pView = (byte *)::MapViewOfFile( g_hTransferMapping, FILE_MAP_READ,
+			(DWORD)( nViewStart >> 32 ), (DWORD)( nViewStart & 0xFFFFFFFF ), (SIZE_T)( nViewEnd - nViewStart ) );
+		if ( !window.m_pView )
+			Error( "Can't map transfer file window (%d)\n", GetLastError() );
+
+		window.m_nStart = nViewStart;
+		window.m_nEnd = nViewEnd;
+		++window.m_nRemaps;
+	}
+
+	return window.m_pView + ( nStart - window.m_nStart );
+}
+
+
+const transfer_t *GetPatchTransfers( const CPatch *pPatch, int iThread, transfer_t *pScratch )
+{
+	if ( !pPatch->packedsize )
+		return pPatch->transfers;
+
+	const byte *pBlock = pPatch->packedtransfers;
+	if ( !pBlock )
+		pBlock = GetStreamedBlock( pPatch, iThread );
+
+	DecodePackedTransfers( pBlock, pPatch->numtransfers, pPatch->packedscale, pScratch );
+	return pScratch;
+}
+
+
+void FreePackedTransfers()
+{
+	for ( int i = 0; i < ARRAYSIZE( g_TransferStreamWindows ); i++ )
+	{
+		if ( g_TransferStreamWindows[i].m_pView )
+			::UnmapViewOfFile( g_TransferStreamWindows[i].m_pView );
+	}
+	memset( g_TransferStreamWindows, 0, sizeof( g_TransferStreamWindows ) );
+
+	if ( g_hTransferMapping )
+	{
+		::CloseHandle( g_hTransferMapping );
+		g_hTransferMapping = NULL;
+	}
+
+	if ( g_hTransferFile != INVALID_HANDLE_VALUE )
+	{
+		::CloseHandle( g_hTransferFile );
+		g_hTransferFile = INVALID_HANDLE_VALUE;
+	}
+
+	int nPatches = g_Patches.Count();
+	for ( int i = 0; i < nPatches; i++ )
+	{
+		CPatch *pPatch = &g_Patches[i];
+		if ( pPatch->packedsize )
+		{
+			free( pPatch->packedtransfers );
+			pPatch->packedtransfers = NULL;
+			pPatch->packedsize = 0;
+			pPatch->numtransfers = 0;
+		}
+	}
+
+	g_PackedTransferOffsets.Purge();
+	g_nPackedTransferBytes = 0;
+}
+
+
+void PrintTransferStats()
+{
+	if ( !total_transfer )
+		return;
+
+	float flUnpackedMegs = (float)total_transfer * sizeof( transfer_t ) / ( 1024*1024 );
+	if ( g_nPackedTransferBytes )
+	{
+		int nRemaps = 0;
+		for ( int i = 0; i < ARRAYSIZE( g_TransferStreamWindows ); i++ )
+			nRemaps += g_TransferStreamWindows[i].m_nRemaps;
+
+		Msg( "Transfers: %d, %.1f megs packed (%.1f megs unpacked, %.2f bytes each)%s\n",
+			total_transfer, (float)g_nPackedTransferBytes / ( 1024*1024 ), flUnpackedMegs,
+			(float)g_nPackedTransferBytes / total_transfer,
+			g_hTransferMapping ? ", streamed" : "" );
+		if ( g_hTransferMapping )
+			Msg( "Transfer stream window remaps: %d\n", nRemaps );
+	}
+	else
+	{
+		Msg( "Transfers: %d, %.1f megs\n", total_transfer, flUnpackedMegs );
+	}
+
+	if ( g_flBounceTime > 0 )
+	{
+		Msg( "Bounce time: %.2f seconds (%.2f ns per transfer per bounce)\n",
+			g_flBounceTime, g_flBounceTime * 1e9 / ( (double)total_transfer * max( 1u, g_nBounces ) ) );
+	}
+}
@@ -0,0 +1,55 @@
+//========= Copyright Valve Corporation, All rights reserved. ============//
+//
+// Purpose: Compact storage for the patch transfer lists used by the bounce.
+//
+// With -compresstransfers each patch's transfer list is stored as a block of
+// 16-bit quantized form factors followed by the delta-coded (varint) indices
+// of the patches they come from, sorted by patch index. -streamtransfers also
+// moves the blocks into a temporary file that the bounce reads through
+// per-thread mapped windows, so the OS can page them out when RAM is tight.
+//
+//=============================================================================//
+
+#ifndef PACKEDTRANSFERS_H
+#define PACKEDTRANSFERS_H
+#ifdef _WIN32
+#pragma once
+#endif
+
+
+struct CPatch;
+struct transfer_t;
+
+extern bool g_bCompressTransfers;
+extern bool g_bStreamTransfers;
+
+// Time spent in BounceLight and the number of bounces done, for the end-of-run stats.
+extern double g_flBounceTime;
+extern unsigned g_nBounces;
+
+// Sort a transfer list by patch index, the order GatherLight wants to read it in.
+void SortTransfers( transfer_t *pTransfers, int nTransfers );
+
+// Encode a patch's scaled transfer list into its packed block. Sorts pTransfers in place.
+void PackPatchTransfers( CPatch *pPatch, transfer_t *pTransfers, int nTransfers );
+
+// Pack every patch that still holds a plain transfer_t list (MPI master, transfer cache).
+// bFreeLists frees the old lists, which must have come from MakeScales.
+void PackAllTransfers( bool bFreeLists );
+
+// Move the packed blocks out of the heap into the temporary transfer file.
+void StreamPackedTransfers();
+
+// Free packed blocks and close the transfer file.
+void FreePackedTransfers();
+
+// Returns the patch's transfer list, decoding it into pScratch (which must hold
+// numtransfers entries) if it is packed. iThread selects the mapped window used
+// when streaming.
+const transfer_t *GetPatchTransfers( const CPatch *pPatch, int iThread, transfer_t *pScratch );
+
+// Print memory used by the transfers and the time spent bouncing.
+void PrintTransferStats();
+
+
+#endif // PACKEDTRANSFERS_H
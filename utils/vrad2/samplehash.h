@@ -0,0 +1,292 @@
+//========= Copyright Valve Corporation, All rights reserved. ============//
+//
+// Purpose: Spatial hashes from SAMPLEHASH_VOXEL_SIZE voxels to the luxel
+//			samples and patches in them, used to gather neighboring light
+//			onto displacements.
+//
+//=============================================================================//
+
+#ifndef SAMPLEHASH_H
+#define SAMPLEHASH_H
+#ifdef _WIN32
+#pragma once
+#endif
+
+#include "tier1/utlvector.h"
+#include "tier1/utlmemory.h"
+
+
+#define SAMPLEHASH_VOXEL_SIZE			64.0f
+#define SAMPLEHASH_CELLS_PER_BUCKET		4
+
+
+//-----------------------------------------------------------------------------
+// Open addressed hash from voxels to lists of values. Cells sit four to a 64
+// byte bucket and are probed a bucket at a time, so most lookups touch one
+// cache line. All the values live in one array, each cell's together and in
+// the order they were added.
+//
+// The hash is built in one go: set the number of (voxel, value) pairs, fill
+// them in from any number of threads (each pair has its own slot), then call
+// Build. Appending pairs with AddPair works too, from one thread.
+//-----------------------------------------------------------------------------
+template< class T >
+class CSampleHash
+{
+public:
+	CSampleHash() : m_nCells( 0 ), m_nProbes( 0 ) {}
+
+	void Purge( void );
+
+	void SetPairCount( int nPairs )						{ m_Pairs.SetCount( nPairs ); }
+	void SetPair( int iPair, int x, int y, int z, T value );
+	void AddPair( int x, int y, int z, T value )		{ SetPair( m_Pairs.AddToTail(), x, y, z, value ); }
+	void Build( void );
+
+	// Returns the number of values in the voxel and points ppValues at them.
+	int Find( int x, int y, int z, const T **ppValues ) const;
+
+	int CellCount( void ) const							{ return m_nCells; }
+	int ValueCount( void ) const						{ return m_Values.Count(); }
+	void Log( const char *pszFileName ) const;
+
+private:
+	struct Pair_t
+	{
+		uint64	m_Key;
+		T		m_Value;
+	};
+
+	struct Cell_t
+	{
+		uint64	m_Key;				// 0 for empty cells
+		int		m_nFirst;			// index into m_Values
+		int		m_nCount;
+	};
+
+	struct Bucket_t
+	{
+		Cell_t	m_Cells[SAMPLEHASH_CELLS_PER_BUCKET];
+	};
+
+	// Voxel coordinates are well inside 16 bits, the top bit marks a used cell.
+	static uint64 MakeKey( int x, int y, int z )
+	{
+		return (uint64)(unsigned short)x | ( (uint64)(unsigned short)y << 16 ) | ( (uint64)(unsigned short)z << 32 ) | ( (uint64)1 << 63 );
+	}
+
+	int HashBucket( uint64 key ) const
+	{
+		return (int)( ( key * 0x9E3779B97F4A7C15ULL ) >> 32 ) & ( m_Buckets.Count() - 1 );
+	}
+
+	const Cell_t *FindCell( uint64 key ) const;
+	Cell_t *FindOrAddCell( uint64 key );
+	void Grow( void );
+
+	CUtlVector< Pair_t > m_Pairs;
+	CUtlVector< Bucket_t, CUtlMemoryAligned< Bucket_t, 64 > > m_Buckets;
+	CUtlVector< T > m_Values;
+	int m_nCells;
+	int m_nProbes;					// extra buckets visited while building, for Log
+};
+
+
+template< class T >
+void CSampleHash<T>::Purge( void )
+{
+	m_Pairs.Purge();
+	m_Buckets.Purge();
+	m_Values.Purge();
+	m_nCells = 0;
+	m_nProbes = 0;
+}
+
+template< class T >
+void CSampleHash<T>::SetPair( int iPair, int x, int y, int z, T value )
+{
+	m_Pairs[iPair].m_Key = MakeKey( x, y, z );
+	m_Pairs[iPair].m_Value = value;
+}
+
+template< class T >
+const typename CSampleHash<T>::Cell_t *CSampleHash<T>::FindCell( uint64 key ) const
+{
+	int nMask = m_Buckets.Count() - 1;
+	for ( int iBucket = HashBucket( key ); ; iBucket = ( iBucket + 1 ) & nMask )
+	{
+		const Bucket_t &bucket = m_Buckets[iBucket];
+		for ( int i = 0; i < SAMPLEHASH_CELLS_PER_BUCKET; i++ )
+		{
+			if ( bucket.m_Cells[i].m_Key == key )
+				return &bucket.m_Cells[i];
+
+			if ( !bucket.m_Cells[i].m_Key )
+				return NULL;
+		}
+	}
+}
+
+template< class T >
+typename CSampleHash<T>::Cell_t *CSampleHash<T>::FindOrAddCell( uint64 key )
+{
+	// Keep the table at most half full
+	if ( ( m_nCells + 1 ) * 2 > m_Buckets.Count() * SAMPLEHASH_CELLS_PER_BUCKET )
+	{
+		Grow();
+	}
+
+	int nMask = m_Buckets.Count() - 1;
+	for ( int iBucket = HashBucket( key ); ; iBucket = ( iBucket + 1 ) & nMask )
+	{
+		Bucket_t &bucket = m_Buckets[iBucket];
+		for ( int i = 0; i < SAMPLEHASH_CELLS_PER_BUCKET; i++ )
+		{
+			Cell_t &cell = bucket.m_Cells[i];
+			if ( cell.m_Key == key )
+				return &cell;
+
+			if ( !cell.m_Key )
+			{
+				cell.m_Key = key;
+				cell.m_nFirst = 0;
+				cell.m_nCount = 0;
+				m_nCells++;
+				return &cell;
+			}
+		}
+		m_nProbes++;
+	}
+}
+
+template< class T >
+void CSampleHash<T>::Grow( void )
+{
+	CUtlVector< Bucket_t, CUtlMemoryAligned< Bucket_t, 64 > > oldBuckets;
+	oldBuckets.Swap( m_Buckets );
+
+	int nBuckets = MAX( oldBuckets.Count() * 2, 64 );
+	m_Buckets.SetCount( nBuckets );
+	memset( m_Buckets.Base(), 0, nBuckets * sizeof( Bucket_t ) );
+	m_nCells = 0;
+
+	for ( int iBucket = 0; iBucket < oldBuckets.Count(); iBucket++ )
+	{
+		for ( int i = 0; i < SAMPLEHASH_CELLS_PER_BUCKET; i++ )
+		{
+			const Cell_t &oldCell = oldBuckets[iBucket].m_Cells[i];
+			if ( oldCell.m_Key )
+			{
+				*FindOrAddCell( oldCell.m_Key ) = oldCell;
+			}
+		}
+	}
+}
+
+template< class T >
+void CSampleHash<T>::Build( void )
+{
+	m_Buckets.Purge();
+	m_Values.Purge();
+	m_nCells = 0;
+	m_nProbes = 0;
+
+	// Count the values in each voxel
+	int nPairs = m_Pairs.Count();
+	for ( int i = 0; i < nPairs; i++ )
+	{
+		FindOrAddCell( m_Pairs[i].m_Key )->m_nCount++;
+	}
+
+	// Lay the cells out one after another
+	int nFirst = 0;
+	for ( int iBucket = 0; iBucket < m_Buckets.Count(); iBucket++ )
+	{
+		for ( int i = 0; i < SAMPLEHASH_CELLS_PER_BUCKET; i++ )
+		{
+			Cell_t &cell = m_Buckets[iBucket].m_Cells[i];
+			if ( cell.m_Key )
+			{
+				cell.m_nFirst = nFirst;
+				nFirst += cell.m_nCount;
+				cell.m_nCount = 0;
+			}
+		}
+	}
+
+	// and drop the values in, in the order they were added
+	m_Values.SetCount( nPairs );
+	for ( int i = 0; i < nPairs; i++ )
+	{
+		Cell_t *pCell = const_cast< Cell_t * >( FindCell( m_Pairs[i].m_Key ) );
+		m_Values[pCell->m_nFirst + pCell->m_nCount++] = m_Pairs[i].m_Value;
+	}
+
+	m_Pairs.Purge();
+}
+
+template< class T >
+int CSampleHash<T>::Find( int x, int y, int z, const T **ppValues ) const
+{
+	if ( !m_nCells )
+		return 0;
+
+	const Cell_t *pCell = FindCell( MakeKey( x, y, z ) );
+	if ( !pCell )
+		return 0;
+
+	*ppValues = m_Values.Base() + pCell->m_nFirst;
+	return pCell->m_nCount;
+}
+
+template< class T >
+void CSampleHash<T>::Log( const char *pszFileName ) const
+{
+	FILE *fp = fopen( pszFileName, "w" );
+	if ( !fp )
+		return;
+
+	int nLargest = 0;
+	int nUsedBuckets = 0;
+	for ( int iBucket = 0; iBucket < m_Buckets.Count(); iBucket++ )
+	{
+		const Bucket_t &bucket = m_Buckets[iBucket];
+		nUsedBuckets += bucket.m_Cells[0].m_Key ? 1 : 0;
+		for ( int i = 0; i < SAMPLEHASH_CELLS_PER_BUCKET; i++ )
+		{
+			if ( bucket.m_Cells[i].m_Key )
+			{
+				nLargest = MAX( nLargest, bucket.m_Cells[i].m_nCount );
+			}
+		}
+	}
+
+	fprintf( fp, "%d buckets of %d cells, %d used\n", m_Buckets.Count(), SAMPLEHASH_CELLS_PER_BUCKET, nUsedBuckets );
+	fprintf( fp, "%d voxels, %d values, %.1f values per voxel, largest voxel %d\n", m_nCells, m_Values.Count(),
+		m_nCells ? (float)m_Values.Count() / m_nCells : 0.0f, nLargest );
+	fprintf( fp, "%d extra buckets probed while building\n", m_nProbes );
+
+	fclose( fp );
+}
+
+
+typedef unsigned int SampleHandle_t;				// the upper 16 bits = facelight index (works because max face are 65536)
+													// the lower 16 bits = sample index inside of facelight
+
+extern CSampleHash<SampleHandle_t>	g_SampleHashTable;
+extern CSampleHash<int>				g_PatchSampleHashTable;
+
+extern int samplesAdded;
+extern int patchSamplesAdded;
+
+void GetSampleHashVoxel( const Vector &vOrigin, int &x, int &y, int &z );
+void PatchSampleData_AddSample( CPatch *pPatch, int ndxPatch );
+unsigned short IncrementPatchIterationKey();
+void SampleData_Log( void );
+
+// Builds the sample hash the old way, with node based CUtlHash tables, and with
+// CSampleHash, then times both and checks that they find the same samples.
+void RunSampleHashBenchmark( void );
+
+
+#endif // SAMPLEHASH_H
@@ -0,0 +1,250 @@
+//========= Copyright Valve Corporation, All rights reserved. ============//
+//
+// Purpose: Times building and querying the sample and patch hashes with
+//			CSampleHash against the node based CUtlHash tables they used to
+//			be, and checks that both find the same values in the same order.
+//
+// $NoKeywords: $
+//=============================================================================//
+
+#include "vrad.h"
+#include "lightmap.h"
+#include "utlhash.h"
+#include "tier0/platform.h"
+
+
+#define BENCH_PASSES			3
+#define BENCH_OLD_NUM_BUCKETS	65536
+
+
+//-----------------------------------------------------------------------------
+// The old tables: one CUtlHash node per voxel, keyed on x * 100, y * 10 and z
+// packed into shorts, each with its own vector of values.
+//-----------------------------------------------------------------------------
+template< class T >
+struct OldSampleData_t
+{
+	unsigned short	x, y, z;
+	CUtlVector< T >	m_Values;
+};
+
+template< class T >
+static bool OldSampleData_CompareFunc( OldSampleData_t<T> const &src1, OldSampleData_t<T> const &src2 )
+{
+	return ( ( src1.x == src2.x ) &&
+		     ( src1.y == src2.y ) &&
+			 ( src1.z == src2.z ) );
+}
+
+template< class T >
+static unsigned int OldSampleData_KeyFunc( OldSampleData_t<T> const &src )
+{
+	return ( src.x + src.y + src.z );
+}
+
+template< class T >
+static void OldSampleData_Add( CUtlHash< OldSampleData_t<T> > &table, int x, int y, int z, T value )
+{
+	OldSampleData_t<T> data;
+	data.x = x * 100;
+	data.y = y * 10;
+	data.z = z;
+
+	UtlHashHandle_t handle = table.Find( data );
+	if ( handle == table.InvalidHandle() )
+	{
+		handle = table.AllocEntryFromKey( data );
+		OldSampleData_t<T> *pData = &table.Element( handle );
+		pData->x = data.x;
+		pData->y = data.y;
+		pData->z = data.z;
+	}
+	table.Element( handle ).m_Values.AddToTail( value );
+}
+
+template< class T >
+static int OldSampleData_Find( CUtlHash< OldSampleData_t<T> > &table, int x, int y, int z, const T **ppValues )
+{
+	OldSampleData_t<T> data;
+	data.x = x * 100;
+	data.y = y * 10;
+	data.z = z;
+
+	UtlHashHandle_t handle = table.Find( data );
+	if ( handle == table.InvalidHandle() )
+		return 0;
+
+	OldSampleData_t<T> *pData = &table.Element( handle );
+	*ppValues = pData->m_Values.Base();
+	return pData->m_Values.Count();
+}
+
+
+//-----------------------------------------------------------------------------
+// What goes into a hash, in the order vrad adds it.
+//-----------------------------------------------------------------------------
+template< class T >
+struct BenchPair_t
+{
+	int	x, y, z;
+	T	value;
+};
+
+static double BestTime( double flBest, double flTime )
+{
+	return ( flBest < 0 || flTime < flBest ) ? flTime : flBest;
+}
+
+template< class T >
+static void BenchmarkHash( const char *pszName, const CUtlVector< BenchPair_t<T> > &pairs )
+{
+	if ( !pairs.Count() )
+	{
+		Msg( "%s: nothing to hash\n", pszName );
+		return;
+	}
+
+	double flOldBuild = -1, flNewBuild = -1, flOldQuery = -1, flNewQuery = -1;
+	int nQueries = 0, nFound = 0;
+	bool bMatch = true;
+	for ( int nPass = 0; nPass < BENCH_PASSES; nPass++ )
+	{
+		CUtlHash< OldSampleData_t<T> > oldTable( BENCH_OLD_NUM_BUCKETS, 0, 0, OldSampleData_CompareFunc<T>, OldSampleData_KeyFunc<T> );
+		CSampleHash<T> newTable;
+
+		double flStart = Plat_FloatTime();
+		for ( int i = 0; i < pairs.Count(); i++ )
+		{
+			OldSampleData_Add( oldTable, pairs[i].x, pairs[i].y, pairs[i].z, pairs[i].value );
+		}
+		flOldBuild = BestTime( flOldBuild, Plat_FloatTime() - flStart );
+
+		flStart = Plat_FloatTime();
+		newTable.SetPairCount( pairs.Count() );
+		for ( int i = 0; i < pairs.Count(); i++ )
+		{
+			newTable.SetPair( i, pairs[i].x, pairs[i].y, pairs[i].z, pairs[i].value );
+		}
+		newTable.Build();
+		flNewBuild = BestTime( flNewBuild, Plat_FloatTime() - flStart );
+
+		// Gathers look at the voxels around a luxel, so query the 3x3x3
+		// block of voxels around everything that went in.
+		const T *pValues;
+		unsigned int nOldSum = 0;
+		flStart = Plat_FloatTime();
+		for ( int i = 0; i < pairs.Count(); i++ )
+		{
+			for ( int dz = -1; dz <= 1; dz++ )
+			for ( int dy = -1; dy <= 1; dy++ )
+			for ( int dx = -1; dx <= 1; dx++ )
+			{
+				int nCount = OldSampleData_Find( oldTable, pairs[i].x + dx, pairs[i].y + dy, pairs[i].z + dz, &pValues );
+				for ( int j = 0; j < nCount; j++ )
+				{
+					nOldSum += (unsigned int)pValues[j];
+				}
+			}
+		}
+		flOldQuery = BestTime( flOldQuery, Plat_FloatTime() - flStart );
+
+		unsigned int nNewSum = 0;
+		flStart = Plat_FloatTime();
+		for ( int i = 0; i < pairs.Count(); i++ )
+		{
+			for ( int dz = -1; dz <= 1; dz++ )
+			for ( int dy = -1; dy <= 1; dy++ )
+			for ( int dx = -1; dx <= 1; dx++ )
+			{
+				int nCount = newTable.Find( pairs[i].x + dx, pairs[i].y + dy, pairs[i].z + dz, &pValues );
+				for ( int j = 0; j < nCount; j++ )
+				{
+					nNewSum += (unsigned int)pValues[j];
+				}
+			}
+		}
+		flNewQuery = BestTime( flNewQuery, Plat_FloatTime() - flStart );
+
+		if ( nPass == 0 )
+		{
+			bMatch = ( nOldSum == nNewSum );
+
+			// Lighting is summed in the order the values come back, so the
+			// lists have to match exactly, not just hold the same values.
+			nQueries = pairs.Count() * 27;
+			for ( int i = 0; i < pairs.Count() && bMatch; i++ )
+			{
+				for ( int dz = -1; dz <= 1; dz++ )
+				for ( int dy = -1; dy <= 1; dy++ )
+				for ( int dx = -1; dx <= 1; dx++ )
+				{
+					const T *pOldValues = NULL, *pNewValues = NULL;
+					int x = pairs[i].x + dx, y = pairs[i].y + dy, z = pairs[i].z + dz;
+					int nOldCount = OldSampleData_Find( oldTable, x, y, z, &pOldValues );
+					int nNewCount = newTable.Find( x, y, z, &pNewValues );
+					if ( nOldCount != nNewCount || ( nOldCount && memcmp( pOldValues, pNewValues, nOldCount * sizeof( T ) ) ) )
+					{
+						bMatch = false;
+					}
+					nFound += nNewCount;
+				}
+			}
+		}
+	}
+
+	flOldBuild = MAX( flOldBuild, 1.0e-6 );
+	flNewBuild = MAX( flNewBuild, 1.0e-6 );
+	flOldQuery = MAX( flOldQuery, 1.0e-6 );
+	flNewQuery = MAX( flNewQuery, 1.0e-6 );
+
+	Msg( "%s: %d values\n", pszName, pairs.Count() );
+	Msg( "  build  CUtlHash %.3f s, CSampleHash %.3f s (%.1fx)\n", flOldBuild, flNewBuild, flOldBuild / flNewBuild );
+	Msg( "  query  CUtlHash %.1f M/sec, CSampleHash %.1f M/sec (%.1fx), %d queries found %d values\n",
+		nQueries / ( flOldQuery * 1000000.0 ), nQueries / ( flNewQuery * 1000000.0 ), flOldQuery / flNewQuery, nQueries, nFound );
+	if ( bMatch )
+	{
+		Msg( "  both hashes find the same values in the same order\n" );
+	}
+	else
+	{
+		Warning( "  %s: CSampleHash doesn't match CUtlHash!\n", pszName );
+	}
+}
+
+
+//-----------------------------------------------------------------------------
+//-----------------------------------------------------------------------------
+void RunSampleHashBenchmark( void )
+{
+	Msg( "Sample hash benchmark\n" );
+
+	CUtlVector< BenchPair_t<SampleHandle_t> > samples;
+	for ( int ndxFace = 0; ndxFace < numfaces; ndxFace++ )
+	{
+		if ( texinfo[g_pFaces[ndxFace].texinfo].flags & TEX_SPECIAL )
+			continue;
+
+		facelight_t *pFaceLight = &facelight[ndxFace];
+		for ( int ndxSample = 0; ndxSample < pFaceLight->numsamples; ndxSample++ )
+		{
+			BenchPair_t<SampleHandle_t> &pair = samples[samples.AddToTail()];
+			GetSampleHashVoxel( pFaceLight->sample[ndxSample].pos, pair.x, pair.y, pair.z );
+			pair.value = ndxSample | ( ndxFace << 16 );
+		}
+	}
+	BenchmarkHash( "face samples", samples );
+
+	// Leaf patches, by their origins
+	CUtlVector< BenchPair_t<int> > patches;
+	for ( int ndxPatch = 0; ndxPatch < g_Patches.Count(); ndxPatch++ )
+	{
+		CPatch *pPatch = &g_Patches[ndxPatch];
+		if ( pPatch->child1 != g_Patches.InvalidIndex() )
+			continue;
+
+		BenchPair_t<int> &pair = patches[patches.AddToTail()];
+		GetSampleHashVoxel( pPatch->origin, pair.x, pair.y, pair.z );
+		pair.value = ndxPatch;
+	}
+	BenchmarkHash( "patches", patches );
+}
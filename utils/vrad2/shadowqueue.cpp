@@ -0,0 +1,234 @@
+//========= Copyright Valve Corporation, All rights reserved. ============//
+//
+// Purpose: Deferred, coherence-sorted shadow rays for direct lighting.
+//
+//=============================================================================//
+
+#include "vrad.h"
+#include "shadowqueue.h"
+
+
+// Origin cells are 64 units, 9 bits of morton code per axis covers +/-16k
+#define SHADOWQUEUE_CELL_SHIFT		6
+#define SHADOWQUEUE_CELL_BITS		9
+#define SHADOWQUEUE_CELL_BIAS		( 1 << ( SHADOWQUEUE_CELL_BITS - 1 ) )
+
+bool g_bShadowRayQueue = false;
+bool g_bShadowRayStats = false;
+
+static CShadowRayQueue g_ShadowRayQueues[MAX_TOOL_THREADS+1];
+
+struct ShadowRayStats_t
+{
+	int64		m_nRays[2];			// immediate, queued
+	CCycleCount	m_TraceTime[2];
+	char		m_Pad[32];			// keep the threads off each other's cache lines
+};
+
+static ShadowRayStats_t g_ShadowRayStats[MAX_TOOL_THREADS+1];
+
+
+CShadowRayQueue &GetShadowRayQueue( int iThread )
+{
+	return g_ShadowRayQueues[iThread];
+}
+
+
+//-----------------------------------------------------------------------------
+// Interleaves the low SHADOWQUEUE_CELL_BITS bits of the cell coordinates of a point.
+//-----------------------------------------------------------------------------
+static uint64 CellMortonCode( Vector const &vecPoint )
+{
+	uint64 nCode = 0;
+	for ( int nAxis = 0; nAxis < 3; nAxis++ )
+	{
+		int nCell = ( (int)floor( vecPoint[nAxis] ) >> SHADOWQUEUE_CELL_SHIFT ) + SHADOWQUEUE_CELL_BIAS;
+		nCell = clamp( nCell, 0, ( 1 << SHADOWQUEUE_CELL_BITS ) - 1 );
+		for ( int nBit = 0; nBit < SHADOWQUEUE_CELL_BITS; nBit++ )
+		{
+			if ( nCell & ( 1 << nBit ) )
+				nCode |= (uint64)1 << ( 3 * nBit + nAxis );
+		}
+	}
+	return nCode;
+}
+
+
+int CShadowRayQueue::AddRays( FourVectors const &start, FourVectors const &stop, int nLaneMask )
+{
+	int nHandle = m_FractionVisible.Count() / 4;
+	m_FractionVisible.AddMultipleToTail( 4 );
+	for ( int i = 0; i < 4; i++ )
+	{
+		m_FractionVisible[4 * nHandle + i] = 1.0f;
+		if ( !( nLaneMask & ( 1 << i ) ) )
+			continue;
+
+		ShadowRay_t &ray = m_Rays[m_Rays.AddToTail()];
+		ray.m_vecStart = start.Vec( i );
+		ray.m_vecStop = stop.Vec( i );
+		ray.m_nResult = 4 * nHandle + i;
+
+		Vector vecDelta = ray.m_vecStop - ray.m_vecStart;
+		uint64 nOctant = ( vecDelta.x < 0 ? 1 : 0 ) | ( vecDelta.y < 0 ? 2 : 0 ) | ( vecDelta.z < 0 ? 4 : 0 );
+		ray.m_nSortKey = ( nOctant << ( 6 * SHADOWQUEUE_CELL_BITS ) ) |
+			( CellMortonCode( ray.m_vecStart ) << ( 3 * SHADOWQUEUE_CELL_BITS ) ) |
+			CellMortonCode( ray.m_vecStop );
+	}
+	return nHandle;
+}
+
+
+fltx4 CShadowRayQueue::GetFractionVisible( int nHandle ) const
+{
+	return LoadUnalignedSIMD( &m_FractionVisible[4 * nHandle] );
+}
+
+
+void CShadowRayQueue::Reset()
+{
+	m_Rays.RemoveAll();
+	m_FractionVisible.RemoveAll();
+}
+
+
+// Ties keep queue order so the packets, and with them the results, are deterministic.
+int __cdecl CShadowRayQueue::CompareShadowRays( const ShadowRay_t *pRay1, const ShadowRay_t *pRay2 )
+{
+	if ( pRay1->m_nSortKey != pRay2->m_nSortKey )
+		return ( pRay1->m_nSortKey < pRay2->m_nSortKey ) ? -1 : 1;
+	return pRay1->m_nResult - pRay2->m_nResult;
+}
+
+
+//-----------------------------------------------------------------------------
+// Traces nRays (at most 4 * nGroups) sorted rays. Lanes past nRays repeat the last ray.
+//-----------------------------------------------------------------------------
+void CShadowRayQueue::TraceRayGroups( int nGroups, ShadowRay_t const **ppRays, int nRays, int static_prop_index_to_ignore )
+{
+	FourVectors starts[4], stops[4];
+	for ( int g = 0; g < nGroups; g++ )
+	{
+		ShadowRay_t const *pLanes[4];
+		for ( int i = 0; i < 4; i++ )
+			pLanes[i] = ppRays[ min( 4 * g + i, nRays - 1 ) ];
+		starts[g].LoadAndSwizzle( pLanes[0]->m_vecStart, pLanes[1]->m_vecStart, pLanes[2]->m_vecStart, pLanes[3]->m_vecStart );
+		stops[g].LoadAndSwizzle( pLanes[0]->m_vecStop, pLanes[1]->m_vecStop, pLanes[2]->m_vecStop, pLanes[3]->m_vecStop );
+	}
+
+	fltx4 fractionVisible[4];
+	if ( g_bTextureShadows || ( nGroups == 1 ) )
+	{
+		// the coverage callback only knows how to look at 4 rays
+		for ( int g = 0; g < nGroups; g++ )
+		{
+			fractionVisible[g] = Four_Ones;
+			TestLine( starts[g], stops[g], &fractionVisible[g], static_prop_index_to_ignore );
+		}
+	}
+	else
+	{
+		// same setup as TestLine, so each lane gets the same ray no matter which packet it lands in
+		FourRays myrays[4];
+		fltx4 len[4];
+		for ( int g = 0; g < nGroups; g++ )
+		{
+			myrays[g].origin = starts[g];
+			myrays[g].direction = stops[g];
+			myrays[g].direction -= myrays[g].origin;
+			len[g] = myrays[g].direction.length();
+			myrays[g].direction *= ReciprocalSIMD( len[g] );
+		}
+
+		RayTracingResult rt_result[4];
+		g_RtEnv.TraceRayPacket( nGroups, myrays, Four_Zeros, len, rt_result, TRACE_ID_STATICPROP | static_prop_index_to_ignore );
+
+		for ( int g = 0; g < nGroups; g++ )
+		{
+			float visibility[4];
+			for ( int i = 0; i < 4; i++ )
+			{
+				visibility[i] = 1.0f;
+				if ( ( rt_result[g].HitIds[i] != -1 ) &&
+					 ( SubFloat( rt_result[g].HitDistance, i ) < SubFloat( len[g], i ) ) )
+				{
+					visibility[i] = 0.0f;
+				}
+			}
+			fractionVisible[g] = LoadUnalignedSIMD( visibility );
+		}
+	}
+
+	for ( int r = 0; r < nRays; r++ )
+		m_FractionVisible[ppRays[r]->m_nResult] = SubFloat( fractionVisible[r >> 2], r & 3 );
+}
+
+
+void CShadowRayQueue::TraceQueuedRays( int iThread, int static_prop_index_to_ignore )
+{
+	int nRays = m_Rays.Count();
+	if ( !nRays )
+		return;
+
+	CFastTimer timer;
+	timer.Start();
+
+	m_Rays.Sort( CompareShadowRays );
+
+	// 16 at a time while there are enough left, so the AVX kernel gets full packets
+	ShadowRay_t const *pPacket[16];
+	int nDone = 0;
+	while ( nDone < nRays )
+	{
+		int nPacketRays = min( 16, nRays - nDone );
+		for ( int r = 0; r < nPacketRays; r++ )
+			pPacket[r] = &m_Rays[nDone + r];
+
+		if ( nPacketRays == 16 )
+		{
+			TraceRayGroups( 4, pPacket, 16, static_prop_index_to_ignore );
+		}
+		else
+		{
+			for ( int r = 0; r < nPacketRays; r += 4 )
+				TraceRayGroups( 1, pPacket + r, min( 4, nPacketRays - r ), static_prop_index_to_ignore );
+		}
+		nDone += nPacketRays;
+	}
+
+	timer.End();
+	if ( g_bShadowRayStats )
+	{
+		AddShadowRayStats( iThread, true, nRays, timer.GetDuration() );
+	}
+}
+
+
+void AddShadowRayStats( int iThread, bool bQueued, int nRays, CCycleCount const &traceTime )
+{
+	ShadowRayStats_t &stats = g_ShadowRayStats[iThread];
+	stats.m_nRays[bQueued] += nRays;
+	stats.m_TraceTime[bQueued] += traceTime;
+}
+
+
+void ReportShadowRayStats()
+{
+	static const char *s_pModeNames[2] = { "immediate", "queued" };
+	for ( int nMode = 0; nMode < 2; nMode++ )
+	{
+		int64 nRays = 0;
+		CCycleCount traceTime;
+		for ( int i = 0; i < MAX_TOOL_THREADS+1; i++ )
+		{
+			nRays += g_ShadowRayStats[i].m_nRays[nMode];
+			traceTime += g_ShadowRayStats[i].m_TraceTime[nMode];
+		}
+		if ( !nRays )
+			continue;
+
+		double flSeconds = traceTime.GetSeconds();
+		Msg( "Shadow rays (%s): %lld in %.2f thread-seconds (%.0f rays/sec per thread)\n",
+			s_pModeNames[nMode], nRays, flSeconds, nRays / max( flSeconds, 1.0e-6 ) );
+	}
+}
@@ -0,0 +1,70 @@
+//========= Copyright Valve Corporation, All rights reserved. ============//
+//
+// Purpose: Deferred, coherence-sorted shadow rays for direct lighting.
+//
+//=============================================================================//
+
+#ifndef SHADOWQUEUE_H
+#define SHADOWQUEUE_H
+#ifdef _WIN32
+#pragma once
+#endif
+
+#include "mathlib/ssemath.h"
+#include "tier0/fasttimer.h"
+#include "utlvector.h"
+
+
+// Set by -shadowqueue. BuildFacelights queues the shadow rays for point, spot and surface
+// lights and traces them once per face instead of 4 at a time as each light is gathered.
+extern bool g_bShadowRayQueue;
+
+
+//-----------------------------------------------------------------------------
+// Collects the shadow rays for one face against all of its lights, sorts them by direction
+// octant and origin cell and traces them as packets. Visibility is the same as TestLine's.
+// One per thread; see GetShadowRayQueue.
+//-----------------------------------------------------------------------------
+class CShadowRayQueue
+{
+public:
+	// Queues the rays from start to stop in the lanes set in nLaneMask (TestSignSIMD order).
+	// Returns the handle to pass to GetFractionVisible once the rays have been traced.
+	int AddRays( FourVectors const &start, FourVectors const &stop, int nLaneMask );
+
+	// Traces everything queued since the last Reset.
+	void TraceQueuedRays( int iThread, int static_prop_index_to_ignore = -1 );
+
+	// Lanes that weren't queued come back fully visible.
+	fltx4 GetFractionVisible( int nHandle ) const;
+
+	void Reset();
+
+private:
+	struct ShadowRay_t
+	{
+		Vector	m_vecStart;
+		Vector	m_vecStop;
+		uint64	m_nSortKey;		// octant, then start cell, then stop cell
+		int		m_nResult;		// index into m_FractionVisible
+	};
+
+	static int __cdecl CompareShadowRays( const ShadowRay_t *pRay1, const ShadowRay_t *pRay2 );
+	void TraceRayGroups( int nGroups, ShadowRay_t const **ppRays, int nRays, int static_prop_index_to_ignore );
+
+	CUtlVector<ShadowRay_t> m_Rays;
+	CUtlVector<float> m_FractionVisible;
+};
+
+CShadowRayQueue &GetShadowRayQueue( int iThread );
+
+// Set by -shadowraystats. Every visibility test for a point, spot or surface light is then
+// counted and timed, queued or not, so runs with and without -shadowqueue can be compared.
+// Callers check it before starting a timer.
+extern bool g_bShadowRayStats;
+
+void AddShadowRayStats( int iThread, bool bQueued, int nRays, CCycleCount const &traceTime );
+void ReportShadowRayStats();
+
+
+#endif // SHADOWQUEUE_H
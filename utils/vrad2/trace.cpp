@@ -220,6 +220,53 @@ void TestLine_IgnoreSky( const FourVectors& start, const FourVectors& stop,
 		*pFractionVisible = MinSIMD( *pFractionVisible, coverageCallback.GetFractionVisible() );
 }
 
+void TestLines_IgnoreSky( int nGroups, FourVectors const *pStarts, FourVectors const *pStops,
+						  fltx4 *pFractionVisible, int static_prop_index_to_ignore )
+{
+	Assert( nGroups == 2 || nGroups == 4 );
+
+	// the coverage callback only knows how to look at 4 rays
+	if ( g_bTextureShadows )
+	{
+		for ( int g = 0; g < nGroups; g++ )
+			TestLine_IgnoreSky( pStarts[g], pStops[g], &pFractionVisible[g], static_prop_index_to_ignore );
+		return;
+	}
+
+	FourRays myrays[4];
+	fltx4 len[4];
+	for ( int g = 0; g < nGroups; g++ )
+	{
+		myrays[g].origin = pStarts[g];
+		myrays[g].direction = pStops[g];
+		myrays[g].direction -= myrays[g].origin;
+		len[g] = myrays[g].direction.length();
+		myrays[g].direction *= ReciprocalSIMD( len[g] );
+	}
+
+	RayTracingResult rt_result[4];
+	g_RtEnv.TraceRayPacket( nGroups, myrays, Four_Zeros, len, rt_result, TRACE_ID_STATICPROP | static_prop_index_to_ignore );
+
+	for ( int g = 0; g < nGroups; g++ )
+	{
+		// Assume we can see the targets unless we get hits
+		float visibility[4];
+		for ( int i = 0; i < 4; i++ )
+		{
+			visibility[i] = 1.0f;
+			if ( ( rt_result[g].HitIds[i] != -1 ) &&
+				 ( SubFloat( rt_result[g].HitDistance, i ) < SubFloat( len[g], i ) ) )
+			{
+				int id = g_RtEnv.OptimizedTriangleList[rt_result[g].HitIds[i]].m_Data.m_IntersectData.m_nTriangleID;
+
+				if ( ( id & TRACE_ID_SKY ) == 0 )
+					visibility[i] = 0.0f;
+			}
+		}
+		pFractionVisible[g] = LoadUnalignedSIMD( visibility );
+	}
+}
+
 /*
 ================
 DM_ClipBoxToBrush
@@ -0,0 +1,295 @@
+//========= Copyright Valve Corporation, All rights reserved. ============//
+//
+// Purpose: On-disk cache of the patch-to-patch transfer lists.
+//
+// Building the transfers (BuildVisLeafs/MakeScales) depends only on the patches,
+// the ray tracing geometry and the PVS, none of which change when only entity
+// lighting is edited. Those inputs are hashed, and the scaled transfer lists are
+// written to <mapname>.vtc so that the next compile can map them back in.
+//
+//=============================================================================//
+
+#include "vrad.h"
+#include "transfercache.h"
+#include "packedtransfers.h"
+#include "tier1/checksum_crc.h"
+
+
+#define TRANSFERCACHE_ID		(('H'<<24)+('C'<<16)+('T'<<8)+'V')	// little-endian "VTCH"
+#define TRANSFERCACHE_VERSION	2
+
+struct TransferCacheHeader_t
+{
+	int		m_nId;
+	int		m_nVersion;
+	CRC32_t	m_GeometryCRC;		// Ray tracing triangles (world, displacements, props).
+	CRC32_t	m_PatchCRC;			// Patch layout, which captures the subdivision settings.
+	CRC32_t	m_VisCRC;			// Compressed PVS.
+	int		m_nPatches;
+	int		m_nTotalTransfers;
+	int		m_nMaxTransfer;
+
+	// Followed by int numtransfers[m_nPatches], then transfer_t transfers[m_nTotalTransfers].
+};
+
+
+bool g_bUseTransferCache = false;
+
+extern int total_transfer;
+extern int max_transfer;
+
+static HANDLE g_hTransferCacheFile = INVALID_HANDLE_VALUE;
+static HANDLE g_hTransferCacheMapping = NULL;
+static void const *g_pTransferCacheData = NULL;
+
+
+static void GetTransferCacheFilename( char *pOut, int nOutLen )
+{
+	Q_snprintf( pOut, nOutLen, "%s.vtc", source );
+}
+
+
+static CRC32_t ComputeGeometryCRC()
+{
+	CRC32_t crc;
+	CRC32_Init( &crc );
+
+	int nTriangles = g_RtEnv.OptimizedTriangleList.Count();
+	CRC32_ProcessBuffer( &crc, &nTriangles, sizeof( nTriangles ) );
+	for ( int i = 0; i < nTriangles; i++ )
+	{
+		CRC32_ProcessBuffer( &crc, &g_RtEnv.OptimizedTriangleList[i], sizeof( CacheOptimizedTriangle ) );
+	}
+
+	if ( g_RtEnv.TriangleMaterials.Count() )
+		CRC32_ProcessBuffer( &crc, g_RtEnv.TriangleMaterials.Base(), g_RtEnv.TriangleMaterials.Count() * sizeof( int32 ) );
+
+	CRC32_Final( &crc );
+	return crc;
+}
+
+
+static CRC32_t ComputePatchCRC()
+{
+	CRC32_t crc;
+	CRC32_Init( &crc );
+
+	int nPatches = g_Patches.Count();
+	CRC32_ProcessBuffer( &crc, &nPatches, sizeof( nPatches ) );
+	for ( int i = 0; i < nPatches; i++ )
+	{
+		CPatch *pPatch = &g_Patches[i];
+
+		CRC32_ProcessBuffer( &crc, &pPatch->origin, sizeof( pPatch->origin ) );
+		CRC32_ProcessBuffer( &crc, &pPatch->normal, sizeof( pPatch->normal ) );
+		CRC32_ProcessBuffer( &crc, &pPatch->planeDist, sizeof( pPatch->planeDist ) );
+		CRC32_ProcessBuffer( &crc, &pPatch->area, sizeof( pPatch->area ) );
+		CRC32_ProcessBuffer( &crc, &pPatch->faceNumber, sizeof( pPatch->faceNumber ) );
+		CRC32_ProcessBuffer( &crc, &pPatch->clusterNumber, sizeof( pPatch->clusterNumber ) );
+		CRC32_ProcessBuffer( &crc, &pPatch->parent, sizeof( pPatch->parent ) );
+		CRC32_ProcessBuffer( &crc, &pPatch->child1, sizeof( pPatch->child1 ) );
+		CRC32_ProcessBuffer( &crc, &pPatch->child2, sizeof( pPatch->child2 ) );
+		CRC32_ProcessBuffer( &crc, &pPatch->ndxNextParent, sizeof( pPatch->ndxNextParent ) );
+		CRC32_ProcessBuffer( &crc, &pPatch->ndxNextClusterChild, sizeof( pPatch->ndxNextClusterChild ) );
+
+		// FormFactorPolyToDiff uses the winding for close patches.
+		if ( pPatch->winding )
+		{
+			CRC32_ProcessBuffer( &crc, &pPatch->winding->numpoints, sizeof( pPatch->winding->numpoints ) );
+			CRC32_ProcessBuffer( &crc, pPatch->winding->p, pPatch->winding->numpoints * sizeof( Vector ) );
+		}
+
+		// MakeTransfer skips sky faces.
+		int bSky = pPatch->sky;
+		CRC32_ProcessBuffer( &crc, &bSky, sizeof( bSky ) );
+	}
+
+	CRC32_Final( &crc );
+	return crc;
+}
+
+
+static CRC32_t ComputeVisCRC()
+{
+	CRC32_t crc;
+	CRC32_Init( &crc );
+	CRC32_ProcessBuffer( &crc, &visdatasize, sizeof( visdatasize ) );
+	if ( visdatasize )
+		CRC32_ProcessBuffer( &crc, dvisdata, visdatasize );
+	CRC32_Final( &crc );
+	return crc;
+}
+
+
+static void BuildTransferCacheHeader( TransferCacheHeader_t &header )
+{
+	header.m_nId = TRANSFERCACHE_ID;
+	header.m_nVersion = TRANSFERCACHE_VERSION;
+	header.m_GeometryCRC = ComputeGeometryCRC();
+	header.m_PatchCRC = ComputePatchCRC();
+	header.m_VisCRC = ComputeVisCRC();
+	header.m_nPatches = g_Patches.Count();
+	header.m_nTotalTransfers = 0;
+	header.m_nMaxTransfer = 0;
+}
+
+
+bool LoadTransferCache()
+{
+	Assert( !g_pTransferCacheData );
+
+	char szFilename[MAX_PATH];
+	GetTransferCacheFilename( szFilename, sizeof( szFilename ) );
+
+	g_hTransferCacheFile = ::CreateFile( szFilename, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL );
+	if ( g_hTransferCacheFile == INVALID_HANDLE_VALUE )
+		return false;
+
+	double flStart = Plat_FloatTime();
+
+	DWORD dwSizeHigh = 0;
+	DWORD dwSize = ::GetFileSize( g_hTransferCacheFile, &dwSizeHigh );
+	if ( dwSizeHigh != 0 || dwSize < sizeof( TransferCacheHeader_t ) )
+	{
+		Warning( "Ignoring transfer cache %s: bad size\n", szFilename );
+		UnloadTransferCache();
+		return false;
+	}
+
+	g_hTransferCacheMapping = ::CreateFileMapping( g_hTransferCacheFile, NULL, PAGE_READONLY, 0, 0, NULL );
+	if ( g_hTransferCacheMapping )
+		g_pTransferCacheData = ::MapViewOfFile( g_hTransferCacheMapping, FILE_MAP_READ, 0, 0, 0 );
+
+	if ( !g_pTransferCacheData )
+	{
+		Warning( "Ignoring transfer cache %s: can't map it\n", szFilename );
+		UnloadTransferCache();
+		return false;
+	}
+
+	const TransferCacheHeader_t *pHeader = (const TransferCacheHeader_t *)g_pTransferCacheData;
+	if ( pHeader->m_nId != TRANSFERCACHE_ID || pHeader->m_nVersion != TRANSFERCACHE_VERSION )
+	{
+		Msg( "Transfer cache %s is out of date, rebuilding\n", szFilename );
+		UnloadTransferCache();
+		return false;
+	}
+
+	TransferCacheHeader_t expected;
+	BuildTransferCacheHeader( expected );
+	if ( pHeader->m_nPatches != expected.m_nPatches ||
+		 pHeader->m_GeometryCRC != expected.m_GeometryCRC ||
+		 pHeader->m_PatchCRC != expected.m_PatchCRC ||
+		 pHeader->m_VisCRC != expected.m_VisCRC )
+	{
+		Msg( "Transfer cache %s doesn't match this map, rebuilding\n", szFilename );
+		UnloadTransferCache();
+		return false;
+	}
+
+	const int *pCounts = (const int *)( pHeader + 1 );
+	const transfer_t *pTransfers = (const transfer_t *)( pCounts + pHeader->m_nPatches );
+	unsigned int nExpectedSize = sizeof( TransferCacheHeader_t ) + pHeader->m_nPatches * sizeof( int ) + pHeader->m_nTotalTransfers * sizeof( transfer_t );
+	if ( dwSize != nExpectedSize )
+	{
+		Warning( "Ignoring transfer cache %s: truncated\n", szFilename );
+		UnloadTransferCache();
+		return false;
+	}
+
+	// The transfers are only read by the bounce, so point straight into the mapping.
+	for ( int i = 0; i < pHeader->m_nPatches; i++ )
+	{
+		CPatch *pPatch = &g_Patches[i];
+		pPatch->numtransfers = pCounts[i];
+		pPatch->transfers = pCounts[i] ? const_cast<transfer_t *>( pTransfers ) : NULL;
+		pTransfers += pCounts[i];
+	}
+
+	total_transfer = pHeader->m_nTotalTransfers;
+	max_transfer = pHeader->m_nMaxTransfer;
+
+	Msg( "Loaded transfers from %s in %.2f seconds\n", szFilename, Plat_FloatTime() - flStart );
+	return true;
+}
+
+
+void SaveTransferCache()
+{
+	char szFilename[MAX_PATH];
+	GetTransferCacheFilename( szFilename, sizeof( szFilename ) );
+
+	FILE *fp = fopen( szFilename, "wb" );
+	if ( !fp )
+	{
+		Warning( "Can't write transfer cache %s\n", szFilename );
+		return;
+	}
+
+	TransferCacheHeader_t header;
+	BuildTransferCacheHeader( header );
+	header.m_nTotalTransfers = total_transfer;
+	header.m_nMaxTransfer = max_transfer;
+
+	// Write a zeroed header first so an interrupted save is never picked up as valid.
+	TransferCacheHeader_t blank;
+	memset( &blank, 0, sizeof( blank ) );
+	bool bOk = ( fwrite( &blank, sizeof( blank ), 1, fp ) == 1 );
+
+	int nPatches = g_Patches.Count();
+	for ( int i = 0; bOk && i < nPatches; i++ )
+	{
+		bOk = ( fwrite( &g_Patches[i].numtransfers, sizeof( int ), 1, fp ) == 1 );
+	}
+
+	CUtlVector<transfer_t> unpacked;
+	unpacked.SetCount( max_transfer );
+	for ( int i = 0; bOk && i < nPatches; i++ )
+	{
+		CPatch *pPatch = &g_Patches[i];
+		if ( pPatch->numtransfers )
+		{
+			const transfer_t *pTransfers = GetPatchTransfers( pPatch, THREADINDEX_MAIN, unpacked.Base() );
+			bOk = ( fwrite( pTransfers, sizeof( transfer_t ), pPatch->numtransfers, fp ) == (size_t)pPatch->numtransfers );
+		}
+	}
+
+	if ( bOk )
+	{
+		fseek( fp, 0, SEEK_SET );
+		bOk = ( fwrite( &header, sizeof( header ), 1, fp ) == 1 );
+	}
+
+	fclose( fp );
+
+	if ( !bOk )
+	{
+		Warning( "Error writing transfer cache %s\n", szFilename );
+		remove( szFilename );
+		return;
+	}
+
+	Msg( "Wrote transfers to %s\n", szFilename );
+}
+
+
+void UnloadTransferCache()
+{
+	if ( g_pTransferCacheData )
+	{
+		::UnmapViewOfFile( g_pTransferCacheData );
+		g_pTransferCacheData = NULL;
+	}
+
+	if ( g_hTransferCacheMapping )
+	{
+		::CloseHandle( g_hTransferCacheMapping );
+		g_hTransferCacheMapping = NULL;
+	}
+
+	if ( g_hTransferCacheFile != INVALID_HANDLE_VALUE )
+	{
+		::CloseHandle( g_hTransferCacheFile );
+		g_hTransferCacheFile = INVALID_HANDLE_VALUE;
+	}
+}
@@ -0,0 +1,29 @@
+//========= Copyright Valve Corporation, All rights reserved. ============//
+//
+// Purpose: On-disk cache of the patch-to-patch transfer lists.
+//
+//=============================================================================//
+
+#ifndef TRANSFERCACHE_H
+#define TRANSFERCACHE_H
+#ifdef _WIN32
+#pragma once
+#endif
+
+
+// Set with -transfercache. The cache lives next to the BSP as <mapname>.vtc.
+extern bool g_bUseTransferCache;
+
+// If the cache file matches the current geometry, patches and PVS, point every
+// patch's transfer list into a read-only mapping of it and return true.
+// Must be called after the patches and the ray tracing environment are built.
+bool LoadTransferCache();
+
+// Write the transfer lists built by BuildVisMatrix out to the cache file.
+void SaveTransferCache();
+
+// Release the mapping. Patch transfer lists that came from the cache are invalid after this.
+void UnloadTransferCache();
+
+
+#endif // TRANSFERCACHE_H
@@ -8,6 +8,7 @@
 
 #include "vrad.h"
 #include "vmpi.h"
+#include "bitvec.h"
 #ifdef MPI
 #include "messbuf.h"
 static MessageBuffer mb;
@@ -151,10 +152,117 @@ void PvsForOrigin (Vector& org, byte *pvs)
 	if (visofs == -1)
 		Error ("visofs == -1");
 
+	const uint64 *pCachedPVS = GetClusterPVS( cluster );
+	if ( pCachedPVS )
+	{
+		memcpy( pvs, pCachedPVS, (dvis->numclusters+7)/8 );
+		return;
+	}
+
 	DecompressVis (&dvisdata[visofs], pvs);
 }
 
 
+//-----------------------------------------------------------------------------
+// PVS cache. Each cluster's row is decompressed the first time any thread
+// asks for it and shared from then on. Rows are bitsets of 64 bit words; on
+// the little endian machines vrad runs on they have the same layout as the
+// bytes DecompressVis writes.
+//-----------------------------------------------------------------------------
+#define PVS_CACHE_MAX_BYTES		( 256 * 1024 * 1024 )
+
+enum
+{
+	PVS_ROW_EMPTY = 0,
+	PVS_ROW_DECOMPRESSING,
+	PVS_ROW_READY
+};
+
+static uint64		*g_pPVSRows = NULL;
+static int volatile	*g_pPVSRowState = NULL;
+
+int PVSRowWords( void )
+{
+	// Always room for the (numclusters / 8) + 1 bytes a light's pvs has had
+	return ( dvis->numclusters / 64 ) + 1;
+}
+
+void InitPVSCache( void )
+{
+	FreePVSCache();
+
+	if ( !visdatasize || dvis->numclusters <= 0 )
+		return;
+
+	size_t nBytes = (size_t)dvis->numclusters * PVSRowWords() * sizeof( uint64 );
+	if ( nBytes > PVS_CACHE_MAX_BYTES )
+	{
+		Warning( "PVS cache would need %d MB, decompressing the PVS as needed instead\n", (int)( nBytes / ( 1024 * 1024 ) ) );
+		return;
+	}
+
+	g_pPVSRows = (uint64 *)calloc( 1, nBytes );
+	g_pPVSRowState = (int volatile *)calloc( dvis->numclusters, sizeof( int ) );
+}
+
+void FreePVSCache( void )
+{
+	free( g_pPVSRows );
+	g_pPVSRows = NULL;
+
+	free( (void *)g_pPVSRowState );
+	g_pPVSRowState = NULL;
+}
+
+// Returns NULL if there is no cache, for clusters outside the world, and when
+// there is no vis data; callers fall back to DecompressVis.
+const uint64 *GetClusterPVS( int cluster )
+{
+	if ( !g_pPVSRows || cluster < 0 || cluster >= dvis->numclusters )
+		return NULL;
+
+	uint64 *pRow = g_pPVSRows + (size_t)cluster * PVSRowWords();
+	if ( g_pPVSRowState[cluster] != PVS_ROW_READY )
+	{
+		if ( ThreadInterlockedAssignIf( &g_pPVSRowState[cluster], PVS_ROW_DECOMPRESSING, PVS_ROW_EMPTY ) )
+		{
+			int visofs = dvis->bitofs[ cluster ][DVIS_PVS];
+			if ( visofs == -1 )
+				Error ("visofs == -1");
+
+			DecompressVis( &dvisdata[visofs], (byte *)pRow );
+			ThreadInterlockedExchange( &g_pPVSRowState[cluster], PVS_ROW_READY );
+			return pRow;
+		}
+
+		// Another thread is decompressing it
+		while ( g_pPVSRowState[cluster] != PVS_ROW_READY )
+		{
+			ThreadPause();
+		}
+	}
+
+	ThreadMemoryBarrier();
+	return pRow;
+}
+
+void MergePVS( uint64 *pDest, const uint64 *pSrc )
+{
+	int nWords = PVSRowWords();
+	int i = 0;
+	for ( ; i + 2 <= nWords; i += 2 )
+	{
+		fltx4 merged = OrSIMD( LoadUnalignedSIMD( pDest + i ), LoadUnalignedSIMD( pSrc + i ) );
+		StoreUnalignedSIMD( (float *)( pDest + i ), merged );
+	}
+
+	for ( ; i < nWords; i++ )
+	{
+		pDest[i] |= pSrc[i];
+	}
+}
+
+
 void TestPatchToPatch( int ndxPatch1, int ndxPatch2, int head, transfer_t *transfers, CTransferMaker &transferMaker, int iThread )
 {
 	Vector tmp;
@@ -296,6 +404,54 @@ void AddDispsToClusterTable( void )
 }
 
 
+//-----------------------------------------------------------------------------
+// Tests the patch against the faces and displacements in one cluster of its pvs
+//-----------------------------------------------------------------------------
+static void BuildVisCluster( int patchnum, CPatch *patch, int iCluster, byte *face_tested, byte *disp_tested, int head, transfer_t *transfers, CTransferMaker &transferMaker, int iThread )
+{
+	int		k, l, leafIndex;
+	dleaf_t	*leaf;
+
+	for ( leafIndex = 0; leafIndex < g_ClusterLeaves[iCluster].leafCount; leafIndex++ )
+	{
+		leaf = dleafs + g_ClusterLeaves[iCluster].leafs[leafIndex];
+
+		for (k=0 ; k<leaf->numleaffaces; k++)
+		{
+			l = dleaffaces[leaf->firstleafface + k];
+			// faces can be marksurfed by multiple leaves, but
+			// don't bother testing again
+			if (face_tested[l])
+			{
+				continue;
+			}
+			face_tested[l] = 1;
+
+			// don't check patches on the same face
+			if (patch->faceNumber == l)
+				continue;
+			TestPatchToFace (patchnum, l, head, transfers, transferMaker, iThread );
+		}
+	}
+
+	int dispCount = g_ClusterDispFaces[iCluster].dispFaces.Size();
+	for( int ndxDisp = 0; ndxDisp < dispCount; ndxDisp++ )
+	{
+		int ndxFace = g_ClusterDispFaces[iCluster].dispFaces[ndxDisp];
+		if( disp_tested[ndxFace] )
+			continue;
+
+		disp_tested[ndxFace] = 1;
+
+		// don't check patches on the same face
+		if( patch->faceNumber == ndxFace )
+			continue;
+
+		TestPatchToFace( patchnum, ndxFace, head, transfers, transferMaker, iThread );
+	}
+}
+
+
 /*
 ==============
 BuildVisRow
@@ -303,11 +459,10 @@ BuildVisRow
 Calc vis bits from a single patch
 ==============
 */
-void BuildVisRow (int patchnum, byte *pvs, int head, transfer_t *transfers, CTransferMaker &transferMaker, int iThread )
+void BuildVisRow (int patchnum, const uint64 *pvs, int head, transfer_t *transfers, CTransferMaker &transferMaker, int iThread )
 {
-	int		j, k, l, leafIndex;
+	int		j, iWord, iHalf;
 	CPatch	*patch;
-	dleaf_t	*leaf;
 	byte	face_tested[MAX_MAP_FACES];
 	byte	disp_tested[MAX_MAP_FACES];
 
@@ -316,50 +471,29 @@ void BuildVisRow (int patchnum, byte *pvs, int head, transfer_t *transfers, CTra
 	memset( face_tested, 0, numfaces ) ;
 	memset( disp_tested, 0, numfaces );
 
-	for (j=0; j<dvis->numclusters; j++)
+	int nWords = PVSRowWords();
+	for (iWord=0; iWord<nWords; iWord++)
 	{
-		if ( ! ( pvs[(j)>>3] & (1<<((j)&7)) ) )
+		if ( !pvs[iWord] )
 		{
-			continue;		// not in pvs
+			continue;		// none of these 64 clusters are in the pvs
 		}
 
-		for ( leafIndex = 0; leafIndex < g_ClusterLeaves[j].leafCount; leafIndex++ )
+		for (iHalf=0; iHalf<2; iHalf++)
 		{
-			leaf = dleafs + g_ClusterLeaves[j].leafs[leafIndex];
-
-			for (k=0 ; k<leaf->numleaffaces; k++)
+			unsigned int bits = (unsigned int)( pvs[iWord] >> ( iHalf * 32 ) );
+			while ( bits )
 			{
-				l = dleaffaces[leaf->firstleafface + k];
-				// faces can be marksurfed by multiple leaves, but
-				// don't bother testing again
-				if (face_tested[l])
+				j = FirstBitInWord( bits, iWord * 64 + iHalf * 32 );
+				bits &= bits - 1;
+				if ( j >= dvis->numclusters )
 				{
-					continue;
+					break;
 				}
-				face_tested[l] = 1;
 
-				// don't check patches on the same face
-				if (patch->faceNumber == l)
-					continue;
-				TestPatchToFace (patchnum, l, head, transfers, transferMaker, iThread );
+				BuildVisCluster( patchnum, patch, j, face_tested, disp_tested, head, transfers, transferMaker, iThread );
 			}
 		}
-
-		int dispCount = g_ClusterDispFaces[j].dispFaces.Size();
-		for( int ndxDisp = 0; ndxDisp < dispCount; ndxDisp++ )
-		{
-			int ndxFace = g_ClusterDispFaces[j].dispFaces[ndxDisp];
-			if( disp_tested[ndxFace] )
-				continue;
-
-			disp_tested[ndxFace] = 1;
-
-			// don't check patches on the same face
-			if( patch->faceNumber == ndxFace )
-				continue;
-
-			TestPatchToFace( patchnum, ndxFace, head, transfers, transferMaker, iThread );
-		}
 	}
 
 
@@ -390,12 +524,17 @@ void BuildVisLeafs_Cluster(
 	void (*PatchCB)(int iThread, int patchnum, CPatch *patch)
 	)
 {
-	byte	pvs[(MAX_MAP_CLUSTERS+7)/8];
+	uint64	pvsBuffer[(MAX_MAP_CLUSTERS/64)+1];
 	CPatch	*patch;
 	int		head;
 	unsigned	patchnum;
 	
-	DecompressVis( &dvisdata[ dvis->bitofs[ iCluster ][DVIS_PVS] ], pvs);
+	const uint64 *pvs = GetClusterPVS( iCluster );
+	if ( !pvs )
+	{
+		DecompressVis( &dvisdata[ dvis->bitofs[ iCluster ][DVIS_PVS] ], (byte *)pvsBuffer );
+		pvs = pvsBuffer;
+	}
 	head = 0;
 
 	CTransferMaker transferMaker( transfers );
@@ -16,6 +16,11 @@
 #include "macro_texture.h"
 #include "vmpi_tools_shared.h"
 #include "leaf_ambient_lighting.h"
+#include "facecost.h"
+#include "shadowqueue.h"
+#include "transfercache.h"
+#include "lightcache.h"
+#include "packedtransfers.h"
 #include "tools_minidump.h"
 #include "loadcmdline.h"
 #include "byteswap.h"
@@ -40,6 +45,11 @@ CUtlVector<int>			clusterChildren;
 CUtlVector<Vector>		emitlight;
 CUtlVector<bumplights_t>	addlight;
 
+int g_nBenchmarkBounces = 0;	// "-benchbounce" times this many gather passes before bouncing
+int g_nBenchmarkKDTreeTris = 0;	// "-benchkdtree" builds a synthetic soup of this many triangles
+bool g_bBenchmarkSampleHash = false;	// "-benchsamplehash" times the sample hashes against CUtlHash
+bool g_bUseTraceCache = false;	// "-tracecache" reuses the kd-tree saved in <mapname>.vrt
+
 int num_sky_cameras;
 sky_camera_t sky_cameras[MAX_MAP_AREAS];
 int area_sky_cameras[MAX_MAP_AREAS];
@@ -1200,10 +1210,6 @@ void MakeScales ( int ndxPatch, transfer_t *all_transfers )
 		}
 
 
-		patch->transfers = ( transfer_t* )calloc (1, patch->numtransfers * sizeof(transfer_t));
-		if (!patch->transfers)
-			Error ("Memory allocation failure");
-
 		// get total transfer energy
 		t2 = all_transfers;
 
@@ -1219,12 +1225,34 @@ void MakeScales ( int ndxPatch, transfer_t *all_transfers )
 		else
 			total = 1.0f/M_PI;
 
-		t = patch->transfers;
-		t2 = all_transfers;
-		for (j=0 ; j<patch->numtransfers ; j++, t++, t2++)
+		if ( g_bCompressTransfers && !g_bUseMPI )
+		{
+			// Scale in place and pack straight from the scratch list (VMPI workers
+			// send plain lists, the master packs them as they arrive).
+			t2 = all_transfers;
+			for (j=0 ; j<patch->numtransfers ; j++, t2++)
+			{
+				t2->transfer *= total;
+			}
+
+			PackPatchTransfers( patch, all_transfers, patch->numtransfers );
+		}
+		else
 		{
-			t->transfer = t2->transfer*total;
-			t->patch = t2->patch;
+			patch->transfers = ( transfer_t* )calloc (1, patch->numtransfers * sizeof(transfer_t));
+			if (!patch->transfers)
+				Error ("Memory allocation failure");
+
+			t = patch->transfers;
+			t2 = all_transfers;
+			for (j=0 ; j<patch->numtransfers ; j++, t++, t2++)
+			{
+				t->transfer = t2->transfer*total;
+				t->patch = t2->patch;
+			}
+
+			// GatherLight walks the list in patch order
+			SortTransfers( patch->transfers, patch->numtransfers );
 		}
 		if (patch->numtransfers > max_transfer)
 		{
@@ -1506,7 +1534,38 @@ void PreGetBumpNormalsForDisp( texinfo_t *pTexinfo, Vector &vecU, Vector &vecV,
 	vecV = vecTexV;
 }
 
-void GatherLight (int threadnum, void *pUserData)
+static void GetPatchBumpNormals( const CPatch *patch, Vector *normals )
+{
+	// Disps
+	bool bDisp = ( g_pFaces[patch->faceNumber].dispinfo != -1 );
+	if ( bDisp )
+	{
+		normals[0] = patch->normal;
+		texinfo_t *pTexinfo = &texinfo[g_pFaces[patch->faceNumber].texinfo];
+		Vector vecTexU, vecTexV;
+		PreGetBumpNormalsForDisp( pTexinfo, vecTexU, vecTexV, normals[0] );
+
+		// use facenormal along with the smooth normal to build the three bump map vectors
+		GetBumpNormals( vecTexU, vecTexV, normals[0], normals[0], &normals[1] );
+	}
+	else
+	{
+		GetPhongNormal( patch->faceNumber, patch->origin, normals[0] );
+
+		texinfo_t *pTexinfo = &texinfo[g_pFaces[patch->faceNumber].texinfo];
+		// use facenormal along with the smooth normal to build the three bump map vectors
+		GetBumpNormals( pTexinfo->textureVecsTexelsPerWorldUnits[0],
+			pTexinfo->textureVecsTexelsPerWorldUnits[1], patch->normal,
+			normals[0], &normals[1] );
+	}
+
+	// force the base lightmap to use the flat normal instead of the phong normal
+	// FIXME: why does the patch not use the phong normal?
+	normals[0] = patch->normal;
+}
+
+// Scalar version of GatherLight, kept as the reference for -benchbounce.
+static void GatherLightReference (int threadnum, void *pUserData)
 {
 	int			i, j, k;
 	transfer_t	*trans;
@@ -1514,6 +1573,13 @@ void GatherLight (int threadnum, void *pUserData)
 	CPatch		*patch;
 	Vector		sum, v;
 
+	// Packed transfer lists get decoded into here one patch at a time.
+	CUtlVector<transfer_t> unpacked;
+	if ( g_bCompressTransfers )
+	{
+		unpacked.SetCount( max_transfer );
+	}
+
 	while (1)
 	{
 		j = GetThreadWork ();
@@ -1522,40 +1588,14 @@ void GatherLight (int threadnum, void *pUserData)
 
 		patch = &g_Patches[j];
 
-		trans = patch->transfers;
+		trans = const_cast<transfer_t *>( GetPatchTransfers( patch, threadnum, unpacked.Base() ) );
 		num = patch->numtransfers;
 		if ( patch->needsBumpmap )
 		{
 			Vector delta;
 			Vector bumpSum[NUM_BUMP_VECTS+1];
 			Vector normals[NUM_BUMP_VECTS+1];
-
-			// Disps
-			bool bDisp = ( g_pFaces[patch->faceNumber].dispinfo != -1 );
-			if ( bDisp )
-			{
-				normals[0] = patch->normal;
-				texinfo_t *pTexinfo = &texinfo[g_pFaces[patch->faceNumber].texinfo];
-				Vector vecTexU, vecTexV;
-				PreGetBumpNormalsForDisp( pTexinfo, vecTexU, vecTexV, normals[0] );
-
-				// use facenormal along with the smooth normal to build the three bump map vectors
-				GetBumpNormals( vecTexU, vecTexV, normals[0], normals[0], &normals[1] );
-			}
-			else
-			{
-				GetPhongNormal( patch->faceNumber, patch->origin, normals[0] );
-
-				texinfo_t *pTexinfo = &texinfo[g_pFaces[patch->faceNumber].texinfo];
-				// use facenormal along with the smooth normal to build the three bump map vectors
-				GetBumpNormals( pTexinfo->textureVecsTexelsPerWorldUnits[0],
-					pTexinfo->textureVecsTexelsPerWorldUnits[1], patch->normal,
-					normals[0], &normals[1] );
-			}
-
-			// force the base lightmap to use the flat normal instead of the phong normal
-			// FIXME: why does the patch not use the phong normal?
-			normals[0] = patch->normal;
+			GetPatchBumpNormals( patch, normals );
 
 			for ( i = 0; i < NUM_BUMP_VECTS+1; i++ )
 			{
@@ -1619,6 +1659,277 @@ void GatherLight (int threadnum, void *pUserData)
 #endif
 
 
+//-----------------------------------------------------------------------------
+// SIMD bounce gather. The light each patch sends out (emitlight * reflectivity)
+// and the patch origins are kept in structure-of-arrays buffers so a batch of
+// four transfers turns into four scalar loads per component instead of walking
+// CPatch. Transfer lists are sorted by patch index, so consecutive batches
+// touch nearby entries and the loads ahead can be prefetched.
+//-----------------------------------------------------------------------------
+
+// How many transfers ahead of the current batch to prefetch.
+#define GATHER_PREFETCH_DISTANCE	16
+
+static CUtlVector<float> g_BounceRadiance[3];		// emitlight * reflectivity, rebuilt every bounce
+static CUtlVector<float> g_BounceOrigin[3];			// patch origins, for the bump direction
+
+static void BuildBounceOrigins()
+{
+	int nPatches = g_Patches.Count();
+	for ( int c = 0; c < 3; c++ )
+	{
+		g_BounceOrigin[c].SetCount( nPatches );
+		g_BounceRadiance[c].SetCount( nPatches );
+	}
+
+	for ( int i = 0; i < nPatches; i++ )
+	{
+		for ( int c = 0; c < 3; c++ )
+		{
+			g_BounceOrigin[c][i] = g_Patches[i].origin[c];
+		}
+	}
+}
+
+static void BuildBounceRadiance()
+{
+	int nPatches = g_Patches.Count();
+	for ( int i = 0; i < nPatches; i++ )
+	{
+		for ( int c = 0; c < 3; c++ )
+		{
+			g_BounceRadiance[c][i] = emitlight[i][c] * g_Patches[i].reflectivity[c];
+		}
+	}
+}
+
+static void FreeBounceBuffers()
+{
+	for ( int c = 0; c < 3; c++ )
+	{
+		g_BounceRadiance[c].Purge();
+		g_BounceOrigin[c].Purge();
+	}
+}
+
+FORCEINLINE fltx4 GatherSIMD( const float *pBase, const int *pIndices )
+{
+	ALIGN16 float flValues[4] ALIGN16_POST;
+	flValues[0] = pBase[pIndices[0]];
+	flValues[1] = pBase[pIndices[1]];
+	flValues[2] = pBase[pIndices[2]];
+	flValues[3] = pBase[pIndices[3]];
+	return LoadAlignedSIMD( flValues );
+}
+
+FORCEINLINE void PrefetchGather( const int *pIndices, bool bOrigins )
+{
+	for ( int c = 0; c < 3; c++ )
+	{
+		_mm_prefetch( (const char *)&g_BounceRadiance[c][pIndices[0]], _MM_HINT_T0 );
+		if ( bOrigins )
+			_mm_prefetch( (const char *)&g_BounceOrigin[c][pIndices[0]], _MM_HINT_T0 );
+	}
+}
+
+FORCEINLINE float HorizontalSumSIMD( const fltx4 &a )
+{
+	return SubFloat( a, 0 ) + SubFloat( a, 1 ) + SubFloat( a, 2 ) + SubFloat( a, 3 );
+}
+
+// Per-thread scratch holding a patch's transfers as separate index/value
+// arrays, padded to a multiple of 4 with zero-weight copies of the last transfer.
+class CGatherBatch
+{
+public:
+	void Init( int nMaxTransfers )
+	{
+		int nPadded = ( nMaxTransfers + 3 ) & ~3;
+		m_Indices.SetCount( nPadded );
+		m_Transfers.SetCount( nPadded );
+		m_Unpacked.SetCount( nMaxTransfers );
+	}
+
+	int Load( const CPatch *pPatch, int iThread )
+	{
+		const transfer_t *pTransfers = GetPatchTransfers( pPatch, iThread, m_Unpacked.Base() );
+		int nTransfers = pPatch->numtransfers;
+		for ( int k = 0; k < nTransfers; k++ )
+		{
+			m_Indices[k] = pTransfers[k].patch;
+			m_Transfers[k] = pTransfers[k].transfer;
+		}
+
+		int nPadded = ( nTransfers + 3 ) & ~3;
+		for ( int k = nTransfers; k < nPadded; k++ )
+		{
+			m_Indices[k] = pTransfers[nTransfers-1].patch;
+			m_Transfers[k] = 0.0f;
+		}
+		return nPadded;
+	}
+
+	CUtlVector<int> m_Indices;
+	CUtlVector<float> m_Transfers;
+	CUtlVector<transfer_t> m_Unpacked;
+};
+
+static void GatherPatchLightSIMD( CGatherBatch &batch, int nPadded, bumplights_t &out )
+{
+	const int *pIndices = batch.m_Indices.Base();
+	const float *pTransfers = batch.m_Transfers.Base();
+
+	FourVectors sum;
+	sum.x = sum.y = sum.z = Four_Zeros;
+	for ( int k = 0; k < nPadded; k += 4 )
+	{
+		if ( k + GATHER_PREFETCH_DISTANCE < nPadded )
+			PrefetchGather( pIndices + k + GATHER_PREFETCH_DISTANCE, false );
+
+		fltx4 flTransfer = LoadUnalignedSIMD( pTransfers + k );
+		sum.x = MaddSIMD( GatherSIMD( g_BounceRadiance[0].Base(), pIndices + k ), flTransfer, sum.x );
+		sum.y = MaddSIMD( GatherSIMD( g_BounceRadiance[1].Base(), pIndices + k ), flTransfer, sum.y );
+		sum.z = MaddSIMD( GatherSIMD( g_BounceRadiance[2].Base(), pIndices + k ), flTransfer, sum.z );
+	}
+
+	out.light[0].Init( HorizontalSumSIMD( sum.x ), HorizontalSumSIMD( sum.y ), HorizontalSumSIMD( sum.z ) );
+}
+
+static void GatherBumpPatchLightSIMD( const CPatch *patch, const Vector *pNormals, CGatherBatch &batch, int nPadded, bumplights_t &out )
+{
+	const int *pIndices = batch.m_Indices.Base();
+	const float *pTransfers = batch.m_Transfers.Base();
+
+	FourVectors origin;
+	origin.DuplicateVector( patch->origin );
+
+	FourVectors bumpSum[NUM_BUMP_VECTS+1];
+	for ( int i = 0; i < NUM_BUMP_VECTS+1; i++ )
+	{
+		bumpSum[i].x = bumpSum[i].y = bumpSum[i].z = Four_Zeros;
+	}
+
+	for ( int k = 0; k < nPadded; k += 4 )
+	{
+		if ( k + GATHER_PREFETCH_DISTANCE < nPadded )
+			PrefetchGather( pIndices + k + GATHER_PREFETCH_DISTANCE, true );
+
+		// get vector to other patch
+		FourVectors delta;
+		delta.x = GatherSIMD( g_BounceOrigin[0].Base(), pIndices + k );
+		delta.y = GatherSIMD( g_BounceOrigin[1].Base(), pIndices + k );
+		delta.z = GatherSIMD( g_BounceOrigin[2].Base(), pIndices + k );
+		delta -= origin;
+		delta.VectorNormalize();
+
+		// remove normal already factored into transfer steradian
+		fltx4 flScale = DivSIMD( LoadUnalignedSIMD( pTransfers + k ), delta * pNormals[0] );
+
+		FourVectors v;
+		v.x = MulSIMD( GatherSIMD( g_BounceRadiance[0].Base(), pIndices + k ), flScale );
+		v.y = MulSIMD( GatherSIMD( g_BounceRadiance[1].Base(), pIndices + k ), flScale );
+		v.z = MulSIMD( GatherSIMD( g_BounceRadiance[2].Base(), pIndices + k ), flScale );
+
+		for ( int i = 0; i < NUM_BUMP_VECTS+1; i++ )
+		{
+			fltx4 flDot = MaxSIMD( delta * pNormals[i], Four_Zeros );
+			bumpSum[i].x = MaddSIMD( v.x, flDot, bumpSum[i].x );
+			bumpSum[i].y = MaddSIMD( v.y, flDot, bumpSum[i].y );
+			bumpSum[i].z = MaddSIMD( v.z, flDot, bumpSum[i].z );
+		}
+	}
+
+	for ( int i = 0; i < NUM_BUMP_VECTS+1; i++ )
+	{
+		out.light[i].Init( HorizontalSumSIMD( bumpSum[i].x ), HorizontalSumSIMD( bumpSum[i].y ), HorizontalSumSIMD( bumpSum[i].z ) );
+	}
+}
+
+void GatherLight (int threadnum, void *pUserData)
+{
+	CGatherBatch batch;
+	batch.Init( max_transfer );
+
+	while (1)
+	{
+		int j = GetThreadWork ();
+		if (j == -1)
+			break;
+
+		CPatch *patch = &g_Patches[j];
+		if ( !patch->numtransfers )
+		{
+			int normalCount = patch->needsBumpmap ? NUM_BUMP_VECTS+1 : 1;
+			for ( int i = 0; i < normalCount; i++ )
+			{
+				VectorFill( addlight[j].light[i], 0 );
+			}
+			continue;
+		}
+
+		int nPadded = batch.Load( patch, threadnum );
+		if ( patch->needsBumpmap )
+		{
+			Vector normals[NUM_BUMP_VECTS+1];
+			GetPatchBumpNormals( patch, normals );
+			GatherBumpPatchLightSIMD( patch, normals, batch, nPadded, addlight[j] );
+		}
+		else
+		{
+			GatherPatchLightSIMD( batch, nPadded, addlight[j] );
+		}
+	}
+}
+
+
+//-----------------------------------------------------------------------------
+// Purpose: Times nBounces gather passes with the scalar and SIMD kernels on the
+//			current emitlight, and reports how far apart their results are.
+//			GatherLight only reads emitlight, so this doesn't disturb the bounce.
+//-----------------------------------------------------------------------------
+static void BenchmarkBounce( int nBounces )
+{
+	int uiPatchCount = g_Patches.Size();
+	BuildBounceRadiance();
+
+	Msg( "Benchmarking %d bounces over %d patches, %d transfers\n", nBounces, uiPatchCount, total_transfer );
+
+	double flStart = Plat_FloatTime();
+	for ( int i = 0; i < nBounces; i++ )
+	{
+		RunThreadsOn( uiPatchCount, false, GatherLightReference );
+	}
+	double flReferenceTime = Plat_FloatTime() - flStart;
+
+	CUtlVector<bumplights_t> reference;
+	reference.CopyArray( addlight.Base(), addlight.Count() );
+
+	flStart = Plat_FloatTime();
+	for ( int i = 0; i < nBounces; i++ )
+	{
+		RunThreadsOn( uiPatchCount, false, GatherLight );
+	}
+	double flSIMDTime = Plat_FloatTime() - flStart;
+
+	float flMaxError = 0;
+	for ( int i = 0; i < uiPatchCount; i++ )
+	{
+		int normalCount = g_Patches[i].needsBumpmap ? NUM_BUMP_VECTS+1 : 1;
+		for ( int j = 0; j < normalCount; j++ )
+		{
+			Vector vDelta = addlight[i].light[j] - reference[i].light[j];
+			float flMagnitude = max( 1.0f, reference[i].light[j].Length() );
+			flMaxError = max( flMaxError, vDelta.Length() / flMagnitude );
+		}
+	}
+
+	double flTransfers = (double)total_transfer * nBounces;
+	Msg( "  scalar: %.3f seconds per bounce, %.1f M transfers/sec\n", flReferenceTime / nBounces, flTransfers / flReferenceTime * 1e-6 );
+	Msg( "  SIMD  : %.3f seconds per bounce, %.1f M transfers/sec\n", flSIMDTime / nBounces, flTransfers / flSIMDTime * 1e-6 );
+	Msg( "  max relative difference: %g\n", flMaxError );
+}
+
+
 /*
 =============
 BounceLight
@@ -1640,11 +1951,21 @@ void BounceLight (void)
 		VectorFill( g_Patches[i].totallight.light[0], 0 );
 	}
 
+	BuildBounceOrigins();
+
+	if ( g_nBenchmarkBounces > 0 )
+	{
+		BenchmarkBounce( g_nBenchmarkBounces );
+	}
+
+	double flStart = Plat_FloatTime();
+
 	unsigned i = 0U;
 	while ( bouncing )
 	{
 		// transfer light from to the leaf patches from other patches via transfers
 		// this moves shooter->emitlight to receiver->addlight
+		BuildBounceRadiance();
 		RunThreadsOn (uiPatchCount, true, GatherLight);
 		// move newly received light (addlight) to light to be sent out (emitlight)
 		// start at children and pull light up to parents
@@ -1663,6 +1984,11 @@ void BounceLight (void)
 			WriteWorld (name, 0);
 		}
 	}
+
+	g_flBounceTime = Plat_FloatTime() - flStart;
+	g_nBounces = i;
+
+	FreeBounceBuffers();
 }
 
 
@@ -1730,6 +2056,7 @@ void RadWorld_Start()
 	MakeParents (0, -1);
 
 	BuildClusterTable();
+	InitPVSCache();
 
 	// turn each face into a single patch
 	MakePatches ();
@@ -1772,32 +2099,17 @@ void BuildFacesVisibleToLights( bool bAllVisible )
 	}
 
 	// First merge all the light PVSes.
-	CUtlVector<byte> aggregate;
-	aggregate.SetSize( (dvis->numclusters/8) + 1 );
-	memset( aggregate.Base(), 0, aggregate.Count() );
-
-	int nDWords = aggregate.Count() / 4;
-	int nBytes = aggregate.Count() - nDWords*4;
+	CUtlVector<uint64> aggregateWords;
+	aggregateWords.SetSize( PVSRowWords() );
+	memset( aggregateWords.Base(), 0, aggregateWords.Count() * sizeof( uint64 ) );
 
 	for( directlight_t *dl = activelights; dl != NULL; dl = dl->next )
 	{
-		byte *pIn  = dl->pvs;
-		byte *pOut = aggregate.Base();
-		for( int iDWord=0; iDWord < nDWords; iDWord++ )
-		{
-			*((unsigned long*)pOut) |= *((unsigned long*)pIn);
-			pIn  += 4;
-			pOut += 4;
-		}
-
-		for( int iByte=0; iByte < nBytes; iByte++ )
-		{
-			*pOut |= *pIn;
-			++pOut;
-			++pIn;
-		}
+		MergePVS( aggregateWords.Base(), (const uint64 *)dl->pvs );
 	}
 
+	const byte *aggregate = (const byte *)aggregateWords.Base();
+
 
 	// Now tag any faces that are visible to this monster PVS.
 	for( int iCluster=0; iCluster < dvis->numclusters; iCluster++ )
@@ -1848,16 +2160,44 @@ void BuildFacesVisibleToLights( bool bAllVisible )
 
 void MakeAllScales (void)
 {
-	// determine visibility between patches
-	BuildVisMatrix ();
+	// The transfers only depend on the patches, geometry and PVS, so reuse the last run's if they match.
+	if ( g_bUseTransferCache && !g_bUseMPI && LoadTransferCache() )
+	{
+		if ( g_bCompressTransfers )
+		{
+			// The cached lists live in the mapping, so pack copies and let it go.
+			PackAllTransfers( false );
+			UnloadTransferCache();
+		}
+	}
+	else
+	{
+		// determine visibility between patches
+		BuildVisMatrix ();
+
+		// release visibility matrix
+		FreeVisMatrix ();
+
+		// Lists built locally by a VMPI master still need packing.
+		if ( g_bCompressTransfers )
+		{
+			PackAllTransfers( true );
+		}
+
+		if ( g_bUseTransferCache && !g_bUseMPI )
+		{
+			SaveTransferCache();
+		}
+	}
 
-	// release visibility matrix
-	FreeVisMatrix ();
+	if ( g_bCompressTransfers && g_bStreamTransfers )
+	{
+		StreamPackedTransfers();
+	}
 
 	Msg("transfers %d, max %d\n", total_transfer, max_transfer );
 
-	Msg("transfer lists: %5.1f megs\n"
-		, (float)total_transfer * sizeof(transfer_t) / (1024*1024));
+	PrintTransferStats();
 }
 
 
@@ -1941,6 +2281,11 @@ bool RadWorld_Go()
 		// likely that all faces are going to be touched by at least one light so don't
 		// waste time here.
 		BuildFacesVisibleToLights( true );
+
+		if ( g_bUseLightCache )
+		{
+			LoadLightCache();
+		}
 	}
 
 	// build initial facelights
@@ -1949,10 +2294,25 @@ bool RadWorld_Go()
 		// RunThreadsOnIndividual (numfaces, true, BuildFacelights);
 		RunMPIBuildFacelights();
 	}
-	else
+	else if ( g_pIncremental )
 	{
 		RunThreadsOnIndividual (numfaces, true, BuildFacelights);
 	}
+	else
+	{
+		// Hand out the most expensive faces first so they don't straggle at the end. They
+		// have to come off one shared cursor: the per-thread ranges would give thread 0
+		// every expensive face.
+		BuildFacelightSchedule();
+		RunThreadsOnIndividualOrdered (numfaces, true, BuildScheduledFacelights);
+		ReportFacelightSchedule();
+	}
+	ReportShadowRayStats();
+
+	if ( g_bUseLightCache )
+	{
+		SaveLightCache();
+	}
 
 	// Was the process interrupted?
 	if( g_pIncremental && (g_iCurFace != numfaces) )
@@ -1996,13 +2356,18 @@ bool RadWorld_Go()
 		}
 
 		//
-		// displacement surface luxel accumulation (make threaded!!!)
+		// displacement surface luxel accumulation
 		//
 		StaticDispMgr()->StartTimer( "Build Patch/Sample Hash Table(s)....." );
 		StaticDispMgr()->InsertSamplesDataIntoHashTable();
 		StaticDispMgr()->InsertPatchSampleDataIntoHashTable();
 		StaticDispMgr()->EndTimer();
 
+		if ( g_bBenchmarkSampleHash && !g_bUseMPI )
+		{
+			RunSampleHashBenchmark();
+		}
+
 		// blend bounced light into direct light and save
 		VMPI_SetCurrentStage( "FinalLightFace" );
 		if ( !g_bUseMPI || g_bMPIMaster )
@@ -2104,6 +2469,7 @@ void VRAD_LoadBSP( char const *pFilename )
 
 	strcpy(incrementfile, source);
 	Q_DefaultExtension(incrementfile, ".r0", sizeof(incrementfile));
+
 	Q_DefaultExtension(source, ".bsp", sizeof( source ));
 
 	Msg( "Loading %s\n", source );
@@ -2194,10 +2560,34 @@ void VRAD_LoadBSP( char const *pFilename )
 	if ( g_bDumpRtEnv )
 		WriteRTEnv("trace.txt");
 
+	if ( g_nBenchmarkKDTreeTris > 0 )
+		RunRayTraceBenchmark( g_nBenchmarkKDTreeTris, 1 << 20, numthreads );
+
+	// The light cache needs every face lit by this process
+	if ( g_bUseLightCache && ( g_bUseMPI || g_pIncremental ) )
+	{
+		g_bUseLightCache = false;
+	}
+
+	if ( g_bUseLightCache )
+	{
+		HashLightCacheGeometry();
+	}
+
 	// Build acceleration structure
 	Msg( "Setting up ray-trace acceleration structure... " );
+	g_RtEnv.m_nBuildThreads = numthreads;
 	float start = Plat_FloatTime();
-	g_RtEnv.SetupAccelerationStructure();
+	if ( g_bUseTraceCache && !g_bUseMPI )
+	{
+		char szTraceCache[MAX_PATH];
+		Q_snprintf( szTraceCache, sizeof( szTraceCache ), "%s.vrt", source );
+		g_RtEnv.SetupAccelerationStructure( szTraceCache );
+	}
+	else
+	{
+		g_RtEnv.SetupAccelerationStructure();
+	}
 	float end = Plat_FloatTime();
 	Msg( "Done (%.2f seconds)\n", end - start );
 
@@ -2263,6 +2653,11 @@ void VRAD_Finish()
 	}
 
 	CloseDispLuxels();
+	FreePVSCache();
+
+	PrintTransferStats();
+	FreePackedTransfers();
+	UnloadTransferCache();
 
 	StaticPropMgr()->Shutdown();
 
@@ -2490,6 +2885,77 @@ int ParseCommandLine( int argc, char **argv, bool *onlydetail )
 		{
 			g_bLogHashData = true;
 		}
+		else if( !Q_stricmp( argv[i], "-benchbounce" ) )
+		{
+			if ( ++i < argc )
+			{
+				g_nBenchmarkBounces = atoi( argv[i] );
+				if ( g_nBenchmarkBounces <= 0 )
+				{
+					Warning("Error: expected a positive value after '-benchbounce'\n" );
+					return -1;
+				}
+			}
+			else
+			{
+				Warning("Error: expected a value after '-benchbounce'\n" );
+				return -1;
+			}
+		}
+		else if( !Q_stricmp( argv[i], "-benchkdtree" ) )
+		{
+			if ( ++i < argc )
+			{
+				g_nBenchmarkKDTreeTris = atoi( argv[i] );
+				if ( g_nBenchmarkKDTreeTris <= 0 )
+				{
+					Warning("Error: expected a positive value after '-benchkdtree'\n" );
+					return -1;
+				}
+			}
+			else
+			{
+				Warning("Error: expected a value after '-benchkdtree'\n" );
+				return -1;
+			}
+		}
+		else if( !Q_stricmp( argv[i], "-benchsamplehash" ) )
+		{
+			g_bBenchmarkSampleHash = true;
+		}
+		else if( !Q_stricmp( argv[i], "-compresstransfers" ) )
+		{
+			g_bCompressTransfers = true;
+		}
+		else if( !Q_stricmp( argv[i], "-streamtransfers" ) )
+		{
+			g_bCompressTransfers = true;
+			g_bStreamTransfers = true;
+		}
+		else if( !Q_stricmp( argv[i], "-transfercache" ) )
+		{
+			g_bUseTransferCache = true;
+		}
+		else if( !Q_stricmp( argv[i], "-lightcache" ) )
+		{
+			g_bUseLightCache = true;
+		}
+		else if( !Q_stricmp( argv[i], "-tracecache" ) )
+		{
+			g_bUseTraceCache = true;
+		}
+		else if( !Q_stricmp( argv[i], "-logfacecost" ) )
+		{
+			g_bLogFaceCost = true;
+		}
+		else if( !Q_stricmp( argv[i], "-shadowqueue" ) )
+		{
+			g_bShadowRayQueue = true;
+		}
+		else if( !Q_stricmp( argv[i], "-shadowraystats" ) )
+		{
+			g_bShadowRayStats = true;
+		}
 		else if( !Q_stricmp( argv[i], "-onlydetail" ) )
 		{
 			*onlydetail = true;
@@ -2772,6 +3238,31 @@ void PrintUsage( int argc, char **argv )
 		"                    The number specified should be less than 1.0 or it will be\n"
 		"                    inverted.\n"
 		"  -loghash        : Log the sample hash table to samplehash.txt.\n"
+		"  -benchbounce #  : Time # bounce gathers with the scalar and SIMD kernels\n"
+		"                    before bouncing.\n"
+		"  -benchkdtree #  : Build and trace a synthetic soup of # triangles with the\n"
+		"                    reference and binned kd-tree builders, and compare 4, 8\n"
+		"                    and 16 ray packets.\n"
+		"  -benchsamplehash : Time building and querying the displacement sample hashes\n"
+		"                    against the old CUtlHash tables, and check they match.\n"
+		"  -compresstransfers : Store bounce transfers as delta-coded indices with 16-bit\n"
+		"                    form factors to cut memory use on big maps.\n"
+		"  -streamtransfers : Like -compresstransfers, but page the transfers in from a\n"
+		"                    temporary file during the bounce.\n"
+		"  -transfercache  : Save patch transfers to <mapname>.vtc and reuse them on the\n"
+		"                    next compile if geometry, patches and PVS are unchanged.\n"
+		"  -tracecache     : Save the ray trace kd-tree to <mapname>.vrt and reuse it on\n"
+		"                    the next compile if the world, displacement and static prop\n"
+		"                    triangles are unchanged.\n"
+		"  -lightcache     : Save each face's direct lighting to <mapname>.vlc and on the\n"
+		"                    next compile only relight faces whose geometry changed or\n"
+		"                    that added, removed or edited lights can reach.\n"
+		"  -logfacecost    : Log predicted vs. measured direct lighting cost per face\n"
+		"                    to facecost.txt.\n"
+		"  -shadowqueue    : Queue each face's direct light shadow rays and trace them\n"
+		"                    sorted by direction and origin.\n"
+		"  -shadowraystats : Count and time direct light shadow rays, to compare runs\n"
+		"                    with and without -shadowqueue.\n"
 		"  -onlydetail     : Only light detail props and per-leaf lighting.\n"
 		"  -maxdispsamplesize #: Set max displacement sample size (default: 512).\n"
 		"  -softsun <n>    : Treat the sun as an area light source of size <n> degrees."
@@ -2827,6 +3318,26 @@ void PrintUsage( int argc, char **argv )
 #endif
 }
 
+//-----------------------------------------------------------------------------
+// vrad -benchbsp <bspfile> times loading the map with LoadBSPFile against
+// viewing its lumps in place, checks that both see the same data and exits.
+// It isn't a compile option, so it's kept out of ParseCommandLine.
+//-----------------------------------------------------------------------------
+static int RunBSPBenchmark( int argc, char **argv )
+{
+	CmdLib_InitFileSystem( argv[2] );
+
+	char szFileName[MAX_PATH];
+	Q_strncpy( szFileName, ExpandArg( argv[2] ), sizeof( szFileName ) );
+	Q_DefaultExtension( szFileName, ".bsp", sizeof( szFileName ) );
+	RunMappedBSPBenchmark( szFileName );
+
+	DeleteCmdLine( argc, argv );
+	CmdLib_Cleanup();
+	return 0;
+}
+
+
 int RunVRAD( int argc, char **argv )
 {
 #if defined(_MSC_VER) && ( _MSC_VER >= 1310 )
@@ -2839,6 +3350,11 @@ int RunVRAD( int argc, char **argv )
 
 	verbose = true;  // Originally FALSE
 
+	if ( ( argc == 3 ) && !Q_stricmp( argv[1], "-benchbsp" ) )
+	{
+		return RunBSPBenchmark( argc, argv );
+	}
+
 	bool onlydetail;
 	int i = ParseCommandLine( argc, argv, &onlydetail );
 	if (i == -1)
@@ -244,6 +244,11 @@ struct CPatch
 	int			numtransfers;
 	transfer_t	*transfers;
 
+	// -compresstransfers stores the list here instead of in transfers (see packedtransfers.h)
+	byte		*packedtransfers;	// NULL while streamed from the transfer file
+	int			packedsize;
+	float		packedscale;		// form factor of one quantization step
+
 	short		indices[3];				// displacement use these for subdivision
 };
 
@@ -372,6 +377,13 @@ void BuildFacelights (int facenum, int threadnum);
 void PrecompLightmapOffsets();
 void FinalLightFace (int threadnum, int facenum);
 void PvsForOrigin (Vector& org, byte *pvs);
+
+// Shared cache of decompressed PVS rows, as bitsets of 64 bit words
+int PVSRowWords( void );
+void InitPVSCache( void );
+void FreePVSCache( void );
+const uint64 *GetClusterPVS( int cluster );
+void MergePVS( uint64 *pDest, const uint64 *pSrc );
 void ConvertRGBExp32ToRGBA8888( const ColorRGBExp32 *pSrc, unsigned char *pDst, Vector* _optOutLinear = NULL );
 void ConvertRGBExp32ToLinear(const ColorRGBExp32 *pSrc, Vector* pDst);
 void ConvertLinearToRGBA8888( const Vector *pSrc, unsigned char *pDst );
@@ -396,6 +408,9 @@ void TestLine( FourVectors const& start, FourVectors const& stop, fltx4 *pFracti
 
 void TestLine_IgnoreSky( FourVectors const& start, FourVectors const& stop, fltx4 *pFractionVisible, int static_prop_index_to_ignore = -1 );
 
+// TestLine_IgnoreSky on 2 or 4 sets of rays at once, traced as one wide packet when the cpu can
+void TestLines_IgnoreSky( int nGroups, FourVectors const *pStarts, FourVectors const *pStops, fltx4 *pFractionVisible, int static_prop_index_to_ignore = -1 );
+
 // returns 1 if the ray sees the sky, 0 if it doesn't, and in-between values for partial coverage
 void TestLine_DoesHitSky( FourVectors const& start, FourVectors const& stop,
                           fltx4 *pFractionVisible, bool canRecurse = true, int static_prop_to_skip=-1, bool bDoDebug = false );
@@ -558,32 +573,7 @@ inline bool ValidDispFace( dface_t *pFace )
 	return true;
 }
 
-#define SAMPLEHASH_VOXEL_SIZE			64.0f
-typedef unsigned int SampleHandle_t;				// the upper 16 bits = facelight index (works because max face are 65536)
-													// the lower 16 bits = sample index inside of facelight
-struct sample_t;
-struct SampleData_t
-{
-	unsigned short				x, y, z;
-	CUtlVector<SampleHandle_t>	m_Samples;
-};
-
-struct PatchSampleData_t
-{
-	unsigned short				x, y, z;
-	CUtlVector<int>				m_ndxPatches;
-};
-
-UtlHashHandle_t SampleData_AddSample( sample_t *pSample, SampleHandle_t sampleHandle );
-void PatchSampleData_AddSample( CPatch *pPatch, int ndxPatch );
-unsigned short IncrementPatchIterationKey();
-void SampleData_Log( void );
-
-extern CUtlHash<SampleData_t>		g_SampleHashTable;
-extern CUtlHash<PatchSampleData_t>	g_PatchSampleHashTable;
-
-extern int samplesAdded;
-extern int patchSamplesAdded;
+#include "samplehash.h"
 
 //-----------------------------------------------------------------------------
 // Computes lighting for the detail props